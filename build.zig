@@ -104,6 +104,23 @@ pub fn build(b: *std.Build) void {
         .optimize = optimize,
     });
 
+    // ==========================================================================
+    // Build options (-Dlog-level, -Dshim-log-level, -Dgl-validation)
+    // ==========================================================================
+    // Log levels are fixed at compile time; messages below them are not
+    // compiled in. Shim scopes (webgl*) trace every call and draw, so they
+    // default to warnings only outside Debug builds.
+    const log_level = b.option(std.log.Level, "log-level", "Most verbose log level compiled in (default: debug in Debug builds, info otherwise)") orelse
+        if (optimize == .Debug) std.log.Level.debug else std.log.Level.info;
+    const shim_log_level = b.option(std.log.Level, "shim-log-level", "Most verbose log level compiled in for the webgl* shim scopes (default: debug in Debug builds, warn otherwise)") orelse
+        if (optimize == .Debug) std.log.Level.debug else std.log.Level.warn;
+    const gl_validation = b.option(bool, "gl-validation", "Poll glGetError after each draw's direct GL calls (default: on in Debug builds)") orelse
+        (optimize == .Debug);
+    const build_options = b.addOptions();
+    build_options.addOption(std.log.Level, "log_level", log_level);
+    build_options.addOption(std.log.Level, "shim_log_level", shim_log_level);
+    build_options.addOption(bool, "gl_validation", gl_validation);
+
     // ==========================================================================
     // Library module (for tests and reuse)
     // ==========================================================================
@@ -117,6 +134,7 @@ pub fn build(b: *std.Build) void {
         },
     });
     mod.linkLibrary(sokol_dep.artifact("sokol_clib"));
+    mod.addOptions("build_options", build_options);
 
     // Add mquickjs include paths to module for @cImport
     mod.addIncludePath(generated_include);
@@ -141,6 +159,7 @@ pub fn build(b: *std.Build) void {
     });
 
     exe.linkLibrary(mquickjs_lib);
+    exe.root_module.addOptions("build_options", build_options);
 
     // Link sokol
     exe.root_module.linkLibrary(sokol_dep.artifact("sokol_clib"));
@@ -157,6 +176,92 @@ pub fn build(b: *std.Build) void {
     const es5_step = b.step("three-es5", "Build the Three.js ES5 bundle");
     es5_step.dependOn(&npm_build_es5.step);
 
+    // ==========================================================================
+    // Asset archive (zig build pack-assets -Dasset-dir=<dir>)
+    // ==========================================================================
+    const asset_dir = b.option([]const u8, "asset-dir", "Directory packed by the pack-assets step (default: examples)") orelse "examples";
+    const asset_store = b.option(bool, "asset-store", "Store archive entries without LZ4 compression") orelse false;
+    const pack_assets = b.addExecutable(.{
+        .name = "pack_assets",
+        .root_module = b.createModule(.{
+            .root_source_file = b.path("src/pack_assets.zig"),
+            .target = b.graph.host,
+            .optimize = .ReleaseSafe,
+        }),
+    });
+    const pack_cmd = b.addRunArtifact(pack_assets);
+    pack_cmd.addDirectoryArg(.{ .cwd_relative = asset_dir });
+    const asset_pak = pack_cmd.addOutputFileArg("assets.pak");
+    if (asset_store) pack_cmd.addArg("--store");
+    // Directory contents are not part of the cache key; always repack
+    pack_cmd.has_side_effects = true;
+
+    const pack_step = b.step("pack-assets", "Pack an asset directory into zig-out/assets.pak");
+    pack_step.dependOn(&b.addInstallFile(asset_pak, "assets.pak").step);
+
+    // ==========================================================================
+    // Bytecode bundle (zig build bytecode -Dbytecode-scripts=<entry.js,...>)
+    // ==========================================================================
+    // Compiled by the host executable, so this step needs a native target.
+    const bytecode_scripts = b.option([]const u8, "bytecode-scripts", "Comma-separated scripts for the bytecode step, entry first (default: examples/creating-a-scene.js,examples/three.es5.js)") orelse "examples/creating-a-scene.js,examples/three.es5.js";
+    const compile_cmd = b.addRunArtifact(exe);
+    compile_cmd.addArg("--compile-bytecode");
+    const scripts_bundle = compile_cmd.addOutputFileArg("scripts.jsbc");
+    // Script names are the paths as given, relative to the project root
+    var script_names = std.mem.splitScalar(u8, bytecode_scripts, ',');
+    while (script_names.next()) |script| compile_cmd.addArg(script);
+    compile_cmd.setCwd(b.path("."));
+    compile_cmd.step.dependOn(es5_step);
+    // Script contents are not part of the cache key; always recompile
+    compile_cmd.has_side_effects = true;
+
+    const bytecode_step = b.step("bytecode", "Precompile scripts into zig-out/scripts.jsbc");
+    bytecode_step.dependOn(&b.addInstallFile(scripts_bundle, "scripts.jsbc").step);
+
+    // ==========================================================================
+    // Benchmarks (zig build bench -Doptimize=ReleaseFast)
+    // ==========================================================================
+    // Each scene runs for a fixed number of frames in a window with the
+    // profiler recording; reports land in zig-out/bench/<scene>.json next
+    // to micro.json from the microbenchmarks.
+    const bench_scenes = b.option([]const u8, "bench-scenes", "Comma-separated scenes for the bench step (default: examples/creating-a-scene.js,examples/textured-cube.js,examples/bench-stress.js)") orelse "examples/creating-a-scene.js,examples/textured-cube.js,examples/bench-stress.js";
+    const bench_frames = b.option([]const u8, "bench-frames", "Frames each bench scene runs for (default: 600)") orelse "600";
+    const bench_step = b.step("bench", "Run scene and micro benchmarks into zig-out/bench");
+
+    var bench_scene_paths = std.mem.splitScalar(u8, bench_scenes, ',');
+    while (bench_scene_paths.next()) |scene| {
+        const scene_cmd = b.addRunArtifact(exe);
+        scene_cmd.addArgs(&.{ "--heap-mb", "64", "--bench", bench_frames, "--bench-out" });
+        const report_name = b.fmt("{s}.json", .{std.fs.path.stem(scene)});
+        const report = scene_cmd.addOutputFileArg(report_name);
+        scene_cmd.addArg(scene);
+        scene_cmd.setCwd(b.path("."));
+        scene_cmd.step.dependOn(es5_step);
+        // Timings are the output; never reuse a cached run
+        scene_cmd.has_side_effects = true;
+        bench_step.dependOn(&b.addInstallFile(report, b.fmt("bench/{s}", .{report_name})).step);
+    }
+
+    const micro_bench = b.addExecutable(.{
+        .name = "three_native_bench",
+        .root_module = b.createModule(.{
+            .root_source_file = b.path("src/bench.zig"),
+            .target = target,
+            .optimize = optimize,
+            .imports = &.{
+                .{ .name = "three_native", .module = mod },
+                .{ .name = "sokol", .module = sokol_dep.module("sokol") },
+            },
+        }),
+    });
+    micro_bench.linkLibrary(mquickjs_lib);
+    micro_bench.root_module.linkLibrary(sokol_dep.artifact("sokol_clib"));
+    const micro_cmd = b.addRunArtifact(micro_bench);
+    micro_cmd.addArg("--out");
+    const micro_report = micro_cmd.addOutputFileArg("micro.json");
+    micro_cmd.has_side_effects = true;
+    bench_step.dependOn(&b.addInstallFile(micro_report, "bench/micro.json").step);
+
     // ==========================================================================
     // Run step
     // ==========================================================================
@@ -179,6 +284,8 @@ pub fn build(b: *std.Build) void {
     mod_tests.linkLibrary(mquickjs_lib);
 
     const run_mod_tests = b.addRunArtifact(mod_tests);
+    // Some tests read examples/ by path
+    run_mod_tests.setCwd(b.path("."));
 
     const test_step = b.step("test", "Run tests");
     test_step.dependOn(&run_mod_tests.step);
@@ -259,6 +259,8 @@ static const JSPropDef js_typed_array_base_proto[] = {
     JS_CFUNC_DEF("toString", 0, js_array_toString ),
     JS_CFUNC_DEF("subarray", 2, js_typed_array_subarray ),
     JS_CFUNC_DEF("set", 1, js_typed_array_set ),
+    JS_CFUNC_DEF("fill", 1, js_typed_array_fill ),
+    JS_CFUNC_DEF("copyWithin", 2, js_typed_array_copyWithin ),
     JS_PROP_END,
 };
 
@@ -335,6 +337,7 @@ static const JSPropDef js_gl[] = {
     JS_CFUNC_DEF("deleteBuffer", 1, js_gl_deleteBuffer),
     JS_CFUNC_DEF("bindBuffer", 2, js_gl_bindBuffer),
     JS_CFUNC_DEF("bufferData", 2, js_gl_bufferData),
+    JS_CFUNC_DEF("bufferSubData", 3, js_gl_bufferSubData),
     JS_CFUNC_DEF("createShader", 1, js_gl_createShader),
     JS_CFUNC_DEF("deleteShader", 1, js_gl_deleteShader),
     JS_CFUNC_DEF("shaderSource", 2, js_gl_shaderSource),
@@ -369,6 +372,8 @@ static const JSPropDef js_gl[] = {
     JS_CFUNC_DEF("texImage2D", 9, js_gl_texImage2D),
     JS_CFUNC_DEF("texSubImage2D", 9, js_gl_texSubImage2D),
     JS_CFUNC_DEF("texStorage2D", 5, js_gl_texStorage2D),
+    JS_CFUNC_DEF("compressedTexImage2D", 7, js_gl_compressedTexImage2D),
+    JS_CFUNC_DEF("compressedTexSubImage2D", 8, js_gl_compressedTexSubImage2D),
     JS_CFUNC_DEF("texImage3D", 10, js_gl_texImage3D),
     JS_CFUNC_DEF("texSubImage3D", 10, js_gl_texSubImage3D),
     JS_CFUNC_DEF("generateMipmap", 1, js_gl_generateMipmap),
@@ -382,6 +387,33 @@ static const JSPropDef js_gl[] = {
     JS_CFUNC_DEF("bindRenderbuffer", 2, js_gl_bindRenderbuffer),
     JS_CFUNC_DEF("renderbufferStorage", 4, js_gl_renderbufferStorage),
     JS_CFUNC_DEF("framebufferRenderbuffer", 4, js_gl_framebufferRenderbuffer),
+    JS_CFUNC_DEF("renderbufferStorageMultisample", 5, js_gl_renderbufferStorageMultisample),
+    JS_CFUNC_DEF("blitFramebuffer", 10, js_gl_blitFramebuffer),
+    JS_CFUNC_DEF("createQuery", 0, js_gl_createQuery),
+    JS_CFUNC_DEF("deleteQuery", 1, js_gl_deleteQuery),
+    JS_CFUNC_DEF("isQuery", 1, js_gl_isQuery),
+    JS_CFUNC_DEF("beginQuery", 2, js_gl_beginQuery),
+    JS_CFUNC_DEF("endQuery", 1, js_gl_endQuery),
+    JS_CFUNC_DEF("getQuery", 2, js_gl_getQuery),
+    JS_CFUNC_DEF("getQueryParameter", 2, js_gl_getQueryParameter),
+    JS_CFUNC_DEF("__queryCounter", 2, js_gl_queryCounter),
+    JS_CFUNC_DEF("readPixels", 7, js_gl_readPixels),
+    JS_CFUNC_DEF("getBufferSubData", 5, js_gl_getBufferSubData),
+    JS_CFUNC_DEF("fenceSync", 2, js_gl_fenceSync),
+    JS_CFUNC_DEF("deleteSync", 1, js_gl_deleteSync),
+    JS_CFUNC_DEF("isSync", 1, js_gl_isSync),
+    JS_CFUNC_DEF("clientWaitSync", 3, js_gl_clientWaitSync),
+    JS_CFUNC_DEF("waitSync", 3, js_gl_waitSync),
+    JS_CFUNC_DEF("getSyncParameter", 2, js_gl_getSyncParameter),
+    JS_CFUNC_DEF("__multiDrawArrays", 6, js_gl_multiDrawArrays),
+    JS_CFUNC_DEF("__multiDrawElements", 7, js_gl_multiDrawElements),
+    JS_CFUNC_DEF("__multiDrawArraysInstanced", 8, js_gl_multiDrawArraysInstanced),
+    JS_CFUNC_DEF("__multiDrawElementsInstanced", 9, js_gl_multiDrawElementsInstanced),
+    JS_CFUNC_DEF("bindBufferBase", 3, js_gl_bindBufferBase),
+    JS_CFUNC_DEF("bindBufferRange", 5, js_gl_bindBufferRange),
+    JS_CFUNC_DEF("getUniformBlockIndex", 2, js_gl_getUniformBlockIndex),
+    JS_CFUNC_DEF("uniformBlockBinding", 3, js_gl_uniformBlockBinding),
+    JS_CFUNC_DEF("getActiveUniformBlockParameter", 3, js_gl_getActiveUniformBlockParameter),
     JS_CFUNC_DEF("createVertexArray", 0, js_gl_createVertexArray),
     JS_CFUNC_DEF("deleteVertexArray", 1, js_gl_deleteVertexArray),
     JS_CFUNC_DEF("bindVertexArray", 1, js_gl_bindVertexArray),
@@ -412,6 +444,15 @@ static const JSPropDef js_gl[] = {
     JS_CFUNC_DEF("vertexAttribPointer", 6, js_gl_vertexAttribPointer),
     JS_CFUNC_DEF("drawArrays", 3, js_gl_drawArrays),
     JS_CFUNC_DEF("drawElements", 4, js_gl_drawElements),
+    JS_CFUNC_DEF("drawArraysInstanced", 4, js_gl_drawArraysInstanced),
+    JS_CFUNC_DEF("drawElementsInstanced", 5, js_gl_drawElementsInstanced),
+    JS_CFUNC_DEF("vertexAttribDivisor", 2, js_gl_vertexAttribDivisor),
+    JS_CFUNC_DEF("__warmPipelines", 0, js_gl_warmPipelines),
+    JS_CFUNC_DEF("__setPipelineCacheCapacity", 1, js_gl_setPipelineCacheCapacity),
+    JS_CFUNC_DEF("__getPipelineCacheStats", 0, js_gl_getPipelineCacheStats),
+    JS_CFUNC_DEF("__getCallStats", 0, js_gl_getCallStats),
+    JS_CFUNC_DEF("__resetCallStats", 0, js_gl_resetCallStats),
+    JS_CFUNC_DEF("__submit", 2, js_gl_submit),
     JS_CFUNC_DEF("getUniformLocation", 2, js_gl_getUniformLocation),
     JS_CFUNC_DEF("uniform1f", 2, js_gl_uniform1f),
     JS_CFUNC_DEF("uniform2f", 3, js_gl_uniform2f),
@@ -430,6 +471,9 @@ static const JSPropDef js_gl[] = {
     JS_CFUNC_DEF("uniform4fv", 2, js_gl_uniform4fv),
     JS_PROP_DOUBLE_DEF("ARRAY_BUFFER", 34962, 0 ),
     JS_PROP_DOUBLE_DEF("ELEMENT_ARRAY_BUFFER", 34963, 0 ),
+    JS_PROP_DOUBLE_DEF("STREAM_DRAW", 0x88E0, 0 ),
+    JS_PROP_DOUBLE_DEF("STATIC_DRAW", 0x88E4, 0 ),
+    JS_PROP_DOUBLE_DEF("DYNAMIC_DRAW", 0x88E8, 0 ),
     JS_PROP_DOUBLE_DEF("VERTEX_SHADER", 35633, 0 ),
     JS_PROP_DOUBLE_DEF("FRAGMENT_SHADER", 35632, 0 ),
     JS_PROP_DOUBLE_DEF("COMPILE_STATUS", 35713, 0 ),
@@ -510,6 +554,7 @@ static const JSPropDef js_gl[] = {
     JS_PROP_DOUBLE_DEF("RENDERER", 0x1F01, 0 ),
     JS_PROP_DOUBLE_DEF("MAX_TEXTURE_IMAGE_UNITS", 0x8872, 0 ),
     JS_PROP_DOUBLE_DEF("MAX_VERTEX_ATTRIBS", 0x8869, 0 ),
+    JS_PROP_DOUBLE_DEF("VERTEX_ATTRIB_ARRAY_DIVISOR", 0x88FE, 0 ),
     JS_PROP_DOUBLE_DEF("MAX_TEXTURE_SIZE", 0x0D33, 0 ),
     JS_PROP_DOUBLE_DEF("MAX_CUBE_MAP_TEXTURE_SIZE", 0x851C, 0 ),
     JS_PROP_DOUBLE_DEF("MAX_VERTEX_UNIFORM_VECTORS", 0x8DFB, 0 ),
@@ -538,6 +583,10 @@ static const JSPropDef js_gl[] = {
     JS_PROP_DOUBLE_DEF("SRGB8_ALPHA8", 0x8C43, 0 ),
     JS_PROP_DOUBLE_DEF("SRGB8", 0x8C41, 0 ),
     JS_PROP_DOUBLE_DEF("NO_ERROR", 0, 0 ),
+    JS_PROP_DOUBLE_DEF("INVALID_ENUM", 0x0500, 0 ),
+    JS_PROP_DOUBLE_DEF("INVALID_VALUE", 0x0501, 0 ),
+    JS_PROP_DOUBLE_DEF("INVALID_OPERATION", 0x0502, 0 ),
+    JS_PROP_DOUBLE_DEF("OUT_OF_MEMORY", 0x0505, 0 ),
     JS_PROP_DOUBLE_DEF("TEXTURE_2D", 0x0DE1, 0 ),
     JS_PROP_DOUBLE_DEF("TEXTURE_CUBE_MAP", 0x8513, 0 ),
     JS_PROP_DOUBLE_DEF("TEXTURE_3D", 0x806F, 0 ),
@@ -588,12 +637,72 @@ static const JSPropDef js_gl[] = {
     JS_PROP_DOUBLE_DEF("STENCIL_ATTACHMENT", 0x8D20, 0 ),
     JS_PROP_DOUBLE_DEF("DEPTH_STENCIL_ATTACHMENT", 0x821A, 0 ),
     JS_PROP_DOUBLE_DEF("DEPTH_STENCIL", 0x84F9, 0 ),
+    JS_PROP_DOUBLE_DEF("DRAW_FRAMEBUFFER", 0x8CA9, 0 ),
+    JS_PROP_DOUBLE_DEF("READ_FRAMEBUFFER", 0x8CA8, 0 ),
+    JS_PROP_DOUBLE_DEF("FRAMEBUFFER_INCOMPLETE_ATTACHMENT", 0x8CD6, 0 ),
+    JS_PROP_DOUBLE_DEF("FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT", 0x8CD7, 0 ),
+    JS_PROP_DOUBLE_DEF("FRAMEBUFFER_INCOMPLETE_DIMENSIONS", 0x8CD9, 0 ),
+    JS_PROP_DOUBLE_DEF("FRAMEBUFFER_UNSUPPORTED", 0x8CDD, 0 ),
+    JS_PROP_DOUBLE_DEF("FRAMEBUFFER_INCOMPLETE_MULTISAMPLE", 0x8D56, 0 ),
+    JS_PROP_DOUBLE_DEF("RENDERBUFFER_SAMPLES", 0x8CAB, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH_COMPONENT", 0x1902, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH_COMPONENT16", 0x81A5, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH_COMPONENT24", 0x81A6, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH_COMPONENT32F", 0x8CAC, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH24_STENCIL8", 0x88F0, 0 ),
+    JS_PROP_DOUBLE_DEF("DEPTH32F_STENCIL8", 0x8CAD, 0 ),
+    JS_PROP_DOUBLE_DEF("UNSIGNED_INT_24_8", 0x84FA, 0 ),
+    JS_PROP_DOUBLE_DEF("STENCIL_INDEX8", 0x8D48, 0 ),
+    JS_PROP_DOUBLE_DEF("RGBA4", 0x8056, 0 ),
+    JS_PROP_DOUBLE_DEF("RGB565", 0x8D62, 0 ),
+    JS_PROP_DOUBLE_DEF("RGB5_A1", 0x8057, 0 ),
+    JS_PROP_DOUBLE_DEF("ANY_SAMPLES_PASSED", 0x8C2F, 0 ),
+    JS_PROP_DOUBLE_DEF("ANY_SAMPLES_PASSED_CONSERVATIVE", 0x8D6A, 0 ),
+    JS_PROP_DOUBLE_DEF("CURRENT_QUERY", 0x8865, 0 ),
+    JS_PROP_DOUBLE_DEF("QUERY_RESULT", 0x8866, 0 ),
+    JS_PROP_DOUBLE_DEF("QUERY_RESULT_AVAILABLE", 0x8867, 0 ),
+    JS_PROP_DOUBLE_DEF("PIXEL_PACK_BUFFER", 0x88EB, 0 ),
+    JS_PROP_DOUBLE_DEF("UNIFORM_BUFFER", 0x8A11, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_VERTEX_UNIFORM_BLOCKS", 0x8A2B, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_FRAGMENT_UNIFORM_BLOCKS", 0x8A2D, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_COMBINED_UNIFORM_BLOCKS", 0x8A2E, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_UNIFORM_BUFFER_BINDINGS", 0x8A2F, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_UNIFORM_BLOCK_SIZE", 0x8A30, 0 ),
+    JS_PROP_DOUBLE_DEF("UNIFORM_BUFFER_OFFSET_ALIGNMENT", 0x8A34, 0 ),
+    JS_PROP_DOUBLE_DEF("ACTIVE_UNIFORM_BLOCKS", 0x8A36, 0 ),
+    JS_PROP_DOUBLE_DEF("UNIFORM_BLOCK_BINDING", 0x8A3F, 0 ),
+    JS_PROP_DOUBLE_DEF("INVALID_INDEX", 0xFFFFFFFF, 0 ),
+    JS_PROP_DOUBLE_DEF("STREAM_READ", 0x88E1, 0 ),
+    JS_PROP_DOUBLE_DEF("MAX_CLIENT_WAIT_TIMEOUT_WEBGL", 0x9247, 0 ),
+    JS_PROP_DOUBLE_DEF("OBJECT_TYPE", 0x9112, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_CONDITION", 0x9113, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_STATUS", 0x9114, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_FLAGS", 0x9115, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_FENCE", 0x9116, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_GPU_COMMANDS_COMPLETE", 0x9117, 0 ),
+    JS_PROP_DOUBLE_DEF("UNSIGNALED", 0x9118, 0 ),
+    JS_PROP_DOUBLE_DEF("SIGNALED", 0x9119, 0 ),
+    JS_PROP_DOUBLE_DEF("ALREADY_SIGNALED", 0x911A, 0 ),
+    JS_PROP_DOUBLE_DEF("TIMEOUT_EXPIRED", 0x911B, 0 ),
+    JS_PROP_DOUBLE_DEF("CONDITION_SATISFIED", 0x911C, 0 ),
+    JS_PROP_DOUBLE_DEF("WAIT_FAILED", 0x911D, 0 ),
+    JS_PROP_DOUBLE_DEF("SYNC_FLUSH_COMMANDS_BIT", 0x00000001, 0 ),
+    JS_PROP_DOUBLE_DEF("TEXTURE_COMPARE_MODE", 0x884C, 0 ),
+    JS_PROP_DOUBLE_DEF("TEXTURE_COMPARE_FUNC", 0x884D, 0 ),
+    JS_PROP_DOUBLE_DEF("COMPARE_REF_TO_TEXTURE", 0x884E, 0 ),
     JS_PROP_END,
 };
 
 static const JSClassDef js_gl_obj =
     JS_OBJECT_DEF("WebGLContext", js_gl);
 
+/* Finalized handles of native Web Audio nodes and buffers */
+static const JSClassDef js_audio_node_handle_class =
+    JS_CLASS_DEF("__AudioNodeHandle", 1, js_AudioNodeHandle, JS_CLASS_AUDIO_NODE_HANDLE, NULL, NULL, NULL, js_AudioNodeHandle_finalizer);
+
+static const JSClassDef js_audio_buffer_handle_class =
+    JS_CLASS_DEF("__AudioBufferHandle", 1, js_AudioBufferHandle, JS_CLASS_AUDIO_BUFFER_HANDLE, NULL, NULL, NULL, js_AudioBufferHandle_finalizer);
+
 static const JSPropDef js_global_object[] = {
     JS_PROP_CLASS_DEF("Object", &js_object_class),
     JS_PROP_CLASS_DEF("Function", &js_function_class),
@@ -653,10 +762,46 @@ static const JSPropDef js_global_object[] = {
     JS_CFUNC_DEF("__dom_getContext", 1, js_dom_getContext),
     JS_CFUNC_SPECIAL_DEF("Image", 2, constructor, js_Image),
     JS_CFUNC_DEF("__loadImage", 2, js_loadImage),
+    JS_CFUNC_DEF("__decodeImage", 3, js_decodeImage),
     JS_CFUNC_DEF("__freeImage", 1, js_freeImage),
-    JS_CFUNC_DEF("__nativeFetch", 1, js_nativeFetch),
-    JS_CFUNC_DEF("__getFetchBufferData", 1, js_getFetchBufferData),
-    JS_CFUNC_DEF("__freeFetchBuffer", 1, js_freeFetchBuffer),
+    JS_CFUNC_DEF("__audioInstall", 0, js_audioInstall),
+    JS_CFUNC_DEF("__audioOpen", 0, js_audioOpen),
+    JS_CFUNC_DEF("__audioClose", 0, js_audioClose),
+    JS_CFUNC_DEF("__audioSuspend", 1, js_audioSuspend),
+    JS_CFUNC_DEF("__audioTime", 0, js_audioTime),
+    JS_CFUNC_DEF("__audioCreateNode", 1, js_audioCreateNode),
+    JS_CFUNC_DEF("__audioConnect", 2, js_audioConnect),
+    JS_CFUNC_DEF("__audioDisconnect", 1, js_audioDisconnect),
+    JS_CFUNC_DEF("__audioParam", 6, js_audioParam),
+    JS_CFUNC_DEF("__audioParamValue", 2, js_audioParamValue),
+    JS_CFUNC_DEF("__audioConfig", 3, js_audioConfig),
+    JS_CFUNC_DEF("__audioStart", 5, js_audioStart),
+    JS_CFUNC_DEF("__audioStop", 2, js_audioStop),
+    JS_CFUNC_DEF("__audioCreateBuffer", 3, js_audioCreateBuffer),
+    JS_CFUNC_DEF("__audioBufferWrite", 4, js_audioBufferWrite),
+    JS_CFUNC_DEF("__audioBufferRead", 4, js_audioBufferRead),
+    JS_PROP_CLASS_DEF("__AudioNodeHandle", &js_audio_node_handle_class),
+    JS_PROP_CLASS_DEF("__AudioBufferHandle", &js_audio_buffer_handle_class),
+    JS_CFUNC_DEF("__decodeAudio", 2, js_decodeAudio),
+    JS_CFUNC_DEF("__fetchStart", 3, js_fetchStart),
+    JS_CFUNC_DEF("__fetchCancel", 1, js_fetchCancel),
+    JS_CFUNC_DEF("__getCoalescedEvents", 0, js_getCoalescedEvents),
+    JS_CFUNC_DEF("__gcStats", 0, js_gcStats),
+    JS_CFUNC_DEF("nativeRenderInfo", 0, js_nativeRenderInfo),
+    JS_CFUNC_DEF("__propertyCacheStats", 1, js_propertyCacheStats),
+    JS_CFUNC_DEF("__textDecode", 3, js_textDecode),
+    JS_CFUNC_DEF("__parseKtx2", 1, js_parseKtx2),
+    JS_CFUNC_DEF("__mat4Multiply", 4, js_mat4Multiply),
+    JS_CFUNC_DEF("__mat4Compose", 11, js_mat4Compose),
+    JS_CFUNC_DEF("__mat4ArrayMultiply", 3, js_mat4ArrayMultiply),
+    JS_CFUNC_DEF("__frustumIntersectSpheres", 3, js_frustumIntersectSpheres),
+    JS_CFUNC_DEF("__workerInstall", 0, js_workerInstall),
+    JS_CFUNC_DEF("__workerCreate", 3, js_workerCreate),
+    JS_CFUNC_DEF("__workerPost", 3, js_workerPost),
+    JS_CFUNC_DEF("__workerTerminate", 1, js_workerTerminate),
+    JS_CFUNC_DEF("__workerPostParent", 2, js_workerPostParent),
+    JS_CFUNC_DEF("__workerClose", 0, js_workerClose),
+    JS_CFUNC_DEF("__scheduleMicrotasks", 0, js_scheduleMicrotasks),
 #ifdef CONFIG_CLASS_EXAMPLE
     JS_PROP_CLASS_DEF("Rectangle", &js_rectangle_class),
     JS_PROP_CLASS_DEF("FilledRectangle", &js_filled_rectangle_class),
@@ -665,6 +810,8 @@ static const JSPropDef js_global_object[] = {
     JS_CFUNC_DEF("load", 1, js_load),
     JS_CFUNC_DEF("setTimeout", 2, js_setTimeout),
     JS_CFUNC_DEF("clearTimeout", 1, js_clearTimeout),
+    JS_CFUNC_DEF("setInterval", 2, js_setInterval),
+    JS_CFUNC_DEF("clearInterval", 1, js_clearTimeout),
 #endif
     JS_PROP_END,
 };
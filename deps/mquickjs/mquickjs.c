@@ -180,7 +180,9 @@ typedef struct JSROMClass {
     JSValue parent_class; /* JSROMClass or JS_NULL */
 } JSROMClass;
 
-#define N_ROM_ATOM_TABLES_MAX 2
+/* the stdlib plus one table per loaded bytecode image (a bundle holds
+   up to 8 scripts, see bytecode_bundle.zig) */
+#define N_ROM_ATOM_TABLES_MAX 9
 
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
@@ -201,6 +203,17 @@ typedef struct {
     uint32_t str_pos[2]; /* 0 = UTF-8 pos (in bytes), 1 = UTF-16 pos */
 } JSStringPosCacheEntry;
 
+/* property slot cache for get_field/put_field sites. An entry predicts
+   where a site's property sits in an object's property list; the
+   prediction is checked against the key stored there, so entries never
+   need invalidation. Objects built the same way share a layout, so one
+   entry serves every instance of a monomorphic site. */
+typedef struct {
+    const uint8_t *pc; /* operand address of the site, NULL if unused */
+    JSValue hash_mask; /* arr[1] of the property list the slot was found in */
+    uint32_t idx; /* JSValue index of the property in that list */
+} JSPropCacheEntry;
+
 struct JSContext {
     /* memory map:
        Stack
@@ -238,6 +251,15 @@ struct JSContext {
     void *opaque;
     JSValue *class_obj; /* same as class_proto + class_count */
     JSStringPosCacheEntry string_pos_cache[JS_STRING_POS_CACHE_SIZE];
+    JSPropCacheEntry *prop_cache; /* prop_cache_mask + 1 entries */
+    uint32_t prop_cache_mask;
+    uint64_t prop_cache_hits;
+    uint64_t prop_cache_misses;
+    JSPropCacheEntry prop_cache_default; /* used until JS_SetPropertyCache() */
+    JSGCHook *gc_hook; /* called around each GC, may be NULL */
+    uint32_t gc_count;
+    uint32_t gc_forced_count; /* GCs started by an allocation that did not fit */
+    size_t gc_live_size; /* heap size right after the last GC */
                                            
     /* must only contain JSValue from this point (see JS_GC()) */
     JSValue unique_strings; /* JSValueArray of sorted strings or JS_NULL */
@@ -506,6 +528,7 @@ static int check_free_mem(JSContext *ctx, JSValue *stack_bottom, uint32_t size)
     }
 #endif
     if (((uint8_t *)stack_bottom - ctx->heap_free) < size + ctx->min_free_size) {
+        ctx->gc_forced_count++;
         JS_GC(ctx);
         if (((uint8_t *)stack_bottom - ctx->heap_free) < size + ctx->min_free_size) {
             JS_ThrowOutOfMemory(ctx);
@@ -1223,6 +1246,118 @@ int JS_GetTypedArrayData(JSContext *ctx, JSValue val, uint8_t **pdata, size_t *p
     return 0;
 }
 
+#define JS_TYPED_ARRAY_COUNT (JS_CLASS_FLOAT64_ARRAY - JS_CLASS_UINT8C_ARRAY + 1)
+
+static uint8_t typed_array_size_log2[JS_TYPED_ARRAY_COUNT] = {
+    0, 0, 0, 1, 1, 2, 2, 2, 3
+};
+
+static inline BOOL js_class_is_typed_array(int class_id)
+{
+    return class_id >= JS_CLASS_UINT8C_ARRAY &&
+        class_id <= JS_CLASS_FLOAT64_ARRAY;
+}
+
+/* first element of the typed array 'p'. Only valid until the next
+   allocation. */
+static inline uint8_t *js_typed_array_data(JSObject *p)
+{
+    JSObject *pbuffer = JS_VALUE_TO_PTR(p->u.typed_array.buffer);
+    JSByteArray *arr = JS_VALUE_TO_PTR(pbuffer->u.array_buffer.byte_buffer);
+    return arr->buf + (p->u.typed_array.offset <<
+                       typed_array_size_log2[p->class_id - JS_CLASS_UINT8C_ARRAY]);
+}
+
+/* element 'idx' (< length) of the typed array 'p'. Can allocate for
+   float and 32 bit integer arrays. */
+static JSValue js_typed_array_get_element(JSContext *ctx, JSObject *p, uint32_t idx)
+{
+    uint8_t *buf = js_typed_array_data(p);
+    switch(p->class_id) {
+    default:
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        return JS_NewShortInt(*((uint8_t *)buf + idx));
+    case JS_CLASS_INT8_ARRAY:
+        return JS_NewShortInt(*((int8_t *)buf + idx));
+    case JS_CLASS_INT16_ARRAY:
+        return JS_NewShortInt(*((int16_t *)buf + idx));
+    case JS_CLASS_UINT16_ARRAY:
+        return JS_NewShortInt(*((uint16_t *)buf + idx));
+    case JS_CLASS_INT32_ARRAY:
+        return JS_NewInt32(ctx, *((int32_t *)buf + idx));
+    case JS_CLASS_UINT32_ARRAY:
+        return JS_NewUint32(ctx, *((uint32_t *)buf + idx));
+    case JS_CLASS_FLOAT32_ARRAY:
+        return JS_NewFloat64(ctx, *((float *)buf + idx));
+    case JS_CLASS_FLOAT64_ARRAY:
+        return JS_NewFloat64(ctx, *((double *)buf + idx));
+    }
+}
+
+/* store element 'idx' (< length) of the typed array 'p'. 'v' is the
+   value converted with ToInt32 (ToUint8Clamp for Uint8ClampedArray), 'd'
+   with ToNumber for float arrays. */
+static void js_typed_array_store(JSObject *p, uint32_t idx, int v, double d)
+{
+    uint8_t *buf = js_typed_array_data(p);
+    switch(p->class_id) {
+    default:
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        *((uint8_t *)buf + idx) = v;
+        break;
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+        *((uint16_t *)buf + idx) = v;
+        break;
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+        *((uint32_t *)buf + idx) = v;
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        *((float *)buf + idx) = d;
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        *((double *)buf + idx) = d;
+        break;
+    }
+}
+
+/* convert 'val' to the element type of 'p': 'v' for integer arrays,
+   'd' for float arrays. Can call JS code unless 'val' is a number. */
+static int js_typed_array_convert(JSContext *ctx, JSObject *p, int *pv,
+                                  double *pd, JSValue val)
+{
+    *pv = 0;
+    *pd = 0;
+    switch(p->class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+        return JS_ToUint8Clamp(ctx, pv, val);
+    case JS_CLASS_FLOAT32_ARRAY:
+    case JS_CLASS_FLOAT64_ARRAY:
+        return JS_ToNumber(ctx, pd, val);
+    default:
+        return JS_ToInt32(ctx, pv, val);
+    }
+}
+
+/* fast path for storing a number: the conversion cannot call JS code,
+   allocate or fail. Return FALSE if 'val' is not a number or 'idx' is
+   out of range. */
+static BOOL js_typed_array_put_number(JSContext *ctx, JSObject *p, uint32_t idx,
+                                      JSValue val)
+{
+    int v;
+    double d;
+    if (idx >= p->u.typed_array.len || !JS_IsNumber(ctx, val))
+        return FALSE;
+    js_typed_array_convert(ctx, p, &v, &d, val);
+    js_typed_array_store(p, idx, v, d);
+    return TRUE;
+}
+
 static JSObject *js_get_object_class(JSContext *ctx, JSValue val, int class_id)
 {
     if (!JS_IsPtr(val)) {
@@ -1450,6 +1585,28 @@ JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t len)
     return JS_VALUE_FROM_PTR(p);
 }
 
+/* The contents are left uninitialized: the caller writes 'len' bytes
+   of valid WTF-8 to *pbuf before the next allocation. The result must
+   not be a single character (use JS_NewStringLen() for short strings). */
+JSValue JS_NewStringUninitialized(JSContext *ctx, size_t len, JS_BOOL is_ascii,
+                                  uint8_t **pbuf)
+{
+    JSString *p;
+
+    if (len <= 4) {
+        *pbuf = NULL;
+        return JS_ThrowInternalError(ctx, "string too short");
+    }
+    p = js_alloc_string(ctx, len);
+    if (!p) {
+        *pbuf = NULL;
+        return JS_EXCEPTION;
+    }
+    p->is_ascii = (is_ascii != 0);
+    *pbuf = p->buf;
+    return JS_VALUE_FROM_PTR(p);
+}
+
 /* Warning: the string must be a valid UTF-8 string. */
 JSValue JS_NewString(JSContext *ctx, const char *buf)
 {
@@ -1472,7 +1629,7 @@ static JSValue js_byte_array_to_string(JSContext *ctx, JSValue val, int len, BOO
         js_shrink_byte_array(ctx, &val, len + 1);
         p = (JSString *)arr;
         p->mtag = JS_MTAG_STRING;
-        p->is_ascii = is_ascii;
+        p->is_ascii = (is_ascii != 0);
         p->is_unique = FALSE;
         p->is_numeric = FALSE;
         p->len = len;
@@ -2552,6 +2709,64 @@ static inline JSProperty *find_own_property(JSContext *ctx,
     return find_own_property_inlined(ctx, p, prop);
 }
 
+static force_inline JSPropCacheEntry *prop_cache_entry(JSContext *ctx,
+                                                       const uint8_t *pc)
+{
+    uint32_t h = (uint32_t)(uintptr_t)pc * 0x9e3779b1;
+    return &ctx->prop_cache[(h >> 16) & ctx->prop_cache_mask];
+}
+
+/* return the property at the slot cached for 'pc' if it holds 'prop'
+   in 'p', NULL otherwise. Equal hash masks mean the same slot grid, so
+   a matching key at the cached index is the property itself. */
+static force_inline JSProperty *prop_cache_find(JSPropCacheEntry *ce,
+                                                const uint8_t *pc,
+                                                JSObject *p, JSValue prop)
+{
+    JSValueArray *arr = JS_VALUE_TO_PTR(p->props);
+    JSProperty *pr;
+
+    if (ce->pc != pc || arr->arr[1] != ce->hash_mask ||
+        ce->idx + 3 > arr->size)
+        return NULL;
+    pr = (JSProperty *)&arr->arr[ce->idx];
+    if (pr->key != prop)
+        return NULL;
+    return pr;
+}
+
+static force_inline void prop_cache_update(JSPropCacheEntry *ce,
+                                           const uint8_t *pc,
+                                           JSObject *p, JSProperty *pr)
+{
+    JSValueArray *arr = JS_VALUE_TO_PTR(p->props);
+    ce->pc = pc;
+    ce->hash_mask = arr->arr[1];
+    ce->idx = (JSValue *)pr - arr->arr;
+}
+
+/* own property lookup for a get_field/put_field site */
+static force_inline JSProperty *find_own_property_cached(JSContext *ctx,
+                                                         JSPropCacheEntry *ce,
+                                                         const uint8_t *pc,
+                                                         JSObject *p,
+                                                         JSValue prop)
+{
+    JSProperty *pr;
+
+    pr = prop_cache_find(ce, pc, p, prop);
+    if (likely(pr)) {
+        ctx->prop_cache_hits++;
+        return pr;
+    }
+    pr = find_own_property_inlined(ctx, p, prop);
+    if (pr) {
+        ctx->prop_cache_misses++;
+        prop_cache_update(ce, pc, p, pr);
+    }
+    return pr;
+}
+
 static JSValue get_special_prop(JSContext *ctx, JSValue val)
 {
     int idx;
@@ -2633,37 +2848,11 @@ static JSValue JS_GetPropertyInternal(JSContext *ctx, JSValue obj, JSValue prop,
             } else if (JS_IsNumericProperty(ctx, prop)) {
                 return JS_UNDEFINED;
             }
-        } else if (p->class_id >= JS_CLASS_UINT8C_ARRAY &&
-                   p->class_id <= JS_CLASS_FLOAT64_ARRAY) {
+        } else if (js_class_is_typed_array(p->class_id)) {
             if (JS_IsInt(prop)) {
                 uint32_t idx = JS_VALUE_GET_INT(prop);
-                JSObject *pbuffer;
-                JSByteArray *arr;
-                if (idx < p->u.typed_array.len) {
-                    idx += p->u.typed_array.offset;
-                    pbuffer = JS_VALUE_TO_PTR(p->u.typed_array.buffer);
-                    arr = JS_VALUE_TO_PTR(pbuffer->u.array_buffer.byte_buffer);
-                    switch(p->class_id) {
-                    default:
-                    case JS_CLASS_UINT8C_ARRAY:
-                    case JS_CLASS_UINT8_ARRAY:
-                        return JS_NewShortInt(*((uint8_t *)arr->buf + idx));
-                    case JS_CLASS_INT8_ARRAY:
-                        return JS_NewShortInt(*((int8_t *)arr->buf + idx));
-                    case JS_CLASS_INT16_ARRAY:
-                        return JS_NewShortInt(*((int16_t *)arr->buf + idx));
-                    case JS_CLASS_UINT16_ARRAY:
-                        return JS_NewShortInt(*((uint16_t *)arr->buf + idx));
-                    case JS_CLASS_INT32_ARRAY:
-                        return JS_NewInt32(ctx, *((int32_t *)arr->buf + idx));
-                    case JS_CLASS_UINT32_ARRAY:
-                        return JS_NewUint32(ctx, *((uint32_t *)arr->buf + idx));
-                    case JS_CLASS_FLOAT32_ARRAY:
-                        return JS_NewFloat64(ctx, *((float *)arr->buf + idx));
-                    case JS_CLASS_FLOAT64_ARRAY:
-                        return JS_NewFloat64(ctx, *((double *)arr->buf + idx));
-                    }
-                }
+                if (idx < p->u.typed_array.len)
+                    return js_typed_array_get_element(ctx, p, idx);
             } else if (JS_IsNumericProperty(ctx, prop)) {
                 return JS_UNDEFINED;
             }
@@ -3277,30 +3466,18 @@ static JSValue JS_SetPropertyInternal(JSContext *ctx, JSValue this_obj,
         } else if (JS_IsNumericProperty(ctx, prop)) {
             goto invalid_array_subscript;
         }
-    } else if (p->class_id >= JS_CLASS_UINT8C_ARRAY &&
-               p->class_id <= JS_CLASS_FLOAT64_ARRAY) {
+    } else if (js_class_is_typed_array(p->class_id)) {
         if (JS_IsInt(prop)) {
             uint32_t idx = JS_VALUE_GET_INT(prop);
             int v, conv_ret;
             double d;
-            JSObject *pbuffer;
-            JSByteArray *arr;
             JSGCRef val_ref, this_obj_ref;
 
+            if (js_typed_array_put_number(ctx, p, idx, val))
+                return JS_UNDEFINED;
             JS_PUSH_VALUE(ctx, this_obj);
             JS_PUSH_VALUE(ctx, val);
-            switch(p->class_id) {
-            case JS_CLASS_UINT8C_ARRAY:
-                conv_ret = JS_ToUint8Clamp(ctx, &v, val);
-                break;
-            case JS_CLASS_FLOAT32_ARRAY:
-            case JS_CLASS_FLOAT64_ARRAY:
-                conv_ret = JS_ToNumber(ctx, &d, val);
-                break;
-            default:
-                conv_ret = JS_ToInt32(ctx, &v, val);
-                break;
-            }
+            conv_ret = js_typed_array_convert(ctx, p, &v, &d, val);
             JS_POP_VALUE(ctx, val);
             JS_POP_VALUE(ctx, this_obj);
             if (conv_ret)
@@ -3309,31 +3486,7 @@ static JSValue JS_SetPropertyInternal(JSContext *ctx, JSValue this_obj,
             p = JS_VALUE_TO_PTR(this_obj);
             if (idx >= p->u.typed_array.len)
                 goto invalid_array_subscript;
-            idx += p->u.typed_array.offset;
-            pbuffer = JS_VALUE_TO_PTR(p->u.typed_array.buffer);
-            arr = JS_VALUE_TO_PTR(pbuffer->u.array_buffer.byte_buffer);
-            switch(p->class_id) {
-            default:
-            case JS_CLASS_UINT8C_ARRAY:
-            case JS_CLASS_INT8_ARRAY:
-            case JS_CLASS_UINT8_ARRAY:
-                *((uint8_t *)arr->buf + idx) = v;
-                break;
-            case JS_CLASS_INT16_ARRAY:
-            case JS_CLASS_UINT16_ARRAY:
-                *((uint16_t *)arr->buf + idx) = v;
-                break;
-            case JS_CLASS_INT32_ARRAY:
-            case JS_CLASS_UINT32_ARRAY:
-                *((uint32_t *)arr->buf + idx) = v;
-                break;
-            case JS_CLASS_FLOAT32_ARRAY:
-                *((float *)arr->buf + idx) = d;
-                break;
-            case JS_CLASS_FLOAT64_ARRAY:
-                *((double *)arr->buf + idx) = d;
-                break;
-            }
+            js_typed_array_store(p, idx, v, d);
             return JS_UNDEFINED;
         } else if (JS_IsNumericProperty(ctx, prop)) {
         invalid_array_subscript:
@@ -3656,6 +3809,8 @@ JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDe
     ctx->write_func = dummy_write_func;
     for(i = 0; i < JS_STRING_POS_CACHE_SIZE; i++)
         ctx->string_pos_cache[i].str = JS_NULL;
+    ctx->prop_cache = &ctx->prop_cache_default;
+    ctx->prop_cache_mask = 0;
 
     if (prepare_compilation) {
         int atom_table_len;
@@ -3731,6 +3886,36 @@ JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDe
     return ctx;
 }
 
+void JS_SetPropertyCache(JSContext *ctx, void *buf, size_t buf_size)
+{
+    size_t n;
+
+    n = buf ? buf_size / sizeof(JSPropCacheEntry) : 0;
+    if (n == 0) {
+        ctx->prop_cache = &ctx->prop_cache_default;
+        ctx->prop_cache_mask = 0;
+    } else {
+        /* round down to a power of two */
+        while (n & (n - 1))
+            n &= n - 1;
+        ctx->prop_cache = buf;
+        ctx->prop_cache_mask = n - 1;
+    }
+    memset(ctx->prop_cache, 0, (ctx->prop_cache_mask + 1) * sizeof(JSPropCacheEntry));
+}
+
+void JS_GetPropertyCacheStats(JSContext *ctx, uint64_t *phits, uint64_t *pmisses)
+{
+    *phits = ctx->prop_cache_hits;
+    *pmisses = ctx->prop_cache_misses;
+}
+
+void JS_ResetPropertyCacheStats(JSContext *ctx)
+{
+    ctx->prop_cache_hits = 0;
+    ctx->prop_cache_misses = 0;
+}
+
 JSContext *JS_NewContext(void *mem_start, size_t mem_size, const JSSTDLibraryDef *stdlib_def)
 {
     return JS_NewContext2(mem_start, mem_size, stdlib_def, FALSE);
@@ -5937,13 +6122,14 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                     /* fast case */
                     JSObject *p = JS_VALUE_TO_PTR(obj);
                     JSProperty *pr;
+                    JSPropCacheEntry *ce;
                     if (unlikely(p->mtag != JS_MTAG_OBJECT))
                         goto get_field_slow;
+                    ce = prop_cache_entry(ctx, pc);
                     for(;;) {
                         /* no array check is necessary because 'prop' is
                            guaranteed not to be a numeric property */
-                        /* XXX: slow due to short ints */
-                        pr = find_own_property_inlined(ctx, p, prop);
+                        pr = find_own_property_cached(ctx, ce, pc, p, prop);
                         if (pr) {
                             if (unlikely(pr->prop_type != JS_PROP_NORMAL)) {
                                 /* sp[0] is this_obj, obj is the current
@@ -6040,8 +6226,8 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                         goto put_field_slow;
                     /* no array check is necessary because 'prop' is
                        guaranteed not to be a numeric property */
-                    /* XXX: slow due to short ints */
-                    pr = find_own_property_inlined(ctx, p, prop);
+                    pr = find_own_property_cached(ctx, prop_cache_entry(ctx, pc),
+                                                  pc, p, prop);
                     if (unlikely(!pr))
                         goto put_field_slow;
                     if (unlikely(pr->prop_type != JS_PROP_NORMAL))
@@ -6079,21 +6265,30 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                 JSValue prop = val, obj;
                 obj = sp[0];
                 if (JS_IsPtr(obj) && JS_IsInt(prop)) {
-                    /* fast case with array */
-                    /* XXX: optimize typed arrays too ? */
+                    /* fast case with array or typed array */
                     JSObject *p = JS_VALUE_TO_PTR(obj);
                     uint32_t idx;
                     JSValueArray *arr;
                     if (unlikely(p->mtag != JS_MTAG_OBJECT))
                         goto get_array_el_slow;
-                    if (unlikely(p->class_id != JS_CLASS_ARRAY))
-                        goto get_array_el_slow;
                     idx = JS_VALUE_GET_INT(prop);
-                    if (unlikely(idx >= p->u.array.len))
+                    if (p->class_id == JS_CLASS_ARRAY) {
+                        if (unlikely(idx >= p->u.array.len))
+                            goto get_array_el_slow;
+                        arr = JS_VALUE_TO_PTR(p->u.array.tab);
+                        val = arr->arr[idx];
+                    } else if (js_class_is_typed_array(p->class_id)) {
+                        if (unlikely(idx >= p->u.typed_array.len))
+                            goto get_array_el_slow;
+                        /* may allocate a float */
+                        SAVE();
+                        val = js_typed_array_get_element(ctx, p, idx);
+                        RESTORE();
+                        if (unlikely(JS_IsException(val)))
+                            goto exception;
+                    } else {
                         goto get_array_el_slow;
-                        
-                    arr = JS_VALUE_TO_PTR(p->u.array.tab);
-                    val = arr->arr[idx];
+                    }
                 } else {
                 get_array_el_slow:
                     SAVE();
@@ -6121,16 +6316,22 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                 obj = sp[2];
                 prop = sp[1];
                 if (JS_IsPtr(obj) && JS_IsInt(prop)) {
-                    /* fast case with array */
-                    /* XXX: optimize typed arrays too ? */
+                    /* fast case with array or typed array */
                     JSObject *p = JS_VALUE_TO_PTR(obj);
                     uint32_t idx;
                     JSValueArray *arr;
                     if (unlikely(p->mtag != JS_MTAG_OBJECT))
                         goto put_array_el_slow;
+                    idx = JS_VALUE_GET_INT(prop);
+                    if (js_class_is_typed_array(p->class_id)) {
+                        /* numbers only: other values may call JS code */
+                        if (unlikely(!js_typed_array_put_number(ctx, p, idx, sp[0])))
+                            goto put_array_el_slow;
+                        sp += 3;
+                        BREAK;
+                    }
                     if (unlikely(p->class_id != JS_CLASS_ARRAY))
                         goto put_array_el_slow;
-                    idx = JS_VALUE_GET_INT(prop);
                     arr = JS_VALUE_TO_PTR(p->u.array.tab);
                     if (unlikely(idx >= p->u.array.len)) {
                         if (idx == p->u.array.len &&
@@ -12511,6 +12712,8 @@ static void gc_compact_heap(JSContext *ctx)
 
 static void JS_GC2(JSContext *ctx, BOOL keep_atoms)
 {
+    if (ctx->gc_hook)
+        ctx->gc_hook(ctx->opaque, FALSE);
 #ifdef DUMP_GC
     js_printf(ctx, "GC   : heap size=%u/%u stack_size=%u\n",
            (uint32_t)(ctx->heap_free - ctx->heap_base),
@@ -12536,12 +12739,16 @@ static void JS_GC2(JSContext *ctx, BOOL keep_atoms)
 #endif
     gc_mark_all(ctx, keep_atoms);
     gc_compact_heap(ctx);
+    ctx->gc_count++;
+    ctx->gc_live_size = ctx->heap_free - ctx->heap_base;
 #ifdef DUMP_GC
     js_printf(ctx, "AFTER: heap size=%u/%u stack_size=%u\n",
            (uint32_t)(ctx->heap_free - ctx->heap_base),
            (uint32_t)(ctx->stack_top - ctx->heap_base),
            (uint32_t)(ctx->stack_top - (uint8_t *)ctx->sp));
 #endif
+    if (ctx->gc_hook)
+        ctx->gc_hook(ctx->opaque, TRUE);
 }
 
 void JS_GC(JSContext *ctx)
@@ -12549,6 +12756,22 @@ void JS_GC(JSContext *ctx)
     JS_GC2(ctx, TRUE);
 }
 
+void JS_SetGCHook(JSContext *ctx, JSGCHook *hook)
+{
+    ctx->gc_hook = hook;
+}
+
+void JS_GetMemoryInfo(JSContext *ctx, JSMemoryInfo *info)
+{
+    info->total_size = ctx->stack_top - ctx->heap_base;
+    info->heap_size = ctx->heap_free - ctx->heap_base;
+    info->stack_size = ctx->stack_top - (uint8_t *)ctx->sp;
+    info->free_size = (uint8_t *)ctx->stack_bottom - ctx->heap_free;
+    info->live_size = ctx->gc_live_size;
+    info->gc_count = ctx->gc_count;
+    info->gc_forced_count = ctx->gc_forced_count;
+}
+
 /* bytecode saving and loading */
 
 #define JS_BYTECODE_VERSION_32 0x0001
@@ -15169,12 +15392,6 @@ JSValue js_math_random(JSContext *ctx, JSValue *this_val,
 
 /* typed array */
 
-#define JS_TYPED_ARRAY_COUNT (JS_CLASS_FLOAT64_ARRAY - JS_CLASS_UINT8C_ARRAY + 1)
-
-static uint8_t typed_array_size_log2[JS_TYPED_ARRAY_COUNT] = {
-    0, 0, 0, 1, 1, 2, 2, 2, 3
-};
-
 static int JS_ToIndex(JSContext *ctx, uint64_t *plen, JSValue val)
 {
     int v;
@@ -15189,7 +15406,7 @@ static int JS_ToIndex(JSContext *ctx, uint64_t *plen, JSValue val)
     return 0;
 }
 
-JSValue js_array_buffer_alloc(JSContext *ctx, uint64_t len)
+static JSValue js_array_buffer_alloc2(JSContext *ctx, uint64_t len, int zero_fill)
 {
     JSByteArray *arr;
     JSValue buffer, obj;
@@ -15201,7 +15418,8 @@ JSValue js_array_buffer_alloc(JSContext *ctx, uint64_t len)
     arr = js_alloc_byte_array(ctx, len);
     if (!arr)
         return JS_EXCEPTION;
-    memset(arr->buf, 0, len);
+    if (zero_fill)
+        memset(arr->buf, 0, len);
     buffer = JS_VALUE_FROM_PTR(arr);
     JS_PUSH_VALUE(ctx, buffer);
     obj = JS_NewObjectClass(ctx, JS_CLASS_ARRAY_BUFFER, sizeof(JSArrayBuffer));
@@ -15213,6 +15431,18 @@ JSValue js_array_buffer_alloc(JSContext *ctx, uint64_t len)
     return obj;
 }
 
+JSValue js_array_buffer_alloc(JSContext *ctx, uint64_t len)
+{
+    return js_array_buffer_alloc2(ctx, len, TRUE);
+}
+
+/* The contents are left uninitialized: the caller fills them through
+   JS_GetArrayBufferData() before the next allocation. */
+JSValue JS_NewArrayBufferUninitialized(JSContext *ctx, size_t len)
+{
+    return js_array_buffer_alloc2(ctx, len, FALSE);
+}
+
 JSValue js_array_buffer_constructor(JSContext *ctx, JSValue *this_val,
                                     int argc, JSValue *argv)
 {
@@ -15442,23 +15672,15 @@ JSValue js_typed_array_set(JSContext *ctx, JSValue *this_val,
     p = JS_VALUE_TO_PTR(*this_val);
     dst_len = p->u.typed_array.len;
     p1 = JS_VALUE_TO_PTR(argv[0]);
-    if (p1->class_id >= JS_CLASS_UINT8C_ARRAY &&
-        p1->class_id <= JS_CLASS_FLOAT64_ARRAY) {
+    if (js_class_is_typed_array(p1->class_id)) {
         src_len = p1->u.typed_array.len;
         if (src_len > dst_len || offset > dst_len - src_len)
             goto range_error;
         if (p1->class_id == p->class_id) {
-            JSObject *src_buffer, *dst_buffer;
-            JSByteArray *src_arr, *dst_arr;
             int shift = typed_array_size_log2[p->class_id - JS_CLASS_UINT8C_ARRAY];
-            dst_buffer = JS_VALUE_TO_PTR(p->u.typed_array.buffer);
-            dst_arr = JS_VALUE_TO_PTR(dst_buffer->u.array_buffer.byte_buffer);
-            src_buffer = JS_VALUE_TO_PTR(p1->u.typed_array.buffer);
-            src_arr = JS_VALUE_TO_PTR(src_buffer->u.array_buffer.byte_buffer);
             /* same type: must copy to preserve float bits */
-            memmove(dst_arr->buf + ((p->u.typed_array.offset + offset) << shift),
-                    src_arr->buf + (p1->u.typed_array.offset << shift),
-                    src_len << shift);
+            memmove(js_typed_array_data(p) + ((uint32_t)offset << shift),
+                    js_typed_array_data(p1), src_len << shift);
             goto done;
         }
     } else {
@@ -15471,9 +15693,23 @@ JSValue js_typed_array_set(JSContext *ctx, JSValue *this_val,
     }
     for(i = 0; i < src_len; i++) {
         JSValue val;
-        val = JS_GetPropertyUint32(ctx, argv[0], i);
+        /* the objects may have moved: reload them for each element */
+        p = JS_VALUE_TO_PTR(*this_val);
+        p1 = JS_VALUE_TO_PTR(argv[0]);
+        if (p1->class_id == JS_CLASS_ARRAY && i < p1->u.array.len) {
+            JSValueArray *arr = JS_VALUE_TO_PTR(p1->u.array.tab);
+            val = arr->arr[i];
+        } else if (js_class_is_typed_array(p1->class_id) &&
+                   i < p1->u.typed_array.len) {
+            val = js_typed_array_get_element(ctx, p1, i);
+        } else {
+            val = JS_GetPropertyUint32(ctx, argv[0], i);
+        }
         if (JS_IsException(val))
             return JS_EXCEPTION;
+        p = JS_VALUE_TO_PTR(*this_val);
+        if (js_typed_array_put_number(ctx, p, offset + i, val))
+            continue;
         val = JS_SetPropertyUint32(ctx, *this_val, offset + i, val);
         if (JS_IsException(val))
             return JS_EXCEPTION;
@@ -15482,6 +15718,83 @@ JSValue js_typed_array_set(JSContext *ctx, JSValue *this_val,
     return JS_UNDEFINED;
 }
 
+/* fill(value, start, end) */
+JSValue js_typed_array_fill(JSContext *ctx, JSValue *this_val,
+                            int argc, JSValue *argv)
+{
+    JSObject *p;
+    int len, start, final, v, size;
+    double d;
+    uint8_t *buf;
+
+    p = get_typed_array(ctx, *this_val);
+    if (!p)
+        return JS_EXCEPTION;
+    if (js_typed_array_convert(ctx, p, &v, &d, argv[0]))
+        return JS_EXCEPTION;
+    p = JS_VALUE_TO_PTR(*this_val);
+    len = p->u.typed_array.len;
+    start = 0;
+    final = len;
+    if (argc > 1) {
+        if (JS_ToInt32Clamp(ctx, &start, argv[1], 0, len, len))
+            return JS_EXCEPTION;
+    }
+    if (argc > 2 && !JS_IsUndefined(argv[2])) {
+        if (JS_ToInt32Clamp(ctx, &final, argv[2], 0, len, len))
+            return JS_EXCEPTION;
+    }
+    if (start >= final)
+        return *this_val;
+    p = JS_VALUE_TO_PTR(*this_val);
+    size = 1 << typed_array_size_log2[p->class_id - JS_CLASS_UINT8C_ARRAY];
+    buf = js_typed_array_data(p) + start * size;
+    js_typed_array_store(p, start, v, d);
+    if (size == 1) {
+        memset(buf + 1, buf[0], final - start - 1);
+    } else {
+        /* replicate the first element in doubling copies */
+        size_t filled = size, total = (size_t)(final - start) * size;
+        while (filled < total) {
+            size_t n = min_size_t(filled, total - filled);
+            memcpy(buf + filled, buf, n);
+            filled += n;
+        }
+    }
+    return *this_val;
+}
+
+/* copyWithin(target, start, end) */
+JSValue js_typed_array_copyWithin(JSContext *ctx, JSValue *this_val,
+                                  int argc, JSValue *argv)
+{
+    JSObject *p;
+    int len, to, from, final, count, shift;
+    uint8_t *buf;
+
+    p = get_typed_array(ctx, *this_val);
+    if (!p)
+        return JS_EXCEPTION;
+    len = p->u.typed_array.len;
+    if (JS_ToInt32Clamp(ctx, &to, argv[0], 0, len, len))
+        return JS_EXCEPTION;
+    if (JS_ToInt32Clamp(ctx, &from, argv[1], 0, len, len))
+        return JS_EXCEPTION;
+    final = len;
+    if (argc > 2 && !JS_IsUndefined(argv[2])) {
+        if (JS_ToInt32Clamp(ctx, &final, argv[2], 0, len, len))
+            return JS_EXCEPTION;
+    }
+    count = min_int(final - from, len - to);
+    if (count > 0) {
+        p = JS_VALUE_TO_PTR(*this_val);
+        shift = typed_array_size_log2[p->class_id - JS_CLASS_UINT8C_ARRAY];
+        buf = js_typed_array_data(p);
+        memmove(buf + (to << shift), buf + (from << shift), count << shift);
+    }
+    return *this_val;
+}
+
 /* Date */
 
 JSValue js_date_constructor(JSContext *ctx, JSValue *this_val,
@@ -215,6 +215,7 @@ void *JS_GetOpaque(JSContext *ctx, JSValue val);
 /* ArrayBuffer / TypedArray helpers */
 int JS_GetArrayBufferData(JSContext *ctx, JSValue val, uint8_t **pdata, size_t *plen);
 int JS_GetTypedArrayData(JSContext *ctx, JSValue val, uint8_t **pdata, size_t *plen);
+JSValue JS_NewArrayBufferUninitialized(JSContext *ctx, size_t len);
 
 typedef JSValue JSCFunction(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 /* no JS function call be called from a C finalizer */
@@ -305,8 +306,34 @@ JSValue JS_Run(JSContext *ctx, JSValue val);
 JSValue JS_Eval(JSContext *ctx, const char *input, size_t input_len,
                 const char *filename, int eval_flags);
 void JS_GC(JSContext *ctx);
+
+typedef struct {
+    size_t total_size; /* heap and stack area */
+    size_t heap_size; /* allocated bytes, garbage included */
+    size_t stack_size;
+    size_t free_size; /* left before an allocation forces a GC */
+    size_t live_size; /* heap size right after the last GC */
+    uint32_t gc_count;
+    uint32_t gc_forced_count; /* GCs started because an allocation did not fit */
+} JSMemoryInfo;
+
+void JS_GetMemoryInfo(JSContext *ctx, JSMemoryInfo *info);
+/* called with the context opaque before ('done' = false) and after each
+   GC. It must not call into the context. */
+typedef void JSGCHook(void *opaque, JS_BOOL done);
+void JS_SetGCHook(JSContext *ctx, JSGCHook *hook);
+/* Give get_field/put_field sites a property slot cache of 'buf_size'
+   bytes (rounded down to a power of two entries). 'buf' must outlive the
+   context; NULL disables the cache. */
+void JS_SetPropertyCache(JSContext *ctx, void *buf, size_t buf_size);
+/* hits: lookups answered by the cache; misses: properties found through
+   the hash table, after which the site's entry is updated */
+void JS_GetPropertyCacheStats(JSContext *ctx, uint64_t *phits, uint64_t *pmisses);
+void JS_ResetPropertyCacheStats(JSContext *ctx);
 JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len);
 JSValue JS_NewString(JSContext *ctx, const char *buf);
+JSValue JS_NewStringUninitialized(JSContext *ctx, size_t len, JS_BOOL is_ascii,
+                                  uint8_t **pbuf);
 const char *JS_ToCStringLen(JSContext *ctx, size_t *plen, JSValue val, JSCStringBuf *buf);
 const char *JS_ToCString(JSContext *ctx, JSValue val, JSCStringBuf *buf);
 JSValue JS_ToString(JSContext *ctx, JSValue val);
@@ -568,6 +568,43 @@ function test_typed_array()
     a = new Uint8Array([1, 2, 3, 4]);
     a = a.subarray(1, 3);
     assert(a.toString(), "2,3");
+
+    /* element access with conversions */
+    a = new Float32Array(2);
+    a[0] = 0.1;
+    assert(a[0], Math.fround(0.1));
+    a[1] = "2.5";
+    assert(a[1], 2.5);
+    a = new Uint32Array(1);
+    a[0] = -1;
+    assert(a[0], 4294967295);
+    a = new Int16Array(1);
+    a[0] = 1e10;
+    assert(a[0], -7168);
+
+    /* set() between element types and from arrays */
+    a = new Float32Array(4);
+    a.set(new Int8Array([-1, 2]), 1);
+    assert(a.toString(), "0,-1,2,0");
+    a.set([0.5, "3"], 2);
+    assert(a.toString(), "0,-1,0.5,3");
+    a = new Uint8ClampedArray(2);
+    a.set(new Float64Array([300, -5]));
+    assert(a.toString(), "255,0");
+
+    a = new Float32Array(5);
+    assert(a.fill(1.5, 1, -1), a);
+    assert(a.toString(), "0,1.5,1.5,1.5,0");
+    a = new Uint8Array(4).fill(300);
+    assert(a.toString(), "44,44,44,44");
+
+    a = new Int32Array([1, 2, 3, 4, 5]);
+    assert(a.copyWithin(0, 3), a);
+    assert(a.toString(), "4,5,3,4,5");
+    a.copyWithin(1, 0, 3);
+    assert(a.toString(), "4,4,5,3,5");
+    a.subarray(1).copyWithin(-1, 0);
+    assert(a.toString(), "4,4,5,3,4");
 }
 
 function repeat(a, n)
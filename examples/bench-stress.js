@@ -0,0 +1,85 @@
+// Stress scene for `zig build bench`: thousands of meshes over many
+// materials and textures, plus a large instanced field. Every mesh moves
+// each frame so matrix updates and uniform uploads are part of the cost.
+
+load("examples/three.es5.js");
+
+var MeshCount = 2000;
+// Meshes sit on a grid, in layers one behind the other
+var GridColumns = 50;
+var GridRows = 20;
+var MaterialCount = 64;
+var TextureCount = 16;
+var TextureSize = 64;
+var InstanceCount = 4096;
+
+var scene = new THREE.Scene();
+var camera = new THREE.PerspectiveCamera(60, 800 / 600, 0.1, 500);
+camera.position.z = 60;
+
+var renderer = new THREE.WebGLRenderer();
+renderer.setSize(800, 600);
+renderer.setAnimationLoop(animate);
+document.body.appendChild(renderer.domElement);
+
+var textures = [];
+for (var t = 0; t < TextureCount; t++) {
+  var data = new Uint8Array(TextureSize * TextureSize * 4);
+  for (var p = 0; p < TextureSize * TextureSize; p++) {
+    var x = p % TextureSize;
+    var y = Math.floor(p / TextureSize);
+    var check = ((x >> 3) ^ (y >> 3)) & 1;
+    data[p * 4] = check ? 255 : t * 16;
+    data[p * 4 + 1] = check ? 255 : 255 - t * 16;
+    data[p * 4 + 2] = check ? 255 : 128;
+    data[p * 4 + 3] = 255;
+  }
+  var texture = new THREE.DataTexture(data, TextureSize, TextureSize);
+  texture.needsUpdate = true;
+  textures.push(texture);
+}
+
+var materials = [];
+for (var m = 0; m < MaterialCount; m++) {
+  materials.push(new THREE.MeshBasicMaterial({
+    color: (m * 0x3f1f0f) & 0xffffff,
+    map: textures[m % TextureCount],
+    transparent: m % 8 === 0,
+    opacity: m % 8 === 0 ? 0.6 : 1.0,
+  }));
+}
+
+var geometry = new THREE.BoxGeometry(0.6, 0.6, 0.6);
+var meshes = [];
+for (var i = 0; i < MeshCount; i++) {
+  var mesh = new THREE.Mesh(geometry, materials[i % MaterialCount]);
+  mesh.position.set(
+    ((i % GridColumns) - GridColumns / 2) * 1.2,
+    ((Math.floor(i / GridColumns) % GridRows) - GridRows / 2) * 1.2,
+    -Math.floor(i / (GridColumns * GridRows)) * 2
+  );
+  scene.add(mesh);
+  meshes.push(mesh);
+}
+
+var instanced = new THREE.InstancedMesh(
+  geometry,
+  new THREE.MeshBasicMaterial({ color: 0x8080ff }),
+  InstanceCount
+);
+var matrix = new THREE.Matrix4();
+for (var k = 0; k < InstanceCount; k++) {
+  matrix.makeTranslation(((k % 64) - 32) * 0.8, (Math.floor(k / 64) - 32) * 0.8, -20);
+  instanced.setMatrixAt(k, matrix);
+}
+scene.add(instanced);
+
+function animate(time) {
+  var s = time * 0.001;
+  for (var i = 0; i < meshes.length; i++) {
+    meshes[i].rotation.x = s + i * 0.01;
+    meshes[i].rotation.y = s * 0.5;
+  }
+  instanced.rotation.z = s * 0.1;
+  renderer.render(scene, camera);
+}
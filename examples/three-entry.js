@@ -5,11 +5,348 @@ import {
   BoxGeometry,
   MeshBasicMaterial,
   Mesh,
+  InstancedMesh,
   Texture,
+  DataTexture,
   TextureLoader,
   SRGBColorSpace,
+  Matrix4,
+  Skeleton,
+  Frustum,
+  Loader,
+  FileLoader,
+  CompressedTexture,
+  UnsignedByteType,
+  LinearFilter,
+  LinearMipmapLinearFilter,
 } from "../deps/three/build/three.module.js";
 
+// Route the hottest Matrix4/Skeleton paths to the runtime's native math
+// bindings. Opt in with THREE.useNativeMath() after loading the bundle;
+// returns false (and changes nothing) where the bindings are missing, as
+// in a browser. multiply() and premultiply() go through multiplyMatrices.
+function useNativeMath() {
+  if (typeof __mat4Multiply !== "function") return false;
+
+  Matrix4.prototype.multiplyMatrices = function (a, b) {
+    __mat4Multiply(this.elements, a.elements, b.elements);
+    return this;
+  };
+
+  Matrix4.prototype.compose = function (position, quaternion, scale) {
+    __mat4Compose(
+      this.elements,
+      position.x, position.y, position.z,
+      quaternion._x, quaternion._y, quaternion._z, quaternion._w,
+      scale.x, scale.y, scale.z
+    );
+    return this;
+  };
+
+  var identity = new Matrix4();
+  Skeleton.prototype.update = function () {
+    var bones = this.bones;
+    var boneInverses = this.boneInverses;
+    var boneMatrices = this.boneMatrices;
+    for (var i = 0, il = bones.length; i < il; i++) {
+      var matrix = bones[i] ? bones[i].matrixWorld : identity;
+      __mat4Multiply(boneMatrices, matrix.elements, boneInverses[i].elements, i * 16);
+    }
+    if (this.boneTexture !== null) this.boneTexture.needsUpdate = true;
+  };
+
+  // Batch culling for scenes that manage their own visibility: spheres is
+  // a Float32Array of (x, y, z, radius), results a Uint8Array of flags.
+  var planes = new Float32Array(24);
+  Frustum.prototype.intersectsSpheres = function (spheres, results) {
+    for (var i = 0; i < 6; i++) {
+      var plane = this.planes[i];
+      planes[i * 4] = plane.normal.x;
+      planes[i * 4 + 1] = plane.normal.y;
+      planes[i * 4 + 2] = plane.normal.z;
+      planes[i * 4 + 3] = plane.constant;
+    }
+    return __frustumIntersectSpheres(planes, spheres, results);
+  };
+
+  return true;
+}
+
+// Three's compressed format constants are the GL enums of the linear
+// variants; an sRGB enum maps to its linear constant plus SRGBColorSpace.
+var KTX2_SRGB_FORMATS = {
+  0x8E8D: 0x8E8C, // BC7
+  0x9275: 0x9274, // ETC2 RGB8
+  0x9279: 0x9278, // ETC2 RGBA8
+  0x93D0: 0x93B0, // ASTC 4x4
+};
+// No Three.js format constant to hand the renderer
+var KTX2_UNMAPPED_FORMATS = {
+  0x9276: "ETC2 RGB8 punchthrough alpha",
+};
+var KTX2_ERRORS = {
+  BasisUniversal: "Basis Universal (ETC1S/UASTC) data is not transcoded natively; ship KTX2 files with BCn, ETC2 or ASTC 4x4 levels",
+  Supercompressed: "Zstandard/zlib supercompressed levels are not supported",
+  UnsupportedFormat: "the vkFormat has no WebGL compressed equivalent",
+  UnsupportedLayout: "cube maps, arrays and 3D textures are not supported",
+  Truncated: "the file is truncated",
+  NotKtx2: "not a KTX2 file",
+};
+
+// Stand-in for three/addons KTX2Loader on the runtime: the addon transcodes
+// on Web Workers with a wasm module, which the runtime cannot run. Files
+// whose levels are already GPU blocks are parsed natively by __parseKtx2
+// and their levels viewed in place, so loading copies nothing before the
+// upload. Same calls as the addon; the transcoder and worker settings are
+// accepted and ignored.
+class KTX2Loader extends Loader {
+  setTranscoderPath() {
+    return this;
+  }
+
+  setWorkerLimit() {
+    return this;
+  }
+
+  detectSupport() {
+    return this;
+  }
+
+  load(url, onLoad, onProgress, onError) {
+    var scope = this;
+    var loader = new FileLoader(this.manager);
+    loader.setPath(this.path);
+    loader.setResponseType("arraybuffer");
+    loader.setRequestHeader(this.requestHeader);
+    loader.setWithCredentials(this.withCredentials);
+    loader.load(url, function (buffer) {
+      scope.parse(buffer, onLoad, onError);
+    }, onProgress, onError);
+  }
+
+  // `buffer` is the ArrayBuffer of a whole .ktx2 file
+  parse(buffer, onLoad, onError) {
+    var texture;
+    try {
+      texture = createKtx2Texture(buffer);
+    } catch (e) {
+      if (onError) onError(e);
+      else console.error(e);
+      return null;
+    }
+    if (onLoad) onLoad(texture);
+    return texture;
+  }
+
+  dispose() {
+    return this;
+  }
+}
+
+function createKtx2Texture(buffer) {
+  if (typeof __parseKtx2 !== "function") {
+    throw new Error("KTX2Loader: native KTX2 parsing is unavailable; use three/addons KTX2Loader in a browser");
+  }
+  var info;
+  try {
+    info = __parseKtx2(buffer);
+  } catch (e) {
+    throw new Error("KTX2Loader: " + (KTX2_ERRORS[e.message] || e.message));
+  }
+  var glFormat = info[0];
+  if (glFormat in KTX2_UNMAPPED_FORMATS) {
+    throw new Error("KTX2Loader: " + KTX2_UNMAPPED_FORMATS[glFormat] + " has no Three.js format");
+  }
+  var width = info[1];
+  var height = info[2];
+  var mipmaps = [];
+  for (var i = 0; i < info[3]; i++) {
+    mipmaps.push({
+      data: new Uint8Array(buffer, info[4 + 2 * i], info[5 + 2 * i]),
+      width: Math.max(width >> i, 1),
+      height: Math.max(height >> i, 1),
+    });
+  }
+  var linear = KTX2_SRGB_FORMATS[glFormat];
+  var texture = new CompressedTexture(mipmaps, width, height, linear === undefined ? glFormat : linear, UnsignedByteType);
+  if (linear !== undefined) texture.colorSpace = SRGBColorSpace;
+  texture.minFilter = mipmaps.length === 1 ? LinearFilter : LinearMipmapLinearFilter;
+  texture.magFilter = LinearFilter;
+  texture.generateMipmaps = false;
+  texture.needsUpdate = true;
+  return texture;
+}
+
+// Opcodes of gl.__submit() command buffers; mirror GlOp in
+// src/runtime/js.zig. Each opcode is followed by a fixed number of words.
+var GL_OP = {
+  enable: 1, disable: 2, viewport: 3, scissor: 4, depthFunc: 5,
+  depthMask: 6, colorMask: 7, cullFace: 8, frontFace: 9, blendFunc: 10,
+  blendFuncSeparate: 11, blendEquation: 12, blendEquationSeparate: 13,
+  polygonOffset: 14, activeTexture: 15, bindTexture: 16, bindBuffer: 17,
+  useProgram: 18, bindVertexArray: 19, enableVertexAttribArray: 20,
+  disableVertexAttribArray: 21, vertexAttribPointer: 22,
+  vertexAttribDivisor: 23, uniform1f: 24, uniform2f: 25, uniform3f: 26,
+  uniform4f: 27, uniform1i: 28, uniform2i: 29, uniform3i: 30, uniform4i: 31,
+};
+
+// Wrap a context so the setters WebGLState and WebGLBindingStates call
+// (enable, blendFunc, bindBuffer, useProgram, uniform*, ...) are encoded
+// into a buffer and run by one gl.__submit() call instead of one native
+// call each. Pass the result to the renderer:
+//   new WebGLRenderer({ canvas: canvas, context: createBatchedContext(gl) })
+// Every other method submits pending commands first, so calls keep their
+// order. Returns gl itself where the runtime has no __submit, as in a
+// browser. `words` sizes the buffer (default 4096); a full buffer submits.
+function createBatchedContext(gl, words) {
+  if (typeof gl.__submit !== "function") return gl;
+  var capacity = words || 4096;
+  var buffer = new ArrayBuffer(capacity * 4);
+  var ints = new Int32Array(buffer);
+  var floats = new Float32Array(buffer);
+  var length = 0;
+
+  function submit() {
+    if (length === 0) return;
+    var count = length;
+    length = 0;
+    gl.__submit(ints, count);
+  }
+
+  // Reserve a command of `count` words and return its first index. Handles
+  // and booleans store as integers (null becomes 0).
+  function begin(op, count) {
+    if (length + count > capacity) submit();
+    var at = length;
+    ints[at] = op;
+    length += count;
+    return at;
+  }
+
+  function op1(op) {
+    return function (a) {
+      var at = begin(op, 2);
+      ints[at + 1] = a;
+    };
+  }
+
+  function op2(op) {
+    return function (a, b) {
+      var at = begin(op, 3);
+      ints[at + 1] = a;
+      ints[at + 2] = b;
+    };
+  }
+
+  function op4(op) {
+    return function (a, b, c, d) {
+      var at = begin(op, 5);
+      ints[at + 1] = a;
+      ints[at + 2] = b;
+      ints[at + 3] = c;
+      ints[at + 4] = d;
+    };
+  }
+
+  // Uniform locations are -1 when null; values follow as floats or ints
+  function uniform(op, n, view) {
+    return function (location, x, y, z, w) {
+      var at = begin(op, 2 + n);
+      ints[at + 1] = location === null || location === undefined ? -1 : location;
+      view[at + 2] = x;
+      if (n > 1) view[at + 3] = y;
+      if (n > 2) view[at + 4] = z;
+      if (n > 3) view[at + 5] = w;
+    };
+  }
+
+  function passThrough(fn) {
+    return function () {
+      submit();
+      return fn.apply(gl, arguments);
+    };
+  }
+
+  // Non-function members (constants, canvas, drawingBufferWidth) are read
+  // through the prototype, so they stay live
+  var batched = Object.create(gl);
+  var keys = Object.keys(gl);
+  for (var i = 0; i < keys.length; i++) {
+    if (typeof gl[keys[i]] === "function") batched[keys[i]] = passThrough(gl[keys[i]]);
+  }
+
+  batched.enable = op1(GL_OP.enable);
+  batched.disable = op1(GL_OP.disable);
+  batched.viewport = op4(GL_OP.viewport);
+  batched.scissor = op4(GL_OP.scissor);
+  batched.depthFunc = op1(GL_OP.depthFunc);
+  batched.depthMask = op1(GL_OP.depthMask);
+  batched.colorMask = op4(GL_OP.colorMask);
+  batched.cullFace = op1(GL_OP.cullFace);
+  batched.frontFace = op1(GL_OP.frontFace);
+  batched.blendFunc = op2(GL_OP.blendFunc);
+  batched.blendFuncSeparate = op4(GL_OP.blendFuncSeparate);
+  batched.blendEquation = op1(GL_OP.blendEquation);
+  batched.blendEquationSeparate = op2(GL_OP.blendEquationSeparate);
+  batched.polygonOffset = function (factor, units) {
+    var at = begin(GL_OP.polygonOffset, 3);
+    floats[at + 1] = factor;
+    floats[at + 2] = units;
+  };
+  batched.activeTexture = op1(GL_OP.activeTexture);
+  batched.bindTexture = op2(GL_OP.bindTexture);
+  batched.bindBuffer = op2(GL_OP.bindBuffer);
+  batched.useProgram = op1(GL_OP.useProgram);
+  batched.bindVertexArray = op1(GL_OP.bindVertexArray);
+  batched.enableVertexAttribArray = op1(GL_OP.enableVertexAttribArray);
+  batched.disableVertexAttribArray = op1(GL_OP.disableVertexAttribArray);
+  batched.vertexAttribPointer = function (index, size, type, normalized, stride, offset) {
+    var at = begin(GL_OP.vertexAttribPointer, 7);
+    ints[at + 1] = index;
+    ints[at + 2] = size;
+    ints[at + 3] = type;
+    ints[at + 4] = normalized;
+    ints[at + 5] = stride;
+    ints[at + 6] = offset;
+  };
+  batched.vertexAttribDivisor = op2(GL_OP.vertexAttribDivisor);
+  batched.uniform1f = uniform(GL_OP.uniform1f, 1, floats);
+  batched.uniform2f = uniform(GL_OP.uniform2f, 2, floats);
+  batched.uniform3f = uniform(GL_OP.uniform3f, 3, floats);
+  batched.uniform4f = uniform(GL_OP.uniform4f, 4, floats);
+  batched.uniform1i = uniform(GL_OP.uniform1i, 1, ints);
+  batched.uniform2i = uniform(GL_OP.uniform2i, 2, ints);
+  batched.uniform3i = uniform(GL_OP.uniform3i, 3, ints);
+  batched.uniform4i = uniform(GL_OP.uniform4i, 4, ints);
+
+  // Extension methods are native functions too: route the ones that alias
+  // a gl method (ANGLE_instanced_arrays) to its wrapper, the rest through
+  // passThrough, so they cannot overtake pending commands
+  var extensions = {};
+  batched.getExtension = function (name) {
+    if (name in extensions) return extensions[name];
+    var ext = gl.getExtension(name);
+    if (ext !== null && typeof ext === "object") {
+      var wrapped = Object.create(ext);
+      var names = Object.keys(ext);
+      for (var j = 0; j < names.length; j++) {
+        var fn = ext[names[j]];
+        if (typeof fn !== "function") continue;
+        var alias = null;
+        for (var k = 0; k < keys.length && alias === null; k++) {
+          if (gl[keys[k]] === fn) alias = batched[keys[k]];
+        }
+        wrapped[names[j]] = alias || passThrough(fn);
+      }
+      ext = wrapped;
+    }
+    extensions[name] = ext;
+    return ext;
+  };
+
+  return batched;
+}
+
 export {
   Scene,
   PerspectiveCamera,
@@ -17,7 +354,15 @@ export {
   BoxGeometry,
   MeshBasicMaterial,
   Mesh,
+  InstancedMesh,
   Texture,
+  DataTexture,
   TextureLoader,
   SRGBColorSpace,
+  Matrix4,
+  Skeleton,
+  Frustum,
+  KTX2Loader,
+  useNativeMath,
+  createBatchedContext,
 };
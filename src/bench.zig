@@ -0,0 +1,230 @@
+//! Microbenchmarks
+//!
+//! Host tool behind the `bench` build step:
+//!
+//!   three_native_bench [--out <file.json>]
+//!
+//! Times the CPU paths a frame leans on most: shader translation,
+//! pipeline key hashing and cache lookup, CPU staging pool allocation and
+//! a JS call into a native gl binding. Prints one JSON object with the
+//! nanoseconds per operation of each, to the file or to stdout.
+
+const std = @import("std");
+const sokol = @import("sokol");
+const sg = sokol.gfx;
+const three_native = @import("three_native");
+const webgl = three_native.webgl;
+const webgl_draw = three_native.webgl_draw;
+const webgl_program = three_native.webgl_program;
+const JsRuntime = three_native.JsRuntime;
+
+const Result = struct {
+    name: []const u8,
+    iterations: u64,
+    ns_per_op: f64,
+};
+
+/// Vertex and fragment stages shaped like a Three.js MeshBasicMaterial
+/// with a map, as the renderer hands them to shaderSource.
+const vertex_source =
+    \\#version 300 es
+    \\#define attribute in
+    \\#define varying out
+    \\precision highp float;
+    \\uniform mat4 modelMatrix;
+    \\uniform mat4 modelViewMatrix;
+    \\uniform mat4 projectionMatrix;
+    \\uniform mat4 viewMatrix;
+    \\uniform mat3 normalMatrix;
+    \\uniform vec3 cameraPosition;
+    \\uniform mat3 mapTransform;
+    \\attribute vec3 position;
+    \\attribute vec3 normal;
+    \\attribute vec2 uv;
+    \\varying vec2 vMapUv;
+    \\varying vec3 vNormal;
+    \\void main() {
+    \\  vMapUv = (mapTransform * vec3(uv, 1.0)).xy;
+    \\  vNormal = normalize(normalMatrix * normal);
+    \\  vec4 mvPosition = modelViewMatrix * vec4(position, 1.0);
+    \\  gl_Position = projectionMatrix * mvPosition;
+    \\}
+;
+
+const fragment_source =
+    \\#version 300 es
+    \\#define varying in
+    \\layout(location = 0) out highp vec4 pc_fragColor;
+    \\#define gl_FragColor pc_fragColor
+    \\#define texture2D texture
+    \\precision highp float;
+    \\uniform vec3 diffuse;
+    \\uniform float opacity;
+    \\uniform sampler2D map;
+    \\varying vec2 vMapUv;
+    \\varying vec3 vNormal;
+    \\void main() {
+    \\  vec4 diffuseColor = vec4(diffuse, opacity);
+    \\  vec4 sampledDiffuseColor = texture2D(map, vMapUv);
+    \\  diffuseColor *= sampledDiffuseColor;
+    \\  gl_FragColor = vec4(diffuseColor.rgb * (0.5 + 0.5 * vNormal.z), diffuseColor.a);
+    \\}
+;
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    var out_path: ?[]const u8 = null;
+    var i: usize = 1;
+    while (i < args.len) : (i += 1) {
+        if (std.mem.eql(u8, args[i], "--out") and i + 1 < args.len) {
+            i += 1;
+            out_path = args[i];
+        } else {
+            return usage();
+        }
+    }
+
+    const results = [_]Result{
+        try benchTranslate(allocator, .vertex, vertex_source, 2_000),
+        try benchTranslate(allocator, .fragment, fragment_source, 2_000),
+        benchPipelineKey(1_000_000),
+        try benchPipelineCacheHit(1_000_000),
+        try benchCpuPool(1_000_000),
+        try benchJsCall(allocator, 500_000),
+    };
+
+    var file = if (out_path) |path| try std.fs.cwd().createFile(path, .{}) else std.fs.File.stdout();
+    defer if (out_path != null) file.close();
+    var buf: [4096]u8 = undefined;
+    var writer = file.writer(&buf);
+    const out = &writer.interface;
+    try out.writeByte('{');
+    for (results, 0..) |entry, index| {
+        if (index != 0) try out.writeByte(',');
+        try out.print("\"{s}\":{{\"iterations\":{d},\"nsPerOp\":{d:.1}}}", .{ entry.name, entry.iterations, entry.ns_per_op });
+    }
+    try out.writeAll("}\n");
+    try out.flush();
+}
+
+fn usage() error{InvalidArguments} {
+    std.debug.print("usage: three_native_bench [--out <file.json>]\n", .{});
+    return error.InvalidArguments;
+}
+
+fn result(name: []const u8, iterations: u64, elapsed_ns: u64) Result {
+    return .{
+        .name = name,
+        .iterations = iterations,
+        .ns_per_op = @as(f64, @floatFromInt(elapsed_ns)) / @as(f64, @floatFromInt(iterations)),
+    };
+}
+
+fn benchTranslate(allocator: std.mem.Allocator, stage: webgl_program.ShaderStage, source: []const u8, iterations: u64) !Result {
+    var out: std.ArrayList(u8) = .empty;
+    defer out.deinit(allocator);
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |_| {
+        try webgl_program.translateStage(allocator, source, stage, &out);
+        std.mem.doNotOptimizeAway(out.items.len);
+    }
+    const name = switch (stage) {
+        .vertex => "translateVertex",
+        .fragment => "translateFragment",
+    };
+    return result(name, iterations, timer.read());
+}
+
+/// Descriptors differing in the state Three.js materials toggle most.
+fn pipelineDesc(variant: usize) sg.PipelineDesc {
+    var desc = sg.PipelineDesc{};
+    desc.cull_mode = if (variant & 1 != 0) .BACK else .NONE;
+    desc.depth.write_enabled = variant & 2 != 0;
+    desc.depth.compare = if (variant & 4 != 0) .LESS_EQUAL else .ALWAYS;
+    desc.colors[0].blend.enabled = variant & 8 != 0;
+    desc.colors[0].blend.src_factor_rgb = .SRC_ALPHA;
+    desc.colors[0].blend.dst_factor_rgb = .ONE_MINUS_SRC_ALPHA;
+    desc.index_type = if (variant & 16 != 0) .UINT16 else .NONE;
+    return desc;
+}
+
+const PipelineVariants = 32;
+
+fn benchPipelineKey(iterations: u64) Result {
+    var descs: [PipelineVariants]sg.PipelineDesc = undefined;
+    for (&descs, 0..) |*desc, variant| desc.* = pipelineDesc(variant);
+    var timer = std.time.Timer.start() catch unreachable;
+    var sum: u64 = 0;
+    for (0..iterations) |n| {
+        sum +%= webgl_draw.pipelineKey(@intCast(n & 7), &descs[n % PipelineVariants]);
+    }
+    std.mem.doNotOptimizeAway(sum);
+    return result("pipelineKey", iterations, timer.read());
+}
+
+/// Lookups of cached pipelines, the path every draw after warm-up takes.
+/// Pipeline ids are placeholders; nothing is created on a GPU.
+fn benchPipelineCacheHit(iterations: u64) !Result {
+    var cache: webgl_draw.PipelineCache = .{};
+    defer cache.deinit();
+    var keys: [PipelineVariants * 4]u64 = undefined;
+    for (&keys, 0..) |*key, n| {
+        const desc = pipelineDesc(n % PipelineVariants);
+        key.* = webgl_draw.pipelineKey(@intCast(n / PipelineVariants), &desc);
+        _ = try cache.insert(key.*, .{ .id = @intCast(n + 1) });
+    }
+    var timer = try std.time.Timer.start();
+    var sum: u64 = 0;
+    for (0..iterations) |n| {
+        const entry = cache.find(keys[(n *% 7) % keys.len]) orelse return error.CacheMiss;
+        sum +%= entry.pipeline.id;
+    }
+    std.mem.doNotOptimizeAway(sum);
+    return result("pipelineCacheFind", iterations, timer.read());
+}
+
+/// An alloc and a free per iteration, over a pool kept partly full with
+/// mixed sizes as a scene's buffers leave it.
+fn benchCpuPool(iterations: u64) !Result {
+    var pool: webgl.CpuBufferPool = .{};
+    defer pool.deinit();
+    const block = webgl.CpuBufferPool.BlockSizeBytes;
+    var resident: [64]three_native.cpu_block_pool.CpuSlice = undefined;
+    for (&resident, 0..) |*slice, n| slice.* = try pool.alloc((n % 5 + 1) * block);
+    for (resident, 0..) |slice, n| {
+        if (n % 2 == 0) pool.free(slice);
+    }
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |n| {
+        const slice = try pool.alloc((n % 3 + 1) * block - 16);
+        pool.free(slice);
+    }
+    return result("cpuBufferPoolAllocFree", iterations, timer.read());
+}
+
+/// One JS call into a native gl binding that changes state, less the cost
+/// of the same loop without the calls.
+fn benchJsCall(allocator: std.mem.Allocator, iterations: u64) !Result {
+    var rt = try JsRuntime.init(allocator, 1024 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+
+    var code_buf: [256]u8 = undefined;
+    const empty = try std.fmt.bufPrint(&code_buf, "var n = 0; for (var i = 0; i < {d}; i++) {{ n += i & 1; }}", .{iterations / 2});
+    var timer = try std.time.Timer.start();
+    try rt.eval(empty, "bench");
+    const empty_ns = timer.read();
+
+    const calls = try std.fmt.bufPrint(&code_buf, "for (var i = 0; i < {d}; i++) {{ gl.enable(gl.BLEND); gl.disable(gl.BLEND); }}", .{iterations / 2});
+    timer.reset();
+    try rt.eval(calls, "bench");
+    const calls_ns = timer.read();
+    return result("jsGlCall", iterations, calls_ns -| empty_ns);
+}
@@ -2,15 +2,126 @@ const std = @import("std");
 const three_native = @import("three_native");
 const window = three_native.window;
 const JsRuntime = three_native.JsRuntime;
+const shader_cache = three_native.shader_cache;
+const webgl = three_native.webgl;
+const webgl_texture = three_native.webgl_texture;
+const webgl_draw = three_native.webgl_draw;
+const webgl_shader = three_native.webgl_shader;
+const webgl_program = three_native.webgl_program;
+const web_audio = three_native.web_audio;
+const bytecode_bundle = three_native.bytecode_bundle;
+const profiler = three_native.profiler;
+const build_options = @import("build_options");
+const frame_bench = three_native.frame_bench;
+const manifest = three_native.manifest;
 
-var g_js_rt: ?*JsRuntime = null;
-var g_time_ms: f64 = 0;
+/// Log levels are fixed at build time (-Dlog-level, -Dshim-log-level):
+/// calls below them compile to nothing, so per-draw shim tracing costs
+/// nothing in release builds.
+pub const std_options: std.Options = .{
+    .log_level = std.enums.nameCast(std.log.Level, build_options.log_level),
+    .log_scope_levels = &shim_scope_levels,
+};
+
+const shim_scope_levels = blk: {
+    const scopes = [_]@Type(.enum_literal){
+        .webgl,
+        .webgl_draw,
+        .webgl_program,
+        .webgl_texture,
+        .webgl_backend,
+        .webgl_framebuffer,
+        .webgl_query,
+        .webgl_readback,
+        .web_audio,
+    };
+    var levels: [scopes.len]std.log.ScopeLevel = undefined;
+    for (scopes, &levels) |scope, *level| {
+        level.* = .{ .scope = scope, .level = std.enums.nameCast(std.log.Level, build_options.shim_log_level) };
+    }
+    break :blk levels;
+};
+
+/// Translated shaders persist here between runs. Override with the
+/// THREE_NATIVE_SHADER_CACHE environment variable (empty disables it).
+const default_shader_cache_dir = ".three-native-cache/shaders";
+
+/// CPU staging pool sizes in MiB, read before anything is uploaded.
+const buffer_pool_env = "THREE_NATIVE_BUFFER_POOL_MB";
+const texture_pool_env = "THREE_NATIVE_TEXTURE_POOL_MB";
+
+/// WebGL object table capacities (buffers, textures, shaders, programs),
+/// read before any object is created.
+const max_buffers_env = "THREE_NATIVE_MAX_BUFFERS";
+const max_textures_env = "THREE_NATIVE_MAX_TEXTURES";
+const max_shaders_env = "THREE_NATIVE_MAX_SHADERS";
+const max_programs_env = "THREE_NATIVE_MAX_PROGRAMS";
+
+/// Texture residency: GPU MiB to keep textures under (0 = unlimited), and
+/// 0 to drop texture CPU copies after upload (kept under a budget).
+const vram_budget_env = "THREE_NATIVE_VRAM_BUDGET_MB";
+const keep_texture_copies_env = "THREE_NATIVE_KEEP_TEXTURE_COPIES";
+
+/// 1 to regroup opaque draws by program and state at flush. Off by default,
+/// since it can change which draw wins a depth tie.
+const reorder_draws_env = "THREE_NATIVE_REORDER_DRAWS";
+
+/// Audio output: 0 mixes without opening a device, and the device buffer
+/// size in frames (lower is less latency, higher survives longer stalls).
+const audio_env = "THREE_NATIVE_AUDIO";
+const audio_buffer_frames_env = "THREE_NATIVE_AUDIO_BUFFER_FRAMES";
+
+/// Packed asset archive (from `zig build pack-assets`) to serve fetch() from.
+const asset_archive_env = "THREE_NATIVE_ASSETS";
+
+/// `three_native --compile-bytecode <out> <entry.js> [script.js...]`
+const compile_bytecode_flag = "--compile-bytecode";
+
+const max_script_bytes: usize = 16 * 1024 * 1024;
+
+/// `three_native [--heap-mb <MiB>] [script]`: JS heap size, also read from
+/// THREE_NATIVE_HEAP_MB. Defaults to 16 MiB with a script and 64 KiB without.
+const heap_flag = "--heap-mb";
+const heap_env = "THREE_NATIVE_HEAP_MB";
+const default_script_heap_bytes: usize = 16 * 1024 * 1024;
+const max_heap_mb: usize = 2048;
+
+/// `--bench <frames>`: run that many frames with the profiler recording,
+/// then quit and report frame and zone times as JSON to `--bench-out`
+/// (stdout without it). Used by `zig build bench`.
+const bench_flag = "--bench";
+const bench_out_flag = "--bench-out";
+
+/// Frame pacing: FPS cap (0 = display rate), vblanks per present and
+/// low-latency mode (1 to enable).
+const target_fps_env = "THREE_NATIVE_TARGET_FPS";
+const swap_interval_env = "THREE_NATIVE_SWAP_INTERVAL";
+const low_latency_env = "THREE_NATIVE_LOW_LATENCY";
+/// Window MSAA samples per pixel (1 = off)
+const msaa_env = "THREE_NATIVE_MSAA";
 
-fn onFrame(delta: f64) void {
-    g_time_ms += delta * 1000.0;
+/// Frame profiler: 1 records and shows the overlay (F3 toggles it); a
+/// trace path records and writes the last frames as a Chrome trace on exit.
+const profile_env = "THREE_NATIVE_PROFILE";
+const profile_trace_env = "THREE_NATIVE_PROFILE_TRACE";
 
+/// Idle GC gets what is left of the frame period after the tick, minus
+/// time kept back for submitting and presenting the frame.
+const present_reserve_ms: f64 = 2.0;
+
+var g_js_rt: ?*JsRuntime = null;
+var g_bench: ?*frame_bench.FrameBench = null;
+
+fn onFrame(_: f64) void {
+    // Frames completed since the last callback
+    if (g_bench) |bench| bench.recordNew(profiler.global());
     if (g_js_rt) |rt| {
-        rt.tick(g_time_ms);
+        const frame_start = std.time.nanoTimestamp();
+        // Predicted present time, in whole display periods
+        rt.tick(window.frameTimestampMs());
+        const tick_ms = @as(f64, @floatFromInt(std.time.nanoTimestamp() - frame_start)) / std.time.ns_per_ms;
+        // Collections open their own profiler zone
+        _ = rt.collectIdle(window.framePeriodMs() - present_reserve_ms - tick_ms);
         const shared = rt.getSharedState();
         window.setClearColor(window.ClearColor.rgb(
             shared.clear_color[0],
@@ -20,32 +131,197 @@ fn onFrame(delta: f64) void {
     }
 }
 
+fn configurePool(env: *const std.process.EnvMap, name: []const u8, manifest_mib: ?usize, comptime configure: anytype) void {
+    const mib = manifest.countSetting(env, name, "a size in MiB", manifest_mib) orelse return;
+    const bytes = manifest.mibToBytes(name, mib) orelse return;
+    configure(bytes) catch |err| {
+        std.log.warn("{s}: cannot use {d} MiB: {s}", .{ name, mib, @errorName(err) });
+    };
+}
+
+fn configureTable(env: *const std.process.EnvMap, name: []const u8, manifest_capacity: ?usize, comptime configure: anytype) void {
+    const capacity = manifest.countSetting(env, name, "an object count", manifest_capacity) orelse return;
+    configure(capacity) catch |err| {
+        std.log.warn("{s}: cannot hold {d} objects: {s}", .{ name, capacity, @errorName(err) });
+    };
+}
+
+fn uintFromEnv(allocator: std.mem.Allocator, name: []const u8, default: u32) u32 {
+    const value = std.process.getEnvVarOwned(allocator, name) catch return default;
+    defer allocator.free(value);
+    return std.fmt.parseInt(u32, value, 10) catch {
+        std.log.warn("{s}: expected a whole number, got '{s}'", .{ name, value });
+        return default;
+    };
+}
+
+fn usage() error{InvalidArguments} {
+    std.debug.print("usage: three_native [{s} <1-{d}>] [{s} <frames> [{s} <file.json>]] [script.js | bundle.jsbc]\n", .{ heap_flag, max_heap_mb, bench_flag, bench_out_flag });
+    return error.InvalidArguments;
+}
+
+fn parseHeapMb(value: []const u8) ?usize {
+    const mib = std.fmt.parseInt(usize, value, 10) catch return null;
+    return parseHeapMbValue(mib);
+}
+
+fn parseHeapMbValue(mib: usize) ?usize {
+    if (mib == 0 or mib > max_heap_mb) return null;
+    return mib;
+}
+
+fn heapMbFromEnv(allocator: std.mem.Allocator) ?usize {
+    const value = std.process.getEnvVarOwned(allocator, heap_env) catch return null;
+    defer allocator.free(value);
+    return parseHeapMb(value) orelse {
+        std.log.warn("{s}: expected 1 to {d} MiB, got '{s}'", .{ heap_env, max_heap_mb, value });
+        return null;
+    };
+}
+
+/// Precompile scripts into a bundle that runs in place of their sources.
+/// Scripts are named by their paths as given, which is how the entry
+/// script load()s the others.
+fn compileBytecodeBundle(allocator: std.mem.Allocator, args: []const [:0]u8) !void {
+    if (args.len < 2 or args.len - 1 > bytecode_bundle.MaxScripts) {
+        std.debug.print("usage: three_native {s} <out> <entry.js> [script.js...] (at most {d} scripts)\n", .{ compile_bytecode_flag, bytecode_bundle.MaxScripts });
+        return error.InvalidArguments;
+    }
+    var sources: [bytecode_bundle.MaxScripts]bytecode_bundle.Source = undefined;
+    var compiled: usize = 0;
+    defer {
+        for (sources[0..compiled]) |source| allocator.free(source.code);
+    }
+    for (args[1..]) |path| {
+        const script = try std.fs.cwd().readFileAlloc(allocator, path, max_script_bytes);
+        defer allocator.free(script);
+        const code = try JsRuntime.compileBytecode(allocator, script, path);
+        sources[compiled] = .{ .name = bytecode_bundle.scriptName(path), .code = code };
+        compiled += 1;
+    }
+
+    var out = try std.fs.cwd().createFile(args[0], .{});
+    defer out.close();
+    var buf: [64 * 1024]u8 = undefined;
+    var writer = out.writer(&buf);
+    try bytecode_bundle.writeBundle(sources[0..compiled], &writer.interface);
+    try writer.interface.flush();
+    std.debug.print("compiled {d} scripts into {s}\n", .{ compiled, args[0] });
+}
+
 pub fn main() !void {
+    // Startup time is measured from here
+    _ = profiler.now();
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
     const allocator = gpa.allocator();
 
     const args = try std.process.argsAlloc(allocator);
     defer std.process.argsFree(allocator, args);
-    const script_path: ?[]const u8 = if (args.len > 1) args[1] else null;
-    const runtime_mem: usize = if (script_path != null) 16 * 1024 * 1024 else 64 * 1024;
+    if (args.len > 1 and std.mem.eql(u8, args[1], compile_bytecode_flag)) {
+        return compileBytecodeBundle(allocator, args[2..]);
+    }
+    var script_path: ?[]const u8 = null;
+    var heap_mb: ?usize = null;
+    var bench_frames: u64 = 0;
+    var bench_out: ?[]const u8 = null;
+    var arg_index: usize = 1;
+    while (arg_index < args.len) : (arg_index += 1) {
+        const arg = args[arg_index];
+        if (std.mem.eql(u8, arg, heap_flag)) {
+            arg_index += 1;
+            if (arg_index == args.len) return usage();
+            heap_mb = parseHeapMb(args[arg_index]) orelse return usage();
+        } else if (std.mem.eql(u8, arg, bench_flag)) {
+            arg_index += 1;
+            if (arg_index == args.len) return usage();
+            bench_frames = std.fmt.parseInt(u64, args[arg_index], 10) catch return usage();
+            if (bench_frames == 0) return usage();
+        } else if (std.mem.eql(u8, arg, bench_out_flag)) {
+            arg_index += 1;
+            if (arg_index == args.len) return usage();
+            bench_out = args[arg_index];
+        } else if (script_path == null) {
+            script_path = arg;
+        } else {
+            return usage();
+        }
+    }
+    // Per-game sizing from the script's directory; the THREE_NATIVE_*
+    // variables and --heap-mb override it
+    const sizing: manifest.Manifest = if (script_path) |path| manifest.read(allocator, path) else .{};
+    const manifest_heap_mb: ?usize = if (sizing.heap_mb) |mib| parseHeapMbValue(mib) orelse blk: {
+        std.log.warn("{s}: heap_mb must be 1 to {d}, got {d}", .{ manifest.file_name, max_heap_mb, mib });
+        break :blk null;
+    } else null;
+    const runtime_mem: usize = if (heap_mb orelse heapMbFromEnv(allocator) orelse manifest_heap_mb) |mib|
+        mib * 1024 * 1024
+    else if (script_path != null)
+        default_script_heap_bytes
+    else
+        64 * 1024;
+
+    const cache_env = std.process.getEnvVarOwned(allocator, "THREE_NATIVE_SHADER_CACHE") catch null;
+    defer if (cache_env) |dir| allocator.free(dir);
+    shader_cache.setDirectory(cache_env orelse default_shader_cache_dir);
+    var env = try std.process.getEnvMap(allocator);
+    defer env.deinit();
+    configurePool(&env, buffer_pool_env, sizing.buffer_pool_mb, webgl.configureCpuPool);
+    configurePool(&env, texture_pool_env, sizing.texture_pool_mb, webgl_texture.configureCpuPool);
+    configureTable(&env, max_buffers_env, sizing.max_buffers, webgl.configureBufferCapacity);
+    configureTable(&env, max_textures_env, sizing.max_textures, webgl_texture.configureTextureCapacity);
+    configureTable(&env, max_shaders_env, sizing.max_shaders, webgl_shader.configureShaderCapacity);
+    configureTable(&env, max_programs_env, sizing.max_programs, webgl_program.configureProgramCapacity);
+    const vram_budget_mb = manifest.countSetting(&env, vram_budget_env, "a size in MiB", sizing.vram_budget_mb) orelse 0;
+    webgl_texture.configureResidency(.{
+        // A budget too large to count in bytes is no limit at all
+        .vram_budget = manifest.mibToBytes(vram_budget_env, vram_budget_mb) orelse 0,
+        .keep_cpu_copies = manifest.flagSetting(&env, keep_texture_copies_env, sizing.keep_texture_copies, true),
+    });
+    webgl_draw.configureDrawReordering(manifest.flagSetting(&env, reorder_draws_env, null, false));
+    const audio_defaults: web_audio.OutputConfig = .{};
+    web_audio.configureOutput(.{
+        .enabled = uintFromEnv(allocator, audio_env, 1) != 0,
+        .buffer_frames = std.math.clamp(uintFromEnv(allocator, audio_buffer_frames_env, audio_defaults.buffer_frames), @as(u32, web_audio.RenderQuantum), 65536),
+    });
 
     // Initialize JS runtime (pure Zig bindings)
     var runtime = try JsRuntime.init(allocator, runtime_mem);
     defer runtime.deinit();
     runtime.makeCurrent();
     g_js_rt = &runtime;
+
+    // Read the script before any JS runs: a bytecode bundle can only be
+    // loaded into a context that has not parsed anything yet
+    var source: ?[]align(bytecode_bundle.CodeAlignment) u8 = null;
+    defer if (source) |bytes| allocator.free(bytes);
+    if (script_path) |path| {
+        const bytes = try bytecode_bundle.readFile(allocator, path, max_script_bytes);
+        if (bytecode_bundle.isBundle(bytes)) {
+            try runtime.loadBytecode(bytes);
+        } else {
+            source = bytes;
+        }
+    }
     try runtime.installDomStubs();
 
+    if (std.process.getEnvVarOwned(allocator, asset_archive_env)) |archive_path| {
+        defer allocator.free(archive_path);
+        runtime.mountArchive(archive_path) catch |err| {
+            std.log.warn("{s}: cannot mount '{s}': {s}", .{ asset_archive_env, archive_path, @errorName(err) });
+        };
+    } else |_| {}
+
     // Run initialization script
     if (script_path) |path| {
-        const max_bytes: usize = 16 * 1024 * 1024;
-        const script = try std.fs.cwd().readFileAlloc(allocator, path, max_bytes);
-        defer allocator.free(script);
-        const path_z = try allocator.dupeZ(u8, path);
-        defer allocator.free(path_z);
         std.debug.print("Loading script: {s}\n", .{path});
-        try runtime.eval(script, path_z);
+        if (source) |script| {
+            const path_z = try allocator.dupeZ(u8, path);
+            defer allocator.free(path_z);
+            try runtime.eval(script, path_z);
+        } else {
+            try runtime.runBytecodeEntry();
+        }
     } else {
         try runtime.eval(
             \\print('hello from mquickjs (Zig stdlib bindings)');
@@ -63,6 +339,17 @@ pub fn main() !void {
 
     // Set up frame callback
     window.setFrameCallback(onFrame);
+    if (uintFromEnv(allocator, profile_env, 0) != 0) window.setProfilerOverlay(true);
+    const trace_path = std.process.getEnvVarOwned(allocator, profile_trace_env) catch null;
+    defer if (trace_path) |path| allocator.free(path);
+    if (trace_path != null) profiler.setEnabled(true);
+    var bench: ?frame_bench.FrameBench = null;
+    defer if (bench) |*b| b.deinit();
+    if (bench_frames != 0) {
+        bench = try frame_bench.FrameBench.init(allocator, @intCast(bench_frames));
+        g_bench = &bench.?;
+        profiler.setEnabled(true);
+    }
 
     // Enable triangle rendering unless running an example script
     window.setDrawTriangle(script_path == null);
@@ -73,9 +360,68 @@ pub fn main() !void {
     } else {
         std.debug.print("Opening window with triangle... Press ESC to close.\n", .{});
     }
+    const pacing: window.WindowConfig = .{};
     window.run(.{
         .width = 800,
         .height = 600,
         .title = "three-native",
+        .target_fps = uintFromEnv(allocator, target_fps_env, pacing.target_fps),
+        .swap_interval = uintFromEnv(allocator, swap_interval_env, pacing.swap_interval),
+        .low_latency = uintFromEnv(allocator, low_latency_env, 0) != 0,
+        .sample_count = uintFromEnv(allocator, msaa_env, pacing.sample_count),
+        .max_frames = bench_frames,
+    });
+    if (bench) |*b| {
+        b.recordNew(profiler.global());
+        g_bench = null;
+        writeBenchReport(b, script_path orelse "init", bench_out) catch |err| {
+            std.log.warn("{s}: cannot write the report: {s}", .{ bench_flag, @errorName(err) });
+        };
+    }
+
+    const gc = runtime.gcStats();
+    std.log.info("js gc: {d} idle, {d} forced, max unscheduled pause {d:.2} ms, live {d} KiB of {d} KiB", .{
+        gc.idle_count,
+        gc.forced_count,
+        @as(f64, @floatFromInt(gc.max_unscheduled_pause_ns)) / std.time.ns_per_ms,
+        gc.live_bytes / 1024,
+        gc.total_bytes / 1024,
     });
+    if (profiler.enabled()) logProfile(trace_path);
+}
+
+fn writeBenchReport(bench: *const frame_bench.FrameBench, scene: []const u8, out_path: ?[]const u8) !void {
+    const info: frame_bench.RunInfo = .{
+        .scene = scene,
+        .startup_ns = bench.first_end_ns orelse 0,
+        .peak_rss_bytes = frame_bench.peakRssBytes(),
+    };
+    var file = if (out_path) |path| try std.fs.cwd().createFile(path, .{}) else std.fs.File.stdout();
+    defer if (out_path != null) file.close();
+    var buf: [4096]u8 = undefined;
+    var writer = file.writer(&buf);
+    try bench.writeJson(&writer.interface, info);
+    try writer.interface.flush();
+    if (out_path) |path| std.log.info("bench: {d} frames of {s} written to {s}", .{ bench.count, scene, path });
+}
+
+fn logProfile(trace_path: ?[]const u8) void {
+    const prof = profiler.global();
+    inline for (.{ profiler.Zone.tick, profiler.Zone.flush }) |zone| {
+        const summary = prof.summary(zone);
+        std.log.info("profile {s}: avg {d:.2} ms, max {d:.2} ms over the last {d} frames; {d} frames over the {d:.1} ms budget", .{
+            zone.label(),
+            @as(f64, @floatFromInt(summary.avg_ns)) / std.time.ns_per_ms,
+            @as(f64, @floatFromInt(summary.max_ns)) / std.time.ns_per_ms,
+            prof.frameCount(),
+            prof.overBudgetFrames(zone),
+            @as(f64, @floatFromInt(zone.budgetNs().?)) / std.time.ns_per_ms,
+        });
+    }
+    const path = trace_path orelse return;
+    profiler.writeChromeTraceFile(path) catch |err| {
+        std.log.warn("{s}: cannot write '{s}': {s}", .{ profile_trace_env, path, @errorName(err) });
+        return;
+    };
+    std.log.info("profile trace of {d} frames written to {s}", .{ prof.frameCount(), path });
 }
@@ -0,0 +1,57 @@
+//! Asset archive packer
+//!
+//! Host tool behind the `pack-assets` build step:
+//!
+//!   pack_assets <asset-dir> <out.pak> [--store] [--align N]
+//!
+//! Every regular file below <asset-dir> becomes an entry named by its path
+//! relative to that directory. --store disables LZ4 compression and
+//! --align sets the data alignment (a power of two, default 16).
+
+const std = @import("std");
+const asset_archive = @import("shim/asset_archive.zig");
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    var positional: [2][]const u8 = undefined;
+    var positional_count: usize = 0;
+    var options: asset_archive.WriteOptions = .{};
+    var i: usize = 1;
+    while (i < args.len) : (i += 1) {
+        const arg = args[i];
+        if (std.mem.eql(u8, arg, "--store")) {
+            options.compress = false;
+        } else if (std.mem.eql(u8, arg, "--align") and i + 1 < args.len) {
+            i += 1;
+            options.alignment = std.fmt.parseInt(u32, args[i], 10) catch return usage();
+        } else if (positional_count < positional.len) {
+            positional[positional_count] = arg;
+            positional_count += 1;
+        } else {
+            return usage();
+        }
+    }
+    if (positional_count != positional.len) return usage();
+
+    var dir = try std.fs.cwd().openDir(positional[0], .{ .iterate = true });
+    defer dir.close();
+    var out = try std.fs.cwd().createFile(positional[1], .{});
+    defer out.close();
+    var buf: [64 * 1024]u8 = undefined;
+    var writer = out.writer(&buf);
+
+    const count = try asset_archive.packDirectory(allocator, dir, &writer.interface, options);
+    try writer.interface.flush();
+    std.debug.print("packed {d} assets from {s} into {s}\n", .{ count, positional[0], positional[1] });
+}
+
+fn usage() error{InvalidArguments} {
+    std.debug.print("usage: pack_assets <asset-dir> <out.pak> [--store] [--align N]\n", .{});
+    return error.InvalidArguments;
+}
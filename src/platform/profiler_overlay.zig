@@ -0,0 +1,105 @@
+//! Profiler overlay
+//!
+//! Draws the frame profiler's per-zone times over the window with
+//! sokol_debugtext: the last frame, the average and the worst over the
+//! profiler's ring, and each budgeted zone's frames over budget. Zones
+//! running over their budget in the last frame are drawn in red.
+
+const std = @import("std");
+const sokol = @import("sokol");
+const sapp = sokol.app;
+const sgfx = sokol.gfx;
+const sdtx = sokol.debugtext;
+const slog = sokol.log;
+const profiler = @import("../shim/profiler.zig");
+
+/// Zones in display order, indented under the zone they run in.
+const Row = struct {
+    zone: profiler.Zone,
+    indent: u8,
+};
+
+const rows = [_]Row{
+    .{ .zone = .frame, .indent = 0 },
+    .{ .zone = .tick, .indent = 1 },
+    .{ .zone = .timers, .indent = 2 },
+    .{ .zone = .input, .indent = 2 },
+    .{ .zone = .raf, .indent = 2 },
+    .{ .zone = .gc, .indent = 1 },
+    .{ .zone = .flush, .indent = 1 },
+    .{ .zone = .texture_upload, .indent = 2 },
+    .{ .zone = .pipeline_create, .indent = 2 },
+    .{ .zone = .commit, .indent = 1 },
+};
+
+comptime {
+    std.debug.assert(rows.len == profiler.ZoneCount);
+}
+
+/// Text cells are 8x8 pixels, scaled by this on top of the DPI factor.
+const TextScale: f32 = 2.0;
+/// Character cells before the first time column
+const LabelColumns: f32 = 14;
+
+var g_ready = false;
+
+/// After sgfx.setup().
+pub fn setup() void {
+    var desc = sdtx.Desc{ .logger = .{ .func = slog.func } };
+    desc.fonts[0] = sdtx.fontOric();
+    sdtx.setup(desc);
+    g_ready = true;
+}
+
+pub fn shutdown() void {
+    if (!g_ready) return;
+    sdtx.shutdown();
+    g_ready = false;
+}
+
+/// Draw into the window's swapchain in a pass of its own that keeps what
+/// the frame drew, after every other pass of the frame.
+pub fn draw(swapchain: sgfx.Swapchain) void {
+    if (!g_ready) return;
+    const prof = profiler.global();
+    if (prof.frameCount() == 0) return;
+
+    const scale = TextScale * sapp.dpiScale();
+    sdtx.canvas(sapp.widthf() / scale, sapp.heightf() / scale);
+    sdtx.origin(1, 1);
+    sdtx.color3b(0xc0, 0xc0, 0xc0);
+    sdtx.puts("ms");
+    sdtx.posX(LabelColumns);
+    sdtx.puts("  last    avg    max  over\n");
+    for (rows) |row| {
+        const summary = prof.summary(row.zone);
+        const budget = row.zone.budgetNs();
+        if (budget != null and summary.last_ns > budget.?) {
+            sdtx.color3b(0xff, 0x50, 0x50);
+        } else {
+            sdtx.color3b(0xff, 0xff, 0xff);
+        }
+        sdtx.posX(@floatFromInt(2 * row.indent));
+        sdtx.print("{s}", .{row.zone.label()});
+        sdtx.posX(LabelColumns);
+        sdtx.print("{d:>6.2} {d:>6.2} {d:>6.2}", .{
+            nsToMs(summary.last_ns),
+            nsToMs(summary.avg_ns),
+            nsToMs(summary.max_ns),
+        });
+        if (budget != null) sdtx.print(" {d:>5}", .{prof.overBudgetFrames(row.zone)});
+        sdtx.crlf();
+    }
+
+    var action = sgfx.PassAction{};
+    action.colors[0] = .{ .load_action = .LOAD };
+    action.depth = .{ .load_action = .LOAD };
+    action.stencil = .{ .load_action = .LOAD };
+    sgfx.beginPass(.{ .action = action, .swapchain = swapchain });
+    sdtx.draw();
+    sgfx.endPass();
+}
+
+fn nsToMs(ns: u64) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+}
@@ -10,9 +10,12 @@ const sgfx = sokol.gfx;
 const sglue = sokol.glue;
 const slog = sokol.log;
 const TriangleRenderer = @import("renderer.zig").TriangleRenderer;
+const profiler_overlay = @import("profiler_overlay.zig");
 const webgl_state = @import("../shim/webgl_state.zig");
 const webgl_backend = @import("../shim/webgl_backend.zig");
 const webgl_draw = @import("../shim/webgl_draw.zig");
+const webgl_framebuffer = @import("../shim/webgl_framebuffer.zig");
+const profiler = @import("../shim/profiler.zig");
 const events = @import("../runtime/events.zig");
 const js = @import("../runtime/js.zig");
 
@@ -28,6 +31,16 @@ pub const WindowConfig = struct {
     high_dpi: bool = true,
     /// Target frames per second (0 = vsync)
     target_fps: u32 = 60,
+    /// Vblanks per present, at least 1 (ignored on some platforms)
+    swap_interval: u32 = 1,
+    /// Sleep at the start of each frame so that it is built, and reads
+    /// queued input, as late as its measured work allows
+    low_latency: bool = false,
+    /// MSAA samples per pixel of the window (1 = off). Offscreen targets
+    /// choose their own with renderbufferStorageMultisample
+    sample_count: u32 = 1,
+    /// Quit after this many frames (0 = run until closed), for benchmarks
+    max_frames: u64 = 0,
 };
 
 /// Clear color for the render pass
@@ -76,10 +89,12 @@ var g_state: struct {
     clear_color: ClearColor = ClearColor.rgb(0.0, 0.0, 0.0),
     frame_count: u64 = 0,
     frame_callback: ?FrameCallback = null,
-    last_time: u64 = 0,
+    pacer: FramePacer = FramePacer.init(.{}),
     pass_action: sgfx.PassAction = .{},
     triangle_renderer: ?TriangleRenderer = null,
     draw_triangle: bool = false,
+    /// Draw the frame profiler's overlay (toggled with F3)
+    profiler_overlay: bool = false,
     // Mouse tracking for click detection
     mouse_down_x: f32 = 0,
     mouse_down_y: f32 = 0,
@@ -87,6 +102,138 @@ var g_state: struct {
     mouse_is_down: bool = false,
 } = .{};
 
+// =============================================================================
+// Frame pacing
+// =============================================================================
+
+/// Display period assumed until frames have been measured
+const DefaultPeriodNs: f64 = std.time.ns_per_s / 60.0;
+/// Weight of each new measurement in the period estimate
+const PeriodSmoothing: f64 = 0.05;
+/// Frame intervals over which the estimate moves freely to the display rate
+const PeriodWarmupFrames: u32 = 30;
+const PeriodWarmupSmoothing: f64 = 0.2;
+/// A frame interval refines the estimate only within this fraction of a
+/// whole number of periods; anything noisier is a hitch, not a rate change
+const PeriodTolerance: f64 = 0.25;
+/// Decay of the frame work estimate; increases are taken at once
+const WorkSmoothing: f64 = 0.1;
+/// Low-latency mode aims to finish this long before the predicted present
+const LowLatencyMarginNs: f64 = 2 * std.time.ns_per_ms;
+
+/// Turns noisy frame-callback times into evenly spaced rAF timestamps
+/// aligned to the predicted present time, and decides how long to sleep
+/// before a frame to honor the FPS cap or low-latency mode. All times are
+/// nanoseconds on one monotonic clock.
+pub const FramePacer = struct {
+    /// Frame period requested by target_fps; 0 when uncapped
+    target_period_ns: f64,
+    low_latency: bool,
+    /// Estimated display (or capped) period
+    period_ns: f64,
+    /// CPU time from frame start to commit: peaks at once, decays slowly
+    work_ns: f64 = 0,
+    last_start_ns: ?f64 = null,
+    intervals: u32 = 0,
+    origin_ns: f64 = 0,
+    /// Whole periods covered by the last frame, times period_ns
+    delta_ns: f64,
+    /// Predicted present of the frame being built, on the caller's clock
+    present_ns: f64 = 0,
+    /// present_ns relative to the first frame, never decreasing
+    timestamp_ns: f64 = 0,
+
+    pub fn init(config: WindowConfig) FramePacer {
+        const target: f64 = if (config.target_fps == 0) 0 else std.time.ns_per_s / @as(f64, @floatFromInt(config.target_fps));
+        return .{
+            .target_period_ns = target,
+            .low_latency = config.low_latency,
+            .period_ns = DefaultPeriodNs,
+            .delta_ns = DefaultPeriodNs,
+        };
+    }
+
+    /// How long to sleep before starting a frame at `now_ns`. Nothing while
+    /// warming up: the estimate must see the display's own intervals, not
+    /// the capped or delayed ones the sleep would produce.
+    pub fn sleepBefore(self: *const FramePacer, now_ns: f64) f64 {
+        if (self.last_start_ns == null or self.intervals < PeriodWarmupFrames) return 0;
+        // Wake-ups count from the last frame's present, which the swap
+        // waits for; the last start may itself have been delayed
+        const present = self.present_ns;
+        var wake = present;
+        var n: f64 = 1;
+        if (self.target_period_ns > 0) {
+            // Every n-th vblank, woken half a period early so the swap
+            // lands on it: an even cadence, unlike sleeping to the cap
+            n = @max(1, @round(self.target_period_ns / self.period_ns));
+            wake = @max(wake, present + (n - 0.5) * self.period_ns);
+        }
+        if (self.low_latency) {
+            // Start as late as the work allows, so the tick runs as close
+            // to its present as possible. sokol pumps events right before
+            // the frame callback and presents right after it, with no hook
+            // in between, so input that arrives during this sleep waits
+            // for the next frame
+            wake = @max(wake, present + n * self.period_ns - self.work_ns - LowLatencyMarginNs);
+        }
+        return @max(wake - now_ns, 0);
+    }
+
+    /// Start a frame at `now_ns`, after any sleep.
+    pub fn beginFrame(self: *FramePacer, now_ns: f64) void {
+        const last = self.last_start_ns orelse {
+            self.last_start_ns = now_ns;
+            self.origin_ns = now_ns;
+            self.present_ns = now_ns + self.period_ns;
+            self.timestamp_ns = self.period_ns;
+            return;
+        };
+        const measured = now_ns - last;
+        if (measured <= 0) return;
+        self.last_start_ns = now_ns;
+        if (self.intervals < PeriodWarmupFrames) {
+            self.period_ns = if (self.intervals == 0) measured else self.period_ns + (measured - self.period_ns) * PeriodWarmupSmoothing;
+            self.intervals += 1;
+        }
+        const periods = @max(1, @round(measured / self.period_ns));
+        if (@abs(measured - periods * self.period_ns) < PeriodTolerance * self.period_ns) {
+            self.period_ns += (measured / periods - self.period_ns) * PeriodSmoothing;
+        }
+        // Whole periods: a missed vblank advances time by two, jitter by none
+        self.delta_ns = periods * self.period_ns;
+
+        // The present is the first vblank after the previous one that the
+        // work fits before. A start well before the previous present means
+        // the prediction has drifted ahead of the display: re-anchor on
+        // this start, as frames start just after a vblank
+        if (now_ns < self.present_ns - PeriodTolerance * self.period_ns) self.present_ns = now_ns;
+        const vblanks = @max(1, @ceil((now_ns + self.work_ns - self.present_ns) / self.period_ns));
+        self.present_ns += vblanks * self.period_ns;
+        self.timestamp_ns = @max(self.timestamp_ns, self.present_ns - self.origin_ns);
+    }
+
+    /// The frame is committed at `now_ns`; feeds the work estimate.
+    pub fn endFrame(self: *FramePacer, now_ns: f64) void {
+        const start = self.last_start_ns orelse return;
+        const work = now_ns - start;
+        self.work_ns = if (work > self.work_ns) work else self.work_ns + (work - self.work_ns) * WorkSmoothing;
+    }
+
+    /// rAF timestamp: when the frame being built is expected on screen.
+    pub fn timestampMs(self: *const FramePacer) f64 {
+        return self.timestamp_ns / std.time.ns_per_ms;
+    }
+
+    pub fn deltaSeconds(self: *const FramePacer) f64 {
+        return self.delta_ns / std.time.ns_per_s;
+    }
+
+    pub fn periodMs(self: *const FramePacer) f64 {
+        return self.period_ns / std.time.ns_per_ms;
+    }
+};
+
 // =============================================================================
 // Sokol callbacks
 // =============================================================================
@@ -107,6 +254,11 @@ fn sokolInit() callconv(.c) void {
         features.mrt_independent_write_mask,
     });
 
+    profiler_overlay.setup();
+
+    // The platform may give fewer samples than asked for
+    webgl_framebuffer.setSwapchainSamples(@intCast(sapp.sampleCount()));
+
     // Wire WebGL buffer backend to sokol
     webgl_state.globalBufferManager().setBackend(webgl_backend.getSokolBackend()) catch |err| {
         std.debug.print("[window] buffer backfill failed: {}\n", .{err});
@@ -118,7 +270,6 @@ fn sokolInit() callconv(.c) void {
     g_state.triangle_renderer = TriangleRenderer.init();
 
     g_state.state = .running;
-    g_state.last_time = sokol.time.now();
     updatePassAction();
     std.debug.print("[window] initialized {}x{}\n", .{
         sapp.width(),
@@ -127,39 +278,37 @@ fn sokolInit() callconv(.c) void {
 }
 
 fn sokolFrame() callconv(.c) void {
-    // Calculate delta time
-    const now = sokol.time.now();
-    const delta_ns = sokol.time.diff(now, g_state.last_time);
-    const delta_seconds = sokol.time.sec(delta_ns);
-    g_state.last_time = now;
+    const pacer = &g_state.pacer;
+    const sleep_ns = pacer.sleepBefore(sokol.time.ns(sokol.time.now()));
+    if (sleep_ns > 0) std.Thread.sleep(@intFromFloat(sleep_ns));
+    pacer.beginFrame(sokol.time.ns(sokol.time.now()));
+    profiler.beginFrame();
 
     // Call user frame callback if set
     if (g_state.frame_callback) |cb| {
-        cb(delta_seconds);
+        cb(pacer.deltaSeconds());
     }
 
-    // Begin default render pass with clear color
-    const pass_action = webgl_draw.consumePassAction(g_state.pass_action);
-    sgfx.beginPass(.{
-        .action = pass_action,
-        .swapchain = sglue.swapchain(),
-    });
-
-    // Draw triangle if enabled
-    if (g_state.draw_triangle) {
-        if (g_state.triangle_renderer) |renderer| {
-            renderer.draw();
-        }
-    }
-
-    // Flush queued WebGL draw calls
-    webgl_draw.flush();
-
-    // End pass and commit
-    sgfx.endPass();
+    // Flush queued WebGL draw calls, one pass per render target
+    webgl_draw.flush(sglue.swapchain(), g_state.pass_action, drawOverlay);
+    if (g_state.profiler_overlay) profiler_overlay.draw(sglue.swapchain());
+    const commit_zone = profiler.begin(.commit);
     sgfx.commit();
+    commit_zone.end();
+    pacer.endFrame(sokol.time.ns(sokol.time.now()));
+    profiler.endFrame();
 
     g_state.frame_count += 1;
+    const max_frames = g_state.config.max_frames;
+    if (max_frames != 0 and g_state.frame_count == max_frames) sapp.requestQuit();
+}
+
+/// Drawn into the window's pass before the frame's WebGL draws.
+fn drawOverlay() void {
+    if (!g_state.draw_triangle) return;
+    if (g_state.triangle_renderer) |renderer| {
+        renderer.draw();
+    }
 }
 
 fn sokolCleanup() callconv(.c) void {
@@ -169,6 +318,7 @@ fn sokolCleanup() callconv(.c) void {
         g_state.triangle_renderer = null;
     }
 
+    profiler_overlay.shutdown();
     sgfx.shutdown();
     g_state.state = .closed;
     std.debug.print("[window] shutdown after {} frames\n", .{g_state.frame_count});
@@ -201,9 +351,12 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
             if (ev.key_code == .ESCAPE) {
                 sapp.requestQuit();
             }
-            // Dispatch keydown event
+            if (ev.key_code == .F3 and !ev.key_repeat) {
+                setProfilerOverlay(!g_state.profiler_overlay);
+            }
+            // Queue keydown event
             const key_code: u32 = @intCast(@intFromEnum(ev.key_code));
-            js.dispatchKeyboardEvent(.keydown, .{
+            js.queueKeyboardEvent(.keydown, .{
                 .key = events.sokolKeyCodeToKey(key_code, shift),
                 .code = events.sokolKeyCodeToCode(key_code),
                 .keyCode = events.sokolKeyCodeToDom(key_code),
@@ -216,7 +369,7 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
         },
         .KEY_UP => {
             const key_code: u32 = @intCast(@intFromEnum(ev.key_code));
-            js.dispatchKeyboardEvent(.keyup, .{
+            js.queueKeyboardEvent(.keyup, .{
                 .key = events.sokolKeyCodeToKey(key_code, shift),
                 .code = events.sokolKeyCodeToCode(key_code),
                 .keyCode = events.sokolKeyCodeToDom(key_code),
@@ -240,7 +393,7 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
             g_state.mouse_down_button = button;
             g_state.mouse_is_down = true;
 
-            js.dispatchMouseEvent(.mousedown, .{
+            js.queueMouseEvent(.mousedown, .{
                 .clientX = @intFromFloat(ev.mouse_x),
                 .clientY = @intFromFloat(ev.mouse_y),
                 .button = button,
@@ -258,7 +411,7 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
                 .RIGHT => 2,
                 else => 0,
             };
-            js.dispatchMouseEvent(.mouseup, .{
+            js.queueMouseEvent(.mouseup, .{
                 .clientX = @intFromFloat(ev.mouse_x),
                 .clientY = @intFromFloat(ev.mouse_y),
                 .button = button,
@@ -289,17 +442,17 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
 
                     if (button == 2) {
                         // Right click -> contextmenu
-                        js.dispatchMouseEvent(.contextmenu, mouse_data);
+                        js.queueMouseEvent(.contextmenu, mouse_data);
                     } else {
                         // Left/middle click -> click
-                        js.dispatchMouseEvent(.click, mouse_data);
+                        js.queueMouseEvent(.click, mouse_data);
                     }
                 }
             }
             g_state.mouse_is_down = false;
         },
         .MOUSE_MOVE => {
-            js.dispatchMouseEvent(.mousemove, .{
+            js.queueMouseEvent(.mousemove, .{
                 .clientX = @intFromFloat(ev.mouse_x),
                 .clientY = @intFromFloat(ev.mouse_y),
                 .button = 0,
@@ -311,7 +464,7 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
             });
         },
         .MOUSE_SCROLL => {
-            js.dispatchMouseEvent(.wheel, .{
+            js.queueMouseEvent(.wheel, .{
                 .clientX = @intFromFloat(ev.mouse_x),
                 .clientY = @intFromFloat(ev.mouse_y),
                 .button = 0,
@@ -326,8 +479,8 @@ fn sokolEvent(event: [*c]const sapp.Event) callconv(.c) void {
             });
         },
         .RESIZED => {
-            // Dispatch resize event with new dimensions
-            js.dispatchResizeEvent(.{
+            // Queue resize event with new dimensions
+            js.queueResizeEvent(.{
                 .width = @intCast(sapp.width()),
                 .height = @intCast(sapp.height()),
             });
@@ -366,6 +519,7 @@ pub fn run(config: WindowConfig) void {
     g_state.clear_color = ClearColor.rgb(0.0, 0.0, 0.0);
     g_state.frame_count = 0;
     g_state.state = .uninitialized;
+    g_state.pacer = FramePacer.init(config);
 
     sapp.run(.{
         .init_cb = sokolInit,
@@ -376,6 +530,8 @@ pub fn run(config: WindowConfig) void {
         .height = @intCast(config.height),
         .window_title = config.title.ptr,
         .high_dpi = config.high_dpi,
+        .swap_interval = @intCast(@max(config.swap_interval, 1)),
+        .sample_count = @intCast(@max(config.sample_count, 1)),
         .logger = .{ .func = slog.func },
     });
 }
@@ -398,6 +554,17 @@ pub fn getClearColor() ClearColor {
     return g_state.clear_color;
 }
 
+/// rAF timestamp of the current frame in ms: its predicted present time,
+/// advancing in whole display periods
+pub fn frameTimestampMs() f64 {
+    return g_state.pacer.timestampMs();
+}
+
+/// Estimated display (or capped) frame period in ms
+pub fn framePeriodMs() f64 {
+    return g_state.pacer.periodMs();
+}
+
 /// Get frame count
 pub fn getFrameCount() u64 {
     return g_state.frame_count;
@@ -418,6 +585,13 @@ pub fn setDrawTriangle(enabled: bool) void {
     g_state.draw_triangle = enabled;
 }
 
+/// Show or hide the profiler overlay. Showing it starts the profiler,
+/// which keeps recording once it is hidden again.
+pub fn setProfilerOverlay(visible: bool) void {
+    g_state.profiler_overlay = visible;
+    if (visible) profiler.setEnabled(true);
+}
+
 /// Get window width
 pub fn getWidth() u32 {
     return @intCast(sapp.width());
@@ -488,6 +662,8 @@ test "WindowConfig has sensible defaults" {
     try testing.expectEqualStrings("three-native", config.title);
     try testing.expect(config.high_dpi);
     try testing.expectEqual(@as(u32, 60), config.target_fps);
+    try testing.expectEqual(@as(u32, 1), config.sample_count);
+    try testing.expectEqual(@as(u64, 0), config.max_frames);
 }
 
 test "ClearColor rgb constructor" {
@@ -535,3 +711,67 @@ test "Window initializes with custom config" {
 test "Window struct size is reasonable" {
     try testing.expect(@sizeOf(Window) <= 128);
 }
+
+test "FramePacer turns jittery frame times into whole display periods" {
+    const period = std.time.ns_per_s / 144.0;
+    var pacer = FramePacer.init(.{ .target_fps = 0 });
+    var last_timestamp: f64 = 0;
+    for (0..400) |i| {
+        const jitter: f64 = @as(f64, @floatFromInt(i % 5)) * 0.3 * std.time.ns_per_ms - 0.6 * std.time.ns_per_ms;
+        pacer.beginFrame(@as(f64, @floatFromInt(i)) * period + jitter);
+        try testing.expect(pacer.timestampMs() >= last_timestamp);
+        last_timestamp = pacer.timestampMs();
+    }
+    try testing.expectApproxEqRel(period, pacer.period_ns, 0.02);
+    try testing.expectEqual(pacer.period_ns, pacer.delta_ns);
+
+    // A missed vblank counts as two periods
+    pacer.beginFrame(401 * period);
+    try testing.expectEqual(2 * pacer.period_ns, pacer.delta_ns);
+}
+
+/// Drive a pacer against a display whose swaps block until the next vblank,
+/// recording when each frame starts and is presented.
+fn simulateBlockingSwaps(pacer: *FramePacer, period: f64, work: f64, starts: []f64, presents: []f64) !void {
+    var now: f64 = 0;
+    for (starts, presents, 0..) |*start, *present, i| {
+        const sleep = pacer.sleepBefore(now);
+        // Warm-up frames run unpaced, so the estimate sees the display
+        if (i <= PeriodWarmupFrames) try testing.expectEqual(@as(f64, 0), sleep);
+        now += sleep;
+        pacer.beginFrame(now);
+        start.* = now;
+        now += work;
+        pacer.endFrame(now);
+        now = @ceil(now / period) * period;
+        present.* = now;
+    }
+    try testing.expectApproxEqRel(period, pacer.period_ns, 0.001);
+}
+
+test "FramePacer caps on whole vblanks and starts late in low-latency mode" {
+    const ms = std.time.ns_per_ms;
+    const period = std.time.ns_per_s / 144.0;
+    const frames = PeriodWarmupFrames + 8;
+    var starts: [frames]f64 = undefined;
+    var presents: [frames]f64 = undefined;
+
+    // 60 FPS on a 144 Hz display: every second vblank, woken half a
+    // period early
+    var capped = FramePacer.init(.{ .target_fps = 60 });
+    try simulateBlockingSwaps(&capped, period, 1 * ms, &starts, &presents);
+    for (PeriodWarmupFrames + 2..frames) |i| {
+        try testing.expectApproxEqAbs(2 * period, presents[i] - presents[i - 1], 1);
+        try testing.expectApproxEqAbs(presents[i] - 0.5 * period, starts[i], 1);
+    }
+
+    // Low latency: every vblank, started as late as the work allows
+    var low_latency = FramePacer.init(.{ .target_fps = 0, .low_latency = true });
+    try simulateBlockingSwaps(&low_latency, period, 3 * ms, &starts, &presents);
+    for (PeriodWarmupFrames + 2..frames) |i| {
+        try testing.expectApproxEqAbs(period, presents[i] - presents[i - 1], 1);
+        try testing.expectApproxEqAbs(presents[i] - 3 * ms - LowLatencyMarginNs, starts[i], 1);
+    }
+    // The rAF timestamp was the actual present
+    try testing.expectApproxEqAbs(presents[frames - 1] - low_latency.origin_ns, low_latency.timestamp_ns, 1);
+}
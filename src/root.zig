@@ -7,21 +7,46 @@ const std = @import("std");
 // Platform modules
 pub const window = @import("platform/window.zig");
 pub const renderer = @import("platform/renderer.zig");
+pub const profiler_overlay = @import("platform/profiler_overlay.zig");
 
 // Runtime modules
 pub const js = @import("runtime/js.zig");
 pub const events = @import("runtime/events.zig");
+pub const bytecode_bundle = @import("runtime/bytecode_bundle.zig");
+pub const worker_messages = @import("runtime/worker_messages.zig");
+pub const frame_bench = @import("runtime/frame_bench.zig");
+pub const manifest = @import("runtime/manifest.zig");
 
 // Shim modules
 pub const globals = @import("shim/globals.zig");
 pub const webgl = @import("shim/webgl.zig");
+pub const cpu_block_pool = @import("shim/cpu_block_pool.zig");
+pub const handle_table = @import("shim/handle_table.zig");
+pub const lazy_pages = @import("shim/lazy_pages.zig");
 pub const webgl_state = @import("shim/webgl_state.zig");
 pub const webgl_backend = @import("shim/webgl_backend.zig");
 pub const webgl_shader = @import("shim/webgl_shader.zig");
 pub const webgl_program = @import("shim/webgl_program.zig");
+pub const shader_cache = @import("shim/shader_cache.zig");
 pub const webgl_draw = @import("shim/webgl_draw.zig");
 pub const webgl_texture = @import("shim/webgl_texture.zig");
+pub const webgl_framebuffer = @import("shim/webgl_framebuffer.zig");
+pub const webgl_query = @import("shim/webgl_query.zig");
+pub const webgl_readback = @import("shim/webgl_readback.zig");
 pub const image_loader = @import("shim/image_loader.zig");
+pub const ktx2 = @import("shim/ktx2.zig");
+pub const lz4 = @import("shim/lz4.zig");
+pub const asset_archive = @import("shim/asset_archive.zig");
+pub const spsc_ring = @import("shim/spsc_ring.zig");
+pub const job_system = @import("shim/job_system.zig");
+pub const image_decode = @import("shim/image_decode.zig");
+pub const audio_decode = @import("shim/audio_decode.zig");
+pub const web_audio = @import("shim/web_audio.zig");
+pub const file_stream = @import("shim/file_stream.zig");
+pub const pixel_kernels = @import("shim/pixel_kernels.zig");
+pub const utf8 = @import("shim/utf8.zig");
+pub const math_kernels = @import("shim/math_kernels.zig");
+pub const profiler = @import("shim/profiler.zig");
 
 // Re-export main types for convenience
 pub const Window = window.Window;
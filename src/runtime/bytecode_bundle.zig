@@ -0,0 +1,208 @@
+//! Precompiled script bundle
+//!
+//! Holds mquickjs bytecode for a game's scripts so that a shipped build
+//! neither parses nor ships their sources. Layout (little endian):
+//!
+//!   header   magic "TNBC", version, script count, reserved
+//!   index    fixed-size entries in bundle order; the first is the entry
+//!            script run at startup
+//!   names    script names as passed to load(), without "./" prefixes
+//!   code     one mquickjs bytecode image per script (JS_PrepareBytecode
+//!            output, relocated to address 0), each on 16 bytes
+//!
+//! Bytecode is relocated and executed in place, so a bundle is read into
+//! one aligned, writable buffer that lives as long as the JS context.
+//! Bundles are written by `three_native --compile-bytecode` (the `bytecode`
+//! build step) and are specific to the pointer width and stdlib they were
+//! compiled against.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub const Magic = "TNBC";
+pub const Version: u32 = 1;
+/// Alignment of each bytecode image and of the buffer holding the bundle.
+pub const CodeAlignment = 16;
+const code_alignment = std.mem.Alignment.fromByteUnits(CodeAlignment);
+/// Each loaded script takes one of mquickjs' ROM atom tables
+/// (N_ROM_ATOM_TABLES_MAX, one is the stdlib's).
+pub const MaxScripts = 8;
+
+const HeaderBytes: usize = 16;
+const IndexEntryBytes: usize = 16;
+
+pub const FormatError = error{ NotBundle, UnsupportedVersion, Truncated, TooManyScripts, BadIndex };
+
+pub const Script = struct {
+    name: []const u8,
+    /// Bytecode image, aligned to CodeAlignment; relocated in place on load
+    code: []align(CodeAlignment) u8,
+};
+
+pub const Bundle = struct {
+    scripts_buf: [MaxScripts]Script,
+    count: usize,
+
+    pub fn scripts(self: *const Bundle) []const Script {
+        return self.scripts_buf[0..self.count];
+    }
+};
+
+pub fn isBundle(bytes: []const u8) bool {
+    return bytes.len >= HeaderBytes and std.mem.eql(u8, bytes[0..4], Magic);
+}
+
+/// Split a bundle held in `bytes` into its scripts. The scripts borrow
+/// `bytes`, which must be aligned so that every image is.
+pub fn parse(bytes: []align(CodeAlignment) u8) FormatError!Bundle {
+    if (bytes.len < HeaderBytes) return error.Truncated;
+    if (!isBundle(bytes)) return error.NotBundle;
+    if (readU32(bytes, 4) != Version) return error.UnsupportedVersion;
+    const count = readU32(bytes, 8);
+    if (count > MaxScripts) return error.TooManyScripts;
+    if (count * IndexEntryBytes > bytes.len - HeaderBytes) return error.Truncated;
+
+    var bundle: Bundle = .{ .scripts_buf = undefined, .count = count };
+    for (bundle.scripts_buf[0..count], 0..) |*script, i| {
+        const at = HeaderBytes + i * IndexEntryBytes;
+        const name_offset: usize = readU32(bytes, at);
+        const name_len: usize = readU32(bytes, at + 4);
+        const code_offset: usize = readU32(bytes, at + 8);
+        const code_len: usize = readU32(bytes, at + 12);
+        if (name_offset > bytes.len or name_len > bytes.len - name_offset) return error.BadIndex;
+        if (code_offset > bytes.len or code_len > bytes.len - code_offset) return error.BadIndex;
+        if (code_offset % CodeAlignment != 0) return error.BadIndex;
+        script.* = .{
+            .name = bytes[name_offset..][0..name_len],
+            .code = @alignCast(bytes[code_offset..][0..code_len]),
+        };
+    }
+    return bundle;
+}
+
+/// Read a file into a buffer aligned for parse().
+pub fn readFile(allocator: std.mem.Allocator, path: []const u8, max_bytes: usize) ![]align(CodeAlignment) u8 {
+    const file = try std.fs.cwd().openFile(path, .{});
+    defer file.close();
+    const size = try file.getEndPos();
+    if (size > max_bytes) return error.FileTooBig;
+    const bytes = try allocator.alignedAlloc(u8, code_alignment, @intCast(size));
+    errdefer allocator.free(bytes);
+    if (try file.preadAll(bytes, 0) != bytes.len) return error.Truncated;
+    return bytes;
+}
+
+/// Name under which load() finds a script: its path without "./" prefixes.
+pub fn scriptName(path: []const u8) []const u8 {
+    var name = path;
+    while (std.mem.startsWith(u8, name, "./")) name = name[2..];
+    return name;
+}
+
+// =============================================================================
+// Writing
+// =============================================================================
+
+pub const Source = struct {
+    name: []const u8,
+    code: []const u8,
+};
+
+pub const WriteError = error{ TooManyScripts, DuplicateName, TooLarge } || std.Io.Writer.Error;
+
+/// Write a bundle of `sources` in order; the first is the entry script.
+pub fn writeBundle(sources: []const Source, out: *std.Io.Writer) WriteError!void {
+    if (sources.len > MaxScripts) return error.TooManyScripts;
+    var names_len: usize = 0;
+    for (sources, 0..) |source, i| {
+        for (sources[0..i]) |prev| {
+            if (std.mem.eql(u8, prev.name, source.name)) return error.DuplicateName;
+        }
+        names_len += source.name.len;
+    }
+
+    const names_offset = HeaderBytes + sources.len * IndexEntryBytes;
+    var code_offset = std.mem.alignForward(usize, names_offset + names_len, CodeAlignment);
+    var end = code_offset;
+    for (sources) |source| end = std.mem.alignForward(usize, end + source.code.len, CodeAlignment);
+    if (end > std.math.maxInt(u32)) return error.TooLarge;
+
+    try out.writeAll(Magic);
+    try out.writeInt(u32, Version, .little);
+    try out.writeInt(u32, @intCast(sources.len), .little);
+    try out.writeInt(u32, 0, .little);
+
+    var name_offset = names_offset;
+    for (sources) |source| {
+        try out.writeInt(u32, @intCast(name_offset), .little);
+        try out.writeInt(u32, @intCast(source.name.len), .little);
+        try out.writeInt(u32, @intCast(code_offset), .little);
+        try out.writeInt(u32, @intCast(source.code.len), .little);
+        name_offset += source.name.len;
+        code_offset = std.mem.alignForward(usize, code_offset + source.code.len, CodeAlignment);
+    }
+    for (sources) |source| try out.writeAll(source.name);
+
+    var written = names_offset + names_len;
+    for (sources) |source| {
+        const aligned = std.mem.alignForward(usize, written, CodeAlignment);
+        try out.splatByteAll(0, aligned - written);
+        try out.writeAll(source.code);
+        written = aligned + source.code.len;
+    }
+}
+
+fn readU32(bytes: []const u8, offset: usize) u32 {
+    return std.mem.readInt(u32, bytes[offset..][0..4], .little);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "bytecode bundle keeps script order and aligns images" {
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    try writeBundle(&.{
+        .{ .name = "game.js", .code = "entry-image" },
+        .{ .name = "examples/three.es5.js", .code = "library" },
+    }, &aw.writer);
+
+    const bytes = try testing.allocator.alignedAlloc(u8, code_alignment, aw.written().len);
+    defer testing.allocator.free(bytes);
+    @memcpy(bytes, aw.written());
+
+    const bundle = try parse(bytes);
+    try testing.expectEqual(@as(usize, 2), bundle.scripts().len);
+    try testing.expectEqualStrings("game.js", bundle.scripts()[0].name);
+    try testing.expectEqualStrings("entry-image", bundle.scripts()[0].code);
+    try testing.expectEqualStrings("examples/three.es5.js", bundle.scripts()[1].name);
+    try testing.expectEqualStrings("library", bundle.scripts()[1].code);
+    for (bundle.scripts()) |script| {
+        try testing.expect(std.mem.isAligned(@intFromPtr(script.code.ptr), CodeAlignment));
+    }
+    try testing.expectEqualStrings("examples/a.js", scriptName("././examples/a.js"));
+}
+
+test "bytecode bundle rejects malformed input" {
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    try testing.expectError(error.DuplicateName, writeBundle(&.{
+        .{ .name = "a.js", .code = "1" },
+        .{ .name = "a.js", .code = "2" },
+    }, &aw.writer));
+
+    var buf: [32]u8 align(CodeAlignment) = @splat(0);
+    try testing.expectError(error.Truncated, parse(buf[0..8]));
+    try testing.expectError(error.NotBundle, parse(&buf));
+    @memcpy(buf[0..4], Magic);
+    std.mem.writeInt(u32, buf[4..8], Version, .little);
+    std.mem.writeInt(u32, buf[8..12], MaxScripts + 1, .little);
+    try testing.expectError(error.TooManyScripts, parse(&buf));
+    // One script whose image runs past the end
+    std.mem.writeInt(u32, buf[8..12], 1, .little);
+    std.mem.writeInt(u32, buf[16..20], 0, .little);
+    std.mem.writeInt(u32, buf[24..28], 16, .little);
+    std.mem.writeInt(u32, buf[28..32], 64, .little);
+    try testing.expectError(error.BadIndex, parse(&buf));
+}
@@ -1,9 +1,13 @@
-//! Event system types and key code mapping
+//! Event system types, input queue and key code mapping
 //!
-//! Provides event types and key code mapping for DOM event handling.
-//! Event listener registration is handled in js.zig.
+//! Provides event types and key code mapping for DOM event handling. Input
+//! from the sokol event callback goes through a bounded SPSC ring and is
+//! drained once per frame into a FrameBatch, which folds runs of
+//! mousemove, wheel and resize events into one event each. Event listener
+//! registration and dispatch are handled in js.zig.
 
 const std = @import("std");
+const spsc_ring = @import("../shim/spsc_ring.zig");
 
 // =============================================================================
 // Event Types
@@ -97,6 +101,94 @@ pub const ResizeEventData = struct {
     height: u32 = 0,
 };
 
+// =============================================================================
+// Input Queue
+// =============================================================================
+
+pub const InputEvent = struct {
+    event_type: EventType,
+    data: Data,
+
+    pub const Data = union(enum) {
+        mouse: MouseEventData,
+        keyboard: KeyboardEventData,
+        resize: ResizeEventData,
+    };
+};
+
+/// Events buffered between frames. At 1000 Hz input and 30 FPS a frame
+/// sees ~35 moves, so the ring only fills when frames stall for seconds;
+/// events that do not fit are dropped.
+pub const QueueCapacity = 512;
+pub const InputRing = spsc_ring.SpscRing(InputEvent, QueueCapacity);
+
+/// Whether `next` folds into `prev`, the event queued just before it.
+/// Moves and resizes only report the latest state; wheel deltas add up
+/// while the delta mode stays the same.
+pub fn coalesces(prev: InputEvent, next: InputEvent) bool {
+    if (prev.event_type != next.event_type) return false;
+    return switch (prev.event_type) {
+        .mousemove, .resize => true,
+        .wheel => prev.data.mouse.deltaMode == next.data.mouse.deltaMode,
+        else => false,
+    };
+}
+
+fn coalesce(prev: *InputEvent, next: InputEvent) void {
+    if (prev.event_type == .wheel) {
+        var merged = next;
+        merged.data.mouse.deltaX += prev.data.mouse.deltaX;
+        merged.data.mouse.deltaY += prev.data.mouse.deltaY;
+        prev.* = merged;
+    } else {
+        prev.* = next;
+    }
+}
+
+/// One frame of input after coalescing. `raw` keeps every drained event in
+/// order, for getCoalescedEvents(); each batched event covers a run of it.
+pub const FrameBatch = struct {
+    raw: [QueueCapacity]InputEvent = undefined,
+    raw_len: usize = 0,
+    events: [QueueCapacity]Batched = undefined,
+    len: usize = 0,
+
+    pub const Batched = struct {
+        event: InputEvent,
+        first: u32,
+        count: u32,
+    };
+
+    /// Drain `ring` (at most one ring's worth) into the batch, replacing
+    /// the previous frame.
+    pub fn fill(self: *FrameBatch, ring: *InputRing) void {
+        self.raw_len = 0;
+        self.len = 0;
+        while (self.raw_len < QueueCapacity) {
+            const event = ring.pop() orelse break;
+            self.raw[self.raw_len] = event;
+            if (self.len > 0 and coalesces(self.events[self.len - 1].event, event)) {
+                const last = &self.events[self.len - 1];
+                coalesce(&last.event, event);
+                last.count += 1;
+            } else {
+                self.events[self.len] = .{ .event = event, .first = @intCast(self.raw_len), .count = 1 };
+                self.len += 1;
+            }
+            self.raw_len += 1;
+        }
+    }
+
+    pub fn batched(self: *const FrameBatch) []const Batched {
+        return self.events[0..self.len];
+    }
+
+    /// The raw events folded into `b`, oldest first.
+    pub fn coalesced(self: *const FrameBatch, b: Batched) []const InputEvent {
+        return self.raw[b.first..][0..b.count];
+    }
+};
+
 // =============================================================================
 // Key Code Mapping (Sokol Keycode -> DOM keyCode)
 // =============================================================================
@@ -280,3 +372,35 @@ test "sokolKeyCodeToDom mapping" {
     // Escape
     try testing.expectEqual(@as(u32, 27), sokolKeyCodeToDom(256));
 }
+
+test "FrameBatch folds runs of moves and wheel deltas" {
+    const testing = std.testing;
+    var ring = InputRing{};
+    const move = struct {
+        fn at(x: i32) InputEvent {
+            return .{ .event_type = .mousemove, .data = .{ .mouse = .{ .clientX = x } } };
+        }
+    }.at;
+    const wheel: InputEvent = .{ .event_type = .wheel, .data = .{ .mouse = .{ .deltaY = 120 } } };
+    const down: InputEvent = .{ .event_type = .mousedown, .data = .{ .mouse = .{ .clientX = 3 } } };
+    for ([_]InputEvent{ move(1), move(2), move(3), down, move(4), wheel, wheel, wheel }) |event| {
+        try testing.expect(ring.push(event));
+    }
+
+    var batch = FrameBatch{};
+    batch.fill(&ring);
+    const events = batch.batched();
+    try testing.expectEqual(@as(usize, 4), events.len);
+    // Moves keep the latest position, and remember each raw move
+    try testing.expectEqual(@as(i32, 3), events[0].event.data.mouse.clientX);
+    try testing.expectEqual(@as(usize, 3), batch.coalesced(events[0]).len);
+    try testing.expectEqual(@as(i32, 1), batch.coalesced(events[0])[0].data.mouse.clientX);
+    // A button press splits the run, so ordering is preserved
+    try testing.expectEqual(EventType.mousedown, events[1].event.event_type);
+    try testing.expectEqual(@as(i32, 4), events[2].event.data.mouse.clientX);
+    try testing.expectEqual(@as(f32, 360), events[3].event.data.mouse.deltaY);
+    try testing.expectEqual(@as(u32, 0), ring.len());
+
+    batch.fill(&ring);
+    try testing.expectEqual(@as(usize, 0), batch.batched().len);
+}
@@ -0,0 +1,195 @@
+//! Frame benchmark recorder
+//!
+//! Keeps every frame the profiler completes during a benchmark run (the
+//! profiler's own ring only holds the last few seconds) and reports frame
+//! time and per-zone percentiles, startup time and peak memory as JSON for
+//! `zig build bench`.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const testing = std.testing;
+const profiler = @import("../shim/profiler.zig");
+
+pub const RunInfo = struct {
+    scene: []const u8,
+    /// Process start to the end of the first frame
+    startup_ns: u64,
+    peak_rss_bytes: u64,
+};
+
+pub const FrameBench = struct {
+    allocator: std.mem.Allocator,
+    /// Per frame, ZoneCount zone totals; zone .frame is the frame time
+    zone_ns: []u64,
+    capacity: usize,
+    count: usize = 0,
+    /// End of the first recorded frame, on the profiler clock
+    first_end_ns: ?u64 = null,
+    /// Profiler frames already seen, so each is recorded once
+    seen: u64 = 0,
+
+    const Self = @This();
+
+    pub fn init(allocator: std.mem.Allocator, frames: usize) !Self {
+        return .{
+            .allocator = allocator,
+            .zone_ns = try allocator.alloc(u64, frames * profiler.ZoneCount),
+            .capacity = frames,
+        };
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.allocator.free(self.zone_ns);
+    }
+
+    pub fn record(self: *Self, frame: *const profiler.Frame) void {
+        if (self.first_end_ns == null) self.first_end_ns = frame.start_ns + frame.zoneNs(.frame);
+        if (self.count == self.capacity) return;
+        self.zone_ns[self.count * profiler.ZoneCount ..][0..profiler.ZoneCount].* = frame.total_ns;
+        self.count += 1;
+    }
+
+    /// Record the frames `prof` completed since the last call. Call at
+    /// least once per MaxFrames frames.
+    pub fn recordNew(self: *Self, prof: *const profiler.Profiler) void {
+        const missed = prof.count - self.seen;
+        const kept = prof.frameCount();
+        const first = kept - @min(missed, kept);
+        for (first..kept) |i| self.record(prof.frame(i));
+        self.seen = prof.count;
+    }
+
+    fn zoneSamples(self: *const Self, zone: profiler.Zone, out: []u64) []u64 {
+        for (out[0..self.count], 0..) |*sample, i| {
+            sample.* = self.zone_ns[i * profiler.ZoneCount + @intFromEnum(zone)];
+        }
+        const samples = out[0..self.count];
+        std.mem.sort(u64, samples, {}, std.sort.asc(u64));
+        return samples;
+    }
+
+    pub fn writeJson(self: *const Self, out: *std.Io.Writer, info: RunInfo) !void {
+        const scratch = try self.allocator.alloc(u64, self.count);
+        defer self.allocator.free(scratch);
+
+        try out.print("{{\"scene\":{f},\"frames\":{d},\"startupMs\":{d:.3},\"peakRssBytes\":{d},\"frameMs\":", .{
+            std.json.fmt(info.scene, .{}),
+            self.count,
+            nsToMs(info.startup_ns),
+            info.peak_rss_bytes,
+        });
+        try writeStats(out, self.zoneSamples(.frame, scratch));
+        try out.writeAll(",\"phasesMs\":{");
+        var first = true;
+        for (std.enums.values(profiler.Zone)) |zone| {
+            if (zone == .frame) continue;
+            if (!first) try out.writeByte(',');
+            first = false;
+            try out.print("\"{s}\":", .{@tagName(zone)});
+            try writeStats(out, self.zoneSamples(zone, scratch));
+        }
+        try out.writeAll("}}\n");
+    }
+};
+
+fn writeStats(out: *std.Io.Writer, sorted: []const u64) !void {
+    var sum: u64 = 0;
+    for (sorted) |ns| sum += ns;
+    const mean = if (sorted.len == 0) 0 else sum / sorted.len;
+    try out.print("{{\"mean\":{d:.3},\"p50\":{d:.3},\"p95\":{d:.3},\"p99\":{d:.3},\"max\":{d:.3}}}", .{
+        nsToMs(mean),
+        nsToMs(percentile(sorted, 50)),
+        nsToMs(percentile(sorted, 95)),
+        nsToMs(percentile(sorted, 99)),
+        nsToMs(if (sorted.len == 0) 0 else sorted[sorted.len - 1]),
+    });
+}
+
+/// Nearest-rank percentile of ascending `sorted`.
+pub fn percentile(sorted: []const u64, p: u32) u64 {
+    if (sorted.len == 0) return 0;
+    const rank = std.math.divCeil(usize, sorted.len * p, 100) catch unreachable;
+    return sorted[@max(rank, 1) - 1];
+}
+
+fn nsToMs(ns: u64) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+}
+
+/// Peak resident set size of the process, 0 where it cannot be read.
+pub fn peakRssBytes() u64 {
+    switch (builtin.os.tag) {
+        .linux => {
+            const usage = std.posix.getrusage(std.posix.rusage.SELF);
+            return @as(u64, @intCast(usage.maxrss)) * 1024;
+        },
+        .macos => {
+            const usage = std.posix.getrusage(std.posix.rusage.SELF);
+            return @intCast(usage.maxrss);
+        },
+        else => return 0,
+    }
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "percentile uses the nearest rank" {
+    const samples = [_]u64{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    try testing.expectEqual(@as(u64, 5), percentile(&samples, 50));
+    try testing.expectEqual(@as(u64, 10), percentile(&samples, 95));
+    try testing.expectEqual(@as(u64, 1), percentile(&samples, 0));
+    try testing.expectEqual(@as(u64, 0), percentile(&.{}, 99));
+}
+
+test "FrameBench records each profiler frame once and reports JSON" {
+    const prof = try testing.allocator.create(profiler.Profiler);
+    defer testing.allocator.destroy(prof);
+    prof.* = .{};
+    var bench = try FrameBench.init(testing.allocator, 4);
+    defer bench.deinit();
+
+    var t: u64 = 1_000_000;
+    for (0..3) |i| {
+        prof.beginFrame(t);
+        prof.beginZone(.flush, t);
+        prof.endZone(t + (i + 1) * 1_000_000);
+        // 10, 12 and 14 ms
+        prof.endFrame(t + (10 + 2 * i) * 1_000_000);
+        t += 16_000_000;
+        bench.recordNew(prof);
+    }
+    bench.recordNew(prof);
+    // Two more than fit
+    for (0..2) |_| {
+        prof.beginFrame(t);
+        prof.endFrame(t + 1_000_000);
+        t += 16_000_000;
+    }
+    bench.recordNew(prof);
+    try testing.expectEqual(@as(usize, 4), bench.count);
+    try testing.expectEqual(@as(?u64, 11_000_000), bench.first_end_ns);
+
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    try bench.writeJson(&aw.writer, .{ .scene = "cube.js", .startup_ns = 11_000_000, .peak_rss_bytes = 4096 });
+
+    const parsed = try std.json.parseFromSlice(std.json.Value, testing.allocator, aw.written(), .{});
+    defer parsed.deinit();
+    const root = parsed.value.object;
+    try testing.expectEqualStrings("cube.js", root.get("scene").?.string);
+    try testing.expectEqual(@as(i64, 4), root.get("frames").?.integer);
+    try testing.expectApproxEqAbs(@as(f64, 11), root.get("startupMs").?.float, 0.001);
+    // Frames of 10, 12, 14 and 1 ms; the fifth and sixth did not fit
+    const frame = root.get("frameMs").?.object;
+    try testing.expectApproxEqAbs(@as(f64, 9.25), frame.get("mean").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 10), frame.get("p50").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 14), frame.get("p95").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 14), frame.get("max").?.float, 0.001);
+    // Flush zones of 1, 2 and 3 ms, and none in the last frame
+    const flush = root.get("phasesMs").?.object.get("flush").?.object;
+    try testing.expectApproxEqAbs(@as(f64, 1.5), flush.get("mean").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 1), flush.get("p50").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 3), flush.get("max").?.float, 0.001);
+}
@@ -4,6 +4,7 @@
 //! are implemented in Zig and provided through the stdlib table.
 
 const std = @import("std");
+const builtin = @import("builtin");
 const sokol = @import("sokol");
 const sg = sokol.gfx;
 const sapp = sokol.app;
@@ -13,8 +14,28 @@ const webgl_shader = @import("../shim/webgl_shader.zig");
 const webgl_program = @import("../shim/webgl_program.zig");
 const webgl_draw = @import("../shim/webgl_draw.zig");
 const webgl_texture = @import("../shim/webgl_texture.zig");
+const webgl_framebuffer = @import("../shim/webgl_framebuffer.zig");
+const webgl_query = @import("../shim/webgl_query.zig");
+const webgl_readback = @import("../shim/webgl_readback.zig");
 const image_loader = @import("../shim/image_loader.zig");
+const image_decode = @import("../shim/image_decode.zig");
+const audio_decode = @import("../shim/audio_decode.zig");
+const web_audio = @import("../shim/web_audio.zig");
+const job_system = @import("../shim/job_system.zig");
+const pixel_kernels = @import("../shim/pixel_kernels.zig");
+const cpu_block_pool = @import("../shim/cpu_block_pool.zig");
+const lazy_pages = @import("../shim/lazy_pages.zig");
+const ktx2 = @import("../shim/ktx2.zig");
+const utf8 = @import("../shim/utf8.zig");
+const math_kernels = @import("../shim/math_kernels.zig");
+const asset_archive = @import("../shim/asset_archive.zig");
+const file_stream = @import("../shim/file_stream.zig");
+const webgl_backend = @import("../shim/webgl_backend.zig");
+const gl_uniforms = @import("../shim/gl_uniforms.zig");
+const profiler = @import("../shim/profiler.zig");
 const events = @import("events.zig");
+const bytecode_bundle = @import("bytecode_bundle.zig");
+const worker_messages = @import("worker_messages.zig");
 
 const c = @cImport({
     @cInclude("mquickjs_bindings.h");
@@ -33,22 +54,192 @@ pub const SharedState = struct {
 /// Maximum length for asset root path
 const MaxAssetRootLen: usize = 1024;
 
-/// Maximum concurrent fetch buffers
-const MaxFetchBuffers: usize = 16;
+/// Largest body fetch() will load: the mquickjs ArrayBuffer length limit.
+/// In practice the JS heap size is the tighter bound.
+const MaxFetchBytes: u64 = (1 << 30) - 1;
+
+/// Timer or animation frame callbacks by id. The functions live in one
+/// rooted JS array, indexed by slot, so the table grows without moving GC
+/// roots and holds none per callback. Ids are never reused.
+const CallbackTable = struct {
+    funcs: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
+    rooted: bool = false,
+    entries: std.AutoHashMapUnmanaged(i32, Callback) = .empty,
+    free_slots: std.ArrayListUnmanaged(u32) = .empty,
+    slot_count: u32 = 0,
+    next_id: i32 = 1,
+
+    const Callback = struct {
+        slot: u32,
+        /// Set for setInterval()
+        interval_ms: ?f64 = null,
+    };
+
+    /// Store the function in args[0] under a new id. args[0] is read after
+    /// any JS allocation.
+    fn add(self: *CallbackTable, ctx: *c.JSContext, allocator: std.mem.Allocator, args: [*]c.JSValue, interval_ms: ?f64) !i32 {
+        if (!self.rooted) {
+            const funcs = c.JS_AddGCRef(ctx, &self.funcs);
+            funcs.* = c.JS_NewArray(ctx, 0);
+            self.rooted = true;
+            if (funcs.* == c.JS_EXCEPTION) {
+                c.JS_DeleteGCRef(ctx, &self.funcs);
+                self.rooted = false;
+                return error.JsException;
+            }
+        }
+        try self.entries.ensureUnusedCapacity(allocator, 1);
+        // Room for every slot, so that remove() never allocates
+        try self.free_slots.ensureTotalCapacity(allocator, self.slot_count + 1);
+        const slot = self.free_slots.pop() orelse self.slot_count;
+        if (c.JS_SetPropertyUint32(ctx, self.funcs.val, slot, args[0]) == c.JS_EXCEPTION) {
+            if (slot < self.slot_count) self.free_slots.appendAssumeCapacity(slot);
+            return error.JsException;
+        }
+        if (slot == self.slot_count) self.slot_count += 1;
+
+        const id = self.next_id;
+        self.next_id = if (id == std.math.maxInt(i32)) 1 else id + 1;
+        self.entries.putAssumeCapacity(id, .{ .slot = slot, .interval_ms = interval_ms });
+        return id;
+    }
+
+    /// The function stored for a slot; valid until the next allocation.
+    fn func(self: *const CallbackTable, ctx: *c.JSContext, slot: u32) c.JSValue {
+        return c.JS_GetPropertyUint32(ctx, self.funcs.val, slot);
+    }
 
-const MaxTimers = 16;
-const MaxRaf = 16;
+    fn remove(self: *CallbackTable, ctx: *c.JSContext, id: i32) void {
+        const removed = self.entries.fetchRemove(id) orelse return;
+        _ = c.JS_SetPropertyUint32(ctx, self.funcs.val, removed.value.slot, c.JS_UNDEFINED);
+        self.free_slots.appendAssumeCapacity(removed.value.slot);
+    }
 
-const Timer = struct {
-    allocated: bool = false,
-    timeout_ms: f64 = 0,
-    func: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
+    fn deinit(self: *CallbackTable, ctx: *c.JSContext, allocator: std.mem.Allocator) void {
+        if (self.rooted) c.JS_DeleteGCRef(ctx, &self.funcs);
+        self.entries.deinit(allocator);
+        self.free_slots.deinit(allocator);
+        self.* = .{};
+    }
 };
 
-const RafEntry = struct {
-    active: bool = false,
-    id: i32 = 0,
-    func: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
+/// A pending timer deadline. Cleared timers leave their entry behind until
+/// it comes up or Runtime.clearTimer compacts the queue.
+const TimerEntry = struct {
+    due_ms: f64,
+    /// Scheduling order: equal deadlines fire first come, first served
+    seq: u64,
+    id: i32,
+
+    fn order(_: void, a: TimerEntry, b: TimerEntry) std.math.Order {
+        return switch (std.math.order(a.due_ms, b.due_ms)) {
+            .eq => std.math.order(a.seq, b.seq),
+            else => |o| o,
+        };
+    }
+
+    fn lessThan(_: void, a: TimerEntry, b: TimerEntry) bool {
+        return order({}, a, b) == .lt;
+    }
+};
+
+const TimerQueue = std.PriorityQueue(TimerEntry, void, TimerEntry.order);
+
+/// A script loaded from a bytecode bundle. `main` points into the bundle
+/// buffer, outside the GC heap, so it never moves.
+const BytecodeScript = struct {
+    name: []const u8,
+    main: c.JSValue,
+};
+
+/// Heap for compiling one script. Parsing the ~1 MB Three.js bundle needs
+/// several times its size; the heap is discarded after compilation.
+const CompileHeapBytes: usize = 64 * 1024 * 1024;
+
+/// Property slot cache for the interpreter's get_field/put_field sites
+/// (JS_SetPropertyCache). Entries are 24 bytes on 64-bit targets and the
+/// entry count is rounded down to a power of two, so this covers 1024
+/// sites, enough for the Three.js render loop. Kept outside the JS heap,
+/// which stays small.
+const PropertyCacheBytes: usize = 32 * 1024;
+
+/// Idle collection starts once this fraction of the heap is in use, if the
+/// frame has slack for the expected pause.
+const GcIdleOccupancy = 0.70;
+/// Above this an allocation-triggered GC is close, so collect in idle time
+/// even when the pause overruns the slack.
+const GcUrgentOccupancy = 0.90;
+/// Skip idle collection when less than this fraction of the heap could be
+/// reclaimed, so a large live set does not cause a GC every frame.
+const GcMinGarbageFraction = 0.10;
+
+pub const GcStats = struct {
+    /// Collections run from frame slack by collectIdle()
+    idle_count: u32 = 0,
+    /// Collections started because an allocation did not fit, mid-frame
+    forced_count: u32 = 0,
+    /// All collections, including explicit gc() calls
+    total_count: u32 = 0,
+    total_pause_ns: u64 = 0,
+    max_pause_ns: u64 = 0,
+    last_pause_ns: u64 = 0,
+    /// Longest pause not scheduled by collectIdle(): the ones that hitch
+    max_unscheduled_pause_ns: u64 = 0,
+    /// Heap and stack area, as given to Runtime.init
+    total_bytes: usize = 0,
+    /// Allocated bytes, garbage included
+    heap_bytes: usize = 0,
+    /// Heap size right after the last collection
+    live_bytes: usize = 0,
+};
+
+/// Pause bookkeeping updated by the mquickjs GC hook.
+const GcTimer = struct {
+    started_ns: i128 = 0,
+    started_heap_bytes: usize = 0,
+    idle: bool = false,
+    idle_count: u32 = 0,
+    total_pause_ns: u64 = 0,
+    max_pause_ns: u64 = 0,
+    last_pause_ns: u64 = 0,
+    max_unscheduled_pause_ns: u64 = 0,
+    /// last pause per heap byte, to estimate the next one
+    ns_per_byte: f64 = 0,
+    /// Profiler zone of the collection underway, idle or forced
+    zone: profiler.Scope = .{ .active = false },
+};
+
+/// The thread a JS context belongs to. mquickjs contexts are
+/// single-threaded, so rather than locking, every Runtime method checks in
+/// safe builds that it runs on the owner. Ownership moves only through an
+/// explicit release on one thread and acquire on the next.
+const ThreadOwner = struct {
+    /// Owning thread id; 0 while released
+    id: std.atomic.Value(std.Thread.Id),
+
+    fn check(self: *const ThreadOwner) void {
+        if (std.debug.runtime_safety) {
+            std.debug.assert(self.id.load(.monotonic) == std.Thread.getCurrentId());
+        }
+    }
+
+    fn release(self: *ThreadOwner) void {
+        self.check();
+        self.id.store(0, .release);
+    }
+
+    fn acquire(self: *ThreadOwner) bool {
+        const current = std.Thread.getCurrentId();
+        const prev = self.id.cmpxchgStrong(0, current, .acquire, .monotonic) orelse return true;
+        return prev == current;
+    }
+};
+
+pub const PropertyCacheStats = struct {
+    /// Lookups answered from a site's cached slot
+    hits: u64,
+    /// Lookups that went through the property hash table and refilled the entry
+    misses: u64,
 };
 
 pub const Runtime = struct {
@@ -56,38 +247,74 @@ pub const Runtime = struct {
     mem_buf: []u8,
     allocator: std.mem.Allocator,
     shared: SharedState,
-    timers: [MaxTimers]Timer,
-    raf: [MaxRaf]RafEntry,
-    next_raf_id: i32,
+    timers: CallbackTable,
+    /// Min-heap of timer deadlines
+    timer_queue: TimerQueue,
+    timer_seq: u64,
+    raf: CallbackTable,
+    /// Animation frame ids in request order, for the next runRaf()
+    raf_queue: std.ArrayListUnmanaged(i32),
+    /// The frame being run; requests made meanwhile go to raf_queue
+    raf_running: std.ArrayListUnmanaged(i32),
+    /// queueMicrotask() / Promise jobs are waiting for runMicrotasks()
+    microtasks_pending: bool,
     dom_installed: bool,
     asset_root_buf: [MaxAssetRootLen]u8,
     asset_root_len: usize,
+    /// Mounted asset archive; replaces the asset root for fetch()
+    archive: ?asset_archive.Archive,
+    /// Bundle adopted by loadBytecode(); its scripts execute in place
+    bytecode_buf: ?[]align(bytecode_bundle.CodeAlignment) u8,
+    bytecode_scripts: [bytecode_bundle.MaxScripts]BytecodeScript,
+    bytecode_count: usize,
+    /// Backing store of the interpreter's property slot cache
+    prop_cache: []u64,
+    gc_timer: GcTimer,
+    owner: ThreadOwner,
+    /// Set on the runtime of a Web Worker thread
+    worker: ?*WebWorker,
 
     const Self = @This();
 
     pub fn init(allocator: std.mem.Allocator, mem_size: usize) !Self {
-        const mem_buf = try allocator.alloc(u8, mem_size);
-        errdefer allocator.free(mem_buf);
+        // The heap is committed page by page as the GC reaches it
+        const mem_buf = try lazy_pages.alloc(allocator, u8, mem_size);
+        errdefer lazy_pages.free(allocator, mem_buf);
+        const prop_cache = try allocator.alloc(u64, PropertyCacheBytes / @sizeOf(u64));
+        errdefer allocator.free(prop_cache);
 
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
         const ctx = c.JS_NewContext(mem_buf.ptr, mem_size, &js_stdlib) orelse {
             return error.ContextCreationFailed;
         };
 
         c.JS_SetLogFunc(ctx, logFunc);
+        const prop_cache_bytes = std.mem.sliceAsBytes(prop_cache);
+        c.JS_SetPropertyCache(ctx, prop_cache_bytes.ptr, prop_cache_bytes.len);
+        c.JS_SetGCHook(ctx, gcHook);
 
         var self = Self{
             .ctx = ctx,
             .mem_buf = mem_buf,
             .allocator = allocator,
             .shared = .{},
-            .timers = [_]Timer{.{}} ** MaxTimers,
-            .raf = [_]RafEntry{.{}} ** MaxRaf,
-            .next_raf_id = 1,
+            .timers = .{},
+            .timer_queue = TimerQueue.init(allocator, {}),
+            .timer_seq = 0,
+            .raf = .{},
+            .raf_queue = .empty,
+            .raf_running = .empty,
+            .microtasks_pending = false,
             .dom_installed = false,
             .asset_root_buf = undefined,
             .asset_root_len = 0,
+            .archive = null,
+            .bytecode_buf = null,
+            .bytecode_scripts = undefined,
+            .bytecode_count = 0,
+            .prop_cache = prop_cache,
+            .gc_timer = .{},
+            .owner = .{ .id = .init(std.Thread.getCurrentId()) },
+            .worker = null,
         };
         self.setAssetRoot(".") catch {};
         return self;
@@ -117,35 +344,247 @@ pub const Runtime = struct {
         return self.asset_root_buf[0..self.asset_root_len];
     }
 
+    /// Serve fetch() from a packed asset archive instead of the asset root.
+    /// Image loads look in the archive first and fall back to loose files.
+    /// Replaces any archive already mounted; fetches in flight then fail.
+    pub fn mountArchive(self: *Self, path: []const u8) !void {
+        const archive = try asset_archive.Archive.open(self.allocator, path);
+        self.unmountArchive();
+        self.archive = archive;
+    }
+
+    pub fn unmountArchive(self: *Self) void {
+        if (self.archive) |*archive| {
+            // Streams may be reading the mapping
+            abortFetches(self.ctx, true);
+            archive.close();
+        }
+        self.archive = null;
+    }
+
+    /// Adopt a bundle written by `three_native --compile-bytecode`, allocated
+    /// with the runtime's allocator (see bytecode_bundle.readFile). Must run
+    /// before any source is evaluated, installDomStubs() included: mquickjs
+    /// only links bytecode into a context with no atoms in its heap. The
+    /// runtime owns `bytes` from here on, since the code runs in place.
+    pub fn loadBytecode(self: *Self, bytes: []align(bytecode_bundle.CodeAlignment) u8) !void {
+        if (self.bytecode_buf != null) {
+            self.allocator.free(bytes);
+            return error.BytecodeAlreadyLoaded;
+        }
+        const bundle = bytecode_bundle.parse(bytes) catch |err| {
+            self.allocator.free(bytes);
+            return err;
+        };
+        // Kept until deinit even on error: loaded images are linked into the context
+        self.bytecode_buf = bytes;
+
+        self.owner.check();
+        for (bundle.scripts()) |script| {
+            if (c.JS_RelocateBytecode(self.ctx, script.code.ptr, @intCast(script.code.len)) != 0) {
+                return error.InvalidBytecode;
+            }
+            const main = c.JS_LoadBytecode(self.ctx, script.code.ptr);
+            if (main == c.JS_EXCEPTION) {
+                dumpException(self.ctx);
+                return error.InvalidBytecode;
+            }
+            self.bytecode_scripts[self.bytecode_count] = .{ .name = script.name, .main = main };
+            self.bytecode_count += 1;
+        }
+    }
+
+    /// Run the entry (first) script of the loaded bundle. The others run
+    /// when the entry load()s them by name.
+    pub fn runBytecodeEntry(self: *Self) !void {
+        if (self.bytecode_count == 0) return error.NoBytecode;
+        self.owner.check();
+        if (c.JS_Run(self.ctx, self.bytecode_scripts[0].main) == c.JS_EXCEPTION) {
+            dumpException(self.ctx);
+            return error.EvalFailed;
+        }
+    }
+
+    /// Compiled code of a script by its load() path, if the bundle has it.
+    fn findBytecode(self: *const Self, path: []const u8) ?c.JSValue {
+        const name = bytecode_bundle.scriptName(path);
+        for (self.bytecode_scripts[0..self.bytecode_count]) |script| {
+            if (std.mem.eql(u8, script.name, name)) return script.main;
+        }
+        return null;
+    }
+
+    /// Compile a script to a bytecode image for a bundle; the caller owns
+    /// the result. Runs in a throwaway context prepared for compilation, so
+    /// no runtime is needed.
+    pub fn compileBytecode(allocator: std.mem.Allocator, source: []const u8, filename: [:0]const u8) ![]u8 {
+        const sanitized = try sanitizeScriptBytes(allocator, source);
+        defer if (sanitized.owned) allocator.free(sanitized.bytes);
+        // The parser expects a NUL after the source
+        const code = try allocator.dupeZ(u8, sanitized.bytes);
+        defer allocator.free(code);
+
+        const mem_buf = try allocator.alloc(u8, CompileHeapBytes);
+        defer allocator.free(mem_buf);
+        const ctx = c.JS_NewContext2(mem_buf.ptr, mem_buf.len, &js_stdlib, 1) orelse {
+            return error.ContextCreationFailed;
+        };
+        defer c.JS_FreeContext(ctx);
+        c.JS_SetLogFunc(ctx, logFunc);
+
+        const func = c.JS_Parse(ctx, code.ptr, sanitized.bytes.len, filename.ptr, 0);
+        if (func == c.JS_EXCEPTION) {
+            dumpException(ctx);
+            return error.CompileFailed;
+        }
+        var header: c.JSBytecodeHeader = undefined;
+        var data: [*c]const u8 = null;
+        var data_len: u32 = 0;
+        c.JS_PrepareBytecode(ctx, &header, &data, &data_len, func);
+        // Relocate to address 0 so the image does not depend on this heap
+        if (c.JS_RelocateBytecode2(ctx, &header, @constCast(data), data_len, 0, 0) != 0) {
+            return error.CompileFailed;
+        }
+
+        const header_bytes = std.mem.asBytes(&header);
+        const image = try allocator.alloc(u8, header_bytes.len + data_len);
+        @memcpy(image[0..header_bytes.len], header_bytes);
+        @memcpy(image[header_bytes.len..], data[0..data_len]);
+        return image;
+    }
+
     pub fn deinit(self: *Self) void {
+        self.owner.check();
         if (g_runtime == self) {
             g_runtime = null;
         }
-        // Clean up event system before freeing context (needs valid context for JS_DeleteGCRef)
-        deinitEventSystem();
-        // Clean up native images to avoid memory leaks
-        for (&g_native_images) |*img| {
-            if (img.active) {
-                img.deinit();
+        // Events, fetches, images, audio and the job system belong to the main runtime
+        if (self.worker == null) {
+            stopWebWorkers();
+            // Clean up event system before freeing context (needs valid context for JS_DeleteGCRef)
+            deinitEventSystem();
+            // Join IO and job workers, then drop loads that will never be delivered
+            abortFetches(self.ctx, false);
+            g_image_decoder.stop();
+            g_audio_decoder.stop();
+            webgl_program.globalProgramTable().useJobSystem(null);
+            g_jobs.stop();
+            web_audio.graph().shutdown();
+            for (&g_pending_images) |*pending| {
+                if (pending.active) {
+                    c.JS_DeleteGCRef(self.ctx, &pending.img);
+                    pending.* = .{};
+                }
+            }
+            for (&g_pending_audio) |*pending| {
+                if (pending.active) {
+                    c.JS_DeleteGCRef(self.ctx, &pending.target);
+                    pending.* = .{};
+                }
+            }
+            // Clean up native images to avoid memory leaks
+            for (&g_native_images) |*img| {
+                if (img.active) {
+                    img.deinit();
+                }
             }
+            g_unpack_scratch.clearAndFree(std.heap.page_allocator);
         }
-        g_js_mutex.lock();
+        self.unmountArchive();
+        self.timers.deinit(self.ctx, self.allocator);
+        self.timer_queue.deinit();
+        self.raf.deinit(self.ctx, self.allocator);
+        self.raf_queue.deinit(self.allocator);
+        self.raf_running.deinit(self.allocator);
         c.JS_FreeContext(self.ctx);
-        g_js_mutex.unlock();
-        self.allocator.free(self.mem_buf);
+        lazy_pages.free(self.allocator, self.mem_buf);
+        self.allocator.free(self.prop_cache);
+        if (self.bytecode_buf) |buf| self.allocator.free(buf);
+    }
+
+    /// Hit and miss counts of the property slot cache since the last reset.
+    pub fn propertyCacheStats(self: *const Self) PropertyCacheStats {
+        var stats: PropertyCacheStats = undefined;
+        self.owner.check();
+        c.JS_GetPropertyCacheStats(self.ctx, &stats.hits, &stats.misses);
+        return stats;
+    }
+
+    pub fn resetPropertyCacheStats(self: *Self) void {
+        self.owner.check();
+        c.JS_ResetPropertyCacheStats(self.ctx);
+    }
+
+    /// Collect garbage in the time left in a frame, once the heap is full
+    /// enough that an allocation would soon force a collection mid-frame.
+    /// Call after tick() with the remaining frame budget. Returns true if
+    /// a collection ran. Needs makeCurrent() for pause timing.
+    pub fn collectIdle(self: *Self, slack_ms: f64) bool {
+        self.owner.check();
+        var info: c.JSMemoryInfo = undefined;
+        c.JS_GetMemoryInfo(self.ctx, &info);
+        const total: f64 = @floatFromInt(info.total_size);
+        const occupancy = 1.0 - @as(f64, @floatFromInt(info.free_size)) / total;
+        if (occupancy < GcIdleOccupancy) return false;
+        // live_size is 0 until the first collection: all of it may be garbage
+        const garbage: f64 = @floatFromInt(info.heap_size -| info.live_size);
+        if (garbage < GcMinGarbageFraction * total) return false;
+        const expected_ms = self.gc_timer.ns_per_byte * @as(f64, @floatFromInt(info.heap_size)) / std.time.ns_per_ms;
+        if (expected_ms > slack_ms and occupancy < GcUrgentOccupancy) return false;
+
+        self.gc_timer.idle = true;
+        defer self.gc_timer.idle = false;
+        c.JS_GC(self.ctx);
+        return true;
+    }
+
+    /// GC pause counters and heap occupancy.
+    pub fn gcStats(self: *const Self) GcStats {
+        self.owner.check();
+        return self.readGcStats();
+    }
+
+    fn readGcStats(self: *const Self) GcStats {
+        var info: c.JSMemoryInfo = undefined;
+        c.JS_GetMemoryInfo(self.ctx, &info);
+        const t = &self.gc_timer;
+        return .{
+            .idle_count = t.idle_count,
+            .forced_count = info.gc_forced_count,
+            .total_count = info.gc_count,
+            .total_pause_ns = t.total_pause_ns,
+            .max_pause_ns = t.max_pause_ns,
+            .last_pause_ns = t.last_pause_ns,
+            .max_unscheduled_pause_ns = t.max_unscheduled_pause_ns,
+            .total_bytes = info.total_size,
+            .heap_bytes = info.heap_size,
+            .live_bytes = info.live_size,
+        };
     }
 
     pub fn makeCurrent(self: *Self) void {
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
+        self.owner.check();
         g_runtime = self;
         c.JS_SetContextOpaque(self.ctx, self);
         g_start_time_ms = std.time.milliTimestamp();
     }
 
+    /// Let another thread take the runtime over with acquireThread(). The
+    /// runtime must not be touched in between; the release/acquire pair
+    /// publishes everything written before the handoff.
+    pub fn releaseThread(self: *Self) void {
+        self.owner.release();
+    }
+
+    /// Become the JS thread after releaseThread(), taking over submission
+    /// to the job system as well.
+    pub fn acquireThread(self: *Self) error{RuntimeOwnedElsewhere}!void {
+        if (!self.owner.acquire()) return error.RuntimeOwnedElsewhere;
+        if (g_jobs.started) g_jobs.adopt();
+    }
+
     pub fn eval(self: *Self, code: []const u8, filename: [:0]const u8) !void {
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
+        self.owner.check();
         const val = c.JS_Eval(self.ctx, code.ptr, code.len, filename.ptr, 0);
         if (val == c.JS_EXCEPTION) {
             dumpException(self.ctx);
@@ -154,8 +593,7 @@ pub const Runtime = struct {
     }
 
     pub fn evalInt(self: *Self, code: []const u8, filename: [:0]const u8) !i32 {
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
+        self.owner.check();
         const val = c.JS_Eval(self.ctx, code.ptr, code.len, filename.ptr, c.JS_EVAL_RETVAL);
         if (val == c.JS_EXCEPTION) {
             dumpException(self.ctx);
@@ -169,17 +607,38 @@ pub const Runtime = struct {
     }
 
     pub fn tick(self: *Self, timestamp_ms: f64) void {
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
+        self.owner.check();
+        const zone = profiler.begin(.tick);
+        defer zone.end();
         self.shared.time_ms = timestamp_ms;
+        // Microtasks queued by scripts since the last tick, then after each
+        // step, as a browser does after each task
+        self.runMicrotasks();
+        self.deliverImages();
+        self.runMicrotasks();
+        self.deliverAudio();
+        self.runMicrotasks();
+        self.deliverFetches();
+        self.runMicrotasks();
+        deliverWorkerMessages(self.ctx);
+        self.runMicrotasks();
+        const timers_zone = profiler.begin(.timers);
         self.runTimers(timestamp_ms);
+        timers_zone.end();
+        if (g_event_ctx) |ctx| {
+            const input_zone = profiler.begin(.input);
+            deliverInput(ctx);
+            self.runMicrotasks();
+            input_zone.end();
+        }
+        const raf_zone = profiler.begin(.raf);
         self.runRaf(timestamp_ms);
+        raf_zone.end();
     }
 
     pub fn installDomStubs(self: *Self) !void {
         if (self.dom_installed) return;
-        g_js_mutex.lock();
-        defer g_js_mutex.unlock();
+        self.owner.check();
         try createDomStubs(self.ctx);
         self.dom_installed = true;
     }
@@ -189,48 +648,169 @@ pub const Runtime = struct {
         return &self.shared;
     }
 
+    /// Hand finished background decodes to their Image objects, at most
+    /// MaxImageLoadsPerFrame per tick so a burst of loads is spread out.
+    fn deliverImages(self: *Self) void {
+        if (!g_image_decoder.started) return;
+        var delivered: usize = 0;
+        while (delivered < MaxImageLoadsPerFrame) : (delivered += 1) {
+            const result = g_image_decoder.poll() orelse return;
+            deliverImage(self.ctx, result);
+        }
+    }
+
+    /// Pump the audio graph, then hand finished decodes (at most
+    /// MaxAudioDecodesPerFrame) and ended sources to JS.
+    fn deliverAudio(self: *Self) void {
+        if (self.worker != null) return;
+        const graph = web_audio.graph();
+        graph.pump();
+        if (g_audio_decoder.started) {
+            var delivered: usize = 0;
+            while (delivered < MaxAudioDecodesPerFrame) : (delivered += 1) {
+                const result = g_audio_decoder.poll() orelse break;
+                deliverDecodedAudio(self.ctx, result);
+            }
+        }
+        while (graph.pollEnded()) |node| deliverAudioEnded(self.ctx, node);
+    }
+
+    /// Hand streamed fetch events to JS, bounded per tick by event count and
+    /// by body bytes copied so a large load is spread over frames.
+    fn deliverFetches(self: *Self) void {
+        if (!g_file_streams.started) return;
+        var copied: usize = 0;
+        var delivered: usize = 0;
+        while (delivered < MaxFetchEventsPerFrame and copied < MaxFetchBytesPerFrame) : (delivered += 1) {
+            const event = g_file_streams.poll() orelse return;
+            copied += deliverFetchEvent(self.ctx, event);
+        }
+    }
+
+    /// Schedule the function in args[0] to run `delay_ms` from the current
+    /// tick, every `delay_ms` if `repeat`.
+    fn scheduleTimer(self: *Self, args: [*]c.JSValue, delay_ms: f64, repeat: bool) !i32 {
+        const id = try self.timers.add(self.ctx, self.allocator, args, if (repeat) delay_ms else null);
+        errdefer self.timers.remove(self.ctx, id);
+        try self.timer_queue.add(.{ .due_ms = self.shared.time_ms + delay_ms, .seq = self.timer_seq, .id = id });
+        self.timer_seq += 1;
+        return id;
+    }
+
     fn runTimers(self: *Self, now_ms: f64) void {
-        for (&self.timers) |*timer| {
-            if (!timer.allocated) continue;
-            if (timer.timeout_ms > now_ms) continue;
+        // Timers set by the callbacks below wait for the next tick, even
+        // with no delay: they order after everything already due
+        const seq_limit = self.timer_seq;
+        while (self.timer_queue.peek()) |next| {
+            if (next.due_ms > now_ms or next.seq >= seq_limit) break;
+            _ = self.timer_queue.remove();
+            const timer = self.timers.entries.get(next.id) orelse continue;
 
             if (c.JS_StackCheck(self.ctx, 2) != 0) {
                 dumpException(self.ctx);
-                return;
+                self.timers.remove(self.ctx, next.id);
+                continue;
             }
-
-            c.JS_PushArg(self.ctx, timer.func.val);
+            c.JS_PushArg(self.ctx, self.timers.func(self.ctx, timer.slot));
             c.JS_PushArg(self.ctx, c.JS_NULL);
+            // Settled before the call, so clearTimeout/clearInterval in the
+            // callback itself behave
+            if (timer.interval_ms) |interval_ms| {
+                self.timer_queue.add(.{ .due_ms = now_ms + interval_ms, .seq = self.timer_seq, .id = next.id }) catch {
+                    self.timers.remove(self.ctx, next.id);
+                };
+                self.timer_seq += 1;
+            } else {
+                self.timers.remove(self.ctx, next.id);
+            }
             const ret = c.JS_Call(self.ctx, 0);
             if (c.JS_IsException(ret) != 0) {
                 dumpException(self.ctx);
             }
+            self.runMicrotasks();
+        }
+    }
+
+    /// Time until the earliest timer is due, or null when none is set.
+    fn nextTimerDelay(self: *Self, now_ms: f64) ?f64 {
+        self.dropClearedTimers();
+        const next = self.timer_queue.peek() orelse return null;
+        return @max(next.due_ms - now_ms, 0);
+    }
+
+    /// clearTimeout and clearInterval. The queue entry is left in place and
+    /// dropped once it reaches the front; when cleared entries outnumber
+    /// live timers the queue is rebuilt, so cleared long timeouts do not
+    /// pile up.
+    fn clearTimer(self: *Self, id: i32) void {
+        self.timers.remove(self.ctx, id);
+        self.dropClearedTimers();
+        const live = self.timers.entries.count();
+        if (self.timer_queue.count() > 2 * live) self.compactTimers();
+    }
+
+    fn dropClearedTimers(self: *Self) void {
+        while (self.timer_queue.peek()) |next| {
+            if (self.timers.entries.contains(next.id)) return;
+            _ = self.timer_queue.remove();
+        }
+    }
 
-            c.JS_DeleteGCRef(self.ctx, &timer.func);
-            timer.allocated = false;
+    /// Keep only the entries of live timers. A sorted array is a valid heap.
+    fn compactTimers(self: *Self) void {
+        const items = self.timer_queue.items;
+        var kept: usize = 0;
+        for (items) |entry| {
+            if (!self.timers.entries.contains(entry.id)) continue;
+            items[kept] = entry;
+            kept += 1;
         }
+        self.timer_queue.items = items[0..kept];
+        std.sort.pdq(TimerEntry, self.timer_queue.items, {}, TimerEntry.lessThan);
     }
 
     fn runRaf(self: *Self, now_ms: f64) void {
-        for (&self.raf) |*entry| {
-            if (!entry.active) continue;
+        // Callbacks requested from here on run next frame
+        std.mem.swap(std.ArrayListUnmanaged(i32), &self.raf_queue, &self.raf_running);
+        defer self.raf_running.clearRetainingCapacity();
+        for (self.raf_running.items) |id| {
+            const entry = self.raf.entries.get(id) orelse continue;
 
             if (c.JS_StackCheck(self.ctx, 3) != 0) {
                 dumpException(self.ctx);
-                return;
+                self.raf.remove(self.ctx, id);
+                continue;
             }
 
             const time_val = c.JS_NewFloat64(self.ctx, now_ms);
             c.JS_PushArg(self.ctx, time_val);
-            c.JS_PushArg(self.ctx, entry.func.val);
+            c.JS_PushArg(self.ctx, self.raf.func(self.ctx, entry.slot));
             c.JS_PushArg(self.ctx, c.JS_NULL);
+            self.raf.remove(self.ctx, id);
             const ret = c.JS_Call(self.ctx, 1);
             if (c.JS_IsException(ret) != 0) {
                 dumpException(self.ctx);
             }
+            self.runMicrotasks();
+        }
+    }
 
-            c.JS_DeleteGCRef(self.ctx, &entry.func);
-            entry.active = false;
+    /// Drain the Promise polyfill's microtask queue if anything was queued
+    /// since the last drain.
+    fn runMicrotasks(self: *Self) void {
+        if (!self.microtasks_pending) return;
+        self.microtasks_pending = false;
+        if (c.JS_StackCheck(self.ctx, 2) != 0) {
+            dumpException(self.ctx);
+            return;
+        }
+        const global = c.JS_GetGlobalObject(self.ctx);
+        const run = c.JS_GetPropertyStr(self.ctx, global, "__runMicrotasks");
+        if (c.JS_IsFunction(self.ctx, run) == 0) return;
+        c.JS_PushArg(self.ctx, run);
+        c.JS_PushArg(self.ctx, c.JS_NULL);
+        if (c.JS_IsException(c.JS_Call(self.ctx, 0)) != 0) {
+            dumpException(self.ctx);
         }
     }
 };
@@ -239,15 +819,11 @@ pub const Runtime = struct {
 // Global runtime pointer for C callbacks
 // =============================================================================
 
-var g_runtime: ?*Runtime = null;
-var g_start_time_ms: i64 = 0;
-var g_js_mutex: std.Thread.Mutex = .{};
+// Per thread: each Web Worker runs its own runtime
+threadlocal var g_runtime: ?*Runtime = null;
+threadlocal var g_start_time_ms: i64 = 0;
 
 const MaxTextureUnits: usize = 8;
-const MaxTextures: usize = 256;
-const MaxFramebuffers: usize = 64;
-const MaxRenderbuffers: usize = 64;
-const MaxVertexArrays: usize = 64;
 const MaxNativeImages: usize = 64;
 
 // =============================================================================
@@ -274,48 +850,37 @@ const NativeImage = struct {
 var g_native_images: [MaxNativeImages]NativeImage = [_]NativeImage{.{}} ** MaxNativeImages;
 var g_next_native_image_id: u32 = 1;
 
-// =============================================================================
-// Native Fetch Buffer Pool
-// =============================================================================
+/// Decoded images handed to JS per tick; the rest stay queued.
+const MaxImageLoadsPerFrame: usize = 8;
 
-const NativeFetchBuffer = struct {
+/// An Image waiting on a background decode job.
+const PendingImage = struct {
     active: bool = false,
-    data: ?[]u8 = null,
-    allocator: ?std.mem.Allocator = null,
-
-    fn deinit(self: *NativeFetchBuffer) void {
-        if (self.data) |d| {
-            if (self.allocator) |alloc| {
-                alloc.free(d);
-            }
-        }
-        self.* = .{};
-    }
+    job_id: u32 = 0,
+    img: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
 };
 
-var g_fetch_buffers: [MaxFetchBuffers]NativeFetchBuffer = [_]NativeFetchBuffer{.{}} ** MaxFetchBuffers;
+/// CPU jobs for the JS thread (decode, batched math); see jobSystem()
+var g_jobs: job_system.JobSystem = .{};
+var g_image_decoder: image_decode.DecodePool = .{};
+var g_pending_images: [image_decode.MaxPending]PendingImage = [_]PendingImage{.{}} ** image_decode.MaxPending;
 
-fn allocFetchBuffer() ?u32 {
-    for (g_fetch_buffers[0..], 0..) |*buf, i| {
-        if (!buf.active) {
-            buf.active = true;
-            return @intCast(i);
-        }
-    }
-    return null;
-}
+/// Fetch events handed to JS per tick, and the body bytes copied with them;
+/// the rest wait on the IO side, which stops reading ahead when full.
+const MaxFetchEventsPerFrame: usize = 64;
+const MaxFetchBytesPerFrame: usize = 16 * 1024 * 1024;
 
-fn getFetchBuffer(handle: u32) ?*NativeFetchBuffer {
-    if (handle >= MaxFetchBuffers) return null;
-    if (!g_fetch_buffers[handle].active) return null;
-    return &g_fetch_buffers[handle];
-}
+/// A fetch whose body is streaming in. `body` is the ArrayBuffer chunks are
+/// copied into, allocated once the length is known.
+const PendingFetch = struct {
+    active: bool = false,
+    stream_id: u32 = 0,
+    loaded: usize = 0,
+    body: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
+};
 
-fn freeFetchBuffer(handle: u32) void {
-    if (handle < MaxFetchBuffers) {
-        g_fetch_buffers[handle].deinit();
-    }
-}
+var g_file_streams: file_stream.StreamPool = .{};
+var g_pending_fetches: [file_stream.MaxStreams]PendingFetch = [_]PendingFetch{.{}} ** file_stream.MaxStreams;
 
 // =============================================================================
 // Event Listener Storage
@@ -339,6 +904,8 @@ pub fn initEventSystem(ctx: *c.JSContext) void {
     for (&g_event_listeners) |*listener| {
         listener.active = false;
     }
+    g_event_objects_ready = @splat(false);
+    while (g_input_ring.pop() != null) {}
     log.debug("Event system initialized", .{});
 }
 
@@ -352,8 +919,14 @@ pub fn deinitEventSystem() void {
                 listener.active = false;
             }
         }
+        for (&g_event_objects, &g_event_objects_ready) |*ref, *ready| {
+            if (ready.*) c.JS_DeleteGCRef(ctx, ref);
+            ready.* = false;
+        }
     }
     g_event_ctx = null;
+    g_coalesced_moves = &.{};
+    g_coalesced_wheels = &.{};
 }
 
 /// Add an event listener (called from js_addEventListener)
@@ -393,63 +966,161 @@ fn removeEventListenerInternal(event_type: events.EventType, callback: c.JSValue
     return false;
 }
 
-/// Dispatch a mouse event to all registered listeners
-pub fn dispatchMouseEvent(event_type: events.EventType, data: events.MouseEventData) void {
-    const ctx = g_event_ctx orelse return;
+/// Input waiting for the next tick, and the current frame's coalesced batch
+var g_input_ring: events.InputRing = .{};
+var g_input_batch: events.FrameBatch = .{};
+var g_input_dropped: u32 = 0;
+/// Raw events behind the last delivered mousemove and wheel, for
+/// getCoalescedEvents(); valid until the next tick replaces the batch
+var g_coalesced_moves: []const events.InputEvent = &.{};
+var g_coalesced_wheels: []const events.InputEvent = &.{};
 
-    // Create the event object
-    const event_obj = createMouseEventObject(ctx, event_type, data);
-    if (c.JS_IsException(event_obj) != 0) {
-        log.err("Failed to create mouse event object", .{});
-        return;
-    }
+/// One reusable event object per type, refilled for each dispatch
+var g_event_objects: [std.meta.fields(events.EventType).len]c.JSGCRef = undefined;
+var g_event_objects_ready: [std.meta.fields(events.EventType).len]bool = @splat(false);
 
-    // Call all matching listeners
-    for (&g_event_listeners) |*listener| {
-        if (listener.active and listener.event_type == event_type) {
-            callEventListener(ctx, listener.callback.val, event_obj);
-        }
+fn queueInputEvent(event: events.InputEvent) void {
+    if (g_event_ctx == null) return;
+    if (!g_input_ring.push(event)) {
+        if (g_input_dropped == 0) log.warn("input queue full, dropping events", .{});
+        g_input_dropped +%= 1;
     }
 }
 
-/// Dispatch a keyboard event to all registered listeners
-pub fn dispatchKeyboardEvent(event_type: events.EventType, data: events.KeyboardEventData) void {
-    const ctx = g_event_ctx orelse return;
+/// Queue a mouse event for the next tick. Runs in the sokol event callback
+/// and touches no JS state.
+pub fn queueMouseEvent(event_type: events.EventType, data: events.MouseEventData) void {
+    queueInputEvent(.{ .event_type = event_type, .data = .{ .mouse = data } });
+}
+
+/// Queue a keyboard event for the next tick
+pub fn queueKeyboardEvent(event_type: events.EventType, data: events.KeyboardEventData) void {
+    queueInputEvent(.{ .event_type = event_type, .data = .{ .keyboard = data } });
+}
 
-    // Create the event object
-    const event_obj = createKeyboardEventObject(ctx, event_type, data);
-    if (c.JS_IsException(event_obj) != 0) {
-        log.err("Failed to create keyboard event object", .{});
-        return;
-    }
+/// Queue a resize event for the next tick
+pub fn queueResizeEvent(data: events.ResizeEventData) void {
+    queueInputEvent(.{ .event_type = .resize, .data = .{ .resize = data } });
+}
 
-    // Call all matching listeners
-    for (&g_event_listeners) |*listener| {
-        if (listener.active and listener.event_type == event_type) {
-            callEventListener(ctx, listener.callback.val, event_obj);
+/// Dispatch the input queued since the last tick, after coalescing, to all
+/// registered listeners.
+fn deliverInput(ctx: *c.JSContext) void {
+    g_coalesced_moves = &.{};
+    g_coalesced_wheels = &.{};
+    g_input_batch.fill(&g_input_ring);
+    for (g_input_batch.batched()) |batched| {
+        const event = batched.event;
+        switch (event.event_type) {
+            .mousemove => g_coalesced_moves = g_input_batch.coalesced(batched),
+            .wheel => g_coalesced_wheels = g_input_batch.coalesced(batched),
+            else => {},
+        }
+        var has_listener = false;
+        for (&g_event_listeners) |*listener| {
+            if (listener.active and listener.event_type == event.event_type) has_listener = true;
+        }
+        if (!has_listener) continue;
+
+        const obj = pooledEventObject(ctx, event.event_type) orelse {
+            log.err("Failed to create {s} event object", .{event.event_type.toString()});
+            continue;
+        };
+        switch (event.data) {
+            .mouse => |data| fillMouseEventObject(ctx, obj, event.event_type, data),
+            .keyboard => |data| fillKeyboardEventObject(ctx, obj, data),
+            .resize => |data| fillResizeEventObject(ctx, obj, data),
+        }
+        for (&g_event_listeners) |*listener| {
+            if (listener.active and listener.event_type == event.event_type) {
+                callEventListener(ctx, listener.callback.val, obj.*);
+            }
         }
     }
 }
 
-/// Dispatch a resize event to all registered listeners
-pub fn dispatchResizeEvent(data: events.ResizeEventData) void {
-    const ctx = g_event_ctx orelse return;
+/// The reusable event object for `event_type`, created on first use with
+/// the fields that never change. Listeners that keep an event past the
+/// callback see it refilled by the next one, as with pooled DOM events.
+fn pooledEventObject(ctx: *c.JSContext, event_type: events.EventType) ?*c.JSValue {
+    const index = @intFromEnum(event_type);
+    const ref = &g_event_objects[index];
+    if (g_event_objects_ready[index]) return &ref.val;
 
-    // Create the event object
-    const event_obj = createResizeEventObject(ctx, data);
-    if (c.JS_IsException(event_obj) != 0) {
-        log.err("Failed to create resize event object", .{});
-        return;
+    const obj = c.JS_AddGCRef(ctx, ref);
+    obj.* = c.JS_NewObject(ctx);
+    if (c.JS_IsException(obj.*) != 0) {
+        c.JS_DeleteGCRef(ctx, ref);
+        return null;
+    }
+    g_event_objects_ready[index] = true;
+    setEventProp(ctx, obj, "type", c.JS_NewString(ctx, event_type.toString().ptr));
+    // Stub methods
+    const global = c.JS_GetGlobalObject(ctx);
+    setEventProp(ctx, obj, "preventDefault", c.JS_GetPropertyStr(ctx, global, "__dom_noop"));
+    setEventProp(ctx, obj, "stopPropagation", c.JS_GetPropertyStr(ctx, global, "__dom_noop"));
+    switch (event_type) {
+        .mousemove, .wheel => setEventProp(ctx, obj, "getCoalescedEvents", c.JS_GetPropertyStr(ctx, global, "__getCoalescedEvents")),
+        .resize => setEventProp(ctx, obj, "target", c.JS_NewObject(ctx)),
+        else => {},
     }
+    return obj;
+}
 
-    // Call all matching listeners
-    for (&g_event_listeners) |*listener| {
-        if (listener.active and listener.event_type == .resize) {
-            callEventListener(ctx, listener.callback.val, event_obj);
-        }
+/// Set a property of a GC-rooted object; `value` is created before the
+/// object is read, so an allocation in between cannot leave it stale.
+fn setEventProp(ctx: *c.JSContext, obj: *c.JSValue, name: [:0]const u8, value: c.JSValue) void {
+    _ = c.JS_SetPropertyStr(ctx, obj.*, name.ptr, value);
+}
+
+fn jsBool(value: bool) c.JSValue {
+    return if (value) c.JS_TRUE else c.JS_FALSE;
+}
+
+fn fillMouseEventObject(ctx: *c.JSContext, obj: *c.JSValue, event_type: events.EventType, data: events.MouseEventData) void {
+    setEventProp(ctx, obj, "clientX", c.JS_NewInt32(ctx, data.clientX));
+    setEventProp(ctx, obj, "clientY", c.JS_NewInt32(ctx, data.clientY));
+    setEventProp(ctx, obj, "pageX", c.JS_NewInt32(ctx, data.clientX));
+    setEventProp(ctx, obj, "pageY", c.JS_NewInt32(ctx, data.clientY));
+    setEventProp(ctx, obj, "screenX", c.JS_NewInt32(ctx, data.clientX));
+    setEventProp(ctx, obj, "screenY", c.JS_NewInt32(ctx, data.clientY));
+    setEventProp(ctx, obj, "offsetX", c.JS_NewInt32(ctx, data.clientX));
+    setEventProp(ctx, obj, "offsetY", c.JS_NewInt32(ctx, data.clientY));
+    setEventProp(ctx, obj, "button", c.JS_NewInt32(ctx, data.button));
+    setEventProp(ctx, obj, "buttons", c.JS_NewInt32(ctx, data.buttons));
+    setEventProp(ctx, obj, "shiftKey", jsBool(data.shiftKey));
+    setEventProp(ctx, obj, "ctrlKey", jsBool(data.ctrlKey));
+    setEventProp(ctx, obj, "altKey", jsBool(data.altKey));
+    setEventProp(ctx, obj, "metaKey", jsBool(data.metaKey));
+
+    // Wheel-specific properties
+    if (event_type == .wheel) {
+        setEventProp(ctx, obj, "deltaX", c.JS_NewFloat64(ctx, data.deltaX));
+        setEventProp(ctx, obj, "deltaY", c.JS_NewFloat64(ctx, data.deltaY));
+        setEventProp(ctx, obj, "deltaZ", c.JS_NewFloat64(ctx, 0));
+        setEventProp(ctx, obj, "deltaMode", c.JS_NewInt32(ctx, data.deltaMode));
     }
 }
 
+fn fillKeyboardEventObject(ctx: *c.JSContext, obj: *c.JSValue, data: events.KeyboardEventData) void {
+    setEventProp(ctx, obj, "key", c.JS_NewStringLen(ctx, data.key.ptr, data.key.len));
+    setEventProp(ctx, obj, "code", c.JS_NewStringLen(ctx, data.code.ptr, data.code.len));
+    setEventProp(ctx, obj, "keyCode", c.JS_NewInt32(ctx, @intCast(data.keyCode)));
+    setEventProp(ctx, obj, "which", c.JS_NewInt32(ctx, @intCast(data.keyCode)));
+    setEventProp(ctx, obj, "shiftKey", jsBool(data.shiftKey));
+    setEventProp(ctx, obj, "ctrlKey", jsBool(data.ctrlKey));
+    setEventProp(ctx, obj, "altKey", jsBool(data.altKey));
+    setEventProp(ctx, obj, "metaKey", jsBool(data.metaKey));
+    setEventProp(ctx, obj, "repeat", jsBool(data.repeat));
+}
+
+/// Resize events include target with innerWidth/innerHeight
+fn fillResizeEventObject(ctx: *c.JSContext, obj: *c.JSValue, data: events.ResizeEventData) void {
+    const target = c.JS_GetPropertyStr(ctx, obj.*, "target");
+    _ = c.JS_SetPropertyStr(ctx, target, "innerWidth", c.JS_NewInt32(ctx, @intCast(data.width)));
+    _ = c.JS_SetPropertyStr(ctx, target, "innerHeight", c.JS_NewInt32(ctx, @intCast(data.height)));
+}
+
 fn callEventListener(ctx: *c.JSContext, callback: c.JSValue, event_obj: c.JSValue) void {
     // Check stack space
     if (c.JS_StackCheck(ctx, 3) != 0) {
@@ -469,85 +1140,6 @@ fn callEventListener(ctx: *c.JSContext, callback: c.JSValue, event_obj: c.JSValu
     }
 }
 
-fn createMouseEventObject(ctx: *c.JSContext, event_type: events.EventType, data: events.MouseEventData) c.JSValue {
-    const obj = c.JS_NewObject(ctx);
-    if (c.JS_IsException(obj) != 0) return obj;
-
-    // Set properties
-    _ = c.JS_SetPropertyStr(ctx, obj, "type", c.JS_NewString(ctx, event_type.toString().ptr));
-    _ = c.JS_SetPropertyStr(ctx, obj, "clientX", c.JS_NewInt32(ctx, data.clientX));
-    _ = c.JS_SetPropertyStr(ctx, obj, "clientY", c.JS_NewInt32(ctx, data.clientY));
-    _ = c.JS_SetPropertyStr(ctx, obj, "pageX", c.JS_NewInt32(ctx, data.clientX));
-    _ = c.JS_SetPropertyStr(ctx, obj, "pageY", c.JS_NewInt32(ctx, data.clientY));
-    _ = c.JS_SetPropertyStr(ctx, obj, "screenX", c.JS_NewInt32(ctx, data.clientX));
-    _ = c.JS_SetPropertyStr(ctx, obj, "screenY", c.JS_NewInt32(ctx, data.clientY));
-    _ = c.JS_SetPropertyStr(ctx, obj, "offsetX", c.JS_NewInt32(ctx, data.clientX));
-    _ = c.JS_SetPropertyStr(ctx, obj, "offsetY", c.JS_NewInt32(ctx, data.clientY));
-    _ = c.JS_SetPropertyStr(ctx, obj, "button", c.JS_NewInt32(ctx, data.button));
-    _ = c.JS_SetPropertyStr(ctx, obj, "buttons", c.JS_NewInt32(ctx, data.buttons));
-    _ = c.JS_SetPropertyStr(ctx, obj, "shiftKey", if (data.shiftKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "ctrlKey", if (data.ctrlKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "altKey", if (data.altKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "metaKey", if (data.metaKey) c.JS_TRUE else c.JS_FALSE);
-
-    // Wheel-specific properties
-    if (event_type == .wheel) {
-        _ = c.JS_SetPropertyStr(ctx, obj, "deltaX", c.JS_NewFloat64(ctx, data.deltaX));
-        _ = c.JS_SetPropertyStr(ctx, obj, "deltaY", c.JS_NewFloat64(ctx, data.deltaY));
-        _ = c.JS_SetPropertyStr(ctx, obj, "deltaZ", c.JS_NewFloat64(ctx, 0));
-        _ = c.JS_SetPropertyStr(ctx, obj, "deltaMode", c.JS_NewInt32(ctx, data.deltaMode));
-    }
-
-    // Stub methods
-    const global = c.JS_GetGlobalObject(ctx);
-    const noop = c.JS_GetPropertyStr(ctx, global, "__dom_noop");
-    _ = c.JS_SetPropertyStr(ctx, obj, "preventDefault", noop);
-    _ = c.JS_SetPropertyStr(ctx, obj, "stopPropagation", noop);
-
-    return obj;
-}
-
-fn createKeyboardEventObject(ctx: *c.JSContext, event_type: events.EventType, data: events.KeyboardEventData) c.JSValue {
-    const obj = c.JS_NewObject(ctx);
-    if (c.JS_IsException(obj) != 0) return obj;
-
-    // Set properties
-    _ = c.JS_SetPropertyStr(ctx, obj, "type", c.JS_NewString(ctx, event_type.toString().ptr));
-    _ = c.JS_SetPropertyStr(ctx, obj, "key", c.JS_NewStringLen(ctx, data.key.ptr, data.key.len));
-    _ = c.JS_SetPropertyStr(ctx, obj, "code", c.JS_NewStringLen(ctx, data.code.ptr, data.code.len));
-    _ = c.JS_SetPropertyStr(ctx, obj, "keyCode", c.JS_NewInt32(ctx, @intCast(data.keyCode)));
-    _ = c.JS_SetPropertyStr(ctx, obj, "which", c.JS_NewInt32(ctx, @intCast(data.keyCode)));
-    _ = c.JS_SetPropertyStr(ctx, obj, "shiftKey", if (data.shiftKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "ctrlKey", if (data.ctrlKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "altKey", if (data.altKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "metaKey", if (data.metaKey) c.JS_TRUE else c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "repeat", if (data.repeat) c.JS_TRUE else c.JS_FALSE);
-
-    // Stub methods
-    const global = c.JS_GetGlobalObject(ctx);
-    const noop = c.JS_GetPropertyStr(ctx, global, "__dom_noop");
-    _ = c.JS_SetPropertyStr(ctx, obj, "preventDefault", noop);
-    _ = c.JS_SetPropertyStr(ctx, obj, "stopPropagation", noop);
-
-    return obj;
-}
-
-fn createResizeEventObject(ctx: *c.JSContext, data: events.ResizeEventData) c.JSValue {
-    const obj = c.JS_NewObject(ctx);
-    if (c.JS_IsException(obj) != 0) return obj;
-
-    // Set properties - resize events include target with innerWidth/innerHeight
-    _ = c.JS_SetPropertyStr(ctx, obj, "type", c.JS_NewString(ctx, "resize"));
-
-    // Create target object with window dimensions
-    const target = c.JS_NewObject(ctx);
-    _ = c.JS_SetPropertyStr(ctx, target, "innerWidth", c.JS_NewInt32(ctx, @intCast(data.width)));
-    _ = c.JS_SetPropertyStr(ctx, target, "innerHeight", c.JS_NewInt32(ctx, @intCast(data.height)));
-    _ = c.JS_SetPropertyStr(ctx, obj, "target", target);
-
-    return obj;
-}
-
 fn allocNativeImage() ?u32 {
     for (g_native_images[0..], 0..) |*entry, i| {
         if (!entry.active) {
@@ -621,18 +1213,67 @@ const GlState = struct {
     enabled_polygon_offset: bool = false,
     enabled_scissor_test: bool = false,
     enabled_sample_alpha_to_coverage: bool = false,
+    /// Unread getError() code
+    error_code: u32 = GL_NO_ERROR,
 };
 
 var g_gl_state: GlState = .{};
-var g_framebuffer_live: [MaxFramebuffers]bool = [_]bool{false} ** MaxFramebuffers;
-var g_next_framebuffer_id: u32 = 1;
-var g_bound_framebuffer: u32 = 0;
-var g_renderbuffer_live: [MaxRenderbuffers]bool = [_]bool{false} ** MaxRenderbuffers;
-var g_next_renderbuffer_id: u32 = 1;
-var g_bound_renderbuffer: u32 = 0;
-var g_vao_live: [MaxVertexArrays]bool = [_]bool{false} ** MaxVertexArrays;
-var g_next_vao_id: u32 = 1;
-var g_bound_vao: u32 = 0;
+
+/// State setters that return early when the call would change nothing.
+/// Three.js filters most redundant calls itself, but whatever reaches the
+/// bindings is compared against g_gl_state (or the owning table for
+/// bindings and uniform values) before webgl_draw is touched.
+const GlCall = enum {
+    enable,
+    disable,
+    viewport,
+    scissor,
+    depthFunc,
+    depthMask,
+    colorMask,
+    cullFace,
+    frontFace,
+    blendFunc,
+    blendFuncSeparate,
+    blendEquation,
+    blendEquationSeparate,
+    activeTexture,
+    bindTexture,
+    bindBuffer,
+    useProgram,
+    uniform1f,
+    uniform2f,
+    uniform3f,
+    uniform4f,
+    uniform1i,
+    uniform2i,
+    uniform3i,
+    uniform4i,
+    uniform1fv,
+    uniform2fv,
+    uniform3fv,
+    uniform4fv,
+    uniformMatrix2fv,
+    uniformMatrix3fv,
+    uniformMatrix4fv,
+};
+
+const GlCallCounter = struct {
+    calls: u64 = 0,
+    /// Calls that returned early because nothing changed
+    skipped: u64 = 0,
+};
+
+var g_gl_calls: std.EnumArray(GlCall, GlCallCounter) = .initFill(.{});
+
+/// Count a call to `call`; returns `redundant` so setters can write
+/// `if (countGlCall(.x, same)) return c.JS_UNDEFINED;`.
+fn countGlCall(call: GlCall, redundant: bool) bool {
+    const counter = g_gl_calls.getPtr(call);
+    counter.calls += 1;
+    counter.skipped += @intFromBool(redundant);
+    return redundant;
+}
 
 fn getRuntime(ctx: *c.JSContext) ?*Runtime {
     const ctx_opaque = c.JS_GetContextOpaque(ctx);
@@ -642,6 +1283,13 @@ fn getRuntime(ctx: *c.JSContext) ?*Runtime {
     return g_runtime;
 }
 
+/// True on a Web Worker's thread. Fetch, images, input and the job system
+/// belong to the main runtime and are refused there.
+fn onWebWorkerThread() bool {
+    const rt = g_runtime orelse return false;
+    return rt.worker != null;
+}
+
 fn clampU8(value: i32) u8 {
     if (value < 0) return 0;
     if (value > 255) return 255;
@@ -744,27 +1392,54 @@ fn createDomStubs(ctx: *c.JSContext) !void {
         \\      set: function(url) {
         \\        img._src = url;
         \\        img.complete = false;
-        \\        setTimeout(function() {
-        \\          try {
-        \\            __loadImage(img, url);
-        \\            img.complete = true;
-        \\            var evt = { type: 'load', target: img };
-        \\            for (var i = 0; i < img._listeners.load.length; i++) {
-        \\              img._listeners.load[i].call(img, evt);
-        \\            }
-        \\            if (img.onload) img.onload.call(img, evt);
-        \\          } catch (e) {
-        \\            var evt = { type: 'error', target: img, error: e };
-        \\            for (var i = 0; i < img._listeners.error.length; i++) {
-        \\              img._listeners.error[i].call(img, evt);
-        \\            }
-        \\            if (img.onerror) img.onerror.call(img, evt);
-        \\          }
-        \\        }, 0);
+        \\        try {
+        \\          __loadImage(img, url);
+        \\        } catch (e) {
+        \\          setTimeout(function() { __imageLoadDone(img, false, e); }, 0);
+        \\        }
         \\      }
         \\    });
         \\    return img;
         \\  };
+        \\
+        \\  // Called by the runtime when a background decode finishes
+        \\  globalThis.__imageLoadDone = function(img, ok, error) {
+        \\    img.complete = ok;
+        \\    var evt = ok ? { type: 'load', target: img } : { type: 'error', target: img, error: error };
+        \\    var listeners = img._listeners ? img._listeners[evt.type] : null;
+        \\    if (listeners) {
+        \\      for (var i = 0; i < listeners.length; i++) listeners[i].call(img, evt);
+        \\    }
+        \\    var handler = ok ? img.onload : img.onerror;
+        \\    if (handler) handler.call(img, evt);
+        \\  };
+        \\
+        \\  // Decoded bitmaps are native Images, so texImage2D takes them as-is.
+        \\  // imageOrientation: 'flipY' is applied while decoding; sources that
+        \\  // are already decoded Images are returned without reorientation.
+        \\  globalThis.createImageBitmap = function(source, options) {
+        \\    var flipY = !!(options && options.imageOrientation === 'flipY');
+        \\    return new Promise(function(resolve, reject) {
+        \\      function decode(buffer) {
+        \\        var bitmap = new Image();
+        \\        bitmap._isImageBitmap = true;
+        \\        bitmap.close = function() { __freeImage(bitmap); };
+        \\        bitmap.onload = function() { resolve(bitmap); };
+        \\        bitmap.onerror = function() { reject(new Error('createImageBitmap: decode failed')); };
+        \\        try { __decodeImage(bitmap, buffer, flipY); } catch (e) { reject(e); }
+        \\      }
+        \\      if (source && source._isNativeImage) {
+        \\        if (source.complete) { resolve(source); return; }
+        \\        if (!source.addEventListener) { reject(new TypeError('createImageBitmap: image is not loaded')); return; }
+        \\        source.addEventListener('load', function() { resolve(source); });
+        \\        source.addEventListener('error', function() { reject(new Error('createImageBitmap: image failed to load')); });
+        \\      } else if (source && typeof source.arrayBuffer === 'function') {
+        \\        source.arrayBuffer().then(decode, reject);
+        \\      } else {
+        \\        decode(source);
+        \\      }
+        \\    });
+        \\  };
         \\})();
     ;
     const result = c.JS_Eval(ctx, img_helper_code, img_helper_code.len, "img_helper", 0);
@@ -773,36 +1448,54 @@ fn createDomStubs(ctx: *c.JSContext) !void {
         return error.HelperEvalFailed;
     }
 
-    // Install Promise polyfill and fetch API
+    try installPromiseAndFetch(ctx);
+    const blob_result = c.JS_Eval(ctx, blob_url_code, blob_url_code.len, "blob_url", 0);
+    if (blob_result == c.JS_EXCEPTION) {
+        dumpException(ctx);
+        return error.HelperEvalFailed;
+    }
+    const audio_result = c.JS_Eval(ctx, audio_stub_code, audio_stub_code.len, "audio_stub", 0);
+    if (audio_result == c.JS_EXCEPTION) {
+        dumpException(ctx);
+        return error.HelperEvalFailed;
+    }
+}
+
+/// Promise polyfill and fetch API, shared by the main context and workers.
+fn installPromiseAndFetch(ctx: *c.JSContext) !void {
     const promise_fetch_code =
         \\(function() {
         \\  // Promise states
         \\  var PENDING = 0, FULFILLED = 1, REJECTED = 2;
         \\
-        \\  // Microtask queue (uses setTimeout(fn, 0) for async execution)
+        \\  // Microtask queue, drained by the runtime after each timer, frame
+        \\  // callback and delivery step (see Runtime.runMicrotasks)
         \\  var microtaskQueue = [];
         \\  var microtaskScheduled = false;
         \\
         \\  function scheduleMicrotasks() {
         \\    if (!microtaskScheduled && microtaskQueue.length > 0) {
         \\      microtaskScheduled = true;
-        \\      setTimeout(function() {
-        \\        microtaskScheduled = false;
-        \\        // Process all microtasks including nested ones in one tick
-        \\        var maxIterations = 1000;
-        \\        var iterations = 0;
-        \\        while (microtaskQueue.length > 0 && iterations < maxIterations) {
-        \\          iterations++;
-        \\          var tasks = microtaskQueue;
-        \\          microtaskQueue = [];
-        \\          for (var i = 0; i < tasks.length; i++) {
-        \\            try { tasks[i](); } catch (e) { console.error('Microtask error:', e); }
-        \\          }
-        \\        }
-        \\      }, 0);
+        \\      __scheduleMicrotasks();
         \\    }
         \\  }
         \\
+        \\  globalThis.__runMicrotasks = function() {
+        \\    // Process all microtasks including nested ones in one drain
+        \\    var maxIterations = 1000;
+        \\    var iterations = 0;
+        \\    while (microtaskQueue.length > 0 && iterations < maxIterations) {
+        \\      iterations++;
+        \\      var tasks = microtaskQueue;
+        \\      microtaskQueue = [];
+        \\      for (var i = 0; i < tasks.length; i++) {
+        \\        try { tasks[i](); } catch (e) { console.error('Microtask error:', e); }
+        \\      }
+        \\    }
+        \\    microtaskScheduled = false;
+        \\    scheduleMicrotasks();
+        \\  };
+        \\
         \\  function queueMicrotask(fn) {
         \\    microtaskQueue.push(fn);
         \\    scheduleMicrotasks();
@@ -918,45 +1611,191 @@ fn createDomStubs(ctx: *c.JSContext) !void {
         \\    });
         \\  };
         \\
-        \\  // Response class for fetch
-        \\  function Response(data, options) {
-        \\    // data is a Uint8Array from native fetch
-        \\    this._data = data;
-        \\    this.ok = options.ok;
-        \\    this.status = options.status;
-        \\    this.statusText = options.statusText || '';
-        \\    this.headers = options.headers || {};
-        \\    this.url = options.url || '';
+        \\  // Headers: case-insensitive name -> string map
+        \\  function Headers(init) {
+        \\    this._map = {};
+        \\    if (init instanceof Headers) init = init._map;
+        \\    if (init) {
+        \\      for (var name in init) {
+        \\        if (Object.prototype.hasOwnProperty.call(init, name)) {
+        \\          this._map[String(name).toLowerCase()] = String(init[name]);
+        \\        }
+        \\      }
+        \\    }
         \\  }
         \\
-        \\  Response.prototype.arrayBuffer = function() {
-        \\    var self = this;
-        \\    return new Promise(function(resolve) {
-        \\      // _data is Uint8Array, return its underlying ArrayBuffer
-        \\      if (self._data && self._data.buffer) {
-        \\        resolve(self._data.buffer);
-        \\      } else {
-        \\        resolve(self._data);
-        \\      }
-        \\    });
+        \\  Headers.prototype.get = function(name) {
+        \\    var key = String(name).toLowerCase();
+        \\    return Object.prototype.hasOwnProperty.call(this._map, key) ? this._map[key] : null;
         \\  };
         \\
-        \\  Response.prototype.text = function() {
-        \\    var self = this;
-        \\    return new Promise(function(resolve) {
-        \\      // _data is Uint8Array, convert to string
-        \\      var arr = self._data;
-        \\      if (!(arr instanceof Uint8Array)) {
-        \\        arr = new Uint8Array(arr);
-        \\      }
-        \\      var str = '';
-        \\      for (var i = 0; i < arr.length; i++) {
-        \\        str += String.fromCharCode(arr[i]);
-        \\      }
-        \\      resolve(str);
-        \\    });
+        \\  Headers.prototype.has = function(name) {
+        \\    return this.get(name) !== null;
         \\  };
         \\
+        \\  Headers.prototype.set = function(name, value) {
+        \\    this._map[String(name).toLowerCase()] = String(value);
+        \\  };
+        \\
+        \\  Headers.prototype.forEach = function(callback, thisArg) {
+        \\    for (var key in this._map) {
+        \\      callback.call(thisArg, this._map[key], key, this);
+        \\    }
+        \\  };
+        \\
+        \\  // ReadableStream: the subset used by Response bodies and FileLoader
+        \\  function ReadableStream(source) {
+        \\    var self = this;
+        \\    this._source = source || {};
+        \\    this._queue = [];
+        \\    this._reads = [];
+        \\    this._closed = false;
+        \\    this._error = null;
+        \\    this.locked = false;
+        \\    var controller = {
+        \\      enqueue: function(chunk) { self._queue.push(chunk); self._pump(); },
+        \\      close: function() { self._closed = true; self._pump(); },
+        \\      error: function(e) { self._error = e || new TypeError('stream errored'); self._pump(); }
+        \\    };
+        \\    if (this._source.start) this._source.start(controller);
+        \\  }
+        \\
+        \\  // Settle pending reads from queued chunks, then from close/error
+        \\  ReadableStream.prototype._pump = function() {
+        \\    while (this._reads.length > 0) {
+        \\      if (this._queue.length > 0) {
+        \\        this._reads.shift().resolve({ done: false, value: this._queue.shift() });
+        \\      } else if (this._error) {
+        \\        this._reads.shift().reject(this._error);
+        \\      } else if (this._closed) {
+        \\        this._reads.shift().resolve({ done: true, value: undefined });
+        \\      } else {
+        \\        break;
+        \\      }
+        \\    }
+        \\  };
+        \\
+        \\  ReadableStream.prototype.getReader = function() {
+        \\    if (this.locked) throw new TypeError('ReadableStream is locked');
+        \\    var stream = this;
+        \\    stream.locked = true;
+        \\    return {
+        \\      read: function() {
+        \\        return new Promise(function(resolve, reject) {
+        \\          stream._reads.push({ resolve: resolve, reject: reject });
+        \\          stream._pump();
+        \\        });
+        \\      },
+        \\      cancel: function(reason) { return stream.cancel(reason); },
+        \\      releaseLock: function() { stream.locked = false; }
+        \\    };
+        \\  };
+        \\
+        \\  ReadableStream.prototype.cancel = function(reason) {
+        \\    this._queue = [];
+        \\    this._closed = true;
+        \\    this._pump();
+        \\    if (this._source.cancel) this._source.cancel(reason);
+        \\    return Promise.resolve();
+        \\  };
+        \\
+        \\  // Bytes of a body value as a Uint8Array (buffers and views are not copied)
+        \\  function bodyBytes(data) {
+        \\    if (data === null || data === undefined) return new Uint8Array(0);
+        \\    if (data instanceof Uint8Array) return data;
+        \\    if (data instanceof ArrayBuffer) return new Uint8Array(data);
+        \\    if (data.buffer instanceof ArrayBuffer) {
+        \\      return new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+        \\    }
+        \\    var str = String(data);
+        \\    var bytes = new Uint8Array(str.length);
+        \\    for (var i = 0; i < str.length; i++) {
+        \\      bytes[i] = str.charCodeAt(i) & 0xFF;
+        \\    }
+        \\    return bytes;
+        \\  }
+        \\
+        \\  // Join body chunks. A native fetch delivers consecutive views of one
+        \\  // buffer, which are joined without copying.
+        \\  function joinChunks(chunks) {
+        \\    if (chunks.length === 1) return chunks[0];
+        \\    var total = 0;
+        \\    var contiguous = chunks.length > 0;
+        \\    for (var i = 0; i < chunks.length; i++) {
+        \\      var chunk = chunks[i];
+        \\      if (chunk.buffer !== chunks[0].buffer || chunk.byteOffset !== chunks[0].byteOffset + total) {
+        \\        contiguous = false;
+        \\      }
+        \\      total += chunk.byteLength;
+        \\    }
+        \\    if (contiguous) return new Uint8Array(chunks[0].buffer, chunks[0].byteOffset, total);
+        \\    var out = new Uint8Array(total);
+        \\    var offset = 0;
+        \\    for (var j = 0; j < chunks.length; j++) {
+        \\      out.set(chunks[j], offset);
+        \\      offset += chunks[j].byteLength;
+        \\    }
+        \\    return out;
+        \\  }
+        \\
+        \\  // Response: body is a ReadableStream, or a buffer/view/string
+        \\  function Response(body, options) {
+        \\    options = options || {};
+        \\    this.status = options.status === undefined ? 200 : options.status;
+        \\    this.ok = options.ok !== undefined ? options.ok : this.status >= 200 && this.status < 300;
+        \\    this.statusText = options.statusText || '';
+        \\    this.headers = new Headers(options.headers);
+        \\    this.url = options.url || '';
+        \\    this.bodyUsed = false;
+        \\    // body stays undefined for buffered responses (FileLoader checks it)
+        \\    if (body instanceof ReadableStream) {
+        \\      this.body = body;
+        \\    } else {
+        \\      this._data = body;
+        \\    }
+        \\  }
+        \\
+        \\  Response.prototype._bytes = function() {
+        \\    var self = this;
+        \\    self.bodyUsed = true;
+        \\    if (!self.body) return Promise.resolve(bodyBytes(self._data));
+        \\    var reader = self.body.getReader();
+        \\    var chunks = [];
+        \\    return new Promise(function(resolve, reject) {
+        \\      function next() {
+        \\        reader.read().then(function(result) {
+        \\          if (result.done) {
+        \\            resolve(joinChunks(chunks));
+        \\            return;
+        \\          }
+        \\          chunks.push(bodyBytes(result.value));
+        \\          next();
+        \\        }, reject);
+        \\      }
+        \\      next();
+        \\    });
+        \\  };
+        \\
+        \\  Response.prototype.arrayBuffer = function() {
+        \\    return this._bytes().then(function(bytes) {
+        \\      if (bytes.byteOffset === 0 && bytes.byteLength === bytes.buffer.byteLength) {
+        \\        return bytes.buffer;
+        \\      }
+        \\      return new Uint8Array(bytes).buffer;
+        \\    });
+        \\  };
+        \\
+        \\  Response.prototype.text = function() {
+        \\    if (!this.body && typeof this._data === 'string') {
+        \\      this.bodyUsed = true;
+        \\      return Promise.resolve(this._data);
+        \\    }
+        \\    return this._bytes().then(function(arr) {
+        \\      return __textDecode(arr, false, false);
+        \\    });
+        \\  };
+        \\
+        \\  // Native UTF-8 decode straight into the native JSON parser
         \\  Response.prototype.json = function() {
         \\    return this.text().then(function(text) {
         \\      return JSON.parse(text);
@@ -965,45 +1804,122 @@ fn createDomStubs(ctx: *c.JSContext) !void {
         \\
         \\  Response.prototype.blob = function() {
         \\    // Blob not fully supported, return object with arrayBuffer method
-        \\    var self = this;
-        \\    return new Promise(function(resolve) {
-        \\      resolve({
-        \\        arrayBuffer: function() { return self.arrayBuffer(); },
-        \\        size: self._data ? self._data.length : 0,
+        \\    return this.arrayBuffer().then(function(buffer) {
+        \\      return {
+        \\        arrayBuffer: function() { return Promise.resolve(buffer); },
+        \\        size: buffer.byteLength,
         \\        type: ''
-        \\      });
+        \\      };
         \\    });
         \\  };
         \\
-        \\  // fetch() API
-        \\  function fetch(url, options) {
+        \\  // TextDecoder: UTF-8 only, decoded natively by __textDecode. The
+        \\  // streaming option is not supported.
+        \\  function TextDecoder(label, options) {
+        \\    var encoding = label === undefined ? 'utf-8' : String(label).trim().toLowerCase();
+        \\    if (encoding !== 'utf-8' && encoding !== 'utf8' && encoding !== 'unicode-1-1-utf-8') {
+        \\      throw new RangeError('TextDecoder: unsupported encoding ' + label);
+        \\    }
+        \\    options = options || {};
+        \\    this.encoding = 'utf-8';
+        \\    this.fatal = !!options.fatal;
+        \\    this.ignoreBOM = !!options.ignoreBOM;
+        \\  }
+        \\
+        \\  TextDecoder.prototype.decode = function(input) {
+        \\    if (input === undefined) return '';
+        \\    return __textDecode(input, this.fatal, this.ignoreBOM);
+        \\  };
+        \\
+        \\  function Request(input, init) {
+        \\    init = init || {};
+        \\    var base = input instanceof Request ? input : null;
+        \\    this.url = base ? base.url : String(input);
+        \\    this.method = init.method || (base ? base.method : 'GET');
+        \\    this.headers = new Headers(init.headers || (base ? base.headers : undefined));
+        \\  }
+        \\
+        \\  function ProgressEvent(type, init) {
+        \\    init = init || {};
+        \\    this.type = type;
+        \\    this.lengthComputable = !!init.lengthComputable;
+        \\    this.loaded = init.loaded || 0;
+        \\    this.total = init.total || 0;
+        \\  }
+        \\
+        \\  // fetch() API: bodies stream in from native IO threads. Event types
+        \\  // match FetchEventKind in js.zig.
+        \\  var FETCH_OPEN = 0, FETCH_DATA = 1, FETCH_DONE = 2, FETCH_ERROR = 3;
+        \\  var fetches = {};
+        \\
+        \\  // Range: bytes=start-[end]; suffix ranges are not supported
+        \\  function parseRange(value) {
+        \\    var match = value ? /^bytes=(\d+)-(\d*)$/.exec(value.replace(/\s/g, '')) : null;
+        \\    if (!match) return null;
+        \\    return { start: parseInt(match[1], 10), end: match[2] === '' ? -1 : parseInt(match[2], 10) + 1 };
+        \\  }
+        \\
+        \\  function fetch(input, init) {
+        \\    var request = input instanceof Request && !init ? input : new Request(input, init);
         \\    return new Promise(function(resolve, reject) {
-        \\      // Use setTimeout to make it async (matches browser behavior)
-        \\      setTimeout(function() {
-        \\        try {
-        \\          // __nativeFetch returns { bufferId, size, status } or throws
-        \\          var result = __nativeFetch(url);
-        \\          // Get data from native buffer and free it immediately
-        \\          var data = __getFetchBufferData(result.bufferId);
-        \\          __freeFetchBuffer(result.bufferId);
-        \\          var response = new Response(data, {
-        \\            ok: result.status >= 200 && result.status < 300,
-        \\            status: result.status,
-        \\            statusText: result.status === 200 ? 'OK' : 'Error',
-        \\            url: url
-        \\          });
-        \\          resolve(response);
-        \\        } catch (e) {
-        \\          reject(new TypeError('Network request failed: ' + e));
-        \\        }
-        \\      }, 0);
+        \\      var range = parseRange(request.headers.get('range'));
+        \\      var id;
+        \\      try {
+        \\        id = __fetchStart(request.url, range ? range.start : 0, range ? range.end : -1);
+        \\      } catch (e) {
+        \\        reject(new TypeError('Network request failed: ' + e));
+        \\        return;
+        \\      }
+        \\      fetches[id] = { url: request.url, range: range, resolve: resolve, reject: reject, buffer: null, loaded: 0, controller: null };
         \\    });
         \\  }
         \\
+        \\  // Called from Runtime.tick. 'open' passes the body buffer and the whole
+        \\  // resource size, 'data' the number of body bytes filled so far.
+        \\  globalThis.__fetchEvent = function(id, type, a, b) {
+        \\    var f = fetches[id];
+        \\    if (!f) return;
+        \\    if (type === FETCH_OPEN) {
+        \\      f.buffer = a;
+        \\      var headers = new Headers({ 'Content-Length': String(a.byteLength) });
+        \\      var status = 200;
+        \\      if (f.range) {
+        \\        status = 206;
+        \\        headers.set('Content-Range', 'bytes ' + f.range.start + '-' + (f.range.start + a.byteLength - 1) + '/' + b);
+        \\      }
+        \\      var body = new ReadableStream({
+        \\        start: function(controller) { f.controller = controller; },
+        \\        cancel: function() { delete fetches[id]; __fetchCancel(id); }
+        \\      });
+        \\      f.resolve(new Response(body, {
+        \\        status: status,
+        \\        statusText: status === 206 ? 'Partial Content' : 'OK',
+        \\        headers: headers,
+        \\        url: f.url
+        \\      }));
+        \\    } else if (type === FETCH_DATA) {
+        \\      f.controller.enqueue(new Uint8Array(f.buffer, f.loaded, a - f.loaded));
+        \\      f.loaded = a;
+        \\    } else {
+        \\      delete fetches[id];
+        \\      if (type === FETCH_DONE) {
+        \\        f.controller.close();
+        \\      } else {
+        \\        var error = new TypeError('Network request failed: ' + a);
+        \\        if (f.controller) f.controller.error(error); else f.reject(error);
+        \\      }
+        \\    }
+        \\  };
+        \\
         \\  // Export to global
         \\  globalThis.Promise = Promise;
         \\  globalThis.fetch = fetch;
         \\  globalThis.Response = Response;
+        \\  globalThis.Request = Request;
+        \\  globalThis.Headers = Headers;
+        \\  globalThis.ReadableStream = ReadableStream;
+        \\  globalThis.TextDecoder = TextDecoder;
+        \\  if (typeof globalThis.ProgressEvent === 'undefined') globalThis.ProgressEvent = ProgressEvent;
         \\  globalThis.queueMicrotask = queueMicrotask;
         \\})();
     ;
@@ -1016,6 +1932,14 @@ fn createDomStubs(ctx: *c.JSContext) !void {
 
 const GL_ARRAY_BUFFER: u32 = 34962;
 const GL_ELEMENT_ARRAY_BUFFER: u32 = 34963;
+const GL_PIXEL_PACK_BUFFER: u32 = 0x88EB;
+const GL_UNIFORM_BUFFER: u32 = 0x8A11;
+const GL_STREAM_DRAW: u32 = 0x88E0;
+const GL_STREAM_COPY: u32 = 0x88E2;
+const GL_STATIC_DRAW: u32 = 0x88E4;
+const GL_STATIC_COPY: u32 = 0x88E6;
+const GL_DYNAMIC_DRAW: u32 = 0x88E8;
+const GL_DYNAMIC_COPY: u32 = 0x88EA;
 const GL_VERTEX_SHADER: u32 = 35633;
 const GL_FRAGMENT_SHADER: u32 = 35632;
 const GL_COMPILE_STATUS: u32 = 35713;
@@ -1024,6 +1948,30 @@ const GL_VALIDATE_STATUS: u32 = 0x8B83;
 const GL_ATTACHED_SHADERS: u32 = 0x8B85;
 const GL_ACTIVE_UNIFORMS: u32 = 0x8B86;
 const GL_ACTIVE_ATTRIBUTES: u32 = 0x8B89;
+const GL_ACTIVE_UNIFORM_BLOCKS: u32 = 0x8A36;
+const GL_UNIFORM_BLOCK_BINDING: u32 = 0x8A3F;
+const GL_INVALID_INDEX: u32 = 0xFFFFFFFF;
+const GL_COMPLETION_STATUS_KHR: u32 = 0x91B1;
+const GL_VERTEX_ATTRIB_ARRAY_DIVISOR: u32 = 0x88FE;
+const GL_QUERY_COUNTER_BITS_EXT: u32 = 0x8864;
+const GL_CURRENT_QUERY: u32 = 0x8865;
+const GL_QUERY_RESULT: u32 = 0x8866;
+const GL_QUERY_RESULT_AVAILABLE: u32 = 0x8867;
+const GL_TIME_ELAPSED_EXT: u32 = 0x88BF;
+const GL_TIMESTAMP_EXT: u32 = 0x8E28;
+const GL_GPU_DISJOINT_EXT: u32 = 0x8FBB;
+const GL_MAX_CLIENT_WAIT_TIMEOUT_WEBGL: u32 = 0x9247;
+const GL_OBJECT_TYPE: u32 = 0x9112;
+const GL_SYNC_CONDITION: u32 = 0x9113;
+const GL_SYNC_STATUS: u32 = 0x9114;
+const GL_SYNC_FLAGS: u32 = 0x9115;
+const GL_SYNC_FENCE: u32 = 0x9116;
+const GL_SYNC_GPU_COMMANDS_COMPLETE: u32 = 0x9117;
+const GL_UNSIGNALED: u32 = 0x9118;
+const GL_SIGNALED: u32 = 0x9119;
+const GL_ALREADY_SIGNALED: u32 = 0x911A;
+const GL_TIMEOUT_EXPIRED: u32 = 0x911B;
+const GL_WAIT_FAILED: u32 = 0x911D;
 const GL_FLOAT_VEC2: u32 = 0x8B50;
 const GL_FLOAT_VEC3: u32 = 0x8B51;
 const GL_FLOAT_VEC4: u32 = 0x8B52;
@@ -1042,6 +1990,8 @@ const GL_SAMPLER_CUBE_SHADOW: u32 = 0x8DC5;
 const GL_FLOAT: u32 = 5126;
 const GL_INT: u32 = 0x1404;
 const GL_UNSIGNED_SHORT: u32 = 5123;
+const GL_UNSIGNED_SHORT_4_4_4_4: u32 = 0x8033;
+const GL_UNSIGNED_SHORT_5_6_5: u32 = 0x8363;
 const GL_UNSIGNED_INT: u32 = 5125;
 const GL_TRIANGLES: u32 = 0x0004;
 const GL_TRIANGLE_STRIP: u32 = 0x0005;
@@ -1089,11 +2039,14 @@ const GL_TEXTURE0: u32 = 0x84C0;
 const GL_FRAMEBUFFER: u32 = 0x8D40;
 const GL_RENDERBUFFER: u32 = 0x8D41;
 const GL_FRAMEBUFFER_COMPLETE: u32 = 0x8CD5;
+const GL_DRAW_FRAMEBUFFER: u32 = 0x8CA9;
+const GL_READ_FRAMEBUFFER: u32 = 0x8CA8;
 const GL_COLOR_ATTACHMENT0: u32 = 0x8CE0;
 const GL_DEPTH_ATTACHMENT: u32 = 0x8D00;
 const GL_STENCIL_ATTACHMENT: u32 = 0x8D20;
 const GL_DEPTH_STENCIL_ATTACHMENT: u32 = 0x821A;
 const GL_DEPTH_STENCIL: u32 = 0x84F9;
+const GL_DEPTH_COMPONENT: u32 = 0x1902;
 const GL_BLEND: u32 = 0x0BE2;
 const GL_CULL_FACE: u32 = 0x0B44;
 const GL_POLYGON_OFFSET_FILL: u32 = 0x8037;
@@ -1148,6 +2101,12 @@ const GL_MAX_TEXTURE_SIZE: u32 = 0x0D33;
 const GL_MAX_CUBE_MAP_TEXTURE_SIZE: u32 = 0x851C;
 const GL_MAX_VERTEX_UNIFORM_VECTORS: u32 = 0x8DFB;
 const GL_MAX_FRAGMENT_UNIFORM_VECTORS: u32 = 0x8DFD;
+const GL_MAX_VERTEX_UNIFORM_BLOCKS: u32 = 0x8A2B;
+const GL_MAX_FRAGMENT_UNIFORM_BLOCKS: u32 = 0x8A2D;
+const GL_MAX_COMBINED_UNIFORM_BLOCKS: u32 = 0x8A2E;
+const GL_MAX_UNIFORM_BUFFER_BINDINGS: u32 = 0x8A2F;
+const GL_MAX_UNIFORM_BLOCK_SIZE: u32 = 0x8A30;
+const GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT: u32 = 0x8A34;
 const GL_MAX_VARYING_VECTORS: u32 = 0x8DFC;
 const GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS: u32 = 0x8B4C;
 const GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS: u32 = 0x8B4D;
@@ -1168,6 +2127,10 @@ const GL_UNPACK_COLORSPACE_CONVERSION_WEBGL: u32 = 0x9243;
 const GL_RGBA: u32 = 0x1908;
 const GL_UNSIGNED_BYTE: u32 = 0x1401;
 const GL_NO_ERROR: u32 = 0;
+const GL_INVALID_ENUM: u32 = 0x0500;
+const GL_INVALID_VALUE: u32 = 0x0501;
+const GL_INVALID_OPERATION: u32 = 0x0502;
+const GL_OUT_OF_MEMORY: u32 = 0x0505;
 const MaxUniformFloatCount: usize = @as(usize, @intCast(webgl_program.MaxUniformArrayCount)) * 16;
 
 fn bufferIdToU32(id: webgl.BufferId) u32 {
@@ -1198,10 +2161,22 @@ fn parseBufferTarget(target: u32) !webgl_state.BufferTarget {
     return switch (target) {
         GL_ARRAY_BUFFER => .array,
         GL_ELEMENT_ARRAY_BUFFER => .element_array,
+        GL_PIXEL_PACK_BUFFER => .pixel_pack,
+        GL_UNIFORM_BUFFER => .uniform,
         else => error.InvalidTarget,
     };
 }
 
+/// *_DRAW, *_READ and *_COPY share a hint; only the update frequency matters.
+fn parseBufferHint(usage: u32) !webgl.BufferHint {
+    return switch (usage) {
+        GL_STREAM_DRAW...GL_STREAM_COPY => .stream,
+        GL_STATIC_DRAW...GL_STATIC_COPY => .static,
+        GL_DYNAMIC_DRAW...GL_DYNAMIC_COPY => .dynamic,
+        else => error.InvalidUsage,
+    };
+}
+
 fn parseShaderKind(kind: u32) !webgl_shader.ShaderKind {
     return switch (kind) {
         GL_VERTEX_SHADER => .vertex,
@@ -1222,25 +2197,77 @@ fn readUniformLocation(ctx: *c.JSContext, value: c.JSValue) !?u32 {
     return @intCast(loc_i);
 }
 
-fn readFloatValues(ctx: *c.JSContext, value: c.JSValue, out: []f32) !usize {
+/// Backing store of a typed array or ArrayBuffer, borrowed in place.
+///
+/// mquickjs has a compacting GC, so the slice is only valid until the next
+/// JS allocation: use it within the current native call and don't create JS
+/// values while holding it.
+fn borrowArrayBytes(ctx: *c.JSContext, value: c.JSValue) ?[]const u8 {
     var c_ptr: [*c]u8 = null;
     var len: usize = 0;
-    if (c.JS_GetTypedArrayData(ctx, value, &c_ptr, &len) == 0) {
-        return copyFloatBytes(out, c_ptr, len);
+    if (c.JS_GetTypedArrayData(ctx, value, &c_ptr, &len) != 0 and
+        c.JS_GetArrayBufferData(ctx, value, &c_ptr, &len) != 0)
+    {
+        return null;
     }
-    if (c.JS_GetArrayBufferData(ctx, value, &c_ptr, &len) == 0) {
-        return copyFloatBytes(out, c_ptr, len);
+    if (len == 0) return &.{};
+    if (c_ptr == null) return null;
+    return @as([*]const u8, @ptrCast(c_ptr))[0..len];
+}
+
+/// Writable variant of borrowArrayBytes(), for bindings that fill a typed
+/// array in place. Same lifetime rules.
+fn borrowArrayBytesMut(ctx: *c.JSContext, value: c.JSValue) ?[]u8 {
+    const bytes = borrowArrayBytes(ctx, value) orelse return null;
+    return @constCast(bytes);
+}
+
+/// Float view of a typed array argument. Borrows the backing store when it
+/// is 4-byte aligned (the common case) and only copies into `scratch`
+/// otherwise. Same lifetime rules as borrowArrayBytes().
+fn readFloatValues(ctx: *c.JSContext, value: c.JSValue, scratch: []f32) ![]const f32 {
+    const bytes = borrowArrayBytes(ctx, value) orelse return error.InvalidType;
+    if (bytes.len % 4 != 0) return error.InvalidLength;
+    const count = bytes.len / 4;
+    if (count > scratch.len) return error.TooLarge;
+    if (std.mem.isAligned(@intFromPtr(bytes.ptr), @alignOf(f32))) {
+        const floats: [*]const f32 = @ptrCast(@alignCast(bytes.ptr));
+        return floats[0..count];
+    }
+    @memcpy(std.mem.sliceAsBytes(scratch[0..count]), bytes);
+    return scratch[0..count];
+}
+
+/// Times each collection; the context opaque is the current Runtime.
+fn gcHook(opaque: ?*anyopaque, done: c.JS_BOOL) callconv(.c) void {
+    const rt: *Runtime = @ptrCast(@alignCast(opaque orelse return));
+    const t = &rt.gc_timer;
+    const now = std.time.nanoTimestamp();
+    if (done == 0) {
+        var info: c.JSMemoryInfo = undefined;
+        c.JS_GetMemoryInfo(rt.ctx, &info);
+        t.started_ns = now;
+        t.started_heap_bytes = info.heap_size;
+        t.zone = profiler.begin(.gc);
+        return;
+    }
+    if (t.started_ns == 0) return;
+    t.zone.end();
+    t.zone = .{ .active = false };
+    const pause: u64 = @intCast(@max(now - t.started_ns, 0));
+    t.started_ns = 0;
+    t.last_pause_ns = pause;
+    t.total_pause_ns += pause;
+    t.max_pause_ns = @max(t.max_pause_ns, pause);
+    if (t.idle) {
+        t.idle_count += 1;
+    } else {
+        t.max_unscheduled_pause_ns = @max(t.max_unscheduled_pause_ns, pause);
+    }
+    // Marking and compaction walk the whole heap, garbage included
+    if (t.started_heap_bytes > 0) {
+        t.ns_per_byte = @as(f64, @floatFromInt(pause)) / @as(f64, @floatFromInt(t.started_heap_bytes));
     }
-    return error.InvalidType;
-}
-
-fn copyFloatBytes(out: []f32, c_ptr: [*c]u8, len: usize) !usize {
-    if (len % 4 != 0) return error.InvalidLength;
-    const count = len / 4;
-    if (count > out.len) return error.TooLarge;
-    const bytes: [*]const u8 = @ptrCast(c_ptr);
-    @memcpy(std.mem.sliceAsBytes(out[0..count]), bytes[0..len]);
-    return count;
 }
 
 fn logFunc(_: ?*anyopaque, buf: ?*const anyopaque, len: usize) callconv(.c) void {
@@ -1380,6 +2407,15 @@ export fn js_load(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSVa
     }
 
     const path = std.mem.span(@as([*:0]const u8, @ptrCast(filename)));
+    // Precompiled scripts skip reading and parsing the source
+    if (rt.findBytecode(path)) |main| return c.JS_Run(ctx, main);
+    return runScriptFile(rt, ctx, path);
+}
+
+/// Read, sanitize and evaluate a script file relative to the working
+/// directory. Also runs Web Worker scripts.
+fn runScriptFile(rt: *Runtime, ctx: *c.JSContext, path: [:0]const u8) c.JSValue {
+
     const max_bytes: usize = 16 * 1024 * 1024;
     const data = std.fs.cwd().readFileAlloc(rt.allocator, path, max_bytes) catch {
         return throwInternalError(ctx, "failed to read file");
@@ -1399,7 +2435,7 @@ export fn js_load(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSVa
     @memcpy(eval_buf[0..sanitized.bytes.len], sanitized.bytes);
     eval_buf[sanitized.bytes.len] = 0;
 
-    return c.JS_Eval(ctx, eval_buf.ptr, sanitized.bytes.len, filename, 0);
+    return c.JS_Eval(ctx, eval_buf.ptr, sanitized.bytes.len, path.ptr, 0);
 }
 
 /// Resolve and validate a path relative to the asset root
@@ -1437,16 +2473,38 @@ fn resolveAssetPath(allocator: std.mem.Allocator, asset_root: []const u8, reques
     return resolved;
 }
 
-/// Native fetch implementation - reads file and returns { bufferId: number, size: number, status: number }
-/// The bufferId can be used with __getFetchBufferData to get the actual Uint8Array data
-export fn js_nativeFetch(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+/// Start streaming a fetch body on the IO threads.
+/// Called as: __fetchStart(url, rangeStart, rangeEnd) -> id
+/// rangeEnd is exclusive; a negative value reads to the end. Progress is
+/// reported from Runtime.tick through __fetchEvent(id, type, a, b) (see
+/// FetchEventKind). Bodies are copied into one ArrayBuffer allocated when
+/// the length is known, so nothing is held natively after delivery.
+export fn js_fetchStart(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) {
-        return throwTypeError(ctx, "__nativeFetch requires a URL");
+        return throwTypeError(ctx, "__fetchStart requires a URL");
     }
 
     const rt = getRuntime(ctx) orelse {
         return throwInternalError(ctx, "runtime not initialized");
     };
+    if (onWebWorkerThread()) return throwTypeError(ctx, "fetch is not available in workers");
+
+    // Numbers first: converting them can run JS, which must not happen
+    // once the URL string is borrowed
+    var range_start: f64 = 0;
+    var range_end: f64 = -1;
+    if (argc >= 2 and c.JS_ToNumber(ctx, &range_start, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (argc >= 3 and c.JS_ToNumber(ctx, &range_end, argv[2]) != 0) return c.JS_EXCEPTION;
+    const max_offset: f64 = @floatFromInt(std.math.maxInt(u53));
+    if (!(range_start >= 0 and range_start <= max_offset) or range_end > max_offset) {
+        return throwTypeError(ctx, "__fetchStart: invalid range");
+    }
+    const range = file_stream.Range{
+        .start = @intFromFloat(range_start),
+        .end = if (range_end >= 0) @as(u64, @intFromFloat(range_end)) else null,
+    };
+
+    const pending = findFreePendingFetch() orelse return throwInternalError(ctx, "too many pending fetches");
 
     var buf: c.JSCStringBuf = undefined;
     const url_cstr = c.JS_ToCString(ctx, argv[0], &buf);
@@ -1462,102 +2520,578 @@ export fn js_nativeFetch(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*
         path = path[2..];
     }
 
-    // Resolve path relative to asset root and validate it doesn't escape
-    const asset_root = rt.getAssetRoot();
-    const resolved_path = resolveAssetPath(rt.allocator, asset_root, path) orelse {
-        return throwTypeError(ctx, "Access denied: path outside asset root");
+    var resolved_path: ?[]const u8 = null;
+    defer if (resolved_path) |resolved| rt.allocator.free(resolved);
+    const source: file_stream.Source = if (rt.archive != null) blk: {
+        const found = findArchived(rt, path) orelse return throwTypeError(ctx, "File not found");
+        break :blk .{ .archived = .{ .archive = found.archive, .entry = found.entry } };
+    } else blk: {
+        // Resolve path relative to asset root and validate it doesn't escape
+        resolved_path = resolveAssetPath(rt.allocator, rt.getAssetRoot(), path) orelse {
+            return throwTypeError(ctx, "Access denied: path outside asset root");
+        };
+        break :blk .{ .file = resolved_path.? };
     };
-    defer rt.allocator.free(resolved_path);
 
-    // Allocate a buffer from the pool
-    const buffer_id = allocFetchBuffer() orelse {
-        return throwInternalError(ctx, "Too many concurrent fetch operations");
+    const id = fileStreams(rt).submit(source, range) catch |err| {
+        return throwInternalError(ctx, @errorName(err));
     };
-    var fetch_buf = &g_fetch_buffers[buffer_id];
-    fetch_buf.allocator = rt.allocator;
+    const body = c.JS_AddGCRef(ctx, &pending.body);
+    body.* = c.JS_UNDEFINED;
+    pending.stream_id = id;
+    pending.loaded = 0;
+    pending.active = true;
+    return c.JS_NewInt32(ctx, @intCast(id));
+}
+
+/// Stop a streaming fetch whose body is no longer wanted.
+/// Called as: __fetchCancel(id)
+export fn js_fetchCancel(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return throwTypeError(ctx, "__fetchCancel requires an id");
+    var id: c_int = 0;
+    if (c.JS_ToInt32(ctx, &id, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (id <= 0) return c.JS_UNDEFINED;
+    if (findPendingFetch(@intCast(id))) |pending| {
+        g_file_streams.cancel(pending.stream_id);
+        releasePendingFetch(ctx, pending);
+    }
+    return c.JS_UNDEFINED;
+}
 
-    // Read the file using the resolved path directly into the buffer
-    const max_bytes: usize = 64 * 1024 * 1024; // 64 MB max
-    fetch_buf.data = std.fs.cwd().readFileAlloc(rt.allocator, resolved_path, max_bytes) catch |err| {
-        freeFetchBuffer(buffer_id);
-        return switch (err) {
-            error.FileNotFound => throwTypeError(ctx, "File not found"),
-            error.AccessDenied => throwTypeError(ctx, "Access denied"),
-            else => throwInternalError(ctx, "Failed to read file"),
-        };
-    };
+/// The shared IO pool, started with the runtime's allocator on first use.
+fn fileStreams(runtime: *Runtime) *file_stream.StreamPool {
+    if (!g_file_streams.started) {
+        g_file_streams.start(runtime.allocator, file_stream.MaxWorkers);
+    }
+    return &g_file_streams;
+}
+
+fn findFreePendingFetch() ?*PendingFetch {
+    for (&g_pending_fetches) |*pending| {
+        if (!pending.active) return pending;
+    }
+    return null;
+}
 
-    // Create result object: { bufferId: number, size: number, status: 200 }
-    const result = c.JS_NewObject(ctx);
-    _ = c.JS_SetPropertyStr(ctx, result, "bufferId", c.JS_NewInt32(ctx, @intCast(buffer_id)));
-    _ = c.JS_SetPropertyStr(ctx, result, "size", c.JS_NewInt32(ctx, @intCast(fetch_buf.data.?.len)));
-    _ = c.JS_SetPropertyStr(ctx, result, "status", c.JS_NewInt32(ctx, 200));
+fn findPendingFetch(stream_id: u32) ?*PendingFetch {
+    for (&g_pending_fetches) |*pending| {
+        if (pending.active and pending.stream_id == stream_id) return pending;
+    }
+    return null;
+}
 
-    return result;
+fn releasePendingFetch(ctx: *c.JSContext, pending: *PendingFetch) void {
+    c.JS_DeleteGCRef(ctx, &pending.body);
+    pending.* = .{};
 }
 
-/// Get data from a fetch buffer as Uint8Array
-/// Called as: __getFetchBufferData(bufferId) -> Uint8Array
-export fn js_getFetchBufferData(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) {
-        return throwTypeError(ctx, "__getFetchBufferData requires bufferId");
+/// Main thread: apply one stream event to its fetch and notify JS.
+/// Returns the body bytes copied into the JS heap.
+fn deliverFetchEvent(ctx: *c.JSContext, event: file_stream.Event) usize {
+    defer event.discard(g_file_streams.allocator);
+    // Missing when JS cancelled the fetch; its remaining events are dropped
+    const pending = findPendingFetch(event.id) orelse return 0;
+    switch (event.kind) {
+        .opened => |opened| {
+            if (opened.len > MaxFetchBytes) {
+                failPendingFetch(ctx, pending, "File too large");
+                return 0;
+            }
+            pending.body.val = c.JS_NewArrayBufferUninitialized(ctx, @intCast(opened.len));
+            if (c.JS_IsException(pending.body.val) != 0) {
+                _ = c.JS_GetException(ctx);
+                pending.body.val = c.JS_UNDEFINED;
+                failPendingFetch(ctx, pending, "out of memory");
+                return 0;
+            }
+            dispatchFetchEvent(ctx, event.id, .open, pending.body.val, @floatFromInt(opened.resource_size));
+            return 0;
+        },
+        .chunk => |bytes| {
+            var ptr: [*c]u8 = null;
+            var len: usize = 0;
+            if (c.JS_GetArrayBufferData(ctx, pending.body.val, &ptr, &len) != 0 or bytes.len > len - pending.loaded) {
+                failPendingFetch(ctx, pending, "Failed to read file");
+                return 0;
+            }
+            if (bytes.len > 0) @memcpy(@as([*]u8, @ptrCast(ptr))[pending.loaded..][0..bytes.len], bytes);
+            pending.loaded += bytes.len;
+            dispatchFetchEvent(ctx, event.id, .data, c.JS_NewInt32(ctx, @intCast(pending.loaded)), 0);
+            return bytes.len;
+        },
+        .done => {
+            releasePendingFetch(ctx, pending);
+            dispatchFetchEvent(ctx, event.id, .done, c.JS_UNDEFINED, 0);
+        },
+        .failed => |err| {
+            releasePendingFetch(ctx, pending);
+            dispatchFetchEvent(ctx, event.id, .failed, c.JS_NewString(ctx, @errorName(err).ptr), 0);
+        },
     }
+    return 0;
+}
 
-    var buffer_id: i32 = 0;
-    if (c.JS_ToInt32(ctx, &buffer_id, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
+/// End a fetch early from the main thread: the stream is cancelled and JS
+/// sees an error event.
+fn failPendingFetch(ctx: *c.JSContext, pending: *PendingFetch, msg: [:0]const u8) void {
+    const id = pending.stream_id;
+    g_file_streams.cancel(id);
+    releasePendingFetch(ctx, pending);
+    dispatchFetchEvent(ctx, id, .failed, c.JS_NewString(ctx, msg.ptr), 0);
+}
+
+/// Event types passed to __fetchEvent; mirrored by FETCH_* in the polyfill.
+const FetchEventKind = enum(i32) { open = 0, data = 1, done = 2, failed = 3 };
+
+/// Call __fetchEvent(id, type, a, b). `a` is rooted before anything else
+/// allocates; `b` is a number.
+fn dispatchFetchEvent(ctx: *c.JSContext, id: u32, kind: FetchEventKind, a: c.JSValue, b: f64) void {
+    var a_ref: c.JSGCRef = undefined;
+    const a_val = c.JS_PushGCRef(ctx, &a_ref);
+    a_val.* = a;
+    var b_ref: c.JSGCRef = undefined;
+    const b_val = c.JS_PushGCRef(ctx, &b_ref);
+    b_val.* = c.JS_NewFloat64(ctx, b);
+
+    const global = c.JS_GetGlobalObject(ctx);
+    const handler = c.JS_GetPropertyStr(ctx, global, "__fetchEvent");
+    if (c.JS_IsFunction(ctx, handler) != 0 and c.JS_StackCheck(ctx, 6) == 0) {
+        c.JS_PushArg(ctx, b_val.*);
+        c.JS_PushArg(ctx, a_val.*);
+        c.JS_PushArg(ctx, c.JS_NewInt32(ctx, @intFromEnum(kind)));
+        c.JS_PushArg(ctx, c.JS_NewInt32(ctx, @intCast(id)));
+        c.JS_PushArg(ctx, handler);
+        c.JS_PushArg(ctx, c.JS_NULL);
+        const ret = c.JS_Call(ctx, 4);
+        if (c.JS_IsException(ret) != 0) {
+            dumpException(ctx);
+        }
+    }
+    _ = c.JS_PopGCRef(ctx, &b_ref);
+    _ = c.JS_PopGCRef(ctx, &a_ref);
+}
+
+/// Fail every fetch in flight and stop the IO pool, e.g. before the archive
+/// its streams read from goes away. JS is notified only if `notify`.
+fn abortFetches(ctx: *c.JSContext, notify: bool) void {
+    g_file_streams.stop();
+    for (&g_pending_fetches) |*pending| {
+        if (!pending.active) continue;
+        const id = pending.stream_id;
+        releasePendingFetch(ctx, pending);
+        if (notify) dispatchFetchEvent(ctx, id, .failed, c.JS_NewString(ctx, "Aborted"), 0);
     }
+}
 
-    const fetch_buf = getFetchBuffer(@intCast(buffer_id)) orelse {
-        return throwTypeError(ctx, "Invalid buffer ID");
-    };
+const ArchivedAsset = struct {
+    archive: *const asset_archive.Archive,
+    entry: asset_archive.Entry,
+};
+
+/// Look a request path up in the mounted archive. Entry paths are relative
+/// to the packed directory, so leading "./" segments are ignored.
+fn findArchived(rt: *const Runtime, path: []const u8) ?ArchivedAsset {
+    const archive = if (rt.archive) |*archive| archive else return null;
+    var name = path;
+    while (std.mem.startsWith(u8, name, "./")) name = name[2..];
+    if (!asset_archive.isEntryPath(name)) return null;
+    const entry = archive.find(name) orelse return null;
+    return .{ .archive = archive, .entry = entry };
+}
+
+/// __propertyCacheStats(reset): { hits, misses } of the interpreter's
+/// property slot cache; counts restart from zero when `reset` is true.
+export fn js_propertyCacheStats(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    var hits: u64 = 0;
+    var misses: u64 = 0;
+    c.JS_GetPropertyCacheStats(ctx, &hits, &misses);
+    if (argc >= 1 and argv[0] == c.JS_TRUE) c.JS_ResetPropertyCacheStats(ctx);
+    const obj = c.JS_NewObject(ctx);
+    _ = c.JS_SetPropertyStr(ctx, obj, "hits", c.JS_NewFloat64(ctx, @floatFromInt(hits)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "misses", c.JS_NewFloat64(ctx, @floatFromInt(misses)));
+    return obj;
+}
+
+/// __gcStats(): { idle, forced, total, pauseMs, maxPauseMs,
+/// maxUnscheduledPauseMs, heapBytes, liveBytes, totalBytes }
+export fn js_gcStats(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const opaque_ptr = c.JS_GetContextOpaque(ctx) orelse return c.JS_UNDEFINED;
+    const rt: *Runtime = @ptrCast(@alignCast(opaque_ptr));
+    // Bindings run with the JS mutex held
+    const stats = rt.readGcStats();
+    const ms = @as(f64, std.time.ns_per_ms);
+    const obj = c.JS_NewObject(ctx);
+    _ = c.JS_SetPropertyStr(ctx, obj, "idle", c.JS_NewFloat64(ctx, @floatFromInt(stats.idle_count)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "forced", c.JS_NewFloat64(ctx, @floatFromInt(stats.forced_count)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "total", c.JS_NewFloat64(ctx, @floatFromInt(stats.total_count)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "pauseMs", c.JS_NewFloat64(ctx, @as(f64, @floatFromInt(stats.total_pause_ns)) / ms));
+    _ = c.JS_SetPropertyStr(ctx, obj, "maxPauseMs", c.JS_NewFloat64(ctx, @as(f64, @floatFromInt(stats.max_pause_ns)) / ms));
+    _ = c.JS_SetPropertyStr(ctx, obj, "maxUnscheduledPauseMs", c.JS_NewFloat64(ctx, @as(f64, @floatFromInt(stats.max_unscheduled_pause_ns)) / ms));
+    _ = c.JS_SetPropertyStr(ctx, obj, "heapBytes", c.JS_NewFloat64(ctx, @floatFromInt(stats.heap_bytes)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "liveBytes", c.JS_NewFloat64(ctx, @floatFromInt(stats.live_bytes)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "totalBytes", c.JS_NewFloat64(ctx, @floatFromInt(stats.total_bytes)));
+    return obj;
+}
+
+/// nativeRenderInfo(): what the shim sent to sokol, for perf HUDs and
+/// regression tests, next to Three.js's own renderer.info.
+///   frame: counters of the last flush (draws, state applies, uniform
+///     bytes, pipeline misses, bytes uploaded since the flush before)
+///   pipelines: pipeline cache counters since start
+///   uploads: buffer and texture bytes uploaded since start
+///   bufferPool, texturePool: CPU staging pool use and high-water mark
+///   textures: GPU bytes against the VRAM budget, resident and evicted
+///     counts, and the last upload pass's evictions and restores
+export fn js_nativeRenderInfo(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    var obj_ref: c.JSGCRef = undefined;
+    const obj = c.JS_PushGCRef(ctx, &obj_ref);
+    obj.* = c.JS_NewObject(ctx);
+    var entry_ref: c.JSGCRef = undefined;
+    const entry = c.JS_PushGCRef(ctx, &entry_ref);
+
+    const frame = webgl_draw.lastFlushStats();
+    entry.* = c.JS_NewObject(ctx);
+    setNumberProp(ctx, entry.*, "commands", frame.commands);
+    setNumberProp(ctx, entry.*, "passes", frame.passes);
+    setNumberProp(ctx, entry.*, "draws", frame.draws);
+    setNumberProp(ctx, entry.*, "reordered", frame.reordered);
+    setNumberProp(ctx, entry.*, "pipelineApplies", frame.pipeline_applies);
+    setNumberProp(ctx, entry.*, "bindingApplies", frame.binding_applies);
+    setNumberProp(ctx, entry.*, "uniformApplies", frame.uniform_applies);
+    setNumberProp(ctx, entry.*, "uniformBytes", frame.uniform_snapshot_bytes);
+    setNumberProp(ctx, entry.*, "uniformBufferApplies", frame.uniform_buffer_applies);
+    setNumberProp(ctx, entry.*, "uniformBufferBytes", frame.uniform_buffer_bytes);
+    setNumberProp(ctx, entry.*, "viewportApplies", frame.viewport_applies);
+    setNumberProp(ctx, entry.*, "scissorApplies", frame.scissor_applies);
+    setNumberProp(ctx, entry.*, "textureApplies", frame.texture_applies);
+    setNumberProp(ctx, entry.*, "pipelineMisses", frame.pipeline_misses);
+    setNumberProp(ctx, entry.*, "bufferUploadBytes", frame.buffer_upload_bytes);
+    setNumberProp(ctx, entry.*, "textureUploadBytes", frame.texture_upload_bytes);
+    setNumberProp(ctx, entry.*, "textureUploads", frame.texture_uploads);
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "frame", entry.*);
+
+    const pipelines = webgl_draw.pipelineCacheStats();
+    entry.* = c.JS_NewObject(ctx);
+    setNumberProp(ctx, entry.*, "hits", pipelines.hits);
+    setNumberProp(ctx, entry.*, "misses", pipelines.misses);
+    setNumberProp(ctx, entry.*, "evictions", pipelines.evictions);
+    setNumberProp(ctx, entry.*, "failures", pipelines.failures);
+    setNumberProp(ctx, entry.*, "live", pipelines.live);
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "pipelines", entry.*);
+
+    const uploads = webgl_backend.uploadStats();
+    entry.* = c.JS_NewObject(ctx);
+    setNumberProp(ctx, entry.*, "bufferBytes", uploads.buffer_bytes);
+    setNumberProp(ctx, entry.*, "textureBytes", uploads.texture_bytes);
+    setNumberProp(ctx, entry.*, "textureUploads", uploads.texture_uploads);
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "uploads", entry.*);
+
+    entry.* = poolInfo(ctx, webgl.cpuPoolStats());
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "bufferPool", entry.*);
+    entry.* = poolInfo(ctx, webgl_texture.cpuPoolStats());
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "texturePool", entry.*);
+
+    const residency = webgl_texture.residencyStats();
+    const texture_uploads = webgl_texture.lastUploadStats();
+    entry.* = c.JS_NewObject(ctx);
+    setNumberProp(ctx, entry.*, "gpuBytes", residency.gpu_bytes);
+    setNumberProp(ctx, entry.*, "budgetBytes", residency.budget_bytes);
+    setNumberProp(ctx, entry.*, "resident", residency.resident);
+    setNumberProp(ctx, entry.*, "evicted", residency.evicted);
+    setNumberProp(ctx, entry.*, "cpuReleased", residency.cpu_released);
+    setNumberProp(ctx, entry.*, "evictions", texture_uploads.evictions);
+    setNumberProp(ctx, entry.*, "restores", texture_uploads.restores);
+    _ = c.JS_SetPropertyStr(ctx, obj.*, "textures", entry.*);
+
+    _ = c.JS_PopGCRef(ctx, &entry_ref);
+    return c.JS_PopGCRef(ctx, &obj_ref);
+}
+
+/// { usedBytes, peakBytes, capacityBytes } of a CPU staging pool
+fn poolInfo(ctx: *c.JSContext, stats: cpu_block_pool.PoolStats) c.JSValue {
+    const obj = c.JS_NewObject(ctx);
+    setNumberProp(ctx, obj, "usedBytes", @as(u64, stats.used_blocks) * stats.block_size);
+    setNumberProp(ctx, obj, "peakBytes", @as(u64, stats.peak_used_blocks) * stats.block_size);
+    setNumberProp(ctx, obj, "capacityBytes", @as(u64, stats.block_count) * stats.block_size);
+    return obj;
+}
 
-    const data = fetch_buf.data orelse {
-        return throwInternalError(ctx, "Buffer has no data");
+fn setNumberProp(ctx: *c.JSContext, obj: c.JSValue, name: [:0]const u8, value: anytype) void {
+    _ = c.JS_SetPropertyStr(ctx, obj, name, c.JS_NewFloat64(ctx, @floatFromInt(value)));
+}
+
+/// Decoded strings at most this long may be a single character, which
+/// mquickjs stores inline rather than as a string object.
+const MaxInlineStringBytes = 4;
+
+/// Decode UTF-8 bytes into a string for TextDecoder.decode().
+/// Called as: __textDecode(bufferOrView, fatal, ignoreBOM) -> string
+/// The string is allocated at its decoded size and filled in one pass, so
+/// a multi-megabyte glTF document costs one scan and one copy. Invalid
+/// sequences become U+FFFD, or throw a TypeError when `fatal` is set.
+export fn js_textDecode(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return throwTypeError(ctx, "__textDecode requires a buffer");
+    const fatal = argc >= 2 and argv[1] == c.JS_TRUE;
+    const ignore_bom = argc >= 3 and argv[2] == c.JS_TRUE;
+    const source = borrowArrayBytes(ctx, argv[0]) orelse
+        return throwTypeError(ctx, "TextDecoder.decode expects an ArrayBuffer or view");
+    const skip: usize = if (!ignore_bom and std.mem.startsWith(u8, source, utf8.Bom)) utf8.Bom.len else 0;
+    const measured = utf8.measure(source[skip..]);
+    if (fatal and !measured.valid) return throwTypeError(ctx, "TextDecoder: invalid UTF-8 data");
+
+    // Replacements never shrink the input, so short output means short input
+    if (measured.len <= MaxInlineStringBytes) {
+        var short: [MaxInlineStringBytes]u8 = undefined;
+        utf8.decode(source[skip..], short[0..measured.len]);
+        return c.JS_NewStringLen(ctx, &short, measured.len);
+    }
+
+    var dst: [*c]u8 = null;
+    const str = c.JS_NewStringUninitialized(ctx, measured.len, @intFromBool(measured.ascii), &dst);
+    if (str == c.JS_EXCEPTION) return str;
+    // The allocation may have compacted the heap and moved the source
+    const src = borrowArrayBytes(ctx, argv[0]).?[skip..];
+    const out = @as([*]u8, @ptrCast(dst))[0..measured.len];
+    if (measured.valid) @memcpy(out, src) else utf8.decode(src, out);
+    return str;
+}
+
+/// Locate the GPU block levels of a KTX2 file without copying them.
+/// Called as: __parseKtx2(bufferOrView) ->
+///   [glInternalFormat, width, height, levelCount, offset0, length0, offset1, ...]
+/// Offsets are relative to the start of the argument's bytes, so levels can
+/// be viewed with new Uint8Array(buffer, offset, length) and passed straight
+/// to compressedTexImage2D. Throws for Basis Universal or supercompressed
+/// files, which need a transcoder.
+export fn js_parseKtx2(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return throwTypeError(ctx, "__parseKtx2 requires an ArrayBuffer");
+    const bytes = borrowArrayBytes(ctx, argv[0]) orelse {
+        return throwTypeError(ctx, "__parseKtx2 requires an ArrayBuffer");
     };
+    // Everything needed is copied out of `bytes` before any JS allocation
+    const image = ktx2.parse(bytes) catch |err| return throwTypeError(ctx, @errorName(err));
 
-    // Create Uint8Array with the data
-    const global = c.JS_GetGlobalObject(ctx);
-    const uint8array_ctor = c.JS_GetPropertyStr(ctx, global, "Uint8Array");
+    var values: [4 + 2 * ktx2.MaxLevels]u32 = undefined;
+    values[0] = @intFromEnum(image.format);
+    values[1] = image.width;
+    values[2] = image.height;
+    values[3] = image.level_count;
+    for (image.levels[0..image.level_count], 0..) |level, i| {
+        values[4 + 2 * i] = @intCast(level.offset);
+        values[5 + 2 * i] = @intCast(level.len);
+    }
+    const count = 4 + 2 * image.level_count;
 
-    // Create array with size, then copy data
-    c.JS_PushArg(ctx, c.JS_NewInt32(ctx, @intCast(data.len)));
-    c.JS_PushArg(ctx, uint8array_ctor);
-    c.JS_PushArg(ctx, c.JS_UNDEFINED);
-    const uint8arr = c.JS_Call(ctx, 0x10000 | 1); // FRAME_CF_CTOR | 1 arg
+    var ref: c.JSGCRef = undefined;
+    const arr = c.JS_PushGCRef(ctx, &ref);
+    arr.* = c.JS_NewArray(ctx, @intCast(count));
+    for (values[0..count], 0..) |value, i| {
+        const item = c.JS_NewUint32(ctx, value);
+        _ = c.JS_SetPropertyUint32(ctx, arr.*, @intCast(i), item);
+    }
+    return c.JS_PopGCRef(ctx, &ref);
+}
 
-    if (c.JS_IsException(uint8arr) != 0) {
-        return c.JS_EXCEPTION;
+// =============================================================================
+// Native math (Matrix4 / Skeleton / Frustum fast paths)
+// =============================================================================
+
+/// Storage of a matrix argument: Three.js math classes use plain Arrays,
+/// bone palettes and instance attributes use Float32Array.
+const NumberArrayKind = enum { array, float32, float64 };
+
+fn numberArrayKind(ctx: *c.JSContext, value: c.JSValue) ?NumberArrayKind {
+    return switch (c.JS_GetClassID(ctx, value)) {
+        c.JS_CLASS_ARRAY => .array,
+        c.JS_CLASS_FLOAT32_ARRAY => .float32,
+        c.JS_CLASS_FLOAT64_ARRAY => .float64,
+        else => null,
+    };
+}
+
+/// Elements [offset, offset + len) of a typed array, borrowed in place.
+fn typedElements(comptime T: type, ctx: *c.JSContext, value: c.JSValue, offset: u32, len: usize) ![]align(1) T {
+    const bytes = borrowArrayBytesMut(ctx, value) orelse return error.InvalidType;
+    const all = std.mem.bytesAsSlice(T, bytes[0 .. bytes.len - bytes.len % @sizeOf(T)]);
+    if (offset > all.len or len > all.len - offset) return error.OutOfRange;
+    return all[offset..][0..len];
+}
+
+/// Read numbers from argv[arg] starting at element `offset`.
+fn readNumbers(ctx: *c.JSContext, argv: [*]c.JSValue, arg: usize, offset: u32, out: []f64) !void {
+    switch (numberArrayKind(ctx, argv[arg]) orelse return error.InvalidType) {
+        .array => for (out, 0..) |*x, i| {
+            const v = c.JS_GetPropertyUint32(ctx, argv[arg], offset + @as(u32, @intCast(i)));
+            if (v == c.JS_EXCEPTION) return error.JsException;
+            if (c.JS_ToNumber(ctx, x, v) != 0) return error.JsException;
+        },
+        .float32 => for (out, try typedElements(f32, ctx, argv[arg], offset, out.len)) |*x, v| {
+            x.* = v;
+        },
+        .float64 => for (out, try typedElements(f64, ctx, argv[arg], offset, out.len)) |*x, v| {
+            x.* = v;
+        },
     }
+}
 
-    // Copy data into the Uint8Array
-    for (data, 0..) |byte, i| {
-        _ = c.JS_SetPropertyUint32(ctx, uint8arr, @intCast(i), c.JS_NewInt32(ctx, @intCast(byte)));
+/// Store numbers into argv[arg] starting at element `offset`.
+fn writeNumbers(ctx: *c.JSContext, argv: [*]c.JSValue, arg: usize, offset: u32, values: []const f64) !void {
+    switch (numberArrayKind(ctx, argv[arg]) orelse return error.InvalidType) {
+        .array => for (values, 0..) |x, i| {
+            // May allocate: argv[arg] is read after
+            const num = c.JS_NewFloat64(ctx, x);
+            const r = c.JS_SetPropertyUint32(ctx, argv[arg], offset + @as(u32, @intCast(i)), num);
+            if (r == c.JS_EXCEPTION) return error.JsException;
+        },
+        .float32 => for (try typedElements(f32, ctx, argv[arg], offset, values.len), values) |*dst, x| {
+            dst.* = @floatCast(x);
+        },
+        .float64 => for (try typedElements(f64, ctx, argv[arg], offset, values.len), values) |*dst, x| {
+            dst.* = x;
+        },
     }
+}
 
-    return uint8arr;
+/// Float32Array argument as aligned floats, for the batched kernels.
+fn readFloat32Span(ctx: *c.JSContext, value: c.JSValue) ?[]f32 {
+    if (c.JS_GetClassID(ctx, value) != c.JS_CLASS_FLOAT32_ARRAY) return null;
+    const bytes = borrowArrayBytesMut(ctx, value) orelse return null;
+    if (!std.mem.isAligned(@intFromPtr(bytes.ptr), @alignOf(f32))) return null;
+    const floats: [*]f32 = @ptrCast(@alignCast(bytes.ptr));
+    return floats[0 .. bytes.len / 4];
+}
+
+/// Matrix4.multiplyMatrices in native code.
+/// Called as: __mat4Multiply(out, a, b[, outOffset]) -> out
+/// Matrices are 16-element Arrays, Float32Arrays or Float64Arrays; the
+/// result lands at element `outOffset` of `out`, so Skeleton.update can
+/// write bone palettes directly. `out` may alias `a` or `b`.
+export fn js_mat4Multiply(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__mat4Multiply requires (out, a, b)");
+    var out_offset: u32 = 0;
+    if (argc >= 4 and c.JS_ToUint32(ctx, &out_offset, argv[3]) != 0) return c.JS_EXCEPTION;
+    var a: [math_kernels.Mat4Len]f64 = undefined;
+    var b: [math_kernels.Mat4Len]f64 = undefined;
+    readNumbers(ctx, argv, 1, 0, &a) catch |err| return mathArgError(ctx, err, "__mat4Multiply");
+    readNumbers(ctx, argv, 2, 0, &b) catch |err| return mathArgError(ctx, err, "__mat4Multiply");
+    var m: [math_kernels.Mat4Len]f64 = undefined;
+    math_kernels.multiply(f64, &m, &a, &b);
+    writeNumbers(ctx, argv, 0, out_offset, &m) catch |err| return mathArgError(ctx, err, "__mat4Multiply");
+    return argv[0];
+}
+
+/// Matrix4.compose in native code.
+/// Called as: __mat4Compose(out, px, py, pz, qx, qy, qz, qw, sx, sy, sz) -> out
+export fn js_mat4Compose(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 11) return throwTypeError(ctx, "__mat4Compose requires (out, position, quaternion, scale) components");
+    var v: [10]f64 = undefined;
+    for (&v, 1..) |*x, i| {
+        if (c.JS_ToNumber(ctx, x, argv[i]) != 0) return c.JS_EXCEPTION;
+    }
+    var m: [math_kernels.Mat4Len]f64 = undefined;
+    math_kernels.compose(f64, &m, v[0..3].*, v[3..7].*, v[7..10].*);
+    writeNumbers(ctx, argv, 0, 0, &m) catch |err| return mathArgError(ctx, err, "__mat4Compose");
+    return argv[0];
+}
+
+/// Batched matrix multiply over Float32Array spans.
+/// Called as: __mat4ArrayMultiply(out, a, b)
+/// `out` holds N matrices; `a` and `b` hold N matrices or a single one
+/// applied to all. Computed in f32, four lanes per column.
+export fn js_mat4ArrayMultiply(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__mat4ArrayMultiply requires (out, a, b)");
+    const msg = "__mat4ArrayMultiply requires Float32Arrays of whole matrices";
+    const out = readFloat32Span(ctx, argv[0]) orelse return throwTypeError(ctx, msg);
+    const a = readFloat32Span(ctx, argv[1]) orelse return throwTypeError(ctx, msg);
+    const b = readFloat32Span(ctx, argv[2]) orelse return throwTypeError(ctx, msg);
+    const len = math_kernels.Mat4Len;
+    if (out.len % len != 0 or (a.len != len and a.len != out.len) or (b.len != len and b.len != out.len)) {
+        return throwTypeError(ctx, msg);
+    }
+    runBatched(out.len / len, &MultiplyBatch{ .out = out, .a = a, .b = b }, MultiplyBatch.run);
+    return c.JS_UNDEFINED;
 }
 
-/// Free a fetch buffer
-/// Called as: __freeFetchBuffer(bufferId)
-export fn js_freeFetchBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) {
-        return c.JS_UNDEFINED;
+const MultiplyBatch = struct {
+    out: []f32,
+    a: []const f32,
+    b: []const f32,
+
+    fn run(batch: *const MultiplyBatch, begin: usize, end: usize) void {
+        const len = math_kernels.Mat4Len;
+        const a = if (batch.a.len == len) batch.a else batch.a[begin * len .. end * len];
+        const b = if (batch.b.len == len) batch.b else batch.b[begin * len .. end * len];
+        math_kernels.multiplyArray(f32, batch.out[begin * len .. end * len], a, b);
     }
+};
 
-    var buffer_id: i32 = 0;
-    if (c.JS_ToInt32(ctx, &buffer_id, argv[0]) != 0) {
-        return c.JS_UNDEFINED;
+/// Frustum.intersectsSphere over many spheres.
+/// Called as: __frustumIntersectSpheres(planes, spheres, results) -> inside count
+/// `planes` holds 6 x (nx, ny, nz, constant), `spheres` is a Float32Array
+/// of (cx, cy, cz, radius) and `results` a Uint8Array receiving 1 for each
+/// sphere at least partly inside.
+export fn js_frustumIntersectSpheres(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__frustumIntersectSpheres requires (planes, spheres, results)");
+    var plane_values: [math_kernels.FrustumLen]f64 = undefined;
+    readNumbers(ctx, argv, 0, 0, &plane_values) catch |err| return mathArgError(ctx, err, "__frustumIntersectSpheres");
+    var planes: [math_kernels.FrustumLen]f32 = undefined;
+    for (&planes, plane_values) |*dst, x| dst.* = @floatCast(x);
+
+    const spheres = readFloat32Span(ctx, argv[1]) orelse {
+        return throwTypeError(ctx, "__frustumIntersectSpheres requires a Float32Array of spheres");
+    };
+    const count = spheres.len / math_kernels.SphereLen;
+    if (c.JS_GetClassID(ctx, argv[2]) != c.JS_CLASS_UINT8_ARRAY) {
+        return throwTypeError(ctx, "__frustumIntersectSpheres requires a Uint8Array of results");
     }
+    const results = borrowArrayBytesMut(ctx, argv[2]) orelse return c.JS_EXCEPTION;
+    if (results.len < count) return throwTypeError(ctx, "__frustumIntersectSpheres results too short");
+    var batch = CullBatch{ .planes = &planes, .spheres = spheres, .results = results };
+    runBatched(count, &batch, CullBatch.run);
+    return c.JS_NewInt32(ctx, @intCast(batch.inside.load(.monotonic)));
+}
+
+const CullBatch = struct {
+    planes: *const [math_kernels.FrustumLen]f32,
+    spheres: []const f32,
+    results: []u8,
+    inside: std.atomic.Value(usize) = .init(0),
 
-    if (buffer_id >= 0) {
-        freeFetchBuffer(@intCast(buffer_id));
+    fn run(batch: *CullBatch, begin: usize, end: usize) void {
+        const spheres = batch.spheres[begin * math_kernels.SphereLen .. end * math_kernels.SphereLen];
+        const inside = math_kernels.intersectSpheres(batch.planes, spheres, batch.results[begin..end]);
+        _ = batch.inside.fetchAdd(inside, .monotonic);
     }
+};
 
-    return c.JS_UNDEFINED;
+/// Matrices or spheres per job once a batch is split across the job system;
+/// smaller batches are not worth the handoff.
+const MathJobGrain: usize = 512;
+
+/// Run a batched kernel over [0, count), on the job system when large.
+fn runBatched(count: usize, context: anytype, comptime body: fn (@TypeOf(context), usize, usize) void) void {
+    // Workers stay off the job system, whose submitter is the main thread
+    if (count <= MathJobGrain or onWebWorkerThread()) return body(context, 0, count);
+    jobSystem().parallelFor(count, MathJobGrain, context, body);
+}
+
+fn mathArgError(ctx: *c.JSContext, err: anyerror, comptime name: []const u8) c.JSValue {
+    return switch (err) {
+        error.JsException => c.JS_EXCEPTION,
+        error.OutOfRange => throwTypeError(ctx, name ++ ": matrix out of range"),
+        else => throwTypeError(ctx, name ++ " requires Array, Float32Array or Float64Array matrices"),
+    };
 }
 
 export fn js_setTimeout(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return setTimer(ctx, argc, argv, false);
+}
+
+export fn js_setInterval(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return setTimer(ctx, argc, argv, true);
+}
+
+fn setTimer(ctx: *c.JSContext, argc: c_int, argv: [*]c.JSValue, repeat: bool) c.JSValue {
     if (argc < 2) {
         return throwTypeError(ctx, "setTimeout requires (function, delay_ms)");
     }
@@ -1573,18 +3107,13 @@ export fn js_setTimeout(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]
         return throwInternalError(ctx, "runtime not initialized");
     };
 
-    for (&rt.timers, 0..) |*timer, idx| {
-        if (!timer.allocated) {
-            const pfunc = c.JS_AddGCRef(ctx, &timer.func);
-            pfunc.* = argv[0];
-            timer.timeout_ms = rt.shared.time_ms + @as(f64, @floatFromInt(delay_ms));
-            timer.allocated = true;
-            return c.JS_NewInt32(ctx, @intCast(idx));
-        }
-    }
-    return throwInternalError(ctx, "too many timers");
+    const id = rt.scheduleTimer(argv, @floatFromInt(@max(delay_ms, 0)), repeat) catch |err| {
+        return if (err == error.JsException) c.JS_EXCEPTION else throwInternalError(ctx, "out of memory for timers");
+    };
+    return c.JS_NewInt32(ctx, id);
 }
 
+/// clearTimeout and clearInterval: both kinds share one id space.
 export fn js_clearTimeout(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) {
         return c.JS_UNDEFINED;
@@ -1596,13 +3125,17 @@ export fn js_clearTimeout(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [
     const rt = getRuntime(ctx) orelse {
         return throwInternalError(ctx, "runtime not initialized");
     };
-    if (timer_id >= 0 and timer_id < MaxTimers) {
-        const t = &rt.timers[@intCast(timer_id)];
-        if (t.allocated) {
-            c.JS_DeleteGCRef(ctx, &t.func);
-            t.allocated = false;
-        }
-    }
+    rt.clearTimer(timer_id);
+    return c.JS_UNDEFINED;
+}
+
+/// __scheduleMicrotasks(): the Promise polyfill queued a job; the runtime
+/// calls __runMicrotasks() once the current callback returns.
+export fn js_scheduleMicrotasks(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const rt = getRuntime(ctx) orelse {
+        return throwInternalError(ctx, "runtime not initialized");
+    };
+    rt.microtasks_pending = true;
     return c.JS_UNDEFINED;
 }
 
@@ -1635,17 +3168,14 @@ export fn js_requestAnimationFrame(ctx: *c.JSContext, _: *c.JSValue, argc: c_int
         return throwInternalError(ctx, "runtime not initialized");
     };
 
-    for (&rt.raf) |*entry| {
-        if (!entry.active) {
-            const pfunc = c.JS_AddGCRef(ctx, &entry.func);
-            pfunc.* = argv[0];
-            entry.id = rt.next_raf_id;
-            rt.next_raf_id += 1;
-            entry.active = true;
-            return c.JS_NewInt32(ctx, entry.id);
-        }
-    }
-    return throwInternalError(ctx, "too many animation frame callbacks");
+    const id = rt.raf.add(ctx, rt.allocator, argv, null) catch |err| {
+        return if (err == error.JsException) c.JS_EXCEPTION else throwInternalError(ctx, "out of memory for animation frame callbacks");
+    };
+    rt.raf_queue.append(rt.allocator, id) catch {
+        rt.raf.remove(ctx, id);
+        return throwInternalError(ctx, "out of memory for animation frame callbacks");
+    };
+    return c.JS_NewInt32(ctx, id);
 }
 
 export fn js_cancelAnimationFrame(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
@@ -1659,13 +3189,8 @@ export fn js_cancelAnimationFrame(ctx: *c.JSContext, _: *c.JSValue, argc: c_int,
     const rt = getRuntime(ctx) orelse {
         return throwInternalError(ctx, "runtime not initialized");
     };
-    for (&rt.raf) |*entry| {
-        if (entry.active and entry.id == id) {
-            c.JS_DeleteGCRef(ctx, &entry.func);
-            entry.active = false;
-            break;
-        }
-    }
+    // Its id stays queued and is skipped at the next frame
+    rt.raf.remove(ctx, id);
     return c.JS_UNDEFINED;
 }
 
@@ -1673,6 +3198,32 @@ export fn js_dom_noop(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue)
     return c.JS_UNDEFINED;
 }
 
+/// event.getCoalescedEvents() for mousemove and wheel: one event object per
+/// raw event folded into the dispatched one, oldest first. Reflects the
+/// last frame's input until the next tick.
+export fn js_getCoalescedEvents(ctx: *c.JSContext, this_val: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    var type_buf: c.JSCStringBuf = undefined;
+    var type_len: usize = 0;
+    const type_val = c.JS_GetPropertyStr(ctx, this_val.*, "type");
+    const type_str = c.JS_ToCStringLen(ctx, &type_len, type_val, &type_buf);
+    const is_wheel = type_str != null and std.mem.eql(u8, @as([*]const u8, @ptrCast(type_str))[0..type_len], "wheel");
+    const raw = if (is_wheel) g_coalesced_wheels else g_coalesced_moves;
+
+    var arr_ref: c.JSGCRef = undefined;
+    const arr = c.JS_PushGCRef(ctx, &arr_ref);
+    arr.* = c.JS_NewArray(ctx, @intCast(raw.len));
+    var item_ref: c.JSGCRef = undefined;
+    const item = c.JS_PushGCRef(ctx, &item_ref);
+    for (raw, 0..) |event, i| {
+        item.* = c.JS_NewObject(ctx);
+        setEventProp(ctx, item, "type", c.JS_NewString(ctx, event.event_type.toString().ptr));
+        fillMouseEventObject(ctx, item, event.event_type, event.data.mouse);
+        _ = c.JS_SetPropertyUint32(ctx, arr.*, @intCast(i), item.*);
+    }
+    _ = c.JS_PopGCRef(ctx, &item_ref);
+    return c.JS_PopGCRef(ctx, &arr_ref);
+}
+
 /// addEventListener(type, callback) - Register an event listener
 export fn js_addEventListener(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 2) return c.JS_UNDEFINED;
@@ -1836,111 +3387,1331 @@ export fn js_dom_getContext(ctx: *c.JSContext, this_val: *c.JSValue, argc: c_int
 }
 
 // =============================================================================
-// Image constructor and loading
+// Web Workers
 // =============================================================================
 
-/// Image constructor: new Image() or new Image(width, height)
-export fn js_Image(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    const img = c.JS_NewObject(ctx);
+// Each Worker runs a runtime of its own (context, heap, timers) on its own
+// thread. Messages cross as worker_messages.Message: JSON text plus binary
+// buffers, copied out of the sending heap and into the receiving one.
 
-    // Set default properties
-    var width: i32 = 0;
-    var height: i32 = 0;
-    if (argc >= 2) {
-        _ = c.JS_ToInt32(ctx, &width, argv[0]);
-        _ = c.JS_ToInt32(ctx, &height, argv[1]);
-    }
-    _ = c.JS_SetPropertyStr(ctx, img, "width", c.JS_NewInt32(ctx, width));
-    _ = c.JS_SetPropertyStr(ctx, img, "height", c.JS_NewInt32(ctx, height));
-    _ = c.JS_SetPropertyStr(ctx, img, "complete", c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, img, "naturalWidth", c.JS_NewInt32(ctx, 0));
-    _ = c.JS_SetPropertyStr(ctx, img, "naturalHeight", c.JS_NewInt32(ctx, 0));
+const worker_log = std.log.scoped(.worker);
 
-    // Mark this as a native Image for detection in texImage2D
-    _ = c.JS_SetPropertyStr(ctx, img, "_isNativeImage", c.JS_TRUE);
+const MaxWebWorkers: usize = 8;
+const DefaultWorkerHeapBytes: usize = 16 * 1024 * 1024;
+const MaxWorkerHeapMb: u32 = 1024;
+/// Messages handed to JS per tick, on either side
+const MaxWorkerMessagesPerFrame: usize = 64;
+/// ArrayBuffers one message may carry
+const MaxMessageBuffers: usize = 256;
+/// Longest an idle worker sleeps before re-checking its flags
+const WorkerIdleWaitMs: f64 = 1000;
 
-    // Native handle for pixel data (0 = not loaded)
-    _ = c.JS_SetPropertyStr(ctx, img, "_nativeHandle", c.JS_NewInt32(ctx, 0));
+const WebWorker = struct {
+    // Main thread only
+    active: bool = false,
+    /// terminate() was called: messages from the worker are dropped
+    terminated: bool = false,
+    joined: bool = false,
+    id: u32 = 0,
+    thread: std.Thread = undefined,
+
+    // Read-only once the thread runs
+    /// Script source (blob: URLs) or path, NUL-terminated
+    script: [:0]u8 = undefined,
+    script_is_source: bool = false,
+    allocator: std.mem.Allocator = undefined,
+    heap_bytes: usize = 0,
+    /// The parent's resolved asset root, inherited by the worker runtime
+    asset_root: [MaxAssetRootLen]u8 = undefined,
+    asset_root_len: usize = 0,
+
+    /// Main to worker
+    inbox: worker_messages.Mailbox = .{},
+    /// Worker to main; main owns the producer side too once joined
+    outbox: worker_messages.Mailbox = .{},
+    /// close() or terminate(): leave the event loop
+    closing: std.atomic.Value(bool) = .init(false),
+    /// terminate(): also interrupt running JS
+    terminate: std.atomic.Value(bool) = .init(false),
+    exited: std.atomic.Value(bool) = .init(false),
+};
 
-    return img;
+var g_web_workers: [MaxWebWorkers]WebWorker = [_]WebWorker{.{}} ** MaxWebWorkers;
+var g_next_web_worker_id: u32 = 1;
+
+fn findWebWorker(id: u32) ?*WebWorker {
+    for (&g_web_workers) |*worker| {
+        if (worker.active and !worker.terminated and worker.id == id) return worker;
+    }
+    return null;
 }
 
-/// Load an image from a file path and populate the Image object
-/// Called as: __loadImage(imageObj, path)
-export fn js_loadImage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return throwTypeError(ctx, "__loadImage requires (image, path)");
+/// __workerCreate(url, source, heapMb): start a worker running `source`,
+/// or the script file at `url` when source is null. Returns its id.
+export fn js_workerCreate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return throwTypeError(ctx, "__workerCreate requires a URL");
+    const rt = getRuntime(ctx) orelse return throwInternalError(ctx, "runtime not initialized");
+    if (rt.worker != null) return throwTypeError(ctx, "Worker: nested workers are not supported");
 
-    const img_obj = argv[0];
-    // Verify it's an object-like value (not a primitive)
-    if (c.JS_IsNull(img_obj) != 0 or c.JS_IsUndefined(img_obj) != 0 or c.JS_IsBool(img_obj) != 0) {
-        return throwTypeError(ctx, "__loadImage: first argument must be an Image object");
-    }
+    var heap_mb: u32 = 0;
+    if (argc >= 3 and c.JS_ToUint32(ctx, &heap_mb, argv[2]) != 0) return c.JS_EXCEPTION;
+    const worker: *WebWorker = for (&g_web_workers) |*slot| {
+        if (!slot.active) break slot;
+    } else return throwInternalError(ctx, "Worker: too many workers");
 
-    // Get path string
-    if (c.JS_IsString(ctx, argv[1]) == 0) {
-        return throwTypeError(ctx, "__loadImage: second argument must be a string path");
-    }
+    const is_source = argc >= 2 and c.JS_IsString(ctx, argv[1]) != 0;
     var len: usize = 0;
     var buf: c.JSCStringBuf = undefined;
-    const c_str = c.JS_ToCStringLen(ctx, &len, argv[1], &buf);
+    const c_str = c.JS_ToCStringLen(ctx, &len, argv[if (is_source) 1 else 0], &buf);
     if (c_str == null) return c.JS_EXCEPTION;
-    const path = @as([*]const u8, @ptrCast(c_str))[0..len];
-
-    // Get runtime allocator
-    const runtime = getRuntime(ctx) orelse return throwInternalError(ctx, "no runtime");
+    const script = rt.allocator.dupeZ(u8, @as([*]const u8, @ptrCast(c_str))[0..len]) catch {
+        return throwInternalError(ctx, "Worker: out of memory");
+    };
 
-    // Load image file
-    var image_data = image_loader.loadFromFile(runtime.allocator, path) catch |err| {
-        // Set error state
-        _ = c.JS_SetPropertyStr(ctx, img_obj, "_loadError", c.JS_TRUE);
-        log.debug("__loadImage: failed to load '{s}': {s}", .{ path, @errorName(err) });
-        return c.JS_FALSE;
+    worker.* = .{
+        .active = true,
+        .id = g_next_web_worker_id,
+        .script = script,
+        .script_is_source = is_source,
+        .allocator = rt.allocator,
+        .heap_bytes = if (heap_mb == 0) DefaultWorkerHeapBytes else @as(usize, @min(heap_mb, MaxWorkerHeapMb)) * 1024 * 1024,
+        .asset_root_len = rt.asset_root_len,
+    };
+    @memcpy(worker.asset_root[0..rt.asset_root_len], rt.asset_root_buf[0..rt.asset_root_len]);
+    worker.thread = std.Thread.spawn(.{}, runWebWorker, .{worker}) catch {
+        rt.allocator.free(script);
+        worker.* = .{};
+        return throwInternalError(ctx, "Worker: failed to start thread");
     };
+    g_next_web_worker_id = if (g_next_web_worker_id == std.math.maxInt(i32)) 1 else g_next_web_worker_id + 1;
+    return c.JS_NewInt32(ctx, @intCast(worker.id));
+}
+
+/// __workerPost(id, json, buffers): queue a message, encoded by
+/// __cloneEncode, for a worker. Messages to a closed worker are dropped.
+export fn js_workerPost(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__workerPost requires (id, json, buffers)");
+    var id: u32 = 0;
+    if (c.JS_ToUint32(ctx, &id, argv[0]) != 0) return c.JS_EXCEPTION;
+    const worker = findWebWorker(id) orelse return c.JS_UNDEFINED;
+    if (worker.closing.load(.acquire)) return c.JS_UNDEFINED;
+    const msg = messageFromJs(ctx, worker.allocator, argv + 1) catch |err| return messageError(ctx, err);
+    worker.inbox.send(msg);
+    return c.JS_UNDEFINED;
+}
 
-    // Allocate native image slot
-    const handle = allocNativeImage() orelse {
-        image_data.deinit();
-        return throwInternalError(ctx, "too many native images");
-    };
-
-    // Transfer pixel ownership to native storage
-    const native_img = getNativeImage(handle) orelse {
-        image_data.deinit();
-        return throwInternalError(ctx, "failed to get native image");
-    };
-    native_img.width = image_data.width;
-    native_img.height = image_data.height;
-    native_img.allocator = image_data.allocator;
-    native_img.pixels = image_data.pixels;
-
-    // Don't free pixels - ownership transferred to native storage
-    image_data.pixels = undefined;
-
-    // Update Image object properties
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "width", c.JS_NewInt32(ctx, @intCast(native_img.width)));
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "height", c.JS_NewInt32(ctx, @intCast(native_img.height)));
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "naturalWidth", c.JS_NewInt32(ctx, @intCast(native_img.width)));
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "naturalHeight", c.JS_NewInt32(ctx, @intCast(native_img.height)));
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "complete", c.JS_TRUE);
-    _ = c.JS_SetPropertyStr(ctx, img_obj, "_nativeHandle", c.JS_NewInt32(ctx, @intCast(handle)));
-
-    // Call onload callback if present
-    const onload = c.JS_GetPropertyStr(ctx, img_obj, "onload");
-    if (c.JS_IsFunction(ctx, onload) != 0) {
-        if (c.JS_StackCheck(ctx, 2) == 0) {
-            c.JS_PushArg(ctx, onload);
-            c.JS_PushArg(ctx, img_obj);
-            const ret = c.JS_Call(ctx, 0);
-            if (c.JS_IsException(ret) != 0) {
-                dumpException(ctx);
-            }
+/// __workerTerminate(id): stop a worker, interrupting any running script.
+/// The thread is joined by a later tick.
+export fn js_workerTerminate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return throwTypeError(ctx, "__workerTerminate requires an id");
+    var id: u32 = 0;
+    if (c.JS_ToUint32(ctx, &id, argv[0]) != 0) return c.JS_EXCEPTION;
+    const worker = findWebWorker(id) orelse return c.JS_UNDEFINED;
+    worker.terminated = true;
+    worker.terminate.store(true, .release);
+    worker.closing.store(true, .release);
+    worker.inbox.notify();
+    return c.JS_UNDEFINED;
+}
+
+/// __workerPostParent(json, buffers): postMessage() inside a worker.
+export fn js_workerPostParent(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "__workerPostParent requires (json, buffers)");
+    const rt = getRuntime(ctx) orelse return throwInternalError(ctx, "runtime not initialized");
+    const worker = rt.worker orelse return throwTypeError(ctx, "postMessage: not in a worker");
+    const msg = messageFromJs(ctx, worker.allocator, argv) catch |err| return messageError(ctx, err);
+    worker.outbox.send(msg);
+    return c.JS_UNDEFINED;
+}
+
+/// __workerClose(): close() inside a worker; the event loop ends once the
+/// running callback returns.
+export fn js_workerClose(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const rt = getRuntime(ctx) orelse return throwInternalError(ctx, "runtime not initialized");
+    const worker = rt.worker orelse return throwTypeError(ctx, "close: not in a worker");
+    worker.closing.store(true, .release);
+    return c.JS_UNDEFINED;
+}
+
+/// Copy __cloneEncode output, args[0] the JSON text and args[1] the array
+/// of ArrayBuffers, out of the heap into a new message.
+fn messageFromJs(ctx: *c.JSContext, allocator: std.mem.Allocator, args: [*]c.JSValue) !*worker_messages.Message {
+    var count: u32 = 0;
+    const count_val = c.JS_GetPropertyStr(ctx, args[1], "length");
+    if (count_val == c.JS_EXCEPTION or c.JS_ToUint32(ctx, &count, count_val) != 0) return error.JsException;
+    if (count > MaxMessageBuffers) return error.TooManyBuffers;
+    var lens: [MaxMessageBuffers]usize = undefined;
+    for (lens[0..count], 0..) |*len, i| {
+        const buffer = c.JS_GetPropertyUint32(ctx, args[1], @intCast(i));
+        if (buffer == c.JS_EXCEPTION) return error.JsException;
+        len.* = (borrowArrayBytes(ctx, buffer) orelse return error.NotArrayBuffer).len;
+    }
+
+    var json_len: usize = 0;
+    var buf: c.JSCStringBuf = undefined;
+    const json = c.JS_ToCStringLen(ctx, &json_len, args[0], &buf);
+    if (json == null) return error.JsException;
+    // Native allocation only from here on: the borrows stay valid
+    const msg = try worker_messages.Message.create(allocator, .message, json_len, lens[0..count]);
+    errdefer msg.destroy();
+    @memcpy(msg.json(), @as([*]const u8, @ptrCast(json))[0..json_len]);
+    for (0..count) |i| {
+        const buffer = c.JS_GetPropertyUint32(ctx, args[1], @intCast(i));
+        const bytes = borrowArrayBytes(ctx, buffer) orelse return error.NotArrayBuffer;
+        if (bytes.len != lens[i]) return error.NotArrayBuffer;
+        @memcpy(msg.buffer(i), bytes);
+    }
+    return msg;
+}
+
+fn messageError(ctx: *c.JSContext, err: anyerror) c.JSValue {
+    return switch (err) {
+        error.JsException => c.JS_EXCEPTION,
+        error.TooManyBuffers => throwTypeError(ctx, "postMessage: too many ArrayBuffers"),
+        error.NotArrayBuffer => throwTypeError(ctx, "postMessage: buffers must be ArrayBuffers"),
+        else => throwInternalError(ctx, "postMessage: out of memory"),
+    };
+}
+
+/// Call __workerMessage(id, isError, json, buffers) with a message's
+/// contents copied into the heap. Returns false, with the exception
+/// pending, if anything throws.
+fn dispatchWorkerMessage(ctx: *c.JSContext, id: u32, msg: *worker_messages.Message) bool {
+    var buffers_ref: c.JSGCRef = undefined;
+    const buffers = c.JS_PushGCRef(ctx, &buffers_ref);
+    defer _ = c.JS_PopGCRef(ctx, &buffers_ref);
+    var json_ref: c.JSGCRef = undefined;
+    const json = c.JS_PushGCRef(ctx, &json_ref);
+    defer _ = c.JS_PopGCRef(ctx, &json_ref);
+
+    buffers.* = c.JS_NewArray(ctx, 0);
+    if (buffers.* == c.JS_EXCEPTION) return false;
+    for (0..msg.buffer_count) |i| {
+        const bytes = msg.buffer(i);
+        const buffer = c.JS_NewArrayBufferUninitialized(ctx, bytes.len);
+        if (buffer == c.JS_EXCEPTION) return false;
+        @memcpy(borrowArrayBytesMut(ctx, buffer).?, bytes);
+        if (c.JS_SetPropertyUint32(ctx, buffers.*, @intCast(i), buffer) == c.JS_EXCEPTION) return false;
+    }
+    json.* = c.JS_NewStringLen(ctx, msg.json().ptr, msg.json().len);
+    if (json.* == c.JS_EXCEPTION) return false;
+
+    const global = c.JS_GetGlobalObject(ctx);
+    const handler = c.JS_GetPropertyStr(ctx, global, "__workerMessage");
+    if (c.JS_IsFunction(ctx, handler) == 0) return true;
+    if (c.JS_StackCheck(ctx, 6) != 0) return false;
+    c.JS_PushArg(ctx, buffers.*);
+    c.JS_PushArg(ctx, json.*);
+    c.JS_PushArg(ctx, jsBool(msg.kind == .@"error"));
+    c.JS_PushArg(ctx, c.JS_NewInt32(ctx, @intCast(id)));
+    c.JS_PushArg(ctx, handler);
+    c.JS_PushArg(ctx, c.JS_NULL);
+    return c.JS_IsException(c.JS_Call(ctx, 4)) == 0;
+}
+
+/// Hand messages from workers to their Worker objects, at most
+/// MaxWorkerMessagesPerFrame per tick, and reap workers that have exited.
+fn deliverWorkerMessages(ctx: *c.JSContext) void {
+    var delivered: usize = 0;
+    for (&g_web_workers) |*worker| {
+        if (!worker.active) continue;
+        _ = worker.inbox.flush();
+        if (!worker.joined and worker.exited.load(.acquire)) {
+            worker.thread.join();
+            worker.joined = true;
+        }
+        while (delivered < MaxWorkerMessagesPerFrame and worker.active) {
+            // The thread is gone: what it left in overflow is ours to move
+            if (worker.joined) _ = worker.outbox.flush();
+            const msg = worker.outbox.receive() orelse break;
+            defer msg.destroy();
+            delivered += 1;
+            if (worker.terminated) continue;
+            if (!dispatchWorkerMessage(ctx, worker.id, msg)) dumpException(ctx);
+        }
+        if (worker.active and worker.joined and worker.outbox.isEmpty()) {
+            const id = worker.id;
+            const notify = !worker.terminated;
+            releaseWebWorker(worker);
+            if (notify) callWorkerExit(ctx, id);
+        }
+    }
+}
+
+/// Free a joined worker's slot and anything still queued.
+fn releaseWebWorker(worker: *WebWorker) void {
+    worker.inbox.drain();
+    worker.outbox.drain();
+    worker.allocator.free(worker.script);
+    worker.* = .{};
+}
+
+/// Let the Worker object go once its thread ended on its own (close()).
+fn callWorkerExit(ctx: *c.JSContext, id: u32) void {
+    const global = c.JS_GetGlobalObject(ctx);
+    const handler = c.JS_GetPropertyStr(ctx, global, "__workerExit");
+    if (c.JS_IsFunction(ctx, handler) == 0) return;
+    if (c.JS_StackCheck(ctx, 3) != 0) {
+        dumpException(ctx);
+        return;
+    }
+    c.JS_PushArg(ctx, c.JS_NewInt32(ctx, @intCast(id)));
+    c.JS_PushArg(ctx, handler);
+    c.JS_PushArg(ctx, c.JS_NULL);
+    if (c.JS_IsException(c.JS_Call(ctx, 1)) != 0) dumpException(ctx);
+}
+
+/// Terminate and join every worker; part of the main runtime's deinit.
+fn stopWebWorkers() void {
+    for (&g_web_workers) |*worker| {
+        if (!worker.active) continue;
+        worker.terminate.store(true, .release);
+        worker.closing.store(true, .release);
+        worker.inbox.notify();
+    }
+    for (&g_web_workers) |*worker| {
+        if (!worker.active) continue;
+        if (!worker.joined) worker.thread.join();
+        releaseWebWorker(worker);
+    }
+}
+
+fn workerInterrupt(_: ?*c.JSContext, ctx_opaque: ?*anyopaque) callconv(.c) c_int {
+    const rt: *Runtime = @ptrCast(@alignCast(ctx_opaque orelse return 0));
+    const worker = rt.worker orelse return 0;
+    return @intFromBool(worker.terminate.load(.acquire));
+}
+
+/// Worker thread: run the script, then deliver messages and timers until
+/// close() or terminate().
+fn runWebWorker(worker: *WebWorker) void {
+    defer worker.exited.store(true, .release);
+    var rt = Runtime.init(worker.allocator, worker.heap_bytes) catch |err| {
+        postWorkerError(worker, @errorName(err));
+        return;
+    };
+    defer rt.deinit();
+    rt.worker = worker;
+    @memcpy(rt.asset_root_buf[0..worker.asset_root_len], worker.asset_root[0..worker.asset_root_len]);
+    rt.asset_root_len = worker.asset_root_len;
+    rt.makeCurrent();
+    const ctx = rt.ctx;
+    c.JS_SetInterruptHandler(ctx, workerInterrupt);
+    installWorkerScope(ctx) catch {
+        postWorkerError(worker, "failed to install the worker scope");
+        return;
+    };
+
+    const script = worker.script;
+    const ret = if (worker.script_is_source)
+        c.JS_Eval(ctx, script.ptr, script.len, "worker", 0)
+    else
+        runScriptFile(&rt, ctx, script);
+    if (ret == c.JS_EXCEPTION) reportWorkerException(ctx, worker);
+    rt.runMicrotasks();
+
+    const started_ms = std.time.milliTimestamp();
+    while (!worker.closing.load(.acquire)) {
+        const seen = worker.inbox.epoch.load(.acquire);
+        const now_ms: f64 = @floatFromInt(std.time.milliTimestamp() - started_ms);
+        rt.shared.time_ms = now_ms;
+        var delivered: usize = 0;
+        while (delivered < MaxWorkerMessagesPerFrame and !worker.closing.load(.acquire)) : (delivered += 1) {
+            const msg = worker.inbox.receive() orelse break;
+            defer msg.destroy();
+            if (!dispatchWorkerMessage(ctx, 0, msg)) reportWorkerException(ctx, worker);
+            rt.runMicrotasks();
         }
+        rt.runTimers(now_ms);
+
+        // Sleep until a message or the next timer; poll while the outbox
+        // is backed up, and not at all if the inbox still has messages
+        var wait_ms = rt.nextTimerDelay(now_ms) orelse WorkerIdleWaitMs;
+        if (!worker.outbox.flush()) wait_ms = @min(wait_ms, 1);
+        if (delivered == MaxWorkerMessagesPerFrame) wait_ms = 0;
+        if (wait_ms > 0) worker.inbox.wait(seen, @intFromFloat(wait_ms * std.time.ns_per_ms));
+    }
+}
+
+fn installWorkerScope(ctx: *c.JSContext) !void {
+    try installPromiseAndFetch(ctx);
+    try installStructuredClone(ctx);
+    const result = c.JS_Eval(ctx, worker_scope_code, worker_scope_code.len, "worker_scope", 0);
+    if (result == c.JS_EXCEPTION) {
+        dumpException(ctx);
+        return error.HelperEvalFailed;
+    }
+}
+
+/// Send the pending exception to the Worker's onerror.
+fn reportWorkerException(ctx: *c.JSContext, worker: *WebWorker) void {
+    const exception = c.JS_GetException(ctx);
+    var len: usize = 0;
+    var buf: c.JSCStringBuf = undefined;
+    const text = c.JS_ToCStringLen(ctx, &len, exception, &buf);
+    if (text == null) {
+        _ = c.JS_GetException(ctx);
+        postWorkerError(worker, "uncaught exception");
+        return;
+    }
+    const message = @as([*]const u8, @ptrCast(text))[0..len];
+    worker_log.warn("uncaught exception: {s}", .{message});
+    postWorkerError(worker, message);
+}
+
+fn postWorkerError(worker: *WebWorker, message: []const u8) void {
+    const msg = worker_messages.Message.create(worker.allocator, .@"error", message.len, &.{}) catch {
+        worker_log.err("out of memory reporting a worker error", .{});
+        return;
+    };
+    @memcpy(msg.json(), message);
+    worker.outbox.send(msg);
+}
+
+fn installStructuredClone(ctx: *c.JSContext) !void {
+    const result = c.JS_Eval(ctx, structured_clone_code, structured_clone_code.len, "structured_clone", 0);
+    if (result == c.JS_EXCEPTION) {
+        dumpException(ctx);
+        return error.HelperEvalFailed;
+    }
+}
+
+/// __workerInstall(): replace the Worker stub with the real constructor.
+/// Runs on first use, so pages without workers keep the heap it takes.
+export fn js_workerInstall(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const global = c.JS_GetGlobalObject(ctx);
+    if (c.JS_IsFunction(ctx, c.JS_GetPropertyStr(ctx, global, "__workerMessage")) != 0) return c.JS_UNDEFINED;
+    installStructuredClone(ctx) catch return throwInternalError(ctx, "Worker: failed to install structured clone");
+    if (c.JS_Eval(ctx, worker_api_code, worker_api_code.len, "worker_api", 0) == c.JS_EXCEPTION) return c.JS_EXCEPTION;
+    return c.JS_UNDEFINED;
+}
+
+// Structured clone as JSON plus a buffer list. Values JSON cannot carry
+// become single-key marker objects: [0, i] ArrayBuffer i, [1, kind, i,
+// byteOffset, length] a view on buffer i, [2] undefined, [3, text] a
+// non-finite number, [5, object] an object that has the marker key itself,
+// [6, time] a Date, [7, source, flags] a RegExp, [8, name, message] an
+// Error, [9, [[key, value]...]] a Map and [10, [value...]] a Set. Date,
+// Map and Set exist only where a script provides them (the engine has no
+// Date instances and no collections), and decode with the receiver's.
+// Views carry their whole buffer, and buffers shared by several views stay
+// shared. Transferred buffers are copied too: heaps cannot hand memory
+// over, so the sender's copy stays usable.
+const structured_clone_code =
+    \\(function() {
+    \\  var KEY = '@@clone';
+    \\  var VIEWS = [Int8Array, Uint8Array, Uint8ClampedArray, Int16Array, Uint16Array,
+    \\    Int32Array, Uint32Array, Float32Array, Float64Array];
+    \\  var ERRORS = ['EvalError', 'RangeError', 'ReferenceError', 'SyntaxError', 'TypeError', 'URIError'];
+    \\
+    \\  function cloneError(message) {
+    \\    var error = new Error(message);
+    \\    error.name = 'DataCloneError';
+    \\    return error;
+    \\  }
+    \\  function marker(value) {
+    \\    var m = {};
+    \\    m[KEY] = value;
+    \\    return m;
+    \\  }
+    \\  function viewKind(v) {
+    \\    for (var i = 0; i < VIEWS.length; i++) {
+    \\      if (v instanceof VIEWS[i]) return i;
+    \\    }
+    \\    return -1;
+    \\  }
+    \\  function isA(v, name) {
+    \\    var ctor = globalThis[name];
+    \\    return typeof ctor === 'function' && typeof ctor.prototype === 'object' && v instanceof ctor;
+    \\  }
+    \\  function construct(name) {
+    \\    if (typeof globalThis[name] !== 'function') throw cloneError(name + ' is not available');
+    \\    return globalThis[name];
+    \\  }
+    \\
+    \\  globalThis.__cloneEncode = function(value, transfer) {
+    \\    var buffers = [];
+    \\    var stack = [];
+    \\    if (transfer) {
+    \\      for (var t = 0; t < transfer.length; t++) {
+    \\        if (!(transfer[t] instanceof ArrayBuffer)) throw cloneError('only ArrayBuffers can be transferred');
+    \\        if (buffers.indexOf(transfer[t]) < 0) buffers.push(transfer[t]);
+    \\      }
+    \\    }
+    \\    function bufferIndex(buffer) {
+    \\      var i = buffers.indexOf(buffer);
+    \\      if (i < 0) {
+    \\        i = buffers.length;
+    \\        buffers.push(buffer);
+    \\      }
+    \\      return i;
+    \\    }
+    \\    function encode(v) {
+    \\      if (v === undefined) return marker([2]);
+    \\      if (typeof v === 'number') return isFinite(v) ? v : marker([3, String(v)]);
+    \\      if (v === null || typeof v === 'boolean' || typeof v === 'string') return v;
+    \\      if (typeof v !== 'object') throw cloneError(typeof v + ' values cannot be cloned');
+    \\      if (v instanceof ArrayBuffer) return marker([0, bufferIndex(v)]);
+    \\      var kind = viewKind(v);
+    \\      if (kind >= 0) return marker([1, kind, bufferIndex(v.buffer), v.byteOffset, v.length]);
+    \\      if (isA(v, 'Date')) return marker([6, encode(v.getTime())]);
+    \\      if (v instanceof RegExp) return marker([7, v.source, v.flags]);
+    \\      if (v instanceof Error) return marker([8, String(v.name), String(v.message)]);
+    \\      if (stack.indexOf(v) >= 0) throw cloneError('cyclic values cannot be cloned');
+    \\      stack.push(v);
+    \\      var out;
+    \\      if (Array.isArray(v)) {
+    \\        out = [];
+    \\        for (var i = 0; i < v.length; i++) out.push(encode(v[i]));
+    \\      } else if (isA(v, 'Map')) {
+    \\        out = [];
+    \\        v.forEach(function(value, key) { out.push([encode(key), encode(value)]); });
+    \\        out = marker([9, out]);
+    \\      } else if (isA(v, 'Set')) {
+    \\        out = [];
+    \\        v.forEach(function(value) { out.push(encode(value)); });
+    \\        out = marker([10, out]);
+    \\      } else {
+    \\        out = {};
+    \\        var keys = Object.keys(v);
+    \\        for (var k = 0; k < keys.length; k++) out[keys[k]] = encode(v[keys[k]]);
+    \\        if (KEY in out) out = marker([5, out]);
+    \\      }
+    \\      stack.pop();
+    \\      return out;
+    \\    }
+    \\    return { json: JSON.stringify(encode(value)), buffers: buffers };
+    \\  };
+    \\
+    \\  globalThis.__cloneDecode = function(json, buffers) {
+    \\    function decode(v) {
+    \\      if (v === null || typeof v !== 'object') return v;
+    \\      if (Array.isArray(v)) {
+    \\        for (var i = 0; i < v.length; i++) v[i] = decode(v[i]);
+    \\        return v;
+    \\      }
+    \\      if (KEY in v) {
+    \\        var m = v[KEY];
+    \\        switch (m[0]) {
+    \\          case 0: return buffers[m[1]];
+    \\          case 1: return new VIEWS[m[1]](buffers[m[2]], m[3], m[4]);
+    \\          case 2: return undefined;
+    \\          case 3: return Number(m[1]);
+    \\          case 5: v = m[1]; break;
+    \\          case 6: return new (construct('Date'))(decode(m[1]));
+    \\          case 7: return new RegExp(m[1], m[2]);
+    \\          case 8:
+    \\            var error = new (ERRORS.indexOf(m[1]) >= 0 ? globalThis[m[1]] : Error)(m[2]);
+    \\            if (error.name !== m[1]) error.name = m[1];
+    \\            return error;
+    \\          case 9:
+    \\            var map = new (construct('Map'))();
+    \\            for (var e = 0; e < m[1].length; e++) map.set(decode(m[1][e][0]), decode(m[1][e][1]));
+    \\            return map;
+    \\          case 10:
+    \\            var set = new (construct('Set'))();
+    \\            for (var s = 0; s < m[1].length; s++) set.add(decode(m[1][s]));
+    \\            return set;
+    \\          default: throw cloneError('unknown clone marker ' + m[0]);
+    \\        }
+    \\      }
+    \\      var keys = Object.keys(v);
+    \\      for (var k = 0; k < keys.length; k++) v[keys[k]] = decode(v[keys[k]]);
+    \\      return v;
+    \\    }
+    \\    return decode(JSON.parse(json));
+    \\  };
+    \\})();
+;
+
+// Globals of a worker context: self, postMessage, close, importScripts
+// and 'message' listeners.
+const worker_scope_code =
+    \\(function() {
+    \\  var listeners = [];
+    \\  globalThis.self = globalThis;
+    \\  // The GL context and the canvas belong to the main thread
+    \\  var mainOnly = ['gl', 'setClearColor', 'nativeRenderInfo', '__dom_getContext'];
+    \\  for (var i = 0; i < mainOnly.length; i++) delete globalThis[mainOnly[i]];
+    \\  globalThis.onmessage = null;
+    \\  globalThis.postMessage = function(message, transfer) {
+    \\    if (transfer && !Array.isArray(transfer)) transfer = transfer.transfer;
+    \\    var clone = __cloneEncode(message, transfer);
+    \\    __workerPostParent(clone.json, clone.buffers);
+    \\  };
+    \\  globalThis.close = function() { __workerClose(); };
+    \\  globalThis.importScripts = function() {
+    \\    for (var i = 0; i < arguments.length; i++) load(String(arguments[i]));
+    \\  };
+    \\  globalThis.addEventListener = function(type, fn) {
+    \\    if (type === 'message' && listeners.indexOf(fn) < 0) listeners.push(fn);
+    \\  };
+    \\  globalThis.removeEventListener = function(type, fn) {
+    \\    var i = listeners.indexOf(fn);
+    \\    if (type === 'message' && i >= 0) listeners.splice(i, 1);
+    \\  };
+    \\  globalThis.__workerMessage = function(id, isError, json, buffers) {
+    \\    var event = { type: 'message', data: __cloneDecode(json, buffers), target: self };
+    \\    if (typeof self.onmessage === 'function') self.onmessage(event);
+    \\    var list = listeners.slice();
+    \\    for (var i = 0; i < list.length; i++) list[i].call(self, event);
+    \\  };
+    \\})();
+;
+
+// Main context, at startup: the Blob and URL.createObjectURL subset that
+// inline worker scripts are made from, and a Worker stub that installs
+// the real constructor. Blobs only hold text here.
+const blob_url_code =
+    \\(function() {
+    \\  if (typeof globalThis.Blob === 'undefined') {
+    \\    var Blob = function(parts, options) {
+    \\      var text = '';
+    \\      parts = parts || [];
+    \\      for (var i = 0; i < parts.length; i++) {
+    \\        var part = parts[i];
+    \\        if (typeof part === 'string') text += part;
+    \\        else if (part instanceof Blob) text += part._text;
+    \\        else text += new TextDecoder().decode(part);
+    \\      }
+    \\      this._text = text;
+    \\      this.size = text.length;
+    \\      this.type = options && options.type ? String(options.type) : '';
+    \\    };
+    \\    Blob.prototype.text = function() { return Promise.resolve(this._text); };
+    \\    globalThis.Blob = Blob;
+    \\  }
+    \\
+    \\  var blobs = {};
+    \\  var nextBlob = 1;
+    \\  if (typeof globalThis.URL === 'undefined') globalThis.URL = {};
+    \\  URL.createObjectURL = function(blob) {
+    \\    var url = 'blob:three-native/' + nextBlob++;
+    \\    blobs[url] = blob;
+    \\    return url;
+    \\  };
+    \\  URL.revokeObjectURL = function(url) { delete blobs[url]; };
+    \\  globalThis.__blobText = function(url) { return blobs[url] ? blobs[url]._text : null; };
+    \\
+    \\  globalThis.Worker = function(url, options) {
+    \\    __workerInstall();
+    \\    return new Worker(url, options);
+    \\  };
+    \\})();
+;
+
+// Main context, at startup: AudioContext and AudioBuffer stubs that
+// install the real constructors.
+const audio_stub_code =
+    \\(function() {
+    \\  function stub(name) {
+    \\    return function(a, b) {
+    \\      __audioInstall();
+    \\      return new globalThis[name](a, b);
+    \\    };
+    \\  }
+    \\  var names = ['AudioContext', 'webkitAudioContext', 'AudioBuffer'];
+    \\  for (var i = 0; i < names.length; i++) {
+    \\    globalThis[names[i]] = stub(names[i]);
+    \\    if (globalThis.window) window[names[i]] = globalThis[names[i]];
+    \\  }
+    \\})();
+;
+
+// Main context, on first use: Web Audio over the native graph in
+// web_audio.zig. Node, buffer and param handles are plain numbers; the
+// objects here only keep the JS-visible state.
+const audio_api_code =
+    \\(function() {
+    \\  // Numbering of web_audio.zig's NodeKind, Param, ParamOp and Config
+    \\  var KIND_GAIN = 2, KIND_PANNER = 3, KIND_SOURCE = 4;
+    \\  var PARAM = {
+    \\    gain: 0, playbackRate: 1, detune: 2,
+    \\    positionX: 3, positionY: 4, positionZ: 5,
+    \\    orientationX: 6, orientationY: 7, orientationZ: 8,
+    \\    forwardX: 9, forwardY: 10, forwardZ: 11,
+    \\    upX: 12, upY: 13, upZ: 14
+    \\  };
+    \\  var OP_SET = 0, OP_SET_AT = 1, OP_LINEAR = 2, OP_EXPONENTIAL = 3, OP_TARGET = 4, OP_CANCEL = 5;
+    \\  var CONFIG = {
+    \\    loop: 0, loopStart: 1, loopEnd: 2, distanceModel: 3, refDistance: 4, maxDistance: 5,
+    \\    rolloffFactor: 6, coneInnerAngle: 7, coneOuterAngle: 8, coneOuterGain: 9
+    \\  };
+    \\  var DISTANCE_MODELS = { linear: 0, inverse: 1, exponential: 2 };
+    \\
+    \\  // Every AudioContext shares the native graph; its handles are only good
+    \\  // for the generation it was opened in
+    \\  var generation = 0;
+    \\  // Started sources by node handle, until they end
+    \\  var playing = {};
+    \\
+    \\  function live(node) {
+    \\    return node._live && node.context._open;
+    \\  }
+    \\
+    \\  function AudioParam(node, param, defaultValue) {
+    \\    this._node = node;
+    \\    this._param = param;
+    \\    this._value = defaultValue;
+    \\    this.defaultValue = defaultValue;
+    \\    this.minValue = -3.4028234663852886e38;
+    \\    this.maxValue = 3.4028234663852886e38;
+    \\  }
+    \\  AudioParam.prototype._schedule = function(op, value, time, timeConstant) {
+    \\    if (live(this._node)) __audioParam(this._node._id, this._param, op, value, time, timeConstant);
+    \\    return this;
+    \\  };
+    \\  Object.defineProperty(AudioParam.prototype, 'value', {
+    \\    get: function() {
+    \\      return live(this._node) ? __audioParamValue(this._node._id, this._param) : this._value;
+    \\    },
+    \\    set: function(value) {
+    \\      this._value = +value;
+    \\      this._schedule(OP_SET, this._value, 0, 0);
+    \\    }
+    \\  });
+    \\  // One event at a time: each call replaces the pending one, starting
+    \\  // from the value the param has when it arrives
+    \\  AudioParam.prototype.setValueAtTime = function(value, time) {
+    \\    this._value = +value;
+    \\    return this._schedule(OP_SET_AT, this._value, +time, 0);
+    \\  };
+    \\  AudioParam.prototype.linearRampToValueAtTime = function(value, time) {
+    \\    this._value = +value;
+    \\    return this._schedule(OP_LINEAR, this._value, +time, 0);
+    \\  };
+    \\  AudioParam.prototype.exponentialRampToValueAtTime = function(value, time) {
+    \\    if (+value === 0) throw new RangeError('exponentialRampToValueAtTime: value must not be 0');
+    \\    this._value = +value;
+    \\    return this._schedule(OP_EXPONENTIAL, this._value, +time, 0);
+    \\  };
+    \\  AudioParam.prototype.setTargetAtTime = function(value, time, timeConstant) {
+    \\    if (!(timeConstant >= 0)) throw new RangeError('setTargetAtTime: timeConstant must not be negative');
+    \\    this._value = +value;
+    \\    return this._schedule(OP_TARGET, this._value, +time, +timeConstant);
+    \\  };
+    \\  AudioParam.prototype.cancelScheduledValues = function(time) {
+    \\    return this._schedule(OP_CANCEL, 0, +time || 0, 0);
+    \\  };
+    \\  AudioParam.prototype.cancelAndHoldAtTime = AudioParam.prototype.cancelScheduledValues;
+    \\
+    \\  function initNode(node, context, id) {
+    \\    node.context = context;
+    \\    node._id = id;
+    \\    node._live = true;
+    \\    node._handle = null;
+    \\    node.numberOfInputs = 1;
+    \\    node.numberOfOutputs = 1;
+    \\    node.channelCount = 2;
+    \\    node.channelCountMode = 'max';
+    \\    node.channelInterpretation = 'speakers';
+    \\  }
+    \\
+    \\  function AudioNode() {
+    \\    throw new TypeError('Illegal constructor');
+    \\  }
+    \\  // A node feeds one other node: connecting again moves its output
+    \\  AudioNode.prototype.connect = function(destination) {
+    \\    if (!destination || destination._id === undefined || destination instanceof AudioParam) {
+    \\      throw new TypeError('AudioNode.connect: destination must be an AudioNode');
+    \\    }
+    \\    if (live(this)) __audioConnect(this._id, destination._id);
+    \\    return destination;
+    \\  };
+    \\  AudioNode.prototype.disconnect = function() {
+    \\    if (live(this)) __audioDisconnect(this._id);
+    \\  };
+    \\
+    \\  function AudioDestinationNode(context, id) {
+    \\    initNode(this, context, id);
+    \\    this.numberOfOutputs = 0;
+    \\    this.maxChannelCount = 2;
+    \\  }
+    \\  AudioDestinationNode.prototype = Object.create(AudioNode.prototype);
+    \\
+    \\  // A created node; the graph frees it once this object is collected and
+    \\  // nothing feeds it
+    \\  function createNode(node, context, kind) {
+    \\    var id = __audioCreateNode(kind);
+    \\    initNode(node, context, id);
+    \\    node._handle = new __AudioNodeHandle(id);
+    \\  }
+    \\
+    \\  function GainNode(context, options) {
+    \\    createNode(this, context, KIND_GAIN);
+    \\    this.gain = new AudioParam(this, PARAM.gain, 1);
+    \\    if (options && options.gain !== undefined) this.gain.value = options.gain;
+    \\  }
+    \\  GainNode.prototype = Object.create(AudioNode.prototype);
+    \\
+    \\  // HRTF is accepted and pans with equal power
+    \\  function PannerNode(context, options) {
+    \\    createNode(this, context, KIND_PANNER);
+    \\    this.channelCountMode = 'clamped-max';
+    \\    this.positionX = new AudioParam(this, PARAM.positionX, 0);
+    \\    this.positionY = new AudioParam(this, PARAM.positionY, 0);
+    \\    this.positionZ = new AudioParam(this, PARAM.positionZ, 0);
+    \\    this.orientationX = new AudioParam(this, PARAM.orientationX, 1);
+    \\    this.orientationY = new AudioParam(this, PARAM.orientationY, 0);
+    \\    this.orientationZ = new AudioParam(this, PARAM.orientationZ, 0);
+    \\    this._config = {
+    \\      panningModel: 'equalpower', distanceModel: 'inverse', refDistance: 1, maxDistance: 10000,
+    \\      rolloffFactor: 1, coneInnerAngle: 360, coneOuterAngle: 360, coneOuterGain: 0
+    \\    };
+    \\    if (options) {
+    \\      for (var name in this._config) {
+    \\        if (options[name] !== undefined) this[name] = options[name];
+    \\      }
+    \\    }
+    \\  }
+    \\  PannerNode.prototype = Object.create(AudioNode.prototype);
+    \\  function defineNumberConfig(name) {
+    \\    Object.defineProperty(PannerNode.prototype, name, {
+    \\      get: function() { return this._config[name]; },
+    \\      set: function(value) {
+    \\        this._config[name] = +value;
+    \\        if (live(this)) __audioConfig(this._id, CONFIG[name], +value);
+    \\      }
+    \\    });
+    \\  }
+    \\  var numberConfigs = ['refDistance', 'maxDistance', 'rolloffFactor', 'coneInnerAngle', 'coneOuterAngle', 'coneOuterGain'];
+    \\  for (var i = 0; i < numberConfigs.length; i++) defineNumberConfig(numberConfigs[i]);
+    \\  Object.defineProperty(PannerNode.prototype, 'distanceModel', {
+    \\    get: function() { return this._config.distanceModel; },
+    \\    set: function(value) {
+    \\      if (!DISTANCE_MODELS.hasOwnProperty(value)) return;
+    \\      this._config.distanceModel = value;
+    \\      if (live(this)) __audioConfig(this._id, CONFIG.distanceModel, DISTANCE_MODELS[value]);
+    \\    }
+    \\  });
+    \\  Object.defineProperty(PannerNode.prototype, 'panningModel', {
+    \\    get: function() { return this._config.panningModel; },
+    \\    set: function(value) {
+    \\      if (value === 'equalpower' || value === 'HRTF') this._config.panningModel = value;
+    \\    }
+    \\  });
+    \\  PannerNode.prototype.setPosition = function(x, y, z) {
+    \\    this.positionX.value = x;
+    \\    this.positionY.value = y;
+    \\    this.positionZ.value = z;
+    \\  };
+    \\  PannerNode.prototype.setOrientation = function(x, y, z) {
+    \\    this.orientationX.value = x;
+    \\    this.orientationY.value = y;
+    \\    this.orientationZ.value = z;
+    \\  };
+    \\
+    \\  function AudioListener(context, id) {
+    \\    this.context = context;
+    \\    this._id = id;
+    \\    this._live = true;
+    \\    this.positionX = new AudioParam(this, PARAM.positionX, 0);
+    \\    this.positionY = new AudioParam(this, PARAM.positionY, 0);
+    \\    this.positionZ = new AudioParam(this, PARAM.positionZ, 0);
+    \\    this.forwardX = new AudioParam(this, PARAM.forwardX, 0);
+    \\    this.forwardY = new AudioParam(this, PARAM.forwardY, 0);
+    \\    this.forwardZ = new AudioParam(this, PARAM.forwardZ, -1);
+    \\    this.upX = new AudioParam(this, PARAM.upX, 0);
+    \\    this.upY = new AudioParam(this, PARAM.upY, 1);
+    \\    this.upZ = new AudioParam(this, PARAM.upZ, 0);
+    \\  }
+    \\  AudioListener.prototype.setPosition = function(x, y, z) {
+    \\    this.positionX.value = x;
+    \\    this.positionY.value = y;
+    \\    this.positionZ.value = z;
+    \\  };
+    \\  AudioListener.prototype.setOrientation = function(x, y, z, upX, upY, upZ) {
+    \\    this.forwardX.value = x;
+    \\    this.forwardY.value = y;
+    \\    this.forwardZ.value = z;
+    \\    this.upX.value = upX;
+    \\    this.upY.value = upY;
+    \\    this.upZ.value = upZ;
+    \\  };
+    \\
+    \\  // Samples live natively, freed once the buffer is collected and no
+    \\  // source plays them. getChannelData() hands out a copy, which is
+    \\  // written back when a source starts with the buffer and then detached:
+    \\  // later writes to it reach only sources started after another
+    \\  // getChannelData().
+    \\  function AudioBuffer(options) {
+    \\    options = options || {};
+    \\    var channels = options.numberOfChannels === undefined ? 1 : options.numberOfChannels;
+    \\    var id = __audioCreateBuffer(channels, options.length, options.sampleRate);
+    \\    this._init(id, channels, options.length, options.sampleRate);
+    \\  }
+    \\  AudioBuffer.prototype._init = function(id, channels, length, sampleRate) {
+    \\    this._setId(id);
+    \\    this._generation = generation;
+    \\    this._channels = [];
+    \\    this.numberOfChannels = channels;
+    \\    this.length = length;
+    \\    this.sampleRate = sampleRate;
+    \\    this.duration = length / sampleRate;
+    \\  };
+    \\  // A copy-on-write comes back as a new handle; the old one is already
+    \\  // left to the sources playing it
+    \\  AudioBuffer.prototype._setId = function(id) {
+    \\    if (this._id === id) return;
+    \\    this._id = id;
+    \\    this._handle = new __AudioBufferHandle(id);
+    \\  };
+    \\  AudioBuffer.prototype._check = function(channel) {
+    \\    if (this._generation !== generation) throw new Error('InvalidStateError: AudioBuffer belongs to a closed AudioContext');
+    \\    if (!(channel >= 0 && channel < this.numberOfChannels)) throw new RangeError('AudioBuffer: channel out of range');
+    \\  };
+    \\  AudioBuffer.prototype.getChannelData = function(channel) {
+    \\    this._check(channel);
+    \\    var data = this._channels[channel];
+    \\    if (!data) {
+    \\      data = new Float32Array(this.length);
+    \\      __audioBufferRead(this._id, channel, data, 0);
+    \\      this._channels[channel] = data;
+    \\    }
+    \\    return data;
+    \\  };
+    \\  AudioBuffer.prototype.copyFromChannel = function(destination, channel, start) {
+    \\    this._check(channel);
+    \\    start = start || 0;
+    \\    var data = this._channels[channel];
+    \\    if (!data) return __audioBufferRead(this._id, channel, destination, start);
+    \\    var n = Math.min(destination.length, this.length - start);
+    \\    for (var i = 0; i < n; i++) destination[i] = data[start + i];
+    \\  };
+    \\  AudioBuffer.prototype.copyToChannel = function(source, channel, start) {
+    \\    this._check(channel);
+    \\    start = start || 0;
+    \\    var data = this._channels[channel];
+    \\    if (!data) {
+    \\      this._setId(__audioBufferWrite(this._id, channel, source, start));
+    \\      return;
+    \\    }
+    \\    var n = Math.min(source.length, this.length - start);
+    \\    for (var i = 0; i < n; i++) data[start + i] = source[i];
+    \\  };
+    \\  // Native copy-on-write: a buffer a source still plays comes back as a
+    \\  // new handle
+    \\  AudioBuffer.prototype._sync = function() {
+    \\    this._check(0);
+    \\    for (var channel = 0; channel < this._channels.length; channel++) {
+    \\      var data = this._channels[channel];
+    \\      if (data) this._setId(__audioBufferWrite(this._id, channel, data, 0));
+    \\    }
+    \\    this._channels = [];
+    \\  };
+    \\  function wrapBuffer(id, channels, length, sampleRate) {
+    \\    var buffer = Object.create(AudioBuffer.prototype);
+    \\    buffer._init(id, channels, length, sampleRate);
+    \\    return buffer;
+    \\  }
+    \\
+    \\  function AudioBufferSourceNode(context, options) {
+    \\    createNode(this, context, KIND_SOURCE);
+    \\    this.numberOfInputs = 0;
+    \\    this.playbackRate = new AudioParam(this, PARAM.playbackRate, 1);
+    \\    this.detune = new AudioParam(this, PARAM.detune, 0);
+    \\    this.onended = null;
+    \\    this._buffer = null;
+    \\    this._loop = false;
+    \\    this._loopStart = 0;
+    \\    this._loopEnd = 0;
+    \\    this._listeners = [];
+    \\    if (options) {
+    \\      if (options.buffer) this.buffer = options.buffer;
+    \\      if (options.loop !== undefined) this.loop = options.loop;
+    \\      if (options.loopStart !== undefined) this.loopStart = options.loopStart;
+    \\      if (options.loopEnd !== undefined) this.loopEnd = options.loopEnd;
+    \\      if (options.playbackRate !== undefined) this.playbackRate.value = options.playbackRate;
+    \\      if (options.detune !== undefined) this.detune.value = options.detune;
+    \\    }
+    \\  }
+    \\  AudioBufferSourceNode.prototype = Object.create(AudioNode.prototype);
+    \\  // The buffer is taken when the source starts
+    \\  Object.defineProperty(AudioBufferSourceNode.prototype, 'buffer', {
+    \\    get: function() { return this._buffer; },
+    \\    set: function(buffer) { this._buffer = buffer || null; }
+    \\  });
+    \\  function defineSourceConfig(name, field, toNumber) {
+    \\    Object.defineProperty(AudioBufferSourceNode.prototype, name, {
+    \\      get: function() { return this[field]; },
+    \\      set: function(value) {
+    \\        this[field] = toNumber ? +value : !!value;
+    \\        if (live(this)) __audioConfig(this._id, CONFIG[name], +this[field]);
+    \\      }
+    \\    });
+    \\  }
+    \\  defineSourceConfig('loop', '_loop', false);
+    \\  defineSourceConfig('loopStart', '_loopStart', true);
+    \\  defineSourceConfig('loopEnd', '_loopEnd', true);
+    \\  AudioBufferSourceNode.prototype.start = function(when, offset, duration) {
+    \\    if (!live(this)) throw new Error('InvalidStateError: source already played or its context is closed');
+    \\    var buffer = this._buffer;
+    \\    if (buffer) buffer._sync();
+    \\    __audioStart(this._id, buffer ? buffer._id : 0, +when || 0, +offset || 0, duration === undefined ? -1 : +duration);
+    \\    playing[this._id] = this;
+    \\  };
+    \\  AudioBufferSourceNode.prototype.stop = function(when) {
+    \\    if (live(this)) __audioStop(this._id, +when || 0);
+    \\  };
+    \\  AudioBufferSourceNode.prototype.addEventListener = function(type, fn) {
+    \\    if (type === 'ended' && this._listeners.indexOf(fn) < 0) this._listeners.push(fn);
+    \\  };
+    \\  AudioBufferSourceNode.prototype.removeEventListener = function(type, fn) {
+    \\    var i = this._listeners.indexOf(fn);
+    \\    if (type === 'ended' && i >= 0) this._listeners.splice(i, 1);
+    \\  };
+    \\
+    \\  function AudioContext(options) {
+    \\    var info = __audioOpen();
+    \\    generation = info.generation;
+    \\    this._open = true;
+    \\    this._closedTime = 0;
+    \\    this.sampleRate = info.sampleRate;
+    \\    this.baseLatency = info.baseLatency;
+    \\    this.outputLatency = info.baseLatency;
+    \\    this.state = 'running';
+    \\    this.onstatechange = null;
+    \\    this.destination = new AudioDestinationNode(this, info.destination);
+    \\    this.listener = new AudioListener(this, info.listener);
+    \\  }
+    \\  Object.defineProperty(AudioContext.prototype, 'currentTime', {
+    \\    get: function() { return this._open ? __audioTime() : this._closedTime; }
+    \\  });
+    \\  AudioContext.prototype._setState = function(state) {
+    \\    if (this.state === state) return;
+    \\    this.state = state;
+    \\    if (typeof this.onstatechange === 'function') this.onstatechange({ type: 'statechange', target: this });
+    \\  };
+    \\  // Contexts share one device, so suspending one pauses them all
+    \\  AudioContext.prototype.resume = function() {
+    \\    if (!this._open) return Promise.reject(new Error('InvalidStateError: AudioContext is closed'));
+    \\    __audioSuspend(false);
+    \\    this._setState('running');
+    \\    return Promise.resolve();
+    \\  };
+    \\  AudioContext.prototype.suspend = function() {
+    \\    if (!this._open) return Promise.reject(new Error('InvalidStateError: AudioContext is closed'));
+    \\    __audioSuspend(true);
+    \\    this._setState('suspended');
+    \\    return Promise.resolve();
+    \\  };
+    \\  AudioContext.prototype.close = function() {
+    \\    if (this._open) {
+    \\      this._closedTime = __audioTime();
+    \\      this._open = false;
+    \\      for (var id in playing) {
+    \\        if (playing[id].context === this) delete playing[id];
+    \\      }
+    \\      __audioClose();
+    \\      this._setState('closed');
+    \\    }
+    \\    return Promise.resolve();
+    \\  };
+    \\  AudioContext.prototype.createGain = function() { return new GainNode(this); };
+    \\  AudioContext.prototype.createPanner = function() { return new PannerNode(this); };
+    \\  AudioContext.prototype.createBufferSource = function() { return new AudioBufferSourceNode(this); };
+    \\  AudioContext.prototype.createBuffer = function(channels, length, sampleRate) {
+    \\    return new AudioBuffer({ numberOfChannels: channels, length: length, sampleRate: sampleRate });
+    \\  };
+    \\  // WAV only; the buffer keeps the file's sample rate and is resampled
+    \\  // while playing
+    \\  AudioContext.prototype.decodeAudioData = function(data, success, failure) {
+    \\    return new Promise(function(resolve, reject) {
+    \\      var request = {
+    \\        resolve: function(buffer) {
+    \\          if (typeof success === 'function') success(buffer);
+    \\          resolve(buffer);
+    \\        },
+    \\        reject: function(error) {
+    \\          if (typeof failure === 'function') failure(error);
+    \\          reject(error);
+    \\        }
+    \\      };
+    \\      try {
+    \\        __decodeAudio(request, data);
+    \\      } catch (e) {
+    \\        request.reject(e);
+    \\      }
+    \\    });
+    \\  };
+    \\
+    \\  // Called by the runtime when a background decode finishes (buffer 0:
+    \\  // it failed)
+    \\  globalThis.__audioDecodeDone = function(request, buffer, channels, length, sampleRate) {
+    \\    if (buffer === 0) request.reject(new Error('EncodingError: unable to decode audio data'));
+    \\    else request.resolve(wrapBuffer(buffer, channels, length, sampleRate));
+    \\  };
+    \\
+    \\  // Called by the runtime when a source finished; its handle is released
+    \\  globalThis.__audioEnded = function(id) {
+    \\    var node = playing[id];
+    \\    if (!node) return;
+    \\    delete playing[id];
+    \\    node._live = false;
+    \\    var event = { type: 'ended', target: node };
+    \\    if (typeof node.onended === 'function') node.onended(event);
+    \\    var list = node._listeners.slice();
+    \\    for (var i = 0; i < list.length; i++) list[i].call(node, event);
+    \\  };
+    \\
+    \\  var exported = {
+    \\    AudioContext: AudioContext, webkitAudioContext: AudioContext, AudioNode: AudioNode,
+    \\    AudioParam: AudioParam, AudioBuffer: AudioBuffer, GainNode: GainNode, PannerNode: PannerNode,
+    \\    AudioBufferSourceNode: AudioBufferSourceNode
+    \\  };
+    \\  for (var name in exported) {
+    \\    globalThis[name] = exported[name];
+    \\    if (globalThis.window) window[name] = exported[name];
+    \\  }
+    \\})();
+;
+
+// Main context, on first use: Worker and the dispatch of its messages
+const worker_api_code =
+    \\(function() {
+    \\  // Live workers by id; keeps each Worker reachable until it ends
+    \\  var workers = {};
+    \\  function Worker(url, options) {
+    \\    url = String(url);
+    \\    if (options && options.type === 'module') throw new TypeError('Worker: module workers are not supported');
+    \\    var source = null;
+    \\    if (url.indexOf('blob:') === 0) {
+    \\      source = __blobText(url);
+    \\      if (source === null) throw new TypeError('Worker: unknown blob URL ' + url);
+    \\    }
+    \\    this.onmessage = null;
+    \\    this.onerror = null;
+    \\    this._listeners = { message: [], error: [] };
+    \\    // heapMB is an extension: the worker's fixed JS heap size
+    \\    this._id = __workerCreate(url, source, options && options.heapMB ? options.heapMB : 0);
+    \\    workers[this._id] = this;
+    \\  }
+    \\  Worker.prototype.postMessage = function(message, transfer) {
+    \\    if (transfer && !Array.isArray(transfer)) transfer = transfer.transfer;
+    \\    var clone = __cloneEncode(message, transfer);
+    \\    __workerPost(this._id, clone.json, clone.buffers);
+    \\  };
+    \\  Worker.prototype.terminate = function() {
+    \\    delete workers[this._id];
+    \\    __workerTerminate(this._id);
+    \\  };
+    \\  Worker.prototype.addEventListener = function(type, fn) {
+    \\    var list = this._listeners[type];
+    \\    if (list && list.indexOf(fn) < 0) list.push(fn);
+    \\  };
+    \\  Worker.prototype.removeEventListener = function(type, fn) {
+    \\    var list = this._listeners[type];
+    \\    var i = list ? list.indexOf(fn) : -1;
+    \\    if (i >= 0) list.splice(i, 1);
+    \\  };
+    \\  Worker.prototype._dispatch = function(type, event) {
+    \\    var handler = this['on' + type];
+    \\    if (typeof handler === 'function') handler.call(this, event);
+    \\    var list = this._listeners[type].slice();
+    \\    for (var i = 0; i < list.length; i++) list[i].call(this, event);
+    \\  };
+    \\
+    \\  globalThis.__workerMessage = function(id, isError, json, buffers) {
+    \\    var worker = workers[id];
+    \\    if (!worker) return;
+    \\    if (isError) worker._dispatch('error', { type: 'error', message: json, target: worker });
+    \\    else worker._dispatch('message', { type: 'message', data: __cloneDecode(json, buffers), target: worker });
+    \\  };
+    \\  globalThis.__workerExit = function(id) { delete workers[id]; };
+    \\  globalThis.Worker = Worker;
+    \\})();
+;
+
+// =============================================================================
+// Image constructor and loading
+// =============================================================================
+
+/// Image constructor: new Image() or new Image(width, height)
+export fn js_Image(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    const img = c.JS_NewObject(ctx);
+
+    // Set default properties
+    var width: i32 = 0;
+    var height: i32 = 0;
+    if (argc >= 2) {
+        _ = c.JS_ToInt32(ctx, &width, argv[0]);
+        _ = c.JS_ToInt32(ctx, &height, argv[1]);
+    }
+    _ = c.JS_SetPropertyStr(ctx, img, "width", c.JS_NewInt32(ctx, width));
+    _ = c.JS_SetPropertyStr(ctx, img, "height", c.JS_NewInt32(ctx, height));
+    _ = c.JS_SetPropertyStr(ctx, img, "complete", c.JS_FALSE);
+    _ = c.JS_SetPropertyStr(ctx, img, "naturalWidth", c.JS_NewInt32(ctx, 0));
+    _ = c.JS_SetPropertyStr(ctx, img, "naturalHeight", c.JS_NewInt32(ctx, 0));
+
+    // Mark this as a native Image for detection in texImage2D
+    _ = c.JS_SetPropertyStr(ctx, img, "_isNativeImage", c.JS_TRUE);
+
+    // Native handle for pixel data (0 = not loaded)
+    _ = c.JS_SetPropertyStr(ctx, img, "_nativeHandle", c.JS_NewInt32(ctx, 0));
+
+    return img;
+}
+
+/// Start loading an image file in the background
+/// Called as: __loadImage(imageObj, path)
+/// Read and decode happen on the decode pool; a later tick fills in the
+/// Image's size and native handle and calls __imageLoadDone(img, ok).
+/// Throws when the load cannot be queued.
+export fn js_loadImage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "__loadImage requires (image, path)");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "images are not available in workers");
+
+    const img_obj = argv[0];
+    // Verify it's an object-like value (not a primitive)
+    if (c.JS_IsNull(img_obj) != 0 or c.JS_IsUndefined(img_obj) != 0 or c.JS_IsBool(img_obj) != 0) {
+        return throwTypeError(ctx, "__loadImage: first argument must be an Image object");
+    }
+
+    // Get path string
+    if (c.JS_IsString(ctx, argv[1]) == 0) {
+        return throwTypeError(ctx, "__loadImage: second argument must be a string path");
     }
+    var len: usize = 0;
+    var buf: c.JSCStringBuf = undefined;
+    const c_str = c.JS_ToCStringLen(ctx, &len, argv[1], &buf);
+    if (c_str == null) return c.JS_EXCEPTION;
+    const path = @as([*]const u8, @ptrCast(c_str))[0..len];
+
+    const runtime = getRuntime(ctx) orelse return throwInternalError(ctx, "no runtime");
+    const pending = findFreePendingImage() orelse return throwInternalError(ctx, "too many pending image loads");
+    const decoder = imageDecoder(runtime);
+    // The path is used up (copied into the job or looked up in the archive)
+    // before anything can allocate on the JS heap
+    const submitted = if (findArchived(runtime, path)) |found| blk: {
+        const bytes = decoder.allocator.alloc(u8, found.entry.size) catch break :blk error.OutOfMemory;
+        found.archive.extract(found.entry, bytes) catch {
+            decoder.allocator.free(bytes);
+            return throwInternalError(ctx, "corrupt archive entry");
+        };
+        break :blk decoder.submitOwnedBytes(bytes, false);
+    } else decoder.submitFile(path, false);
+    const job_id = submitted catch |err| {
+        return throwInternalError(ctx, @errorName(err));
+    };
+    trackPendingImage(ctx, pending, job_id, img_obj);
+
+    log.debug("__loadImage: queued '{s}' as job {d}", .{ path, job_id });
+    return c.JS_TRUE;
+}
 
-    log.debug("__loadImage: loaded '{s}' ({d}x{d})", .{ path, image_data.width, image_data.height });
+/// Start decoding encoded image bytes in the background
+/// Called as: __decodeImage(imageObj, bufferOrView, flipY)
+/// Completes like __loadImage. The bytes are copied, so the buffer may be
+/// reused as soon as this returns.
+export fn js_decodeImage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "__decodeImage requires (image, buffer)");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "images are not available in workers");
+    const flip_y = argc >= 3 and argv[2] == c.JS_TRUE;
+
+    const runtime = getRuntime(ctx) orelse return throwInternalError(ctx, "no runtime");
+    const pending = findFreePendingImage() orelse return throwInternalError(ctx, "too many pending image loads");
+    const bytes = borrowArrayBytes(ctx, argv[1]) orelse {
+        return throwTypeError(ctx, "__decodeImage: second argument must be an ArrayBuffer or view");
+    };
+    const job_id = imageDecoder(runtime).submitBytes(bytes, flip_y) catch |err| {
+        return throwInternalError(ctx, @errorName(err));
+    };
+    trackPendingImage(ctx, pending, job_id, argv[0]);
     return c.JS_TRUE;
 }
 
+/// The shared decode pool, started with the runtime's allocator on first use.
+fn imageDecoder(runtime: *Runtime) *image_decode.DecodePool {
+    if (!g_image_decoder.started) g_image_decoder.start(runtime.allocator, jobSystem());
+    return &g_image_decoder;
+}
+
+/// The shared job system, started on first use with a worker per spare
+/// core. Image reads are partly IO-bound, so one worker is kept even on a
+/// single core.
+fn jobSystem() *job_system.JobSystem {
+    if (!g_jobs.started) {
+        const cpus = std.Thread.getCpuCount() catch 1;
+        g_jobs.start(@intCast(@min(@max(cpus, 2) - 1, job_system.MaxWorkers)));
+    }
+    return &g_jobs;
+}
+
+fn findFreePendingImage() ?*PendingImage {
+    for (&g_pending_images) |*pending| {
+        if (!pending.active) return pending;
+    }
+    return null;
+}
+
+fn trackPendingImage(ctx: *c.JSContext, pending: *PendingImage, job_id: u32, img_obj: c.JSValue) void {
+    const ref = c.JS_AddGCRef(ctx, &pending.img);
+    ref.* = img_obj;
+    pending.job_id = job_id;
+    pending.active = true;
+}
+
+/// Main thread: attach a finished decode to its Image and notify JS.
+fn deliverImage(ctx: *c.JSContext, result: image_decode.Result) void {
+    const pending = for (&g_pending_images) |*p| {
+        if (p.active and p.job_id == result.id) break p;
+    } else {
+        result.discard();
+        return;
+    };
+
+    var loaded = false;
+    if (result.image) |image| {
+        loaded = storeNativeImage(ctx, &pending.img, image);
+    } else |err| {
+        log.debug("image job {d} failed: {s}", .{ result.id, @errorName(err) });
+    }
+    if (!loaded) _ = c.JS_SetPropertyStr(ctx, pending.img.val, "_loadError", c.JS_TRUE);
+
+    const global = c.JS_GetGlobalObject(ctx);
+    const done = c.JS_GetPropertyStr(ctx, global, "__imageLoadDone");
+    if (c.JS_IsFunction(ctx, done) != 0 and c.JS_StackCheck(ctx, 4) == 0) {
+        c.JS_PushArg(ctx, if (loaded) c.JS_TRUE else c.JS_FALSE);
+        c.JS_PushArg(ctx, pending.img.val);
+        c.JS_PushArg(ctx, done);
+        c.JS_PushArg(ctx, c.JS_NULL);
+        const ret = c.JS_Call(ctx, 2);
+        if (c.JS_IsException(ret) != 0) {
+            dumpException(ctx);
+        }
+    }
+
+    c.JS_DeleteGCRef(ctx, &pending.img);
+    pending.* = .{};
+}
+
+/// Move decoded pixels into a native image slot and publish its size on the
+/// Image object. `img` is re-read after every property set because the
+/// object may move when the JS heap compacts.
+fn storeNativeImage(ctx: *c.JSContext, img: *c.JSGCRef, image_data: image_loader.ImageData) bool {
+    var image = image_data;
+    const handle = allocNativeImage() orelse {
+        log.warn("too many native images", .{});
+        image.deinit();
+        return false;
+    };
+    const native_img = getNativeImage(handle).?;
+    native_img.width = image.width;
+    native_img.height = image.height;
+    native_img.allocator = image.allocator;
+    native_img.pixels = image.pixels;
+
+    const width: i32 = @intCast(image.width);
+    const height: i32 = @intCast(image.height);
+    _ = c.JS_SetPropertyStr(ctx, img.val, "width", c.JS_NewInt32(ctx, width));
+    _ = c.JS_SetPropertyStr(ctx, img.val, "height", c.JS_NewInt32(ctx, height));
+    _ = c.JS_SetPropertyStr(ctx, img.val, "naturalWidth", c.JS_NewInt32(ctx, width));
+    _ = c.JS_SetPropertyStr(ctx, img.val, "naturalHeight", c.JS_NewInt32(ctx, height));
+    _ = c.JS_SetPropertyStr(ctx, img.val, "complete", c.JS_TRUE);
+    _ = c.JS_SetPropertyStr(ctx, img.val, "_nativeHandle", c.JS_NewInt32(ctx, @intCast(handle)));
+    return true;
+}
+
 /// Free an image's native pixel data
 /// Called as: __freeImage(imageObj)
 export fn js_freeImage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
@@ -1969,6 +4740,25 @@ export fn js_freeImage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c
     return c.JS_TRUE;
 }
 
+fn enableState(cap: u32) ?bool {
+    return switch (cap) {
+        GL_DEPTH_TEST => g_gl_state.enabled_depth_test,
+        GL_STENCIL_TEST => g_gl_state.enabled_stencil_test,
+        GL_BLEND => g_gl_state.enabled_blend,
+        GL_CULL_FACE => g_gl_state.enabled_cull_face,
+        GL_POLYGON_OFFSET_FILL => g_gl_state.enabled_polygon_offset,
+        GL_SCISSOR_TEST => g_gl_state.enabled_scissor_test,
+        GL_SAMPLE_ALPHA_TO_COVERAGE => g_gl_state.enabled_sample_alpha_to_coverage,
+        else => null,
+    };
+}
+
+/// True if `cap` is a tracked capability already in the `enabled` state.
+fn enableUnchanged(cap: u32, enabled: bool) bool {
+    const current = enableState(cap) orelse return false;
+    return current == enabled;
+}
+
 fn setEnableState(cap: u32, enabled: bool) void {
     switch (cap) {
         GL_DEPTH_TEST => g_gl_state.enabled_depth_test = enabled,
@@ -2006,79 +4796,31 @@ fn applyStencilFaceU8(face: u32, front: *u8, back: *u8, value: u8) void {
     }
 }
 
-fn allocFramebufferId() ?u32 {
-    var idx: usize = @intCast((g_next_framebuffer_id - 1) % MaxFramebuffers);
-    var tried: usize = 0;
-    while (tried < MaxFramebuffers) : (tried += 1) {
-        if (!g_framebuffer_live[idx]) {
-            g_framebuffer_live[idx] = true;
-            g_next_framebuffer_id = @intCast(idx + 2);
-            return @intCast(idx + 1);
-        }
-        idx = (idx + 1) % MaxFramebuffers;
-    }
-    return null;
-}
-
-fn isFramebufferId(id: u32) bool {
-    if (id == 0 or id > MaxFramebuffers) return false;
-    return g_framebuffer_live[id - 1];
-}
-
-fn freeFramebufferId(id: u32) bool {
-    if (!isFramebufferId(id)) return false;
-    g_framebuffer_live[id - 1] = false;
-    return true;
-}
-
-fn allocRenderbufferId() ?u32 {
-    var idx: usize = @intCast((g_next_renderbuffer_id - 1) % MaxRenderbuffers);
-    var tried: usize = 0;
-    while (tried < MaxRenderbuffers) : (tried += 1) {
-        if (!g_renderbuffer_live[idx]) {
-            g_renderbuffer_live[idx] = true;
-            g_next_renderbuffer_id = @intCast(idx + 2);
-            return @intCast(idx + 1);
-        }
-        idx = (idx + 1) % MaxRenderbuffers;
-    }
-    return null;
-}
-
-fn isRenderbufferId(id: u32) bool {
-    if (id == 0 or id > MaxRenderbuffers) return false;
-    return g_renderbuffer_live[id - 1];
-}
-
-fn freeRenderbufferId(id: u32) bool {
-    if (!isRenderbufferId(id)) return false;
-    g_renderbuffer_live[id - 1] = false;
-    return true;
-}
-
-fn allocVaoId() ?u32 {
-    var idx: usize = @intCast((g_next_vao_id - 1) % MaxVertexArrays);
-    var tried: usize = 0;
-    while (tried < MaxVertexArrays) : (tried += 1) {
-        if (!g_vao_live[idx]) {
-            g_vao_live[idx] = true;
-            g_next_vao_id = @intCast(idx + 2);
-            return @intCast(idx + 1);
-        }
-        idx = (idx + 1) % MaxVertexArrays;
-    }
-    return null;
+/// WebGL framebuffer target to the bindings it names.
+fn framebufferBinding(target: u32) ?webgl_framebuffer.Binding {
+    return switch (target) {
+        GL_FRAMEBUFFER => .both,
+        GL_DRAW_FRAMEBUFFER => .draw,
+        GL_READ_FRAMEBUFFER => .read,
+        else => null,
+    };
 }
 
-fn isVaoId(id: u32) bool {
-    if (id == 0 or id > MaxVertexArrays) return false;
-    return g_vao_live[id - 1];
+fn framebufferAttachmentPoint(attachment: u32) ?webgl_framebuffer.AttachmentPoint {
+    return switch (attachment) {
+        GL_COLOR_ATTACHMENT0 => .color0,
+        GL_DEPTH_ATTACHMENT => .depth,
+        GL_STENCIL_ATTACHMENT => .stencil,
+        GL_DEPTH_STENCIL_ATTACHMENT => .depth_stencil,
+        else => null,
+    };
 }
 
-fn freeVaoId(id: u32) bool {
-    if (!isVaoId(id)) return false;
-    g_vao_live[id - 1] = false;
-    return true;
+/// Optional object handle argument: null and undefined are 0.
+fn handleArg(ctx: *c.JSContext, value: c.JSValue, out: *u32) bool {
+    out.* = 0;
+    if (c.JS_IsNull(value) != 0 or c.JS_IsUndefined(value) != 0) return true;
+    return c.JS_ToUint32(ctx, out, value) == 0;
 }
 
 fn uniformTypeToGlEnum(utype: webgl_program.UniformType) u32 {
@@ -2099,7 +4841,11 @@ fn uniformTypeToGlEnum(utype: webgl_program.UniformType) u32 {
 }
 
 fn samplerKindToGlEnum(kind: u8) u32 {
-    return if (kind == 1) GL_SAMPLER_CUBE else GL_SAMPLER_2D;
+    return switch (kind) {
+        1 => GL_SAMPLER_CUBE,
+        2 => GL_SAMPLER_2D_SHADOW,
+        else => GL_SAMPLER_2D,
+    };
 }
 
 export fn js_gl_getParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
@@ -2129,6 +4875,11 @@ export fn js_gl_getParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
         GL_MAX_CUBE_MAP_TEXTURE_SIZE => return c.JS_NewInt32(ctx, 4096),
         GL_MAX_VERTEX_UNIFORM_VECTORS => return c.JS_NewInt32(ctx, 128),
         GL_MAX_FRAGMENT_UNIFORM_VECTORS => return c.JS_NewInt32(ctx, 128),
+        GL_MAX_VERTEX_UNIFORM_BLOCKS, GL_MAX_FRAGMENT_UNIFORM_BLOCKS, GL_MAX_COMBINED_UNIFORM_BLOCKS => return c.JS_NewUint32(ctx, webgl_program.MaxUniformBufferBlocks),
+        GL_MAX_UNIFORM_BUFFER_BINDINGS => return c.JS_NewUint32(ctx, webgl_state.MaxUniformBufferBindings),
+        // The GL 3.3 minimum; Three.js sizes UniformsGroup arrays from it
+        GL_MAX_UNIFORM_BLOCK_SIZE => return c.JS_NewInt32(ctx, 16384),
+        GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT => return c.JS_NewUint32(ctx, gl_uniforms.uniformBufferOffsetAlignment()),
         GL_MAX_VARYING_VECTORS => return c.JS_NewInt32(ctx, 8),
         GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS => return c.JS_NewInt32(ctx, 8),
         GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS => return c.JS_NewInt32(ctx, 8),
@@ -2137,8 +4888,8 @@ export fn js_gl_getParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
         GL_MAX_VIEWPORT_DIMS => return jsArray2(ctx, 4096, 4096),
         GL_VIEWPORT => return jsArray4(ctx, g_gl_state.viewport[0], g_gl_state.viewport[1], g_gl_state.viewport[2], g_gl_state.viewport[3]),
         GL_SCISSOR_BOX => return jsArray4(ctx, g_gl_state.scissor[0], g_gl_state.scissor[1], g_gl_state.scissor[2], g_gl_state.scissor[3]),
-        GL_SAMPLES => return c.JS_NewInt32(ctx, 1),
-        GL_MAX_SAMPLES => return c.JS_NewInt32(ctx, 1),
+        GL_SAMPLES => return c.JS_NewUint32(ctx, webgl_framebuffer.samples(.draw)),
+        GL_MAX_SAMPLES => return c.JS_NewUint32(ctx, webgl_framebuffer.MaxSamples),
         GL_IMPLEMENTATION_COLOR_READ_FORMAT => return c.JS_NewInt32(ctx, @intCast(GL_RGBA)),
         GL_IMPLEMENTATION_COLOR_READ_TYPE => return c.JS_NewInt32(ctx, @intCast(GL_UNSIGNED_BYTE)),
         GL_UNPACK_ALIGNMENT => return c.JS_NewInt32(ctx, g_gl_state.unpack_alignment),
@@ -2169,17 +4920,174 @@ export fn js_gl_getParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
         GL_POLYGON_OFFSET_FILL => return if (g_gl_state.enabled_polygon_offset) c.JS_TRUE else c.JS_FALSE,
         GL_SCISSOR_TEST => return if (g_gl_state.enabled_scissor_test) c.JS_TRUE else c.JS_FALSE,
         GL_SAMPLE_ALPHA_TO_COVERAGE => return if (g_gl_state.enabled_sample_alpha_to_coverage) c.JS_TRUE else c.JS_FALSE,
+        // GL has no disjoint operations to report
+        GL_GPU_DISJOINT_EXT => return c.JS_FALSE,
+        // clientWaitSync never blocks
+        GL_MAX_CLIENT_WAIT_TIMEOUT_WEBGL => return c.JS_NewInt32(ctx, 0),
         else => return c.JS_NULL,
     }
 }
 
-export fn js_gl_getExtension(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    _ = ctx;
+export fn js_gl_getExtension(ctx: *c.JSContext, this_val: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_NULL;
+    var len: usize = 0;
+    var buf: c.JSCStringBuf = undefined;
+    const c_str = c.JS_ToCStringLen(ctx, &len, argv[0], &buf);
+    if (c_str == null) return c.JS_NULL;
+    const name = @as([*]const u8, @ptrCast(c_str))[0..len];
+
+    // linkProgram() translates on worker threads; COMPLETION_STATUS_KHR
+    // polls it without blocking.
+    if (std.mem.eql(u8, name, "KHR_parallel_shader_compile")) {
+        const ext = c.JS_NewObject(ctx);
+        _ = c.JS_SetPropertyStr(ctx, ext, "COMPLETION_STATUS_KHR", c.JS_NewUint32(ctx, GL_COMPLETION_STATUS_KHR));
+        return ext;
+    }
+    // WebGL1 spelling of the core instancing entry points
+    if (std.mem.eql(u8, name, "ANGLE_instanced_arrays")) {
+        var ref: c.JSGCRef = undefined;
+        const obj = c.JS_PushGCRef(ctx, &ref);
+        obj.* = c.JS_NewObject(ctx);
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "VERTEX_ATTRIB_ARRAY_DIVISOR_ANGLE", c.JS_NewUint32(ctx, GL_VERTEX_ATTRIB_ARRAY_DIVISOR));
+        for (angle_instanced_arrays_methods) |method| {
+            _ = c.JS_SetPropertyStr(ctx, obj.*, method.alias.ptr, c.JS_GetPropertyStr(ctx, this_val.*, method.name.ptr));
+        }
+        return c.JS_PopGCRef(ctx, &ref);
+    }
+    // Timer queries, flushed with the draws they wrap
+    if (std.mem.eql(u8, name, "EXT_disjoint_timer_query_webgl2")) {
+        var ref: c.JSGCRef = undefined;
+        const obj = c.JS_PushGCRef(ctx, &ref);
+        obj.* = c.JS_NewObject(ctx);
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "QUERY_COUNTER_BITS_EXT", c.JS_NewUint32(ctx, GL_QUERY_COUNTER_BITS_EXT));
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "TIME_ELAPSED_EXT", c.JS_NewUint32(ctx, GL_TIME_ELAPSED_EXT));
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "TIMESTAMP_EXT", c.JS_NewUint32(ctx, GL_TIMESTAMP_EXT));
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "GPU_DISJOINT_EXT", c.JS_NewUint32(ctx, GL_GPU_DISJOINT_EXT));
+        _ = c.JS_SetPropertyStr(ctx, obj.*, "queryCounterEXT", c.JS_GetPropertyStr(ctx, this_val.*, "__queryCounter"));
+        return c.JS_PopGCRef(ctx, &ref);
+    }
+    // BatchedMesh draws; one command per multi-draw
+    if (std.mem.eql(u8, name, "WEBGL_multi_draw")) {
+        var ref: c.JSGCRef = undefined;
+        const obj = c.JS_PushGCRef(ctx, &ref);
+        obj.* = c.JS_NewObject(ctx);
+        for (webgl_multi_draw_methods) |method| {
+            _ = c.JS_SetPropertyStr(ctx, obj.*, method.alias.ptr, c.JS_GetPropertyStr(ctx, this_val.*, method.name.ptr));
+        }
+        return c.JS_PopGCRef(ctx, &ref);
+    }
+    for (&compressed_extensions) |*ext| {
+        if (!std.mem.eql(u8, name, ext.name)) continue;
+        if (!ext.isSupported()) return c.JS_NULL;
+        var ref: c.JSGCRef = undefined;
+        const obj = c.JS_PushGCRef(ctx, &ref);
+        obj.* = c.JS_NewObject(ctx);
+        for (ext.formats) |f| {
+            _ = c.JS_SetPropertyStr(ctx, obj.*, f.name.ptr, c.JS_NewUint32(ctx, @intFromEnum(f.format)));
+        }
+        return c.JS_PopGCRef(ctx, &ref);
+    }
     return c.JS_NULL;
 }
 
 export fn js_gl_getSupportedExtensions(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    return c.JS_NewArray(ctx, 0);
+    var ref: c.JSGCRef = undefined;
+    const arr = c.JS_PushGCRef(ctx, &ref);
+    arr.* = c.JS_NewArray(ctx, 0);
+    var count: u32 = 0;
+    _ = c.JS_SetPropertyUint32(ctx, arr.*, count, c.JS_NewString(ctx, "ANGLE_instanced_arrays"));
+    count += 1;
+    _ = c.JS_SetPropertyUint32(ctx, arr.*, count, c.JS_NewString(ctx, "EXT_disjoint_timer_query_webgl2"));
+    count += 1;
+    _ = c.JS_SetPropertyUint32(ctx, arr.*, count, c.JS_NewString(ctx, "WEBGL_multi_draw"));
+    count += 1;
+    for (&compressed_extensions) |*ext| {
+        if (!ext.isSupported()) continue;
+        const name = c.JS_NewString(ctx, ext.name.ptr);
+        _ = c.JS_SetPropertyUint32(ctx, arr.*, count, name);
+        count += 1;
+    }
+    return c.JS_PopGCRef(ctx, &ref);
+}
+
+const ExtensionMethod = struct {
+    alias: [:0]const u8,
+    name: [:0]const u8,
+};
+
+const angle_instanced_arrays_methods = [_]ExtensionMethod{
+    .{ .alias = "drawArraysInstancedANGLE", .name = "drawArraysInstanced" },
+    .{ .alias = "drawElementsInstancedANGLE", .name = "drawElementsInstanced" },
+    .{ .alias = "vertexAttribDivisorANGLE", .name = "vertexAttribDivisor" },
+};
+
+const webgl_multi_draw_methods = [_]ExtensionMethod{
+    .{ .alias = "multiDrawArraysWEBGL", .name = "__multiDrawArrays" },
+    .{ .alias = "multiDrawElementsWEBGL", .name = "__multiDrawElements" },
+    .{ .alias = "multiDrawArraysInstancedWEBGL", .name = "__multiDrawArraysInstanced" },
+    .{ .alias = "multiDrawElementsInstancedWEBGL", .name = "__multiDrawElementsInstanced" },
+};
+
+const CompressedFormatName = struct {
+    name: [:0]const u8,
+    format: webgl_texture.TextureFormat,
+};
+
+const CompressedExtension = struct {
+    name: [:0]const u8,
+    formats: []const CompressedFormatName,
+
+    /// Advertised only when the GPU can sample every format it names.
+    fn isSupported(self: *const CompressedExtension) bool {
+        for (self.formats) |f| {
+            if (!webgl_backend.supportsTextureFormat(f.format)) return false;
+        }
+        return true;
+    }
+};
+
+const compressed_extensions = [_]CompressedExtension{
+    .{ .name = "WEBGL_compressed_texture_s3tc", .formats = &.{
+        .{ .name = "COMPRESSED_RGB_S3TC_DXT1_EXT", .format = .bc1_rgb },
+        .{ .name = "COMPRESSED_RGBA_S3TC_DXT1_EXT", .format = .bc1_rgba },
+        .{ .name = "COMPRESSED_RGBA_S3TC_DXT3_EXT", .format = .bc2_rgba },
+        .{ .name = "COMPRESSED_RGBA_S3TC_DXT5_EXT", .format = .bc3_rgba },
+    } },
+    .{ .name = "EXT_texture_compression_rgtc", .formats = &.{
+        .{ .name = "COMPRESSED_RED_RGTC1_EXT", .format = .bc4_r },
+        .{ .name = "COMPRESSED_SIGNED_RED_RGTC1_EXT", .format = .bc4_r_snorm },
+        .{ .name = "COMPRESSED_RED_GREEN_RGTC2_EXT", .format = .bc5_rg },
+        .{ .name = "COMPRESSED_SIGNED_RED_GREEN_RGTC2_EXT", .format = .bc5_rg_snorm },
+    } },
+    .{ .name = "EXT_texture_compression_bptc", .formats = &.{
+        .{ .name = "COMPRESSED_RGBA_BPTC_UNORM_EXT", .format = .bc7_rgba },
+        .{ .name = "COMPRESSED_SRGB_ALPHA_BPTC_UNORM_EXT", .format = .bc7_srgba },
+        .{ .name = "COMPRESSED_RGB_BPTC_SIGNED_FLOAT_EXT", .format = .bc6h_rgb_float },
+        .{ .name = "COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_EXT", .format = .bc6h_rgb_ufloat },
+    } },
+    // SRGB8_PUNCHTHROUGH_ALPHA1_ETC2 has no backend format and is left out
+    .{ .name = "WEBGL_compressed_texture_etc", .formats = &.{
+        .{ .name = "COMPRESSED_R11_EAC", .format = .eac_r11 },
+        .{ .name = "COMPRESSED_SIGNED_R11_EAC", .format = .eac_r11_snorm },
+        .{ .name = "COMPRESSED_RG11_EAC", .format = .eac_rg11 },
+        .{ .name = "COMPRESSED_SIGNED_RG11_EAC", .format = .eac_rg11_snorm },
+        .{ .name = "COMPRESSED_RGB8_ETC2", .format = .etc2_rgb8 },
+        .{ .name = "COMPRESSED_SRGB8_ETC2", .format = .etc2_srgb8 },
+        .{ .name = "COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2", .format = .etc2_rgb8a1 },
+        .{ .name = "COMPRESSED_RGBA8_ETC2_EAC", .format = .etc2_rgba8 },
+        .{ .name = "COMPRESSED_SRGB8_ALPHA8_ETC2_EAC", .format = .etc2_srgb8a8 },
+    } },
+    // Only the 4x4 block footprint has a backend format
+    .{ .name = "WEBGL_compressed_texture_astc", .formats = &.{
+        .{ .name = "COMPRESSED_RGBA_ASTC_4x4_KHR", .format = .astc_4x4_rgba },
+        .{ .name = "COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR", .format = .astc_4x4_srgba },
+    } },
+};
+
+fn parseCompressedFormat(raw: u32) ?webgl_texture.TextureFormat {
+    const format = std.meta.intToEnum(webgl_texture.TextureFormat, raw) catch return null;
+    if (!webgl_texture.isCompressed(format)) return null;
+    return format;
 }
 
 export fn js_gl_getContextAttributes(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
@@ -2187,7 +5095,7 @@ export fn js_gl_getContextAttributes(ctx: *c.JSContext, _: *c.JSValue, _: c_int,
     _ = c.JS_SetPropertyStr(ctx, obj, "alpha", c.JS_TRUE);
     _ = c.JS_SetPropertyStr(ctx, obj, "depth", c.JS_TRUE);
     _ = c.JS_SetPropertyStr(ctx, obj, "stencil", c.JS_FALSE);
-    _ = c.JS_SetPropertyStr(ctx, obj, "antialias", c.JS_FALSE);
+    _ = c.JS_SetPropertyStr(ctx, obj, "antialias", jsBool(webgl_framebuffer.swapchainSamples() > 1));
     _ = c.JS_SetPropertyStr(ctx, obj, "premultipliedAlpha", c.JS_TRUE);
     _ = c.JS_SetPropertyStr(ctx, obj, "preserveDrawingBuffer", c.JS_FALSE);
     return obj;
@@ -2294,11 +5202,7 @@ export fn js_gl_activeTexture(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, arg
     if (argc < 1) return c.JS_UNDEFINED;
     var unit: u32 = 0;
     if (c.JS_ToUint32(ctx, &unit, argv[0]) != 0) return c.JS_EXCEPTION;
-    if (unit < GL_TEXTURE0) return c.JS_UNDEFINED;
-    const idx = unit - GL_TEXTURE0;
-    const mgr = webgl_texture.globalTextureManager();
-    mgr.activeTexture(idx) catch return c.JS_UNDEFINED;
-    g_gl_state.active_texture_unit = idx;
+    glActiveTexture(unit);
     return c.JS_UNDEFINED;
 }
 
@@ -2332,31 +5236,8 @@ export fn js_gl_bindTexture(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     var target: u32 = 0;
     if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
     var raw: u32 = 0;
-    if (c.JS_IsNull(argv[1]) == 0 and c.JS_IsUndefined(argv[1]) == 0) {
-        if (c.JS_ToUint32(ctx, &raw, argv[1]) != 0) return c.JS_EXCEPTION;
-    }
-
-    const mgr = webgl_texture.globalTextureManager();
-    const tex_target: webgl_texture.TextureTarget = switch (target) {
-        GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D => .texture_2d,
-        GL_TEXTURE_CUBE_MAP => .texture_cube_map,
-        else => return c.JS_UNDEFINED,
-    };
-
-    const tex_id: ?webgl_texture.TextureId = if (raw == 0) null else webgl_texture.TextureId.fromU32(raw);
-    mgr.bindTexture(tex_target, tex_id) catch |err| {
-        return switch (err) {
-            error.InvalidHandle => throwTypeError(ctx, "invalid texture handle"),
-        };
-    };
-
-    // Keep g_gl_state in sync for compatibility
-    const unit = g_gl_state.active_texture_unit;
-    switch (target) {
-        GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D => g_gl_state.bound_textures_2d[unit] = raw,
-        GL_TEXTURE_CUBE_MAP => g_gl_state.bound_textures_cube[unit] = raw,
-        else => {},
-    }
+    if (!handleArg(ctx, argv[1], &raw)) return c.JS_EXCEPTION;
+    glBindTexture(target, raw) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
@@ -2382,7 +5263,7 @@ export fn js_gl_texParameteri(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, arg
             error.NoTextureBound, error.InvalidHandle => c.JS_UNDEFINED,
         };
     };
-    log.info("texParameteri: pname={x} param={x}", .{ pname, param });
+    log.debug("texParameteri: pname={x} param={x}", .{ pname, param });
     return c.JS_UNDEFINED;
 }
 
@@ -2399,8 +5280,7 @@ export fn js_gl_texImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     if (c.JS_ToInt32(ctx, &level, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToUint32(ctx, &internal_format, argv[2]) != 0) return c.JS_EXCEPTION;
 
-    // Only support level 0 for now (no mipmaps)
-    if (level != 0) return c.JS_UNDEFINED;
+    if (level < 0) return c.JS_UNDEFINED;
 
     const mgr = webgl_texture.globalTextureManager();
     const tex_target: webgl_texture.TextureTarget = switch (target) {
@@ -2427,6 +5307,8 @@ export fn js_gl_texImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
             0x190A => .luminance_alpha,
             0x1909 => .luminance,
             0x1906 => .alpha,
+            GL_DEPTH_COMPONENT => .depth_component,
+            GL_DEPTH_STENCIL => .depth_stencil,
             else => .rgba,
         };
 
@@ -2444,8 +5326,9 @@ export fn js_gl_texImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
             }
         }
 
-        log.info("texImage2D(9-arg): {d}x{d} internal_format={x} format={x} pixels={any}", .{ width, height, internal_format, format, pixels != null });
-        mgr.texImage2D(tex_target, width, height, tex_format, internal_format, pixel_type, pixels) catch {};
+        log.debug("texImage2D(9-arg): level={d} {d}x{d} internal_format={x} format={x} pixels={any}", .{ level, width, height, internal_format, format, pixels != null });
+        const unpacked = unpackPixels(pixels, width, height, tex_format, pixel_type, true);
+        texImage(mgr, tex_target, @intCast(level), width, height, unpacked.format, internal_format, pixel_type, unpacked.data);
     } else {
         // 6-argument form: texImage2D(target, level, internalformat, format, type, source)
         log.debug("texImage2D: 6-arg form, argc={d}", .{argc});
@@ -2488,7 +5371,8 @@ export fn js_gl_texImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
             };
 
             log.debug("texImage2D(Image): {d}x{d} format={x}", .{ native_img.width, native_img.height, format });
-            mgr.texImage2D(tex_target, native_img.width, native_img.height, tex_format, internal_format, pixel_type, pixels) catch {};
+            const unpacked = unpackPixels(pixels, native_img.width, native_img.height, tex_format, pixel_type, !isImageBitmap(ctx, source));
+            texImage(mgr, tex_target, @intCast(level), native_img.width, native_img.height, unpacked.format, internal_format, pixel_type, unpacked.data);
         } else {
             return throwTypeError(ctx, "texImage2D: source must be an Image object");
         }
@@ -2497,6 +5381,85 @@ export fn js_gl_texImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     return c.JS_UNDEFINED;
 }
 
+/// Source texels in the layout the texture table stores.
+const UnpackedPixels = struct {
+    data: ?[]const u8,
+    format: webgl_texture.TextureFormat,
+};
+
+/// Conversion scratch, kept between uploads up to MaxRetainedUnpackBytes.
+var g_unpack_scratch: std.ArrayListUnmanaged(u8) = .empty;
+const MaxRetainedUnpackBytes: usize = 16 * 1024 * 1024;
+
+/// Apply the pixel type and UNPACK_* state to upload data: 16-bit packed
+/// types expand to RGBA8, then UNPACK_FLIP_Y_WEBGL reverses the rows and
+/// UNPACK_PREMULTIPLY_ALPHA_WEBGL scales color by alpha. Data that needs
+/// none of these is returned as-is. ImageBitmaps pass
+/// `apply_unpack_state = false`, since WebGL ignores the flags for them.
+/// The result is only valid until the next call.
+fn unpackPixels(
+    pixels: ?[]const u8,
+    width: u32,
+    height: u32,
+    format: webgl_texture.TextureFormat,
+    pixel_type: u32,
+    apply_unpack_state: bool,
+) UnpackedPixels {
+    const unchanged = UnpackedPixels{ .data = pixels, .format = format };
+    const src = pixels orelse return unchanged;
+    const packed_type = pixel_type == GL_UNSIGNED_SHORT_5_6_5 or pixel_type == GL_UNSIGNED_SHORT_4_4_4_4;
+    const out_format: webgl_texture.TextureFormat = if (packed_type) .rgba else format;
+    const flip = apply_unpack_state and g_gl_state.unpack_flip_y and height > 1;
+    const premultiply = apply_unpack_state and g_gl_state.unpack_premultiply_alpha and
+        out_format == .rgba and pixel_type != GL_UNSIGNED_SHORT_5_6_5;
+    if (!packed_type and !flip and !premultiply) return unchanged;
+
+    const pixel_count = @as(usize, width) * height;
+    const row_bytes = @as(usize, width) * webgl_texture.bytesPerPixel(out_format);
+    const src_len = if (packed_type) pixel_count * 2 else row_bytes * height;
+    // Short data is left for the texture table to reject
+    if (src.len < src_len or row_bytes == 0) return unchanged;
+
+    if (g_unpack_scratch.capacity > MaxRetainedUnpackBytes and g_unpack_scratch.capacity > row_bytes * height) {
+        g_unpack_scratch.clearAndFree(std.heap.page_allocator);
+    }
+    g_unpack_scratch.resize(std.heap.page_allocator, row_bytes * height) catch return unchanged;
+    const out = g_unpack_scratch.items;
+    switch (pixel_type) {
+        GL_UNSIGNED_SHORT_5_6_5 => pixel_kernels.unpackRgb565(out, src, pixel_count),
+        GL_UNSIGNED_SHORT_4_4_4_4 => pixel_kernels.unpackRgba4444(out, src, pixel_count),
+        else => @memcpy(out, src[0..out.len]),
+    }
+    if (flip) pixel_kernels.flipRows(out, row_bytes, height);
+    if (premultiply) pixel_kernels.premultiplyAlpha(out);
+    return .{ .data = out, .format = out_format };
+}
+
+fn isImageBitmap(ctx: *c.JSContext, source: c.JSValue) bool {
+    const flag = c.JS_GetPropertyStr(ctx, source, "_isImageBitmap");
+    return flag == c.JS_TRUE;
+}
+
+fn texImage(
+    mgr: *webgl_texture.TextureManager,
+    target: webgl_texture.TextureTarget,
+    level: u32,
+    width: u32,
+    height: u32,
+    format: webgl_texture.TextureFormat,
+    internal_format: u32,
+    pixel_type: u32,
+    pixels: ?[]const u8,
+) void {
+    if (level == 0) {
+        mgr.texImage2D(target, width, height, format, internal_format, pixel_type, pixels) catch {};
+        return;
+    }
+    mgr.texImageLevel(target, level, width, height, format, pixels) catch |err| {
+        log.warn("texImage2D level {d}: {s}", .{ level, @errorName(err) });
+    };
+}
+
 /// texStorage2D(target, levels, internalformat, width, height)
 /// Allocates immutable storage for a texture
 export fn js_gl_texStorage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
@@ -2513,7 +5476,7 @@ export fn js_gl_texStorage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
     if (c.JS_ToUint32(ctx, &width, argv[3]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToUint32(ctx, &height, argv[4]) != 0) return c.JS_EXCEPTION;
 
-    log.info("texStorage2D: target={x} levels={d} format={x} size={d}x{d}", .{ target, levels, internal_format, width, height });
+    log.debug("texStorage2D: target={x} levels={d} format={x} size={d}x{d}", .{ target, levels, internal_format, width, height });
 
     const mgr = webgl_texture.globalTextureManager();
     const tex_target: webgl_texture.TextureTarget = switch (target) {
@@ -2521,6 +5484,16 @@ export fn js_gl_texStorage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
         else => return c.JS_UNDEFINED,
     };
 
+    // Compressed storage is filled later by compressedTexSubImage2D
+    if (parseCompressedFormat(internal_format)) |format| {
+        mgr.compressedTexImage2D(tex_target, width, height, format, null) catch |err| {
+            log.warn("texStorage2D: {s}", .{@errorName(err)});
+            return c.JS_UNDEFINED;
+        };
+        allocateStorageLevels(mgr, tex_target, levels);
+        return c.JS_UNDEFINED;
+    }
+
     // Allocate storage by calling texImage2D with null data
     // This reserves space in the CPU pool for later texSubImage2D calls
     const tex_format: webgl_texture.TextureFormat = switch (internal_format) {
@@ -2528,13 +5501,114 @@ export fn js_gl_texStorage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
         0x8051 => .rgb, // GL_RGB8
         0x1908 => .rgba, // GL_RGBA
         0x1907 => .rgb, // GL_RGB
+        0x81A5, 0x81A6, 0x8CAC => .depth_component, // GL_DEPTH_COMPONENT16/24/32F
+        0x88F0, 0x8CAD => .depth_stencil, // GL_DEPTH24_STENCIL8, GL_DEPTH32F_STENCIL8
         else => .rgba,
     };
 
-    mgr.texImage2D(tex_target, width, height, tex_format, internal_format, 0x1401, null) catch {};
+    mgr.texImage2D(tex_target, width, height, tex_format, internal_format, 0x1401, null) catch return c.JS_UNDEFINED;
+    allocateStorageLevels(mgr, tex_target, levels);
     return c.JS_UNDEFINED;
 }
 
+fn allocateStorageLevels(mgr: *webgl_texture.TextureManager, target: webgl_texture.TextureTarget, levels: i32) void {
+    if (levels <= 1) return;
+    mgr.allocateLevels(target, @intCast(levels)) catch |err| {
+        log.warn("texStorage2D: {s}", .{@errorName(err)});
+    };
+}
+
+/// compressedTexImage2D(target, level, internalformat, width, height, border, data)
+export fn js_gl_compressedTexImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 7) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var level: i32 = 0;
+    var internal_format: u32 = 0;
+    var width: u32 = 0;
+    var height: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &level, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &internal_format, argv[2]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &width, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &height, argv[4]) != 0) return c.JS_EXCEPTION;
+    if (level < 0 or target != GL_TEXTURE_2D) return c.JS_UNDEFINED;
+
+    const format = parseCompressedFormat(internal_format) orelse {
+        return throwTypeError(ctx, "compressedTexImage2D: unsupported internal format");
+    };
+    const data = borrowArrayBytes(ctx, argv[6]) orelse {
+        return throwTypeError(ctx, "compressedTexImage2D requires an ArrayBufferView");
+    };
+    const mgr = webgl_texture.globalTextureManager();
+    const result = if (level == 0)
+        mgr.compressedTexImage2D(.texture_2d, width, height, format, data)
+    else
+        mgr.texImageLevel(.texture_2d, @intCast(level), width, height, format, data);
+    result catch |err| {
+        log.warn("compressedTexImage2D level {d}: {s}", .{ level, @errorName(err) });
+    };
+    return c.JS_UNDEFINED;
+}
+
+/// compressedTexSubImage2D(target, level, xoffset, yoffset, width, height, format, data)
+export fn js_gl_compressedTexSubImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 8) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var level: i32 = 0;
+    var xoffset: u32 = 0;
+    var yoffset: u32 = 0;
+    var width: u32 = 0;
+    var height: u32 = 0;
+    var raw_format: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &level, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &xoffset, argv[2]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &yoffset, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &width, argv[4]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &height, argv[5]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &raw_format, argv[6]) != 0) return c.JS_EXCEPTION;
+    if (level < 0 or target != GL_TEXTURE_2D) return c.JS_UNDEFINED;
+
+    const format = parseCompressedFormat(raw_format) orelse {
+        return throwTypeError(ctx, "compressedTexSubImage2D: unsupported format");
+    };
+    const data = borrowArrayBytes(ctx, argv[7]) orelse {
+        return throwTypeError(ctx, "compressedTexSubImage2D requires an ArrayBufferView");
+    };
+    const mgr = webgl_texture.globalTextureManager();
+    mgr.compressedTexSubImage2D(.texture_2d, @intCast(level), xoffset, yoffset, width, height, format, data) catch |err| switch (err) {
+        // Without texStorage2D, a full-size origin upload defines the image
+        error.NoStorage => if (level == 0 and xoffset == 0 and yoffset == 0) {
+            mgr.compressedTexImage2D(.texture_2d, width, height, format, data) catch {};
+        },
+        else => log.warn("compressedTexSubImage2D: {s}", .{@errorName(err)}),
+    };
+    return c.JS_UNDEFINED;
+}
+
+fn texSubImage(
+    mgr: *webgl_texture.TextureManager,
+    target: webgl_texture.TextureTarget,
+    level: u32,
+    xoffset: i32,
+    yoffset: i32,
+    width: u32,
+    height: u32,
+    format: webgl_texture.TextureFormat,
+    gl_format: u32,
+    pixel_type: u32,
+    pixels: []const u8,
+) void {
+    if (xoffset < 0 or yoffset < 0) return;
+    mgr.texSubImage2D(target, level, @intCast(xoffset), @intCast(yoffset), width, height, format, pixels) catch |err| switch (err) {
+        // Nothing defined yet: an origin upload defines the whole image
+        error.NoStorage => if (xoffset == 0 and yoffset == 0) {
+            texImage(mgr, target, level, width, height, format, gl_format, pixel_type, pixels);
+        },
+        else => log.warn("texSubImage2D: {s}", .{@errorName(err)}),
+    };
+}
+
 /// texSubImage2D has two forms:
 /// texSubImage2D(target, level, xoffset, yoffset, width, height, format, type, source) - 9 args
 /// texSubImage2D(target, level, xoffset, yoffset, format, type, source) - 7 args (Image source)
@@ -2550,8 +5624,7 @@ export fn js_gl_texSubImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, arg
     if (c.JS_ToInt32(ctx, &xoffset, argv[2]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &yoffset, argv[3]) != 0) return c.JS_EXCEPTION;
 
-    // Only support level 0 for now
-    if (level != 0) return c.JS_UNDEFINED;
+    if (level < 0) return c.JS_UNDEFINED;
 
     const mgr = webgl_texture.globalTextureManager();
     const tex_target: webgl_texture.TextureTarget = switch (target) {
@@ -2580,14 +5653,11 @@ export fn js_gl_texSubImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, arg
                 0x1907 => .rgb,
                 else => .rgba,
             };
-            log.info("texSubImage2D(TypedArray 9-arg): {d}x{d} format={x} len={d}", .{ width, height, format, len });
-            // For subimage, we need to upload the full texture data
-            // For now, treat subimage at (0,0) as a full image upload
-            if (xoffset == 0 and yoffset == 0) {
-                mgr.texImage2D(tex_target, width, height, tex_format, format, pixel_type, pixels) catch {};
-            }
+            log.debug("texSubImage2D(TypedArray 9-arg): {d}x{d} format={x} len={d}", .{ width, height, format, len });
+            const unpacked = unpackPixels(pixels, width, height, tex_format, pixel_type, true);
+            texSubImage(mgr, tex_target, @intCast(level), xoffset, yoffset, width, height, unpacked.format, format, pixel_type, unpacked.data.?);
         } else {
-            log.info("texSubImage2D(9-arg): no typed array data, width={d} height={d}", .{ width, height });
+            log.debug("texSubImage2D(9-arg): no typed array data, width={d} height={d}", .{ width, height });
         }
     } else {
         // 7-arg form with Image source
@@ -2623,12 +5693,10 @@ export fn js_gl_texSubImage2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, arg
                 else => .rgba,
             };
 
-            log.info("texSubImage2D(Image 7-arg): {d}x{d} format={x} len={d}", .{ native_img.width, native_img.height, format, pixels.len });
+            log.debug("texSubImage2D(Image 7-arg): {d}x{d} format={x} len={d}", .{ native_img.width, native_img.height, format, pixels.len });
 
-            // Upload using texImage2D (for offset 0,0 this works)
-            if (xoffset == 0 and yoffset == 0) {
-                mgr.texImage2D(tex_target, native_img.width, native_img.height, tex_format, format, pixel_type, pixels) catch {};
-            }
+            const unpacked = unpackPixels(pixels, native_img.width, native_img.height, tex_format, pixel_type, !isImageBitmap(ctx, source));
+            texSubImage(mgr, tex_target, @intCast(level), xoffset, yoffset, native_img.width, native_img.height, unpacked.format, format, pixel_type, unpacked.data.?);
         }
     }
 
@@ -2643,22 +5711,27 @@ export fn js_gl_texSubImage3D(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_generateMipmap(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+export fn js_gl_generateMipmap(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (target != GL_TEXTURE_2D) return c.JS_UNDEFINED;
+    webgl_texture.globalTextureManager().generateMipmap(.texture_2d) catch |err| {
+        log.warn("generateMipmap: {s}", .{@errorName(err)});
+    };
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_createFramebuffer(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    const id = allocFramebufferId() orelse return c.JS_NULL;
+    const id = webgl_framebuffer.createFramebuffer() catch return c.JS_NULL;
     return c.JS_NewUint32(ctx, id);
 }
 
 export fn js_gl_deleteFramebuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) return c.JS_UNDEFINED;
     var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) return c.JS_EXCEPTION;
-    if (freeFramebufferId(raw) and g_bound_framebuffer == raw) {
-        g_bound_framebuffer = 0;
-    }
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    _ = webgl_framebuffer.deleteFramebuffer(raw);
     return c.JS_UNDEFINED;
 }
 
@@ -2666,38 +5739,66 @@ export fn js_gl_bindFramebuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, a
     if (argc < 2) return c.JS_UNDEFINED;
     var target: u32 = 0;
     if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
-    if (target != GL_FRAMEBUFFER) return c.JS_UNDEFINED;
+    const binding = framebufferBinding(target) orelse return c.JS_UNDEFINED;
     var raw: u32 = 0;
-    if (argv[1] != c.JS_NULL and argv[1] != c.JS_UNDEFINED) {
-        if (c.JS_ToUint32(ctx, &raw, argv[1]) != 0) return c.JS_EXCEPTION;
-    }
-    if (raw != 0 and !isFramebufferId(raw)) {
+    if (!handleArg(ctx, argv[1], &raw)) return c.JS_EXCEPTION;
+    webgl_framebuffer.bindFramebuffer(binding, raw) catch {
         return throwTypeError(ctx, "invalid framebuffer handle");
-    }
-    g_bound_framebuffer = raw;
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_framebufferTexture2D(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+/// framebufferTexture2D(target, attachment, textarget, texture, level).
+/// Only level 0 of TEXTURE_2D textures can be attached.
+export fn js_gl_framebufferTexture2D(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var attachment: u32 = 0;
+    var textarget: u32 = 0;
+    var raw: u32 = 0;
+    var level: i32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &attachment, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &textarget, argv[2]) != 0) return c.JS_EXCEPTION;
+    if (!handleArg(ctx, argv[3], &raw)) return c.JS_EXCEPTION;
+    if (argc >= 5 and c.JS_ToInt32(ctx, &level, argv[4]) != 0) return c.JS_EXCEPTION;
+
+    const binding = framebufferBinding(target) orelse return c.JS_UNDEFINED;
+    const point = framebufferAttachmentPoint(attachment) orelse return c.JS_UNDEFINED;
+    if (raw != 0 and (textarget != GL_TEXTURE_2D or level != 0)) {
+        log.warn("framebufferTexture2D: only level 0 of TEXTURE_2D can be attached (textarget=0x{x} level={d})", .{ textarget, level });
+        return c.JS_UNDEFINED;
+    }
+    const texture: ?webgl_texture.TextureId = if (raw == 0) null else webgl_texture.TextureId.fromU32(raw);
+    webgl_framebuffer.framebufferTexture2D(binding, point, texture) catch |err| {
+        return switch (err) {
+            error.InvalidTexture => throwTypeError(ctx, "invalid texture handle"),
+            else => blk: {
+                log.warn("framebufferTexture2D: {s}", .{@errorName(err)});
+                break :blk c.JS_UNDEFINED;
+            },
+        };
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_checkFramebufferStatus(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    return c.JS_NewUint32(ctx, GL_FRAMEBUFFER_COMPLETE);
+export fn js_gl_checkFramebufferStatus(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    var target: u32 = GL_FRAMEBUFFER;
+    if (argc >= 1 and c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    const binding = framebufferBinding(target) orelse return c.JS_NewUint32(ctx, 0);
+    return c.JS_NewUint32(ctx, @intFromEnum(webgl_framebuffer.checkStatus(binding)));
 }
 
 export fn js_gl_createRenderbuffer(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    const id = allocRenderbufferId() orelse return c.JS_NULL;
+    const id = webgl_framebuffer.createRenderbuffer() catch return c.JS_NULL;
     return c.JS_NewUint32(ctx, id);
 }
 
 export fn js_gl_deleteRenderbuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) return c.JS_UNDEFINED;
     var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) return c.JS_EXCEPTION;
-    if (freeRenderbufferId(raw) and g_bound_renderbuffer == raw) {
-        g_bound_renderbuffer = 0;
-    }
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    _ = webgl_framebuffer.deleteRenderbuffer(raw);
     return c.JS_UNDEFINED;
 }
 
@@ -2707,342 +5808,711 @@ export fn js_gl_bindRenderbuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int,
     if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
     if (target != GL_RENDERBUFFER) return c.JS_UNDEFINED;
     var raw: u32 = 0;
-    if (argv[1] != c.JS_NULL and argv[1] != c.JS_UNDEFINED) {
-        if (c.JS_ToUint32(ctx, &raw, argv[1]) != 0) return c.JS_EXCEPTION;
-    }
-    if (raw != 0 and !isRenderbufferId(raw)) {
+    if (!handleArg(ctx, argv[1], &raw)) return c.JS_EXCEPTION;
+    webgl_framebuffer.bindRenderbuffer(raw) catch {
         return throwTypeError(ctx, "invalid renderbuffer handle");
-    }
-    g_bound_renderbuffer = raw;
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_renderbufferStorage(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+/// renderbufferStorage(target, internalformat, width, height)
+export fn js_gl_renderbufferStorage(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var internal_format: u32 = 0;
+    var width: i32 = 0;
+    var height: i32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &internal_format, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &width, argv[2]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &height, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (target != GL_RENDERBUFFER or width < 0 or height < 0) return c.JS_UNDEFINED;
+    webgl_framebuffer.renderbufferStorage(internal_format, @intCast(width), @intCast(height)) catch |err| {
+        log.warn("renderbufferStorage(0x{x}, {d}x{d}): {s}", .{ internal_format, width, height, @errorName(err) });
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_framebufferRenderbuffer(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+/// renderbufferStorageMultisample(target, samples, internalformat, width, height)
+export fn js_gl_renderbufferStorageMultisample(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 5) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var sample_count: i32 = 0;
+    var internal_format: u32 = 0;
+    var width: i32 = 0;
+    var height: i32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &sample_count, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &internal_format, argv[2]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &width, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToInt32(ctx, &height, argv[4]) != 0) return c.JS_EXCEPTION;
+    if (target != GL_RENDERBUFFER or sample_count < 0 or width < 0 or height < 0) return c.JS_UNDEFINED;
+    webgl_framebuffer.renderbufferStorageMultisample(@intCast(sample_count), internal_format, @intCast(width), @intCast(height)) catch |err| {
+        log.warn("renderbufferStorageMultisample({d}, 0x{x}, {d}x{d}): {s}", .{ sample_count, internal_format, width, height, @errorName(err) });
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_createVertexArray(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    const id = allocVaoId() orelse return c.JS_NULL;
-    return c.JS_NewUint32(ctx, id);
-}
-
-export fn js_gl_deleteVertexArray(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) return c.JS_EXCEPTION;
-    if (freeVaoId(raw) and g_bound_vao == raw) {
-        g_bound_vao = 0;
+/// blitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter)
+/// Only multisample resolves of whole color attachments are supported.
+export fn js_gl_blitFramebuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 9) return c.JS_UNDEFINED;
+    var coords: [8]i32 = undefined;
+    for (&coords, 0..) |*coord, i| {
+        if (c.JS_ToInt32(ctx, coord, argv[i]) != 0) return c.JS_EXCEPTION;
     }
+    var mask: u32 = 0;
+    if (c.JS_ToUint32(ctx, &mask, argv[8]) != 0) return c.JS_EXCEPTION;
+    webgl_draw.blitFramebuffer(coords[0..4].*, coords[4..8].*, mask) catch |err| {
+        log.warn("blitFramebuffer: {s}", .{@errorName(err)});
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_bindVertexArray(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
+/// framebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer)
+export fn js_gl_framebufferRenderbuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var target: u32 = 0;
+    var attachment: u32 = 0;
     var raw: u32 = 0;
-    if (argv[0] != c.JS_NULL and argv[0] != c.JS_UNDEFINED) {
-        if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) return c.JS_EXCEPTION;
-    }
-    if (raw != 0 and !isVaoId(raw)) {
-        return throwTypeError(ctx, "invalid vertex array handle");
-    }
-    g_bound_vao = raw;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &attachment, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (!handleArg(ctx, argv[3], &raw)) return c.JS_EXCEPTION;
+    const binding = framebufferBinding(target) orelse return c.JS_UNDEFINED;
+    const point = framebufferAttachmentPoint(attachment) orelse return c.JS_UNDEFINED;
+    webgl_framebuffer.framebufferRenderbuffer(binding, point, raw) catch |err| {
+        return switch (err) {
+            error.InvalidRenderbuffer => throwTypeError(ctx, "invalid renderbuffer handle"),
+            else => blk: {
+                log.warn("framebufferRenderbuffer: {s}", .{@errorName(err)});
+                break :blk c.JS_UNDEFINED;
+            },
+        };
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_enable(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var cap: u32 = 0;
-    if (c.JS_ToUint32(ctx, &cap, argv[0]) != 0) return c.JS_EXCEPTION;
-    setEnableState(cap, true);
-    switch (cap) {
-        GL_SCISSOR_TEST => webgl_draw.setScissorEnabled(true),
-        GL_DEPTH_TEST => webgl_draw.setDepthTestEnabled(true),
-        GL_STENCIL_TEST => webgl_draw.setStencilEnabled(true),
-        GL_CULL_FACE => webgl_draw.setCullEnabled(true),
-        GL_BLEND => webgl_draw.setBlendEnabled(true),
-        GL_POLYGON_OFFSET_FILL => webgl_draw.setPolygonOffsetEnabled(true),
-        GL_SAMPLE_ALPHA_TO_COVERAGE => webgl_draw.setAlphaToCoverageEnabled(true),
-        else => {},
-    }
-    return c.JS_UNDEFINED;
+// =============================================================================
+// Web Audio
+// =============================================================================
+
+/// Decoded audio handed to JS per tick; the rest stay queued.
+const MaxAudioDecodesPerFrame: usize = 4;
+
+/// An AudioContext waiting on a decodeAudioData job.
+const PendingAudio = struct {
+    active: bool = false,
+    job_id: u32 = 0,
+    target: c.JSGCRef = .{ .val = c.JS_UNDEFINED, .prev = null },
+};
+
+var g_audio_decoder: audio_decode.DecodePool = .{};
+var g_pending_audio: [audio_decode.MaxPending]PendingAudio = [_]PendingAudio{.{}} ** audio_decode.MaxPending;
+
+fn throwAudioError(ctx: *c.JSContext, err: web_audio.Error) c.JSValue {
+    return throwTypeError(ctx, switch (err) {
+        error.NotOpen => "AudioContext is closed",
+        error.InvalidNode => "invalid or finished audio node",
+        error.InvalidBuffer => "invalid AudioBuffer",
+        error.InvalidState => "InvalidStateError: source started twice or never started",
+        error.InvalidArgument => "invalid audio argument",
+        error.AtCapacity => "too many audio nodes or buffers",
+        error.OutOfMemory => "out of memory",
+    });
 }
 
-export fn js_gl_disable(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var cap: u32 = 0;
-    if (c.JS_ToUint32(ctx, &cap, argv[0]) != 0) return c.JS_EXCEPTION;
-    setEnableState(cap, false);
-    switch (cap) {
-        GL_SCISSOR_TEST => webgl_draw.setScissorEnabled(false),
-        GL_DEPTH_TEST => webgl_draw.setDepthTestEnabled(false),
-        GL_STENCIL_TEST => webgl_draw.setStencilEnabled(false),
-        GL_CULL_FACE => webgl_draw.setCullEnabled(false),
-        GL_BLEND => webgl_draw.setBlendEnabled(false),
-        GL_POLYGON_OFFSET_FILL => webgl_draw.setPolygonOffsetEnabled(false),
-        GL_SAMPLE_ALPHA_TO_COVERAGE => webgl_draw.setAlphaToCoverageEnabled(false),
-        else => {},
+/// The first `n` arguments as numbers, missing ones taken from `defaults`.
+/// Null when a conversion threw.
+fn audioArgs(ctx: *c.JSContext, argc: c_int, argv: [*]c.JSValue, comptime n: usize, defaults: [n]f64) ?[n]f64 {
+    var values = defaults;
+    const count = @min(n, @as(usize, @intCast(@max(argc, 0))));
+    for (values[0..count], 0..) |*value, i| {
+        if (c.JS_ToNumber(ctx, value, argv[i]) != 0) return null;
     }
-    return c.JS_UNDEFINED;
+    return values;
 }
 
-export fn js_gl_viewport(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) return c.JS_UNDEFINED;
-    var x: i32 = 0;
-    var y: i32 = 0;
-    var w: i32 = 0;
-    var h: i32 = 0;
-    _ = c.JS_ToInt32(ctx, &x, argv[0]);
-    _ = c.JS_ToInt32(ctx, &y, argv[1]);
-    _ = c.JS_ToInt32(ctx, &w, argv[2]);
-    _ = c.JS_ToInt32(ctx, &h, argv[3]);
-    g_gl_state.viewport = .{ x, y, w, h };
-    webgl_draw.setViewport(x, y, w, h);
-    return c.JS_UNDEFINED;
+/// Node or buffer handle from a JS number; anything else never resolves.
+fn audioHandle(comptime Id: type, value: f64) Id {
+    if (!(value >= 0 and value <= std.math.maxInt(u32))) return @bitCast(@as(u32, 0));
+    return @bitCast(@as(u32, @intFromFloat(value)));
 }
 
-export fn js_gl_clearColor(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) return c.JS_UNDEFINED;
-    var r: f64 = 0;
-    var g: f64 = 0;
-    var b: f64 = 0;
-    var a: f64 = 0;
-    _ = c.JS_ToNumber(ctx, &r, argv[0]);
-    _ = c.JS_ToNumber(ctx, &g, argv[1]);
-    _ = c.JS_ToNumber(ctx, &b, argv[2]);
-    _ = c.JS_ToNumber(ctx, &a, argv[3]);
-    g_gl_state.clear_color = .{ @floatCast(r), @floatCast(g), @floatCast(b), @floatCast(a) };
-    webgl_draw.setClearColor(@floatCast(r), @floatCast(g), @floatCast(b), @floatCast(a));
-    if (getRuntime(ctx)) |rt| {
-        rt.shared.clear_color = .{ @floatCast(r), @floatCast(g), @floatCast(b) };
-    }
-    return c.JS_UNDEFINED;
+/// Enum value from a JS number, as the audio helper code numbers them.
+fn audioEnum(comptime E: type, value: f64) ?E {
+    if (!(value >= 0 and value < std.meta.fields(E).len)) return null;
+    return @enumFromInt(@as(std.meta.Tag(E), @intFromFloat(value)));
 }
 
-export fn js_gl_clear(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var mask: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &mask, argv[0]);
-    webgl_draw.requestClear(mask);
-    return c.JS_UNDEFINED;
+/// Set a number property on a rooted object. The number may be boxed, so
+/// it is made before the object is read.
+fn setAudioNumber(ctx: *c.JSContext, obj: *c.JSValue, name: [:0]const u8, value: anytype) void {
+    const number = c.JS_NewFloat64(ctx, if (@typeInfo(@TypeOf(value)) == .int) @floatFromInt(value) else value);
+    _ = c.JS_SetPropertyStr(ctx, obj.*, name.ptr, number);
 }
 
-export fn js_gl_clearDepth(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: f64 = 1.0;
-    _ = c.JS_ToNumber(ctx, &val, argv[0]);
-    g_gl_state.clear_depth = @floatCast(val);
-    webgl_draw.setClearDepth(@floatCast(val));
+/// __audioInstall(): replace the AudioContext stubs with the real API.
+/// Runs on first use, so pages without audio keep the heap it takes.
+export fn js_audioInstall(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const global = c.JS_GetGlobalObject(ctx);
+    if (c.JS_IsFunction(ctx, c.JS_GetPropertyStr(ctx, global, "__audioEnded")) != 0) return c.JS_UNDEFINED;
+    if (c.JS_Eval(ctx, audio_api_code, audio_api_code.len, "audio_api", 0) == c.JS_EXCEPTION) return c.JS_EXCEPTION;
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_clearStencil(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: i32 = 0;
-    _ = c.JS_ToInt32(ctx, &val, argv[0]);
-    g_gl_state.clear_stencil = val;
-    webgl_draw.setClearStencil(val);
+/// Open (or join) the audio graph for an AudioContext
+/// Called as: __audioOpen() -> { sampleRate, destination, listener, baseLatency, generation }
+export fn js_audioOpen(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const runtime = getRuntime(ctx) orelse return throwInternalError(ctx, "no runtime");
+    const info = web_audio.graph().open(runtime.allocator, web_audio.outputConfig()) catch |err| {
+        return throwAudioError(ctx, err);
+    };
+    var ref: c.JSGCRef = undefined;
+    const obj = c.JS_PushGCRef(ctx, &ref);
+    obj.* = c.JS_NewObject(ctx);
+    setAudioNumber(ctx, obj, "sampleRate", info.sample_rate);
+    setAudioNumber(ctx, obj, "destination", @as(u32, @bitCast(info.destination)));
+    setAudioNumber(ctx, obj, "listener", @as(u32, @bitCast(info.listener)));
+    setAudioNumber(ctx, obj, "baseLatency", info.output_latency);
+    setAudioNumber(ctx, obj, "generation", info.generation);
+    return c.JS_PopGCRef(ctx, &ref);
+}
+
+/// Called as: __audioClose()
+/// The last context to close stops the device and frees every buffer.
+export fn js_audioClose(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    web_audio.graph().close();
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_depthFunc(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &val, argv[0]);
-    g_gl_state.depth_func = val;
-    webgl_draw.setDepthFunc(val);
+/// Called as: __audioSuspend(suspended)
+export fn js_audioSuspend(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    web_audio.graph().setSuspended(argc >= 1 and argv[0] == c.JS_TRUE);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_depthMask(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: i32 = 0;
-    _ = c.JS_ToInt32(ctx, &val, argv[0]);
-    g_gl_state.depth_mask = val != 0;
-    webgl_draw.setDepthMask(val != 0);
+/// Context time in seconds
+/// Called as: __audioTime()
+export fn js_audioTime(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    return c.JS_NewFloat64(ctx, web_audio.graph().currentTime());
+}
+
+/// Called as: __audioCreateNode(kind) -> node
+export fn js_audioCreateNode(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 1, .{-1}) orelse return c.JS_EXCEPTION;
+    const kind = audioEnum(web_audio.NodeKind, args[0]) orelse return throwTypeError(ctx, "__audioCreateNode: unknown node kind");
+    const id = web_audio.graph().createNode(kind) catch |err| return throwAudioError(ctx, err);
+    return c.JS_NewUint32(ctx, @bitCast(id));
+}
+
+/// Node or buffer an __AudioNodeHandle or __AudioBufferHandle stands for,
+/// packed into the object's opaque pointer
+const AudioHandle = packed struct(u64) {
+    id: u32,
+    generation: u32,
+};
+
+/// Construct a handle object whose finalizer drops `id` from the graph.
+fn newAudioHandle(ctx: *c.JSContext, argc: c_int, argv: [*]c.JSValue, class_id: c_int) c.JSValue {
+    if ((argc & c.FRAME_CF_CTOR) == 0) return throwTypeError(ctx, "audio handles must be constructed with new");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc & ~@as(c_int, c.FRAME_CF_CTOR), argv, 1, .{-1}) orelse return c.JS_EXCEPTION;
+    const handle = AudioHandle{
+        .id = @bitCast(audioHandle(web_audio.NodeId, args[0])),
+        .generation = web_audio.graph().generation,
+    };
+    const obj = c.JS_NewObjectClassUser(ctx, class_id);
+    if (c.JS_IsException(obj) != 0) return obj;
+    c.JS_SetOpaque(ctx, obj, @ptrFromInt(@as(usize, @bitCast(handle))));
+    return obj;
+}
+
+fn audioHandleOf(opaque_ptr: ?*anyopaque) AudioHandle {
+    return @bitCast(@as(u64, @intFromPtr(opaque_ptr)));
+}
+
+/// Called as: new __AudioNodeHandle(node)
+export fn js_AudioNodeHandle(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return newAudioHandle(ctx, argc, argv, c.JS_CLASS_AUDIO_NODE_HANDLE);
+}
+
+/// Called as: new __AudioBufferHandle(buffer)
+export fn js_AudioBufferHandle(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return newAudioHandle(ctx, argc, argv, c.JS_CLASS_AUDIO_BUFFER_HANDLE);
+}
+
+/// Runs in the GC, so it only touches the graph, never JS
+export fn js_AudioNodeHandle_finalizer(_: ?*c.JSContext, opaque_ptr: ?*anyopaque) callconv(.c) void {
+    const handle = audioHandleOf(opaque_ptr);
+    web_audio.graph().dropNode(handle.generation, @bitCast(handle.id));
+}
+
+export fn js_AudioBufferHandle_finalizer(_: ?*c.JSContext, opaque_ptr: ?*anyopaque) callconv(.c) void {
+    const handle = audioHandleOf(opaque_ptr);
+    web_audio.graph().dropBuffer(handle.generation, @bitCast(handle.id));
+}
+
+/// Called as: __audioConnect(node, target)
+export fn js_audioConnect(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 2, .{ -1, -1 }) orelse return c.JS_EXCEPTION;
+    web_audio.graph().connect(audioHandle(web_audio.NodeId, args[0]), audioHandle(web_audio.NodeId, args[1])) catch |err| {
+        return throwAudioError(ctx, err);
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_colorMask(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) return c.JS_UNDEFINED;
-    var r: i32 = 0;
-    var g: i32 = 0;
-    var b: i32 = 0;
-    var a: i32 = 0;
-    _ = c.JS_ToInt32(ctx, &r, argv[0]);
-    _ = c.JS_ToInt32(ctx, &g, argv[1]);
-    _ = c.JS_ToInt32(ctx, &b, argv[2]);
-    _ = c.JS_ToInt32(ctx, &a, argv[3]);
-    g_gl_state.color_mask = .{ r != 0, g != 0, b != 0, a != 0 };
-    webgl_draw.setColorMask(r != 0, g != 0, b != 0, a != 0);
+/// Called as: __audioDisconnect(node)
+export fn js_audioDisconnect(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 1, .{-1}) orelse return c.JS_EXCEPTION;
+    // Disconnecting a finished source is harmless
+    web_audio.graph().disconnect(audioHandle(web_audio.NodeId, args[0])) catch {};
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_cullFace(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &val, argv[0]);
-    g_gl_state.cull_face = val;
-    webgl_draw.setCullFace(val);
+/// Schedule an AudioParam change
+/// Called as: __audioParam(node, param, op, value, time, timeConstant)
+export fn js_audioParam(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 6, .{ -1, -1, -1, 0, 0, 0 }) orelse return c.JS_EXCEPTION;
+    const param = audioEnum(web_audio.Param, args[1]) orelse return throwTypeError(ctx, "__audioParam: unknown param");
+    const op = audioEnum(web_audio.ParamOp, args[2]) orelse return throwTypeError(ctx, "__audioParam: unknown op");
+    if (!std.math.isFinite(args[3]) or !std.math.isFinite(args[4]) or !std.math.isFinite(args[5])) {
+        return throwTypeError(ctx, "__audioParam: non-finite value");
+    }
+    const node = audioHandle(web_audio.NodeId, args[0]);
+    web_audio.graph().setParam(node, param, op, @floatCast(args[3]), args[4], args[5]) catch |err| switch (err) {
+        // Sources are released once they end; their params stop mattering
+        error.InvalidNode => {},
+        else => return throwAudioError(ctx, err),
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_frontFace(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var val: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &val, argv[0]);
-    g_gl_state.front_face = val;
-    webgl_draw.setFrontFace(val);
+/// Called as: __audioParamValue(node, param) -> value after the last quantum
+export fn js_audioParamValue(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 2, .{ -1, -1 }) orelse return c.JS_EXCEPTION;
+    const param = audioEnum(web_audio.Param, args[1]) orelse return throwTypeError(ctx, "__audioParamValue: unknown param");
+    const value = web_audio.graph().paramValue(audioHandle(web_audio.NodeId, args[0]), param) catch |err| {
+        return throwAudioError(ctx, err);
+    };
+    return c.JS_NewFloat64(ctx, value);
+}
+
+/// Set a node attribute that is not an AudioParam (loop, panner model)
+/// Called as: __audioConfig(node, field, value)
+export fn js_audioConfig(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 3, .{ -1, -1, 0 }) orelse return c.JS_EXCEPTION;
+    const field = audioEnum(web_audio.Config, args[1]) orelse return throwTypeError(ctx, "__audioConfig: unknown field");
+    if (std.math.isNan(args[2])) return throwTypeError(ctx, "__audioConfig: value is NaN");
+    web_audio.graph().setConfig(audioHandle(web_audio.NodeId, args[0]), field, args[2]) catch |err| switch (err) {
+        error.InvalidNode => {},
+        else => return throwAudioError(ctx, err),
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_blendFunc(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return c.JS_UNDEFINED;
-    var src: u32 = 0;
-    var dst: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &src, argv[0]);
-    _ = c.JS_ToUint32(ctx, &dst, argv[1]);
-    g_gl_state.blend_src = src;
-    g_gl_state.blend_dst = dst;
-    g_gl_state.blend_src_alpha = src;
-    g_gl_state.blend_dst_alpha = dst;
-    webgl_draw.setBlendFunc(src, dst);
+/// Called as: __audioStart(node, buffer, when, offset, duration)
+/// `buffer` 0 plays silence; a negative duration plays to the end.
+export fn js_audioStart(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 5, .{ -1, 0, 0, 0, -1 }) orelse return c.JS_EXCEPTION;
+    for (args[2..5]) |value| {
+        if (!std.math.isFinite(value)) return throwTypeError(ctx, "__audioStart: non-finite time");
+    }
+    const buffer: ?web_audio.BufferId = if (args[1] == 0) null else audioHandle(web_audio.BufferId, args[1]);
+    web_audio.graph().start(audioHandle(web_audio.NodeId, args[0]), buffer, args[2], args[3], args[4]) catch |err| {
+        return throwAudioError(ctx, err);
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_blendFuncSeparate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) return c.JS_UNDEFINED;
-    var src: u32 = 0;
-    var dst: u32 = 0;
-    var src_a: u32 = 0;
-    var dst_a: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &src, argv[0]);
-    _ = c.JS_ToUint32(ctx, &dst, argv[1]);
-    _ = c.JS_ToUint32(ctx, &src_a, argv[2]);
-    _ = c.JS_ToUint32(ctx, &dst_a, argv[3]);
-    g_gl_state.blend_src = src;
-    g_gl_state.blend_dst = dst;
-    g_gl_state.blend_src_alpha = src_a;
-    g_gl_state.blend_dst_alpha = dst_a;
-    webgl_draw.setBlendFuncSeparate(src, dst, src_a, dst_a);
+/// Called as: __audioStop(node, when)
+export fn js_audioStop(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 2, .{ -1, 0 }) orelse return c.JS_EXCEPTION;
+    if (!std.math.isFinite(args[1])) return throwTypeError(ctx, "__audioStop: non-finite time");
+    web_audio.graph().stop(audioHandle(web_audio.NodeId, args[0]), args[1]) catch |err| switch (err) {
+        // Stopping a source that already ended is allowed
+        error.InvalidNode => {},
+        else => return throwAudioError(ctx, err),
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_blendEquation(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    var eq: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &eq, argv[0]);
-    g_gl_state.blend_eq = eq;
-    g_gl_state.blend_eq_alpha = eq;
-    webgl_draw.setBlendEquation(eq);
+/// A zeroed buffer
+/// Called as: __audioCreateBuffer(channels, length, sampleRate) -> buffer
+export fn js_audioCreateBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 3, .{ 0, 0, 0 }) orelse return c.JS_EXCEPTION;
+    if (!(args[0] >= 1 and args[0] <= web_audio.MaxChannels and args[1] >= 1 and args[1] <= std.math.maxInt(u32))) {
+        return throwTypeError(ctx, "__audioCreateBuffer: invalid channel count or length");
+    }
+    const id = web_audio.graph().createBuffer(
+        @intFromFloat(args[0]),
+        @intFromFloat(args[1]),
+        @floatCast(args[2]),
+    ) catch |err| return throwAudioError(ctx, err);
+    return c.JS_NewUint32(ctx, @bitCast(id));
+}
+
+/// Copy a Float32Array into a buffer channel from frame `offset`
+/// Called as: __audioBufferWrite(buffer, channel, samples, offset) -> buffer
+/// A buffer a started source plays is copied first; the returned handle
+/// names the buffer that holds the write.
+export fn js_audioBufferWrite(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__audioBufferWrite requires (buffer, channel, samples)");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 2, .{ -1, -1 }) orelse return c.JS_EXCEPTION;
+    var offset: f64 = 0;
+    if (argc >= 4 and c.JS_ToNumber(ctx, &offset, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (!(args[1] >= 0 and args[1] < web_audio.MaxChannels and offset >= 0 and offset <= std.math.maxInt(u32))) {
+        return throwTypeError(ctx, "__audioBufferWrite: invalid channel or offset");
+    }
+    // Converted before borrowing: nothing may allocate on the JS heap after
+    const bytes = borrowArrayBytes(ctx, argv[2]) orelse return throwTypeError(ctx, "__audioBufferWrite: samples must be a Float32Array");
+    if (bytes.len % 4 != 0 or (bytes.len > 0 and !std.mem.isAligned(@intFromPtr(bytes.ptr), @alignOf(f32)))) {
+        return throwTypeError(ctx, "__audioBufferWrite: samples must be a Float32Array");
+    }
+    const samples: []const f32 = if (bytes.len == 0) &.{} else @as([*]const f32, @ptrCast(@alignCast(bytes.ptr)))[0 .. bytes.len / 4];
+    const id = web_audio.graph().writeChannel(
+        audioHandle(web_audio.BufferId, args[0]),
+        @intFromFloat(args[1]),
+        @intFromFloat(offset),
+        samples,
+    ) catch |err| return throwAudioError(ctx, err);
+    return c.JS_NewUint32(ctx, @bitCast(id));
+}
+
+/// Copy a buffer channel from frame `offset` into a Float32Array
+/// Called as: __audioBufferRead(buffer, channel, samples, offset)
+export fn js_audioBufferRead(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) return throwTypeError(ctx, "__audioBufferRead requires (buffer, channel, samples)");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const args = audioArgs(ctx, argc, argv, 2, .{ -1, -1 }) orelse return c.JS_EXCEPTION;
+    var offset: f64 = 0;
+    if (argc >= 4 and c.JS_ToNumber(ctx, &offset, argv[3]) != 0) return c.JS_EXCEPTION;
+    if (!(args[1] >= 0 and args[1] < web_audio.MaxChannels and offset >= 0 and offset <= std.math.maxInt(u32))) {
+        return throwTypeError(ctx, "__audioBufferRead: invalid channel or offset");
+    }
+    const bytes = borrowArrayBytesMut(ctx, argv[2]) orelse return throwTypeError(ctx, "__audioBufferRead: samples must be a Float32Array");
+    if (bytes.len % 4 != 0 or (bytes.len > 0 and !std.mem.isAligned(@intFromPtr(bytes.ptr), @alignOf(f32)))) {
+        return throwTypeError(ctx, "__audioBufferRead: samples must be a Float32Array");
+    }
+    const samples: []f32 = if (bytes.len == 0) &.{} else @as([*]f32, @ptrCast(@alignCast(bytes.ptr)))[0 .. bytes.len / 4];
+    web_audio.graph().readChannel(
+        audioHandle(web_audio.BufferId, args[0]),
+        @intFromFloat(args[1]),
+        @intFromFloat(offset),
+        samples,
+    ) catch |err| return throwAudioError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_blendEquationSeparate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return c.JS_UNDEFINED;
-    var eq: u32 = 0;
-    var eq_a: u32 = 0;
-    _ = c.JS_ToUint32(ctx, &eq, argv[0]);
-    _ = c.JS_ToUint32(ctx, &eq_a, argv[1]);
-    g_gl_state.blend_eq = eq;
-    g_gl_state.blend_eq_alpha = eq_a;
-    webgl_draw.setBlendEquationSeparate(eq, eq_a);
+/// Start decoding encoded audio in the background
+/// Called as: __decodeAudio(target, bufferOrView)
+/// A later tick calls __audioDecodeDone(target, buffer, channels, length,
+/// sampleRate), with buffer 0 when decoding failed. The bytes are copied.
+export fn js_decodeAudio(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "__decodeAudio requires (target, buffer)");
+    if (onWebWorkerThread()) return throwTypeError(ctx, "audio is not available in workers");
+    const runtime = getRuntime(ctx) orelse return throwInternalError(ctx, "no runtime");
+    const pending = for (&g_pending_audio) |*p| {
+        if (!p.active) break p;
+    } else return throwInternalError(ctx, "too many pending audio decodes");
+    const bytes = borrowArrayBytes(ctx, argv[1]) orelse {
+        return throwTypeError(ctx, "__decodeAudio: second argument must be an ArrayBuffer or view");
+    };
+    const job_id = audioDecoder(runtime).submitBytes(bytes) catch |err| {
+        return throwInternalError(ctx, @errorName(err));
+    };
+    const ref = c.JS_AddGCRef(ctx, &pending.target);
+    ref.* = argv[0];
+    pending.job_id = job_id;
+    pending.active = true;
+    return c.JS_TRUE;
+}
+
+/// The shared audio decode pool, started with the runtime's allocator on
+/// first use.
+fn audioDecoder(runtime: *Runtime) *audio_decode.DecodePool {
+    if (!g_audio_decoder.started) g_audio_decoder.start(runtime.allocator, jobSystem());
+    return &g_audio_decoder;
+}
+
+/// Main thread: turn a finished decode into an AudioBuffer and notify JS.
+fn deliverDecodedAudio(ctx: *c.JSContext, result: audio_decode.Result) void {
+    const pending = for (&g_pending_audio) |*p| {
+        if (p.active and p.job_id == result.id) break p;
+    } else {
+        result.discard();
+        return;
+    };
+
+    var id: u32 = 0;
+    var info: web_audio.BufferInfo = .{ .channels = 0, .frames = 0, .sample_rate = 0 };
+    if (result.audio) |audio| {
+        if (web_audio.graph().adoptBuffer(audio)) |buffer| {
+            id = @bitCast(buffer);
+            info = web_audio.graph().bufferInfo(buffer).?;
+        } else |err| {
+            log.debug("audio job {d}: {s}", .{ result.id, @errorName(err) });
+        }
+    } else |err| {
+        log.debug("audio job {d} failed: {s}", .{ result.id, @errorName(err) });
+    }
+
+    // Numbers that may be boxed are rooted before the handler is read
+    var rate_ref: c.JSGCRef = undefined;
+    const rate = c.JS_PushGCRef(ctx, &rate_ref);
+    rate.* = c.JS_NewFloat64(ctx, info.sample_rate);
+    var frames_ref: c.JSGCRef = undefined;
+    const frames = c.JS_PushGCRef(ctx, &frames_ref);
+    frames.* = c.JS_NewUint32(ctx, info.frames);
+    var id_ref: c.JSGCRef = undefined;
+    const id_val = c.JS_PushGCRef(ctx, &id_ref);
+    id_val.* = c.JS_NewUint32(ctx, id);
+
+    const global = c.JS_GetGlobalObject(ctx);
+    const done = c.JS_GetPropertyStr(ctx, global, "__audioDecodeDone");
+    if (c.JS_IsFunction(ctx, done) != 0 and c.JS_StackCheck(ctx, 7) == 0) {
+        c.JS_PushArg(ctx, rate.*);
+        c.JS_PushArg(ctx, frames.*);
+        c.JS_PushArg(ctx, c.JS_NewInt32(ctx, info.channels));
+        c.JS_PushArg(ctx, id_val.*);
+        c.JS_PushArg(ctx, pending.target.val);
+        c.JS_PushArg(ctx, done);
+        c.JS_PushArg(ctx, c.JS_NULL);
+        const ret = c.JS_Call(ctx, 5);
+        if (c.JS_IsException(ret) != 0) {
+            dumpException(ctx);
+        }
+    }
+    _ = c.JS_PopGCRef(ctx, &id_ref);
+    _ = c.JS_PopGCRef(ctx, &frames_ref);
+    _ = c.JS_PopGCRef(ctx, &rate_ref);
+
+    c.JS_DeleteGCRef(ctx, &pending.target);
+    pending.* = .{};
+}
+
+/// Main thread: report a source that finished playing to its node.
+fn deliverAudioEnded(ctx: *c.JSContext, node: web_audio.NodeId) void {
+    var id_ref: c.JSGCRef = undefined;
+    const id_val = c.JS_PushGCRef(ctx, &id_ref);
+    id_val.* = c.JS_NewUint32(ctx, @bitCast(node));
+    defer _ = c.JS_PopGCRef(ctx, &id_ref);
+
+    const global = c.JS_GetGlobalObject(ctx);
+    const ended = c.JS_GetPropertyStr(ctx, global, "__audioEnded");
+    if (c.JS_IsFunction(ctx, ended) == 0 or c.JS_StackCheck(ctx, 3) != 0) return;
+    c.JS_PushArg(ctx, id_val.*);
+    c.JS_PushArg(ctx, ended);
+    c.JS_PushArg(ctx, c.JS_NULL);
+    const ret = c.JS_Call(ctx, 1);
+    if (c.JS_IsException(ret) != 0) {
+        dumpException(ctx);
+    }
+}
+
+// =============================================================================
+// Query objects
+// =============================================================================
+
+fn queryTarget(ctx: *c.JSContext, value: c.JSValue, target: *webgl_query.Target) bool {
+    var raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, value) != 0) return false;
+    target.* = webgl_query.targetFromGl(raw) orelse {
+        _ = throwTypeError(ctx, "invalid query target");
+        return false;
+    };
+    return true;
+}
+
+fn warnQueryError(comptime call: []const u8, err: anyerror) void {
+    log.warn(call ++ ": {s}", .{@errorName(err)});
+}
+
+export fn js_gl_createQuery(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const id = webgl_query.createQuery() catch return c.JS_NULL;
+    return c.JS_NewUint32(ctx, id);
+}
+
+export fn js_gl_deleteQuery(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    _ = webgl_draw.deleteQuery(raw);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_scissor(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) return c.JS_UNDEFINED;
-    var x: i32 = 0;
-    var y: i32 = 0;
-    var w: i32 = 0;
-    var h: i32 = 0;
-    _ = c.JS_ToInt32(ctx, &x, argv[0]);
-    _ = c.JS_ToInt32(ctx, &y, argv[1]);
-    _ = c.JS_ToInt32(ctx, &w, argv[2]);
-    _ = c.JS_ToInt32(ctx, &h, argv[3]);
-    g_gl_state.scissor = .{ x, y, w, h };
-    webgl_draw.setScissor(x, y, w, h);
+export fn js_gl_isQuery(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_FALSE;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    return jsBool(webgl_query.isQuery(raw));
+}
+
+/// beginQuery(target, query): the query covers the draws recorded until
+/// endQuery(target), timed or counted when they are flushed.
+export fn js_gl_beginQuery(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_UNDEFINED;
+    var target: webgl_query.Target = undefined;
+    if (!queryTarget(ctx, argv[0], &target)) return c.JS_EXCEPTION;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[1], &raw)) return c.JS_EXCEPTION;
+    webgl_draw.beginQuery(target, raw) catch |err| {
+        if (err == error.InvalidQuery) return throwTypeError(ctx, "invalid query handle");
+        warnQueryError("beginQuery", err);
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_lineWidth(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+export fn js_gl_endQuery(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) return c.JS_UNDEFINED;
-    var val: f64 = 1.0;
-    _ = c.JS_ToNumber(ctx, &val, argv[0]);
-    g_gl_state.line_width = @floatCast(val);
+    var target: webgl_query.Target = undefined;
+    if (!queryTarget(ctx, argv[0], &target)) return c.JS_EXCEPTION;
+    webgl_draw.endQuery(target) catch |err| warnQueryError("endQuery", err);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_polygonOffset(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+/// queryCounterEXT(query, TIMESTAMP_EXT) of EXT_disjoint_timer_query_webgl2
+export fn js_gl_queryCounter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 2) return c.JS_UNDEFINED;
-    var factor: f64 = 0;
-    var units: f64 = 0;
-    _ = c.JS_ToNumber(ctx, &factor, argv[0]);
-    _ = c.JS_ToNumber(ctx, &units, argv[1]);
-    g_gl_state.polygon_offset = .{ @floatCast(factor), @floatCast(units) };
-    webgl_draw.setPolygonOffset(@floatCast(factor), @floatCast(units));
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    var target: webgl_query.Target = undefined;
+    if (!queryTarget(ctx, argv[1], &target)) return c.JS_EXCEPTION;
+    if (target != .timestamp) return throwTypeError(ctx, "queryCounterEXT target must be TIMESTAMP_EXT");
+    webgl_draw.queryCounter(raw) catch |err| {
+        if (err == error.InvalidQuery) return throwTypeError(ctx, "invalid query handle");
+        warnQueryError("queryCounterEXT", err);
+    };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_pixelStorei(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return c.JS_UNDEFINED;
+/// getQuery(target, pname): CURRENT_QUERY, or QUERY_COUNTER_BITS_EXT of
+/// the timer targets
+export fn js_gl_getQuery(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_NULL;
+    var target: webgl_query.Target = undefined;
+    if (!queryTarget(ctx, argv[0], &target)) return c.JS_EXCEPTION;
     var pname: u32 = 0;
-    var param: i32 = 0;
-    _ = c.JS_ToUint32(ctx, &pname, argv[0]);
-    _ = c.JS_ToInt32(ctx, &param, argv[1]);
+    if (c.JS_ToUint32(ctx, &pname, argv[1]) != 0) return c.JS_EXCEPTION;
     switch (pname) {
-        GL_UNPACK_ALIGNMENT => g_gl_state.unpack_alignment = param,
-        GL_UNPACK_ROW_LENGTH => g_gl_state.unpack_row_length = param,
-        GL_UNPACK_SKIP_PIXELS => g_gl_state.unpack_skip_pixels = param,
-        GL_UNPACK_SKIP_ROWS => g_gl_state.unpack_skip_rows = param,
-        GL_UNPACK_FLIP_Y_WEBGL => g_gl_state.unpack_flip_y = param != 0,
-        GL_UNPACK_PREMULTIPLY_ALPHA_WEBGL => g_gl_state.unpack_premultiply_alpha = param != 0,
-        GL_UNPACK_COLORSPACE_CONVERSION_WEBGL => g_gl_state.unpack_colorspace_conversion = param,
-        else => {},
+        GL_CURRENT_QUERY => {
+            const id = webgl_query.currentQuery(target);
+            return if (id == 0) c.JS_NULL else c.JS_NewUint32(ctx, id);
+        },
+        GL_QUERY_COUNTER_BITS_EXT => return c.JS_NewInt32(ctx, switch (target) {
+            .time_elapsed, .timestamp => 64,
+            else => 0,
+        }),
+        else => return c.JS_NULL,
     }
-    return c.JS_UNDEFINED;
 }
 
-export fn js_gl_getError(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    return c.JS_NewInt32(ctx, @intCast(GL_NO_ERROR));
+/// getQueryParameter(query, pname): QUERY_RESULT_AVAILABLE turns true once
+/// a later frame read the result back; QUERY_RESULT is 0 until then.
+/// Times are in nanoseconds, occlusion results 0 or 1.
+export fn js_gl_getQueryParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_NULL;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    var pname: u32 = 0;
+    if (c.JS_ToUint32(ctx, &pname, argv[1]) != 0) return c.JS_EXCEPTION;
+    if (!webgl_query.isQuery(raw)) return throwTypeError(ctx, "invalid query handle");
+    const result = webgl_query.result(raw);
+    return switch (pname) {
+        GL_QUERY_RESULT_AVAILABLE => jsBool(result != null),
+        GL_QUERY_RESULT => c.JS_NewFloat64(ctx, @floatFromInt(result orelse 0)),
+        else => c.JS_NULL,
+    };
 }
 
-export fn js_gl_getShaderPrecisionFormat(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    const obj = c.JS_NewObject(ctx);
-    _ = c.JS_SetPropertyStr(ctx, obj, "rangeMin", c.JS_NewInt32(ctx, 127));
-    _ = c.JS_SetPropertyStr(ctx, obj, "rangeMax", c.JS_NewInt32(ctx, 127));
-    _ = c.JS_SetPropertyStr(ctx, obj, "precision", c.JS_NewInt32(ctx, 23));
-    return obj;
-}
+// =============================================================================
+// Pixel readbacks and sync objects
+// =============================================================================
 
-export fn js_gl_createBuffer(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
-    const mgr = webgl_state.globalBufferManager();
-    const id = mgr.createBuffer(.{ .usage = .vertex }) catch {
-        return throwInternalError(ctx, "createBuffer failed");
+/// readPixels(x, y, width, height, format, type, offset) into the bound
+/// PIXEL_PACK_BUFFER. Draws are deferred to the frame flush, so the read is
+/// too: fence it with fenceSync() and getBufferSubData() once the sync has
+/// signalled. readPixels(..., dstData[, dstOffset]) into client memory has
+/// to return the pixels, so it submits the frame's commands so far and
+/// waits for the GPU. A multisampled read source is INVALID_OPERATION.
+export fn js_gl_readPixels(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 7) {
+        return throwTypeError(ctx, "readPixels requires (x, y, width, height, format, type, offset)");
+    }
+    var rect: [4]i32 = undefined;
+    for (&rect, 0..) |*value, i| {
+        if (c.JS_ToInt32(ctx, value, argv[i]) != 0) return c.JS_EXCEPTION;
+    }
+    var format_raw: u32 = 0;
+    var type_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &format_raw, argv[4]) != 0) return c.JS_EXCEPTION;
+    if (c.JS_ToUint32(ctx, &type_raw, argv[5]) != 0) return c.JS_EXCEPTION;
+    const format = webgl_readback.formatFromGl(format_raw, type_raw) orelse {
+        log.warn("readPixels: unsupported format 0x{x} / type 0x{x}", .{ format_raw, type_raw });
+        recordGlError(GL_INVALID_ENUM);
+        return c.JS_UNDEFINED;
     };
-    return c.JS_NewUint32(ctx, bufferIdToU32(id));
-}
-
-export fn js_gl_deleteBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) return c.JS_UNDEFINED;
-    if (argv[0] == c.JS_NULL or argv[0] == c.JS_UNDEFINED) {
+    if (c.JS_IsNumber(ctx, argv[6]) == 0) {
+        // Read everything that may allocate before borrowing the backing store
+        var dst_offset: u32 = 0;
+        var element_size: u32 = 1;
+        if (argc >= 8) {
+            if (c.JS_ToUint32(ctx, &dst_offset, argv[7]) != 0) return c.JS_EXCEPTION;
+            const bpe = c.JS_GetPropertyStr(ctx, argv[6], "BYTES_PER_ELEMENT");
+            if (c.JS_IsNumber(ctx, bpe) != 0 and c.JS_ToUint32(ctx, &element_size, bpe) != 0) return c.JS_EXCEPTION;
+            if (element_size == 0) element_size = 1;
+        }
+        const bytes = borrowArrayBytesMut(ctx, argv[6]) orelse {
+            return throwTypeError(ctx, "readPixels requires a typed array or a pack buffer offset");
+        };
+        const start = @as(usize, dst_offset) * element_size;
+        if (start > bytes.len) {
+            recordGlError(GL_INVALID_OPERATION);
+            return c.JS_UNDEFINED;
+        }
+        webgl_draw.readPixelsNow(rect, format, bytes[start..]) catch |err| readPixelsFailed(err);
         return c.JS_UNDEFINED;
     }
-    var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
-    }
-    const mgr = webgl_state.globalBufferManager();
-    _ = mgr.deleteBuffer(bufferIdFromU32(raw));
+    var offset: u32 = 0;
+    if (c.JS_ToUint32(ctx, &offset, argv[6]) != 0) return c.JS_EXCEPTION;
+    const buffer = webgl_state.globalBufferManager().getBoundBuffer(.pixel_pack) orelse {
+        log.warn("readPixels: no PIXEL_PACK_BUFFER bound", .{});
+        recordGlError(GL_INVALID_OPERATION);
+        return c.JS_UNDEFINED;
+    };
+    webgl_draw.readPixels(rect, format, buffer, offset) catch |err| readPixelsFailed(err);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_bindBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) {
-        return throwTypeError(ctx, "bindBuffer requires (target, buffer)");
+fn readPixelsFailed(err: anyerror) void {
+    log.warn("readPixels: {s}", .{@errorName(err)});
+    recordGlError(switch (err) {
+        error.InvalidValue => GL_INVALID_VALUE,
+        error.OutOfMemory => GL_OUT_OF_MEMORY,
+        else => GL_INVALID_OPERATION,
+    });
+}
+
+/// getBufferSubData(target, srcByteOffset, dstBuffer[, dstOffset[, length]]).
+/// dstOffset/length are in elements of dstBuffer, as in WebGL2. Only pixel
+/// pack buffers keep their contents on the CPU to read from.
+export fn js_gl_getBufferSubData(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) {
+        return throwTypeError(ctx, "getBufferSubData requires (target, srcOffset, dstBuffer)");
     }
     var target_raw: u32 = 0;
     if (c.JS_ToUint32(ctx, &target_raw, argv[0]) != 0) {
@@ -3051,124 +6521,588 @@ export fn js_gl_bindBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     const target = parseBufferTarget(target_raw) catch {
         return throwTypeError(ctx, "invalid buffer target");
     };
-
-    const mgr = webgl_state.globalBufferManager();
-    if (argv[1] == c.JS_NULL or argv[1] == c.JS_UNDEFINED) {
-        mgr.unbindBuffer(target);
-        return c.JS_UNDEFINED;
-    }
-
-    var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[1]) != 0) {
+    var src_offset: u32 = 0;
+    if (c.JS_ToUint32(ctx, &src_offset, argv[1]) != 0) {
         return c.JS_EXCEPTION;
     }
-    mgr.bindBuffer(target, bufferIdFromU32(raw)) catch {
-        return throwTypeError(ctx, "invalid buffer handle");
-    };
-    return c.JS_UNDEFINED;
-}
 
-export fn js_gl_bufferData(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) {
-        return throwTypeError(ctx, "bufferData requires (target, size)");
-    }
-    var target_raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &target_raw, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
+    // Read everything that may allocate before borrowing the backing store
+    var dst_offset: u32 = 0;
+    var dst_length: u32 = 0;
+    var element_size: u32 = 1;
+    if (argc >= 4) {
+        if (c.JS_ToUint32(ctx, &dst_offset, argv[3]) != 0) {
+            return c.JS_EXCEPTION;
+        }
+        if (argc >= 5) {
+            if (c.JS_ToUint32(ctx, &dst_length, argv[4]) != 0) {
+                return c.JS_EXCEPTION;
+            }
+        }
+        const bpe = c.JS_GetPropertyStr(ctx, argv[2], "BYTES_PER_ELEMENT");
+        if (c.JS_IsNumber(ctx, bpe) != 0) {
+            if (c.JS_ToUint32(ctx, &element_size, bpe) != 0) {
+                return c.JS_EXCEPTION;
+            }
+        }
+        if (element_size == 0) element_size = 1;
     }
-    const target = parseBufferTarget(target_raw) catch {
-        return throwTypeError(ctx, "invalid buffer target");
-    };
 
     const mgr = webgl_state.globalBufferManager();
-    var c_ptr: [*c]u8 = null;
-    var len: usize = 0;
-
-    if (c.JS_GetTypedArrayData(ctx, argv[1], &c_ptr, &len) == 0) {
-        const data = @as([*]u8, @ptrCast(c_ptr))[0..len];
-        mgr.bufferData(target, data) catch {
-            return throwTypeError(ctx, "bufferData failed");
-        };
+    const id = mgr.getBoundBuffer(target) orelse {
+        return throwTypeError(ctx, "getBufferSubData: no buffer bound");
+    };
+    const src = mgr.buffers.cpuData(id) orelse {
+        log.warn("getBufferSubData: buffer contents live on the GPU only", .{});
         return c.JS_UNDEFINED;
+    };
+    const bytes = borrowArrayBytesMut(ctx, argv[2]) orelse {
+        return throwTypeError(ctx, "getBufferSubData requires a typed array or ArrayBuffer");
+    };
+    const start = @as(usize, dst_offset) * element_size;
+    if (start > bytes.len) {
+        return throwTypeError(ctx, "getBufferSubData dstOffset out of range");
+    }
+    var dst = bytes[start..];
+    if (dst_length != 0) {
+        const byte_len = @as(usize, dst_length) * element_size;
+        if (byte_len > dst.len) {
+            return throwTypeError(ctx, "getBufferSubData length out of range");
+        }
+        dst = dst[0..byte_len];
     }
-    if (c.JS_GetArrayBufferData(ctx, argv[1], &c_ptr, &len) == 0) {
-        const data = @as([*]u8, @ptrCast(c_ptr))[0..len];
-        mgr.bufferData(target, data) catch {
-            return throwTypeError(ctx, "bufferData failed");
-        };
-        return c.JS_UNDEFINED;
+    if (@as(usize, src_offset) + dst.len > src.len) {
+        return throwTypeError(ctx, "getBufferSubData range exceeds buffer size");
     }
+    @memcpy(dst, src[src_offset..][0..dst.len]);
+    return c.JS_UNDEFINED;
+}
 
-    var size: u32 = 0;
-    if (c.JS_ToUint32(ctx, &size, argv[1]) != 0) {
-        return c.JS_EXCEPTION;
-    }
-    if (size > webgl.MaxBufferBytes) {
-        return throwTypeError(ctx, "bufferData too large");
-    }
+/// fenceSync(SYNC_GPU_COMMANDS_COMPLETE, 0): signals once the GPU finished
+/// the frame it was created in, and with it that frame's readbacks.
+export fn js_gl_fenceSync(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const id = webgl_readback.createSync() catch return c.JS_NULL;
+    return c.JS_NewUint32(ctx, id);
+}
 
-    if (size == 0) {
-        mgr.bufferData(target, &.{}) catch {
-            return throwTypeError(ctx, "bufferData failed");
-        };
-        return c.JS_UNDEFINED;
-    }
+export fn js_gl_deleteSync(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    _ = webgl_readback.deleteSync(raw);
+    return c.JS_UNDEFINED;
+}
 
-    const data = std.heap.page_allocator.alloc(u8, size) catch {
-        return throwInternalError(ctx, "out of memory");
-    };
-    defer std.heap.page_allocator.free(data);
-    @memset(data, 0);
+export fn js_gl_isSync(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_FALSE;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    return jsBool(webgl_readback.isSync(raw));
+}
 
-    mgr.bufferData(target, data) catch {
-        return throwTypeError(ctx, "bufferData failed");
+/// clientWaitSync(sync, flags, timeout): never blocks, whatever the timeout
+/// (MAX_CLIENT_WAIT_TIMEOUT_WEBGL is 0); poll again on a later frame.
+export fn js_gl_clientWaitSync(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_NewUint32(ctx, GL_WAIT_FAILED);
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    const signaled = webgl_readback.syncSignaled(raw) orelse {
+        log.warn("clientWaitSync: invalid sync", .{});
+        return c.JS_NewUint32(ctx, GL_WAIT_FAILED);
     };
+    return c.JS_NewUint32(ctx, if (signaled) GL_ALREADY_SIGNALED else GL_TIMEOUT_EXPIRED);
+}
+
+/// waitSync(): GPU-side waits are implicit, as everything runs in one
+/// command stream.
+export fn js_gl_waitSync(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_createShader(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 1) {
-        return throwTypeError(ctx, "createShader requires a type");
-    }
-    var kind_raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &kind_raw, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
-    }
-    const kind = parseShaderKind(kind_raw) catch {
-        return throwTypeError(ctx, "invalid shader type");
+export fn js_gl_getSyncParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_NULL;
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    var pname: u32 = 0;
+    if (c.JS_ToUint32(ctx, &pname, argv[1]) != 0) return c.JS_EXCEPTION;
+    const signaled = webgl_readback.syncSignaled(raw) orelse {
+        return throwTypeError(ctx, "invalid sync handle");
     };
-    const table = webgl_shader.globalShaderTable();
-    const id = table.alloc(kind) catch {
-        return throwInternalError(ctx, "createShader failed");
+    return switch (pname) {
+        GL_OBJECT_TYPE => c.JS_NewUint32(ctx, GL_SYNC_FENCE),
+        GL_SYNC_CONDITION => c.JS_NewUint32(ctx, GL_SYNC_GPU_COMMANDS_COMPLETE),
+        GL_SYNC_STATUS => c.JS_NewUint32(ctx, if (signaled) GL_SIGNALED else GL_UNSIGNALED),
+        GL_SYNC_FLAGS => c.JS_NewUint32(ctx, 0),
+        else => c.JS_NULL,
     };
-    return c.JS_NewUint32(ctx, shaderIdToU32(id));
 }
 
-export fn js_gl_deleteShader(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+export fn js_gl_createVertexArray(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const id = webgl_draw.createVertexArray() catch return c.JS_NULL;
+    return c.JS_NewUint32(ctx, id);
+}
+
+export fn js_gl_deleteVertexArray(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 1) return c.JS_UNDEFINED;
-    if (argv[0] == c.JS_NULL or argv[0] == c.JS_UNDEFINED) {
-        return c.JS_UNDEFINED;
-    }
     var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
-    }
-    const table = webgl_shader.globalShaderTable();
-    _ = table.free(shaderIdFromU32(raw));
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) return c.JS_EXCEPTION;
+    _ = webgl_draw.deleteVertexArray(raw);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_shaderSource(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) {
-        return throwTypeError(ctx, "shaderSource requires (shader, source)");
-    }
+export fn js_gl_bindVertexArray(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
     var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
-        return c.JS_EXCEPTION;
-    }
-    if (c.JS_IsString(ctx, argv[1]) == 0) {
-        return throwTypeError(ctx, "shaderSource requires a string");
-    }
+    if (!handleArg(ctx, argv[0], &raw)) return c.JS_EXCEPTION;
+    glBindVertexArray(raw) catch |err| return throwGlCallError(ctx, err);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_enable(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var cap: u32 = 0;
+    if (c.JS_ToUint32(ctx, &cap, argv[0]) != 0) return c.JS_EXCEPTION;
+    glSetEnabled(cap, true);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_disable(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var cap: u32 = 0;
+    if (c.JS_ToUint32(ctx, &cap, argv[0]) != 0) return c.JS_EXCEPTION;
+    glSetEnabled(cap, false);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_viewport(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var x: i32 = 0;
+    var y: i32 = 0;
+    var w: i32 = 0;
+    var h: i32 = 0;
+    _ = c.JS_ToInt32(ctx, &x, argv[0]);
+    _ = c.JS_ToInt32(ctx, &y, argv[1]);
+    _ = c.JS_ToInt32(ctx, &w, argv[2]);
+    _ = c.JS_ToInt32(ctx, &h, argv[3]);
+    glViewport(x, y, w, h);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_clearColor(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var r: f64 = 0;
+    var g: f64 = 0;
+    var b: f64 = 0;
+    var a: f64 = 0;
+    _ = c.JS_ToNumber(ctx, &r, argv[0]);
+    _ = c.JS_ToNumber(ctx, &g, argv[1]);
+    _ = c.JS_ToNumber(ctx, &b, argv[2]);
+    _ = c.JS_ToNumber(ctx, &a, argv[3]);
+    g_gl_state.clear_color = .{ @floatCast(r), @floatCast(g), @floatCast(b), @floatCast(a) };
+    webgl_draw.setClearColor(@floatCast(r), @floatCast(g), @floatCast(b), @floatCast(a));
+    if (getRuntime(ctx)) |rt| {
+        rt.shared.clear_color = .{ @floatCast(r), @floatCast(g), @floatCast(b) };
+    }
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_clear(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var mask: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &mask, argv[0]);
+    webgl_draw.requestClear(mask);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_clearDepth(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: f64 = 1.0;
+    _ = c.JS_ToNumber(ctx, &val, argv[0]);
+    g_gl_state.clear_depth = @floatCast(val);
+    webgl_draw.setClearDepth(@floatCast(val));
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_clearStencil(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: i32 = 0;
+    _ = c.JS_ToInt32(ctx, &val, argv[0]);
+    g_gl_state.clear_stencil = val;
+    webgl_draw.setClearStencil(val);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_depthFunc(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &val, argv[0]);
+    glDepthFunc(val);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_depthMask(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: i32 = 0;
+    _ = c.JS_ToInt32(ctx, &val, argv[0]);
+    glDepthMask(val != 0);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_colorMask(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var r: i32 = 0;
+    var g: i32 = 0;
+    var b: i32 = 0;
+    var a: i32 = 0;
+    _ = c.JS_ToInt32(ctx, &r, argv[0]);
+    _ = c.JS_ToInt32(ctx, &g, argv[1]);
+    _ = c.JS_ToInt32(ctx, &b, argv[2]);
+    _ = c.JS_ToInt32(ctx, &a, argv[3]);
+    glColorMask(.{ r != 0, g != 0, b != 0, a != 0 });
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_cullFace(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &val, argv[0]);
+    glCullFace(val);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_frontFace(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &val, argv[0]);
+    glFrontFace(val);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_blendFunc(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_UNDEFINED;
+    var src: u32 = 0;
+    var dst: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &src, argv[0]);
+    _ = c.JS_ToUint32(ctx, &dst, argv[1]);
+    glBlendFunc(src, dst);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_blendFuncSeparate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var src: u32 = 0;
+    var dst: u32 = 0;
+    var src_a: u32 = 0;
+    var dst_a: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &src, argv[0]);
+    _ = c.JS_ToUint32(ctx, &dst, argv[1]);
+    _ = c.JS_ToUint32(ctx, &src_a, argv[2]);
+    _ = c.JS_ToUint32(ctx, &dst_a, argv[3]);
+    glBlendFuncSeparate(src, dst, src_a, dst_a);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_blendEquation(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var eq: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &eq, argv[0]);
+    glBlendEquationSeparate(.blendEquation, eq, eq);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_blendEquationSeparate(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_UNDEFINED;
+    var eq: u32 = 0;
+    var eq_a: u32 = 0;
+    _ = c.JS_ToUint32(ctx, &eq, argv[0]);
+    _ = c.JS_ToUint32(ctx, &eq_a, argv[1]);
+    glBlendEquationSeparate(.blendEquationSeparate, eq, eq_a);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_scissor(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) return c.JS_UNDEFINED;
+    var x: i32 = 0;
+    var y: i32 = 0;
+    var w: i32 = 0;
+    var h: i32 = 0;
+    _ = c.JS_ToInt32(ctx, &x, argv[0]);
+    _ = c.JS_ToInt32(ctx, &y, argv[1]);
+    _ = c.JS_ToInt32(ctx, &w, argv[2]);
+    _ = c.JS_ToInt32(ctx, &h, argv[3]);
+    glScissor(x, y, w, h);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_lineWidth(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    var val: f64 = 1.0;
+    _ = c.JS_ToNumber(ctx, &val, argv[0]);
+    g_gl_state.line_width = @floatCast(val);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_polygonOffset(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_UNDEFINED;
+    var factor: f64 = 0;
+    var units: f64 = 0;
+    _ = c.JS_ToNumber(ctx, &factor, argv[0]);
+    _ = c.JS_ToNumber(ctx, &units, argv[1]);
+    glPolygonOffset(@floatCast(factor), @floatCast(units));
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_pixelStorei(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return c.JS_UNDEFINED;
+    var pname: u32 = 0;
+    var param: i32 = 0;
+    _ = c.JS_ToUint32(ctx, &pname, argv[0]);
+    _ = c.JS_ToInt32(ctx, &param, argv[1]);
+    switch (pname) {
+        GL_UNPACK_ALIGNMENT => g_gl_state.unpack_alignment = param,
+        GL_UNPACK_ROW_LENGTH => g_gl_state.unpack_row_length = param,
+        GL_UNPACK_SKIP_PIXELS => g_gl_state.unpack_skip_pixels = param,
+        GL_UNPACK_SKIP_ROWS => g_gl_state.unpack_skip_rows = param,
+        GL_UNPACK_FLIP_Y_WEBGL => g_gl_state.unpack_flip_y = param != 0,
+        GL_UNPACK_PREMULTIPLY_ALPHA_WEBGL => g_gl_state.unpack_premultiply_alpha = param != 0,
+        GL_UNPACK_COLORSPACE_CONVERSION_WEBGL => g_gl_state.unpack_colorspace_conversion = param,
+        else => {},
+    }
+    return c.JS_UNDEFINED;
+}
+
+/// getError(): the first error recorded since the last call. Most invalid
+/// calls throw instead; only the ones WebGL code checks for are recorded.
+export fn js_gl_getError(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const code = g_gl_state.error_code;
+    g_gl_state.error_code = GL_NO_ERROR;
+    return c.JS_NewInt32(ctx, @intCast(code));
+}
+
+/// Keep `code` for getError() unless an earlier error is still unread.
+fn recordGlError(code: u32) void {
+    if (g_gl_state.error_code == GL_NO_ERROR) g_gl_state.error_code = code;
+}
+
+export fn js_gl_getShaderPrecisionFormat(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const obj = c.JS_NewObject(ctx);
+    _ = c.JS_SetPropertyStr(ctx, obj, "rangeMin", c.JS_NewInt32(ctx, 127));
+    _ = c.JS_SetPropertyStr(ctx, obj, "rangeMax", c.JS_NewInt32(ctx, 127));
+    _ = c.JS_SetPropertyStr(ctx, obj, "precision", c.JS_NewInt32(ctx, 23));
+    return obj;
+}
+
+export fn js_gl_createBuffer(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const mgr = webgl_state.globalBufferManager();
+    const id = mgr.createBuffer(.{ .usage = .vertex }) catch {
+        return throwInternalError(ctx, "createBuffer failed");
+    };
+    return c.JS_NewUint32(ctx, bufferIdToU32(id));
+}
+
+export fn js_gl_deleteBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    if (argv[0] == c.JS_NULL or argv[0] == c.JS_UNDEFINED) {
+        return c.JS_UNDEFINED;
+    }
+    var raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    const mgr = webgl_state.globalBufferManager();
+    _ = mgr.deleteBuffer(bufferIdFromU32(raw));
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_bindBuffer(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) {
+        return throwTypeError(ctx, "bindBuffer requires (target, buffer)");
+    }
+    var target: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[1], &raw)) {
+        return c.JS_EXCEPTION;
+    }
+    glBindBuffer(target, raw) catch |err| return throwGlCallError(ctx, err);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_bufferData(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) {
+        return throwTypeError(ctx, "bufferData requires (target, size)");
+    }
+    var target_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target_raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    const target = parseBufferTarget(target_raw) catch {
+        return throwTypeError(ctx, "invalid buffer target");
+    };
+
+    var hint: webgl.BufferHint = .static;
+    if (argc >= 3) {
+        var usage_raw: u32 = 0;
+        if (c.JS_ToUint32(ctx, &usage_raw, argv[2]) != 0) {
+            return c.JS_EXCEPTION;
+        }
+        hint = parseBufferHint(usage_raw) catch {
+            return throwTypeError(ctx, "invalid buffer usage");
+        };
+    }
+
+    const mgr = webgl_state.globalBufferManager();
+
+    // The JS backing store goes straight to the backend (one copy, into the
+    // driver); only buffers created before the backend is live are shadowed.
+    if (borrowArrayBytes(ctx, argv[1])) |data| {
+        mgr.bufferDataWithHint(target, data, hint) catch {
+            return throwTypeError(ctx, "bufferData failed");
+        };
+        return c.JS_UNDEFINED;
+    }
+
+    var size: u32 = 0;
+    if (c.JS_ToUint32(ctx, &size, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    if (size > webgl.MaxBufferBytes) {
+        return throwTypeError(ctx, "bufferData too large");
+    }
+
+    if (size == 0) {
+        mgr.bufferDataWithHint(target, &.{}, hint) catch {
+            return throwTypeError(ctx, "bufferData failed");
+        };
+        return c.JS_UNDEFINED;
+    }
+
+    const data = std.heap.page_allocator.alloc(u8, size) catch {
+        return throwInternalError(ctx, "out of memory");
+    };
+    defer std.heap.page_allocator.free(data);
+    @memset(data, 0);
+
+    mgr.bufferDataWithHint(target, data, hint) catch {
+        return throwTypeError(ctx, "bufferData failed");
+    };
+    return c.JS_UNDEFINED;
+}
+
+/// bufferSubData(target, dstByteOffset, srcData[, srcOffset[, length]]).
+/// srcOffset/length are in elements of srcData, as in WebGL2.
+export fn js_gl_bufferSubData(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) {
+        return throwTypeError(ctx, "bufferSubData requires (target, offset, data)");
+    }
+    var target_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target_raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    const target = parseBufferTarget(target_raw) catch {
+        return throwTypeError(ctx, "invalid buffer target");
+    };
+    var offset: u32 = 0;
+    if (c.JS_ToUint32(ctx, &offset, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+
+    // Read everything that may allocate before borrowing the backing store
+    var src_offset: u32 = 0;
+    var src_length: ?u32 = null;
+    var element_size: u32 = 1;
+    if (argc >= 4) {
+        if (c.JS_ToUint32(ctx, &src_offset, argv[3]) != 0) {
+            return c.JS_EXCEPTION;
+        }
+        if (argc >= 5) {
+            var len: u32 = 0;
+            if (c.JS_ToUint32(ctx, &len, argv[4]) != 0) {
+                return c.JS_EXCEPTION;
+            }
+            src_length = len;
+        }
+        const bpe = c.JS_GetPropertyStr(ctx, argv[2], "BYTES_PER_ELEMENT");
+        if (c.JS_IsNumber(ctx, bpe) != 0) {
+            if (c.JS_ToUint32(ctx, &element_size, bpe) != 0) {
+                return c.JS_EXCEPTION;
+            }
+        }
+        if (element_size == 0) element_size = 1;
+    }
+
+    const bytes = borrowArrayBytes(ctx, argv[2]) orelse {
+        return throwTypeError(ctx, "bufferSubData requires a typed array or ArrayBuffer");
+    };
+    const start = @as(usize, src_offset) * element_size;
+    if (start > bytes.len) {
+        return throwTypeError(ctx, "bufferSubData srcOffset out of range");
+    }
+    var data = bytes[start..];
+    if (src_length) |len| {
+        const byte_len = @as(usize, len) * element_size;
+        if (len != 0) {
+            if (byte_len > data.len) {
+                return throwTypeError(ctx, "bufferSubData length out of range");
+            }
+            data = data[0..byte_len];
+        }
+    }
+
+    webgl_state.globalBufferManager().bufferSubData(target, offset, data) catch |err| {
+        return switch (err) {
+            error.OutOfRange => throwTypeError(ctx, "bufferSubData range exceeds buffer size"),
+            else => throwTypeError(ctx, "bufferSubData failed"),
+        };
+    };
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_createShader(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) {
+        return throwTypeError(ctx, "createShader requires a type");
+    }
+    var kind_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &kind_raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    const kind = parseShaderKind(kind_raw) catch {
+        return throwTypeError(ctx, "invalid shader type");
+    };
+    const table = webgl_shader.globalShaderTable();
+    const id = table.alloc(kind) catch {
+        return throwInternalError(ctx, "createShader failed");
+    };
+    return c.JS_NewUint32(ctx, shaderIdToU32(id));
+}
+
+export fn js_gl_deleteShader(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) return c.JS_UNDEFINED;
+    if (argv[0] == c.JS_NULL or argv[0] == c.JS_UNDEFINED) {
+        return c.JS_UNDEFINED;
+    }
+    var raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    const table = webgl_shader.globalShaderTable();
+    _ = table.free(shaderIdFromU32(raw));
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_shaderSource(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) {
+        return throwTypeError(ctx, "shaderSource requires (shader, source)");
+    }
+    var raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    if (c.JS_IsString(ctx, argv[1]) == 0) {
+        return throwTypeError(ctx, "shaderSource requires a string");
+    }
     var len: usize = 0;
     var buf: c.JSCStringBuf = undefined;
     const c_str = c.JS_ToCStringLen(ctx, &len, argv[1], &buf);
@@ -3179,7 +7113,7 @@ export fn js_gl_shaderSource(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv
     const table = webgl_shader.globalShaderTable();
     table.setSource(shaderIdFromU32(raw), slice[0..len]) catch |err| switch (err) {
         error.InvalidHandle => return throwTypeError(ctx, "invalid shader handle"),
-        error.TooLarge => return throwTypeError(ctx, "shaderSource too large"),
+        error.OutOfMemory => return throwInternalError(ctx, "shaderSource: out of memory"),
     };
     return c.JS_UNDEFINED;
 }
@@ -3217,13 +7151,15 @@ export fn js_gl_getShaderParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int
     if (c.JS_ToUint32(ctx, &pname, argv[1]) != 0) {
         return c.JS_EXCEPTION;
     }
-    if (pname != GL_COMPILE_STATUS) {
+    if (pname != GL_COMPILE_STATUS and pname != GL_COMPLETION_STATUS_KHR) {
         return throwTypeError(ctx, "invalid shader parameter");
     }
     const table = webgl_shader.globalShaderTable();
     const sh = table.get(shaderIdFromU32(raw)) orelse {
         return throwTypeError(ctx, "invalid shader handle");
     };
+    // compileShader() only validates; it is always complete on return.
+    if (pname == GL_COMPLETION_STATUS_KHR) return c.JS_TRUE;
     return if (sh.compiled) c.JS_TRUE else c.JS_FALSE;
 }
 
@@ -3299,14 +7235,16 @@ export fn js_gl_linkProgram(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     log.debug("linkProgram: program={d}", .{raw});
     const programs = webgl_program.globalProgramTable();
     const shaders = webgl_shader.globalShaderTable();
-    programs.link(programIdFromU32(raw), shaders) catch |err| switch (err) {
+    // Translation runs on the job workers beside image and audio decode
+    if (programs.jobs == null) programs.useJobSystem(jobSystem());
+    programs.linkAsync(programIdFromU32(raw), shaders) catch |err| switch (err) {
         error.InvalidHandle => return throwTypeError(ctx, "invalid program handle"),
         else => {
             log.debug("linkProgram: failed for program={d}", .{raw});
             return throwInternalError(ctx, "linkProgram failed");
         },
     };
-    log.debug("linkProgram: success for program={d}", .{raw});
+    log.debug("linkProgram: queued for program={d}", .{raw});
     return c.JS_UNDEFINED;
 }
 
@@ -3323,13 +7261,20 @@ export fn js_gl_getProgramParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_in
         return c.JS_EXCEPTION;
     }
     const programs = webgl_program.globalProgramTable();
-    const prog = programs.get(programIdFromU32(raw)) orelse {
+    const id = programIdFromU32(raw);
+    // Must not go through get(), which waits for the link to finish
+    if (pname == GL_COMPLETION_STATUS_KHR) {
+        if (!programs.isValid(id)) return throwTypeError(ctx, "invalid program handle");
+        return if (programs.isLinkComplete(id)) c.JS_TRUE else c.JS_FALSE;
+    }
+    const prog = programs.get(id) orelse {
         return throwTypeError(ctx, "invalid program handle");
     };
     switch (pname) {
         GL_LINK_STATUS => return if (prog.linked) c.JS_TRUE else c.JS_FALSE,
         GL_VALIDATE_STATUS => return c.JS_TRUE,
         GL_ACTIVE_ATTRIBUTES => return c.JS_NewUint32(ctx, prog.attr_count),
+        GL_ACTIVE_UNIFORM_BLOCKS => return c.JS_NewUint32(ctx, prog.buffer_block_count),
         GL_ACTIVE_UNIFORMS => {
             const uniform_count: u32 = prog.countUniformUnion();
             const total: u32 = uniform_count + prog.sampler_count;
@@ -3368,19 +7313,11 @@ export fn js_gl_useProgram(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     if (argc < 1) {
         return throwTypeError(ctx, "useProgram requires a program");
     }
-    if (argv[0] == c.JS_NULL or argv[0] == c.JS_UNDEFINED) {
-        log.debug("useProgram: clearing program", .{});
-        webgl_draw.clearProgram();
-        return c.JS_UNDEFINED;
-    }
     var raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
+    if (!handleArg(ctx, argv[0], &raw)) {
         return c.JS_EXCEPTION;
     }
-    log.debug("useProgram: program={d}", .{raw});
-    webgl_draw.useProgram(programIdFromU32(raw)) catch {
-        return throwTypeError(ctx, "invalid program handle");
-    };
+    glUseProgram(raw) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
@@ -3433,7 +7370,7 @@ export fn js_gl_getActiveAttrib(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, a
     const obj = c.JS_NewObject(ctx);
     _ = c.JS_SetPropertyStr(ctx, obj, "name", c.JS_NewStringLen(ctx, prog.attr_names[idx][0..name_len].ptr, name_len));
     _ = c.JS_SetPropertyStr(ctx, obj, "size", c.JS_NewInt32(ctx, 1));
-    _ = c.JS_SetPropertyStr(ctx, obj, "type", c.JS_NewUint32(ctx, GL_FLOAT));
+    _ = c.JS_SetPropertyStr(ctx, obj, "type", c.JS_NewUint32(ctx, uniformTypeToGlEnum(prog.attr_types[idx])));
     return obj;
 }
 
@@ -3505,10 +7442,7 @@ export fn js_gl_enableVertexAttribArray(ctx: *c.JSContext, _: *c.JSValue, argc:
     if (c.JS_ToUint32(ctx, &idx, argv[0]) != 0) {
         return c.JS_EXCEPTION;
     }
-    log.debug("enableVertexAttribArray: index={d}", .{idx});
-    webgl_draw.enableVertexAttribArray(idx) catch {
-        return throwTypeError(ctx, "invalid attrib index");
-    };
+    glSetVertexAttribArray(idx, true) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
@@ -3520,9 +7454,7 @@ export fn js_gl_disableVertexAttribArray(ctx: *c.JSContext, _: *c.JSValue, argc:
     if (c.JS_ToUint32(ctx, &idx, argv[0]) != 0) {
         return c.JS_EXCEPTION;
     }
-    webgl_draw.disableVertexAttribArray(idx) catch {
-        return throwTypeError(ctx, "invalid attrib index");
-    };
+    glSetVertexAttribArray(idx, false) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
@@ -3554,24 +7486,8 @@ export fn js_gl_vertexAttribPointer(ctx: *c.JSContext, _: *c.JSValue, argc: c_in
     if (c.JS_ToInt32(ctx, &offset_i, argv[5]) != 0) {
         return c.JS_EXCEPTION;
     }
-    if (size_i <= 0 or stride_i < 0 or offset_i < 0) {
-        return throwTypeError(ctx, "vertexAttribPointer invalid arguments");
-    }
-    const mgr = webgl_state.globalBufferManager();
-    const buffer = mgr.getBoundBuffer(.array) orelse {
-        return throwTypeError(ctx, "no array buffer bound");
-    };
-    log.debug("vertexAttribPointer: index={d} size={d} type={d} normalized={} stride={d} offset={d}", .{ idx, size_i, type_raw, normalized_i != 0, stride_i, offset_i });
-    webgl_draw.vertexAttribPointer(
-        idx,
-        @intCast(size_i),
-        type_raw,
-        normalized_i != 0,
-        @intCast(stride_i),
-        @intCast(offset_i),
-        buffer,
-    ) catch {
-        return throwTypeError(ctx, "vertexAttribPointer failed");
+    glVertexAttribPointer(idx, size_i, type_raw, normalized_i != 0, stride_i, offset_i) catch |err| {
+        return throwGlCallError(ctx, err);
     };
     return c.JS_UNDEFINED;
 }
@@ -3588,61 +7504,392 @@ export fn js_gl_drawArrays(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
     if (c.JS_ToInt32(ctx, &first, argv[1]) != 0) {
         return c.JS_EXCEPTION;
     }
-    var count: c_int = 0;
-    if (c.JS_ToInt32(ctx, &count, argv[2]) != 0) {
+    var count: c_int = 0;
+    if (c.JS_ToInt32(ctx, &count, argv[2]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    log.debug("drawArrays: mode={d} first={d} count={d}", .{ mode, first, count });
+    webgl_draw.drawArrays(mode, first, count) catch {
+        return throwTypeError(ctx, "drawArrays failed");
+    };
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_drawElements(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) {
+        return throwTypeError(ctx, "drawElements requires (mode, count, type, offset)");
+    }
+    var mode: u32 = 0;
+    if (c.JS_ToUint32(ctx, &mode, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var count: c_int = 0;
+    if (c.JS_ToInt32(ctx, &count, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var type_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &type_raw, argv[2]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var offset: c_int = 0;
+    if (c.JS_ToInt32(ctx, &offset, argv[3]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    if (offset < 0) {
+        return throwTypeError(ctx, "drawElements invalid offset");
+    }
+    const mgr = webgl_state.globalBufferManager();
+    const element = mgr.getBoundBuffer(.element_array) orelse {
+        return throwTypeError(ctx, "no element array buffer bound");
+    };
+    log.debug("drawElements: mode={d} count={d} type={d} offset={d}", .{ mode, count, type_raw, offset });
+    webgl_draw.drawElements(mode, count, type_raw, @intCast(offset), element) catch {
+        return throwTypeError(ctx, "drawElements failed");
+    };
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_drawArraysInstanced(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 4) {
+        return throwTypeError(ctx, "drawArraysInstanced requires (mode, first, count, instanceCount)");
+    }
+    var mode: u32 = 0;
+    if (c.JS_ToUint32(ctx, &mode, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var first: c_int = 0;
+    if (c.JS_ToInt32(ctx, &first, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var count: c_int = 0;
+    if (c.JS_ToInt32(ctx, &count, argv[2]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var instances: c_int = 0;
+    if (c.JS_ToInt32(ctx, &instances, argv[3]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    log.debug("drawArraysInstanced: mode={d} first={d} count={d} instances={d}", .{ mode, first, count, instances });
+    webgl_draw.drawArraysInstanced(mode, first, count, instances) catch {
+        return throwTypeError(ctx, "drawArraysInstanced failed");
+    };
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_drawElementsInstanced(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 5) {
+        return throwTypeError(ctx, "drawElementsInstanced requires (mode, count, type, offset, instanceCount)");
+    }
+    var mode: u32 = 0;
+    if (c.JS_ToUint32(ctx, &mode, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var count: c_int = 0;
+    if (c.JS_ToInt32(ctx, &count, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var type_raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &type_raw, argv[2]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var offset: c_int = 0;
+    if (c.JS_ToInt32(ctx, &offset, argv[3]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var instances: c_int = 0;
+    if (c.JS_ToInt32(ctx, &instances, argv[4]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    if (offset < 0) {
+        return throwTypeError(ctx, "drawElementsInstanced invalid offset");
+    }
+    const mgr = webgl_state.globalBufferManager();
+    const element = mgr.getBoundBuffer(.element_array) orelse {
+        return throwTypeError(ctx, "no element array buffer bound");
+    };
+    log.debug("drawElementsInstanced: mode={d} count={d} type={d} offset={d} instances={d}", .{ mode, count, type_raw, offset, instances });
+    webgl_draw.drawElementsInstanced(mode, count, type_raw, @intCast(offset), element, instances) catch {
+        return throwTypeError(ctx, "drawElementsInstanced failed");
+    };
+    return c.JS_UNDEFINED;
+}
+
+/// Ranges of the multi-draw being decoded. GL calls only run on the main
+/// thread.
+var g_multi_draw_ranges: [webgl_draw.MaxMultiDrawRanges]webgl_draw.DrawRange = undefined;
+
+const MultiDrawField = enum { first, count, instance_count };
+
+/// Fill one field of `ranges` from a WEBGL_multi_draw list argument, an
+/// Int32Array or an Array of numbers, starting at element `offset`.
+fn readMultiDrawList(
+    ctx: *c.JSContext,
+    value: c.JSValue,
+    offset_arg: c.JSValue,
+    ranges: []webgl_draw.DrawRange,
+    comptime field: MultiDrawField,
+) !void {
+    var offset: u32 = 0;
+    if (c.JS_ToUint32(ctx, &offset, offset_arg) != 0) return error.JsException;
+    switch (c.JS_GetClassID(ctx, value)) {
+        c.JS_CLASS_INT32_ARRAY => for (ranges, try typedElements(i32, ctx, value, offset, ranges.len)) |*range, v| {
+            @field(range, @tagName(field)) = v;
+        },
+        c.JS_CLASS_ARRAY => for (ranges, 0..) |*range, i| {
+            const v = c.JS_GetPropertyUint32(ctx, value, offset + @as(u32, @intCast(i)));
+            if (v == c.JS_EXCEPTION) return error.JsException;
+            if (c.JS_ToInt32(ctx, &@field(range, @tagName(field)), v) != 0) return error.JsException;
+        },
+        else => return error.InvalidType,
+    }
+}
+
+/// The four WEBGL_multi_draw entry points. Arguments, after `mode`:
+/// arrays take (firsts, firstsOffset, counts, countsOffset), elements take
+/// (counts, countsOffset, type, offsets, offsetsOffset); instanced variants
+/// add (instanceCounts, instanceCountsOffset); all end with drawCount.
+fn multiDraw(ctx: *c.JSContext, argc: c_int, argv: [*]c.JSValue, comptime kind: enum { arrays, elements }, comptime instanced: bool) c.JSValue {
+    const name = switch (kind) {
+        .arrays => if (instanced) "multiDrawArraysInstancedWEBGL" else "multiDrawArraysWEBGL",
+        .elements => if (instanced) "multiDrawElementsInstancedWEBGL" else "multiDrawElementsWEBGL",
+    };
+    const list_args: usize = if (kind == .elements) 6 else 5;
+    const argn: usize = list_args + @as(usize, if (instanced) 2 else 0) + 1;
+    if (argc < argn) {
+        return throwTypeError(ctx, name ++ " requires " ++ std.fmt.comptimePrint("{d}", .{argn}) ++ " arguments");
+    }
+    var mode: u32 = 0;
+    if (c.JS_ToUint32(ctx, &mode, argv[0]) != 0) return c.JS_EXCEPTION;
+    var draw_count: u32 = 0;
+    if (c.JS_ToUint32(ctx, &draw_count, argv[argn - 1]) != 0) return c.JS_EXCEPTION;
+    if (draw_count > webgl_draw.MaxMultiDrawRanges) {
+        return throwTypeError(ctx, name ++ ": too many draws");
+    }
+    const ranges = g_multi_draw_ranges[0..draw_count];
+    for (ranges) |*range| range.instance_count = 1;
+
+    var index_type: u32 = 0;
+    readLists: {
+        switch (kind) {
+            .arrays => {
+                readMultiDrawList(ctx, argv[1], argv[2], ranges, .first) catch break :readLists;
+                readMultiDrawList(ctx, argv[3], argv[4], ranges, .count) catch break :readLists;
+            },
+            .elements => {
+                readMultiDrawList(ctx, argv[1], argv[2], ranges, .count) catch break :readLists;
+                if (c.JS_ToUint32(ctx, &index_type, argv[3]) != 0) return c.JS_EXCEPTION;
+                readMultiDrawList(ctx, argv[4], argv[5], ranges, .first) catch break :readLists;
+            },
+        }
+        if (instanced) {
+            readMultiDrawList(ctx, argv[list_args], argv[list_args + 1], ranges, .instance_count) catch break :readLists;
+        }
+        const result = switch (kind) {
+            .arrays => webgl_draw.multiDrawArrays(mode, ranges),
+            .elements => blk: {
+                const mgr = webgl_state.globalBufferManager();
+                const element = mgr.getBoundBuffer(.element_array) orelse {
+                    return throwTypeError(ctx, "no element array buffer bound");
+                };
+                break :blk webgl_draw.multiDrawElements(mode, index_type, element, ranges);
+            },
+        };
+        result catch {
+            return throwTypeError(ctx, name ++ " failed");
+        };
+        return c.JS_UNDEFINED;
+    }
+    return throwTypeError(ctx, name ++ " lists must be Int32Arrays or Arrays covering drawCount entries");
+}
+
+export fn js_gl_multiDrawArrays(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return multiDraw(ctx, argc, argv, .arrays, false);
+}
+
+export fn js_gl_multiDrawElements(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return multiDraw(ctx, argc, argv, .elements, false);
+}
+
+export fn js_gl_multiDrawArraysInstanced(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return multiDraw(ctx, argc, argv, .arrays, true);
+}
+
+export fn js_gl_multiDrawElementsInstanced(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    return multiDraw(ctx, argc, argv, .elements, true);
+}
+
+export fn js_gl_vertexAttribDivisor(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) {
+        return throwTypeError(ctx, "vertexAttribDivisor requires (index, divisor)");
+    }
+    var idx: u32 = 0;
+    if (c.JS_ToUint32(ctx, &idx, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var divisor: u32 = 0;
+    if (c.JS_ToUint32(ctx, &divisor, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    glVertexAttribDivisor(idx, divisor) catch |err| return throwGlCallError(ctx, err);
+    return c.JS_UNDEFINED;
+}
+
+/// gl.__warmPipelines(): build pipelines for the draws recorded so far this
+/// frame without rendering them. Returns the number of pipelines created.
+export fn js_gl_warmPipelines(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const created = webgl_draw.warmPipelines();
+    return c.JS_NewInt32(ctx, @intCast(created));
+}
+
+/// gl.__setPipelineCacheCapacity(n): resize (and clear) the pipeline cache.
+export fn js_gl_setPipelineCacheCapacity(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 1) {
+        return throwTypeError(ctx, "__setPipelineCacheCapacity requires (capacity)");
+    }
+    var capacity: u32 = 0;
+    if (c.JS_ToUint32(ctx, &capacity, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    webgl_draw.setPipelineCacheCapacity(capacity);
+    return c.JS_UNDEFINED;
+}
+
+/// gl.__getPipelineCacheStats(): { hits, misses, evictions, failures, live, capacity }
+export fn js_gl_getPipelineCacheStats(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    const stats = webgl_draw.pipelineCacheStats();
+    const obj = c.JS_NewObject(ctx);
+    _ = c.JS_SetPropertyStr(ctx, obj, "hits", c.JS_NewFloat64(ctx, @floatFromInt(stats.hits)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "misses", c.JS_NewFloat64(ctx, @floatFromInt(stats.misses)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "evictions", c.JS_NewFloat64(ctx, @floatFromInt(stats.evictions)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "failures", c.JS_NewFloat64(ctx, @floatFromInt(stats.failures)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "live", c.JS_NewFloat64(ctx, @floatFromInt(stats.live)));
+    _ = c.JS_SetPropertyStr(ctx, obj, "capacity", c.JS_NewFloat64(ctx, @floatFromInt(stats.capacity)));
+    return obj;
+}
+
+/// gl.__getCallStats(): { enable: { calls, skipped }, ... } for each setter
+/// with a redundant-call check, counted since start or the last reset.
+export fn js_gl_getCallStats(ctx: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    var obj_ref: c.JSGCRef = undefined;
+    const obj = c.JS_PushGCRef(ctx, &obj_ref);
+    obj.* = c.JS_NewObject(ctx);
+    var entry_ref: c.JSGCRef = undefined;
+    const entry = c.JS_PushGCRef(ctx, &entry_ref);
+    for (std.enums.values(GlCall)) |call| {
+        const counter = g_gl_calls.get(call);
+        entry.* = c.JS_NewObject(ctx);
+        _ = c.JS_SetPropertyStr(ctx, entry.*, "calls", c.JS_NewFloat64(ctx, @floatFromInt(counter.calls)));
+        _ = c.JS_SetPropertyStr(ctx, entry.*, "skipped", c.JS_NewFloat64(ctx, @floatFromInt(counter.skipped)));
+        _ = c.JS_SetPropertyStr(ctx, obj.*, @tagName(call), entry.*);
+    }
+    _ = c.JS_PopGCRef(ctx, &entry_ref);
+    return c.JS_PopGCRef(ctx, &obj_ref);
+}
+
+/// gl.__resetCallStats(): zero the counters behind __getCallStats().
+export fn js_gl_resetCallStats(_: *c.JSContext, _: *c.JSValue, _: c_int, _: [*]c.JSValue) callconv(.c) c.JSValue {
+    g_gl_calls = .initFill(.{});
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_getUniformLocation(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) {
+        return throwTypeError(ctx, "getUniformLocation requires (program, name)");
+    }
+    var raw: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    if (c.JS_IsString(ctx, argv[1]) == 0) {
+        return throwTypeError(ctx, "getUniformLocation requires a string");
+    }
+    var len: usize = 0;
+    var buf: c.JSCStringBuf = undefined;
+    const c_str = c.JS_ToCStringLen(ctx, &len, argv[1], &buf);
+    if (c_str == null) {
+        return c.JS_EXCEPTION;
+    }
+    const slice: [*]const u8 = @ptrCast(c_str);
+    const programs = webgl_program.globalProgramTable();
+    const loc = programs.getUniformLocation(programIdFromU32(raw), slice[0..len]) catch {
+        return throwTypeError(ctx, "invalid program handle");
+    };
+    // Log uniform location queries for debugging
+    if (std.mem.eql(u8, slice[0..len], "diffuse") or std.mem.eql(u8, slice[0..len], "map")) {
+        log.debug("getUniformLocation: '{s}' -> {d}", .{ slice[0..len], loc });
+    }
+    return c.JS_NewInt32(ctx, @intCast(loc));
+}
+
+/// bindBufferBase(UNIFORM_BUFFER, index, buffer): the whole buffer.
+export fn js_gl_bindBufferBase(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) {
+        return throwTypeError(ctx, "bindBufferBase requires (target, index, buffer)");
+    }
+    var target: u32 = 0;
+    var index: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0 or c.JS_ToUint32(ctx, &index, argv[1]) != 0) {
+        return c.JS_EXCEPTION;
+    }
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[2], &raw)) {
         return c.JS_EXCEPTION;
     }
-    log.debug("drawArrays: mode={d} first={d} count={d}", .{ mode, first, count });
-    webgl_draw.drawArrays(mode, first, count) catch {
-        return throwTypeError(ctx, "drawArrays failed");
-    };
-    return c.JS_UNDEFINED;
+    return bindIndexedBuffer(ctx, target, index, raw, 0, 0);
 }
 
-export fn js_gl_drawElements(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 4) {
-        return throwTypeError(ctx, "drawElements requires (mode, count, type, offset)");
+export fn js_gl_bindBufferRange(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 5) {
+        return throwTypeError(ctx, "bindBufferRange requires (target, index, buffer, offset, size)");
     }
-    var mode: u32 = 0;
-    if (c.JS_ToUint32(ctx, &mode, argv[0]) != 0) {
+    var target: u32 = 0;
+    var index: u32 = 0;
+    if (c.JS_ToUint32(ctx, &target, argv[0]) != 0 or c.JS_ToUint32(ctx, &index, argv[1]) != 0) {
         return c.JS_EXCEPTION;
     }
-    var count: c_int = 0;
-    if (c.JS_ToInt32(ctx, &count, argv[1]) != 0) {
+    var raw: u32 = 0;
+    if (!handleArg(ctx, argv[2], &raw)) {
         return c.JS_EXCEPTION;
     }
-    var type_raw: u32 = 0;
-    if (c.JS_ToUint32(ctx, &type_raw, argv[2]) != 0) {
+    var offset: u32 = 0;
+    var size: u32 = 0;
+    if (c.JS_ToUint32(ctx, &offset, argv[3]) != 0 or c.JS_ToUint32(ctx, &size, argv[4]) != 0) {
         return c.JS_EXCEPTION;
     }
-    var offset: c_int = 0;
-    if (c.JS_ToInt32(ctx, &offset, argv[3]) != 0) {
-        return c.JS_EXCEPTION;
+    if (size == 0 and raw != 0) {
+        return throwTypeError(ctx, "bindBufferRange size must be positive");
     }
-    if (offset < 0) {
-        return throwTypeError(ctx, "drawElements invalid offset");
+    return bindIndexedBuffer(ctx, target, index, raw, offset, size);
+}
+
+/// `raw` 0 clears the binding point; `size` 0 binds to the end of the buffer.
+fn bindIndexedBuffer(ctx: *c.JSContext, target: u32, index: u32, raw: u32, offset: u32, size: u32) c.JSValue {
+    if (target != GL_UNIFORM_BUFFER) {
+        return throwTypeError(ctx, "invalid indexed buffer target");
     }
-    const mgr = webgl_state.globalBufferManager();
-    const element = mgr.getBoundBuffer(.element_array) orelse {
-        return throwTypeError(ctx, "no element array buffer bound");
-    };
-    log.debug("drawElements: mode={d} count={d} type={d} offset={d}", .{ mode, count, type_raw, offset });
-    webgl_draw.drawElements(mode, count, type_raw, @intCast(offset), element) catch {
-        return throwTypeError(ctx, "drawElements failed");
+    if (offset % gl_uniforms.uniformBufferOffsetAlignment() != 0) {
+        return throwTypeError(ctx, "uniform buffer offset is not aligned");
+    }
+    const id: ?webgl.BufferId = if (raw == 0) null else bufferIdFromU32(raw);
+    webgl_state.globalBufferManager().bindBufferRange(index, id, offset, size) catch |err| {
+        return throwTypeError(ctx, switch (err) {
+            error.InvalidIndex => "uniform buffer binding out of range",
+            error.InvalidHandle => "invalid buffer handle",
+        });
     };
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_getUniformLocation(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+export fn js_gl_getUniformBlockIndex(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 2) {
-        return throwTypeError(ctx, "getUniformLocation requires (program, name)");
+        return throwTypeError(ctx, "getUniformBlockIndex requires (program, name)");
     }
     var raw: u32 = 0;
     if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0) {
         return c.JS_EXCEPTION;
     }
     if (c.JS_IsString(ctx, argv[1]) == 0) {
-        return throwTypeError(ctx, "getUniformLocation requires a string");
+        return throwTypeError(ctx, "getUniformBlockIndex requires a string");
     }
     var len: usize = 0;
     var buf: c.JSCStringBuf = undefined;
@@ -3652,68 +7899,113 @@ export fn js_gl_getUniformLocation(ctx: *c.JSContext, _: *c.JSValue, argc: c_int
     }
     const slice: [*]const u8 = @ptrCast(c_str);
     const programs = webgl_program.globalProgramTable();
-    const loc = programs.getUniformLocation(programIdFromU32(raw), slice[0..len]) catch {
+    const index = programs.getUniformBlockIndex(programIdFromU32(raw), slice[0..len]) catch {
         return throwTypeError(ctx, "invalid program handle");
     };
-    // Log uniform location queries for debugging
-    if (std.mem.eql(u8, slice[0..len], "diffuse") or std.mem.eql(u8, slice[0..len], "map")) {
-        log.info("getUniformLocation: '{s}' -> {d}", .{ slice[0..len], loc });
+    return c.JS_NewUint32(ctx, index orelse GL_INVALID_INDEX);
+}
+
+export fn js_gl_uniformBlockBinding(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) {
+        return throwTypeError(ctx, "uniformBlockBinding requires (program, index, binding)");
     }
-    return c.JS_NewInt32(ctx, @intCast(loc));
+    var raw: u32 = 0;
+    var index: u32 = 0;
+    var binding: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0 or
+        c.JS_ToUint32(ctx, &index, argv[1]) != 0 or
+        c.JS_ToUint32(ctx, &binding, argv[2]) != 0)
+    {
+        return c.JS_EXCEPTION;
+    }
+    const programs = webgl_program.globalProgramTable();
+    programs.setUniformBlockBinding(programIdFromU32(raw), index, binding) catch |err| {
+        return throwTypeError(ctx, switch (err) {
+            error.InvalidHandle => "invalid program handle",
+            error.InvalidIndex => "invalid uniform block index",
+            error.InvalidBinding => "uniform buffer binding out of range",
+        });
+    };
+    return c.JS_UNDEFINED;
+}
+
+/// Only UNIFORM_BLOCK_BINDING; Three.js lays std140 blocks out itself.
+export fn js_gl_getActiveUniformBlockParameter(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 3) {
+        return throwTypeError(ctx, "getActiveUniformBlockParameter requires (program, index, pname)");
+    }
+    var raw: u32 = 0;
+    var index: u32 = 0;
+    var pname: u32 = 0;
+    if (c.JS_ToUint32(ctx, &raw, argv[0]) != 0 or
+        c.JS_ToUint32(ctx, &index, argv[1]) != 0 or
+        c.JS_ToUint32(ctx, &pname, argv[2]) != 0)
+    {
+        return c.JS_EXCEPTION;
+    }
+    if (pname != GL_UNIFORM_BLOCK_BINDING) return c.JS_NULL;
+    const programs = webgl_program.globalProgramTable();
+    const binding = programs.getUniformBlockBinding(programIdFromU32(raw), index) catch |err| {
+        return throwTypeError(ctx, switch (err) {
+            error.InvalidHandle => "invalid program handle",
+            error.InvalidIndex => "invalid uniform block index",
+        });
+    };
+    return c.JS_NewUint32(ctx, binding);
+}
+
+/// Write uniform values unless the program already holds them.
+fn applyUniformFloats(call: GlCall, prog: webgl_program.ProgramId, loc: u32, values: []const f32) void {
+    const programs = webgl_program.globalProgramTable();
+    if (countGlCall(call, programs.uniformFloatsMatch(prog, loc, values))) return;
+    programs.setUniformFloats(prog, loc, values) catch {};
+}
+
+fn applyUniformInts(call: GlCall, prog: webgl_program.ProgramId, loc: u32, values: []const i32) void {
+    const programs = webgl_program.globalProgramTable();
+    if (countGlCall(call, programs.uniformIntsMatch(prog, loc, values))) return;
+    programs.setUniformInts(prog, loc, values) catch {};
 }
 
 export fn js_gl_uniform1f(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 2) return throwTypeError(ctx, "uniform1f requires (location, x)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse {
-        return throwTypeError(ctx, "no program in use");
-    };
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
     var x: f64 = 0;
     if (c.JS_ToNumber(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     const values = [_]f32{@floatCast(x)};
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    glUniformFloats(.uniform1f, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform2f(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 3) return throwTypeError(ctx, "uniform2f requires (location, x, y)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
     var x: f64 = 0;
     var y: f64 = 0;
     if (c.JS_ToNumber(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToNumber(ctx, &y, argv[2]) != 0) return c.JS_EXCEPTION;
     const values = [_]f32{ @floatCast(x), @floatCast(y) };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    glUniformFloats(.uniform2f, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform3f(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 4) return throwTypeError(ctx, "uniform3f requires (location, x, y, z)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
     var x: f64 = 0;
     var y: f64 = 0;
     var z: f64 = 0;
     if (c.JS_ToNumber(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToNumber(ctx, &y, argv[2]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToNumber(ctx, &z, argv[3]) != 0) return c.JS_EXCEPTION;
-    log.debug("uniform3f: location={d} x={d:.4} y={d:.4} z={d:.4}", .{ loc, @as(f32, @floatCast(x)), @as(f32, @floatCast(y)), @as(f32, @floatCast(z)) });
     const values = [_]f32{ @floatCast(x), @floatCast(y), @floatCast(z) };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    glUniformFloats(.uniform3f, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform4f(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 5) return throwTypeError(ctx, "uniform4f requires (location, x, y, z, w)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
     var x: f64 = 0;
     var y: f64 = 0;
     var z: f64 = 0;
@@ -3723,74 +8015,59 @@ export fn js_gl_uniform4f(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [
     if (c.JS_ToNumber(ctx, &z, argv[3]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToNumber(ctx, &w, argv[4]) != 0) return c.JS_EXCEPTION;
     const values = [_]f32{ @floatCast(x), @floatCast(y), @floatCast(z), @floatCast(w) };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    glUniformFloats(.uniform4f, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform1i(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 2) return throwTypeError(ctx, "uniform1i requires (location, x)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var x: c_int = 0;
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
+    var x: i32 = 0;
     if (c.JS_ToInt32(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
-    log.debug("uniform1i: location={d} value={d}", .{ loc, x });
-    const values = [_]i32{@intCast(x)};
-    webgl_program.globalProgramTable().setUniformInts(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    const values = [_]i32{x};
+    glUniformInts(.uniform1i, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform2i(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 3) return throwTypeError(ctx, "uniform2i requires (location, x, y)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var x: c_int = 0;
-    var y: c_int = 0;
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
+    var x: i32 = 0;
+    var y: i32 = 0;
     if (c.JS_ToInt32(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &y, argv[2]) != 0) return c.JS_EXCEPTION;
-    const values = [_]i32{ @intCast(x), @intCast(y) };
-    webgl_program.globalProgramTable().setUniformInts(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    const values = [_]i32{ x, y };
+    glUniformInts(.uniform2i, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform3i(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 4) return throwTypeError(ctx, "uniform3i requires (location, x, y, z)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var x: c_int = 0;
-    var y: c_int = 0;
-    var z: c_int = 0;
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
+    var x: i32 = 0;
+    var y: i32 = 0;
+    var z: i32 = 0;
     if (c.JS_ToInt32(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &y, argv[2]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &z, argv[3]) != 0) return c.JS_EXCEPTION;
-    const values = [_]i32{ @intCast(x), @intCast(y), @intCast(z) };
-    webgl_program.globalProgramTable().setUniformInts(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    const values = [_]i32{ x, y, z };
+    glUniformInts(.uniform3i, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
 export fn js_gl_uniform4i(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
     if (argc < 5) return throwTypeError(ctx, "uniform4i requires (location, x, y, z, w)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var x: c_int = 0;
-    var y: c_int = 0;
-    var z: c_int = 0;
-    var w: c_int = 0;
+    const loc = readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION;
+    var x: i32 = 0;
+    var y: i32 = 0;
+    var z: i32 = 0;
+    var w: i32 = 0;
     if (c.JS_ToInt32(ctx, &x, argv[1]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &y, argv[2]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &z, argv[3]) != 0) return c.JS_EXCEPTION;
     if (c.JS_ToInt32(ctx, &w, argv[4]) != 0) return c.JS_EXCEPTION;
-    const values = [_]i32{ @intCast(x), @intCast(y), @intCast(z), @intCast(w) };
-    webgl_program.globalProgramTable().setUniformInts(prog, loc, values[0..]) catch {
-        return c.JS_UNDEFINED;
-    };
+    const values = [_]i32{ x, y, z, w };
+    glUniformInts(.uniform4i, loc, &values) catch |err| return throwGlCallError(ctx, err);
     return c.JS_UNDEFINED;
 }
 
@@ -3802,13 +8079,11 @@ export fn js_gl_uniformMatrix4fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int,
     if (c.JS_ToInt32(ctx, &transpose, argv[1]) != 0) return c.JS_EXCEPTION;
     if (transpose != 0) return throwTypeError(ctx, "uniformMatrix4fv transpose must be false");
     var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[2], temp[0..]) catch {
+    const values = readFloatValues(ctx, argv[2], temp[0..]) catch {
         return throwTypeError(ctx, "uniformMatrix4fv requires Float32Array");
     };
-    log.debug("uniformMatrix4fv: location={d} count={d}", .{ loc, count });
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
-    };
+    log.debug("uniformMatrix4fv: location={d} count={d}", .{ loc, values.len });
+    applyUniformFloats(.uniformMatrix4fv, prog, loc, values);
     return c.JS_UNDEFINED;
 }
 
@@ -3820,25 +8095,11 @@ export fn js_gl_uniformMatrix3fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int,
     if (c.JS_ToInt32(ctx, &transpose, argv[1]) != 0) return c.JS_EXCEPTION;
     if (transpose != 0) return throwTypeError(ctx, "uniformMatrix3fv transpose must be false");
     var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[2], temp[0..]) catch {
+    const values = readFloatValues(ctx, argv[2], temp[0..]) catch {
         return throwTypeError(ctx, "uniformMatrix3fv requires Float32Array");
     };
-    log.debug("uniformMatrix3fv: location={d} count={d} data=[{d:.4},{d:.4},{d:.4},{d:.4},{d:.4},{d:.4},{d:.4},{d:.4},{d:.4}]", .{
-        loc,
-        count,
-        if (count > 0) temp[0] else 0,
-        if (count > 1) temp[1] else 0,
-        if (count > 2) temp[2] else 0,
-        if (count > 3) temp[3] else 0,
-        if (count > 4) temp[4] else 0,
-        if (count > 5) temp[5] else 0,
-        if (count > 6) temp[6] else 0,
-        if (count > 7) temp[7] else 0,
-        if (count > 8) temp[8] else 0,
-    });
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
-    };
+    log.debug("uniformMatrix3fv: location={d} count={d} data={any}", .{ loc, values.len, values[0..@min(values.len, 9)] });
+    applyUniformFloats(.uniformMatrix3fv, prog, loc, values);
     return c.JS_UNDEFINED;
 }
 
@@ -3850,76 +8111,488 @@ export fn js_gl_uniformMatrix2fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int,
     if (c.JS_ToInt32(ctx, &transpose, argv[1]) != 0) return c.JS_EXCEPTION;
     if (transpose != 0) return throwTypeError(ctx, "uniformMatrix2fv transpose must be false");
     var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[2], temp[0..]) catch {
+    const values = readFloatValues(ctx, argv[2], temp[0..]) catch {
         return throwTypeError(ctx, "uniformMatrix2fv requires Float32Array");
     };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
+    applyUniformFloats(.uniformMatrix2fv, prog, loc, values);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_uniform1fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "uniform1fv requires (location, data)");
+    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
+    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    var temp: [MaxUniformFloatCount]f32 = undefined;
+    const values = readFloatValues(ctx, argv[1], temp[0..]) catch {
+        return throwTypeError(ctx, "uniform1fv requires Float32Array");
+    };
+    applyUniformFloats(.uniform1fv, prog, loc, values);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_uniform2fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "uniform2fv requires (location, data)");
+    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
+    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    var temp: [MaxUniformFloatCount]f32 = undefined;
+    const values = readFloatValues(ctx, argv[1], temp[0..]) catch {
+        return throwTypeError(ctx, "uniform2fv requires Float32Array");
+    };
+    applyUniformFloats(.uniform2fv, prog, loc, values);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_uniform3fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "uniform3fv requires (location, data)");
+    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
+    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    var temp: [MaxUniformFloatCount]f32 = undefined;
+    const values = readFloatValues(ctx, argv[1], temp[0..]) catch {
+        return throwTypeError(ctx, "uniform3fv requires Float32Array");
+    };
+    log.debug("uniform3fv: location={d} count={d} data={any}", .{ loc, values.len, values[0..@min(values.len, 3)] });
+    applyUniformFloats(.uniform3fv, prog, loc, values);
+    return c.JS_UNDEFINED;
+}
+
+export fn js_gl_uniform4fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "uniform4fv requires (location, data)");
+    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
+    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
+    var temp: [MaxUniformFloatCount]f32 = undefined;
+    const values = readFloatValues(ctx, argv[1], temp[0..]) catch {
+        return throwTypeError(ctx, "uniform4fv requires Float32Array");
     };
+    applyUniformFloats(.uniform4fv, prog, loc, values);
     return c.JS_UNDEFINED;
 }
 
-export fn js_gl_uniform1fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return throwTypeError(ctx, "uniform1fv requires (location, data)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[1], temp[0..]) catch {
-        return throwTypeError(ctx, "uniform1fv requires Float32Array");
-    };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
-    };
-    return c.JS_UNDEFINED;
+// =============================================================================
+// GL setters shared by the bindings and gl.__submit()
+// =============================================================================
+
+/// Failures of the setters below; each binding throws the matching
+/// glCallErrorMessage() as a TypeError.
+const GlCallError = error{
+    InvalidBufferTarget,
+    InvalidBufferHandle,
+    InvalidTextureHandle,
+    InvalidProgramHandle,
+    InvalidVertexArrayHandle,
+    InvalidAttribIndex,
+    InvalidAttribPointer,
+    AttribPointerFailed,
+    NoArrayBuffer,
+    NoProgram,
+};
+
+fn glCallErrorMessage(err: GlCallError) [:0]const u8 {
+    return switch (err) {
+        error.InvalidBufferTarget => "invalid buffer target",
+        error.InvalidBufferHandle => "invalid buffer handle",
+        error.InvalidTextureHandle => "invalid texture handle",
+        error.InvalidProgramHandle => "invalid program handle",
+        error.InvalidVertexArrayHandle => "invalid vertex array handle",
+        error.InvalidAttribIndex => "invalid attrib index",
+        error.InvalidAttribPointer => "vertexAttribPointer invalid arguments",
+        error.AttribPointerFailed => "vertexAttribPointer failed",
+        error.NoArrayBuffer => "no array buffer bound",
+        error.NoProgram => "no program in use",
+    };
+}
+
+fn throwGlCallError(ctx: *c.JSContext, err: GlCallError) c.JSValue {
+    return throwTypeError(ctx, glCallErrorMessage(err));
+}
+
+fn glSetEnabled(cap: u32, enabled: bool) void {
+    if (countGlCall(if (enabled) .enable else .disable, enableUnchanged(cap, enabled))) return;
+    setEnableState(cap, enabled);
+    switch (cap) {
+        GL_SCISSOR_TEST => webgl_draw.setScissorEnabled(enabled),
+        GL_DEPTH_TEST => webgl_draw.setDepthTestEnabled(enabled),
+        GL_STENCIL_TEST => webgl_draw.setStencilEnabled(enabled),
+        GL_CULL_FACE => webgl_draw.setCullEnabled(enabled),
+        GL_BLEND => webgl_draw.setBlendEnabled(enabled),
+        GL_POLYGON_OFFSET_FILL => webgl_draw.setPolygonOffsetEnabled(enabled),
+        GL_SAMPLE_ALPHA_TO_COVERAGE => webgl_draw.setAlphaToCoverageEnabled(enabled),
+        else => {},
+    }
+}
+
+fn glViewport(x: i32, y: i32, w: i32, h: i32) void {
+    if (countGlCall(.viewport, std.mem.eql(i32, &g_gl_state.viewport, &.{ x, y, w, h }))) return;
+    g_gl_state.viewport = .{ x, y, w, h };
+    webgl_draw.setViewport(x, y, w, h);
+}
+
+fn glScissor(x: i32, y: i32, w: i32, h: i32) void {
+    if (countGlCall(.scissor, std.mem.eql(i32, &g_gl_state.scissor, &.{ x, y, w, h }))) return;
+    g_gl_state.scissor = .{ x, y, w, h };
+    webgl_draw.setScissor(x, y, w, h);
+}
+
+fn glDepthFunc(func: u32) void {
+    if (countGlCall(.depthFunc, g_gl_state.depth_func == func)) return;
+    g_gl_state.depth_func = func;
+    webgl_draw.setDepthFunc(func);
+}
+
+fn glDepthMask(enabled: bool) void {
+    if (countGlCall(.depthMask, g_gl_state.depth_mask == enabled)) return;
+    g_gl_state.depth_mask = enabled;
+    webgl_draw.setDepthMask(enabled);
+}
+
+fn glColorMask(mask: [4]bool) void {
+    if (countGlCall(.colorMask, std.mem.eql(bool, &g_gl_state.color_mask, &mask))) return;
+    g_gl_state.color_mask = mask;
+    webgl_draw.setColorMask(mask[0], mask[1], mask[2], mask[3]);
+}
+
+fn glCullFace(face: u32) void {
+    if (countGlCall(.cullFace, g_gl_state.cull_face == face)) return;
+    g_gl_state.cull_face = face;
+    webgl_draw.setCullFace(face);
+}
+
+fn glFrontFace(face: u32) void {
+    if (countGlCall(.frontFace, g_gl_state.front_face == face)) return;
+    g_gl_state.front_face = face;
+    webgl_draw.setFrontFace(face);
+}
+
+fn blendFuncUnchanged(src: u32, dst: u32, src_alpha: u32, dst_alpha: u32) bool {
+    return g_gl_state.blend_src == src and g_gl_state.blend_dst == dst and
+        g_gl_state.blend_src_alpha == src_alpha and g_gl_state.blend_dst_alpha == dst_alpha;
+}
+
+fn glBlendFunc(src: u32, dst: u32) void {
+    if (countGlCall(.blendFunc, blendFuncUnchanged(src, dst, src, dst))) return;
+    g_gl_state.blend_src = src;
+    g_gl_state.blend_dst = dst;
+    g_gl_state.blend_src_alpha = src;
+    g_gl_state.blend_dst_alpha = dst;
+    webgl_draw.setBlendFunc(src, dst);
+}
+
+fn glBlendFuncSeparate(src: u32, dst: u32, src_alpha: u32, dst_alpha: u32) void {
+    if (countGlCall(.blendFuncSeparate, blendFuncUnchanged(src, dst, src_alpha, dst_alpha))) return;
+    g_gl_state.blend_src = src;
+    g_gl_state.blend_dst = dst;
+    g_gl_state.blend_src_alpha = src_alpha;
+    g_gl_state.blend_dst_alpha = dst_alpha;
+    webgl_draw.setBlendFuncSeparate(src, dst, src_alpha, dst_alpha);
+}
+
+/// blendEquation and blendEquationSeparate; `call` says which was made.
+fn glBlendEquationSeparate(call: GlCall, eq: u32, eq_alpha: u32) void {
+    if (countGlCall(call, g_gl_state.blend_eq == eq and g_gl_state.blend_eq_alpha == eq_alpha)) return;
+    g_gl_state.blend_eq = eq;
+    g_gl_state.blend_eq_alpha = eq_alpha;
+    webgl_draw.setBlendEquationSeparate(eq, eq_alpha);
+}
+
+fn glPolygonOffset(factor: f32, units: f32) void {
+    g_gl_state.polygon_offset = .{ factor, units };
+    webgl_draw.setPolygonOffset(factor, units);
+}
+
+/// Units below TEXTURE0 or past the last one are ignored.
+fn glActiveTexture(unit: u32) void {
+    if (unit < GL_TEXTURE0) return;
+    const idx = unit - GL_TEXTURE0;
+    const mgr = webgl_texture.globalTextureManager();
+    if (countGlCall(.activeTexture, mgr.state.active_unit == idx)) return;
+    mgr.activeTexture(idx) catch return;
+    g_gl_state.active_texture_unit = idx;
+}
+
+/// `raw` 0 unbinds. Unknown targets are ignored.
+fn glBindTexture(target: u32, raw: u32) GlCallError!void {
+    const mgr = webgl_texture.globalTextureManager();
+    const tex_target: webgl_texture.TextureTarget = switch (target) {
+        GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D => .texture_2d,
+        GL_TEXTURE_CUBE_MAP => .texture_cube_map,
+        else => return,
+    };
+
+    const bound_raw: u32 = if (mgr.state.getBound(tex_target)) |bound| bound.toU32() else 0;
+    if (countGlCall(.bindTexture, bound_raw == raw)) return;
+    const tex_id: ?webgl_texture.TextureId = if (raw == 0) null else webgl_texture.TextureId.fromU32(raw);
+    mgr.bindTexture(tex_target, tex_id) catch return error.InvalidTextureHandle;
+
+    // Keep g_gl_state in sync for compatibility
+    const unit = g_gl_state.active_texture_unit;
+    switch (tex_target) {
+        .texture_2d => g_gl_state.bound_textures_2d[unit] = raw,
+        .texture_cube_map => g_gl_state.bound_textures_cube[unit] = raw,
+    }
+}
+
+/// `raw` 0 unbinds.
+fn glBindBuffer(target_raw: u32, raw: u32) GlCallError!void {
+    const target = parseBufferTarget(target_raw) catch return error.InvalidBufferTarget;
+    const mgr = webgl_state.globalBufferManager();
+    const bound = mgr.getBoundBuffer(target);
+    if (raw == 0) {
+        if (countGlCall(.bindBuffer, bound == null)) return;
+        mgr.unbindBuffer(target);
+        return;
+    }
+    const id = bufferIdFromU32(raw);
+    if (countGlCall(.bindBuffer, bound != null and std.meta.eql(bound.?, id))) return;
+    mgr.bindBuffer(target, id) catch return error.InvalidBufferHandle;
+}
+
+/// `raw` 0 clears the program.
+fn glUseProgram(raw: u32) GlCallError!void {
+    const current = webgl_draw.currentProgram();
+    if (raw == 0) {
+        if (countGlCall(.useProgram, current == null)) return;
+        log.debug("useProgram: clearing program", .{});
+        webgl_draw.clearProgram();
+        return;
+    }
+    const id = programIdFromU32(raw);
+    // A deleted program must still fail below, so check it is live
+    const same = current != null and std.meta.eql(current.?, id) and
+        webgl_program.globalProgramTable().isValid(id);
+    if (countGlCall(.useProgram, same)) return;
+    log.debug("useProgram: program={d}", .{raw});
+    webgl_draw.useProgram(id) catch return error.InvalidProgramHandle;
+}
+
+fn glBindVertexArray(raw: u32) GlCallError!void {
+    webgl_draw.bindVertexArray(raw) catch return error.InvalidVertexArrayHandle;
+}
+
+fn glSetVertexAttribArray(idx: u32, enabled: bool) GlCallError!void {
+    log.debug("{s}VertexAttribArray: index={d}", .{ if (enabled) "enable" else "disable", idx });
+    if (enabled) {
+        webgl_draw.enableVertexAttribArray(idx) catch return error.InvalidAttribIndex;
+    } else {
+        webgl_draw.disableVertexAttribArray(idx) catch return error.InvalidAttribIndex;
+    }
+}
+
+/// Points `idx` at the bound ARRAY_BUFFER.
+fn glVertexAttribPointer(idx: u32, size: i32, type_raw: u32, normalized: bool, stride: i32, offset: i32) GlCallError!void {
+    if (size <= 0 or stride < 0 or offset < 0) return error.InvalidAttribPointer;
+    const mgr = webgl_state.globalBufferManager();
+    const buffer = mgr.getBoundBuffer(.array) orelse return error.NoArrayBuffer;
+    log.debug("vertexAttribPointer: index={d} size={d} type={d} normalized={} stride={d} offset={d}", .{ idx, size, type_raw, normalized, stride, offset });
+    webgl_draw.vertexAttribPointer(
+        idx,
+        @intCast(size),
+        type_raw,
+        normalized,
+        @intCast(stride),
+        @intCast(offset),
+        buffer,
+    ) catch return error.AttribPointerFailed;
+}
+
+fn glVertexAttribDivisor(idx: u32, divisor: u32) GlCallError!void {
+    webgl_draw.vertexAttribDivisor(idx, divisor) catch return error.InvalidAttribIndex;
+}
+
+/// A null location (from a uniform the program does not have) is a no-op.
+fn glUniformFloats(call: GlCall, loc: ?u32, values: []const f32) GlCallError!void {
+    const location = loc orelse return;
+    const prog = webgl_draw.currentProgram() orelse return error.NoProgram;
+    applyUniformFloats(call, prog, location, values);
+}
+
+fn glUniformInts(call: GlCall, loc: ?u32, values: []const i32) GlCallError!void {
+    const location = loc orelse return;
+    const prog = webgl_draw.currentProgram() orelse return error.NoProgram;
+    applyUniformInts(call, prog, location, values);
 }
 
-export fn js_gl_uniform2fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return throwTypeError(ctx, "uniform2fv requires (location, data)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[1], temp[0..]) catch {
-        return throwTypeError(ctx, "uniform2fv requires Float32Array");
-    };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
+// =============================================================================
+// Batched GL commands (gl.__submit)
+// =============================================================================
+
+/// Opcodes of gl.__submit() command buffers, mirrored by GL_OP in
+/// examples/three-entry.js. Each opcode word is followed by glOpArgCount()
+/// argument words: enums, flags and handles as integers (0 for null),
+/// uniform locations as integers (-1 for null) and floats as f32 bits.
+const GlOp = enum(u32) {
+    enable = 1,
+    disable = 2,
+    viewport = 3,
+    scissor = 4,
+    depthFunc = 5,
+    depthMask = 6,
+    colorMask = 7,
+    cullFace = 8,
+    frontFace = 9,
+    blendFunc = 10,
+    blendFuncSeparate = 11,
+    blendEquation = 12,
+    blendEquationSeparate = 13,
+    polygonOffset = 14,
+    activeTexture = 15,
+    bindTexture = 16,
+    bindBuffer = 17,
+    useProgram = 18,
+    bindVertexArray = 19,
+    enableVertexAttribArray = 20,
+    disableVertexAttribArray = 21,
+    vertexAttribPointer = 22,
+    vertexAttribDivisor = 23,
+    uniform1f = 24,
+    uniform2f = 25,
+    uniform3f = 26,
+    uniform4f = 27,
+    uniform1i = 28,
+    uniform2i = 29,
+    uniform3i = 30,
+    uniform4i = 31,
+    _,
+};
+
+const MaxGlOpArgs = 6;
+
+fn glOpArgCount(op: GlOp) ?usize {
+    return switch (op) {
+        .enable,
+        .disable,
+        .depthFunc,
+        .depthMask,
+        .cullFace,
+        .frontFace,
+        .blendEquation,
+        .activeTexture,
+        .useProgram,
+        .bindVertexArray,
+        .enableVertexAttribArray,
+        .disableVertexAttribArray,
+        => 1,
+        .blendFunc,
+        .blendEquationSeparate,
+        .polygonOffset,
+        .bindTexture,
+        .bindBuffer,
+        .vertexAttribDivisor,
+        .uniform1f,
+        .uniform1i,
+        => 2,
+        .uniform2f, .uniform2i => 3,
+        .viewport, .scissor, .colorMask, .blendFuncSeparate, .uniform3f, .uniform3i => 4,
+        .uniform4f, .uniform4i => 5,
+        .vertexAttribPointer => 6,
+        _ => null,
     };
-    return c.JS_UNDEFINED;
 }
 
-export fn js_gl_uniform3fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return throwTypeError(ctx, "uniform3fv requires (location, data)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[1], temp[0..]) catch {
-        return throwTypeError(ctx, "uniform3fv requires Float32Array");
-    };
-    log.debug("uniform3fv: location={d} count={d} data=[{d:.4},{d:.4},{d:.4}]", .{
-        loc,
-        count,
-        if (count > 0) temp[0] else 0,
-        if (count > 1) temp[1] else 0,
-        if (count > 2) temp[2] else 0,
-    });
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
-    };
-    return c.JS_UNDEFINED;
+fn wordI32(word: u32) i32 {
+    return @bitCast(word);
+}
+
+fn wordF32(word: u32) f32 {
+    return @bitCast(word);
+}
+
+fn wordLocation(word: u32) ?u32 {
+    const loc = wordI32(word);
+    return if (loc < 0) null else @intCast(loc);
+}
+
+fn runGlOp(op: GlOp, args: []const u32) GlCallError!void {
+    switch (op) {
+        .enable => glSetEnabled(args[0], true),
+        .disable => glSetEnabled(args[0], false),
+        .viewport => glViewport(wordI32(args[0]), wordI32(args[1]), wordI32(args[2]), wordI32(args[3])),
+        .scissor => glScissor(wordI32(args[0]), wordI32(args[1]), wordI32(args[2]), wordI32(args[3])),
+        .depthFunc => glDepthFunc(args[0]),
+        .depthMask => glDepthMask(args[0] != 0),
+        .colorMask => glColorMask(.{ args[0] != 0, args[1] != 0, args[2] != 0, args[3] != 0 }),
+        .cullFace => glCullFace(args[0]),
+        .frontFace => glFrontFace(args[0]),
+        .blendFunc => glBlendFunc(args[0], args[1]),
+        .blendFuncSeparate => glBlendFuncSeparate(args[0], args[1], args[2], args[3]),
+        .blendEquation => glBlendEquationSeparate(.blendEquation, args[0], args[0]),
+        .blendEquationSeparate => glBlendEquationSeparate(.blendEquationSeparate, args[0], args[1]),
+        .polygonOffset => glPolygonOffset(wordF32(args[0]), wordF32(args[1])),
+        .activeTexture => glActiveTexture(args[0]),
+        .bindTexture => try glBindTexture(args[0], args[1]),
+        .bindBuffer => try glBindBuffer(args[0], args[1]),
+        .useProgram => try glUseProgram(args[0]),
+        .bindVertexArray => try glBindVertexArray(args[0]),
+        .enableVertexAttribArray => try glSetVertexAttribArray(args[0], true),
+        .disableVertexAttribArray => try glSetVertexAttribArray(args[0], false),
+        .vertexAttribPointer => try glVertexAttribPointer(
+            args[0],
+            wordI32(args[1]),
+            args[2],
+            args[3] != 0,
+            wordI32(args[4]),
+            wordI32(args[5]),
+        ),
+        .vertexAttribDivisor => try glVertexAttribDivisor(args[0], args[1]),
+        inline .uniform1f, .uniform2f, .uniform3f, .uniform4f => |uop| {
+            var values: [@intFromEnum(uop) - @intFromEnum(GlOp.uniform1f) + 1]f32 = undefined;
+            for (&values, args[1..][0..values.len]) |*value, word| value.* = wordF32(word);
+            try glUniformFloats(@field(GlCall, @tagName(uop)), wordLocation(args[0]), &values);
+        },
+        inline .uniform1i, .uniform2i, .uniform3i, .uniform4i => |uop| {
+            var values: [@intFromEnum(uop) - @intFromEnum(GlOp.uniform1i) + 1]i32 = undefined;
+            for (&values, args[1..][0..values.len]) |*value, word| value.* = wordI32(word);
+            try glUniformInts(@field(GlCall, @tagName(uop)), wordLocation(args[0]), &values);
+        },
+        _ => {},
+    }
 }
 
-export fn js_gl_uniform4fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
-    if (argc < 2) return throwTypeError(ctx, "uniform4fv requires (location, data)");
-    const loc = (readUniformLocation(ctx, argv[0]) catch return c.JS_EXCEPTION) orelse return c.JS_UNDEFINED;
-    const prog = webgl_draw.currentProgram() orelse return throwTypeError(ctx, "no program in use");
-    var temp: [MaxUniformFloatCount]f32 = undefined;
-    const count = readFloatValues(ctx, argv[1], temp[0..]) catch {
-        return throwTypeError(ctx, "uniform4fv requires Float32Array");
+const SubmitFailure = struct {
+    /// Word index of the command that failed
+    offset: usize,
+    message: [:0]const u8,
+};
+
+/// Run a command buffer of native-endian 32-bit words, stopping at the
+/// first command that fails. Bytes need not be aligned.
+fn runGlCommands(bytes: []const u8) ?SubmitFailure {
+    const count = bytes.len / 4;
+    var pos: usize = 0;
+    while (pos < count) {
+        const op: GlOp = @enumFromInt(std.mem.readInt(u32, bytes[pos * 4 ..][0..4], builtin.cpu.arch.endian()));
+        const arg_count = glOpArgCount(op) orelse return .{ .offset = pos, .message = "unknown opcode" };
+        if (pos + 1 + arg_count > count) return .{ .offset = pos, .message = "truncated command" };
+        var args: [MaxGlOpArgs]u32 = undefined;
+        for (args[0..arg_count], 0..) |*arg, i| {
+            arg.* = std.mem.readInt(u32, bytes[(pos + 1 + i) * 4 ..][0..4], builtin.cpu.arch.endian());
+        }
+        runGlOp(op, args[0..arg_count]) catch |err| {
+            return .{ .offset = pos, .message = glCallErrorMessage(err) };
+        };
+        pos += 1 + arg_count;
+    }
+    return null;
+}
+
+/// gl.__submit(commands, length): run the first `length` words of an
+/// Int32Array (or ArrayBuffer) of GlOp commands in one native call. A
+/// failing command throws a TypeError naming its word offset; the commands
+/// before it have run and the ones after it are dropped.
+export fn js_gl_submit(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv: [*]c.JSValue) callconv(.c) c.JSValue {
+    if (argc < 2) return throwTypeError(ctx, "__submit requires (commands, length)");
+    var len: u32 = 0;
+    if (c.JS_ToUint32(ctx, &len, argv[1]) != 0) return c.JS_EXCEPTION;
+    // Borrowed until the next JS allocation; commands allocate none
+    const bytes = borrowArrayBytes(ctx, argv[0]) orelse {
+        return throwTypeError(ctx, "__submit requires an Int32Array or ArrayBuffer");
     };
-    webgl_program.globalProgramTable().setUniformFloats(prog, loc, temp[0..count]) catch {
-        return c.JS_UNDEFINED;
+    const byte_len = @as(usize, len) * 4;
+    if (byte_len > bytes.len) return throwTypeError(ctx, "__submit length exceeds the buffer");
+    const failure = runGlCommands(bytes[0..byte_len]) orelse return c.JS_UNDEFINED;
+    var msg_buf: [128]u8 = undefined;
+    const msg = std.fmt.bufPrintZ(&msg_buf, "__submit: {s} (command at word {d})", .{ failure.message, failure.offset }) catch {
+        return throwTypeError(ctx, failure.message);
     };
-    return c.JS_UNDEFINED;
+    return throwTypeError(ctx, msg);
 }
 
 // =============================================================================
@@ -3928,6 +8601,13 @@ export fn js_gl_uniform4fv(ctx: *c.JSContext, _: *c.JSValue, argc: c_int, argv:
 
 const testing = std.testing;
 
+/// webgl_draw.reset() plus the binding-side shadow state, which would
+/// otherwise skip setters whose values only the draw state forgot.
+fn resetDrawState() void {
+    webgl_draw.reset();
+    g_gl_state = .{};
+}
+
 test "Runtime creates and destroys" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -3936,6 +8616,28 @@ test "Runtime creates and destroys" {
     rt.makeCurrent();
 }
 
+test "Runtime is handed between threads without a lock" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    const Worker = struct {
+        fn run(runtime: *Runtime, out: *i32) void {
+            runtime.acquireThread() catch return;
+            defer runtime.releaseThread();
+            out.* = runtime.evalInt("6 * 7", "worker") catch -1;
+        }
+    };
+    var result: i32 = 0;
+    rt.releaseThread();
+    const thread = try std.Thread.spawn(.{}, Worker.run, .{ &rt, &result });
+    thread.join();
+    try rt.acquireThread();
+    try testing.expectEqual(@as(i32, 42), result);
+}
+
 test "setClearColor updates shared state" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -3953,15 +8655,531 @@ test "setClearColor updates shared state" {
 test "requestAnimationFrame schedules and fires" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
-    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval("var raf_called = 0; requestAnimationFrame(function(ts){ raf_called = 1; });", "test");
+    rt.tick(16.0);
+
+    const called = try rt.evalInt("raf_called", "test");
+    try testing.expectEqual(@as(i32, 1), called);
+}
+
+test "timers and animation frames are unbounded and keep task order" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 256 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var log = [], fired = 0, ticks = 0;
+        \\for (var i = 0; i < 300; i++) setTimeout(function() { fired++; }, i);
+        \\var stale = setTimeout(function() { log.push('stale'); }, 0);
+        \\clearTimeout(stale);
+        \\setTimeout(function() { log.push('a'); }, 0);
+        \\setTimeout(function() { log.push('b'); setTimeout(function() { log.push('next'); }, 0); }, 0);
+        \\var iv = setInterval(function() { if (++ticks === 3) clearInterval(iv); }, 10);
+        \\requestAnimationFrame(function() {
+        \\  log.push('raf');
+        \\  queueMicrotask(function() { log.push('micro'); });
+        \\  requestAnimationFrame(function() { log.push('raf2'); });
+        \\});
+        \\requestAnimationFrame(function() { log.push('raf1b'); });
+    , "test");
+    // Microtasks run after the callback that queued them; timers and
+    // frames requested by a callback wait for the next tick
+    rt.tick(1.0);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("log.join() === 'a,b,raf,micro,raf1b' ? 1 : 0", "test"));
+    rt.tick(2.0);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("log.join() === 'a,b,raf,micro,raf1b,next,raf2' ? 1 : 0", "test"));
+
+    var t: f64 = 10;
+    while (t <= 300) : (t += 10) rt.tick(t);
+    try testing.expectEqual(@as(i32, 300), try rt.evalInt("fired", "test"));
+    try testing.expectEqual(@as(i32, 3), try rt.evalInt("ticks", "test"));
+    try testing.expectEqual(@as(u32, 0), rt.timers.entries.count());
+}
+
+test "Cleared timers do not pile up in the queue" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 256 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // A debounce: each call cancels the previous, far-off timeout
+    try rt.eval(
+        \\var fired = 0, pending = 0;
+        \\var keep = setTimeout(function() { fired++; }, 5);
+        \\for (var i = 0; i < 500; i++) {
+        \\  clearTimeout(pending);
+        \\  pending = setTimeout(function() { fired += 100; }, 1e9);
+        \\}
+    , "test");
+    try testing.expectEqual(@as(u32, 2), rt.timers.entries.count());
+    try testing.expect(rt.timer_queue.count() <= 4);
+    try testing.expectEqual(@as(?f64, 5), rt.nextTimerDelay(0));
+
+    rt.tick(5);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("fired", "test"));
+    // A cleared entry at the front no longer shortens the wait
+    try rt.eval("clearTimeout(pending); pending = setTimeout(function() {}, 50);", "test");
+    try testing.expectEqual(@as(?f64, 50), rt.nextTimerDelay(5));
+    try rt.eval("clearTimeout(pending);", "test");
+    try testing.expectEqual(@as(?f64, null), rt.nextTimerDelay(5));
+    try testing.expectEqual(@as(usize, 0), rt.timer_queue.count());
+}
+
+test "Runtime runs a precompiled bytecode bundle" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const entry = try Runtime.compileBytecode(allocator,
+        \\load('./lib/math.js');
+        \\var answer = double(libValue);
+    , "game.js");
+    defer allocator.free(entry);
+    const lib = try Runtime.compileBytecode(allocator,
+        \\var libValue = 21;
+        \\function double(x) { return x * 2; }
+        \\function greet(name) { return 'hello ' + name; }
+    , "lib/math.js");
+    defer allocator.free(lib);
+
+    var aw: std.Io.Writer.Allocating = .init(allocator);
+    defer aw.deinit();
+    try bytecode_bundle.writeBundle(&.{
+        .{ .name = "game.js", .code = entry },
+        .{ .name = "lib/math.js", .code = lib },
+    }, &aw.writer);
+    const bytes = try allocator.alignedAlloc(u8, std.mem.Alignment.fromByteUnits(bytecode_bundle.CodeAlignment), aw.written().len);
+    @memcpy(bytes, aw.written());
+
+    var rt = try Runtime.init(allocator, 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // Bytecode goes in before the DOM stubs parse any source
+    try rt.loadBytecode(bytes);
+    try rt.installDomStubs();
+    try rt.runBytecodeEntry();
+
+    try testing.expectEqual(@as(i32, 42), try rt.evalInt("answer", "test"));
+    // Source parsed later shares atoms with the loaded bytecode
+    try testing.expectEqual(@as(i32, 11), try rt.evalInt("greet('world').length", "test"));
+    try testing.expectError(error.BytecodeAlreadyLoaded, rt.loadBytecode(
+        try allocator.alignedAlloc(u8, std.mem.Alignment.fromByteUnits(bytecode_bundle.CodeAlignment), 16),
+    ));
+}
+
+test "Runtime property cache hits on monomorphic field access" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\function Vec(x, y) { this.x = x; this.y = y; }
+        \\Vec.prototype.dot = function (o) { return this.x * o.x + this.y * o.y; };
+        \\var vs = [];
+        \\for (var i = 0; i < 32; i++) vs.push(new Vec(i, 1));
+    , "test");
+    rt.resetPropertyCacheStats();
+    try rt.eval(
+        \\var sum = 0;
+        \\for (var i = 0; i < vs.length; i++) { vs[i].x += 1; sum += vs[i].dot(vs[0]); }
+    , "test");
+    // Element i contributes (i + 1) * 1 + 1 * 1
+    try testing.expectEqual(@as(i32, 560), try rt.evalInt("sum", "test"));
+
+    const stats = rt.propertyCacheStats();
+    // Every Vec has the same layout, so each site misses about once
+    try testing.expect(stats.hits > 32 * 4);
+    try testing.expect(stats.misses < stats.hits / 4);
+
+    try rt.eval("var reported = __propertyCacheStats(true);", "test");
+    try testing.expect(rt.propertyCacheStats().hits < stats.hits);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("reported.hits > 0 ? 1 : 0", "test"));
+}
+
+test "JS typed arrays copy, fill and convert natively" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var te = new Float32Array(16);
+        \\te.fill(2, 4, 8);
+        \\te.set([1, 2, 3], 13);
+        \\te.set(new Int16Array([-1, 7]), 0);
+        \\te.copyWithin(8, 4, 6);
+        \\var sum = 0;
+        \\for (var i = 0; i < te.length; i++) sum += te[i] * (i + 1);
+        \\var bytes = new Uint8Array(4).fill(257);
+    , "test");
+    // -1*1 + 7*2 + 2*(5+6+7+8) + 2*(9+10) + 1*14 + 2*15 + 3*16
+    try testing.expectEqual(@as(i32, 195), try rt.evalInt("sum", "test"));
+    try testing.expectEqual(@as(i32, 4), try rt.evalInt("bytes[0] + bytes[1] + bytes[2] + bytes[3]", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("te.subarray(4, 6).fill(0) === undefined ? 0 : 1", "test"));
+}
+
+test "JS native math matches Three.js Matrix4 math" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\function mulJs(a, b) {
+        \\  var o = [];
+        \\  for (var c = 0; c < 4; c++) for (var r = 0; r < 4; r++)
+        \\    o[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+        \\  return o;
+        \\}
+        \\var a = [], b = [];
+        \\for (var i = 0; i < 16; i++) { a.push(i * 0.1 - 0.7); b.push(1 / (i + 3)); }
+        \\var expected = mulJs(a, b);
+        \\var out = new Array(16);
+        \\var same = __mat4Multiply(out, a, b) === out ? 1 : 0;
+        \\for (var i = 0; i < 16; i++) if (out[i] !== expected[i]) same = 0;
+        \\// In place, and into a bone palette at matrix 1
+        \\__mat4Multiply(a, a, b);
+        \\for (var i = 0; i < 16; i++) if (a[i] !== expected[i]) same = 0;
+        \\var palette = new Float32Array(32);
+        \\__mat4Multiply(palette, [1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1], b, 16);
+        \\if (palette[15] !== 0 || palette[16] !== Math.fround(b[0])) same = 0;
+        \\// Quarter turn about Z, scaled by 2, translated to (1, 2, 3)
+        \\var s = Math.sqrt(0.5), m = [];
+        \\__mat4Compose(m, 1, 2, 3, 0, 0, s, s, 2, 2, 2);
+        \\var composed = Math.round(m[1]) === 2 && Math.round(m[4]) === -2 && m[10] === 2 && m[13] === 2 && m[15] === 1;
+        \\// Two mats times identity; one sphere in the unit box, one outside
+        \\var mats = new Float32Array(32), prod = new Float32Array(32);
+        \\for (var i = 0; i < 32; i++) mats[i] = i % 5;
+        \\__mat4ArrayMultiply(prod, mats, new Float32Array([1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1]));
+        \\var batched = prod[7] === mats[7] && prod[31] === mats[31];
+        \\var planes = [1,0,0,1, -1,0,0,1, 0,1,0,1, 0,-1,0,1, 0,0,1,1, 0,0,-1,1];
+        \\var hits = new Uint8Array(2);
+        \\var inside = __frustumIntersectSpheres(planes, new Float32Array([0, 0, 0, 0.5, 0, 0, -3, 0.5]), hits);
+        \\var culled = inside === 1 && hits[0] === 1 && hits[1] === 0;
+        \\var threw = 0;
+        \\try { __mat4Multiply(palette, a, b, 24); } catch (e) { threw = 1; }
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("same", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("composed ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("batched ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("culled ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("threw", "test"));
+}
+
+test "JS batched math splits large batches into jobs" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 512 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // 3000 spheres, every third outside the unit box
+    try rt.eval(
+        \\var n = 3000, spheres = new Float32Array(n * 4), hits = new Uint8Array(n);
+        \\for (var i = 0; i < n; i++) { spheres[i * 4] = i % 3 === 0 ? 5 : 0; spheres[i * 4 + 3] = 0.5; }
+        \\var planes = [1,0,0,1, -1,0,0,1, 0,1,0,1, 0,-1,0,1, 0,0,1,1, 0,0,-1,1];
+        \\var inside = __frustumIntersectSpheres(planes, spheres, hits);
+        \\var flags = 1;
+        \\for (var i = 0; i < n; i++) if (hits[i] !== (i % 3 === 0 ? 0 : 1)) flags = 0;
+        \\var mats = new Float32Array(600 * 16), prod = new Float32Array(600 * 16);
+        \\for (var i = 0; i < mats.length; i++) mats[i] = i % 7;
+        \\__mat4ArrayMultiply(prod, mats, new Float32Array([2,0,0,0, 0,2,0,0, 0,0,2,0, 0,0,0,1]));
+        \\var scaled = prod[16] === 2 * mats[16] && prod[599 * 16 + 5] === 2 * mats[599 * 16 + 5];
+    , "test");
+    try testing.expectEqual(@as(i32, 2000), try rt.evalInt("inside", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("flags", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("scaled ? 1 : 0", "test"));
+}
+
+test "Worker runs on its own context and exchanges cloned messages" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 512 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var source = "onmessage = function(e) {" +
+        \\  "  if (e.data === 'throw') throw new Error('boom');" +
+        \\  "  var d = e.data;" +
+        \\  "  postMessage({ sum: d.a + d.b, bytes: new Uint8Array(d.buffer).length, second: d.view[1]," +
+        \\  "    undef: d.u === undefined && 'u' in d, nan: d.n !== d.n }, [d.buffer]);" +
+        \\  "};";
+        \\var worker = new Worker(URL.createObjectURL(new Blob([source])), { heapMB: 2 });
+        \\var reply = null, failure = null;
+        \\worker.onmessage = function(e) { reply = e.data; };
+        \\worker.onerror = function(e) { failure = e.message; };
+        \\var buf = new ArrayBuffer(8);
+        \\worker.postMessage({ a: 2, b: 40, buffer: buf, view: new Float32Array([1.5, 2.5]), u: undefined, n: NaN }, [buf]);
+    , "test");
+    try tickUntil(&rt, "reply !== null");
+    try testing.expectEqual(@as(i32, 42), try rt.evalInt("reply.sum", "test"));
+    try testing.expectEqual(@as(i32, 8), try rt.evalInt("reply.bytes", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("reply.second === 2.5 && reply.undef && reply.nan ? 1 : 0", "test"));
+    // Buffers are copied across heaps, so the sender keeps its own
+    try testing.expectEqual(@as(i32, 8), try rt.evalInt("buf.byteLength", "test"));
+
+    // An uncaught exception in the worker reaches onerror
+    try rt.eval("worker.postMessage('throw');", "test");
+    try tickUntil(&rt, "failure !== null");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("failure.indexOf('boom') >= 0 ? 1 : 0", "test"));
+    try rt.eval("worker.terminate();", "test");
+}
+
+test "Structured clone carries Date, RegExp, Error, Map and Set" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 256 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try installStructuredClone(rt.ctx);
+
+    try rt.eval(
+        \\function clone(v) { var c = __cloneEncode(v); return __cloneDecode(c.json, c.buffers); }
+        \\function failsToClone(f) {
+        \\  try { f(); } catch (e) { return e.name === 'DataCloneError'; }
+        \\  return false;
+        \\}
+        \\var re = clone({ r: /a+b/gi }).r;
+        \\var range = clone(new RangeError('too far'));
+        \\var custom = new Error('bad');
+        \\custom.name = 'LoadError';
+        \\custom = clone(custom);
+        \\// The engine has no Date instances or collections; scripts bring their own
+        \\globalThis.Date = function(t) { this._t = t; };
+        \\Date.prototype.getTime = function() { return this._t; };
+        \\globalThis.Map = function() { this._k = []; this._v = []; };
+        \\Map.prototype.set = function(k, v) { this._k.push(k); this._v.push(v); return this; };
+        \\Map.prototype.forEach = function(f) { for (var i = 0; i < this._k.length; i++) f(this._v[i], this._k[i], this); };
+        \\globalThis.Set = function() { this._v = []; };
+        \\Set.prototype.add = function(v) { this._v.push(v); return this; };
+        \\Set.prototype.forEach = function(f) { for (var i = 0; i < this._v.length; i++) f(this._v[i], this._v[i], this); };
+        \\var date = clone([new Date(1234.5)])[0];
+        \\var results = new Map().set('a', { hits: 3 }).set(7, new Set().add('x').add(undefined));
+        \\var map = clone(results);
+        \\var cyclicFails = failsToClone(function() { var m = new Map(); m.set('self', m); __cloneEncode(m); });
+        \\var encodedMap = __cloneEncode(results);
+        \\delete globalThis.Map;
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("re instanceof RegExp && re.source === 'a+b' && re.flags === 'gi' && re.test('xAAB') ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("range instanceof RangeError && range.message === 'too far' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("custom instanceof Error && custom.name === 'LoadError' && custom.message === 'bad' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("date instanceof Date && date.getTime() === 1234.5 ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("map !== results && map._k.join() === 'a,7' && map._v[0].hits === 3 ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("map._v[1] instanceof Set && map._v[1]._v.length === 2 && map._v[1]._v[1] === undefined ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("cyclicFails ? 1 : 0", "test"));
+    // A receiver without the collection rejects it instead of handing back {}
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("failsToClone(function() { __cloneDecode(encodedMap.json, encodedMap.buffers); }) ? 1 : 0", "test"));
+}
+
+test "Worker inherits the asset root and has no GL context" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 512 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+    try rt.setAssetRoot("/tmp");
+
+    try rt.eval(
+        \\var source = "postMessage([typeof gl, typeof setClearColor, typeof nativeRenderInfo, typeof __dom_getContext]);";
+        \\var worker = new Worker(URL.createObjectURL(new Blob([source])), { heapMB: 2 });
+        \\var reply = null;
+        \\worker.onmessage = function(e) { reply = e.data.join(); };
+    , "test");
+    const id: u32 = @intCast(try rt.evalInt("worker._id", "test"));
+    const worker = findWebWorker(id) orelse return error.TestUnexpectedResult;
+    try testing.expectEqualStrings(rt.getAssetRoot(), worker.asset_root[0..worker.asset_root_len]);
+
+    try tickUntil(&rt, "reply !== null");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("reply === 'undefined,undefined,undefined,undefined' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("typeof gl === 'object' ? 1 : 0", "test"));
+    try rt.eval("worker.terminate();", "test");
+}
+
+/// Tick the runtime until `condition` holds, for up to two seconds.
+fn tickUntil(rt: *Runtime, comptime condition: []const u8) !void {
+    var elapsed_ms: usize = 0;
+    while (elapsed_ms < 2000) : (elapsed_ms += 1) {
+        rt.tick(@floatFromInt(elapsed_ms));
+        if (try rt.evalInt("(" ++ condition ++ ") ? 1 : 0", "test") == 1) return;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    return error.Timeout;
+}
+
+test "Runtime collects garbage in idle time once the heap fills" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // A mostly empty heap is left alone
+    try testing.expect(!rt.collectIdle(1000));
+    // Garbage up to about three quarters of the heap, short of a forced GC
+    try rt.eval(
+        \\var junk;
+        \\function churn() { for (var i = 0; i < 40; i++) junk = [i, i + 1, i + 2, { v: i }]; }
+    , "test");
+    var rounds: usize = 0;
+    while (rounds < 200 and rt.gcStats().heap_bytes * 4 < rt.gcStats().total_bytes * 3) : (rounds += 1) {
+        try rt.eval("churn();", "test");
+    }
+    const before = rt.gcStats();
+    try testing.expectEqual(@as(u32, 0), before.forced_count);
+    try testing.expect(rt.collectIdle(1000));
+
+    const after = rt.gcStats();
+    try testing.expectEqual(@as(u32, 1), after.idle_count);
+    try testing.expect(after.heap_bytes < before.heap_bytes);
+    try testing.expectEqual(after.heap_bytes, after.live_bytes);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("__gcStats().idle", "test"));
+}
+
+test "JS nativeRenderInfo reports flush counters and CPU pool use" {
+    resetDrawState();
+    defer resetDrawState();
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var b = gl.createBuffer();
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, b);
+        \\gl.bufferData(gl.ARRAY_BUFFER, new Float32Array(1024), gl.STATIC_DRAW);
+        \\var info = nativeRenderInfo();
+        \\var ok_frame = (info.frame.draws === 0 && info.frame.pipelineMisses === 0 &&
+        \\  typeof info.frame.bufferUploadBytes === 'number') ? 1 : 0;
+        \\var ok_totals = (typeof info.pipelines.misses === 'number' &&
+        \\  typeof info.uploads.textureBytes === 'number') ? 1 : 0;
+        \\// Without a GPU backend the buffer's bytes stay in the CPU pool
+        \\var used = info.bufferPool.usedBytes;
+        \\var ok_pool = (used >= 4096 && info.bufferPool.peakBytes >= used &&
+        \\  info.bufferPool.capacityBytes >= used && info.texturePool.capacityBytes > 0) ? 1 : 0;
+        \\gl.deleteBuffer(b);
+        \\var after = nativeRenderInfo().bufferPool;
+        \\var ok_peak = (after.usedBytes < used && after.peakBytes >= used) ? 1 : 0;
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_frame", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_totals", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_pool", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_peak", "test"));
+}
+
+test "JS nativeRenderInfo frame counters cover the latest flush only" {
+    resetDrawState();
+    defer resetDrawState();
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var vs = gl.createShader(gl.VERTEX_SHADER);
+        \\gl.shaderSource(vs, "attribute vec3 position; void main() { gl_Position = vec4(position, 1.0); }");
+        \\gl.compileShader(vs);
+        \\var fs = gl.createShader(gl.FRAGMENT_SHADER);
+        \\gl.shaderSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+        \\gl.compileShader(fs);
+        \\var p = gl.createProgram();
+        \\gl.attachShader(p, vs);
+        \\gl.attachShader(p, fs);
+        \\gl.linkProgram(p);
+        \\gl.useProgram(p);
+        \\var b = gl.createBuffer();
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, b);
+        \\gl.bufferData(gl.ARRAY_BUFFER, new Float32Array(9), gl.STATIC_DRAW);
+        \\gl.enableVertexAttribArray(0);
+        \\gl.vertexAttribPointer(0, 3, gl.FLOAT, false, 0, 0);
+        \\function drawTimes(n) { for (var i = 0; i < n; i++) gl.drawArrays(gl.TRIANGLES, 0, 3); }
+        \\drawTimes(1);
+    , "test");
+    webgl_draw.flush(.{}, .{}, null);
+    try rt.eval("var first = nativeRenderInfo().frame.commands; drawTimes(3);", "test");
+    webgl_draw.flush(.{}, .{}, null);
+    try rt.eval("var second = nativeRenderInfo().frame.commands;", "test");
+    webgl_draw.flush(.{}, .{}, null);
+    try rt.eval(
+        \\var idle = nativeRenderInfo().frame;
+        \\var ok_idle = (idle.commands === 0 && idle.pipelineMisses === 0 && idle.bufferUploadBytes === 0) ? 1 : 0;
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("first", "test"));
+    try testing.expectEqual(@as(i32, 3), try rt.evalInt("second", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_idle", "test"));
+}
+
+test "Input events are coalesced and dispatched once per tick" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 128 * 1024);
     defer rt.deinit();
     rt.makeCurrent();
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var moves = 0, lastX = -1, raw = 0, keys = '', wheel = 0, first = null, reused = 0;
+        \\window.addEventListener('mousemove', function (e) {
+        \\  moves++; lastX = e.clientX; raw = e.getCoalescedEvents().length;
+        \\  if (first === null) first = e; else if (first === e) reused = 1;
+        \\});
+        \\window.addEventListener('keydown', function (e) { keys += e.key; });
+        \\window.addEventListener('wheel', function (e) { wheel += e.deltaY; });
+    , "test");
+
+    // Nothing reaches JS until the tick
+    for (0..5) |i| queueMouseEvent(.mousemove, .{ .clientX = @intCast(i * 10) });
+    queueKeyboardEvent(.keydown, .{ .key = "a" });
+    queueMouseEvent(.wheel, .{ .deltaY = 120 });
+    queueMouseEvent(.wheel, .{ .deltaY = 120 });
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("moves", "test"));
 
-    try rt.eval("var raf_called = 0; requestAnimationFrame(function(ts){ raf_called = 1; });", "test");
     rt.tick(16.0);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("moves", "test"));
+    try testing.expectEqual(@as(i32, 40), try rt.evalInt("lastX", "test"));
+    try testing.expectEqual(@as(i32, 5), try rt.evalInt("raw", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("keys === 'a' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 240), try rt.evalInt("wheel", "test"));
 
-    const called = try rt.evalInt("raf_called", "test");
-    try testing.expectEqual(@as(i32, 1), called);
+    // The event object is pooled across frames
+    queueMouseEvent(.mousemove, .{ .clientX = 7 });
+    rt.tick(32.0);
+    try testing.expectEqual(@as(i32, 2), try rt.evalInt("moves", "test"));
+    try testing.expectEqual(@as(i32, 7), try rt.evalInt("lastX", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("reused", "test"));
 }
 
 test "document.createElement canvas getContext" {
@@ -4153,7 +9371,35 @@ test "JS gl buffer lifecycle hits backend" {
     try testing.expectEqual(@as(u32, 1), stub.create_calls);
     try testing.expectEqual(@as(u32, 1), stub.update_calls);
     try testing.expectEqual(@as(u32, 1), stub.destroy_calls);
-    try testing.expectEqual(@as(u16, 0), mgr.buffers.count);
+    try testing.expectEqual(@as(u16, 0), mgr.buffers.handles.count);
+}
+
+test "JS gl bufferSubData patches the bound buffer" {
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var b = gl.createBuffer();
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, b);
+        \\gl.bufferData(gl.ARRAY_BUFFER, new Float32Array(8), gl.DYNAMIC_DRAW);
+        \\gl.bufferSubData(gl.ARRAY_BUFFER, 4, new Float32Array([1, 2, 3]), 1, 2);
+        \\var threw = 0;
+        \\try { gl.bufferSubData(gl.ARRAY_BUFFER, 28, new Float32Array(2)); } catch (e) { threw = 1; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("threw", "test"));
+    const id = mgr.getBoundBuffer(.array) orelse return error.UnexpectedNull;
+    const buf = mgr.buffers.get(id) orelse return error.UnexpectedNull;
+    try testing.expectEqual(webgl.BufferHint.dynamic, buf.hint);
+    try testing.expectEqual(@as(u32, 32), buf.data_len);
+    try testing.expectEqual(@as(u32, 2), buf.update_count);
 }
 
 test "JS gl bufferData accepts typed arrays" {
@@ -4245,6 +9491,397 @@ test "JS element array buffer sets index usage" {
     try testing.expectEqual(@as(u32, 12), buf.data_len);
 }
 
+test "JS gl setters return early on redundant calls" {
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // Each count is calls * 10 + skipped
+    try rt.eval(
+        \\gl.__resetCallStats();
+        \\gl.enable(gl.BLEND);
+        \\gl.enable(gl.BLEND);
+        \\gl.disable(gl.BLEND);
+        \\gl.blendFunc(gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA);
+        \\gl.blendFuncSeparate(gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA, gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA);
+        \\var b = gl.createBuffer();
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, b);
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, b);
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, null);
+        \\gl.bindBuffer(gl.ARRAY_BUFFER, null);
+        \\var s = gl.__getCallStats();
+        \\var enables = s.enable.calls * 10 + s.enable.skipped;
+        \\var disables = s.disable.calls * 10 + s.disable.skipped;
+        \\var blends = s.blendFuncSeparate.calls * 10 + s.blendFuncSeparate.skipped;
+        \\var binds = s.bindBuffer.calls * 10 + s.bindBuffer.skipped;
+        \\gl.__resetCallStats();
+        \\var cleared = gl.__getCallStats().enable.calls;
+    , "test");
+
+    try testing.expectEqual(@as(i32, 21), try rt.evalInt("enables", "test"));
+    try testing.expectEqual(@as(i32, 10), try rt.evalInt("disables", "test"));
+    try testing.expectEqual(@as(i32, 11), try rt.evalInt("blends", "test"));
+    try testing.expectEqual(@as(i32, 42), try rt.evalInt("binds", "test"));
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("cleared", "test"));
+    try testing.expect(!g_gl_state.enabled_blend);
+    try testing.expectEqual(@as(u32, GL_SRC_ALPHA), g_gl_state.blend_src_alpha);
+    try testing.expect(mgr.getBoundBuffer(.array) == null);
+}
+
+test "JS gl.__submit runs a command buffer in one call" {
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // GlOp: enable 1, blendFunc 10, polygonOffset 14, bindBuffer 17
+    try rt.eval(
+        \\var b = gl.createBuffer();
+        \\var words = new ArrayBuffer(64);
+        \\var ints = new Int32Array(words), floats = new Float32Array(words);
+        \\ints[0] = 1; ints[1] = gl.BLEND;
+        \\ints[2] = 10; ints[3] = gl.SRC_ALPHA; ints[4] = gl.ONE_MINUS_SRC_ALPHA;
+        \\ints[5] = 14; floats[6] = 1.5; floats[7] = -2;
+        \\ints[8] = 17; ints[9] = gl.ARRAY_BUFFER; ints[10] = b;
+        \\gl.__submit(ints, 11);
+        \\ints[0] = 1; ints[1] = gl.DEPTH_TEST;
+        \\ints[2] = 99;
+        \\ints[3] = 1; ints[4] = gl.CULL_FACE;
+        \\var error = '';
+        \\try { gl.__submit(ints, 5); } catch (e) { error = String(e); }
+        \\var failed = error.indexOf('unknown opcode') >= 0 && error.indexOf('word 2') >= 0 ? 1 : 0;
+        \\var truncated = 0;
+        \\ints[0] = 10; ints[1] = gl.ONE;
+        \\try { gl.__submit(ints, 2); } catch (e) { truncated = String(e).indexOf('truncated') >= 0 ? 1 : 0; }
+    , "test");
+
+    try testing.expect(g_gl_state.enabled_blend);
+    try testing.expectEqual(@as(u32, GL_SRC_ALPHA), g_gl_state.blend_src);
+    try testing.expectEqual([2]f32{ 1.5, -2 }, g_gl_state.polygon_offset);
+    const b: u32 = @intCast(try rt.evalInt("b", "test"));
+    try testing.expect(std.meta.eql(bufferIdFromU32(b), mgr.getBoundBuffer(.array).?));
+    // Commands before the failing one ran, the ones after it did not
+    try testing.expect(g_gl_state.enabled_depth_test);
+    try testing.expect(!g_gl_state.enabled_cull_face);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("failed", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("truncated", "test"));
+}
+
+test "JS createBatchedContext from the Three.js entry batches setters around draws" {
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+    var rt = try Runtime.init(allocator, 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // The wrapper as shipped: GL_OP and createBatchedContext run as a
+    // plain script, without the Three.js imports around them
+    const entry = try std.fs.cwd().readFileAlloc(allocator, "examples/three-entry.js", 1 << 20);
+    defer allocator.free(entry);
+    const begin = std.mem.indexOf(u8, entry, "var GL_OP") orelse return error.TestUnexpectedResult;
+    const end = std.mem.indexOfPos(u8, entry, begin, "\nexport {") orelse return error.TestUnexpectedResult;
+    const wrapper = try allocator.dupeZ(u8, entry[begin..end]);
+    defer allocator.free(wrapper);
+    try rt.eval(wrapper, "three-entry.js");
+
+    try rt.eval(
+        \\var bgl = createBatchedContext(gl);
+        \\var ok_wrapped = (bgl !== gl && bgl.TRIANGLES === gl.TRIANGLES) ? 1 : 0;
+        \\var vs = bgl.createShader(bgl.VERTEX_SHADER);
+        \\bgl.shaderSource(vs, "attribute vec3 position; attribute vec3 offset; void main() { gl_Position = vec4(position + offset, 1.0); }");
+        \\bgl.compileShader(vs);
+        \\var fs = bgl.createShader(bgl.FRAGMENT_SHADER);
+        \\bgl.shaderSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+        \\bgl.compileShader(fs);
+        \\var p = bgl.createProgram();
+        \\bgl.attachShader(p, vs);
+        \\bgl.attachShader(p, fs);
+        \\bgl.linkProgram(p);
+        \\var position = bgl.getAttribLocation(p, 'position');
+        \\var offset = bgl.getAttribLocation(p, 'offset');
+        \\var buf = bgl.createBuffer();
+        \\bgl.bindBuffer(bgl.ARRAY_BUFFER, buf);
+        \\bgl.bufferData(bgl.ARRAY_BUFFER, new Float32Array(12), bgl.STATIC_DRAW);
+        \\bgl.useProgram(p);
+        \\bgl.enableVertexAttribArray(position);
+        \\bgl.vertexAttribPointer(position, 3, bgl.FLOAT, false, 0, 0);
+        \\bgl.enable(bgl.BLEND);
+        \\bgl.blendFunc(bgl.SRC_ALPHA, bgl.ONE_MINUS_SRC_ALPHA);
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_wrapped", "test"));
+    // Setters are still in the buffer
+    try testing.expect(!g_gl_state.enabled_blend);
+    try testing.expect(webgl_draw.currentProgram() == null);
+
+    try rt.eval(
+        \\bgl.drawArrays(bgl.TRIANGLES, 0, 3);
+        \\var ext = bgl.getExtension('ANGLE_instanced_arrays');
+        \\bgl.enableVertexAttribArray(offset);
+        \\bgl.vertexAttribPointer(offset, 3, bgl.FLOAT, false, 0, 0);
+        \\ext.vertexAttribDivisorANGLE(offset, 1);
+        \\ext.drawArraysInstancedANGLE(bgl.TRIANGLES, 0, 3, 4);
+        \\bgl.disable(bgl.BLEND);
+    , "test");
+    // Each draw ran after the setters recorded before it
+    try testing.expectEqual(@as(usize, 2), webgl_draw.pendingCommandCount());
+    try testing.expectEqual(@as(u32, GL_SRC_ALPHA), g_gl_state.blend_src);
+    const p: u32 = @intCast(try rt.evalInt("p", "test"));
+    try testing.expect(std.meta.eql(programIdFromU32(p), webgl_draw.currentProgram().?));
+    // Any call the wrapper does not encode submits what is pending
+    try testing.expect(g_gl_state.enabled_blend);
+    try rt.eval("bgl.getError();", "test");
+    try testing.expect(!g_gl_state.enabled_blend);
+}
+
+test "JS vertex arrays keep their own element array binding" {
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var vao = gl.createVertexArray();
+        \\gl.bindVertexArray(vao);
+        \\var b = gl.createBuffer();
+        \\gl.bindBuffer(gl.ELEMENT_ARRAY_BUFFER, b);
+        \\gl.bindVertexArray(null);
+    , "test");
+    try testing.expect(mgr.getBoundBuffer(.element_array) == null);
+    try rt.eval("gl.bindVertexArray(vao);", "test");
+    const id: webgl.BufferId = bufferIdFromU32(@intCast(try rt.evalInt("b", "test")));
+    try testing.expect(mgr.getBoundBuffer(.element_array).? == id);
+
+    // Deleting the bound array falls back to the default one, which has none
+    try rt.eval(
+        \\gl.deleteVertexArray(vao);
+        \\var stale = 0;
+        \\try { gl.bindVertexArray(vao); } catch (e) { stale = 1; }
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("stale", "test"));
+    try testing.expect(mgr.getBoundBuffer(.element_array) == null);
+}
+
+test "JS framebuffers report completeness from their attachments" {
+    const tex_mgr = webgl_texture.globalTextureManager();
+    tex_mgr.reset();
+    defer tex_mgr.reset();
+    webgl_framebuffer.reset();
+    defer webgl_framebuffer.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var fb = gl.createFramebuffer();
+        \\gl.bindFramebuffer(gl.FRAMEBUFFER, fb);
+        \\var empty = gl.checkFramebufferStatus(gl.FRAMEBUFFER);
+        \\var color = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, color);
+        \\gl.texImage2D(gl.TEXTURE_2D, 0, gl.RGBA, 64, 64, 0, gl.RGBA, gl.UNSIGNED_BYTE, null);
+        \\gl.framebufferTexture2D(gl.FRAMEBUFFER, gl.COLOR_ATTACHMENT0, gl.TEXTURE_2D, color, 0);
+        \\var rb = gl.createRenderbuffer();
+        \\gl.bindRenderbuffer(gl.RENDERBUFFER, rb);
+        \\gl.renderbufferStorage(gl.RENDERBUFFER, gl.DEPTH_COMPONENT16, 32, 32);
+        \\gl.framebufferRenderbuffer(gl.FRAMEBUFFER, gl.DEPTH_ATTACHMENT, gl.RENDERBUFFER, rb);
+        \\var mismatched = gl.checkFramebufferStatus(gl.FRAMEBUFFER);
+        \\gl.renderbufferStorage(gl.RENDERBUFFER, gl.DEPTH_COMPONENT16, 64, 64);
+        \\var complete = gl.checkFramebufferStatus(gl.FRAMEBUFFER);
+        \\var depth = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, depth);
+        \\gl.texImage2D(gl.TEXTURE_2D, 0, gl.DEPTH_COMPONENT24, 64, 64, 0, gl.DEPTH_COMPONENT, gl.UNSIGNED_INT, null);
+        \\var shadow = gl.createFramebuffer();
+        \\gl.bindFramebuffer(gl.FRAMEBUFFER, shadow);
+        \\gl.framebufferTexture2D(gl.FRAMEBUFFER, gl.DEPTH_ATTACHMENT, gl.TEXTURE_2D, depth, 0);
+        \\var depth_only = gl.checkFramebufferStatus(gl.FRAMEBUFFER);
+        \\gl.bindFramebuffer(gl.FRAMEBUFFER, null);
+        \\var window = gl.checkFramebufferStatus(gl.FRAMEBUFFER);
+        \\gl.deleteFramebuffer(fb);
+        \\var stale = 0;
+        \\try { gl.bindFramebuffer(gl.FRAMEBUFFER, fb); } catch (e) { stale = 1; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 0x8CD7), try rt.evalInt("empty", "test"));
+    try testing.expectEqual(@as(i32, 0x8CD9), try rt.evalInt("mismatched", "test"));
+    try testing.expectEqual(@as(i32, 0x8CD5), try rt.evalInt("complete", "test"));
+    try testing.expectEqual(@as(i32, 0x8CD5), try rt.evalInt("depth_only", "test"));
+    try testing.expectEqual(@as(i32, 0x8CD5), try rt.evalInt("window", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("stale", "test"));
+
+    // Depth textures have no CPU copy and are drawn into, not uploaded
+    const depth_id = webgl_texture.TextureId.fromU32(@bitCast(try rt.evalInt("depth", "test")));
+    const tex = tex_mgr.getTexture(depth_id) orelse return error.UnexpectedNull;
+    try testing.expectEqual(webgl_texture.TextureFormat.depth_component, tex.format);
+    try testing.expect(tex.render_target);
+    try testing.expect(tex_mgr.textures.getPixelData(depth_id) == null);
+}
+
+test "JS queries wrap recorded draws and report results asynchronously" {
+    resetDrawState();
+    defer resetDrawState();
+    webgl_query.reset(false);
+    defer webgl_query.reset(false);
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var ext = gl.getExtension("EXT_disjoint_timer_query_webgl2");
+        \\var q = gl.createQuery();
+        \\var is_query = gl.isQuery(q) ? 1 : 0;
+        \\gl.beginQuery(ext.TIME_ELAPSED_EXT, q);
+        \\var current = gl.getQuery(ext.TIME_ELAPSED_EXT, gl.CURRENT_QUERY) === q ? 1 : 0;
+        \\gl.endQuery(ext.TIME_ELAPSED_EXT);
+        \\var ended = gl.getQuery(ext.TIME_ELAPSED_EXT, gl.CURRENT_QUERY) === null ? 1 : 0;
+        \\var available = gl.getQueryParameter(q, gl.QUERY_RESULT_AVAILABLE) ? 1 : 0;
+        \\var bits = gl.getQuery(ext.TIMESTAMP_EXT, ext.QUERY_COUNTER_BITS_EXT);
+        \\var disjoint = gl.getParameter(ext.GPU_DISJOINT_EXT) ? 1 : 0;
+        \\var ts = gl.createQuery();
+        \\ext.queryCounterEXT(ts, ext.TIMESTAMP_EXT);
+        \\var bad = 0;
+        \\try { gl.beginQuery(gl.ANY_SAMPLES_PASSED, 12345); } catch (e) { bad = 1; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("is_query", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("current", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ended", "test"));
+    // Nothing is read back before a later flush
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("available", "test"));
+    try testing.expectEqual(@as(i32, 64), try rt.evalInt("bits", "test"));
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("disjoint", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("bad", "test"));
+    try testing.expectEqual(@as(u64, 2), webgl_query.stats().issued);
+}
+
+test "JS readPixels fills a pack buffer behind a fence sync" {
+    resetDrawState();
+    defer resetDrawState();
+    webgl_readback.reset(false);
+    defer webgl_readback.reset(false);
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var pbo = gl.createBuffer();
+        \\gl.bindBuffer(gl.PIXEL_PACK_BUFFER, pbo);
+        \\gl.bufferData(gl.PIXEL_PACK_BUFFER, new Uint8Array([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16]), gl.STREAM_READ);
+        \\gl.readPixels(0, 0, 2, 2, gl.RGBA, gl.UNSIGNED_BYTE, 0);
+        \\var sync = gl.fenceSync(gl.SYNC_GPU_COMMANDS_COMPLETE, 0);
+        \\var is_sync = gl.isSync(sync) ? 1 : 0;
+        \\var waiting = gl.clientWaitSync(sync, 0, 0) === gl.TIMEOUT_EXPIRED ? 1 : 0;
+        \\var unsignaled = gl.getSyncParameter(sync, gl.SYNC_STATUS) === gl.UNSIGNALED ? 1 : 0;
+        \\var max_wait = gl.getParameter(gl.MAX_CLIENT_WAIT_TIMEOUT_WEBGL);
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("is_sync", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("waiting", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("unsignaled", "test"));
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("max_wait", "test"));
+    try testing.expectEqual(@as(u64, 1), webgl_readback.stats().issued);
+
+    // A frame that never reached the GPU leaves nothing to wait for
+    webgl_readback.endFrame(false);
+    try rt.eval(
+        \\var done = gl.clientWaitSync(sync, 0, 0) === gl.ALREADY_SIGNALED ? 1 : 0;
+        \\var out = new Uint8Array(8);
+        \\gl.getBufferSubData(gl.PIXEL_PACK_BUFFER, 4, out, 2, 4);
+        \\var copied = out[1] === 0 && out[2] === 5 && out[5] === 8 && out[6] === 0 ? 1 : 0;
+        \\gl.deleteSync(sync);
+        \\var deleted = gl.isSync(sync) ? 0 : 1;
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("done", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("copied", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("deleted", "test"));
+}
+
+test "JS readPixels into client memory reports errors through getError" {
+    resetDrawState();
+    defer resetDrawState();
+    webgl_readback.reset(false);
+    defer webgl_readback.reset(false);
+    webgl_framebuffer.setSwapchainSamples(4);
+    defer webgl_framebuffer.setSwapchainSamples(1);
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var pixels = new Uint8Array(16);
+        \\var none = gl.getError() === gl.NO_ERROR ? 1 : 0;
+        \\gl.readPixels(0, 0, 2, 2, gl.RGBA, gl.UNSIGNED_BYTE, pixels);
+        \\var msaa = gl.getError() === gl.INVALID_OPERATION ? 1 : 0;
+        \\var cleared = gl.getError() === gl.NO_ERROR ? 1 : 0;
+        \\gl.readPixels(0, 0, -1, 2, gl.RGBA, gl.UNSIGNED_BYTE, pixels);
+        \\gl.readPixels(0, 0, 2, 2, gl.RGBA, gl.UNSIGNED_BYTE, pixels);
+        \\var first = gl.getError() === gl.INVALID_VALUE ? 1 : 0;
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("none", "test"));
+    // The multisampled default framebuffer cannot be read without a resolve
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("msaa", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("cleared", "test"));
+    // The first error is kept until it is read
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("first", "test"));
+
+    // Single-sampled, the read still needs a GPU to submit to
+    webgl_framebuffer.setSwapchainSamples(1);
+    try rt.eval(
+        \\var small = new Uint8Array(8);
+        \\gl.readPixels(0, 0, 2, 2, gl.RGBA, gl.UNSIGNED_BYTE, small);
+        \\var too_small = gl.getError() === gl.INVALID_OPERATION ? 1 : 0;
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("too_small", "test"));
+    try testing.expectEqual(@as(u64, 0), webgl_readback.stats().issued);
+}
+
 test "JS gl shaderSource stores source" {
     const table = webgl_shader.globalShaderTable();
     table.reset();
@@ -4271,10 +9908,162 @@ test "JS gl shaderSource stores source" {
     try testing.expectEqualSlices(u8, src, stored);
 }
 
-test "JS gl compileShader updates status and info log" {
-    const table = webgl_shader.globalShaderTable();
-    table.reset();
-    defer table.reset();
+test "JS gl compileShader updates status and info log" {
+    const table = webgl_shader.globalShaderTable();
+    table.reset();
+    defer table.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var s = gl.createShader(gl.VERTEX_SHADER);
+        \\gl.compileShader(s);
+        \\var status0 = gl.getShaderParameter(s, gl.COMPILE_STATUS) ? 1 : 0;
+        \\var log0 = gl.getShaderInfoLog(s).length;
+        \\gl.shaderSource(s, "void main() {}");
+        \\gl.compileShader(s);
+        \\var status1 = gl.getShaderParameter(s, gl.COMPILE_STATUS) ? 1 : 0;
+        \\var log1 = gl.getShaderInfoLog(s).length;
+    , "test");
+
+    const status0 = try rt.evalInt("status0", "test");
+    const log0 = try rt.evalInt("log0", "test");
+    const status1 = try rt.evalInt("status1", "test");
+    const log1 = try rt.evalInt("log1", "test");
+    try testing.expectEqual(@as(i32, 0), status0);
+    try testing.expect(log0 > 0);
+    try testing.expectEqual(@as(i32, 1), status1);
+    try testing.expectEqual(@as(i32, 0), log1);
+}
+
+test "JS gl program link status reflects shader state" {
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var vs = gl.createShader(gl.VERTEX_SHADER);
+        \\var fs = gl.createShader(gl.FRAGMENT_SHADER);
+        \\gl.shaderSource(vs, "void main() {}");
+        \\gl.shaderSource(fs, "void main() {}");
+        \\gl.compileShader(vs);
+        \\gl.compileShader(fs);
+        \\var p = gl.createProgram();
+        \\gl.attachShader(p, vs);
+        \\gl.attachShader(p, fs);
+        \\gl.linkProgram(p);
+        \\var linked0 = gl.getProgramParameter(p, gl.LINK_STATUS) ? 1 : 0;
+        \\var log0 = gl.getProgramInfoLog(p).length;
+        \\var bad = gl.createProgram();
+        \\gl.attachShader(bad, vs);
+        \\gl.linkProgram(bad);
+        \\var linked1 = gl.getProgramParameter(bad, gl.LINK_STATUS) ? 1 : 0;
+        \\var log1 = gl.getProgramInfoLog(bad).length;
+    , "test");
+
+    const linked0 = try rt.evalInt("linked0", "test");
+    const log0 = try rt.evalInt("log0", "test");
+    const linked1 = try rt.evalInt("linked1", "test");
+    const log1 = try rt.evalInt("log1", "test");
+    try testing.expectEqual(@as(i32, 1), linked0);
+    try testing.expectEqual(@as(i32, 0), log0);
+    try testing.expectEqual(@as(i32, 0), linked1);
+    try testing.expect(log1 > 0);
+}
+
+test "JS gl ANGLE_instanced_arrays aliases the instanced draw calls" {
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var ext = gl.getExtension('ANGLE_instanced_arrays');
+        \\var ok_ext = (ext !== null && ext.VERTEX_ATTRIB_ARRAY_DIVISOR_ANGLE === gl.VERTEX_ATTRIB_ARRAY_DIVISOR &&
+        \\  ext.drawArraysInstancedANGLE === gl.drawArraysInstanced &&
+        \\  ext.drawElementsInstancedANGLE === gl.drawElementsInstanced &&
+        \\  ext.vertexAttribDivisorANGLE === gl.vertexAttribDivisor) ? 1 : 0;
+        \\var ok_listed = gl.getSupportedExtensions().indexOf('ANGLE_instanced_arrays') >= 0 ? 1 : 0;
+        \\ext.vertexAttribDivisorANGLE(3, 1);
+        \\var ok_range = 0;
+        \\try { gl.vertexAttribDivisor(99, 1); } catch (e) { ok_range = 1; }
+        \\// No instances is a no-op, even without a program
+        \\gl.drawArraysInstanced(gl.TRIANGLES, 0, 3, 0);
+        \\var ok_program = 0;
+        \\try { gl.drawArraysInstanced(gl.TRIANGLES, 0, 3, 2); } catch (e) { ok_program = 1; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_ext", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_listed", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_range", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_program", "test"));
+    try testing.expectEqual(@as(usize, 0), webgl_draw.pendingCommandCount());
+}
+
+test "JS gl WEBGL_multi_draw decodes ranges from typed and plain arrays" {
+    resetDrawState();
+    defer resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var ext = gl.getExtension('WEBGL_multi_draw');
+        \\var ok_ext = (ext !== null && typeof ext.multiDrawArraysWEBGL === 'function' &&
+        \\  typeof ext.multiDrawElementsWEBGL === 'function' &&
+        \\  typeof ext.multiDrawArraysInstancedWEBGL === 'function' &&
+        \\  typeof ext.multiDrawElementsInstancedWEBGL === 'function') ? 1 : 0;
+        \\var ok_listed = gl.getSupportedExtensions().indexOf('WEBGL_multi_draw') >= 0 ? 1 : 0;
+        \\// Empty ranges are a no-op, even without a program
+        \\ext.multiDrawArraysWEBGL(gl.TRIANGLES, new Int32Array([0, 3, 6]), 1, [0, 0], 0, 2);
+        \\var ok_program = 0;
+        \\try { ext.multiDrawArraysWEBGL(gl.TRIANGLES, new Int32Array([0, 3]), 0, [3, 3], 0, 2); } catch (e) { ok_program = 1; }
+        \\var ok_type = 0;
+        \\try { ext.multiDrawArraysWEBGL(gl.TRIANGLES, 'nope', 0, [3], 0, 1); } catch (e) { ok_type = 1; }
+        \\var ok_elements = 0;
+        \\try { ext.multiDrawElementsWEBGL(gl.TRIANGLES, [3], 0, gl.UNSIGNED_SHORT, [0], 0, 1); } catch (e) { ok_elements = 1; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_ext", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_listed", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_program", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_type", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_elements", "test"));
+    try testing.expectEqual(@as(usize, 0), webgl_draw.pendingCommandCount());
+}
+
+test "JS gl uniform blocks bind buffer ranges by index" {
+    resetDrawState();
+    defer resetDrawState();
+    const mgr = webgl_state.globalBufferManager();
+    mgr.reset();
+    defer mgr.reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
 
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -4283,27 +10072,50 @@ test "JS gl compileShader updates status and info log" {
     rt.makeCurrent();
 
     try rt.eval(
-        \\var s = gl.createShader(gl.VERTEX_SHADER);
-        \\gl.compileShader(s);
-        \\var status0 = gl.getShaderParameter(s, gl.COMPILE_STATUS) ? 1 : 0;
-        \\var log0 = gl.getShaderInfoLog(s).length;
-        \\gl.shaderSource(s, "void main() {}");
-        \\gl.compileShader(s);
-        \\var status1 = gl.getShaderParameter(s, gl.COMPILE_STATUS) ? 1 : 0;
-        \\var log1 = gl.getShaderInfoLog(s).length;
+        \\var vs = gl.createShader(gl.VERTEX_SHADER);
+        \\var fs = gl.createShader(gl.FRAGMENT_SHADER);
+        \\gl.shaderSource(vs, "layout(std140) uniform Camera { mat4 viewProjection; };\nin vec3 position;\nvoid main() { gl_Position = viewProjection * vec4(position, 1.0); }");
+        \\gl.shaderSource(fs, "void main() {}");
+        \\gl.compileShader(vs);
+        \\gl.compileShader(fs);
+        \\var p = gl.createProgram();
+        \\gl.attachShader(p, vs);
+        \\gl.attachShader(p, fs);
+        \\gl.linkProgram(p);
+        \\var ok_count = gl.getProgramParameter(p, gl.ACTIVE_UNIFORM_BLOCKS) === 1 ? 1 : 0;
+        \\var idx = gl.getUniformBlockIndex(p, 'Camera');
+        \\var ok_index = (idx === 0 && gl.getUniformBlockIndex(p, 'Lights') === gl.INVALID_INDEX) ? 1 : 0;
+        \\gl.uniformBlockBinding(p, idx, 3);
+        \\var ok_binding = gl.getActiveUniformBlockParameter(p, idx, gl.UNIFORM_BLOCK_BINDING) === 3 ? 1 : 0;
+        \\var ok_bad_binding = 0;
+        \\try { gl.uniformBlockBinding(p, idx, gl.getParameter(gl.MAX_UNIFORM_BUFFER_BINDINGS)); } catch (e) { ok_bad_binding = 1; }
+        \\var ubo = gl.createBuffer();
+        \\gl.bindBuffer(gl.UNIFORM_BUFFER, ubo);
+        \\gl.bufferData(gl.UNIFORM_BUFFER, new Float32Array(64), gl.DYNAMIC_DRAW);
+        \\gl.bindBufferBase(gl.UNIFORM_BUFFER, 3, ubo);
+        \\var align = gl.getParameter(gl.UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+        \\gl.bindBufferRange(gl.UNIFORM_BUFFER, 4, ubo, align, 64);
+        \\var ok_unaligned = 0;
+        \\try { gl.bindBufferRange(gl.UNIFORM_BUFFER, 4, ubo, 4, 64); } catch (e) { ok_unaligned = 1; }
+        \\var ok_target = 0;
+        \\try { gl.bindBufferBase(gl.ARRAY_BUFFER, 0, ubo); } catch (e) { ok_target = 1; }
+        \\gl.bindBufferBase(gl.UNIFORM_BUFFER, 3, null);
     , "test");
 
-    const status0 = try rt.evalInt("status0", "test");
-    const log0 = try rt.evalInt("log0", "test");
-    const status1 = try rt.evalInt("status1", "test");
-    const log1 = try rt.evalInt("log1", "test");
-    try testing.expectEqual(@as(i32, 0), status0);
-    try testing.expect(log0 > 0);
-    try testing.expectEqual(@as(i32, 1), status1);
-    try testing.expectEqual(@as(i32, 0), log1);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_count", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_index", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_binding", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_bad_binding", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_unaligned", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_target", "test"));
+    try testing.expect(mgr.uniformBufferBinding(3).buffer == null);
+    const ranged = mgr.uniformBufferBinding(4);
+    try testing.expect(ranged.buffer != null);
+    try testing.expectEqual(gl_uniforms.uniformBufferOffsetAlignment(), ranged.offset);
+    try testing.expectEqual(@as(u32, 64), ranged.size);
 }
 
-test "JS gl program link status reflects shader state" {
+test "JS gl KHR_parallel_shader_compile reports completion" {
     const shaders = webgl_shader.globalShaderTable();
     shaders.reset();
     defer shaders.reset();
@@ -4318,33 +10130,31 @@ test "JS gl program link status reflects shader state" {
     rt.makeCurrent();
 
     try rt.eval(
+        \\var ext = gl.getExtension('KHR_parallel_shader_compile');
+        \\var ok_ext = (ext !== null && ext.COMPLETION_STATUS_KHR === 0x91B1) ? 1 : 0;
+        \\var ok_none = (gl.getExtension('WEBGL_nope') === null) ? 1 : 0;
         \\var vs = gl.createShader(gl.VERTEX_SHADER);
         \\var fs = gl.createShader(gl.FRAGMENT_SHADER);
         \\gl.shaderSource(vs, "void main() {}");
         \\gl.shaderSource(fs, "void main() {}");
         \\gl.compileShader(vs);
         \\gl.compileShader(fs);
+        \\var ok_shader = gl.getShaderParameter(vs, ext.COMPLETION_STATUS_KHR) ? 1 : 0;
         \\var p = gl.createProgram();
         \\gl.attachShader(p, vs);
         \\gl.attachShader(p, fs);
         \\gl.linkProgram(p);
-        \\var linked0 = gl.getProgramParameter(p, gl.LINK_STATUS) ? 1 : 0;
-        \\var log0 = gl.getProgramInfoLog(p).length;
-        \\var bad = gl.createProgram();
-        \\gl.attachShader(bad, vs);
-        \\gl.linkProgram(bad);
-        \\var linked1 = gl.getProgramParameter(bad, gl.LINK_STATUS) ? 1 : 0;
-        \\var log1 = gl.getProgramInfoLog(bad).length;
+        \\var spins = 0;
+        \\while (!gl.getProgramParameter(p, ext.COMPLETION_STATUS_KHR) && spins < 1000000) spins++;
+        \\var ok_done = gl.getProgramParameter(p, ext.COMPLETION_STATUS_KHR) ? 1 : 0;
+        \\var ok_linked = gl.getProgramParameter(p, gl.LINK_STATUS) ? 1 : 0;
     , "test");
 
-    const linked0 = try rt.evalInt("linked0", "test");
-    const log0 = try rt.evalInt("log0", "test");
-    const linked1 = try rt.evalInt("linked1", "test");
-    const log1 = try rt.evalInt("log1", "test");
-    try testing.expectEqual(@as(i32, 1), linked0);
-    try testing.expectEqual(@as(i32, 0), log0);
-    try testing.expectEqual(@as(i32, 0), linked1);
-    try testing.expect(log1 > 0);
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_ext", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_none", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_shader", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_done", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_linked", "test"));
 }
 
 test "JS gl uniform setters work with linked program" {
@@ -4354,7 +10164,7 @@ test "JS gl uniform setters work with linked program" {
     const programs = webgl_program.globalProgramTable();
     programs.reset();
     defer programs.reset();
-    webgl_draw.reset();
+    resetDrawState();
 
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -4401,6 +10211,186 @@ test "JS gl uniform setters work with linked program" {
     try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_uniform", "test"));
 }
 
+test "JS gl uniform arrays are read from typed array views in place" {
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    resetDrawState();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 128 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var vs = gl.createShader(gl.VERTEX_SHADER);
+        \\var fs = gl.createShader(gl.FRAGMENT_SHADER);
+        \\gl.shaderSource(vs, "uniform vec4 u_color; void main() { gl_Position = u_color; }");
+        \\gl.shaderSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+        \\gl.compileShader(vs);
+        \\gl.compileShader(fs);
+        \\var p = gl.createProgram();
+        \\gl.attachShader(p, vs);
+        \\gl.attachShader(p, fs);
+        \\gl.linkProgram(p);
+        \\gl.useProgram(p);
+        \\var all = new Float32Array([9, 1, 2, 3, 4, 9]);
+        \\gl.uniform4fv(gl.getUniformLocation(p, "u_color"), all.subarray(1, 5));
+    , "test");
+
+    const raw: u32 = @intCast(try rt.evalInt("p", "test"));
+    const id = programIdFromU32(raw);
+    const prog = programs.get(id) orelse return error.UnexpectedNull;
+    const color: [4]f32 = @bitCast(prog.vs_uniforms.buffer[0..16].*);
+    try testing.expectEqualSlices(f32, &[_]f32{ 1, 2, 3, 4 }, &color);
+}
+
+test "JS gl compressedTexImage2D stores blocks without conversion" {
+    const mgr = webgl_texture.globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.eval(
+        \\var t = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, t);
+        \\gl.compressedTexImage2D(gl.TEXTURE_2D, 0, 0x8E8C, 8, 8, 0, new Uint8Array(64));
+        \\var block = new Uint8Array(16);
+        \\for (var i = 0; i < 16; i++) block[i] = 7;
+        \\gl.compressedTexSubImage2D(gl.TEXTURE_2D, 0, 4, 0, 4, 4, 0x8E8C, block);
+        \\var ok_ext = gl.getExtension('EXT_texture_compression_bptc') === null ? 1 : 0;
+        \\var threw = 0;
+        \\try { __parseKtx2(new ArrayBuffer(16)); } catch (e) { threw = 1; }
+    , "test");
+
+    // No GPU backend in tests, so no compressed format is advertised
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ok_ext", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("threw", "test"));
+    const raw: u32 = @bitCast(try rt.evalInt("t", "test"));
+    const id = webgl_texture.TextureId.fromU32(raw);
+    const tex = mgr.getTexture(id) orelse return error.UnexpectedNull;
+    try testing.expectEqual(webgl_texture.TextureFormat.bc7_rgba, tex.format);
+    const data = mgr.textures.getPixelData(id) orelse return error.UnexpectedNull;
+    try testing.expectEqual(@as(usize, 64), data.len);
+    try testing.expectEqual(@as(u8, 7), data[16]);
+    try testing.expectEqual(@as(u8, 0), data[32]);
+}
+
+test "JS __parseKtx2 levels upload as compressed mip levels" {
+    const mgr = webgl_texture.globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // 8x8 sRGB BC7 with two levels: 64 bytes at 128, then 16 bytes at 192
+    try rt.eval(
+        \\var file = new ArrayBuffer(208);
+        \\var u8 = new Uint8Array(file);
+        \\var id = [0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A];
+        \\for (var i = 0; i < 12; i++) u8[i] = id[i];
+        \\// Header and level index words, little-endian hosts only
+        \\var u32 = new Uint32Array(file);
+        \\u32[3] = 146;
+        \\u32[5] = 8;
+        \\u32[6] = 8;
+        \\u32[9] = 1;
+        \\u32[10] = 2;
+        \\u32[20] = 128;
+        \\u32[22] = 64;
+        \\u32[26] = 192;
+        \\u32[28] = 16;
+        \\for (var j = 128; j < 208; j++) u8[j] = j & 0xFF;
+        \\var info = __parseKtx2(file);
+        \\var t = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, t);
+        \\gl.compressedTexImage2D(gl.TEXTURE_2D, 0, info[0], info[1], info[2], 0, new Uint8Array(file, info[4], info[5]));
+        \\var level1 = new Uint8Array(file, info[6], info[7]);
+        \\var basis = '';
+        \\u32[3] = 0;
+        \\try { __parseKtx2(file); } catch (e) { basis = e.message; }
+    , "test");
+
+    try testing.expectEqual(@as(i32, 0x8E8D), try rt.evalInt("info[0]", "test"));
+    try testing.expectEqual(@as(i32, 2), try rt.evalInt("info[3]", "test"));
+    try testing.expectEqual(@as(i32, 192), try rt.evalInt("level1[0]", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("basis === 'BasisUniversal' ? 1 : 0", "test"));
+    const raw: u32 = @bitCast(try rt.evalInt("t", "test"));
+    const tex = mgr.getTexture(webgl_texture.TextureId.fromU32(raw)) orelse return error.UnexpectedNull;
+    try testing.expectEqual(webgl_texture.TextureFormat.bc7_srgba, tex.format);
+    const data = mgr.textures.getPixelData(webgl_texture.TextureId.fromU32(raw)) orelse return error.UnexpectedNull;
+    try testing.expectEqual(@as(u8, 128), data[0]);
+}
+
+test "JS gl texImage2D applies pixel type and unpack state" {
+    const mgr = webgl_texture.globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    // 1x2 RGB565: red on top, blue below; then a half-transparent RGBA pixel
+    try rt.eval(
+        \\var a = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, a);
+        \\gl.pixelStorei(0x9240, true);
+        \\gl.texImage2D(gl.TEXTURE_2D, 0, 0x1907, 1, 2, 0, 0x1907, 0x8363, new Uint16Array([0xF800, 0x001F]));
+        \\gl.pixelStorei(0x9240, false);
+        \\var b = gl.createTexture();
+        \\gl.bindTexture(gl.TEXTURE_2D, b);
+        \\gl.pixelStorei(0x9241, true);
+        \\gl.texImage2D(gl.TEXTURE_2D, 0, 0x1908, 1, 1, 0, 0x1908, 0x1401, new Uint8Array([200, 100, 50, 128]));
+        \\gl.pixelStorei(0x9241, false);
+    , "test");
+
+    const flipped = mgr.textures.getPixelData(webgl_texture.TextureId.fromU32(@bitCast(try rt.evalInt("a", "test")))) orelse return error.UnexpectedNull;
+    try testing.expectEqualSlices(u8, &.{ 0, 0, 255, 255, 255, 0, 0, 255 }, flipped[0..8]);
+    const premultiplied = mgr.textures.getPixelData(webgl_texture.TextureId.fromU32(@bitCast(try rt.evalInt("b", "test")))) orelse return error.UnexpectedNull;
+    try testing.expectEqualSlices(u8, &.{ 100, 50, 25, 128 }, premultiplied[0..4]);
+}
+
+test "Unpack state skips ImageBitmaps and never premultiplies alpha-less data" {
+    defer g_gl_state = .{};
+    defer g_unpack_scratch.clearAndFree(std.heap.page_allocator);
+    g_gl_state.unpack_flip_y = true;
+    g_gl_state.unpack_premultiply_alpha = true;
+
+    // Two RGBA rows: opaque red over half-transparent white
+    const rows = [_]u8{ 255, 0, 0, 255, 255, 255, 255, 128 };
+    const bitmap = unpackPixels(&rows, 1, 2, .rgba, GL_UNSIGNED_BYTE, false);
+    try testing.expectEqual(@as([*]const u8, &rows), bitmap.data.?.ptr);
+
+    const applied = unpackPixels(&rows, 1, 2, .rgba, GL_UNSIGNED_BYTE, true);
+    try testing.expectEqualSlices(u8, &.{ 128, 128, 128, 128, 255, 0, 0, 255 }, applied.data.?);
+
+    // RGB565 has no alpha: expanded and flipped, never premultiplied
+    const rgb565 = [_]u16{ 0xF800, 0x07E0 };
+    const expanded = unpackPixels(std.mem.sliceAsBytes(&rgb565), 1, 2, .rgb, GL_UNSIGNED_SHORT_5_6_5, true);
+    try testing.expectEqual(webgl_texture.TextureFormat.rgba, expanded.format);
+    try testing.expectEqualSlices(u8, &.{ 0, 255, 0, 255, 255, 0, 0, 255 }, expanded.data.?);
+
+    // RGB data flips but has no alpha to premultiply by
+    const rgb = [_]u8{ 1, 2, 3, 4, 5, 6 };
+    try testing.expectEqualSlices(u8, &.{ 4, 5, 6, 1, 2, 3 }, unpackPixels(&rgb, 1, 2, .rgb, GL_UNSIGNED_BYTE, true).data.?);
+}
+
 test "JS Promise basic resolve" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -4494,6 +10484,18 @@ test "JS Promise.all" {
     try testing.expectEqual(@as(i32, 6), try rt.evalInt("sum", "test"));
 }
 
+/// Tick until `condition` evaluates to non-zero; fetch bodies and image
+/// decodes complete on background threads.
+fn tickUntil(rt: *Runtime, condition: []const u8) !void {
+    var t: f64 = 1.0;
+    while (t < 2000.0) : (t += 1.0) {
+        rt.tick(t);
+        if (try rt.evalInt(condition, "test") != 0) return;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    return error.Timeout;
+}
+
 test "JS fetch reads file" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -4518,9 +10520,7 @@ test "JS fetch reads file" {
         \\  .then(function(d) { value = d.test; });
     , "test");
 
-    rt.tick(1.0);
-    rt.tick(2.0);
-    rt.tick(3.0);
+    try tickUntil(&rt, "value");
 
     try testing.expectEqual(@as(i32, 200), try rt.evalInt("status", "test"));
     try testing.expectEqual(@as(i32, 123), try rt.evalInt("value", "test"));
@@ -4547,6 +10547,131 @@ test "JS fetch handles missing file" {
     try testing.expectEqual(@as(i32, 1), try rt.evalInt("caught", "test"));
 }
 
+test "JS image loads complete asynchronously on a later tick" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var errors = 0;
+        \\var rejected = 0;
+        \\var img = __createImgElement();
+        \\img.onerror = function() { errors++; };
+        \\img.src = 'nonexistent_image_12345.png';
+        \\createImageBitmap(new Uint8Array([1, 2, 3]).buffer).catch(function() { rejected = 1; });
+        \\var syncErrors = errors;
+    , "test");
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("syncErrors", "test"));
+
+    // Decodes run on worker threads; tick until both results are delivered
+    var t: f64 = 1.0;
+    while (t < 2000.0) : (t += 1.0) {
+        rt.tick(t);
+        if (try rt.evalInt("errors + rejected", "test") == 2) break;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("errors", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("rejected", "test"));
+    try testing.expectEqual(@as(u32, 0), g_image_decoder.pending());
+}
+
+test "JS AudioContext plays a buffer source headless and fires onended" {
+    // As THREE_NATIVE_AUDIO=0 sets it: no device, tick() renders silently
+    web_audio.configureOutput(.{ .enabled = false });
+    defer web_audio.configureOutput(.{});
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 512 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var ctx = new AudioContext();
+        \\var buffer = ctx.createBuffer(1, 441, ctx.sampleRate);
+        \\buffer.getChannelData(0).fill(0.5);
+        \\var source = ctx.createBufferSource();
+        \\source.buffer = buffer;
+        \\source.connect(ctx.destination);
+        \\var ended = 0;
+        \\source.onended = function(e) { ended = e.target === source ? 1 : -1; };
+        \\source.start();
+        \\var restarted = 0;
+        \\try { source.start(); } catch (e) { restarted = 1; }
+    , "test");
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("restarted", "test"));
+    try testing.expectEqual(@as(i32, 0), try rt.evalInt("ended", "test"));
+
+    // The graph renders the wall time between ticks; 441 frames is 10 ms
+    var t: f64 = 1.0;
+    while (t < 2000.0) : (t += 1.0) {
+        rt.tick(t);
+        if (try rt.evalInt("ended", "test") != 0) break;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ended", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ctx.currentTime >= 0.01 ? 1 : 0", "test"));
+
+    // The ended source is gone; collecting the buffer frees its samples
+    const graph = web_audio.graph();
+    try testing.expectEqual(@as(u16, 1), graph.buffers.count);
+    try rt.eval("source = null; buffer = null; gc();", "test");
+    try testing.expectEqual(@as(u16, 0), graph.buffers.count);
+    try testing.expectEqual(@as(u16, 2), graph.nodes.count);
+}
+
+test "JS decodeAudioData decodes a WAV file and rejects other data" {
+    web_audio.configureOutput(.{ .enabled = false });
+    defer web_audio.configureOutput(.{});
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 512 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var bytes = [];
+        \\function str(s) { for (var i = 0; i < s.length; i++) bytes.push(s.charCodeAt(i)); }
+        \\function u16(v) { bytes.push(v & 255, (v >> 8) & 255); }
+        \\function u32(v) { u16(v & 0xFFFF); u16(v >>> 16); }
+        \\// Mono 16-bit PCM at 8 kHz
+        \\var pcm = [0, 16384, -32768, 32767];
+        \\str('RIFF'); u32(36 + pcm.length * 2); str('WAVE');
+        \\str('fmt '); u32(16); u16(1); u16(1); u32(8000); u32(16000); u16(2); u16(16);
+        \\str('data'); u32(pcm.length * 2);
+        \\for (var i = 0; i < pcm.length; i++) u16(pcm[i] & 0xFFFF);
+        \\
+        \\var ctx = new AudioContext();
+        \\var decoded = null;
+        \\var failures = 0;
+        \\ctx.decodeAudioData(new Uint8Array(bytes).buffer).then(function(b) { decoded = b; });
+        \\ctx.decodeAudioData(new Uint8Array([1, 2, 3]).buffer, null, function() { failures++; })
+        \\  .catch(function(e) { if (e.message.indexOf('EncodingError') === 0) failures++; });
+        \\function done() { return decoded !== null && failures === 2 ? 1 : 0; }
+    , "test");
+
+    var t: f64 = 1.0;
+    while (t < 2000.0) : (t += 1.0) {
+        rt.tick(t);
+        if (try rt.evalInt("done()", "test") == 1) break;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("done()", "test"));
+    try rt.eval(
+        \\var data = decoded.getChannelData(0);
+        \\var shape = decoded.numberOfChannels * 1000 + decoded.length;
+        \\var samples = (data[1] === 0.5 && data[2] === -1 && data[0] === 0) ? 1 : 0;
+    , "test");
+    try testing.expectEqual(@as(i32, 1004), try rt.evalInt("shape", "test"));
+    try testing.expectEqual(@as(i32, 8000), try rt.evalInt("decoded.sampleRate", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("samples", "test"));
+}
+
 test "JS fetch text response" {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
@@ -4569,9 +10694,173 @@ test "JS fetch text response" {
         \\  .then(function(t) { textLen = t.length; });
     , "test");
 
-    rt.tick(1.0);
-    rt.tick(2.0);
-    rt.tick(3.0);
+    try tickUntil(&rt, "textLen");
 
     try testing.expectEqual(@as(i32, 5), try rt.evalInt("textLen", "test"));
 }
+
+test "JS TextDecoder decodes UTF-8 natively" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.installDomStubs();
+
+    try rt.eval(
+        \\var d = new TextDecoder();
+        \\var euro = d.decode(new Uint8Array([0xE2, 0x82, 0xAC]));
+        \\var bom = d.decode(new Uint8Array([0xEF, 0xBB, 0xBF, 0x63, 0x61, 0x66, 0xC3, 0xA9, 0x21]));
+        \\var bad = d.decode(new Uint8Array([0x61, 0x80, 0x62, 0x63, 0x64]));
+        \\var raw = new Uint8Array([0x78, 0x78, 0x68, 0x65, 0x6C, 0x6C, 0x6F, 0x78]);
+        \\var view = d.decode(new Uint8Array(raw.buffer, 2, 5));
+        \\var threw = 0;
+        \\try {
+        \\  new TextDecoder('utf-8', { fatal: true }).decode(new Uint8Array([0x61, 0x62, 0x63, 0x64, 0xFF]));
+        \\} catch (e) { threw = e instanceof TypeError ? 1 : 2; }
+        \\var json = '[';
+        \\for (var i = 0; i < 60; i++) json += (i ? ',' : '') + '{"index":' + i + ',"name":"nodeé"}';
+        \\json += ']';
+        \\var utf8 = [];
+        \\for (var j = 0; j < json.length; j++) {
+        \\  var code = json.charCodeAt(j);
+        \\  if (code < 0x80) utf8.push(code); else utf8.push(0xC0 | (code >> 6), 0x80 | (code & 0x3F));
+        \\}
+        \\var bytes = new Uint8Array(utf8);
+        \\var nodes = JSON.parse(d.decode(bytes.buffer));
+    , "test");
+
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("euro === '€' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("bom === 'café!' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("bad === 'a�bcd' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("view === 'hello' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("threw", "test"));
+    try testing.expectEqual(@as(i32, 60), try rt.evalInt("nodes.length", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("nodes[59].name === 'nodeé' ? 1 : 0", "test"));
+}
+
+test "JS fetch responses own their bytes and are not pooled" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 256 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.installDomStubs();
+    try rt.setAssetRoot("/tmp");
+
+    var tmp_file = try std.fs.cwd().createFile("/tmp/js_fetch_many.bin", .{});
+    defer tmp_file.close();
+    try tmp_file.writeAll(&[_]u8{ 7, 8, 9 });
+
+    // More live responses than any fixed native pool would hold
+    try rt.eval(
+        \\var buffers = [];
+        \\for (var i = 0; i < 40; i++) {
+        \\  fetch('js_fetch_many.bin')
+        \\    .then(function(r) { return r.arrayBuffer(); })
+        \\    .then(function(b) { buffers.push(b); });
+        \\}
+    , "test");
+
+    try tickUntil(&rt, "buffers.length === 40");
+
+    try testing.expectEqual(@as(i32, 40), try rt.evalInt("buffers.length", "test"));
+    try testing.expectEqual(@as(i32, 3), try rt.evalInt("buffers[39].byteLength", "test"));
+    try testing.expectEqual(@as(i32, 9), try rt.evalInt("new Uint8Array(buffers[0])[2]", "test"));
+}
+
+test "JS fetch reads from a mounted asset archive" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 64 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.installDomStubs();
+
+    var level: [1024]u8 = undefined;
+    for (&level, 0..) |*byte, i| byte.* = @intCast(i % 5);
+    const sources = [_]asset_archive.Source{
+        .{ .path = "data/hello.txt", .data = "Hello" },
+        .{ .path = "data/level.bin", .data = &level },
+    };
+    {
+        var file = try std.fs.cwd().createFile("/tmp/js_fetch_test.pak", .{});
+        defer file.close();
+        var buf: [256]u8 = undefined;
+        var writer = file.writer(&buf);
+        try asset_archive.writeArchive(testing.allocator, &sources, &writer.interface, .{});
+        try writer.interface.flush();
+    }
+    try rt.mountArchive("/tmp/js_fetch_test.pak");
+
+    try rt.eval(
+        \\var text = '';
+        \\var last = -1;
+        \\var missing = 0;
+        \\fetch('./data/hello.txt').then(function(r) { return r.text(); }).then(function(t) { text = t; });
+        \\fetch('data/level.bin').then(function(r) { return r.arrayBuffer(); })
+        \\  .then(function(b) { last = new Uint8Array(b)[1023]; });
+        \\fetch('data/../data/hello.txt').catch(function() { missing = 1; });
+    , "test");
+
+    try tickUntil(&rt, "text.length && last >= 0 && missing");
+
+    try testing.expectEqual(@as(i32, 5), try rt.evalInt("text.length", "test"));
+    try testing.expectEqual(@as(i32, 1023 % 5), try rt.evalInt("last", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("missing", "test"));
+}
+
+test "JS fetch streams bodies with progress and serves ranges" {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    var rt = try Runtime.init(gpa.allocator(), 4 * 1024 * 1024);
+    defer rt.deinit();
+    rt.makeCurrent();
+
+    try rt.installDomStubs();
+    try rt.setAssetRoot("/tmp");
+
+    // Several chunks' worth, so the body arrives over multiple events
+    const body_len = file_stream.ChunkBytes * 2 + 1000;
+    {
+        var file = try std.fs.cwd().createFile("/tmp/js_fetch_stream.bin", .{});
+        defer file.close();
+        var block: [1000]u8 = undefined;
+        for (&block, 0..) |*byte, i| byte.* = @intCast(i % 250);
+        for (0..body_len / block.len) |_| try file.writeAll(&block);
+        try file.writeAll(block[0 .. body_len % block.len]);
+    }
+
+    try rt.eval(
+        \\var chunks = 0, loaded = 0, total = 0, done = 0;
+        \\var status = 0, ranged = '';
+        \\fetch('js_fetch_stream.bin').then(function(r) {
+        \\  total = parseInt(r.headers.get('Content-Length'), 10);
+        \\  var reader = r.body.getReader();
+        \\  function pump() {
+        \\    return reader.read().then(function(result) {
+        \\      if (result.done) { done = 1; return; }
+        \\      chunks++;
+        \\      loaded += result.value.byteLength;
+        \\      return pump();
+        \\    });
+        \\  }
+        \\  return pump();
+        \\});
+        \\fetch(new Request('js_fetch_stream.bin', { headers: { Range: 'bytes=250-252' } }))
+        \\  .then(function(r) { status = r.status; return r.arrayBuffer(); })
+        \\  .then(function(b) { var v = new Uint8Array(b); ranged = v.length + ':' + v[0] + ',' + v[2]; });
+    , "test");
+
+    try tickUntil(&rt, "done && ranged !== ''");
+
+    try testing.expectEqual(@as(i32, @intCast(body_len)), try rt.evalInt("total", "test"));
+    try testing.expectEqual(@as(i32, @intCast(body_len)), try rt.evalInt("loaded", "test"));
+    try testing.expect(try rt.evalInt("chunks", "test") >= 3);
+    try testing.expectEqual(@as(i32, 206), try rt.evalInt("status", "test"));
+    try testing.expectEqual(@as(i32, 1), try rt.evalInt("ranged === '3:0,2' ? 1 : 0", "test"));
+    try testing.expectEqual(@as(u32, 0), g_file_streams.activeStreams());
+}
@@ -0,0 +1,168 @@
+//! Per-game sizing manifest
+//!
+//! A game ships `three-native.json` next to its script to size the JS heap,
+//! CPU staging pools, WebGL object tables and texture residency. Sizes are
+//! in MiB, capacities in objects (see docs/design/src/memory-concurrency.md
+//! for every field):
+//!
+//!     { "heap_mb": 24, "texture_pool_mb": 8, "max_programs": 64 }
+//!
+//! Every field is optional, and THREE_NATIVE_* environment variables
+//! override it. Unknown fields are ignored, so a manifest written for a
+//! newer build still sizes an older one.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub const file_name = "three-native.json";
+
+pub const max_bytes: usize = 64 * 1024;
+
+pub const Manifest = struct {
+    heap_mb: ?usize = null,
+    buffer_pool_mb: ?usize = null,
+    texture_pool_mb: ?usize = null,
+    max_buffers: ?usize = null,
+    max_textures: ?usize = null,
+    max_shaders: ?usize = null,
+    max_programs: ?usize = null,
+    vram_budget_mb: ?usize = null,
+    keep_texture_copies: ?bool = null,
+};
+
+pub const ParseError = std.json.ParseError(std.json.Scanner);
+
+/// Unknown fields are skipped; a known field of the wrong type fails.
+pub fn parse(allocator: std.mem.Allocator, bytes: []const u8) ParseError!Manifest {
+    // No field allocates, so the value outlives the parse
+    const parsed = try std.json.parseFromSlice(Manifest, allocator, bytes, .{ .ignore_unknown_fields = true });
+    defer parsed.deinit();
+    return parsed.value;
+}
+
+/// The manifest next to `script_path`. Missing or unreadable manifests
+/// leave every setting at its default.
+pub fn read(allocator: std.mem.Allocator, script_path: []const u8) Manifest {
+    const dir = std.fs.path.dirname(script_path) orelse ".";
+    const path = std.fs.path.join(allocator, &.{ dir, file_name }) catch return .{};
+    defer allocator.free(path);
+    return readFrom(allocator, std.fs.cwd(), path);
+}
+
+pub fn readFrom(allocator: std.mem.Allocator, dir: std.fs.Dir, path: []const u8) Manifest {
+    const bytes = dir.readFileAlloc(allocator, path, max_bytes) catch |err| {
+        if (err != error.FileNotFound) std.log.warn("{s}: cannot read: {s}", .{ path, @errorName(err) });
+        return .{};
+    };
+    defer allocator.free(bytes);
+    return parse(allocator, bytes) catch |err| {
+        std.log.warn("{s}: ignored: {s}", .{ path, @errorName(err) });
+        return .{};
+    };
+}
+
+// =============================================================================
+// Environment overrides
+// =============================================================================
+
+/// The environment variable if set, else the manifest value.
+pub fn countSetting(env: *const std.process.EnvMap, name: []const u8, what: []const u8, manifest_value: ?usize) ?usize {
+    const value = env.get(name) orelse return manifest_value;
+    return std.fmt.parseInt(usize, value, 10) catch {
+        std.log.warn("{s}: expected {s}, got '{s}'", .{ name, what, value });
+        return manifest_value;
+    };
+}
+
+/// The environment variable if set (0 is false, any other number true),
+/// else the manifest value, else `default`.
+pub fn flagSetting(env: *const std.process.EnvMap, name: []const u8, manifest_value: ?bool, default: bool) bool {
+    const fallback = manifest_value orelse default;
+    const value = env.get(name) orelse return fallback;
+    const number = std.fmt.parseInt(u32, value, 10) catch {
+        std.log.warn("{s}: expected a whole number, got '{s}'", .{ name, value });
+        return fallback;
+    };
+    return number != 0;
+}
+
+/// `mib` in bytes, or null (with a warning naming the setting) if that
+/// does not fit in a usize.
+pub fn mibToBytes(name: []const u8, mib: usize) ?usize {
+    return std.math.mul(usize, mib, 1024 * 1024) catch {
+        std.log.warn("{s}: {d} MiB is too large", .{ name, mib });
+        return null;
+    };
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn rejects(bytes: []const u8) bool {
+    _ = parse(testing.allocator, bytes) catch return true;
+    return false;
+}
+
+test "Manifest parses known fields and skips unknown ones" {
+    const manifest = try parse(testing.allocator,
+        \\{ "heap_mb": 24, "texture_pool_mb": 8, "max_programs": 64,
+        \\  "keep_texture_copies": false, "future_setting": { "a": [1, 2] } }
+    );
+    try testing.expectEqual(Manifest{
+        .heap_mb = 24,
+        .texture_pool_mb = 8,
+        .max_programs = 64,
+        .keep_texture_copies = false,
+    }, manifest);
+    try testing.expectEqual(Manifest{}, try parse(testing.allocator, "{}"));
+    try testing.expect(rejects("{ \"heap_mb\": \"big\" }"));
+    try testing.expect(rejects("{ \"max_buffers\": -1 }"));
+    try testing.expect(rejects("{ \"keep_texture_copies\": 1 }"));
+    try testing.expect(rejects("{ \"heap_mb\": 24"));
+}
+
+test "Manifest reads from next to the script and defaults when absent" {
+    var tmp = testing.tmpDir(.{});
+    defer tmp.cleanup();
+    try testing.expectEqual(Manifest{}, readFrom(testing.allocator, tmp.dir, file_name));
+
+    try tmp.dir.writeFile(.{ .sub_path = file_name, .data = "{ \"vram_budget_mb\": 1536 }" });
+    try testing.expectEqual(Manifest{ .vram_budget_mb = 1536 }, readFrom(testing.allocator, tmp.dir, file_name));
+
+    try tmp.dir.writeFile(.{ .sub_path = file_name, .data = "not json" });
+    try testing.expectEqual(Manifest{}, readFrom(testing.allocator, tmp.dir, file_name));
+}
+
+test "Environment variables override manifest values" {
+    var env = std.process.EnvMap.init(testing.allocator);
+    defer env.deinit();
+    const manifest = try parse(testing.allocator,
+        \\{ "texture_pool_mb": 8, "max_textures": 128, "keep_texture_copies": false }
+    );
+
+    // Unset variables leave the manifest in charge
+    try testing.expectEqual(@as(?usize, 8), countSetting(&env, "POOL", "a size in MiB", manifest.texture_pool_mb));
+    try testing.expectEqual(@as(?usize, null), countSetting(&env, "POOL", "a size in MiB", manifest.buffer_pool_mb));
+    try testing.expect(!flagSetting(&env, "KEEP", manifest.keep_texture_copies, true));
+    try testing.expect(flagSetting(&env, "KEEP", null, true));
+
+    try env.put("POOL", "32");
+    try env.put("TEXTURES", "lots");
+    try env.put("KEEP", "1");
+    try testing.expectEqual(@as(?usize, 32), countSetting(&env, "POOL", "a size in MiB", manifest.texture_pool_mb));
+    try testing.expectEqual(@as(?usize, 32), countSetting(&env, "POOL", "a size in MiB", null));
+    // A malformed variable falls back to the manifest
+    try testing.expectEqual(@as(?usize, 128), countSetting(&env, "TEXTURES", "an object count", manifest.max_textures));
+    try testing.expect(flagSetting(&env, "KEEP", manifest.keep_texture_copies, true));
+    try env.put("KEEP", "0");
+    try testing.expect(!flagSetting(&env, "KEEP", null, true));
+    try env.put("KEEP", "yes");
+    try testing.expect(!flagSetting(&env, "KEEP", manifest.keep_texture_copies, true));
+}
+
+test "Manifest sizes in MiB convert without overflow" {
+    try testing.expectEqual(@as(?usize, 8 * 1024 * 1024), mibToBytes("POOL", 8));
+    try testing.expectEqual(@as(?usize, 0), mibToBytes("POOL", 0));
+    try testing.expectEqual(@as(?usize, null), mibToBytes("POOL", std.math.maxInt(usize) / 1024));
+}
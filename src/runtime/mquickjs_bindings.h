@@ -3,6 +3,12 @@
 #include <stddef.h>
 #include "mquickjs.h"
 
+/* User classes. Audio handles free their native node or buffer when
+   collected. */
+#define JS_CLASS_AUDIO_NODE_HANDLE (JS_CLASS_USER + 0)
+#define JS_CLASS_AUDIO_BUFFER_HANDLE (JS_CLASS_USER + 1)
+#define JS_CLASS_COUNT (JS_CLASS_USER + 2)
+
 JSValue js_print(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_date_now(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_performance_now(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
@@ -10,6 +16,7 @@ JSValue js_gc(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_load(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_setTimeout(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_clearTimeout(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_setInterval(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_setClearColor(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_requestAnimationFrame(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_cancelAnimationFrame(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
@@ -21,14 +28,53 @@ JSValue js_dom_createElementNS(JSContext *ctx, JSValue *this_val, int argc, JSVa
 JSValue js_dom_getContext(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_Image(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_loadImage(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_decodeImage(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_freeImage(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
-JSValue js_nativeFetch(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
-JSValue js_getFetchBufferData(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
-JSValue js_freeFetchBuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioInstall(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioOpen(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioClose(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioSuspend(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioTime(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioCreateNode(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioConnect(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioDisconnect(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioParam(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioParamValue(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioConfig(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioStart(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioStop(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioCreateBuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioBufferWrite(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_audioBufferRead(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_AudioNodeHandle(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_AudioBufferHandle(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+void js_AudioNodeHandle_finalizer(JSContext *ctx, void *opaque);
+void js_AudioBufferHandle_finalizer(JSContext *ctx, void *opaque);
+JSValue js_decodeAudio(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_fetchStart(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_fetchCancel(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_getCoalescedEvents(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gcStats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_nativeRenderInfo(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_propertyCacheStats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_textDecode(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_parseKtx2(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_mat4Multiply(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_mat4Compose(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_mat4ArrayMultiply(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_frustumIntersectSpheres(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerInstall(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerCreate(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerPost(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerTerminate(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerPostParent(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_workerClose(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_scheduleMicrotasks(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_createBuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_deleteBuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_bindBuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_bufferData(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_bufferSubData(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_createShader(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_deleteShader(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_shaderSource(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
@@ -85,6 +131,8 @@ JSValue js_gl_texParameteri(JSContext *ctx, JSValue *this_val, int argc, JSValue
 JSValue js_gl_texImage2D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_texSubImage2D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_texStorage2D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_compressedTexImage2D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_compressedTexSubImage2D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_texImage3D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_texSubImage3D(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_generateMipmap(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
@@ -98,6 +146,33 @@ JSValue js_gl_deleteRenderbuffer(JSContext *ctx, JSValue *this_val, int argc, JS
 JSValue js_gl_bindRenderbuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_renderbufferStorage(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_framebufferRenderbuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_renderbufferStorageMultisample(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_blitFramebuffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_createQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_deleteQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_isQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_beginQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_endQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getQuery(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getQueryParameter(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_queryCounter(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_readPixels(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getBufferSubData(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_fenceSync(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_deleteSync(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_isSync(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_clientWaitSync(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_waitSync(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getSyncParameter(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_multiDrawArrays(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_multiDrawElements(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_multiDrawArraysInstanced(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_multiDrawElementsInstanced(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_bindBufferBase(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_bindBufferRange(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getUniformBlockIndex(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_uniformBlockBinding(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getActiveUniformBlockParameter(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_createVertexArray(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_deleteVertexArray(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_bindVertexArray(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
@@ -106,6 +181,15 @@ JSValue js_gl_disableVertexAttribArray(JSContext *ctx, JSValue *this_val, int ar
 JSValue js_gl_vertexAttribPointer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_drawArrays(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_drawElements(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_drawArraysInstanced(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_drawElementsInstanced(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_vertexAttribDivisor(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_warmPipelines(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_setPipelineCacheCapacity(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getPipelineCacheStats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_getCallStats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_resetCallStats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
+JSValue js_gl_submit(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_getUniformLocation(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_uniform1f(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
 JSValue js_gl_uniform2f(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv);
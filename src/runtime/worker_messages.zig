@@ -0,0 +1,195 @@
+//! Messages between JS contexts on different threads
+//!
+//! Every Web Worker runs its own mquickjs context, with its own heap, on
+//! its own thread. Heaps cannot share values, so postMessage() encodes the
+//! structured clone of a message as JSON text plus a list of binary
+//! buffers (ArrayBuffers and the contents of typed arrays). Each buffer is
+//! copied once out of the sender's heap into a native Message and once
+//! into the receiver's heap; nothing is serialized twice.
+//!
+//! A Mailbox carries messages one way: an SPSC ring of message pointers,
+//! with a producer-side overflow list so that sending never fails or
+//! blocks, and a futex word the consumer can sleep on.
+
+const std = @import("std");
+const testing = std.testing;
+const SpscRing = @import("../shim/spsc_ring.zig").SpscRing;
+
+pub const Kind = enum(u8) {
+    /// postMessage() payload
+    message,
+    /// Uncaught exception in the worker; the JSON text is its message
+    @"error",
+};
+
+/// One allocation: this header, the buffer lengths, the JSON text and the
+/// buffer contents, in that order.
+pub const Message = struct {
+    allocator: std.mem.Allocator,
+    block_len: usize,
+    kind: Kind,
+    json_len: usize,
+    buffer_count: usize,
+    /// Producer-side overflow list
+    next: ?*Message = null,
+
+    const header_bytes = std.mem.alignForward(usize, @sizeOf(Message), @alignOf(usize));
+
+    /// A message with room for `json_len` bytes of text and buffers of
+    /// `buffer_lens` bytes, left for the sender to fill.
+    pub fn create(allocator: std.mem.Allocator, kind: Kind, json_len: usize, buffer_lens: []const usize) !*Message {
+        var len = header_bytes + buffer_lens.len * @sizeOf(usize) + json_len;
+        for (buffer_lens) |buffer_len| len += buffer_len;
+        const block = try allocator.alignedAlloc(u8, .of(Message), len);
+        const msg: *Message = @ptrCast(block.ptr);
+        msg.* = .{
+            .allocator = allocator,
+            .block_len = len,
+            .kind = kind,
+            .json_len = json_len,
+            .buffer_count = buffer_lens.len,
+        };
+        @memcpy(msg.lens(), buffer_lens);
+        return msg;
+    }
+
+    pub fn destroy(self: *Message) void {
+        const block: [*]align(@alignOf(Message)) u8 = @ptrCast(self);
+        self.allocator.free(block[0..self.block_len]);
+    }
+
+    pub fn json(self: *Message) []u8 {
+        return self.bytes()[header_bytes + self.buffer_count * @sizeOf(usize) ..][0..self.json_len];
+    }
+
+    pub fn buffer(self: *Message, index: usize) []u8 {
+        var offset = header_bytes + self.buffer_count * @sizeOf(usize) + self.json_len;
+        for (self.lens()[0..index]) |len| offset += len;
+        return self.bytes()[offset..][0..self.lens()[index]];
+    }
+
+    fn lens(self: *Message) []usize {
+        const at: [*]usize = @ptrCast(@alignCast(self.bytes()[header_bytes..].ptr));
+        return at[0..self.buffer_count];
+    }
+
+    fn bytes(self: *Message) []u8 {
+        const block: [*]u8 = @ptrCast(self);
+        return block[0..self.block_len];
+    }
+};
+
+/// Messages the ring holds before the sender keeps them on its own side.
+pub const MailboxCapacity = 64;
+
+pub const Mailbox = struct {
+    ring: SpscRing(*Message, MailboxCapacity) = .{},
+    // Producer only: messages waiting for ring space, oldest first
+    overflow_head: ?*Message = null,
+    overflow_tail: ?*Message = null,
+    /// Bumped whenever messages are published; the consumer sleeps on it
+    epoch: std.atomic.Value(u32) = .init(0),
+
+    const Self = @This();
+
+    /// Producer side. Takes ownership of `msg`.
+    pub fn send(self: *Self, msg: *Message) void {
+        msg.next = null;
+        if (self.overflow_head == null and self.ring.push(msg)) {
+            self.notify();
+            return;
+        }
+        if (self.overflow_tail) |tail| tail.next = msg else self.overflow_head = msg;
+        self.overflow_tail = msg;
+    }
+
+    /// Producer side: move overflowed messages into the ring as it drains.
+    /// Returns true when nothing is left waiting.
+    pub fn flush(self: *Self) bool {
+        var moved = false;
+        while (self.overflow_head) |msg| {
+            const next = msg.next;
+            if (!self.ring.push(msg)) break;
+            moved = true;
+            self.overflow_head = next;
+            if (next == null) self.overflow_tail = null;
+        }
+        if (moved) self.notify();
+        return self.overflow_head == null;
+    }
+
+    /// Consumer side. The caller owns, and destroys, the message.
+    pub fn receive(self: *Self) ?*Message {
+        return self.ring.pop();
+    }
+
+    /// True when neither the ring nor the overflow list holds a message.
+    /// Only meaningful once one side has stopped touching the mailbox.
+    pub fn isEmpty(self: *Self) bool {
+        return self.ring.len() == 0 and self.overflow_head == null;
+    }
+
+    /// Wake the consumer without a message, e.g. to make it re-check a
+    /// shutdown flag.
+    pub fn notify(self: *Self) void {
+        _ = self.epoch.fetchAdd(1, .release);
+        std.Thread.Futex.wake(&self.epoch, 1);
+    }
+
+    /// Consumer side: sleep until notified past `seen` (an earlier epoch
+    /// value) or until `timeout_ns` passes.
+    pub fn wait(self: *Self, seen: u32, timeout_ns: u64) void {
+        std.Thread.Futex.timedWait(&self.epoch, seen, timeout_ns) catch {};
+    }
+
+    /// Destroy everything queued, once neither side can touch the mailbox.
+    pub fn drain(self: *Self) void {
+        while (self.ring.pop()) |msg| msg.destroy();
+        while (self.overflow_head) |msg| {
+            self.overflow_head = msg.next;
+            msg.destroy();
+        }
+        self.overflow_tail = null;
+    }
+};
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "Message lays out text and buffers in one block" {
+    const msg = try Message.create(testing.allocator, .message, 5, &.{ 3, 0, 4 });
+    defer msg.destroy();
+    @memcpy(msg.json(), "[1,2]");
+    @memcpy(msg.buffer(0), "abc");
+    @memcpy(msg.buffer(2), "wxyz");
+    try testing.expectEqualStrings("[1,2]", msg.json());
+    try testing.expectEqualStrings("abc", msg.buffer(0));
+    try testing.expectEqual(@as(usize, 0), msg.buffer(1).len);
+    try testing.expectEqualStrings("wxyz", msg.buffer(2));
+}
+
+test "Mailbox keeps order through overflow" {
+    var mailbox: Mailbox = .{};
+    defer mailbox.drain();
+    const count = MailboxCapacity + 10;
+    for (0..count) |i| {
+        const msg = try Message.create(testing.allocator, .message, 8, &.{});
+        std.mem.writeInt(u64, msg.json()[0..8], i, .little);
+        mailbox.send(msg);
+    }
+    try testing.expect(!mailbox.flush());
+
+    var expected: u64 = 0;
+    while (expected < count) {
+        const msg = mailbox.receive() orelse {
+            _ = mailbox.flush();
+            continue;
+        };
+        defer msg.destroy();
+        try testing.expectEqual(expected, std.mem.readInt(u64, msg.json()[0..8], .little));
+        expected += 1;
+    }
+    try testing.expect(mailbox.flush());
+    try testing.expect(mailbox.receive() == null);
+}
@@ -0,0 +1,381 @@
+//! Packed asset archive
+//!
+//! A single file holding every asset of a game, mounted in place of the
+//! loose-file asset root. Layout (little endian):
+//!
+//!   header   magic "TNPK", version, entry count, data alignment,
+//!            index and string table offsets
+//!   index    fixed-size entries sorted by path bytes
+//!   strings  entry paths, '/'-separated and relative to the packed root
+//!   data     entry payloads, each starting on `alignment` bytes
+//!
+//! The archive is memory mapped where the OS allows it, so mounting costs
+//! one open and one map; a lookup is a binary search in mapped memory and
+//! an uncompressed entry is read straight out of the mapping. Entries may be
+//! stored as LZ4 blocks when that saves space. Archives are written by the
+//! `pack-assets` build step (see writeArchive).
+
+const std = @import("std");
+const builtin = @import("builtin");
+const testing = std.testing;
+const lz4 = @import("lz4.zig");
+
+pub const Magic = "TNPK";
+pub const Version: u32 = 1;
+pub const DefaultAlignment: u32 = 16;
+
+const HeaderBytes: usize = 32;
+const IndexEntryBytes: usize = 32;
+/// Paths are looked up by exact bytes and capped to keep the index compact.
+pub const MaxPathLen: usize = std.math.maxInt(u16);
+
+pub const Compression = enum(u8) {
+    none = 0,
+    lz4 = 1,
+    _,
+};
+
+pub const FormatError = error{ NotArchive, UnsupportedVersion, Truncated, BadIndex };
+
+pub const ExtractError = error{ Corrupt, UnsupportedCompression };
+
+pub const Entry = struct {
+    path: []const u8,
+    compression: Compression,
+    /// Offset and length of the stored (possibly compressed) bytes
+    offset: usize,
+    stored_len: usize,
+    /// Length after decompression
+    size: usize,
+};
+
+pub const Archive = struct {
+    bytes: []const u8,
+    entry_count: u32,
+    index_offset: usize,
+    strings_offset: usize,
+    /// Set when `bytes` is owned: either a mapping or an allocation.
+    mapping: ?[]align(std.heap.page_size_min) const u8 = null,
+    allocation: ?[]u8 = null,
+    allocator: ?std.mem.Allocator = null,
+
+    const Self = @This();
+
+    /// Map (or, without mmap, read) an archive file. The index is validated
+    /// here so that lookups never bounds-check against a malformed file.
+    pub fn open(allocator: std.mem.Allocator, path: []const u8) !Self {
+        const file = try std.fs.cwd().openFile(path, .{});
+        defer file.close();
+        const size = try file.getEndPos();
+        if (size < HeaderBytes) return error.Truncated;
+        const len: usize = @intCast(size);
+
+        if (builtin.os.tag != .windows and builtin.os.tag != .wasi) {
+            const mapping = try std.posix.mmap(null, len, std.posix.PROT.READ, .{ .TYPE = .PRIVATE }, file.handle, 0);
+            errdefer std.posix.munmap(mapping);
+            var archive = try fromBytes(mapping);
+            archive.mapping = mapping;
+            return archive;
+        }
+
+        const data = try allocator.alloc(u8, len);
+        errdefer allocator.free(data);
+        if (try file.preadAll(data, 0) != len) return error.Truncated;
+        var archive = try fromBytes(data);
+        archive.allocation = data;
+        archive.allocator = allocator;
+        return archive;
+    }
+
+    /// View an archive held in memory. `bytes` must outlive the archive.
+    pub fn fromBytes(bytes: []const u8) FormatError!Self {
+        if (bytes.len < HeaderBytes) return error.Truncated;
+        if (!std.mem.eql(u8, bytes[0..4], Magic)) return error.NotArchive;
+        if (readU32(bytes, 4) != Version) return error.UnsupportedVersion;
+
+        const entry_count = readU32(bytes, 8);
+        const index_offset = readU64(bytes, 16);
+        const strings_offset = readU64(bytes, 24);
+        if (index_offset > bytes.len or strings_offset > bytes.len) return error.Truncated;
+        if (@as(u64, entry_count) * IndexEntryBytes > bytes.len - index_offset) return error.Truncated;
+
+        const self = Self{
+            .bytes = bytes,
+            .entry_count = entry_count,
+            .index_offset = @intCast(index_offset),
+            .strings_offset = @intCast(strings_offset),
+        };
+        var prev: []const u8 = "";
+        for (0..entry_count) |i| {
+            const entry = self.entryAt(i) orelse return error.BadIndex;
+            if (i > 0 and std.mem.order(u8, prev, entry.path) != .lt) return error.BadIndex;
+            prev = entry.path;
+        }
+        return self;
+    }
+
+    pub fn close(self: *Self) void {
+        if (self.mapping) |mapping| std.posix.munmap(mapping);
+        if (self.allocation) |data| self.allocator.?.free(data);
+        self.* = undefined;
+    }
+
+    /// Binary search the sorted index for an exact path.
+    pub fn find(self: *const Self, path: []const u8) ?Entry {
+        var lo: usize = 0;
+        var hi: usize = self.entry_count;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            // Validated by fromBytes
+            const entry = self.entryAt(mid).?;
+            switch (std.mem.order(u8, path, entry.path)) {
+                .eq => return entry,
+                .lt => hi = mid,
+                .gt => lo = mid + 1,
+            }
+        }
+        return null;
+    }
+
+    /// Stored bytes of an entry, still compressed if it was packed that way.
+    pub fn storedBytes(self: *const Self, entry: Entry) []const u8 {
+        return self.bytes[entry.offset..][0..entry.stored_len];
+    }
+
+    /// Decompress (or copy) an entry into `dst`, which holds `entry.size` bytes.
+    pub fn extract(self: *const Self, entry: Entry, dst: []u8) ExtractError!void {
+        std.debug.assert(dst.len == entry.size);
+        const stored = self.storedBytes(entry);
+        switch (entry.compression) {
+            .none => @memcpy(dst, stored),
+            .lz4 => try lz4.decompress(stored, dst),
+            _ => return error.UnsupportedCompression,
+        }
+    }
+
+    fn entryAt(self: *const Self, i: usize) ?Entry {
+        const at = self.index_offset + i * IndexEntryBytes;
+        const path_offset: usize = readU32(self.bytes, at);
+        const path_len: usize = readU16(self.bytes, at + 4);
+        const compression: Compression = @enumFromInt(self.bytes[at + 6]);
+        const offset = readU64(self.bytes, at + 8);
+        const stored_len = readU64(self.bytes, at + 16);
+        const size = readU64(self.bytes, at + 24);
+
+        if (path_offset > self.bytes.len - self.strings_offset) return null;
+        const strings = self.bytes[self.strings_offset..];
+        if (path_len > strings.len - path_offset) return null;
+        if (offset > self.bytes.len or stored_len > self.bytes.len - offset) return null;
+        if (compression == .none and stored_len != size) return null;
+        if (size > std.math.maxInt(usize)) return null;
+        return .{
+            .path = strings[path_offset..][0..path_len],
+            .compression = compression,
+            .offset = @intCast(offset),
+            .stored_len = @intCast(stored_len),
+            .size = @intCast(size),
+        };
+    }
+};
+
+/// Whether a request path can name an archive entry: relative, '/'-separated
+/// and free of "." and ".." segments. "./" prefixes are stripped by callers.
+pub fn isEntryPath(path: []const u8) bool {
+    if (path.len == 0 or path.len > MaxPathLen or path[0] == '/') return false;
+    var segments = std.mem.splitScalar(u8, path, '/');
+    while (segments.next()) |segment| {
+        if (segment.len == 0 or std.mem.eql(u8, segment, ".") or std.mem.eql(u8, segment, "..")) return false;
+        if (std.mem.indexOfScalar(u8, segment, '\\') != null) return false;
+    }
+    return true;
+}
+
+// =============================================================================
+// Writing
+// =============================================================================
+
+pub const Source = struct {
+    path: []const u8,
+    data: []const u8,
+};
+
+pub const WriteOptions = struct {
+    alignment: u32 = DefaultAlignment,
+    /// Store entries as LZ4 when that saves at least 1/8 of their size.
+    compress: bool = true,
+};
+
+pub const WriteError = error{ DuplicatePath, InvalidPath, BadAlignment } ||
+    std.mem.Allocator.Error || std.Io.Writer.Error;
+
+/// Write an archive holding `sources` (in any order) to `out`.
+pub fn writeArchive(allocator: std.mem.Allocator, sources: []const Source, out: *std.Io.Writer, options: WriteOptions) WriteError!void {
+    if (options.alignment == 0 or !std.math.isPowerOfTwo(options.alignment)) return error.BadAlignment;
+
+    const order = try allocator.alloc(usize, sources.len);
+    defer allocator.free(order);
+    for (order, 0..) |*slot, i| slot.* = i;
+    std.mem.sort(usize, order, sources, struct {
+        fn lessThan(s: []const Source, a: usize, b: usize) bool {
+            return std.mem.order(u8, s[a].path, s[b].path) == .lt;
+        }
+    }.lessThan);
+
+    // Compress up front: the index needs every stored length
+    const stored = try allocator.alloc([]const u8, sources.len);
+    defer allocator.free(stored);
+    const compressed = try allocator.alloc(?[]u8, sources.len);
+    @memset(compressed, null);
+    defer {
+        for (compressed) |maybe| if (maybe) |buf| allocator.free(buf);
+        allocator.free(compressed);
+    }
+
+    var strings_len: usize = 0;
+    for (order, 0..) |src_index, i| {
+        const source = sources[src_index];
+        if (!isEntryPath(source.path)) return error.InvalidPath;
+        if (i > 0 and std.mem.eql(u8, sources[order[i - 1]].path, source.path)) return error.DuplicatePath;
+        strings_len += source.path.len;
+
+        stored[i] = source.data;
+        if (options.compress and source.data.len > 0) {
+            const buf = try allocator.alloc(u8, lz4.compressBound(source.data.len));
+            const len = lz4.compress(source.data, buf);
+            if (len <= source.data.len - source.data.len / 8) {
+                compressed[i] = buf;
+                stored[i] = buf[0..len];
+            } else {
+                allocator.free(buf);
+            }
+        }
+    }
+
+    const strings_offset = HeaderBytes + sources.len * IndexEntryBytes;
+    const data_start = std.mem.alignForward(usize, strings_offset + strings_len, options.alignment);
+
+    try out.writeAll(Magic);
+    try out.writeInt(u32, Version, .little);
+    try out.writeInt(u32, @intCast(sources.len), .little);
+    try out.writeInt(u32, options.alignment, .little);
+    try out.writeInt(u64, HeaderBytes, .little);
+    try out.writeInt(u64, strings_offset, .little);
+
+    var path_offset: usize = 0;
+    var data_offset = data_start;
+    for (order, 0..) |src_index, i| {
+        const source = sources[src_index];
+        try out.writeInt(u32, @intCast(path_offset), .little);
+        try out.writeInt(u16, @intCast(source.path.len), .little);
+        try out.writeByte(@intFromEnum(if (compressed[i] != null) Compression.lz4 else Compression.none));
+        try out.writeByte(0);
+        try out.writeInt(u64, data_offset, .little);
+        try out.writeInt(u64, stored[i].len, .little);
+        try out.writeInt(u64, source.data.len, .little);
+        path_offset += source.path.len;
+        data_offset = std.mem.alignForward(usize, data_offset + stored[i].len, options.alignment);
+    }
+    for (order) |src_index| try out.writeAll(sources[src_index].path);
+
+    var written = strings_offset + strings_len;
+    for (stored) |bytes| {
+        const aligned = std.mem.alignForward(usize, written, options.alignment);
+        try out.splatByteAll(0, aligned - written);
+        try out.writeAll(bytes);
+        written = aligned + bytes.len;
+    }
+}
+
+/// Pack every regular file below `dir` into an archive written to `out`.
+/// Paths are stored relative to `dir` with '/' separators.
+pub fn packDirectory(allocator: std.mem.Allocator, dir: std.fs.Dir, out: *std.Io.Writer, options: WriteOptions) !usize {
+    var arena_state = std.heap.ArenaAllocator.init(allocator);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    var sources: std.ArrayList(Source) = .empty;
+    var walker = try dir.walk(allocator);
+    defer walker.deinit();
+    while (try walker.next()) |item| {
+        if (item.kind != .file) continue;
+        const path = try arena.dupe(u8, item.path);
+        if (std.fs.path.sep != '/') std.mem.replaceScalar(u8, path, std.fs.path.sep, '/');
+        const data = try item.dir.readFileAlloc(arena, item.basename, std.math.maxInt(usize));
+        try sources.append(arena, .{ .path = path, .data = data });
+    }
+    try writeArchive(allocator, sources.items, out, options);
+    return sources.items.len;
+}
+
+fn readU16(bytes: []const u8, offset: usize) u16 {
+    return std.mem.readInt(u16, bytes[offset..][0..2], .little);
+}
+
+fn readU32(bytes: []const u8, offset: usize) u32 {
+    return std.mem.readInt(u32, bytes[offset..][0..4], .little);
+}
+
+fn readU64(bytes: []const u8, offset: usize) u64 {
+    return std.mem.readInt(u64, bytes[offset..][0..8], .little);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "asset archive finds, aligns and extracts entries" {
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+
+    var repetitive: [2048]u8 = undefined;
+    for (&repetitive, 0..) |*byte, i| byte.* = @intCast(i % 7);
+    const sources = [_]Source{
+        .{ .path = "textures/crate.png", .data = "\x89PNG" },
+        .{ .path = "models/level.bin", .data = &repetitive },
+        .{ .path = "a.json", .data = "{}" },
+        .{ .path = "empty.txt", .data = "" },
+    };
+    try writeArchive(testing.allocator, &sources, &aw.writer, .{ .alignment = 64 });
+
+    const archive = try Archive.fromBytes(aw.written());
+    try testing.expectEqual(@as(u32, 4), archive.entry_count);
+    try testing.expect(archive.find("missing.png") == null);
+    try testing.expect(archive.find("textures") == null);
+
+    const crate = archive.find("textures/crate.png").?;
+    try testing.expectEqual(Compression.none, crate.compression);
+    try testing.expectEqual(@as(usize, 0), crate.offset % 64);
+    try testing.expectEqualStrings("\x89PNG", archive.storedBytes(crate));
+
+    const level = archive.find("models/level.bin").?;
+    try testing.expectEqual(Compression.lz4, level.compression);
+    try testing.expect(level.stored_len < level.size);
+    var out: [2048]u8 = undefined;
+    try archive.extract(level, &out);
+    try testing.expectEqualSlices(u8, &repetitive, &out);
+
+    try testing.expectEqual(@as(usize, 0), archive.find("empty.txt").?.size);
+    try testing.expectEqualStrings("{}", archive.storedBytes(archive.find("a.json").?));
+}
+
+test "asset archive rejects bad input and unsafe paths" {
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    const dupes = [_]Source{ .{ .path = "a", .data = "1" }, .{ .path = "a", .data = "2" } };
+    try testing.expectError(error.DuplicatePath, writeArchive(testing.allocator, &dupes, &aw.writer, .{}));
+    const escaping = [_]Source{.{ .path = "../a", .data = "" }};
+    try testing.expectError(error.InvalidPath, writeArchive(testing.allocator, &escaping, &aw.writer, .{}));
+
+    try testing.expectError(error.NotArchive, Archive.fromBytes("this is not an archive, only some plain text"));
+    var header = [_]u8{0} ** HeaderBytes;
+    @memcpy(header[0..4], Magic);
+    std.mem.writeInt(u32, header[4..8], Version, .little);
+    std.mem.writeInt(u32, header[8..12], 3, .little);
+    try testing.expectError(error.Truncated, Archive.fromBytes(&header));
+
+    try testing.expect(isEntryPath("textures/crate.png"));
+    try testing.expect(!isEntryPath("/etc/passwd"));
+    try testing.expect(!isEntryPath("a/../b"));
+    try testing.expect(!isEntryPath("a//b"));
+    try testing.expect(!isEntryPath(""));
+}
@@ -0,0 +1,407 @@
+//! Background audio decode
+//!
+//! decodeAudioData() hands encoded bytes to a job on the native job system,
+//! as image_decode.zig does for images: the job decodes into planar f32
+//! samples and pushes the result into the SPSC ring of the thread that ran
+//! it, and the main thread polls those rings each frame. The mixer reads the
+//! samples as they are; buffers keep their own sample rate and are resampled
+//! while playing.
+//!
+//! Only RIFF WAVE is decoded: integer PCM (8, 16, 24 and 32 bits) and IEEE
+//! float (32 and 64 bits), including WAVE_FORMAT_EXTENSIBLE headers.
+//! Compressed formats are reported as unsupported.
+
+const std = @import("std");
+const testing = std.testing;
+const job_system = @import("job_system.zig");
+const SpscRing = @import("spsc_ring.zig").SpscRing;
+
+const JobSystem = job_system.JobSystem;
+
+/// Jobs submitted but not yet polled. Every result ring can hold this many,
+/// so a job never waits on the main thread to make room.
+pub const MaxPending: usize = 32;
+pub const MaxChannels: usize = 8;
+
+pub const DecodeError = error{ UnsupportedFormat, InvalidData, TooLarge, OutOfMemory };
+pub const SubmitError = error{ QueueFull, OutOfMemory };
+
+/// Decoded samples, planar: channel `c` is samples[c * frames ..][0..frames].
+pub const DecodedAudio = struct {
+    allocator: std.mem.Allocator,
+    samples: []f32,
+    frames: u32,
+    channels: u8,
+    sample_rate: f32,
+
+    pub fn deinit(self: *DecodedAudio) void {
+        self.allocator.free(self.samples);
+        self.* = undefined;
+    }
+};
+
+pub const Result = struct {
+    id: u32,
+    audio: DecodeError!DecodedAudio,
+
+    /// Release the samples of a result that will not be consumed.
+    pub fn discard(self: Result) void {
+        if (self.audio) |audio| {
+            var owned = audio;
+            owned.deinit();
+        } else |_| {}
+    }
+};
+
+// =============================================================================
+// WAV
+// =============================================================================
+
+const Encoding = enum { pcm_u8, pcm_s16, pcm_s24, pcm_s32, float32, float64 };
+
+const Format = struct {
+    encoding: Encoding,
+    channels: u8,
+    sample_rate: u32,
+    block_align: usize,
+};
+
+const FormatPcm: u16 = 1;
+const FormatFloat: u16 = 3;
+const FormatExtensible: u16 = 0xFFFE;
+
+/// Decode a RIFF WAVE file to planar floats in [-1, 1].
+pub fn decodeWav(allocator: std.mem.Allocator, bytes: []const u8) DecodeError!DecodedAudio {
+    if (bytes.len < 12 or !std.mem.eql(u8, bytes[0..4], "RIFF") or !std.mem.eql(u8, bytes[8..12], "WAVE")) {
+        return error.UnsupportedFormat;
+    }
+    var format: ?Format = null;
+    var data: ?[]const u8 = null;
+    var pos: usize = 12;
+    while (pos + 8 <= bytes.len) {
+        const id = bytes[pos..][0..4];
+        const size = std.mem.readInt(u32, bytes[pos + 4 ..][0..4], .little);
+        const body_start = pos + 8;
+        // A truncated last chunk (common for streamed recordings) is read
+        // up to the end of the file
+        const body = bytes[body_start..][0..@min(size, bytes.len - body_start)];
+        if (std.mem.eql(u8, id, "fmt ")) {
+            format = try parseFormat(body);
+        } else if (std.mem.eql(u8, id, "data")) {
+            data = body;
+        }
+        // Chunks are padded to an even size
+        pos = body_start + @as(usize, size) + (size & 1);
+    }
+    const fmt = format orelse return error.InvalidData;
+    const payload = data orelse return error.InvalidData;
+
+    const frame_count = payload.len / fmt.block_align;
+    if (frame_count == 0) return error.InvalidData;
+    if (frame_count > std.math.maxInt(u32)) return error.TooLarge;
+    const samples = try allocator.alloc(f32, frame_count * fmt.channels);
+    switch (fmt.encoding) {
+        inline else => |encoding| deinterleave(encoding, payload, fmt, frame_count, samples),
+    }
+    return .{
+        .allocator = allocator,
+        .samples = samples,
+        .frames = @intCast(frame_count),
+        .channels = fmt.channels,
+        .sample_rate = @floatFromInt(fmt.sample_rate),
+    };
+}
+
+fn parseFormat(body: []const u8) DecodeError!Format {
+    if (body.len < 16) return error.InvalidData;
+    var tag = std.mem.readInt(u16, body[0..2], .little);
+    const channels = std.mem.readInt(u16, body[2..4], .little);
+    const sample_rate = std.mem.readInt(u32, body[4..8], .little);
+    const block_align = std.mem.readInt(u16, body[12..14], .little);
+    const bits = std.mem.readInt(u16, body[14..16], .little);
+    if (tag == FormatExtensible) {
+        // The sub-format GUID starts with the plain format tag
+        if (body.len < 26) return error.InvalidData;
+        tag = std.mem.readInt(u16, body[24..26], .little);
+    }
+    if (channels == 0 or channels > MaxChannels or sample_rate == 0) return error.UnsupportedFormat;
+
+    const encoding: Encoding = switch (tag) {
+        FormatPcm => switch (bits) {
+            8 => .pcm_u8,
+            16 => .pcm_s16,
+            24 => .pcm_s24,
+            32 => .pcm_s32,
+            else => return error.UnsupportedFormat,
+        },
+        FormatFloat => switch (bits) {
+            32 => .float32,
+            64 => .float64,
+            else => return error.UnsupportedFormat,
+        },
+        else => return error.UnsupportedFormat,
+    };
+    if (block_align < sampleBytes(encoding) * channels) return error.InvalidData;
+    return .{
+        .encoding = encoding,
+        .channels = @intCast(channels),
+        .sample_rate = sample_rate,
+        .block_align = block_align,
+    };
+}
+
+fn sampleBytes(encoding: Encoding) usize {
+    return switch (encoding) {
+        .pcm_u8 => 1,
+        .pcm_s16 => 2,
+        .pcm_s24 => 3,
+        .pcm_s32, .float32 => 4,
+        .float64 => 8,
+    };
+}
+
+fn deinterleave(comptime encoding: Encoding, payload: []const u8, fmt: Format, frame_count: usize, out: []f32) void {
+    const size = comptime sampleBytes(encoding);
+    for (0..fmt.channels) |ch| {
+        const channel = out[ch * frame_count ..][0..frame_count];
+        var offset = ch * size;
+        for (channel) |*sample| {
+            sample.* = readSample(encoding, payload[offset..][0..size]);
+            offset += fmt.block_align;
+        }
+    }
+}
+
+fn readSample(comptime encoding: Encoding, bytes: *const [sampleBytes(encoding)]u8) f32 {
+    return switch (encoding) {
+        .pcm_u8 => (@as(f32, @floatFromInt(bytes[0])) - 128.0) / 128.0,
+        .pcm_s16 => @as(f32, @floatFromInt(std.mem.readInt(i16, bytes, .little))) / 32768.0,
+        .pcm_s24 => @as(f32, @floatFromInt(std.mem.readInt(i24, bytes, .little))) / 8388608.0,
+        .pcm_s32 => @floatCast(@as(f64, @floatFromInt(std.mem.readInt(i32, bytes, .little))) / 2147483648.0),
+        .float32 => @bitCast(std.mem.readInt(u32, bytes, .little)),
+        .float64 => @floatCast(@as(f64, @bitCast(std.mem.readInt(u64, bytes, .little)))),
+    };
+}
+
+// =============================================================================
+// Decode pool
+// =============================================================================
+
+const Job = struct {
+    job: job_system.Job,
+    pool: *DecodePool,
+    /// Set by the main thread on submit, cleared once the result is pushed
+    busy: std.atomic.Value(bool),
+    id: u32,
+    /// Encoded bytes owned by the pool
+    bytes: []u8,
+};
+
+const ResultRing = SpscRing(Result, MaxPending);
+
+pub const DecodePool = struct {
+    allocator: std.mem.Allocator = std.heap.page_allocator,
+    started: bool = false,
+    /// Runs the decodes; null decodes inline
+    jobs: ?*JobSystem = null,
+
+    slots: [MaxPending]Job = undefined,
+    next_slot: usize = 0,
+    /// Submitted jobs that have not run yet
+    outstanding: job_system.Counter = .{},
+
+    /// One ring per job system thread, indexed by job_system.threadIndex();
+    /// ring 0 also serves inline decodes.
+    results: [job_system.MaxThreads]ResultRing = [_]ResultRing{.{}} ** job_system.MaxThreads,
+    next_ring: u32 = 0,
+
+    // Main thread only
+    in_flight: u32 = 0,
+    next_id: u32 = 1,
+
+    const Self = @This();
+
+    /// Decode on `jobs`, from the thread that started it. `allocator` must
+    /// be thread-safe; decoded samples are allocated from it.
+    pub fn start(self: *Self, allocator: std.mem.Allocator, jobs: ?*JobSystem) void {
+        if (self.started) return;
+        self.allocator = allocator;
+        self.jobs = jobs;
+        for (&self.slots) |*slot| slot.busy = .init(false);
+        self.started = true;
+    }
+
+    /// Finish the jobs already submitted, then drop their results.
+    pub fn stop(self: *Self) void {
+        if (!self.started) return;
+        if (self.jobs) |jobs| jobs.wait(&self.outstanding);
+        for (&self.results) |*ring| {
+            while (ring.pop()) |result| result.discard();
+        }
+        const next_id = self.next_id;
+        self.* = .{ .next_id = next_id };
+    }
+
+    /// Queue a decode of encoded bytes (copied, so the caller's buffer may
+    /// be a JS ArrayBuffer that moves after this returns). Returns the job
+    /// id reported by poll().
+    pub fn submitBytes(self: *Self, bytes: []const u8) SubmitError!u32 {
+        if (self.in_flight >= MaxPending) return error.QueueFull;
+        const owned = try self.allocator.dupe(u8, bytes);
+        const id = self.next_id;
+        self.next_id +%= 1;
+        if (self.next_id == 0) self.next_id = 1;
+        self.in_flight += 1;
+
+        const job = self.freeSlot();
+        job.id = id;
+        job.bytes = owned;
+        job.pool = self;
+        job.job = .{ .run = runJob, .counter = &self.outstanding };
+        job.busy.store(true, .monotonic);
+        if (self.jobs) |jobs| {
+            jobs.submit(&job.job);
+        } else {
+            runJob(&job.job);
+        }
+        return id;
+    }
+
+    /// Next finished job, or null. Rings are visited round-robin so one busy
+    /// worker cannot starve the others.
+    pub fn poll(self: *Self) ?Result {
+        const ring_count = if (self.jobs) |jobs| jobs.worker_count + 1 else 1;
+        var i: u32 = 0;
+        while (i < ring_count) : (i += 1) {
+            const ring_idx = (self.next_ring + i) % ring_count;
+            if (self.results[ring_idx].pop()) |result| {
+                self.next_ring = (ring_idx + 1) % ring_count;
+                self.in_flight -= 1;
+                return result;
+            }
+        }
+        return null;
+    }
+
+    pub fn pending(self: *const Self) u32 {
+        return self.in_flight;
+    }
+
+    /// A slot whose job has run. Busy slots all have a result that is not
+    /// polled yet, so one is free while in_flight is below MaxPending.
+    fn freeSlot(self: *Self) *Job {
+        while (true) {
+            const job = &self.slots[self.next_slot];
+            self.next_slot = (self.next_slot + 1) % MaxPending;
+            if (!job.busy.load(.acquire)) return job;
+        }
+    }
+};
+
+/// Decode a job and hand the result to the ring of the running thread.
+fn runJob(job_ptr: *job_system.Job) void {
+    const job: *Job = @fieldParentPtr("job", job_ptr);
+    const pool = job.pool;
+    const audio = decodeWav(pool.allocator, job.bytes);
+    pool.allocator.free(job.bytes);
+    // in_flight never exceeds MaxPending, the capacity of every ring
+    const pushed = pool.results[job_system.threadIndex()].push(.{ .id = job.id, .audio = audio });
+    std.debug.assert(pushed);
+    job.busy.store(false, .release);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+/// A WAV file with one `fmt ` chunk of `format_bytes` and the given data.
+fn buildWav(buf: []u8, format_bytes: []const u8, data: []const u8) []u8 {
+    var len: usize = 0;
+    const parts = [_][]const u8{ "RIFF", "\x00\x00\x00\x00", "WAVE", "fmt ", "", format_bytes, "data", "", data };
+    for (parts, 0..) |part, i| {
+        if (i == 4 or i == 7) {
+            const size: u32 = @intCast(if (i == 4) format_bytes.len else data.len);
+            std.mem.writeInt(u32, buf[len..][0..4], size, .little);
+            len += 4;
+            continue;
+        }
+        @memcpy(buf[len..][0..part.len], part);
+        len += part.len;
+    }
+    std.mem.writeInt(u32, buf[4..8], @intCast(len - 8), .little);
+    return buf[0..len];
+}
+
+fn formatChunk(buf: *[16]u8, tag: u16, channels: u16, rate: u32, bits: u16) []const u8 {
+    const block: u16 = channels * (bits / 8);
+    std.mem.writeInt(u16, buf[0..2], tag, .little);
+    std.mem.writeInt(u16, buf[2..4], channels, .little);
+    std.mem.writeInt(u32, buf[4..8], rate, .little);
+    std.mem.writeInt(u32, buf[8..12], rate * block, .little);
+    std.mem.writeInt(u16, buf[12..14], block, .little);
+    std.mem.writeInt(u16, buf[14..16], bits, .little);
+    return buf;
+}
+
+test "decodeWav converts PCM and float samples to planar floats" {
+    var file: [128]u8 = undefined;
+    var fmt: [16]u8 = undefined;
+
+    // Stereo 16-bit: frames (L, R) = (16384, -32768), (0, 32767)
+    const pcm16 = [_]u8{ 0x00, 0x40, 0x00, 0x80, 0x00, 0x00, 0xFF, 0x7F };
+    var stereo = try decodeWav(testing.allocator, buildWav(&file, formatChunk(&fmt, FormatPcm, 2, 22050, 16), &pcm16));
+    defer stereo.deinit();
+    try testing.expectEqual(@as(u8, 2), stereo.channels);
+    try testing.expectEqual(@as(u32, 2), stereo.frames);
+    try testing.expectEqual(@as(f32, 22050), stereo.sample_rate);
+    try testing.expectEqualSlices(f32, &.{ 0.5, 0.0, -1.0, 32767.0 / 32768.0 }, stereo.samples);
+
+    // Mono 8-bit (unsigned) and 24-bit
+    var mono8 = try decodeWav(testing.allocator, buildWav(&file, formatChunk(&fmt, FormatPcm, 1, 8000, 8), &.{ 128, 0, 192 }));
+    defer mono8.deinit();
+    try testing.expectEqualSlices(f32, &.{ 0.0, -1.0, 0.5 }, mono8.samples);
+    var mono24 = try decodeWav(testing.allocator, buildWav(&file, formatChunk(&fmt, FormatPcm, 1, 8000, 24), &.{ 0x00, 0x00, 0xC0 }));
+    defer mono24.deinit();
+    try testing.expectEqualSlices(f32, &.{-0.5}, mono24.samples);
+
+    var float_bytes: [8]u8 = undefined;
+    std.mem.writeInt(u32, float_bytes[0..4], @bitCast(@as(f32, 0.25)), .little);
+    std.mem.writeInt(u32, float_bytes[4..8], @bitCast(@as(f32, -0.75)), .little);
+    var float32 = try decodeWav(testing.allocator, buildWav(&file, formatChunk(&fmt, FormatFloat, 1, 48000, 32), &float_bytes));
+    defer float32.deinit();
+    try testing.expectEqualSlices(f32, &.{ 0.25, -0.75 }, float32.samples);
+}
+
+test "decodeWav rejects other formats and malformed files" {
+    var file: [128]u8 = undefined;
+    var fmt: [16]u8 = undefined;
+    try testing.expectError(error.UnsupportedFormat, decodeWav(testing.allocator, "OggS\x00\x02\x00\x00\x00\x00\x00\x00"));
+    try testing.expectError(error.UnsupportedFormat, decodeWav(testing.allocator, "RIFF"));
+    // 12-bit PCM, and a missing data chunk
+    try testing.expectError(error.UnsupportedFormat, decodeWav(testing.allocator, buildWav(&file, formatChunk(&fmt, FormatPcm, 1, 8000, 12), &.{ 0, 0 })));
+    const no_data = buildWav(&file, formatChunk(&fmt, FormatPcm, 1, 8000, 16), &.{});
+    try testing.expectError(error.InvalidData, decodeWav(testing.allocator, no_data));
+}
+
+test "DecodePool without a job system decodes inline" {
+    var pool = DecodePool{};
+    pool.start(testing.allocator, null);
+    defer pool.stop();
+
+    var file: [128]u8 = undefined;
+    var fmt: [16]u8 = undefined;
+    const good = buildWav(&file, formatChunk(&fmt, FormatPcm, 1, 8000, 8), &.{ 128, 255 });
+    const good_id = try pool.submitBytes(good);
+    const bad_id = try pool.submitBytes("not audio");
+    try testing.expectEqual(@as(u32, 2), pool.pending());
+
+    const first = pool.poll().?;
+    try testing.expectEqual(good_id, first.id);
+    var audio = try first.audio;
+    defer audio.deinit();
+    try testing.expectEqual(@as(u32, 2), audio.frames);
+    const second = pool.poll().?;
+    try testing.expectEqual(bad_id, second.id);
+    try testing.expectError(error.UnsupportedFormat, second.audio);
+    try testing.expect(pool.poll() == null);
+}
@@ -0,0 +1,316 @@
+//! Contiguous block allocator for the CPU staging pools
+//!
+//! Buffers and textures uploaded before the GPU backend is live keep their
+//! bytes here. Free blocks are tracked in a bitmap that is scanned and
+//! updated a 64-bit word at a time: fully used regions cost one compare per
+//! 64 blocks and free runs are measured with @ctz instead of per-block flags.
+//! Storage is reserved from the page allocator on first use and block data
+//! is left untouched until it is allocated, so only the pages a game
+//! actually stages through are committed. The block count can be changed
+//! at startup with configure().
+
+const std = @import("std");
+const testing = std.testing;
+const lazy_pages = @import("lazy_pages.zig");
+
+const allocator = std.heap.page_allocator;
+
+/// Slices address blocks with u16, which bounds every pool.
+pub const MaxBlockCount: usize = std.math.maxInt(u16);
+
+pub const CpuSlice = struct {
+    block_start: u16,
+    block_count: u16,
+    size: u32,
+};
+
+pub const PoolStats = struct {
+    block_size: u32 = 0,
+    block_count: u32 = 0,
+    used_blocks: u32 = 0,
+    peak_used_blocks: u32 = 0,
+    live_slices: u32 = 0,
+    /// Longest run of free blocks; the largest allocation that can succeed.
+    largest_free_run: u32 = 0,
+    failed_allocs: u32 = 0,
+    /// Failures where enough blocks were free, just not contiguous.
+    fragmented_failures: u32 = 0,
+
+    pub fn freeBlocks(self: PoolStats) u32 {
+        return self.block_count - self.used_blocks;
+    }
+
+    /// 0 when all free space is one run, approaching 1 as it splinters.
+    pub fn fragmentation(self: PoolStats) f32 {
+        const free_blocks = self.freeBlocks();
+        if (free_blocks == 0) return 0;
+        const run: f32 = @floatFromInt(self.largest_free_run);
+        const total: f32 = @floatFromInt(free_blocks);
+        return 1.0 - run / total;
+    }
+};
+
+pub fn BlockPool(comptime block_size: usize, comptime default_block_count: usize) type {
+    comptime std.debug.assert(default_block_count <= MaxBlockCount);
+
+    return struct {
+        data: []u8 = &.{},
+        /// One bit per block, set when free. Bits past block_count stay clear.
+        free_bits: []u64 = &.{},
+        block_count: u32 = default_block_count,
+        used_blocks: u32 = 0,
+        peak_used_blocks: u32 = 0,
+        live_slices: u32 = 0,
+        failed_allocs: u32 = 0,
+        fragmented_failures: u32 = 0,
+
+        const Self = @This();
+        pub const BlockSizeBytes = block_size;
+
+        /// Set the pool size in bytes (rounded up to whole blocks). Only
+        /// allowed while nothing is allocated; storage is reserved lazily.
+        pub fn configure(self: *Self, bytes: usize) !void {
+            const blocks = (bytes + block_size - 1) / block_size;
+            if (blocks == 0 or blocks > MaxBlockCount) return error.InvalidSize;
+            if (self.live_slices != 0) return error.PoolInUse;
+            self.releaseStorage();
+            self.block_count = @intCast(blocks);
+        }
+
+        pub fn deinit(self: *Self) void {
+            self.releaseStorage();
+            const block_count = self.block_count;
+            self.* = .{ .block_count = block_count };
+        }
+
+        pub fn reset(self: *Self) void {
+            if (self.free_bits.len != 0) self.markAllFree();
+            self.used_blocks = 0;
+            self.live_slices = 0;
+        }
+
+        pub fn capacityBytes(self: *const Self) usize {
+            return @as(usize, self.block_count) * block_size;
+        }
+
+        pub fn alloc(self: *Self, size: usize) !CpuSlice {
+            if (size == 0) return error.InvalidSize;
+            const blocks_needed = (size + block_size - 1) / block_size;
+            if (blocks_needed > self.block_count) return error.TooLarge;
+            try self.ensureStorage();
+
+            const need: u32 = @intCast(blocks_needed);
+            const start = self.findRun(need) orelse {
+                self.failed_allocs += 1;
+                if (self.block_count - self.used_blocks >= need) self.fragmented_failures += 1;
+                return error.OutOfMemory;
+            };
+            self.setRange(start, need, false);
+            self.used_blocks += need;
+            self.peak_used_blocks = @max(self.peak_used_blocks, self.used_blocks);
+            self.live_slices += 1;
+            return .{
+                .block_start = @intCast(start),
+                .block_count = @intCast(need),
+                .size = @intCast(size),
+            };
+        }
+
+        pub fn free(self: *Self, cpu_slice: CpuSlice) void {
+            if (cpu_slice.block_count == 0 or self.free_bits.len == 0) return;
+            self.setRange(cpu_slice.block_start, cpu_slice.block_count, true);
+            self.used_blocks -|= cpu_slice.block_count;
+            self.live_slices -|= 1;
+        }
+
+        pub fn slice(self: *Self, cpu_slice: CpuSlice) []u8 {
+            const start = @as(usize, cpu_slice.block_start) * block_size;
+            return self.data[start .. start + @as(usize, cpu_slice.size)];
+        }
+
+        pub fn constSlice(self: *const Self, cpu_slice: CpuSlice) []const u8 {
+            const start = @as(usize, cpu_slice.block_start) * block_size;
+            return self.data[start .. start + @as(usize, cpu_slice.size)];
+        }
+
+        pub fn stats(self: *const Self) PoolStats {
+            return .{
+                .block_size = @intCast(block_size),
+                .block_count = self.block_count,
+                .used_blocks = self.used_blocks,
+                .peak_used_blocks = self.peak_used_blocks,
+                .live_slices = self.live_slices,
+                .largest_free_run = self.largestFreeRun(),
+                .failed_allocs = self.failed_allocs,
+                .fragmented_failures = self.fragmented_failures,
+            };
+        }
+
+        fn ensureStorage(self: *Self) !void {
+            if (self.free_bits.len != 0) return;
+            const word_count = (@as(usize, self.block_count) + 63) / 64;
+            const bits = try allocator.alloc(u64, word_count);
+            errdefer allocator.free(bits);
+            // Contents are written before they are read
+            self.data = try lazy_pages.alloc(allocator, u8, self.capacityBytes());
+            self.free_bits = bits;
+            self.markAllFree();
+        }
+
+        fn releaseStorage(self: *Self) void {
+            if (self.free_bits.len == 0) return;
+            lazy_pages.free(allocator, self.data);
+            allocator.free(self.free_bits);
+            self.data = &.{};
+            self.free_bits = &.{};
+            self.used_blocks = 0;
+            self.live_slices = 0;
+        }
+
+        fn markAllFree(self: *Self) void {
+            @memset(self.free_bits, 0);
+            self.setRange(0, self.block_count, true);
+        }
+
+        /// First-fit search for `need` contiguous free blocks.
+        fn findRun(self: *const Self, need: u32) ?u32 {
+            var run_start: u32 = 0;
+            var run_len: u32 = 0;
+            for (self.free_bits, 0..) |word, w| {
+                const base: u32 = @intCast(w * 64);
+                if (word == 0) {
+                    run_len = 0;
+                    continue;
+                }
+                if (word == ~@as(u64, 0)) {
+                    if (run_len == 0) run_start = base;
+                    run_len += 64;
+                    if (run_len >= need) return run_start;
+                    continue;
+                }
+                var bit: u32 = 0;
+                while (bit < 64) {
+                    const rest = word >> @intCast(bit);
+                    if (rest & 1 == 0) {
+                        // Used block: jump to the next free one in this word
+                        run_len = 0;
+                        if (rest == 0) break;
+                        bit += @ctz(rest);
+                        continue;
+                    }
+                    const free_len: u32 = @min(@as(u32, @ctz(~rest)), 64 - bit);
+                    if (run_len == 0) run_start = base + bit;
+                    run_len += free_len;
+                    if (run_len >= need) return run_start;
+                    bit += free_len;
+                }
+            }
+            return null;
+        }
+
+        fn largestFreeRun(self: *const Self) u32 {
+            var best: u32 = 0;
+            var run_len: u32 = 0;
+            for (self.free_bits) |word| {
+                if (word == ~@as(u64, 0)) {
+                    run_len += 64;
+                    continue;
+                }
+                var bit: u32 = 0;
+                while (bit < 64) {
+                    const rest = word >> @intCast(bit);
+                    if (rest & 1 == 0) {
+                        best = @max(best, run_len);
+                        run_len = 0;
+                        if (rest == 0) break;
+                        bit += @ctz(rest);
+                        continue;
+                    }
+                    const free_len: u32 = @min(@as(u32, @ctz(~rest)), 64 - bit);
+                    run_len += free_len;
+                    bit += free_len;
+                }
+            }
+            return @max(best, run_len);
+        }
+
+        fn setRange(self: *Self, start: u32, count: u32, free_state: bool) void {
+            var idx = start;
+            var remaining = count;
+            while (remaining > 0) {
+                const w = idx / 64;
+                const bit: u32 = idx % 64;
+                const n = @min(remaining, 64 - bit);
+                const ones: u64 = if (n == 64) ~@as(u64, 0) else (@as(u64, 1) << @intCast(n)) - 1;
+                const mask = ones << @intCast(bit);
+                if (free_state) {
+                    self.free_bits[w] |= mask;
+                } else {
+                    self.free_bits[w] &= ~mask;
+                }
+                idx += n;
+                remaining -= n;
+            }
+        }
+    };
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+const TestPool = BlockPool(64, 200);
+
+test "BlockPool first-fit reuses freed runs across word boundaries" {
+    var pool = TestPool{};
+    defer pool.deinit();
+
+    const a = try pool.alloc(60 * 64);
+    const b = try pool.alloc(10 * 64);
+    try testing.expectEqual(@as(u16, 0), a.block_start);
+    try testing.expectEqual(@as(u16, 60), b.block_start);
+    try testing.expectEqual(@as(u16, 10), b.block_count);
+
+    pool.free(a);
+    const c = try pool.alloc(1);
+    try testing.expectEqual(@as(u16, 0), c.block_start);
+
+    // 59 free blocks at 1..59 are too short; the run after b spans words
+    const d = try pool.alloc(100 * 64);
+    try testing.expectEqual(@as(u16, 70), d.block_start);
+    try testing.expectEqual(@as(u32, 1 + 10 + 100), pool.stats().used_blocks);
+}
+
+test "BlockPool reports fragmentation and fragmented failures" {
+    var pool = TestPool{};
+    defer pool.deinit();
+
+    var slices: [200]CpuSlice = undefined;
+    for (&slices) |*s| s.* = try pool.alloc(1);
+    try testing.expectError(error.OutOfMemory, pool.alloc(1));
+    for (slices, 0..) |s, i| {
+        if (i % 2 == 0) pool.free(s);
+    }
+
+    try testing.expectError(error.OutOfMemory, pool.alloc(2 * 64));
+    const st = pool.stats();
+    try testing.expectEqual(@as(u32, 100), st.freeBlocks());
+    try testing.expectEqual(@as(u32, 1), st.largest_free_run);
+    try testing.expectEqual(@as(u32, 2), st.failed_allocs);
+    try testing.expectEqual(@as(u32, 1), st.fragmented_failures);
+    try testing.expect(st.fragmentation() > 0.9);
+}
+
+test "BlockPool configure resizes only while empty" {
+    var pool = TestPool{};
+    defer pool.deinit();
+
+    try pool.configure(1000 * 64);
+    try testing.expectEqual(@as(usize, 1000 * 64), pool.capacityBytes());
+    const s = try pool.alloc(999 * 64);
+    try testing.expectError(error.PoolInUse, pool.configure(64));
+    try testing.expectError(error.InvalidSize, pool.configure((MaxBlockCount + 1) * 64));
+    pool.free(s);
+    try pool.configure(64);
+    try testing.expectError(error.TooLarge, pool.alloc(65));
+}
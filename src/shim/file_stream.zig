@@ -0,0 +1,478 @@
+//! Background file streaming
+//!
+//! fetch() bodies are read on IO threads in fixed-size chunks so that a
+//! large load never stalls the JS thread and scripts can consume a body
+//! while the rest of it is still arriving. Every stream produces `opened`
+//! (with the body length), zero or more `chunk`s and then `done`, or a
+//! `failed` at any point. Events travel back through one SPSC ring per
+//! worker; a full ring makes its worker wait, which bounds the chunk memory
+//! held between the threads to RingCapacity * ChunkBytes per worker.
+//!
+//! Streams read either a loose file or an entry of a mounted asset archive
+//! (decompressed on the worker). A pool started with zero workers does the
+//! same work one chunk per poll() on the calling thread.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const testing = std.testing;
+const asset_archive = @import("asset_archive.zig");
+const SpscRing = @import("spsc_ring.zig").SpscRing;
+
+pub const MaxWorkers: usize = 2;
+pub const MaxStreams: usize = 64;
+pub const MaxPathLen: usize = 1024;
+pub const ChunkBytes: usize = 256 * 1024;
+const RingCapacity: usize = 32;
+/// Ids stay below 2^30 so that JS sees them as small integers.
+const MaxStreamId: u32 = 1 << 30;
+
+pub const SubmitError = error{ TooManyStreams, PathTooLong };
+
+pub const StreamError = error{
+    FileNotFound,
+    AccessDenied,
+    ReadFailed,
+    RangeNotSatisfiable,
+    CorruptArchive,
+    OutOfMemory,
+    Cancelled,
+};
+
+/// Body byte range; `end` is exclusive and null reads to the end.
+pub const Range = struct {
+    start: u64 = 0,
+    end: ?u64 = null,
+};
+
+pub const Source = union(enum) {
+    /// Path of a loose file, copied into the stream
+    file: []const u8,
+    /// Entry of an archive that stays mounted while the stream runs
+    archived: struct {
+        archive: *const asset_archive.Archive,
+        entry: asset_archive.Entry,
+    },
+};
+
+pub const Event = struct {
+    id: u32,
+    slot: u16,
+    kind: union(enum) {
+        /// Body length after the range is applied, and the whole resource size
+        opened: struct { len: u64, resource_size: u64 },
+        /// Next body bytes, allocated from the pool's allocator
+        chunk: []u8,
+        done,
+        failed: StreamError,
+    },
+
+    pub fn isFinal(self: Event) bool {
+        return switch (self.kind) {
+            .done, .failed => true,
+            else => false,
+        };
+    }
+
+    /// Release the bytes of an event that will not be consumed.
+    pub fn discard(self: Event, allocator: std.mem.Allocator) void {
+        switch (self.kind) {
+            .chunk => |bytes| allocator.free(bytes),
+            else => {},
+        }
+    }
+};
+
+const Stream = struct {
+    /// Main thread only: set from submit until the final event is polled
+    active: bool = false,
+    id: u32 = 0,
+    cancelled: std.atomic.Value(bool) = .init(false),
+    range: Range = .{},
+    archived: ?asset_archive.Entry = null,
+    archive: ?*const asset_archive.Archive = null,
+    path_len: u16 = 0,
+    path: [MaxPathLen]u8 = undefined,
+};
+
+const EventRing = SpscRing(Event, RingCapacity);
+
+pub const StreamPool = struct {
+    allocator: std.mem.Allocator = std.heap.page_allocator,
+    started: bool = false,
+    threads: [MaxWorkers]std.Thread = undefined,
+    worker_count: u32 = 0,
+
+    mutex: std.Thread.Mutex = .{},
+    work_ready: std.Thread.Condition = .{},
+    shutting_down: std.atomic.Value(bool) = .init(false),
+    /// Slots waiting for a worker, oldest first
+    queue: [MaxStreams]u16 = undefined,
+    queue_head: usize = 0,
+    queue_len: usize = 0,
+
+    streams: [MaxStreams]Stream = [_]Stream{.{}} ** MaxStreams,
+    results: [MaxWorkers]EventRing = [_]EventRing{.{}} ** MaxWorkers,
+    next_ring: u32 = 0,
+    /// Stream being stepped by poll() when there are no workers
+    inline_reader: ?Reader = null,
+
+    // Main thread only
+    next_id: u32 = 1,
+
+    const Self = @This();
+
+    /// Spawn up to `worker_count` IO threads. `allocator` must be
+    /// thread-safe; chunks are allocated from it.
+    pub fn start(self: *Self, allocator: std.mem.Allocator, worker_count: u32) void {
+        if (self.started) return;
+        self.allocator = allocator;
+        self.shutting_down.store(false, .monotonic);
+        self.started = true;
+        if (builtin.single_threaded) return;
+        const count: u32 = @intCast(@min(worker_count, MaxWorkers));
+        while (self.worker_count < count) {
+            self.threads[self.worker_count] = std.Thread.spawn(.{}, workerMain, .{ self, self.worker_count }) catch |err| {
+                std.log.warn("file stream worker unavailable: {s}", .{@errorName(err)});
+                break;
+            };
+            self.worker_count += 1;
+        }
+    }
+
+    /// Join the workers and drop queued streams and unpolled events.
+    pub fn stop(self: *Self) void {
+        if (!self.started) return;
+        self.mutex.lock();
+        self.shutting_down.store(true, .release);
+        self.mutex.unlock();
+        self.work_ready.broadcast();
+        for (self.threads[0..self.worker_count]) |thread| thread.join();
+
+        for (&self.results) |*ring| {
+            while (ring.pop()) |event| event.discard(self.allocator);
+        }
+        if (self.inline_reader) |*reader| reader.close(self.allocator);
+        const next_id = self.next_id;
+        self.* = .{ .next_id = next_id };
+    }
+
+    /// Queue a stream. Returns the id reported by its events.
+    pub fn submit(self: *Self, source: Source, range: Range) SubmitError!u32 {
+        const slot = for (&self.streams, 0..) |*candidate, i| {
+            if (!candidate.active) break i;
+        } else return error.TooManyStreams;
+        const stream = &self.streams[slot];
+        switch (source) {
+            .file => |path| {
+                if (path.len > MaxPathLen) return error.PathTooLong;
+                @memcpy(stream.path[0..path.len], path);
+                stream.path_len = @intCast(path.len);
+                stream.archive = null;
+                stream.archived = null;
+            },
+            .archived => |archived| {
+                stream.path_len = 0;
+                stream.archive = archived.archive;
+                stream.archived = archived.entry;
+            },
+        }
+        const id = self.next_id;
+        self.next_id += 1;
+        if (self.next_id == MaxStreamId) self.next_id = 1;
+        stream.active = true;
+        stream.id = id;
+        stream.range = range;
+        stream.cancelled.store(false, .monotonic);
+
+        self.mutex.lock();
+        self.queue[(self.queue_head + self.queue_len) % MaxStreams] = @intCast(slot);
+        self.queue_len += 1;
+        self.mutex.unlock();
+        self.work_ready.signal();
+        return id;
+    }
+
+    /// Ask a stream to stop early. Its remaining events end with
+    /// `failed: Cancelled` (or whatever was already queued).
+    pub fn cancel(self: *Self, id: u32) void {
+        for (&self.streams) |*stream| {
+            if (stream.active and stream.id == id) {
+                stream.cancelled.store(true, .release);
+                return;
+            }
+        }
+    }
+
+    /// Next event, or null. Rings are visited round-robin so one busy
+    /// worker cannot starve the others.
+    pub fn poll(self: *Self) ?Event {
+        const event = self.nextEvent() orelse return null;
+        if (event.isFinal()) self.streams[event.slot].active = false;
+        return event;
+    }
+
+    pub fn activeStreams(self: *const Self) u32 {
+        var count: u32 = 0;
+        for (&self.streams) |*stream| count += @intFromBool(stream.active);
+        return count;
+    }
+
+    fn nextEvent(self: *Self) ?Event {
+        if (self.worker_count == 0) return self.stepInline();
+        var i: u32 = 0;
+        while (i < self.worker_count) : (i += 1) {
+            const ring_idx = (self.next_ring + i) % self.worker_count;
+            if (self.results[ring_idx].pop()) |event| {
+                self.next_ring = (ring_idx + 1) % self.worker_count;
+                return event;
+            }
+        }
+        return null;
+    }
+
+    fn stepInline(self: *Self) ?Event {
+        while (true) {
+            if (self.inline_reader == null) {
+                const slot = self.takeQueued() orelse return null;
+                self.inline_reader = Reader.init(self, slot);
+            }
+            if (self.inline_reader.?.step(self)) |event| return event;
+            self.inline_reader = null;
+        }
+    }
+
+    fn takeQueued(self: *Self) ?u16 {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        if (self.queue_len == 0) return null;
+        const slot = self.queue[self.queue_head];
+        self.queue_head = (self.queue_head + 1) % MaxStreams;
+        self.queue_len -= 1;
+        return slot;
+    }
+
+    fn workerMain(self: *Self, index: u32) void {
+        while (true) {
+            self.mutex.lock();
+            while (self.queue_len == 0 and !self.shutting_down.load(.monotonic)) self.work_ready.wait(&self.mutex);
+            if (self.shutting_down.load(.monotonic)) {
+                self.mutex.unlock();
+                return;
+            }
+            const slot = self.queue[self.queue_head];
+            self.queue_head = (self.queue_head + 1) % MaxStreams;
+            self.queue_len -= 1;
+            self.mutex.unlock();
+
+            var reader = Reader.init(self, slot);
+            while (reader.step(self)) |event| {
+                if (self.shutting_down.load(.acquire) or !self.pushBlocking(index, event)) {
+                    event.discard(self.allocator);
+                    reader.close(self.allocator);
+                    return;
+                }
+            }
+        }
+    }
+
+    /// Wait for room in the worker's ring; false when the pool is stopping.
+    fn pushBlocking(self: *Self, index: u32, event: Event) bool {
+        while (!self.results[index].push(event)) {
+            if (self.shutting_down.load(.acquire)) return false;
+            std.Thread.sleep(200 * std.time.ns_per_us);
+        }
+        return true;
+    }
+};
+
+/// Per-stream read state, stepped one event at a time.
+const Reader = struct {
+    slot: u16,
+    id: u32,
+    state: enum { opening, reading, finished } = .opening,
+    file: ?std.fs.File = null,
+    /// Body source for archive entries: the mapping, or a decompressed copy
+    memory: ?[]const u8 = null,
+    owned: ?[]u8 = null,
+    offset: u64 = 0,
+    remaining: u64 = 0,
+
+    fn init(pool: *StreamPool, slot: u16) Reader {
+        return .{ .slot = slot, .id = pool.streams[slot].id };
+    }
+
+    fn step(self: *Reader, pool: *StreamPool) ?Event {
+        const stream = &pool.streams[self.slot];
+        if (self.state == .finished) return null;
+        if (stream.cancelled.load(.acquire)) return self.finish(pool.allocator, .{ .failed = error.Cancelled });
+        return switch (self.state) {
+            .opening => self.open(pool.allocator, stream),
+            .reading => self.readChunk(pool.allocator),
+            .finished => unreachable,
+        };
+    }
+
+    fn open(self: *Reader, allocator: std.mem.Allocator, stream: *const Stream) Event {
+        const size = self.openSource(allocator, stream) catch |err| return self.finish(allocator, .{ .failed = err });
+        const start = stream.range.start;
+        const end = @min(stream.range.end orelse size, size);
+        if (start > end or (start == size and size > 0)) return self.finish(allocator, .{ .failed = error.RangeNotSatisfiable });
+        self.offset = start;
+        self.remaining = end - start;
+        self.state = .reading;
+        return self.event(.{ .opened = .{ .len = self.remaining, .resource_size = size } });
+    }
+
+    fn openSource(self: *Reader, allocator: std.mem.Allocator, stream: *const Stream) StreamError!u64 {
+        if (stream.archived) |entry| {
+            const archive = stream.archive.?;
+            if (entry.compression == .none) {
+                self.memory = archive.storedBytes(entry);
+            } else {
+                const bytes = try allocator.alloc(u8, entry.size);
+                self.owned = bytes;
+                archive.extract(entry, bytes) catch return error.CorruptArchive;
+                self.memory = bytes;
+            }
+            return entry.size;
+        }
+        const file = std.fs.cwd().openFile(stream.path[0..stream.path_len], .{}) catch |err| return switch (err) {
+            error.FileNotFound => error.FileNotFound,
+            error.AccessDenied => error.AccessDenied,
+            else => error.ReadFailed,
+        };
+        self.file = file;
+        return file.getEndPos() catch error.ReadFailed;
+    }
+
+    fn readChunk(self: *Reader, allocator: std.mem.Allocator) Event {
+        if (self.remaining == 0) return self.finish(allocator, .done);
+        const len: usize = @intCast(@min(self.remaining, ChunkBytes));
+        const chunk = allocator.alloc(u8, len) catch return self.finish(allocator, .{ .failed = error.OutOfMemory });
+        if (self.memory) |memory| {
+            const from: usize = @intCast(self.offset);
+            @memcpy(chunk, memory[from..][0..len]);
+        } else {
+            const read = self.file.?.preadAll(chunk, self.offset) catch 0;
+            // Read errors and files that shrank since they were opened
+            if (read != len) {
+                allocator.free(chunk);
+                return self.finish(allocator, .{ .failed = error.ReadFailed });
+            }
+        }
+        self.offset += len;
+        self.remaining -= len;
+        return self.event(.{ .chunk = chunk });
+    }
+
+    fn finish(self: *Reader, allocator: std.mem.Allocator, kind: @FieldType(Event, "kind")) Event {
+        self.close(allocator);
+        self.state = .finished;
+        return self.event(kind);
+    }
+
+    fn close(self: *Reader, allocator: std.mem.Allocator) void {
+        if (self.file) |file| file.close();
+        if (self.owned) |bytes| allocator.free(bytes);
+        self.file = null;
+        self.owned = null;
+        self.memory = null;
+    }
+
+    fn event(self: *const Reader, kind: @FieldType(Event, "kind")) Event {
+        return .{ .id = self.id, .slot = self.slot, .kind = kind };
+    }
+};
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn pollBlocking(pool: *StreamPool) Event {
+    while (true) {
+        if (pool.poll()) |event| return event;
+        std.Thread.yield() catch {};
+    }
+}
+
+/// Collect one stream's body; returns the failure if it did not finish.
+fn drain(pool: *StreamPool, id: u32, body: *std.ArrayList(u8)) !?StreamError {
+    while (true) {
+        const event = pollBlocking(pool);
+        try testing.expectEqual(id, event.id);
+        switch (event.kind) {
+            .opened => {},
+            .chunk => |bytes| {
+                defer testing.allocator.free(bytes);
+                try body.appendSlice(testing.allocator, bytes);
+            },
+            .done => return null,
+            .failed => |err| return err,
+        }
+    }
+}
+
+test "StreamPool streams files in chunks and honours ranges" {
+    const path = "/tmp/file_stream_test.bin";
+    {
+        const file = try std.fs.cwd().createFile(path, .{});
+        defer file.close();
+        var buf: [1000]u8 = undefined;
+        for (0..(ChunkBytes * 2) / buf.len + 1) |block| {
+            for (&buf, 0..) |*byte, i| byte.* = @truncate(block * buf.len + i);
+            try file.writeAll(&buf);
+        }
+    }
+    defer std.fs.cwd().deleteFile(path) catch {};
+
+    for ([_]u32{ 0, 1 }) |workers| {
+        var pool = StreamPool{};
+        pool.start(testing.allocator, workers);
+        defer pool.stop();
+
+        var body: std.ArrayList(u8) = .empty;
+        defer body.deinit(testing.allocator);
+        const whole = try pool.submit(.{ .file = path }, .{});
+        try testing.expect(try drain(&pool, whole, &body) == null);
+        try testing.expect(body.items.len > ChunkBytes * 2);
+        try testing.expectEqual(@as(u8, 255), body.items[255]);
+
+        body.clearRetainingCapacity();
+        const ranged = try pool.submit(.{ .file = path }, .{ .start = 10, .end = 14 });
+        try testing.expect(try drain(&pool, ranged, &body) == null);
+        try testing.expectEqualSlices(u8, &[_]u8{ 10, 11, 12, 13 }, body.items);
+
+        const missing = try pool.submit(.{ .file = "/nonexistent/file_stream.bin" }, .{});
+        try testing.expectEqual(@as(?StreamError, error.FileNotFound), try drain(&pool, missing, &body));
+        try testing.expectEqual(@as(u32, 0), pool.activeStreams());
+    }
+}
+
+test "StreamPool serves archive entries and cancels streams" {
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    var level: [3000]u8 = undefined;
+    for (&level, 0..) |*byte, i| byte.* = @intCast(i % 3);
+    const sources = [_]asset_archive.Source{.{ .path = "level.bin", .data = &level }};
+    try asset_archive.writeArchive(testing.allocator, &sources, &aw.writer, .{});
+    const archive = try asset_archive.Archive.fromBytes(aw.written());
+
+    var pool = StreamPool{};
+    pool.start(testing.allocator, 0);
+    defer pool.stop();
+
+    var body: std.ArrayList(u8) = .empty;
+    defer body.deinit(testing.allocator);
+    const entry = archive.find("level.bin").?;
+    const id = try pool.submit(.{ .archived = .{ .archive = &archive, .entry = entry } }, .{ .start = 1 });
+    try testing.expect(try drain(&pool, id, &body) == null);
+    try testing.expectEqualSlices(u8, level[1..], body.items);
+
+    const cancelled = try pool.submit(.{ .archived = .{ .archive = &archive, .entry = entry } }, .{});
+    try testing.expect(pool.poll().?.kind == .opened);
+    pool.cancel(cancelled);
+    try testing.expectEqual(@as(?StreamError, error.Cancelled), try drain(&pool, cancelled, &body));
+
+    const past_end = try pool.submit(.{ .archived = .{ .archive = &archive, .entry = entry } }, .{ .start = 5000 });
+    try testing.expectEqual(@as(?StreamError, error.RangeNotSatisfiable), try drain(&pool, past_end, &body));
+}
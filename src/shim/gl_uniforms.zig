@@ -24,19 +24,68 @@ var glUniformMatrix2fv_ptr: ?*const fn (GLint, GLsizei, GLboolean, [*c]const GLf
 var glUniformMatrix3fv_ptr: ?*const fn (GLint, GLsizei, GLboolean, [*c]const GLfloat) callconv(.c) void = null;
 var glUseProgram_ptr: ?*const fn (GLuint) callconv(.c) void = null;
 var glGetIntegerv_ptr: ?*const fn (c_uint, [*c]GLint) callconv(.c) void = null;
-var glActiveTexture_ptr: ?*const fn (c_uint) callconv(.c) void = null;
 var glBindTexture_ptr: ?*const fn (c_uint, GLuint) callconv(.c) void = null;
-var glBindSampler_ptr: ?*const fn (GLuint, GLuint) callconv(.c) void = null;
 var glUniform1i_ptr: ?*const fn (GLint, GLint) callconv(.c) void = null;
 var glUniform1f_ptr: ?*const fn (GLint, GLfloat) callconv(.c) void = null;
 var glUniform3fv_ptr: ?*const fn (GLint, GLsizei, [*c]const GLfloat) callconv(.c) void = null;
 var glGetError_ptr: ?*const fn () callconv(.c) c_uint = null;
+var glBindBuffer_ptr: ?*const fn (c_uint, GLuint) callconv(.c) void = null;
+var glTexSubImage2D_ptr: ?*const fn (c_uint, GLint, GLint, GLint, GLsizei, GLsizei, c_uint, c_uint, ?*const anyopaque) callconv(.c) void = null;
+var glPixelStorei_ptr: ?*const fn (c_uint, GLint) callconv(.c) void = null;
+var glGenerateMipmap_ptr: ?*const fn (c_uint) callconv(.c) void = null;
+var glBufferSubData_ptr: ?*const fn (c_uint, isize, isize, ?*const anyopaque) callconv(.c) void = null;
+var glGenQueries_ptr: ?*const fn (GLsizei, [*c]GLuint) callconv(.c) void = null;
+var glDeleteQueries_ptr: ?*const fn (GLsizei, [*c]const GLuint) callconv(.c) void = null;
+var glBeginQuery_ptr: ?*const fn (c_uint, GLuint) callconv(.c) void = null;
+var glEndQuery_ptr: ?*const fn (c_uint) callconv(.c) void = null;
+var glQueryCounter_ptr: ?*const fn (GLuint, c_uint) callconv(.c) void = null;
+var glGetQueryObjectuiv_ptr: ?*const fn (GLuint, c_uint, [*c]GLuint) callconv(.c) void = null;
+var glGenBuffers_ptr: ?*const fn (GLsizei, [*c]GLuint) callconv(.c) void = null;
+var glDeleteBuffers_ptr: ?*const fn (GLsizei, [*c]const GLuint) callconv(.c) void = null;
+var glBufferData_ptr: ?*const fn (c_uint, isize, ?*const anyopaque, c_uint) callconv(.c) void = null;
+var glReadPixels_ptr: ?*const fn (GLint, GLint, GLsizei, GLsizei, c_uint, c_uint, ?*anyopaque) callconv(.c) void = null;
+var glMapBufferRange_ptr: ?*const fn (c_uint, isize, isize, c_uint) callconv(.c) ?*anyopaque = null;
+var glUnmapBuffer_ptr: ?*const fn (c_uint) callconv(.c) GLboolean = null;
+var glFenceSync_ptr: ?*const fn (c_uint, c_uint) callconv(.c) ?*anyopaque = null;
+var glClientWaitSync_ptr: ?*const fn (?*anyopaque, c_uint, u64) callconv(.c) c_uint = null;
+var glDeleteSync_ptr: ?*const fn (?*anyopaque) callconv(.c) void = null;
+var glMultiDrawArrays_ptr: ?*const fn (c_uint, [*c]const GLint, [*c]const GLsizei, GLsizei) callconv(.c) void = null;
+var glMultiDrawElements_ptr: ?*const fn (c_uint, [*c]const GLsizei, c_uint, [*c]const ?*const anyopaque, GLsizei) callconv(.c) void = null;
+var glGetQueryObjectui64v_ptr: ?*const fn (GLuint, c_uint, [*c]u64) callconv(.c) void = null;
+var glGetUniformBlockIndex_ptr: ?*const fn (GLuint, [*c]const GLchar) callconv(.c) GLuint = null;
+var glUniformBlockBinding_ptr: ?*const fn (GLuint, GLuint, GLuint) callconv(.c) void = null;
+var glBindBufferRange_ptr: ?*const fn (c_uint, GLuint, GLuint, isize, isize) callconv(.c) void = null;
+var glBindBufferBase_ptr: ?*const fn (c_uint, GLuint, GLuint) callconv(.c) void = null;
 
 const GL_CURRENT_PROGRAM: c_uint = 0x8B8D;
 pub const GL_NO_ERROR: c_uint = 0;
-pub const GL_TEXTURE0: c_uint = 0x84C0;
 pub const GL_TEXTURE_2D: c_uint = 0x0DE1;
 pub const GL_TEXTURE_CUBE_MAP: c_uint = 0x8513;
+// Sokol's state cache never touches this binding point, so ranged writes
+// through it cannot desync the cached ARRAY/ELEMENT_ARRAY bindings.
+const GL_COPY_WRITE_BUFFER: c_uint = 0x8F37;
+const GL_TEXTURE_BINDING_2D: c_uint = 0x8069;
+const GL_UNPACK_ALIGNMENT: c_uint = 0x0CF5;
+const GL_UNPACK_ROW_LENGTH: c_uint = 0x0CF2;
+const GL_UNSIGNED_BYTE: c_uint = 0x1401;
+const GL_QUERY_RESULT: c_uint = 0x8866;
+const GL_QUERY_RESULT_AVAILABLE: c_uint = 0x8867;
+const GL_TIMESTAMP: c_uint = 0x8E28;
+const GL_PIXEL_PACK_BUFFER: c_uint = 0x88EB;
+const GL_STREAM_READ: c_uint = 0x88E1;
+const GL_MAP_READ_BIT: c_uint = 0x0001;
+const GL_SYNC_GPU_COMMANDS_COMPLETE: c_uint = 0x9117;
+const GL_ALREADY_SIGNALED: c_uint = 0x911A;
+const GL_CONDITION_SATISFIED: c_uint = 0x911C;
+const GL_UNIFORM_BUFFER: c_uint = 0x8A11;
+const GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT: c_uint = 0x8A34;
+const GL_STREAM_DRAW: c_uint = 0x88E0;
+const GL_INVALID_INDEX: GLuint = 0xFFFF_FFFF;
+
+/// UNIFORM_BUFFER_OFFSET_ALIGNMENT until init() queried it; the largest
+/// value drivers report, so offsets chosen before then stay valid
+const DefaultUniformBufferAlignment: u32 = 256;
+var uniform_buffer_alignment: u32 = DefaultUniformBufferAlignment;
 
 var initialized = false;
 
@@ -81,13 +130,45 @@ pub fn init() void {
     glUniformMatrix3fv_ptr = @ptrCast(getProcAddress("glUniformMatrix3fv"));
     glUseProgram_ptr = @ptrCast(getProcAddress("glUseProgram"));
     glGetIntegerv_ptr = @ptrCast(getProcAddress("glGetIntegerv"));
-    glActiveTexture_ptr = @ptrCast(getProcAddress("glActiveTexture"));
     glBindTexture_ptr = @ptrCast(getProcAddress("glBindTexture"));
-    glBindSampler_ptr = @ptrCast(getProcAddress("glBindSampler"));
     glUniform1i_ptr = @ptrCast(getProcAddress("glUniform1i"));
     glUniform1f_ptr = @ptrCast(getProcAddress("glUniform1f"));
     glUniform3fv_ptr = @ptrCast(getProcAddress("glUniform3fv"));
     glGetError_ptr = @ptrCast(getProcAddress("glGetError"));
+    glBindBuffer_ptr = @ptrCast(getProcAddress("glBindBuffer"));
+    glBufferSubData_ptr = @ptrCast(getProcAddress("glBufferSubData"));
+    glTexSubImage2D_ptr = @ptrCast(getProcAddress("glTexSubImage2D"));
+    glPixelStorei_ptr = @ptrCast(getProcAddress("glPixelStorei"));
+    glGenerateMipmap_ptr = @ptrCast(getProcAddress("glGenerateMipmap"));
+    glGenQueries_ptr = @ptrCast(getProcAddress("glGenQueries"));
+    glDeleteQueries_ptr = @ptrCast(getProcAddress("glDeleteQueries"));
+    glBeginQuery_ptr = @ptrCast(getProcAddress("glBeginQuery"));
+    glEndQuery_ptr = @ptrCast(getProcAddress("glEndQuery"));
+    // GL 3.3 / ARB_timer_query; GLES only has it as an extension
+    glQueryCounter_ptr = @ptrCast(getProcAddress("glQueryCounter"));
+    glGetQueryObjectuiv_ptr = @ptrCast(getProcAddress("glGetQueryObjectuiv"));
+    glGetQueryObjectui64v_ptr = @ptrCast(getProcAddress("glGetQueryObjectui64v"));
+    glGenBuffers_ptr = @ptrCast(getProcAddress("glGenBuffers"));
+    glDeleteBuffers_ptr = @ptrCast(getProcAddress("glDeleteBuffers"));
+    glBufferData_ptr = @ptrCast(getProcAddress("glBufferData"));
+    glReadPixels_ptr = @ptrCast(getProcAddress("glReadPixels"));
+    glMapBufferRange_ptr = @ptrCast(getProcAddress("glMapBufferRange"));
+    glUnmapBuffer_ptr = @ptrCast(getProcAddress("glUnmapBuffer"));
+    glFenceSync_ptr = @ptrCast(getProcAddress("glFenceSync"));
+    glClientWaitSync_ptr = @ptrCast(getProcAddress("glClientWaitSync"));
+    glDeleteSync_ptr = @ptrCast(getProcAddress("glDeleteSync"));
+    glMultiDrawArrays_ptr = @ptrCast(getProcAddress("glMultiDrawArrays"));
+    glMultiDrawElements_ptr = @ptrCast(getProcAddress("glMultiDrawElements"));
+    glGetUniformBlockIndex_ptr = @ptrCast(getProcAddress("glGetUniformBlockIndex"));
+    glUniformBlockBinding_ptr = @ptrCast(getProcAddress("glUniformBlockBinding"));
+    glBindBufferRange_ptr = @ptrCast(getProcAddress("glBindBufferRange"));
+    glBindBufferBase_ptr = @ptrCast(getProcAddress("glBindBufferBase"));
+    if (glGetIntegerv_ptr) |get| {
+        var alignment: GLint = 0;
+        get(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        // Offsets are aligned with std.mem.alignForward
+        if (alignment > 0 and std.math.isPowerOfTwo(alignment)) uniform_buffer_alignment = @intCast(alignment);
+    }
 
     if (glGetUniformLocation_ptr != null and glUniformMatrix3fv_ptr != null) {
         initialized = true;
@@ -141,28 +222,7 @@ pub fn useProgram(program: GLuint) void {
     }
 }
 
-/// Activate a texture unit (unit 0 = GL_TEXTURE0, etc.)
-pub fn activeTexture(unit: u32) void {
-    if (glActiveTexture_ptr) |func| {
-        func(GL_TEXTURE0 + unit);
-    }
-}
-
-/// Bind a texture to the currently active texture unit
-pub fn bindTexture(target: c_uint, texture: GLuint) void {
-    if (glBindTexture_ptr) |func| {
-        func(target, texture);
-    }
-}
-
-/// Bind a sampler to a texture unit
-pub fn bindSampler(unit: GLuint, sampler: GLuint) void {
-    if (glBindSampler_ptr) |func| {
-        func(unit, sampler);
-    }
-}
-
-/// Set an integer uniform (used for sampler uniforms)
+/// Set an integer uniform (used for gl_DrawID emulation)
 pub fn uniform1i(location: GLint, value: GLint) void {
     if (glUniform1i_ptr) |func| {
         func(location, value);
@@ -183,6 +243,288 @@ pub fn uniform3fv(location: GLint, count: GLsizei, value: [*]const GLfloat) void
     }
 }
 
+/// Write `data` at byte `offset` of GL buffer object `buffer`
+pub fn bufferSubData(buffer: GLuint, offset: usize, data: []const u8) bool {
+    const bind = glBindBuffer_ptr orelse return false;
+    const sub_data = glBufferSubData_ptr orelse return false;
+    bind(GL_COPY_WRITE_BUFFER, buffer);
+    sub_data(GL_COPY_WRITE_BUFFER, @intCast(offset), @intCast(data.len), data.ptr);
+    bind(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+/// Upload an 8-bit-per-channel rectangle into level 0 of a 2D texture.
+/// `pixels` starts at the rectangle's first texel; rows are `row_length`
+/// texels apart. The caller's texture binding and unpack state are restored.
+pub fn texSubImage2D(
+    texture: GLuint,
+    target: c_uint,
+    x: u32,
+    y: u32,
+    width: u32,
+    height: u32,
+    format: c_uint,
+    row_length: u32,
+    pixels: []const u8,
+) bool {
+    if (target != GL_TEXTURE_2D) return false;
+    const sub_image = glTexSubImage2D_ptr orelse return false;
+    const store = glPixelStorei_ptr orelse return false;
+    const bind = glBindTexture_ptr orelse return false;
+    const get = glGetIntegerv_ptr orelse return false;
+
+    var prev_texture: GLint = 0;
+    var prev_alignment: GLint = 4;
+    get(GL_TEXTURE_BINDING_2D, &prev_texture);
+    get(GL_UNPACK_ALIGNMENT, &prev_alignment);
+    bind(target, texture);
+    store(GL_UNPACK_ALIGNMENT, 1);
+    store(GL_UNPACK_ROW_LENGTH, @intCast(row_length));
+    sub_image(target, 0, @intCast(x), @intCast(y), @intCast(width), @intCast(height), format, GL_UNSIGNED_BYTE, pixels.ptr);
+    store(GL_UNPACK_ROW_LENGTH, 0);
+    store(GL_UNPACK_ALIGNMENT, prev_alignment);
+    bind(target, @intCast(prev_texture));
+    return true;
+}
+
+/// Regenerate levels 1.. of a 2D texture from its level 0 on the GPU. The
+/// caller's texture binding is restored.
+pub fn generateMipmap(texture: GLuint, target: c_uint) bool {
+    if (target != GL_TEXTURE_2D) return false;
+    const generate = glGenerateMipmap_ptr orelse return false;
+    const bind = glBindTexture_ptr orelse return false;
+    const get = glGetIntegerv_ptr orelse return false;
+
+    var prev_texture: GLint = 0;
+    get(GL_TEXTURE_BINDING_2D, &prev_texture);
+    bind(target, texture);
+    generate(target);
+    bind(target, @intCast(prev_texture));
+    return true;
+}
+
+/// Create a GL query object; 0 when queries are unavailable
+pub fn createQuery() GLuint {
+    const gen = glGenQueries_ptr orelse return 0;
+    var name: GLuint = 0;
+    gen(1, &name);
+    return name;
+}
+
+pub fn deleteQuery(query: GLuint) void {
+    if (glDeleteQueries_ptr) |func| {
+        func(1, &query);
+    }
+}
+
+pub fn beginQuery(target: c_uint, query: GLuint) void {
+    if (query == 0) return;
+    if (glBeginQuery_ptr) |func| {
+        func(target, query);
+    }
+}
+
+pub fn endQuery(target: c_uint) void {
+    if (glEndQuery_ptr) |func| {
+        func(target);
+    }
+}
+
+/// Record the GPU timestamp into `query` once prior commands complete
+pub fn queryCounter(query: GLuint) void {
+    if (query == 0) return;
+    if (glQueryCounter_ptr) |func| {
+        func(query, GL_TIMESTAMP);
+    }
+}
+
+/// Result of a query object, or null while the GPU has not produced it.
+/// Never blocks: availability is checked first.
+pub fn queryResult(query: GLuint) ?u64 {
+    if (query == 0) return null;
+    const get = glGetQueryObjectuiv_ptr orelse return null;
+    var available: GLuint = 0;
+    get(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == 0) return null;
+    if (glGetQueryObjectui64v_ptr) |get64| {
+        var value: u64 = 0;
+        get64(query, GL_QUERY_RESULT, &value);
+        return value;
+    }
+    var value: GLuint = 0;
+    get(query, GL_QUERY_RESULT, &value);
+    return value;
+}
+
+/// Create a GL buffer object for readbacks; 0 when unavailable
+pub fn createPackBuffer() GLuint {
+    const gen = glGenBuffers_ptr orelse return 0;
+    var name: GLuint = 0;
+    gen(1, &name);
+    return name;
+}
+
+pub fn deleteBuffer(buffer: GLuint) void {
+    if (glDeleteBuffers_ptr) |func| {
+        func(1, &buffer);
+    }
+}
+
+/// Read a rectangle of the bound read framebuffer into pack buffer `pbo`,
+/// first growing its storage to `size` bytes when `capacity.*` is smaller.
+/// Returns without waiting; the copy happens on the GPU.
+pub fn readPixelsToBuffer(
+    pbo: GLuint,
+    capacity: *u32,
+    x: i32,
+    y: i32,
+    width: u32,
+    height: u32,
+    format: c_uint,
+    pixel_type: c_uint,
+    size: u32,
+) bool {
+    if (pbo == 0) return false;
+    const bind = glBindBuffer_ptr orelse return false;
+    const data = glBufferData_ptr orelse return false;
+    const read = glReadPixels_ptr orelse return false;
+    bind(GL_PIXEL_PACK_BUFFER, pbo);
+    if (capacity.* < size) {
+        data(GL_PIXEL_PACK_BUFFER, @intCast(size), null, GL_STREAM_READ);
+        capacity.* = size;
+    }
+    read(x, y, @intCast(width), @intCast(height), format, pixel_type, null);
+    bind(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+/// glReadPixels into client memory; waits for every command issued so far.
+pub fn readPixelsToMemory(
+    x: i32,
+    y: i32,
+    width: u32,
+    height: u32,
+    format: c_uint,
+    pixel_type: c_uint,
+    dst: []u8,
+) bool {
+    const bind = glBindBuffer_ptr orelse return false;
+    const read = glReadPixels_ptr orelse return false;
+    bind(GL_PIXEL_PACK_BUFFER, 0);
+    read(x, y, @intCast(width), @intCast(height), format, pixel_type, dst.ptr);
+    return true;
+}
+
+/// Copy the first `dst.len` bytes of pack buffer `pbo` out. Only call once
+/// a fence after the readback has signalled, or the map waits for the GPU.
+pub fn readPackBuffer(pbo: GLuint, dst: []u8) bool {
+    if (pbo == 0 or dst.len == 0) return false;
+    const bind = glBindBuffer_ptr orelse return false;
+    const map = glMapBufferRange_ptr orelse return false;
+    const unmap = glUnmapBuffer_ptr orelse return false;
+    bind(GL_PIXEL_PACK_BUFFER, pbo);
+    defer bind(GL_PIXEL_PACK_BUFFER, 0);
+    const ptr = map(GL_PIXEL_PACK_BUFFER, 0, @intCast(dst.len), GL_MAP_READ_BIT) orelse return false;
+    const src: [*]const u8 = @ptrCast(ptr);
+    @memcpy(dst, src[0..dst.len]);
+    _ = unmap(GL_PIXEL_PACK_BUFFER);
+    return true;
+}
+
+/// Insert a fence after every command issued so far; null when unavailable
+pub fn fenceSync() ?*anyopaque {
+    const func = glFenceSync_ptr orelse return null;
+    return func(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/// Whether the GPU has passed `sync`. Never blocks (zero timeout).
+pub fn syncSignaled(sync: *anyopaque) bool {
+    const func = glClientWaitSync_ptr orelse return false;
+    const status = func(sync, 0, 0);
+    return status == GL_ALREADY_SIGNALED or status == GL_CONDITION_SATISFIED;
+}
+
+pub fn deleteSync(sync: *anyopaque) void {
+    if (glDeleteSync_ptr) |func| {
+        func(sync);
+    }
+}
+
+/// Whether glMultiDrawArrays/glMultiDrawElements were loaded
+pub fn hasMultiDraw() bool {
+    return glMultiDrawArrays_ptr != null and glMultiDrawElements_ptr != null;
+}
+
+/// Draw `firsts.len` vertex ranges with the bound pipeline and bindings.
+pub fn multiDrawArrays(mode: c_uint, firsts: []const GLint, counts: []const GLsizei) void {
+    std.debug.assert(firsts.len == counts.len);
+    if (glMultiDrawArrays_ptr) |func| {
+        func(mode, firsts.ptr, counts.ptr, @intCast(firsts.len));
+    }
+}
+
+/// Draw `counts.len` index ranges starting at the byte offsets into the
+/// bound index buffer.
+pub fn multiDrawElements(mode: c_uint, counts: []const GLsizei, index_type: c_uint, offsets: []const usize) void {
+    std.debug.assert(offsets.len == counts.len);
+    if (glMultiDrawElements_ptr) |func| {
+        func(mode, counts.ptr, index_type, @ptrCast(offsets.ptr), @intCast(counts.len));
+    }
+}
+
+/// Index of uniform block `name` in `program`; null when the program has
+/// no such active block.
+pub fn getUniformBlockIndex(program: GLuint, name: [*:0]const u8) ?GLuint {
+    const func = glGetUniformBlockIndex_ptr orelse return null;
+    const index = func(program, name);
+    return if (index == GL_INVALID_INDEX) null else index;
+}
+
+/// Make block `index` of `program` read indexed UNIFORM_BUFFER slot `slot`.
+pub fn uniformBlockBinding(program: GLuint, index: GLuint, slot: GLuint) void {
+    if (glUniformBlockBinding_ptr) |func| {
+        func(program, index, slot);
+    }
+}
+
+/// Required alignment of bound uniform buffer range offsets.
+pub fn uniformBufferOffsetAlignment() u32 {
+    return uniform_buffer_alignment;
+}
+
+/// Replace the whole contents of uniform buffer `ubo` with `data`,
+/// creating the buffer on first use. glBufferData orphans the previous
+/// storage, so draws of the last frame still in flight keep theirs.
+pub fn uploadUniformBuffer(ubo: *GLuint, data: []const u8) bool {
+    const bind = glBindBuffer_ptr orelse return false;
+    const upload = glBufferData_ptr orelse return false;
+    if (ubo.* == 0) {
+        const gen = glGenBuffers_ptr orelse return false;
+        gen(1, ubo);
+        if (ubo.* == 0) return false;
+    }
+    bind(GL_UNIFORM_BUFFER, ubo.*);
+    upload(GL_UNIFORM_BUFFER, @intCast(data.len), data.ptr, GL_STREAM_DRAW);
+    bind(GL_UNIFORM_BUFFER, 0);
+    return true;
+}
+
+/// Bind `size` bytes of `ubo` at `offset` to indexed UNIFORM_BUFFER slot
+/// `slot`. Sokol never touches these bindings, so they persist across its
+/// pipeline and binding changes.
+pub fn bindUniformBufferRange(slot: GLuint, ubo: GLuint, offset: u32, size: u32) void {
+    if (glBindBufferRange_ptr) |func| {
+        func(GL_UNIFORM_BUFFER, slot, ubo, @intCast(offset), @intCast(size));
+    }
+}
+
+/// Leave indexed UNIFORM_BUFFER slot `slot` with no buffer.
+pub fn unbindUniformBuffer(slot: GLuint) void {
+    if (glBindBufferBase_ptr) |func| {
+        func(GL_UNIFORM_BUFFER, slot, 0);
+    }
+}
+
 /// Get the last GL error
 pub fn getError() c_uint {
     if (glGetError_ptr) |func| {
@@ -0,0 +1,262 @@
+//! Generational handle tables
+//!
+//! Backs the WebGL object tables (buffers, textures, shaders, programs). A
+//! handle is a slot index plus the slot's generation when it was handed
+//! out; freeing a slot bumps the generation so stale handles stop
+//! resolving. Slot state lives apart from the objects, so checking a handle
+//! reads four bytes and never the object itself, which for a program runs
+//! to kilobytes. Freed slots are kept on a stack: alloc and free are O(1)
+//! and the most recently freed slot is reused first, then the lowest slot
+//! never used.
+//!
+//! Storage is reserved from the page allocator on first use and never
+//! grows; the capacity can be changed at startup with configure(). Slots
+//! past the high-water mark are never written, so a table commits memory
+//! only for the objects it has actually held.
+
+const std = @import("std");
+const testing = std.testing;
+const lazy_pages = @import("lazy_pages.zig");
+
+const allocator = std.heap.page_allocator;
+
+/// Handles address slots with u16, which bounds every table.
+pub const MaxCapacity: usize = std.math.maxInt(u16);
+
+pub const Slot = struct {
+    generation: u16 = 1,
+    active: bool = false,
+};
+
+/// `Id` is a handle type with `index: u16` and `generation: u16` fields.
+pub fn HandleTable(comptime Id: type, comptime T: type, comptime default_capacity: usize) type {
+    comptime std.debug.assert(default_capacity > 0 and default_capacity <= MaxCapacity);
+
+    return struct {
+        /// Hot: read by every handle check. Undefined past `used_slots`.
+        slots: []Slot = &.{},
+        /// Cold: one object per slot, undefined until its slot is first used
+        items: []T = &.{},
+        /// Freed slot indices; the last one is reused next
+        free_stack: []u16 = &.{},
+        free_len: usize = 0,
+        /// High-water mark: slots below it have been handed out at least once
+        used_slots: usize = 0,
+        capacity: usize = default_capacity,
+        count: u16 = 0,
+
+        const Self = @This();
+        pub const DefaultCapacity = default_capacity;
+
+        /// Set the number of slots. Only allowed while nothing is allocated;
+        /// storage is reserved lazily.
+        pub fn configure(self: *Self, capacity: usize) !void {
+            if (capacity == 0 or capacity > MaxCapacity) return error.InvalidSize;
+            if (self.count != 0) return error.TableInUse;
+            self.releaseStorage();
+            self.capacity = capacity;
+        }
+
+        /// Release the storage, keeping the capacity. Every handle becomes
+        /// invalid.
+        pub fn deinit(self: *Self) void {
+            self.releaseStorage();
+        }
+
+        /// Free every slot and restart generations, keeping the storage.
+        pub fn reset(self: *Self) void {
+            if (self.slots.len != 0) self.markAllFree();
+        }
+
+        /// Claim a free slot. Its object is left as the previous occupant
+        /// had it (undefined for a fresh slot); the caller initializes it.
+        pub fn alloc(self: *Self) !Id {
+            try self.ensureStorage();
+            const index: u16 = if (self.free_len != 0) blk: {
+                self.free_len -= 1;
+                break :blk self.free_stack[self.free_len];
+            } else blk: {
+                if (self.used_slots == self.slots.len) return error.AtCapacity;
+                self.slots[self.used_slots] = .{};
+                self.used_slots += 1;
+                break :blk @intCast(self.used_slots - 1);
+            };
+            const slot = &self.slots[index];
+            if (slot.generation == 0) slot.generation = 1;
+            slot.active = true;
+            self.count += 1;
+            return .{ .index = index, .generation = slot.generation };
+        }
+
+        pub fn free(self: *Self, id: Id) bool {
+            if (!self.isValid(id)) return false;
+            const slot = &self.slots[id.index];
+            slot.active = false;
+            slot.generation +%= 1;
+            self.free_stack[self.free_len] = id.index;
+            self.free_len += 1;
+            self.count -= 1;
+            return true;
+        }
+
+        pub fn isValid(self: *const Self, id: Id) bool {
+            if (id.index >= self.used_slots) return false;
+            const slot = self.slots[id.index];
+            return slot.active and slot.generation == id.generation;
+        }
+
+        pub fn get(self: *Self, id: Id) ?*T {
+            if (!self.isValid(id)) return null;
+            return &self.items[id.index];
+        }
+
+        pub fn getConst(self: *const Self, id: Id) ?*const T {
+            if (!self.isValid(id)) return null;
+            return &self.items[id.index];
+        }
+
+        /// The object in slot `index`, for callers that already checked
+        /// the handle.
+        pub fn at(self: *Self, index: usize) *T {
+            return &self.items[index];
+        }
+
+        pub fn isActive(self: *const Self, index: usize) bool {
+            return index < self.used_slots and self.slots[index].active;
+        }
+
+        /// Live objects in slot order.
+        pub fn iterator(self: *Self) Iterator {
+            return .{ .table = self };
+        }
+
+        pub const Iterator = struct {
+            table: *Self,
+            index: usize = 0,
+
+            pub fn next(it: *Iterator) ?*T {
+                while (it.index < it.table.used_slots) {
+                    const index = it.index;
+                    it.index += 1;
+                    if (it.table.slots[index].active) return &it.table.items[index];
+                }
+                return null;
+            }
+        };
+
+        fn ensureStorage(self: *Self) !void {
+            if (self.slots.len != 0) return;
+            // Reserved untouched: everything is written before it is read
+            const slots = try lazy_pages.alloc(allocator, Slot, self.capacity);
+            errdefer lazy_pages.free(allocator, slots);
+            const free_stack = try lazy_pages.alloc(allocator, u16, self.capacity);
+            errdefer lazy_pages.free(allocator, free_stack);
+            self.items = try lazy_pages.alloc(allocator, T, self.capacity);
+            self.slots = slots;
+            self.free_stack = free_stack;
+            self.markAllFree();
+        }
+
+        fn releaseStorage(self: *Self) void {
+            if (self.slots.len == 0) return;
+            lazy_pages.free(allocator, self.slots);
+            lazy_pages.free(allocator, self.items);
+            lazy_pages.free(allocator, self.free_stack);
+            self.* = .{ .capacity = self.capacity };
+        }
+
+        /// Slots past the high-water mark are implicitly free and start
+        /// over at generation 1, so nothing is cleared here.
+        fn markAllFree(self: *Self) void {
+            self.used_slots = 0;
+            self.free_len = 0;
+            self.count = 0;
+        }
+    };
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+const TestId = packed struct(u32) {
+    index: u16,
+    generation: u16,
+};
+
+const TestTable = HandleTable(TestId, u64, 4);
+
+test "HandleTable hands out slots in order and reuses the last freed" {
+    var table: TestTable = .{};
+    defer table.deinit();
+
+    const a = try table.alloc();
+    const b = try table.alloc();
+    const c = try table.alloc();
+    try testing.expectEqual(@as(u16, 0), a.index);
+    try testing.expectEqual(@as(u16, 1), b.index);
+    try testing.expectEqual(@as(u16, 2), c.index);
+    try testing.expectEqual(@as(u16, 3), table.count);
+
+    try testing.expect(table.free(a));
+    try testing.expect(table.free(c));
+    const d = try table.alloc();
+    try testing.expectEqual(c.index, d.index);
+    try testing.expect(d.generation != c.generation);
+    try testing.expect(!table.isValid(c));
+    try testing.expect(table.isValid(d));
+    try testing.expectEqual(a.index, (try table.alloc()).index);
+}
+
+test "HandleTable rejects stale, foreign and double-freed handles" {
+    var table: TestTable = .{};
+    defer table.deinit();
+
+    try testing.expect(table.get(.{ .index = 0, .generation = 1 }) == null);
+    const id = try table.alloc();
+    table.get(id).?.* = 42;
+    try testing.expectEqual(@as(u64, 42), table.getConst(id).?.*);
+    try testing.expect(!table.isValid(.{ .index = 9, .generation = 1 }));
+    try testing.expect(table.free(id));
+    try testing.expect(!table.free(id));
+    try testing.expect(table.get(id) == null);
+}
+
+test "HandleTable reports capacity and iterates live objects" {
+    var table: TestTable = .{};
+    defer table.deinit();
+
+    for (0..TestTable.DefaultCapacity) |n| {
+        const id = try table.alloc();
+        table.at(id.index).* = n;
+    }
+    try testing.expectError(error.AtCapacity, table.alloc());
+    try testing.expect(table.free(.{ .index = 1, .generation = 1 }));
+
+    var sum: u64 = 0;
+    var it = table.iterator();
+    while (it.next()) |value| sum += value.*;
+    try testing.expectEqual(@as(u64, 0 + 2 + 3), sum);
+
+    table.reset();
+    try testing.expectEqual(@as(u16, 0), table.count);
+    try testing.expectEqual(@as(usize, 0), table.used_slots);
+    try testing.expect(!table.isActive(0));
+    // Slots come back in order, at generation 1
+    const id = try table.alloc();
+    try testing.expectEqual(@as(u16, 0), id.index);
+    try testing.expectEqual(@as(u16, 1), id.generation);
+}
+
+test "HandleTable capacity is configured while empty" {
+    var table: TestTable = .{};
+    defer table.deinit();
+
+    try testing.expectError(error.InvalidSize, table.configure(0));
+    try testing.expectError(error.InvalidSize, table.configure(MaxCapacity + 1));
+    try table.configure(2);
+    _ = try table.alloc();
+    try testing.expectError(error.TableInUse, table.configure(8));
+    _ = try table.alloc();
+    try testing.expectError(error.AtCapacity, table.alloc());
+}
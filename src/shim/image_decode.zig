@@ -0,0 +1,259 @@
+//! Background image decode
+//!
+//! File reads and PNG decode run as jobs on the native job system so that
+//! loading a scene's textures never blocks the JS thread. The main thread
+//! fills a task slot and submits it; the thread that runs it pushes the
+//! finished image into the SPSC ring it owns (one per job system thread),
+//! and the main thread polls those rings a bounded number of times per
+//! frame. Jobs only produce pixel buffers; the main thread owns GPU objects
+//! and the JS side of every job.
+//!
+//! A pool started without a job system decodes inline in submit(), which
+//! keeps completion ordering identical on single-threaded builds.
+
+const std = @import("std");
+const testing = std.testing;
+const image_loader = @import("image_loader.zig");
+const job_system = @import("job_system.zig");
+const SpscRing = @import("spsc_ring.zig").SpscRing;
+
+const ImageData = image_loader.ImageData;
+const ImageError = image_loader.ImageError;
+const JobSystem = job_system.JobSystem;
+
+/// Jobs submitted but not yet polled. Every result ring can hold this many,
+/// so a job never waits on the main thread to make room.
+pub const MaxPending: usize = 128;
+pub const MaxPathLen: usize = 1024;
+
+pub const SubmitError = error{ QueueFull, PathTooLong, OutOfMemory };
+
+pub const Result = struct {
+    id: u32,
+    image: ImageError!ImageData,
+
+    /// Release the pixels of a result that will not be consumed.
+    pub fn discard(self: Result) void {
+        if (self.image) |image| {
+            var owned = image;
+            owned.deinit();
+        } else |_| {}
+    }
+};
+
+const Job = struct {
+    job: job_system.Job,
+    pool: *DecodePool,
+    /// Set by the main thread on submit, cleared once the result is pushed
+    busy: std.atomic.Value(bool),
+    id: u32,
+    flip_y: bool,
+    /// Encoded bytes owned by the pool; null reads `path` instead.
+    bytes: ?[]u8,
+    path_len: u16,
+    path: [MaxPathLen]u8,
+};
+
+const ResultRing = SpscRing(Result, MaxPending);
+
+pub const DecodePool = struct {
+    allocator: std.mem.Allocator = std.heap.page_allocator,
+    started: bool = false,
+    /// Runs the decodes; null decodes inline
+    jobs: ?*JobSystem = null,
+
+    slots: [MaxPending]Job = undefined,
+    next_slot: usize = 0,
+    /// Submitted jobs that have not run yet
+    outstanding: job_system.Counter = .{},
+
+    /// One ring per job system thread, indexed by job_system.threadIndex();
+    /// ring 0 also serves inline decodes.
+    results: [job_system.MaxThreads]ResultRing = [_]ResultRing{.{}} ** job_system.MaxThreads,
+    next_ring: u32 = 0,
+
+    // Main thread only
+    in_flight: u32 = 0,
+    next_id: u32 = 1,
+
+    const Self = @This();
+
+    /// Decode on `jobs`, from the thread that started it. `allocator` must
+    /// be thread-safe; decoded pixels are allocated from it.
+    pub fn start(self: *Self, allocator: std.mem.Allocator, jobs: ?*JobSystem) void {
+        if (self.started) return;
+        self.allocator = allocator;
+        self.jobs = jobs;
+        for (&self.slots) |*slot| slot.busy = .init(false);
+        self.started = true;
+    }
+
+    /// Finish the jobs already submitted, then drop their results.
+    pub fn stop(self: *Self) void {
+        if (!self.started) return;
+        if (self.jobs) |jobs| jobs.wait(&self.outstanding);
+        for (&self.results) |*ring| {
+            while (ring.pop()) |result| result.discard();
+        }
+        const next_id = self.next_id;
+        self.* = .{ .next_id = next_id };
+    }
+
+    /// Queue a file read and decode. Returns the job id reported by poll().
+    pub fn submitFile(self: *Self, path: []const u8, flip_y: bool) SubmitError!u32 {
+        if (path.len > MaxPathLen) return error.PathTooLong;
+        return self.enqueue(path, null, flip_y);
+    }
+
+    /// Queue a decode of encoded bytes (copied, so the caller's buffer may
+    /// be a JS ArrayBuffer that moves after this returns).
+    pub fn submitBytes(self: *Self, bytes: []const u8, flip_y: bool) SubmitError!u32 {
+        if (self.in_flight >= MaxPending) return error.QueueFull;
+        return self.submitOwnedBytes(try self.allocator.dupe(u8, bytes), flip_y);
+    }
+
+    /// Queue a decode of bytes allocated from the pool's allocator. The pool
+    /// takes ownership, including when this fails.
+    pub fn submitOwnedBytes(self: *Self, bytes: []u8, flip_y: bool) SubmitError!u32 {
+        return self.enqueue("", bytes, flip_y);
+    }
+
+    /// Next finished job, or null. Rings are visited round-robin so one busy
+    /// worker cannot starve the others.
+    pub fn poll(self: *Self) ?Result {
+        const ring_count = if (self.jobs) |jobs| jobs.worker_count + 1 else 1;
+        var i: u32 = 0;
+        while (i < ring_count) : (i += 1) {
+            const ring_idx = (self.next_ring + i) % ring_count;
+            if (self.results[ring_idx].pop()) |result| {
+                self.next_ring = (ring_idx + 1) % ring_count;
+                self.in_flight -= 1;
+                return result;
+            }
+        }
+        return null;
+    }
+
+    pub fn pending(self: *const Self) u32 {
+        return self.in_flight;
+    }
+
+    fn enqueue(self: *Self, path: []const u8, bytes: ?[]u8, flip_y: bool) SubmitError!u32 {
+        if (self.in_flight >= MaxPending) {
+            if (bytes) |b| self.allocator.free(b);
+            return error.QueueFull;
+        }
+        const id = self.next_id;
+        self.next_id +%= 1;
+        if (self.next_id == 0) self.next_id = 1;
+        self.in_flight += 1;
+
+        const job = self.freeSlot();
+        fillJob(job, id, path, bytes, flip_y);
+        job.pool = self;
+        job.job = .{ .run = runJob, .counter = &self.outstanding };
+        job.busy.store(true, .monotonic);
+        if (self.jobs) |jobs| {
+            jobs.submit(&job.job);
+        } else {
+            runJob(&job.job);
+        }
+        return id;
+    }
+
+    /// A slot whose job has run. Busy slots all have a result that is not
+    /// polled yet, so one is free while in_flight is below MaxPending.
+    fn freeSlot(self: *Self) *Job {
+        while (true) {
+            const job = &self.slots[self.next_slot];
+            self.next_slot = (self.next_slot + 1) % MaxPending;
+            if (!job.busy.load(.acquire)) return job;
+        }
+    }
+};
+
+fn fillJob(job: *Job, id: u32, path: []const u8, bytes: ?[]u8, flip_y: bool) void {
+    job.id = id;
+    job.flip_y = flip_y;
+    job.bytes = bytes;
+    job.path_len = @intCast(path.len);
+    @memcpy(job.path[0..path.len], path);
+}
+
+/// Decode a job and hand the result to the ring of the running thread.
+fn runJob(job_ptr: *job_system.Job) void {
+    const job: *Job = @fieldParentPtr("job", job_ptr);
+    const pool = job.pool;
+    const result = Result{ .id = job.id, .image = decode(pool.allocator, job) };
+    // in_flight never exceeds MaxPending, the capacity of every ring
+    const pushed = pool.results[job_system.threadIndex()].push(result);
+    std.debug.assert(pushed);
+    job.busy.store(false, .release);
+}
+
+/// Read (or take) the encoded bytes, decode to RGBA and apply the requested
+/// orientation. Runs on a worker thread.
+fn decode(allocator: std.mem.Allocator, job: *const Job) ImageError!ImageData {
+    var image = if (job.bytes) |bytes| blk: {
+        defer allocator.free(bytes);
+        break :blk try image_loader.loadFromMemory(allocator, bytes);
+    } else try image_loader.loadFromFile(allocator, job.path[0..job.path_len]);
+    if (job.flip_y) image_loader.flipRows(&image);
+    return image;
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn pollBlocking(pool: *DecodePool) Result {
+    while (true) {
+        if (pool.poll()) |result| return result;
+        std.Thread.yield() catch {};
+    }
+}
+
+test "DecodePool reports file errors through the result rings" {
+    var jobs = JobSystem{};
+    jobs.start(2);
+    defer jobs.stop();
+    var pool = DecodePool{};
+    pool.start(testing.allocator, &jobs);
+    defer pool.stop();
+
+    var ids: [6]u32 = undefined;
+    for (&ids) |*id| id.* = try pool.submitFile("nonexistent_decode_12345.png", false);
+    const garbage = [_]u8{ 0, 1, 2, 3 };
+    const bytes_id = try pool.submitBytes(&garbage, false);
+    try testing.expectEqual(@as(u32, 7), pool.pending());
+
+    var seen: u32 = 0;
+    for (0..7) |_| {
+        const result = pollBlocking(&pool);
+        if (result.id == bytes_id) {
+            try testing.expectError(ImageError.DecodeError, result.image);
+        } else {
+            try testing.expect(std.mem.indexOfScalar(u32, &ids, result.id) != null);
+            try testing.expectError(ImageError.FileNotFound, result.image);
+        }
+        seen += 1;
+    }
+    try testing.expectEqual(@as(u32, 7), seen);
+    try testing.expectEqual(@as(u32, 0), pool.pending());
+    try testing.expect(pool.poll() == null);
+}
+
+test "DecodePool without a job system decodes inline and bounds pending jobs" {
+    var pool = DecodePool{};
+    pool.start(testing.allocator, null);
+    defer pool.stop();
+
+    for (0..MaxPending) |_| _ = try pool.submitFile("nonexistent_decode_12345.png", false);
+    try testing.expectError(error.QueueFull, pool.submitFile("x.png", false));
+    try testing.expectError(error.QueueFull, pool.submitBytes("x", false));
+
+    const first = pool.poll().?;
+    try testing.expectEqual(@as(u32, 1), first.id);
+    try testing.expectError(ImageError.FileNotFound, first.image);
+    _ = try pool.submitFile("x.png", false);
+}
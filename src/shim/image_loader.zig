@@ -1,10 +1,12 @@
 //! Image loading via Zignal
 //!
-//! Provides PNG/JPEG decoding for texture loading.
+//! Provides PNG/JPEG decoding for texture loading. Decoded rows are expanded
+//! to RGBA8 with the vector kernels in pixel_kernels.zig.
 
 const std = @import("std");
 const testing = std.testing;
 const zignal = @import("zignal");
+const pixel_kernels = @import("pixel_kernels.zig");
 
 pub const MaxImageFileSize: usize = 64 * 1024 * 1024; // 64 MB max file size
 
@@ -59,6 +61,12 @@ pub fn loadFromFile(allocator: std.mem.Allocator, path: []const u8) ImageError!I
     return loadFromMemory(allocator, file_data);
 }
 
+/// Reverse the row order of decoded RGBA pixels in place, for sources that
+/// ask for a bottom-up image (createImageBitmap imageOrientation: 'flipY').
+pub fn flipRows(image: *ImageData) void {
+    pixel_kernels.flipRows(image.pixels, @as(usize, image.width) * image.channels, image.height);
+}
+
 /// Substitute .gif extension with .png for transparent GIF->PNG loading
 fn substituteGifExtension(allocator: std.mem.Allocator, path: []const u8) ![]const u8 {
     if (path.len >= 4 and std.mem.eql(u8, path[path.len - 4 ..], ".gif")) {
@@ -117,77 +125,56 @@ fn tryDecodePng(allocator: std.mem.Allocator, data: []const u8) ImageError!Image
 }
 
 fn convertGrayscaleToRgba(allocator: std.mem.Allocator, img: zignal.Image(u8)) ImageError!ImageData {
-    const w: u32 = @intCast(img.cols);
-    const h: u32 = @intCast(img.rows);
-    const size = @as(usize, w) * @as(usize, h) * 4;
-
-    const pixels = allocator.alloc(u8, size) catch return ImageError.OutOfMemory;
-
-    var dst_idx: usize = 0;
-    for (0..h) |y| {
-        for (0..w) |x| {
-            const gray = img.at(y, x).*;
-            pixels[dst_idx + 0] = gray;
-            pixels[dst_idx + 1] = gray;
-            pixels[dst_idx + 2] = gray;
-            pixels[dst_idx + 3] = 255;
-            dst_idx += 4;
-        }
-    }
-
-    return ImageData{
-        .width = w,
-        .height = h,
-        .channels = 4,
-        .pixels = pixels,
-        .allocator = allocator,
-    };
+    return convertRows(u8, allocator, img, pixel_kernels.expandGrayToRgba);
 }
 
 fn convertRgbToRgba(allocator: std.mem.Allocator, img: zignal.Image(zignal.Rgb)) ImageError!ImageData {
-    const w: u32 = @intCast(img.cols);
-    const h: u32 = @intCast(img.rows);
-    const size = @as(usize, w) * @as(usize, h) * 4;
+    return convertRows(zignal.Rgb, allocator, img, pixel_kernels.expandRgbToRgba);
+}
 
-    const pixels = allocator.alloc(u8, size) catch return ImageError.OutOfMemory;
+fn convertRgbaToOutput(allocator: std.mem.Allocator, img: zignal.Image(zignal.Rgba)) ImageError!ImageData {
+    return convertRows(zignal.Rgba, allocator, img, copyRgba);
+}
 
-    var dst_idx: usize = 0;
-    for (0..h) |y| {
-        for (0..w) |x| {
-            const pixel = img.at(y, x).*;
-            pixels[dst_idx + 0] = pixel.r;
-            pixels[dst_idx + 1] = pixel.g;
-            pixels[dst_idx + 2] = pixel.b;
-            pixels[dst_idx + 3] = 255;
-            dst_idx += 4;
-        }
-    }
+fn copyRgba(dst: []u8, src: []const u8, pixel_count: usize) void {
+    @memcpy(dst[0 .. pixel_count * 4], src[0 .. pixel_count * 4]);
+}
 
-    return ImageData{
-        .width = w,
-        .height = h,
-        .channels = 4,
-        .pixels = pixels,
-        .allocator = allocator,
-    };
+/// True when T is laid out as its channel bytes in r, g, b(, a) order, so a
+/// row of T can be handed to a byte kernel directly.
+fn isByteLayout(comptime T: type) bool {
+    if (T == u8) return true;
+    const fields = @typeInfo(T).@"struct".fields;
+    if (@sizeOf(T) != fields.len) return false;
+    inline for (fields, 0..) |field, i| {
+        if (field.type != u8 or @offsetOf(T, field.name) != i) return false;
+    }
+    return true;
 }
 
-fn convertRgbaToOutput(allocator: std.mem.Allocator, img: zignal.Image(zignal.Rgba)) ImageError!ImageData {
+/// Expand each row of a decoded image to RGBA8 with `kernel`. Rows are
+/// addressed through at() so image views with a stride work too.
+fn convertRows(
+    comptime T: type,
+    allocator: std.mem.Allocator,
+    img: zignal.Image(T),
+    comptime kernel: fn ([]u8, []const u8, usize) void,
+) ImageError!ImageData {
     const w: u32 = @intCast(img.cols);
     const h: u32 = @intCast(img.rows);
-    const size = @as(usize, w) * @as(usize, h) * 4;
+    const row_pixels: usize = w;
+    const size = row_pixels * @as(usize, h) * 4;
 
     const pixels = allocator.alloc(u8, size) catch return ImageError.OutOfMemory;
 
-    var dst_idx: usize = 0;
     for (0..h) |y| {
-        for (0..w) |x| {
-            const pixel = img.at(y, x).*;
-            pixels[dst_idx + 0] = pixel.r;
-            pixels[dst_idx + 1] = pixel.g;
-            pixels[dst_idx + 2] = pixel.b;
-            pixels[dst_idx + 3] = pixel.a;
-            dst_idx += 4;
+        const dst = pixels[y * row_pixels * 4 ..][0 .. row_pixels * 4];
+        if (row_pixels == 0) break;
+        const row = @as([*]const T, @ptrCast(img.at(y, 0)))[0..row_pixels];
+        if (comptime isByteLayout(T)) {
+            kernel(dst, std.mem.sliceAsBytes(row), row_pixels);
+        } else {
+            for (row, 0..) |pixel, x| dst[x * 4 ..][0..4].* = rgbaOf(pixel);
         }
     }
 
@@ -200,6 +187,13 @@ fn convertRgbaToOutput(allocator: std.mem.Allocator, img: zignal.Image(zignal.Rg
     };
 }
 
+fn rgbaOf(pixel: anytype) [4]u8 {
+    const T = @TypeOf(pixel);
+    if (T == u8) return .{ pixel, pixel, pixel, 255 };
+    if (@hasField(T, "a")) return .{ pixel.r, pixel.g, pixel.b, pixel.a };
+    return .{ pixel.r, pixel.g, pixel.b, 255 };
+}
+
 // =============================================================================
 // Tests
 // =============================================================================
@@ -216,6 +210,19 @@ test "ImageData size calculation" {
     try testing.expectEqual(@as(u32, 4), img.bytesPerPixel());
 }
 
+test "flipRows reverses row order" {
+    var pixels = [_]u8{ 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    var img = ImageData{
+        .width = 1,
+        .height = 3,
+        .channels = 4,
+        .pixels = &pixels,
+        .allocator = testing.allocator,
+    };
+    flipRows(&img);
+    try testing.expectEqualSlices(u8, &.{ 3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1 }, &pixels);
+}
+
 test "loadFromMemory with invalid data returns DecodeError" {
     const invalid_data = [_]u8{ 0, 1, 2, 3, 4, 5 };
     const result = loadFromMemory(testing.allocator, &invalid_data);
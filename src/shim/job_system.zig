@@ -0,0 +1,369 @@
+//! Native job system
+//!
+//! A fixed set of worker threads runs short CPU jobs (image decode, batched
+//! math) for the JS thread. Every thread owns a bounded Chase-Lev deque: the
+//! owner pushes and pops at the bottom without contention, idle threads
+//! steal from the top of the others. The thread that started the system
+//! (the JS thread) submits into deque 0 and helps run jobs while it waits
+//! on a Counter, so waiting never blocks a core that could do the work.
+//!
+//! Jobs are intrusive and caller-owned: submitting never allocates, and a
+//! full deque runs the job inline. Idle workers spin briefly, then sleep on
+//! a futex until the next submit. Jobs must never wait on the JS thread,
+//! and should not block for long: a one-shot image read is fine, but fetch
+//! streams, which wait on ring space, keep their own IO threads.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const testing = std.testing;
+
+pub const MaxWorkers: usize = 8;
+/// Workers plus the submitting thread, which owns deque 0.
+pub const MaxThreads: usize = MaxWorkers + 1;
+/// Jobs each deque holds before submit() runs them inline.
+pub const DequeCapacity: usize = 256;
+/// Chunks a parallelFor() is split into at most.
+pub const MaxChunks: usize = 64;
+/// Empty polls of every deque before an idle worker sleeps.
+const SpinLimit: u32 = 64;
+
+/// A unit of work. Embed it in the job's own state and recover that with
+/// @fieldParentPtr in `run`. The storage must live until `run` returns.
+pub const Job = struct {
+    run: *const fn (*Job) void,
+    /// Decremented once `run` returns
+    counter: ?*Counter = null,
+};
+
+/// Number of submitted jobs that have not finished.
+pub const Counter = struct {
+    pending: std.atomic.Value(u32) = .init(0),
+
+    pub fn done(self: *const Counter) bool {
+        return self.pending.load(.acquire) == 0;
+    }
+};
+
+/// Index of the calling thread in the system it works for: 0 for the
+/// submitting thread (and any thread that is not a worker), 1..N for
+/// workers. Lets jobs pick per-thread output, such as an SPSC ring.
+pub fn threadIndex() u32 {
+    return tl_thread_index;
+}
+
+threadlocal var tl_thread_index: u32 = 0;
+
+/// Bounded work-stealing deque (Chase-Lev, with the C11 orderings of Lê et
+/// al.). push() and pop() are owner-only; steal() may run on any thread.
+const Deque = struct {
+    top: std.atomic.Value(i64) align(std.atomic.cache_line) = .init(0),
+    bottom: std.atomic.Value(i64) align(std.atomic.cache_line) = .init(0),
+    slots: [DequeCapacity]std.atomic.Value(?*Job) = @splat(.init(null)),
+
+    const mask: i64 = DequeCapacity - 1;
+
+    /// Returns false when the deque is full.
+    fn push(self: *Deque, job: *Job) bool {
+        const b = self.bottom.load(.monotonic);
+        const t = self.top.load(.acquire);
+        if (b - t >= DequeCapacity) return false;
+        self.slots[@intCast(b & mask)].store(job, .monotonic);
+        // seq_cst so a worker that announced itself asleep sees the job
+        self.bottom.store(b + 1, .seq_cst);
+        return true;
+    }
+
+    fn pop(self: *Deque) ?*Job {
+        const b = self.bottom.load(.monotonic) - 1;
+        self.bottom.store(b, .seq_cst);
+        const t = self.top.load(.seq_cst);
+        if (t > b) {
+            self.bottom.store(b + 1, .monotonic);
+            return null;
+        }
+        const job = self.slots[@intCast(b & mask)].load(.monotonic);
+        if (t == b) {
+            // Last job: race the thieves for it
+            const won = self.top.cmpxchgStrong(t, t + 1, .seq_cst, .monotonic) == null;
+            self.bottom.store(b + 1, .monotonic);
+            return if (won) job else null;
+        }
+        return job;
+    }
+
+    fn steal(self: *Deque) ?*Job {
+        const t = self.top.load(.seq_cst);
+        const b = self.bottom.load(.seq_cst);
+        if (t >= b) return null;
+        const job = self.slots[@intCast(t & mask)].load(.monotonic);
+        if (self.top.cmpxchgStrong(t, t + 1, .seq_cst, .monotonic) != null) return null;
+        return job;
+    }
+
+    fn isEmpty(self: *const Deque) bool {
+        return self.top.load(.seq_cst) >= self.bottom.load(.seq_cst);
+    }
+};
+
+pub const JobSystem = struct {
+    started: bool = false,
+    threads: [MaxWorkers]std.Thread = undefined,
+    worker_count: u32 = 0,
+    /// Thread that called start(); the only non-worker allowed to submit
+    owner: std.Thread.Id = 0,
+    running: std.atomic.Value(bool) = .init(false),
+    /// Bumped by every submit; sleeping workers wait for it to change
+    wake_epoch: std.atomic.Value(u32) = .init(0),
+    sleepers: std.atomic.Value(u32) = .init(0),
+    deques: [MaxThreads]Deque = @splat(.{}),
+
+    const Self = @This();
+
+    /// Spawn up to `worker_count` workers. If a thread cannot be spawned
+    /// the system keeps the ones it has (possibly none, running every job
+    /// inline in submit()).
+    pub fn start(self: *Self, worker_count: u32) void {
+        if (self.started) return;
+        self.started = true;
+        self.owner = std.Thread.getCurrentId();
+        self.running.store(true, .release);
+        if (builtin.single_threaded) return;
+        const count: u32 = @intCast(@min(worker_count, MaxWorkers));
+        while (self.worker_count < count) {
+            const index = self.worker_count + 1;
+            self.threads[self.worker_count] = std.Thread.spawn(.{}, workerMain, .{ self, index }) catch |err| {
+                std.log.warn("job worker unavailable: {s}", .{@errorName(err)});
+                break;
+            };
+            self.worker_count += 1;
+        }
+    }
+
+    /// Run every queued job to completion, then join the workers.
+    pub fn stop(self: *Self) void {
+        if (!self.started) return;
+        std.debug.assert(std.Thread.getCurrentId() == self.owner);
+        self.running.store(false, .release);
+        _ = self.wake_epoch.fetchAdd(1, .seq_cst);
+        std.Thread.Futex.wake(&self.wake_epoch, std.math.maxInt(u32));
+        for (self.threads[0..self.worker_count]) |thread| thread.join();
+        // Workers drain before exiting; what is left was pushed to deque 0
+        while (self.findJob(0)) |job| runJob(job);
+        self.* = .{};
+    }
+
+    /// Make the calling thread the submitter, as after a JS thread
+    /// handoff. The previous one must be done with the system.
+    pub fn adopt(self: *Self) void {
+        self.owner = std.Thread.getCurrentId();
+    }
+
+    /// Queue `job`. Call from the thread that started the system or from a
+    /// job; with no workers, or a full deque, the job runs before this
+    /// returns.
+    pub fn submit(self: *Self, job: *Job) void {
+        if (job.counter) |counter| _ = counter.pending.fetchAdd(1, .monotonic);
+        const index = tl_thread_index;
+        if (std.debug.runtime_safety and index == 0) {
+            std.debug.assert(std.Thread.getCurrentId() == self.owner);
+        }
+        if (self.worker_count == 0 or !self.deques[index].push(job)) {
+            runJob(job);
+            return;
+        }
+        _ = self.wake_epoch.fetchAdd(1, .seq_cst);
+        if (self.sleepers.load(.seq_cst) > 0) std.Thread.Futex.wake(&self.wake_epoch, 1);
+    }
+
+    /// Run queued jobs on the calling thread until `counter` reaches zero.
+    pub fn wait(self: *Self, counter: *Counter) void {
+        while (!counter.done()) {
+            if (self.findJob(tl_thread_index)) |job| {
+                runJob(job);
+            } else {
+                std.atomic.spinLoopHint();
+            }
+        }
+    }
+
+    /// Call body(context, begin, end) over [0, count) in chunks of at least
+    /// `grain` items, on the workers and the calling thread. Returns once
+    /// every chunk has run. Small ranges run inline.
+    pub fn parallelFor(
+        self: *Self,
+        count: usize,
+        grain: usize,
+        context: anytype,
+        comptime body: fn (@TypeOf(context), usize, usize) void,
+    ) void {
+        std.debug.assert(grain > 0);
+        if (self.worker_count == 0 or count <= grain) {
+            body(context, 0, count);
+            return;
+        }
+        const Chunk = struct {
+            job: Job,
+            context: @TypeOf(context),
+            begin: usize,
+            end: usize,
+
+            fn run(job: *Job) void {
+                const chunk: *@This() = @fieldParentPtr("job", job);
+                body(chunk.context, chunk.begin, chunk.end);
+            }
+        };
+        const size = @max(grain, std.math.divCeil(usize, count, MaxChunks) catch unreachable);
+        const chunk_count = std.math.divCeil(usize, count, size) catch unreachable;
+        var chunks: [MaxChunks]Chunk = undefined;
+        var counter: Counter = .{};
+        // Chunk 0 runs here while the others are stolen
+        for (chunks[1..chunk_count], 1..) |*chunk, i| {
+            chunk.* = .{
+                .job = .{ .run = Chunk.run, .counter = &counter },
+                .context = context,
+                .begin = i * size,
+                .end = @min(count, (i + 1) * size),
+            };
+            self.submit(&chunk.job);
+        }
+        body(context, 0, @min(count, size));
+        self.wait(&counter);
+    }
+
+    fn workerMain(self: *Self, index: u32) void {
+        tl_thread_index = index;
+        var idle_spins: u32 = 0;
+        while (true) {
+            if (self.findJob(index)) |job| {
+                runJob(job);
+                idle_spins = 0;
+                continue;
+            }
+            if (!self.running.load(.acquire)) return;
+            if (idle_spins < SpinLimit) {
+                idle_spins += 1;
+                std.atomic.spinLoopHint();
+                continue;
+            }
+            const epoch = self.wake_epoch.load(.seq_cst);
+            _ = self.sleepers.fetchAdd(1, .seq_cst);
+            // A submit between findJob() and here either shows in the
+            // deques or has moved the epoch, so the wait returns at once
+            if (self.hasWork() or !self.running.load(.acquire)) {
+                _ = self.sleepers.fetchSub(1, .monotonic);
+                continue;
+            }
+            std.Thread.Futex.wait(&self.wake_epoch, epoch);
+            _ = self.sleepers.fetchSub(1, .monotonic);
+            idle_spins = 0;
+        }
+    }
+
+    /// Own deque first, then steal round-robin from the others.
+    fn findJob(self: *Self, index: u32) ?*Job {
+        if (self.deques[index].pop()) |job| return job;
+        const thread_count = self.worker_count + 1;
+        var i: u32 = 1;
+        while (i < thread_count) : (i += 1) {
+            if (self.deques[(index + i) % thread_count].steal()) |job| return job;
+        }
+        return null;
+    }
+
+    fn hasWork(self: *const Self) bool {
+        for (self.deques[0 .. self.worker_count + 1]) |*deque| {
+            if (!deque.isEmpty()) return true;
+        }
+        return false;
+    }
+};
+
+fn runJob(job: *Job) void {
+    // Read first: `run` may end the lifetime of the job's storage
+    const counter = job.counter;
+    job.run(job);
+    if (counter) |cnt| _ = cnt.pending.fetchSub(1, .release);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+const SumJob = struct {
+    job: Job,
+    value: u64,
+    total: *std.atomic.Value(u64),
+    ran_on: u32 = 0,
+
+    fn run(job: *Job) void {
+        const self: *SumJob = @fieldParentPtr("job", job);
+        _ = self.total.fetchAdd(self.value, .monotonic);
+        self.ran_on = threadIndex();
+    }
+};
+
+test "Deque pops LIFO, steals FIFO and reports full" {
+    var deque: Deque = .{};
+    var total = std.atomic.Value(u64).init(0);
+    var jobs: [DequeCapacity + 1]SumJob = undefined;
+    for (&jobs, 0..) |*j, i| j.* = .{ .job = .{ .run = SumJob.run }, .value = i, .total = &total };
+
+    for (jobs[0..DequeCapacity]) |*j| try testing.expect(deque.push(&j.job));
+    try testing.expect(!deque.push(&jobs[DequeCapacity].job));
+    try testing.expectEqual(&jobs[DequeCapacity - 1].job, deque.pop().?);
+    try testing.expectEqual(&jobs[0].job, deque.steal().?);
+    try testing.expectEqual(&jobs[1].job, deque.steal().?);
+    for (2..DequeCapacity - 1) |_| _ = deque.pop().?;
+    try testing.expect(deque.pop() == null);
+    try testing.expect(deque.steal() == null);
+    try testing.expect(deque.isEmpty());
+}
+
+test "JobSystem runs every job once across workers" {
+    var system: JobSystem = .{};
+    system.start(3);
+    defer system.stop();
+
+    var total = std.atomic.Value(u64).init(0);
+    var counter: Counter = .{};
+    var jobs: [1000]SumJob = undefined;
+    for (&jobs, 0..) |*j, i| {
+        j.* = .{ .job = .{ .run = SumJob.run, .counter = &counter }, .value = i + 1, .total = &total };
+        system.submit(&j.job);
+    }
+    system.wait(&counter);
+    try testing.expectEqual(@as(u64, 1000 * 1001 / 2), total.load(.monotonic));
+    try testing.expect(counter.done());
+}
+
+test "JobSystem without workers runs jobs inline" {
+    var system: JobSystem = .{};
+    system.start(0);
+    defer system.stop();
+
+    var total = std.atomic.Value(u64).init(0);
+    var counter: Counter = .{};
+    var job = SumJob{ .job = .{ .run = SumJob.run, .counter = &counter }, .value = 7, .total = &total, .ran_on = 99 };
+    system.submit(&job.job);
+    try testing.expect(counter.done());
+    try testing.expectEqual(@as(u64, 7), total.load(.monotonic));
+    try testing.expectEqual(@as(u32, 0), job.ran_on);
+}
+
+test "parallelFor covers the range exactly once" {
+    var system: JobSystem = .{};
+    system.start(2);
+    defer system.stop();
+
+    var marks = [_]u8{0} ** 10_000;
+    const Mark = struct {
+        fn body(m: *[10_000]u8, begin: usize, end: usize) void {
+            for (m[begin..end]) |*x| x.* += 1;
+        }
+    };
+    system.parallelFor(marks.len, 100, &marks, Mark.body);
+    for (marks) |x| try testing.expectEqual(@as(u8, 1), x);
+    // Below the grain: one inline call
+    system.parallelFor(50, 100, &marks, Mark.body);
+    for (marks[0..50]) |x| try testing.expectEqual(@as(u8, 2), x);
+}
@@ -0,0 +1,194 @@
+//! KTX2 container parsing
+//!
+//! Reads the header and level index of a KTX2 file whose levels already hold
+//! GPU block data (BCn, ETC2/EAC or ASTC 4x4, no supercompression) and reports
+//! where each level's bytes live. Nothing is copied: callers view the levels
+//! in the original buffer and pass them to compressedTexImage2D; the
+//! KTX2Loader in examples/three-entry.js does that for Three.js.
+//!
+//! Still rejected, each with its own error: Basis Universal payloads
+//! (vkFormat UNDEFINED, ETC1S/BasisLZ or UASTC, with or without zstd),
+//! zstd/zlib supercompressed block levels, cube maps, arrays and 3D
+//! textures. Transcoding Basis needs the basisu transcoder, which this
+//! runtime does not carry; such assets are converted to block formats
+//! offline.
+
+const std = @import("std");
+const testing = std.testing;
+const webgl_texture = @import("webgl_texture.zig");
+
+const TextureFormat = webgl_texture.TextureFormat;
+
+pub const MaxLevels: usize = 16;
+
+const Identifier = [12]u8{ 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const HeaderBytes: usize = 80;
+const LevelIndexEntryBytes: usize = 24;
+
+pub const ParseError = error{
+    NotKtx2,
+    Truncated,
+    /// vkFormat UNDEFINED: Basis Universal data that must be transcoded
+    BasisUniversal,
+    /// Zstd/zlib/BasisLZ supercompression
+    Supercompressed,
+    UnsupportedFormat,
+    /// Arrays, cube maps and 3D textures
+    UnsupportedLayout,
+};
+
+pub const Level = struct {
+    width: u32,
+    height: u32,
+    /// Byte range within the parsed buffer
+    offset: usize,
+    len: usize,
+};
+
+pub const Image = struct {
+    format: TextureFormat,
+    width: u32,
+    height: u32,
+    level_count: u32,
+    levels: [MaxLevels]Level,
+
+    pub fn levelData(self: *const Image, bytes: []const u8, level: usize) []const u8 {
+        const l = self.levels[level];
+        return bytes[l.offset .. l.offset + l.len];
+    }
+};
+
+pub fn parse(bytes: []const u8) ParseError!Image {
+    if (bytes.len < Identifier.len or !std.mem.eql(u8, bytes[0..Identifier.len], &Identifier)) {
+        return error.NotKtx2;
+    }
+    if (bytes.len < HeaderBytes) return error.Truncated;
+
+    const vk_format = readU32(bytes, 12);
+    const width = readU32(bytes, 20);
+    const height = readU32(bytes, 24);
+    const depth = readU32(bytes, 28);
+    const layers = readU32(bytes, 32);
+    const faces = readU32(bytes, 36);
+    // 0 asks the loader to generate mips; only the base level is stored
+    const level_count = @max(readU32(bytes, 40), 1);
+    const supercompression = readU32(bytes, 44);
+
+    if (vk_format == 0) return error.BasisUniversal;
+    if (supercompression != 0) return error.Supercompressed;
+    const format = mapVkFormat(vk_format) orelse return error.UnsupportedFormat;
+    if (width == 0 or height == 0 or depth > 1 or layers > 1 or faces != 1) return error.UnsupportedLayout;
+    if (level_count > MaxLevels) return error.UnsupportedLayout;
+
+    const index_end = HeaderBytes + level_count * LevelIndexEntryBytes;
+    if (bytes.len < index_end) return error.Truncated;
+
+    var image = Image{
+        .format = format,
+        .width = width,
+        .height = height,
+        .level_count = level_count,
+        .levels = undefined,
+    };
+    for (0..level_count) |i| {
+        const entry = HeaderBytes + i * LevelIndexEntryBytes;
+        const offset = readU64(bytes, entry);
+        const len = readU64(bytes, entry + 8);
+        if (offset > bytes.len or len > bytes.len - offset) return error.Truncated;
+        const shift: u5 = @intCast(i);
+        const level_width = @max(width >> shift, 1);
+        const level_height = @max(height >> shift, 1);
+        if (len < webgl_texture.compressedImageSize(format, level_width, level_height)) return error.Truncated;
+        image.levels[i] = .{
+            .width = level_width,
+            .height = level_height,
+            .offset = @intCast(offset),
+            .len = @intCast(len),
+        };
+    }
+    return image;
+}
+
+/// Vulkan block formats that have a WebGL compressed equivalent.
+pub fn mapVkFormat(vk_format: u32) ?TextureFormat {
+    return switch (vk_format) {
+        131 => .bc1_rgb,
+        133 => .bc1_rgba,
+        135 => .bc2_rgba,
+        137 => .bc3_rgba,
+        139 => .bc4_r,
+        140 => .bc4_r_snorm,
+        141 => .bc5_rg,
+        142 => .bc5_rg_snorm,
+        143 => .bc6h_rgb_ufloat,
+        144 => .bc6h_rgb_float,
+        145 => .bc7_rgba,
+        146 => .bc7_srgba,
+        147 => .etc2_rgb8,
+        148 => .etc2_srgb8,
+        149 => .etc2_rgb8a1,
+        151 => .etc2_rgba8,
+        152 => .etc2_srgb8a8,
+        153 => .eac_r11,
+        154 => .eac_r11_snorm,
+        155 => .eac_rg11,
+        156 => .eac_rg11_snorm,
+        157 => .astc_4x4_rgba,
+        158 => .astc_4x4_srgba,
+        else => null,
+    };
+}
+
+fn readU32(bytes: []const u8, offset: usize) u32 {
+    return std.mem.readInt(u32, bytes[offset..][0..4], .little);
+}
+
+fn readU64(bytes: []const u8, offset: usize) u64 {
+    return std.mem.readInt(u64, bytes[offset..][0..8], .little);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn writeTestHeader(buf: []u8, vk_format: u32, width: u32, height: u32, levels: u32, supercompression: u32) void {
+    @memset(buf, 0);
+    @memcpy(buf[0..12], &Identifier);
+    std.mem.writeInt(u32, buf[12..16], vk_format, .little);
+    std.mem.writeInt(u32, buf[20..24], width, .little);
+    std.mem.writeInt(u32, buf[24..28], height, .little);
+    std.mem.writeInt(u32, buf[36..40], 1, .little);
+    std.mem.writeInt(u32, buf[40..44], levels, .little);
+    std.mem.writeInt(u32, buf[44..48], supercompression, .little);
+}
+
+test "KTX2 parse reports block levels in place" {
+    // 8x8 BC7: level 0 is 2x2 blocks (64 bytes), level 1 is one block
+    var buf: [HeaderBytes + 2 * LevelIndexEntryBytes + 80]u8 = undefined;
+    writeTestHeader(&buf, 145, 8, 8, 2, 0);
+    const data_start = HeaderBytes + 2 * LevelIndexEntryBytes;
+    std.mem.writeInt(u64, buf[80..88], data_start + 16, .little);
+    std.mem.writeInt(u64, buf[88..96], 64, .little);
+    std.mem.writeInt(u64, buf[104..112], data_start, .little);
+    std.mem.writeInt(u64, buf[112..120], 16, .little);
+
+    const image = try parse(&buf);
+    try testing.expectEqual(TextureFormat.bc7_rgba, image.format);
+    try testing.expectEqual(@as(u32, 2), image.level_count);
+    try testing.expectEqual(@as(u32, 4), image.levels[1].width);
+    try testing.expectEqual(@as(usize, 64), image.levelData(&buf, 0).len);
+    try testing.expectEqual(@as(usize, data_start), image.levels[1].offset);
+}
+
+test "KTX2 parse rejects Basis, supercompressed and short files" {
+    var buf: [HeaderBytes + LevelIndexEntryBytes]u8 = undefined;
+    writeTestHeader(&buf, 0, 4, 4, 1, 0);
+    try testing.expectError(error.BasisUniversal, parse(&buf));
+    writeTestHeader(&buf, 145, 4, 4, 1, 2);
+    try testing.expectError(error.Supercompressed, parse(&buf));
+    writeTestHeader(&buf, 145, 4, 4, 1, 0);
+    std.mem.writeInt(u64, buf[80..88], HeaderBytes, .little);
+    std.mem.writeInt(u64, buf[88..96], 32, .little);
+    try testing.expectError(error.Truncated, parse(&buf));
+    try testing.expectError(error.NotKtx2, parse("not a texture"));
+}
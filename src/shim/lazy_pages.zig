@@ -0,0 +1,45 @@
+//! Allocations left untouched until they are used
+//!
+//! std.mem.Allocator.alloc and free fill memory with 0xAA in safe builds,
+//! which writes - and so commits - every page of a pool or heap the moment
+//! it is reserved. These go through rawAlloc/rawFree instead: a large
+//! allocation is address space until a page is first written, and a game
+//! that uses a fraction of a pool pays only for that fraction. Callers must
+//! write memory before reading it.
+
+const std = @import("std");
+const testing = std.testing;
+const Allocator = std.mem.Allocator;
+
+pub fn alloc(allocator: Allocator, comptime T: type, n: usize) Allocator.Error![]T {
+    comptime std.debug.assert(@sizeOf(T) > 0);
+    if (n == 0) return &.{};
+    const bytes = std.math.mul(usize, @sizeOf(T), n) catch return error.OutOfMemory;
+    const ptr = allocator.rawAlloc(bytes, .of(T), @returnAddress()) orelse return error.OutOfMemory;
+    const items: [*]T = @ptrCast(@alignCast(ptr));
+    return items[0..n];
+}
+
+pub fn free(allocator: Allocator, memory: anytype) void {
+    const info = @typeInfo(@TypeOf(memory)).pointer;
+    const bytes = std.mem.sliceAsBytes(memory);
+    if (bytes.len == 0) return;
+    allocator.rawFree(@constCast(bytes), .fromByteUnits(info.alignment), @returnAddress());
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "lazy_pages allocations round-trip" {
+    const values = try alloc(testing.allocator, u64, 1000);
+    defer free(testing.allocator, values);
+    try testing.expectEqual(@as(usize, 1000), values.len);
+    try testing.expect(std.mem.isAligned(@intFromPtr(values.ptr), @alignOf(u64)));
+    for (values, 0..) |*value, n| value.* = n;
+    try testing.expectEqual(@as(u64, 999), values[999]);
+
+    const empty = try alloc(testing.allocator, u32, 0);
+    free(testing.allocator, empty);
+    try testing.expectError(error.OutOfMemory, alloc(testing.allocator, u64, std.math.maxInt(usize) / 4));
+}
@@ -0,0 +1,190 @@
+//! LZ4 block codec
+//!
+//! Raw LZ4 blocks (no frame header or checksums) for asset archive entries.
+//! The compressor is the single-probe greedy matcher of the reference
+//! "fast" mode: compression runs once at pack time, while decompression
+//! runs on every load and is a bounds-checked copy loop. Output is
+//! compatible with any LZ4 block decoder.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub const DecodeError = error{Corrupt};
+
+const MinMatch: usize = 4;
+/// Matches may not start within the last 12 bytes of a block and the last
+/// 5 bytes are always literals (format end conditions).
+const MatchStartMargin: usize = 12;
+const LastLiterals: usize = 5;
+const MaxOffset: usize = 65535;
+const HashLog = 12;
+
+/// Worst-case compressed size of `len` input bytes.
+pub fn compressBound(len: usize) usize {
+    return len + len / 255 + 16;
+}
+
+/// Compress `src` into `dst`, which must hold compressBound(src.len) bytes.
+/// Returns the compressed length.
+pub fn compress(src: []const u8, dst: []u8) usize {
+    std.debug.assert(dst.len >= compressBound(src.len));
+    var out: usize = 0;
+    var anchor: usize = 0;
+
+    if (src.len > MatchStartMargin) {
+        // Positions are stored +1 so that 0 marks an empty slot
+        var table = [_]u32{0} ** (1 << HashLog);
+        const match_limit = src.len - LastLiterals;
+        var ip: usize = 0;
+        while (ip < src.len - MatchStartMargin) {
+            const seq = read32(src, ip);
+            const slot = hash(seq);
+            const candidate = table[slot];
+            table[slot] = @intCast(ip + 1);
+            if (candidate == 0 or ip - (candidate - 1) > MaxOffset or read32(src, candidate - 1) != seq) {
+                ip += 1;
+                continue;
+            }
+            const ref = candidate - 1;
+            var len = MinMatch;
+            while (ip + len < match_limit and src[ref + len] == src[ip + len]) len += 1;
+            out = writeSequence(dst, out, src[anchor..ip], ip - ref, len);
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    // Final literal-only sequence
+    const literals = src[anchor..];
+    dst[out] = @as(u8, @intCast(@min(literals.len, 15))) << 4;
+    out += 1;
+    out = writeLength(dst, out, literals.len);
+    @memcpy(dst[out..][0..literals.len], literals);
+    return out + literals.len;
+}
+
+/// Decompress a block into `dst`, which must be exactly the original size.
+pub fn decompress(src: []const u8, dst: []u8) DecodeError!void {
+    var ip: usize = 0;
+    var op: usize = 0;
+    while (true) {
+        if (ip >= src.len) return error.Corrupt;
+        const token = src[ip];
+        ip += 1;
+
+        const literal_len = try readLength(src, &ip, token >> 4);
+        if (literal_len > src.len - ip or literal_len > dst.len - op) return error.Corrupt;
+        @memcpy(dst[op..][0..literal_len], src[ip..][0..literal_len]);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == src.len) break;
+
+        if (src.len - ip < 2) return error.Corrupt;
+        const offset = @as(usize, src[ip]) | @as(usize, src[ip + 1]) << 8;
+        ip += 2;
+        if (offset == 0 or offset > op) return error.Corrupt;
+        const match_len = (try readLength(src, &ip, token & 15)) + MinMatch;
+        if (match_len > dst.len - op) return error.Corrupt;
+        // Byte-wise: the source may overlap the bytes being written
+        var from = op - offset;
+        for (dst[op..][0..match_len]) |*byte| {
+            byte.* = dst[from];
+            from += 1;
+        }
+        op += match_len;
+    }
+    if (op != dst.len) return error.Corrupt;
+}
+
+fn writeSequence(dst: []u8, start: usize, literals: []const u8, offset: usize, match_len: usize) usize {
+    const extra = match_len - MinMatch;
+    var out = start;
+    dst[out] = @as(u8, @intCast(@min(literals.len, 15))) << 4 | @as(u8, @intCast(@min(extra, 15)));
+    out += 1;
+    out = writeLength(dst, out, literals.len);
+    @memcpy(dst[out..][0..literals.len], literals);
+    out += literals.len;
+    dst[out] = @truncate(offset);
+    dst[out + 1] = @truncate(offset >> 8);
+    out += 2;
+    return writeLength(dst, out, extra);
+}
+
+/// Continuation bytes for a length whose nibble saturated at 15.
+fn writeLength(dst: []u8, start: usize, len: usize) usize {
+    if (len < 15) return start;
+    var out = start;
+    var rest = len - 15;
+    while (rest >= 255) : (rest -= 255) {
+        dst[out] = 255;
+        out += 1;
+    }
+    dst[out] = @intCast(rest);
+    return out + 1;
+}
+
+fn readLength(src: []const u8, ip: *usize, nibble: u8) DecodeError!usize {
+    var len: usize = nibble;
+    if (nibble != 15) return len;
+    while (true) {
+        if (ip.* >= src.len) return error.Corrupt;
+        const byte = src[ip.*];
+        ip.* += 1;
+        len += byte;
+        if (byte != 255) return len;
+    }
+}
+
+fn read32(bytes: []const u8, pos: usize) u32 {
+    return std.mem.readInt(u32, bytes[pos..][0..4], .little);
+}
+
+fn hash(seq: u32) usize {
+    return (seq *% 2654435761) >> (32 - HashLog);
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn expectRoundTrip(src: []const u8) !usize {
+    const packed_buf = try testing.allocator.alloc(u8, compressBound(src.len));
+    defer testing.allocator.free(packed_buf);
+    const packed_len = compress(src, packed_buf);
+    const out = try testing.allocator.alloc(u8, src.len);
+    defer testing.allocator.free(out);
+    try decompress(packed_buf[0..packed_len], out);
+    try testing.expectEqualSlices(u8, src, out);
+    return packed_len;
+}
+
+test "lz4 round trips short, repetitive and incompressible input" {
+    _ = try expectRoundTrip("");
+    _ = try expectRoundTrip("abc");
+
+    var repetitive: [4096]u8 = undefined;
+    for (&repetitive, 0..) |*byte, i| byte.* = "three-native "[i % 13];
+    try testing.expect(try expectRoundTrip(&repetitive) < repetitive.len / 10);
+
+    var noise: [3000]u8 = undefined;
+    var prng = std.Random.DefaultPrng.init(7);
+    prng.random().bytes(&noise);
+    try testing.expect(try expectRoundTrip(&noise) <= compressBound(noise.len));
+
+    // Long literal and match runs exercise the 255-byte length continuation
+    var runs: [1200]u8 = undefined;
+    @memcpy(runs[0..600], noise[0..600]);
+    @memset(runs[600..], 'z');
+    _ = try expectRoundTrip(&runs);
+}
+
+test "lz4 decompress rejects malformed blocks" {
+    var out: [16]u8 = undefined;
+    try testing.expectError(error.Corrupt, decompress("", &out));
+    // Literal run longer than the input
+    try testing.expectError(error.Corrupt, decompress(&[_]u8{ 0x50, 'a' }, &out));
+    // Match offset before the start of the output
+    try testing.expectError(error.Corrupt, decompress(&[_]u8{ 0x10, 'a', 0x05, 0x00 }, &out));
+    // Valid block whose output is shorter than expected
+    try testing.expectError(error.Corrupt, decompress(&[_]u8{ 0x10, 'a' }, &out));
+}
@@ -0,0 +1,234 @@
+//! Matrix and culling kernels behind the native math bindings
+//!
+//! Three.js keeps matrices column-major as 16 numbers. Columns load as
+//! @Vector(4, T) and each output column is a broadcast multiply-add chain
+//! over the columns of `a`, summed in the same order as
+//! Matrix4.multiplyMatrices, so f64 results match the JS implementation
+//! bit for bit. Batched kernels work on f32 spans (bone palettes, instance
+//! matrices) and on one sphere per step against all six frustum planes.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub const Mat4Len = 16;
+pub const FrustumPlaneCount = 6;
+/// Frustum planes as (nx, ny, nz, constant) each, in Frustum.planes order
+pub const FrustumLen = 4 * FrustumPlaneCount;
+/// Spheres as (cx, cy, cz, radius) each
+pub const SphereLen = 4;
+
+fn Vec4(comptime T: type) type {
+    return @Vector(4, T);
+}
+
+/// out = a * b. `out` may alias either input.
+pub fn multiply(comptime T: type, out: *[Mat4Len]T, a: *const [Mat4Len]T, b: *const [Mat4Len]T) void {
+    const V = Vec4(T);
+    const cols = [4]V{ a[0..4].*, a[4..8].*, a[8..12].*, a[12..16].* };
+    const rhs = b.*;
+    inline for (0..4) |j| {
+        var acc = cols[0] * @as(V, @splat(rhs[j * 4]));
+        acc += cols[1] * @as(V, @splat(rhs[j * 4 + 1]));
+        acc += cols[2] * @as(V, @splat(rhs[j * 4 + 2]));
+        acc += cols[3] * @as(V, @splat(rhs[j * 4 + 3]));
+        out[j * 4 ..][0..4].* = acc;
+    }
+}
+
+/// Matrix4.compose: translation, rotation from a unit quaternion
+/// (x, y, z, w) and scale.
+pub fn compose(comptime T: type, out: *[Mat4Len]T, position: [3]T, quaternion: [4]T, scale: [3]T) void {
+    const V = Vec4(T);
+    const x, const y, const z, const w = quaternion;
+    const x2 = x + x;
+    const y2 = y + y;
+    const z2 = z + z;
+    const xx = x * x2;
+    const xy = x * y2;
+    const xz = x * z2;
+    const yy = y * y2;
+    const yz = y * z2;
+    const zz = z * z2;
+    const wx = w * x2;
+    const wy = w * y2;
+    const wz = w * z2;
+
+    const col0: V = .{ 1 - (yy + zz), xy + wz, xz - wy, 0 };
+    const col1: V = .{ xy - wz, 1 - (xx + zz), yz + wx, 0 };
+    const col2: V = .{ xz + wy, yz - wx, 1 - (xx + yy), 0 };
+    // The last row is stored, not scaled, in Three.js: scaling its 0 by a
+    // negative scale would give -0
+    out[0..4].* = col0 * V{ scale[0], scale[0], scale[0], 1 };
+    out[4..8].* = col1 * V{ scale[1], scale[1], scale[1], 1 };
+    out[8..12].* = col2 * V{ scale[2], scale[2], scale[2], 1 };
+    out[12..16].* = .{ position[0], position[1], position[2], 1 };
+}
+
+/// out[i] = a[i] * b[i] for each matrix of `out`. Either input may be a
+/// single matrix, which then applies to every output.
+pub fn multiplyArray(comptime T: type, out: []T, a: []const T, b: []const T) void {
+    const count = out.len / Mat4Len;
+    std.debug.assert(out.len == count * Mat4Len);
+    std.debug.assert(a.len == Mat4Len or a.len == out.len);
+    std.debug.assert(b.len == Mat4Len or b.len == out.len);
+    const a_stride: usize = if (a.len == Mat4Len) 0 else Mat4Len;
+    const b_stride: usize = if (b.len == Mat4Len) 0 else Mat4Len;
+    for (0..count) |i| {
+        multiply(
+            T,
+            out[i * Mat4Len ..][0..Mat4Len],
+            a[i * a_stride ..][0..Mat4Len],
+            b[i * b_stride ..][0..Mat4Len],
+        );
+    }
+}
+
+/// Frustum.intersectsSphere for each sphere: results[i] is 1 when sphere i
+/// is at least partly inside all planes. Returns the number inside.
+pub fn intersectSpheres(planes: *const [FrustumLen]f32, spheres: []const f32, results: []u8) usize {
+    // Planes transposed into 8 lanes; the two spare lanes repeat plane 0
+    const F32x8 = @Vector(8, f32);
+    var nx: F32x8 = @splat(planes[0]);
+    var ny: F32x8 = @splat(planes[1]);
+    var nz: F32x8 = @splat(planes[2]);
+    var d: F32x8 = @splat(planes[3]);
+    for (0..FrustumPlaneCount) |p| {
+        nx[p] = planes[p * 4];
+        ny[p] = planes[p * 4 + 1];
+        nz[p] = planes[p * 4 + 2];
+        d[p] = planes[p * 4 + 3];
+    }
+
+    const count = spheres.len / SphereLen;
+    std.debug.assert(results.len >= count);
+    var inside: usize = 0;
+    for (0..count) |i| {
+        const s = spheres[i * SphereLen ..][0..SphereLen];
+        const distance = nx * @as(F32x8, @splat(s[0])) + ny * @as(F32x8, @splat(s[1])) +
+            nz * @as(F32x8, @splat(s[2])) + d;
+        const outside = @reduce(.Or, distance < @as(F32x8, @splat(-s[3])));
+        results[i] = @intFromBool(!outside);
+        inside += @intFromBool(!outside);
+    }
+    return inside;
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+/// Matrix4.multiplyMatrices, written out as in Three.js
+fn multiplyReference(out: *[Mat4Len]f64, a: *const [Mat4Len]f64, b: *const [Mat4Len]f64) void {
+    for (0..4) |row| {
+        for (0..4) |col| {
+            out[col * 4 + row] = a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1] +
+                a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+        }
+    }
+}
+
+test "multiply matches the Three.js formula bit for bit" {
+    var a: [Mat4Len]f64 = undefined;
+    var b: [Mat4Len]f64 = undefined;
+    for (&a, &b, 0..) |*x, *y, i| {
+        const f: f64 = @floatFromInt(i);
+        x.* = 0.1 * f - 0.7;
+        y.* = 1.0 / (f + 3.0);
+    }
+    // A zero column gives sums of signed zeros, which must match too
+    @memset(b[0..4], 0);
+    var expected: [Mat4Len]f64 = undefined;
+    multiplyReference(&expected, &a, &b);
+    var out: [Mat4Len]f64 = undefined;
+    multiply(f64, &out, &a, &b);
+    const expected_bits: [Mat4Len]u64 = @bitCast(expected);
+    const out_bits: [Mat4Len]u64 = @bitCast(out);
+    try testing.expectEqualSlices(u64, &expected_bits, &out_bits);
+
+    // In place, as in Matrix4.multiply(m)
+    multiply(f64, &a, &a, &b);
+    const in_place_bits: [Mat4Len]u64 = @bitCast(a);
+    try testing.expectEqualSlices(u64, &expected_bits, &in_place_bits);
+
+    // Batched, with a shared right-hand side
+    var spans: [2 * Mat4Len]f32 = undefined;
+    for (&spans, 0..) |*x, i| x.* = @floatFromInt(i % 5);
+    var identity = [_]f32{0} ** Mat4Len;
+    for (0..4) |i| identity[i * 5] = 1;
+    var batch: [2 * Mat4Len]f32 = undefined;
+    multiplyArray(f32, &batch, &spans, &identity);
+    try testing.expectEqualSlices(f32, &spans, &batch);
+}
+
+test "compose builds a translation-rotation-scale matrix" {
+    // Quarter turn about Z
+    const s = @sqrt(0.5);
+    var m: [Mat4Len]f64 = undefined;
+    compose(f64, &m, .{ 1, 2, 3 }, .{ 0, 0, s, s }, .{ 2, 2, 2 });
+    const expected = [Mat4Len]f64{ 0, 2, 0, 0, -2, 0, 0, 0, 0, 0, 2, 0, 1, 2, 3, 1 };
+    for (expected, m) |e, v| try testing.expectApproxEqAbs(e, v, 1e-12);
+}
+
+/// Matrix4.compose, written out as in Three.js
+fn composeReference(out: *[Mat4Len]f64, position: [3]f64, quaternion: [4]f64, scale: [3]f64) void {
+    const x, const y, const z, const w = quaternion;
+    const x2 = x + x;
+    const y2 = y + y;
+    const z2 = z + z;
+    const xx = x * x2;
+    const xy = x * y2;
+    const xz = x * z2;
+    const yy = y * y2;
+    const yz = y * z2;
+    const zz = z * z2;
+    const wx = w * x2;
+    const wy = w * y2;
+    const wz = w * z2;
+    const sx, const sy, const sz = scale;
+    out.* = .{
+        (1 - (yy + zz)) * sx, (xy + wz) * sx,       (xz - wy) * sx,       0,
+        (xy - wz) * sy,       (1 - (xx + zz)) * sy, (yz + wx) * sy,       0,
+        (xz + wy) * sz,       (yz - wx) * sz,       (1 - (xx + yy)) * sz, 0,
+        position[0],          position[1],          position[2],          1,
+    };
+}
+
+test "compose matches the Three.js formula bit for bit, signed zeros included" {
+    // A mirrored, rotated transform: negative scales turn the rotation's
+    // zeros into -0, which must survive exactly where Three.js has them
+    const cases = [_]struct { q: [4]f64, s: [3]f64 }{
+        .{ .q = .{ 0, 0, 0, 1 }, .s = .{ -1, 2, -3 } },
+        .{ .q = .{ 0.1, -0.7, 0.3, 0.640312 }, .s = .{ -0.5, -0.5, 4 } },
+        .{ .q = .{ 0, 0, @sqrt(0.5), @sqrt(0.5) }, .s = .{ 1, -1, 1 } },
+    };
+    for (cases) |case| {
+        var expected: [Mat4Len]f64 = undefined;
+        composeReference(&expected, .{ -0.0, 2, 3 }, case.q, case.s);
+        var out: [Mat4Len]f64 = undefined;
+        compose(f64, &out, .{ -0.0, 2, 3 }, case.q, case.s);
+        const expected_bits: [Mat4Len]u64 = @bitCast(expected);
+        const out_bits: [Mat4Len]u64 = @bitCast(out);
+        try testing.expectEqualSlices(u64, &expected_bits, &out_bits);
+    }
+}
+
+test "intersectSpheres culls spheres outside any plane" {
+    // Axis-aligned box -1..1 on every axis: planes face inward
+    const planes = [FrustumLen]f32{
+        1,  0,  0,  1,
+        -1, 0,  0,  1,
+        0,  1,  0,  1,
+        0,  -1, 0,  1,
+        0,  0,  1,  1,
+        0,  0,  -1, 1,
+    };
+    const spheres = [_]f32{
+        0,    0, 0,   0.5, // centered
+        1.4,  0, 0,   0.5, // straddles +x
+        0,    0, -3,  0.5, // beyond -z
+        -1.6, 0, 0,   0.5, // just past -x
+    };
+    var results: [4]u8 = undefined;
+    try testing.expectEqual(@as(usize, 2), intersectSpheres(&planes, &spheres, &results));
+    try testing.expectEqualSlices(u8, &.{ 1, 1, 0, 0 }, &results);
+}
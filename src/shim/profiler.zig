@@ -0,0 +1,470 @@
+//! Frame profiler
+//!
+//! Scoped CPU timers around the main thread's frame phases (JS tick, rAF,
+//! GC, draw flush, texture uploads, pipeline creation, commit), kept per
+//! frame for the last MaxFrames frames. Recording is off until enabled;
+//! a zone costs one load and branch while it is, so shipped builds keep
+//! every zone. The window draws a summary overlay from the ring, and the
+//! ring can be written out as a Chrome trace for chrome://tracing or
+//! Perfetto.
+//!
+//! Main thread only: job system workers and fetch threads are not timed.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub const Zone = enum(u8) {
+    frame,
+    tick,
+    timers,
+    input,
+    raf,
+    gc,
+    flush,
+    texture_upload,
+    pipeline_create,
+    commit,
+
+    pub fn label(self: Zone) []const u8 {
+        return switch (self) {
+            .frame => "frame",
+            .tick => "js tick",
+            .timers => "timers",
+            .input => "input",
+            .raf => "rAF",
+            .gc => "gc",
+            .flush => "flush",
+            .texture_upload => "textures",
+            .pipeline_create => "pipelines",
+            .commit => "commit",
+        };
+    }
+
+    /// CPU budget from docs/design/src/performance.md: the top of the JS
+    /// range for the tick, the shim's for the flush.
+    pub fn budgetNs(self: Zone) ?u64 {
+        return switch (self) {
+            .tick => 4 * std.time.ns_per_ms,
+            .flush => 2 * std.time.ns_per_ms,
+            else => null,
+        };
+    }
+};
+
+pub const ZoneCount = @typeInfo(Zone).@"enum".fields.len;
+
+/// Frames kept for the overlay and the trace (two seconds at 60 FPS).
+pub const MaxFrames: usize = 120;
+/// Zones recorded per frame for the trace; later ones still count
+/// towards the frame's totals.
+pub const MaxEventsPerFrame: usize = 256;
+/// Nesting kept; deeper zones are not timed.
+pub const MaxDepth: usize = 8;
+
+/// One timed zone, relative to the start of its frame.
+pub const Event = struct {
+    zone: Zone,
+    depth: u8,
+    start_ns: u32,
+    dur_ns: u32,
+};
+
+pub const Frame = struct {
+    start_ns: u64,
+    /// Inclusive time and calls per zone
+    total_ns: [ZoneCount]u64,
+    calls: [ZoneCount]u32,
+    event_count: u32,
+    /// Zones past MaxEventsPerFrame, missing from the trace
+    dropped: u32,
+    events: [MaxEventsPerFrame]Event,
+
+    pub fn zoneNs(self: *const Frame, zone: Zone) u64 {
+        return self.total_ns[@intFromEnum(zone)];
+    }
+
+    pub fn recorded(self: *const Frame) []const Event {
+        return self.events[0..self.event_count];
+    }
+};
+
+pub const Summary = struct {
+    last_ns: u64 = 0,
+    avg_ns: u64 = 0,
+    max_ns: u64 = 0,
+};
+
+const OpenZone = struct {
+    zone: Zone,
+    start_ns: u64,
+};
+
+pub const Profiler = struct {
+    frames: [MaxFrames]Frame = undefined,
+    /// Frames completed since reset; the one being recorded is
+    /// frames[count % MaxFrames]
+    count: u64 = 0,
+    in_frame: bool = false,
+    stack: [MaxDepth]OpenZone = undefined,
+    depth: usize = 0,
+    /// Open zones that did not fit on the stack
+    skipped: usize = 0,
+    /// Frames whose zone went over its budget, since reset
+    over_budget: [ZoneCount]u64 = @splat(0),
+
+    const Self = @This();
+
+    pub fn reset(self: *Self) void {
+        self.count = 0;
+        self.in_frame = false;
+        self.depth = 0;
+        self.skipped = 0;
+        self.over_budget = @splat(0);
+    }
+
+    fn current(self: *Self) *Frame {
+        return &self.frames[@intCast(self.count % MaxFrames)];
+    }
+
+    /// Start recording a frame; it is open as the `.frame` zone. Zones
+    /// outside a frame are not recorded.
+    pub fn beginFrame(self: *Self, now_ns: u64) void {
+        const cur = self.current();
+        cur.start_ns = now_ns;
+        cur.total_ns = @splat(0);
+        cur.calls = @splat(0);
+        cur.event_count = 0;
+        cur.dropped = 0;
+        self.in_frame = true;
+        self.depth = 0;
+        self.skipped = 0;
+        self.beginZone(.frame, now_ns);
+    }
+
+    /// Close any zones still open and keep the cur.
+    pub fn endFrame(self: *Self, now_ns: u64) void {
+        if (!self.in_frame) return;
+        self.skipped = 0;
+        while (self.depth > 0) self.endZone(now_ns);
+        const cur = self.current();
+        inline for (@typeInfo(Zone).@"enum".fields) |field| {
+            const zone: Zone = @enumFromInt(field.value);
+            if (zone.budgetNs()) |budget| {
+                if (cur.zoneNs(zone) > budget) self.over_budget[field.value] += 1;
+            }
+        }
+        self.in_frame = false;
+        self.count += 1;
+    }
+
+    pub fn beginZone(self: *Self, zone: Zone, now_ns: u64) void {
+        if (!self.in_frame) return;
+        if (self.depth == MaxDepth) {
+            self.skipped += 1;
+            return;
+        }
+        self.stack[self.depth] = .{ .zone = zone, .start_ns = now_ns };
+        self.depth += 1;
+    }
+
+    /// End the innermost open zone.
+    pub fn endZone(self: *Self, now_ns: u64) void {
+        if (self.skipped > 0) {
+            self.skipped -= 1;
+            return;
+        }
+        if (!self.in_frame or self.depth == 0) return;
+        self.depth -= 1;
+        const open = self.stack[self.depth];
+        const cur = self.current();
+        const dur = now_ns -| open.start_ns;
+        const index = @intFromEnum(open.zone);
+        cur.total_ns[index] += dur;
+        cur.calls[index] += 1;
+        if (cur.event_count == MaxEventsPerFrame) {
+            cur.dropped += 1;
+            return;
+        }
+        cur.events[cur.event_count] = .{
+            .zone = open.zone,
+            .depth = @intCast(self.depth),
+            .start_ns = saturate(open.start_ns -| cur.start_ns),
+            .dur_ns = saturate(dur),
+        };
+        cur.event_count += 1;
+    }
+
+    /// Completed frames in the ring.
+    pub fn frameCount(self: *const Self) usize {
+        return @intCast(@min(self.count, MaxFrames));
+    }
+
+    /// Completed frame `index`, oldest first.
+    pub fn frame(self: *const Self, index: usize) *const Frame {
+        std.debug.assert(index < self.frameCount());
+        const oldest = self.count - self.frameCount();
+        return &self.frames[@intCast((oldest + index) % MaxFrames)];
+    }
+
+    pub fn summary(self: *const Self, zone: Zone) Summary {
+        const frames = self.frameCount();
+        if (frames == 0) return .{};
+        var result = Summary{ .last_ns = self.frame(frames - 1).zoneNs(zone) };
+        var sum: u64 = 0;
+        for (0..frames) |i| {
+            const ns = self.frame(i).zoneNs(zone);
+            sum += ns;
+            result.max_ns = @max(result.max_ns, ns);
+        }
+        result.avg_ns = sum / frames;
+        return result;
+    }
+
+    pub fn overBudgetFrames(self: *const Self, zone: Zone) u64 {
+        return self.over_budget[@intFromEnum(zone)];
+    }
+
+    /// The ring in Chrome's trace event format: one complete ("X") event
+    /// per recorded zone, timestamps in microseconds from the oldest frame.
+    pub fn writeChromeTrace(self: *const Self, out: *std.Io.Writer) std.Io.Writer.Error!void {
+        try out.writeAll("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        const frames = self.frameCount();
+        const origin = if (frames > 0) self.frame(0).start_ns else 0;
+        var first = true;
+        for (0..frames) |i| {
+            const f = self.frame(i);
+            for (f.recorded()) |event| {
+                if (!first) try out.writeByte(',');
+                first = false;
+                const start = f.start_ns - origin + event.start_ns;
+                try out.print("\n{{\"name\":\"{s}\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":{d:.3},\"dur\":{d:.3}}}", .{
+                    event.zone.label(),
+                    nsToUs(start),
+                    nsToUs(event.dur_ns),
+                });
+            }
+        }
+        try out.writeAll("\n]}\n");
+    }
+};
+
+fn saturate(ns: u64) u32 {
+    return @intCast(@min(ns, std.math.maxInt(u32)));
+}
+
+fn nsToUs(ns: u64) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_us;
+}
+
+// =============================================================================
+// Global profiler
+// =============================================================================
+
+var g_profiler: Profiler = .{};
+var g_enabled = false;
+var g_origin: ?std.time.Instant = null;
+
+pub fn global() *Profiler {
+    return &g_profiler;
+}
+
+pub fn enabled() bool {
+    return g_enabled;
+}
+
+/// Takes effect at the next frame: zones of a frame already underway are
+/// not recorded.
+pub fn setEnabled(on: bool) void {
+    if (on == g_enabled) return;
+    g_enabled = on;
+    g_profiler.in_frame = false;
+}
+
+/// Nanoseconds on a monotonic clock, from the first call.
+pub fn now() u64 {
+    const t = std.time.Instant.now() catch return 0;
+    const origin = g_origin orelse {
+        g_origin = t;
+        return 0;
+    };
+    return t.since(origin);
+}
+
+/// A zone of the global profiler; `end()` it on every path, usually with
+/// `defer`.
+pub const Scope = struct {
+    active: bool,
+
+    pub fn end(self: Scope) void {
+        if (self.active) g_profiler.endZone(now());
+    }
+};
+
+pub fn begin(zone: Zone) Scope {
+    if (!g_enabled) return .{ .active = false };
+    g_profiler.beginZone(zone, now());
+    return .{ .active = true };
+}
+
+pub fn beginFrame() void {
+    if (g_enabled) g_profiler.beginFrame(now());
+}
+
+pub fn endFrame() void {
+    if (g_enabled) g_profiler.endFrame(now());
+}
+
+/// Write the global ring as a Chrome trace to `path`.
+pub fn writeChromeTraceFile(path: []const u8) !void {
+    var file = try std.fs.cwd().createFile(path, .{});
+    defer file.close();
+    var buf: [64 * 1024]u8 = undefined;
+    var writer = file.writer(&buf);
+    try g_profiler.writeChromeTrace(&writer.interface);
+    try writer.interface.flush();
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "Profiler keeps nested zone totals and events per frame" {
+    const profiler = try testing.allocator.create(Profiler);
+    defer testing.allocator.destroy(profiler);
+    profiler.* = .{};
+
+    // Outside a frame nothing is recorded
+    profiler.beginZone(.tick, 0);
+    profiler.endZone(10);
+    try testing.expectEqual(@as(usize, 0), profiler.frameCount());
+
+    profiler.beginFrame(1_000);
+    profiler.beginZone(.tick, 1_000);
+    profiler.beginZone(.raf, 1_500);
+    profiler.endZone(5_000_000);
+    profiler.endZone(5_001_000);
+    profiler.beginZone(.flush, 5_001_000);
+    profiler.beginZone(.pipeline_create, 5_002_000);
+    profiler.endZone(5_003_000);
+    profiler.beginZone(.pipeline_create, 5_004_000);
+    profiler.endZone(5_006_000);
+    // Left open: endFrame closes it
+    profiler.endFrame(6_001_000);
+
+    try testing.expectEqual(@as(usize, 1), profiler.frameCount());
+    const frame = profiler.frame(0);
+    try testing.expectEqual(@as(u64, 6_000_000), frame.zoneNs(.frame));
+    try testing.expectEqual(@as(u64, 5_000_000), frame.zoneNs(.tick));
+    try testing.expectEqual(@as(u64, 3_000), frame.zoneNs(.pipeline_create));
+    try testing.expectEqual(@as(u32, 2), frame.calls[@intFromEnum(Zone.pipeline_create)]);
+    try testing.expectEqual(@as(u64, 1_000_000), frame.zoneNs(.flush));
+    try testing.expectEqual(@as(usize, 6), frame.recorded().len);
+    // Children end first
+    try testing.expectEqual(Zone.raf, frame.recorded()[0].zone);
+    try testing.expectEqual(@as(u8, 2), frame.recorded()[0].depth);
+    try testing.expectEqual(@as(u32, 500), frame.recorded()[0].start_ns);
+    try testing.expectEqual(Zone.frame, frame.recorded()[5].zone);
+
+    // 5 ms of JS is over the 4 ms budget; 1 ms of flush is not
+    try testing.expectEqual(@as(u64, 1), profiler.overBudgetFrames(.tick));
+    try testing.expectEqual(@as(u64, 0), profiler.overBudgetFrames(.flush));
+}
+
+test "Profiler ring keeps the newest frames and summarizes them" {
+    const profiler = try testing.allocator.create(Profiler);
+    defer testing.allocator.destroy(profiler);
+    profiler.* = .{};
+
+    var t: u64 = 0;
+    for (0..MaxFrames + 10) |i| {
+        profiler.beginFrame(t);
+        profiler.beginZone(.flush, t);
+        t += (i % 4 + 1) * 1_000;
+        profiler.endZone(t);
+        profiler.endFrame(t);
+        t += 100;
+    }
+    try testing.expectEqual(@as(usize, MaxFrames), profiler.frameCount());
+    // The oldest ten frames were overwritten
+    try testing.expectEqual(@as(u64, (10 % 4 + 1) * 1_000), profiler.frame(0).zoneNs(.flush));
+
+    const flush = profiler.summary(.flush);
+    try testing.expectEqual(@as(u64, ((MaxFrames + 9) % 4 + 1) * 1_000), flush.last_ns);
+    try testing.expectEqual(@as(u64, 4_000), flush.max_ns);
+    try testing.expectEqual(@as(u64, 2_500), flush.avg_ns);
+    try testing.expectEqual(Summary{}, profiler.summary(.gc));
+}
+
+test "Profiler drops zones past the depth and event limits" {
+    const profiler = try testing.allocator.create(Profiler);
+    defer testing.allocator.destroy(profiler);
+    profiler.* = .{};
+
+    profiler.beginFrame(0);
+    for (0..MaxDepth + 2) |_| profiler.beginZone(.tick, 0);
+    for (0..MaxDepth + 2) |_| profiler.endZone(10);
+    // Only the frame zone is still open
+    try testing.expectEqual(@as(usize, 1), profiler.depth);
+    for (0..MaxEventsPerFrame) |_| {
+        profiler.beginZone(.gc, 10);
+        profiler.endZone(20);
+    }
+    profiler.endFrame(30);
+
+    const frame = profiler.frame(0);
+    // MaxDepth - 1 tick zones fit above the frame; as many gc zones and
+    // the frame zone itself are past the event limit
+    try testing.expectEqual(@as(usize, MaxEventsPerFrame), frame.recorded().len);
+    try testing.expectEqual(@as(u32, MaxDepth), frame.dropped);
+    try testing.expectEqual(@as(u32, MaxDepth - 1), frame.calls[@intFromEnum(Zone.tick)]);
+    try testing.expectEqual(@as(u64, MaxEventsPerFrame * 10), frame.zoneNs(.gc));
+    try testing.expectEqual(@as(u64, 30), frame.zoneNs(.frame));
+}
+
+test "Profiler writes a Chrome trace of the ring" {
+    const profiler = try testing.allocator.create(Profiler);
+    defer testing.allocator.destroy(profiler);
+    profiler.* = .{};
+
+    for (0..2) |i| {
+        const start: u64 = 1_000_000 + i * 16_000_000;
+        profiler.beginFrame(start);
+        profiler.beginZone(.flush, start + 2_000);
+        profiler.endZone(start + 3_500);
+        profiler.endFrame(start + 10_000);
+    }
+
+    var aw: std.Io.Writer.Allocating = .init(testing.allocator);
+    defer aw.deinit();
+    try profiler.writeChromeTrace(&aw.writer);
+
+    const parsed = try std.json.parseFromSlice(std.json.Value, testing.allocator, aw.written(), .{});
+    defer parsed.deinit();
+    const events = parsed.value.object.get("traceEvents").?.array.items;
+    try testing.expectEqual(@as(usize, 4), events.len);
+    const flush = events[2].object;
+    try testing.expectEqualStrings("flush", flush.get("name").?.string);
+    try testing.expectEqualStrings("X", flush.get("ph").?.string);
+    try testing.expectApproxEqAbs(@as(f64, 16_002), flush.get("ts").?.float, 0.001);
+    try testing.expectApproxEqAbs(@as(f64, 1.5), flush.get("dur").?.float, 0.001);
+}
+
+test "Disabled scopes record nothing" {
+    setEnabled(false);
+    defer setEnabled(false);
+    g_profiler.reset();
+    defer g_profiler.reset();
+
+    beginFrame();
+    begin(.flush).end();
+    endFrame();
+    try testing.expectEqual(@as(usize, 0), g_profiler.frameCount());
+
+    setEnabled(true);
+    beginFrame();
+    const scope = begin(.flush);
+    scope.end();
+    endFrame();
+    try testing.expectEqual(@as(usize, 1), g_profiler.frameCount());
+    try testing.expectEqual(@as(u32, 1), g_profiler.frame(0).calls[@intFromEnum(Zone.flush)]);
+}
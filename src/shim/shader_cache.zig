@@ -0,0 +1,296 @@
+//! Persistent shader translation cache
+//!
+//! Stores the CPU-side result of linking a program (translated GLSL 330 text
+//! plus uniform/sampler/attribute reflection) on disk, keyed by a hash of the
+//! original vertex and fragment sources and of the translator that produced
+//! it. The payload format is owned by webgl_program.zig; this module only
+//! handles keys, framing, files and hit/miss counters.
+
+const std = @import("std");
+const testing = std.testing;
+
+const log = std.log.scoped(.shader_cache);
+
+pub const MaxCacheDirBytes: usize = 512;
+pub const MaxEntryBytes: usize = 1024 * 1024;
+
+const Magic = [4]u8{ 'T', 'N', 'S', 'C' };
+const HeaderBytes: usize = 4 + 8 + 8 + 4 + 8;
+const allocator = std.heap.page_allocator;
+
+var g_dir_buf: [MaxCacheDirBytes]u8 = undefined;
+var g_dir_len: usize = 0;
+// Atomic because linkAsync() loads from worker threads
+var g_hits = std.atomic.Value(u64).init(0);
+var g_misses = std.atomic.Value(u64).init(0);
+var g_stores = std.atomic.Value(u64).init(0);
+
+/// Lookup and write counters, cumulative since the last resetStats().
+pub const Stats = struct {
+    hits: u64 = 0,
+    misses: u64 = 0,
+    stores: u64 = 0,
+};
+
+pub fn stats() Stats {
+    return .{
+        .hits = g_hits.load(.monotonic),
+        .misses = g_misses.load(.monotonic),
+        .stores = g_stores.load(.monotonic),
+    };
+}
+
+pub fn resetStats() void {
+    g_hits.store(0, .monotonic);
+    g_misses.store(0, .monotonic);
+    g_stores.store(0, .monotonic);
+}
+
+/// Enable the cache rooted at `path` (created on first store), or disable
+/// it with null.
+pub fn setDirectory(path: ?[]const u8) void {
+    const dir = path orelse {
+        g_dir_len = 0;
+        return;
+    };
+    if (dir.len == 0 or dir.len > MaxCacheDirBytes) {
+        g_dir_len = 0;
+        return;
+    }
+    @memcpy(g_dir_buf[0..dir.len], dir);
+    g_dir_len = dir.len;
+}
+
+pub fn isEnabled() bool {
+    return g_dir_len > 0;
+}
+
+/// Content key for a vertex/fragment source pair translated by the build
+/// identified by `fingerprint`.
+pub fn sourceKey(fingerprint: u64, vs_source: []const u8, fs_source: []const u8) u64 {
+    var hasher = std.hash.Wyhash.init(0x7468_7265_652d_6e61);
+    hasher.update(std.mem.asBytes(&fingerprint));
+    hasher.update(vs_source);
+    // Length separator so (ab, c) and (a, bc) hash differently
+    hasher.update(std.mem.asBytes(&vs_source.len));
+    hasher.update(fs_source);
+    return hasher.final();
+}
+
+/// Read the payload stored under `key`. `fingerprint` identifies the payload
+/// layout; entries written by a build with a different layout are ignored.
+/// Caller frees the result with freePayload().
+pub fn load(key: u64, fingerprint: u64) ?[]u8 {
+    if (!isEnabled()) return null;
+    const payload = loadEntry(key, fingerprint) orelse {
+        _ = g_misses.fetchAdd(1, .monotonic);
+        return null;
+    };
+    _ = g_hits.fetchAdd(1, .monotonic);
+    return payload;
+}
+
+fn loadEntry(key: u64, fingerprint: u64) ?[]u8 {
+    var name_buf: [32]u8 = undefined;
+    const name = entryName(&name_buf, key, "");
+    var dir = std.fs.cwd().openDir(g_dir_buf[0..g_dir_len], .{}) catch return null;
+    defer dir.close();
+    const file_bytes = dir.readFileAlloc(allocator, name, MaxEntryBytes + HeaderBytes) catch return null;
+    defer allocator.free(file_bytes);
+
+    const payload = unframe(file_bytes, key, fingerprint) orelse {
+        log.debug("load: discarding stale entry {s}", .{name});
+        return null;
+    };
+    return allocator.dupe(u8, payload) catch null;
+}
+
+pub fn freePayload(payload: []u8) void {
+    allocator.free(payload);
+}
+
+/// Write `payload` under `key`. Failures are logged and otherwise ignored;
+/// the cache is an optimization only.
+pub fn store(key: u64, fingerprint: u64, payload: []const u8) void {
+    if (!isEnabled()) return;
+    if (payload.len > MaxEntryBytes) return;
+    const framed = frame(key, fingerprint, payload) catch return;
+    defer allocator.free(framed);
+
+    const dir_path = g_dir_buf[0..g_dir_len];
+    std.fs.cwd().makePath(dir_path) catch |err| {
+        log.warn("store: cannot create {s}: {s}", .{ dir_path, @errorName(err) });
+        return;
+    };
+    var dir = std.fs.cwd().openDir(dir_path, .{}) catch return;
+    defer dir.close();
+
+    // Write then rename so a crash never leaves a truncated entry behind
+    var tmp_buf: [32]u8 = undefined;
+    var name_buf: [32]u8 = undefined;
+    const tmp_name = entryName(&tmp_buf, key, ".tmp");
+    const name = entryName(&name_buf, key, "");
+    dir.writeFile(.{ .sub_path = tmp_name, .data = framed }) catch |err| {
+        log.warn("store: write failed: {s}", .{@errorName(err)});
+        return;
+    };
+    dir.rename(tmp_name, name) catch |err| {
+        log.warn("store: rename failed: {s}", .{@errorName(err)});
+        dir.deleteFile(tmp_name) catch {};
+        return;
+    };
+    _ = g_stores.fetchAdd(1, .monotonic);
+}
+
+fn entryName(buf: *[32]u8, key: u64, suffix: []const u8) []const u8 {
+    return std.fmt.bufPrint(buf, "{x:0>16}.tnsc{s}", .{ key, suffix }) catch unreachable;
+}
+
+/// Layout: magic, fingerprint, key, payload length, payload checksum, payload.
+fn frame(key: u64, fingerprint: u64, payload: []const u8) ![]u8 {
+    const out = try allocator.alloc(u8, HeaderBytes + payload.len);
+    @memcpy(out[0..4], &Magic);
+    std.mem.writeInt(u64, out[4..12], fingerprint, .little);
+    std.mem.writeInt(u64, out[12..20], key, .little);
+    std.mem.writeInt(u32, out[20..24], @intCast(payload.len), .little);
+    std.mem.writeInt(u64, out[24..32], std.hash.Wyhash.hash(0, payload), .little);
+    @memcpy(out[HeaderBytes..], payload);
+    return out;
+}
+
+fn unframe(bytes: []const u8, key: u64, fingerprint: u64) ?[]const u8 {
+    if (bytes.len < HeaderBytes) return null;
+    if (!std.mem.eql(u8, bytes[0..4], &Magic)) return null;
+    if (std.mem.readInt(u64, bytes[4..12], .little) != fingerprint) return null;
+    if (std.mem.readInt(u64, bytes[12..20], .little) != key) return null;
+    const len: usize = std.mem.readInt(u32, bytes[20..24], .little);
+    if (bytes.len != HeaderBytes + len) return null;
+    const payload = bytes[HeaderBytes..];
+    if (std.mem.readInt(u64, bytes[24..32], .little) != std.hash.Wyhash.hash(0, payload)) return null;
+    return payload;
+}
+
+// =============================================================================
+// Payload encoding helpers
+// =============================================================================
+
+/// Little-endian append-only encoder. Allocation failure is sticky and
+/// reported by finish().
+pub const Writer = struct {
+    bytes: std.ArrayList(u8) = .empty,
+    failed: bool = false,
+
+    const Self = @This();
+
+    pub fn int(self: *Self, comptime T: type, value: T) void {
+        var buf: [@sizeOf(T)]u8 = undefined;
+        std.mem.writeInt(T, &buf, value, .little);
+        self.raw(&buf);
+    }
+
+    pub fn raw(self: *Self, data: []const u8) void {
+        if (self.failed) return;
+        self.bytes.appendSlice(allocator, data) catch {
+            self.failed = true;
+        };
+    }
+
+    /// Length-prefixed byte string.
+    pub fn blob(self: *Self, data: []const u8) void {
+        self.int(u32, @intCast(data.len));
+        self.raw(data);
+    }
+
+    pub fn finish(self: *Self) ?[]const u8 {
+        if (self.failed) return null;
+        return self.bytes.items;
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.bytes.deinit(allocator);
+    }
+};
+
+pub const Reader = struct {
+    bytes: []const u8,
+    pos: usize = 0,
+
+    const Self = @This();
+
+    pub fn int(self: *Self, comptime T: type) !T {
+        const data = try self.raw(@sizeOf(T));
+        return std.mem.readInt(T, data[0..@sizeOf(T)], .little);
+    }
+
+    pub fn raw(self: *Self, len: usize) ![]const u8 {
+        if (len > self.bytes.len - self.pos) return error.Truncated;
+        const data = self.bytes[self.pos .. self.pos + len];
+        self.pos += len;
+        return data;
+    }
+
+    pub fn blob(self: *Self) ![]const u8 {
+        const len = try self.int(u32);
+        return self.raw(len);
+    }
+
+    pub fn done(self: *const Self) bool {
+        return self.pos == self.bytes.len;
+    }
+};
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "Shader cache key depends on both sources, their split and the build" {
+    const a = sourceKey(1, "void main(){}", "out vec4 c;");
+    try testing.expectEqual(a, sourceKey(1, "void main(){}", "out vec4 c;"));
+    try testing.expect(a != sourceKey(1, "void main(){}", "out vec4 d;"));
+    try testing.expect(a != sourceKey(2, "void main(){}", "out vec4 c;"));
+    try testing.expect(sourceKey(1, "ab", "c") != sourceKey(1, "a", "bc"));
+}
+
+test "Shader cache frames reject stale or corrupt entries" {
+    const framed = try frame(42, 7, "payload");
+    defer allocator.free(framed);
+    try testing.expectEqualStrings("payload", unframe(framed, 42, 7).?);
+    try testing.expect(unframe(framed, 42, 8) == null);
+    try testing.expect(unframe(framed, 43, 7) == null);
+    try testing.expect(unframe(framed[0 .. framed.len - 1], 42, 7) == null);
+    framed[framed.len - 1] ^= 0xFF;
+    try testing.expect(unframe(framed, 42, 7) == null);
+}
+
+test "Shader cache round-trips through a directory" {
+    var tmp = testing.tmpDir(.{});
+    defer tmp.cleanup();
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    const root = try tmp.dir.realpath(".", &path_buf);
+    setDirectory(root);
+    defer setDirectory(null);
+    resetStats();
+    defer resetStats();
+
+    try testing.expect(load(1, 1) == null);
+    store(1, 1, "hello");
+    const payload = load(1, 1).?;
+    defer freePayload(payload);
+    try testing.expectEqualStrings("hello", payload);
+    try testing.expect(load(1, 2) == null);
+    try testing.expectEqual(Stats{ .hits = 1, .misses = 2, .stores = 1 }, stats());
+}
+
+test "Shader cache writer and reader round-trip" {
+    var writer = Writer{};
+    defer writer.deinit();
+    writer.int(u32, 0xDEADBEEF);
+    writer.blob("abc");
+    writer.int(u8, 9);
+    var reader = Reader{ .bytes = writer.finish().? };
+    try testing.expectEqual(@as(u32, 0xDEADBEEF), try reader.int(u32));
+    try testing.expectEqualStrings("abc", try reader.blob());
+    try testing.expectEqual(@as(u8, 9), try reader.int(u8));
+    try testing.expect(reader.done());
+    try testing.expectError(error.Truncated, reader.int(u8));
+}
@@ -0,0 +1,102 @@
+//! Bounded single-producer single-consumer ring
+//!
+//! Background workers hand finished work to the main thread through these
+//! rings. One side only ever pushes and the other only ever pops, so the
+//! queue needs no lock: each index is owned by one thread and published to
+//! the other with release/acquire ordering. Storage is inline and sized at
+//! comptime, so pushing never allocates.
+
+const std = @import("std");
+const testing = std.testing;
+
+pub fn SpscRing(comptime T: type, comptime capacity: usize) type {
+    comptime std.debug.assert(std.math.isPowerOfTwo(capacity));
+    comptime std.debug.assert(capacity <= std.math.maxInt(u31));
+
+    return struct {
+        items: [capacity]T = undefined,
+        /// Next slot to read; written only by the consumer.
+        head: std.atomic.Value(u32) = .init(0),
+        /// Next slot to write; written only by the producer.
+        tail: std.atomic.Value(u32) = .init(0),
+
+        const Self = @This();
+        const mask: u32 = capacity - 1;
+        pub const Capacity = capacity;
+
+        /// Producer side. Returns false when the ring is full.
+        pub fn push(self: *Self, item: T) bool {
+            const tail = self.tail.load(.monotonic);
+            const head = self.head.load(.acquire);
+            if (tail -% head == capacity) return false;
+            self.items[tail & mask] = item;
+            self.tail.store(tail +% 1, .release);
+            return true;
+        }
+
+        /// Consumer side. Returns null when the ring is empty.
+        pub fn pop(self: *Self) ?T {
+            const head = self.head.load(.monotonic);
+            const tail = self.tail.load(.acquire);
+            if (head == tail) return null;
+            const item = self.items[head & mask];
+            self.head.store(head +% 1, .release);
+            return item;
+        }
+
+        /// Approximate when called while the other side is active.
+        pub fn len(self: *const Self) u32 {
+            return self.tail.load(.acquire) -% self.head.load(.acquire);
+        }
+    };
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "SpscRing wraps and reports full and empty" {
+    var ring = SpscRing(u32, 4){};
+    try testing.expectEqual(@as(?u32, null), ring.pop());
+
+    for (0..3) |round| {
+        const base: u32 = @intCast(round * 10);
+        for (0..4) |i| try testing.expect(ring.push(base + @as(u32, @intCast(i))));
+        try testing.expect(!ring.push(99));
+        try testing.expectEqual(@as(u32, 4), ring.len());
+        for (0..4) |i| try testing.expectEqual(@as(?u32, base + @as(u32, @intCast(i))), ring.pop());
+        try testing.expectEqual(@as(?u32, null), ring.pop());
+    }
+}
+
+test "SpscRing delivers every item in order across threads" {
+    const Ring = SpscRing(u32, 64);
+    const count: u32 = 10_000;
+    var ring = Ring{};
+
+    const Producer = struct {
+        fn run(r: *Ring) void {
+            var next: u32 = 0;
+            while (next < count) {
+                if (r.push(next)) {
+                    next += 1;
+                } else {
+                    std.Thread.yield() catch {};
+                }
+            }
+        }
+    };
+    const thread = try std.Thread.spawn(.{}, Producer.run, .{&ring});
+
+    var expected: u32 = 0;
+    while (expected < count) {
+        if (ring.pop()) |value| {
+            try testing.expectEqual(expected, value);
+            expected += 1;
+        } else {
+            std.Thread.yield() catch {};
+        }
+    }
+    thread.join();
+    try testing.expectEqual(@as(u32, 0), ring.len());
+}
@@ -0,0 +1,154 @@
+//! UTF-8 decoding for TextDecoder
+//!
+//! mquickjs stores strings as UTF-8 (WTF-8 for lone surrogates), so
+//! decoding a byte buffer is validation plus a copy: well-formed input is
+//! copied as is, and each ill-formed subsequence becomes one U+FFFD, using
+//! the "maximal subpart" rule of the WHATWG Encoding standard. ASCII runs,
+//! which are nearly all of a glTF or JSON document, are scanned 16 bytes
+//! per step with @Vector and copied without per-byte checks.
+
+const std = @import("std");
+const testing = std.testing;
+
+/// Bytes per vector step of the ASCII scan.
+const Lanes = 16;
+const U8xN = @Vector(Lanes, u8);
+
+pub const Replacement = "\xEF\xBF\xBD";
+pub const Bom = "\xEF\xBB\xBF";
+
+/// Result of scanning a buffer without writing anything.
+pub const Measure = struct {
+    /// Decoded length in bytes, replacements included.
+    len: usize,
+    /// The input is entirely 7-bit ASCII.
+    ascii: bool,
+    /// The input is well-formed UTF-8; decoding is then a plain copy.
+    valid: bool,
+};
+
+/// Length of the leading ASCII run of `bytes`.
+pub fn asciiPrefix(bytes: []const u8) usize {
+    var i: usize = 0;
+    while (i + Lanes <= bytes.len) : (i += Lanes) {
+        const chunk: U8xN = bytes[i..][0..Lanes].*;
+        if (@reduce(.Or, chunk) & 0x80 != 0) break;
+    }
+    while (i < bytes.len and bytes[i] < 0x80) i += 1;
+    return i;
+}
+
+pub fn measure(src: []const u8) Measure {
+    var result: Measure = .{ .len = 0, .ascii = true, .valid = true };
+    var i: usize = 0;
+    while (true) {
+        const run = asciiPrefix(src[i..]);
+        i += run;
+        result.len += run;
+        if (i == src.len) break;
+        result.ascii = false;
+        const seq = sequenceAt(src[i..]);
+        if (seq.valid) {
+            result.len += seq.len;
+        } else {
+            result.valid = false;
+            result.len += Replacement.len;
+        }
+        i += seq.len;
+    }
+    return result;
+}
+
+/// Decode `src` into `dst`, which must be exactly measure(src).len bytes.
+pub fn decode(src: []const u8, dst: []u8) void {
+    var i: usize = 0;
+    var out: usize = 0;
+    while (true) {
+        const run = asciiPrefix(src[i..]);
+        @memcpy(dst[out..][0..run], src[i..][0..run]);
+        i += run;
+        out += run;
+        if (i == src.len) break;
+        const seq = sequenceAt(src[i..]);
+        const bytes = if (seq.valid) src[i..][0..seq.len] else Replacement;
+        @memcpy(dst[out..][0..bytes.len], bytes);
+        out += bytes.len;
+        i += seq.len;
+    }
+    std.debug.assert(out == dst.len);
+}
+
+const Sequence = struct {
+    /// Bytes consumed: the whole sequence, or its maximal invalid subpart.
+    len: usize,
+    valid: bool,
+};
+
+/// Sequence length and accepted range of the second byte for a lead byte.
+/// The narrowed ranges exclude overlong forms, surrogates and code points
+/// above U+10FFFF.
+const LeadRule = struct { len: usize, lo: u8, hi: u8 };
+
+fn sequenceAt(bytes: []const u8) Sequence {
+    const rule: LeadRule = switch (bytes[0]) {
+        0xC2...0xDF => .{ .len = 2, .lo = 0x80, .hi = 0xBF },
+        0xE0 => .{ .len = 3, .lo = 0xA0, .hi = 0xBF },
+        0xE1...0xEC, 0xEE...0xEF => .{ .len = 3, .lo = 0x80, .hi = 0xBF },
+        0xED => .{ .len = 3, .lo = 0x80, .hi = 0x9F },
+        0xF0 => .{ .len = 4, .lo = 0x90, .hi = 0xBF },
+        0xF1...0xF3 => .{ .len = 4, .lo = 0x80, .hi = 0xBF },
+        0xF4 => .{ .len = 4, .lo = 0x80, .hi = 0x8F },
+        else => return .{ .len = 1, .valid = false },
+    };
+    if (bytes.len < 2 or bytes[1] < rule.lo or bytes[1] > rule.hi) {
+        return .{ .len = 1, .valid = false };
+    }
+    var i: usize = 2;
+    while (i < rule.len) : (i += 1) {
+        if (i >= bytes.len or bytes[i] & 0xC0 != 0x80) return .{ .len = i, .valid = false };
+    }
+    return .{ .len = rule.len, .valid = true };
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn expectDecoded(src: []const u8, expected: []const u8) !void {
+    const m = measure(src);
+    try testing.expectEqual(expected.len, m.len);
+    try testing.expectEqual(std.mem.eql(u8, src, expected), m.valid);
+    const out = try testing.allocator.alloc(u8, m.len);
+    defer testing.allocator.free(out);
+    decode(src, out);
+    try testing.expectEqualSlices(u8, expected, out);
+}
+
+test "utf8 copies well-formed input and scans ASCII by vector" {
+    var ascii: [100]u8 = undefined;
+    for (&ascii, 0..) |*byte, i| byte.* = 'a' + @as(u8, @intCast(i % 26));
+    try testing.expectEqual(@as(usize, 100), asciiPrefix(&ascii));
+    try testing.expect(measure(&ascii).ascii);
+    ascii[37] = 0xC3;
+    try testing.expectEqual(@as(usize, 37), asciiPrefix(&ascii));
+
+    try expectDecoded("", "");
+    try expectDecoded("{\"asset\":{\"version\":\"2.0\"}}", "{\"asset\":{\"version\":\"2.0\"}}");
+    try expectDecoded("caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80", "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80");
+    try testing.expect(!measure("caf\xC3\xA9").ascii);
+}
+
+test "utf8 replaces each maximal invalid subpart with U+FFFD" {
+    const R = Replacement;
+    // Stray continuation byte and invalid lead bytes
+    try expectDecoded("a\x80b", "a" ++ R ++ "b");
+    try expectDecoded("\xC0\xAF\xFF", R ++ R ++ R);
+    // Truncated sequences: one replacement for the valid prefix
+    try expectDecoded("\xE2\x82", R);
+    try expectDecoded("\xF0\x9F\x98x", R ++ "x");
+    // Surrogates and code points above U+10FFFF are rejected at byte two
+    try expectDecoded("\xED\xA0\x80", R ++ R ++ R);
+    try expectDecoded("\xF4\x90\x80\x80", R ++ R ++ R ++ R);
+    // Overlong three-byte form
+    try expectDecoded("\xE0\x80\xAF", R ++ R ++ R);
+}
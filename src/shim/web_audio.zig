@@ -0,0 +1,1521 @@
+//! Web Audio graph
+//!
+//! AudioContext and its nodes (buffer sources, gains, panners, the listener
+//! and the destination) are a native graph mixed on the sokol_audio stream
+//! thread, so audio keeps playing however long a JS frame takes. JS never
+//! touches the mixer: node creation, connections, parameter automation and
+//! start/stop are fixed-size commands pushed into an SPSC ring, which the
+//! audio thread drains at the start of every render quantum (128 frames, as
+//! in Web Audio). The audio thread reports finished sources back through a
+//! second ring and publishes the context clock and current parameter values
+//! as atomics.
+//!
+//! Each quantum, every playing source walks its chain of nodes down to the
+//! destination once, folding gains and panning into one 2x2 channel matrix.
+//! The buffer is resampled with linear interpolation and accumulated into
+//! the stereo mix under a per-frame ramp from the previous quantum's matrix,
+//! 8 frames per @Vector step.
+//!
+//! Without an output device (setup failed, or disabled with
+//! configureOutput) the main thread renders the graph silently from pump(),
+//! so the clock and `ended` events behave the same headless.
+
+const std = @import("std");
+const testing = std.testing;
+const sokol = @import("sokol");
+const saudio = sokol.audio;
+const slog = sokol.log;
+const handle_table = @import("handle_table.zig");
+const SpscRing = @import("spsc_ring.zig").SpscRing;
+const audio_decode = @import("audio_decode.zig");
+
+const log = std.log.scoped(.web_audio);
+
+pub const MaxNodes: usize = 1024;
+pub const MaxBuffers: usize = 512;
+/// Frames rendered per step; parameters and start/stop commands apply at
+/// quantum boundaries, start and stop times are frame-accurate.
+pub const RenderQuantum: usize = 128;
+/// The listener has the most parameters: position, forward and up.
+pub const MaxNodeParams: usize = 9;
+pub const MaxChannels: usize = audio_decode.MaxChannels;
+
+/// Nodes a source's output may pass through before the destination.
+const MaxChainLength = 16;
+const CommandCapacity = 4096;
+const EventCapacity = 256;
+/// Headless rendering catches up at most this much per pump
+const MaxPumpSeconds: f64 = 0.25;
+
+/// open() creates these first, so the mixer finds them by slot.
+const DestinationSlot: u16 = 0;
+const ListenerSlot: u16 = 1;
+const NoNode: u16 = std.math.maxInt(u16);
+
+/// Frames per vector step.
+const Lanes = 8;
+const F32xN = @Vector(Lanes, f32);
+const Vec3 = @Vector(3, f32);
+
+pub const NodeId = packed struct(u32) {
+    index: u16,
+    generation: u16,
+};
+
+pub const BufferId = packed struct(u32) {
+    index: u16,
+    generation: u16,
+};
+
+pub const NodeKind = enum(u8) {
+    destination,
+    listener,
+    gain,
+    panner,
+    buffer_source,
+};
+
+/// AudioParams by name. Each node kind owns a subset; see paramSlot().
+pub const Param = enum(u8) {
+    gain,
+    playback_rate,
+    detune,
+    position_x,
+    position_y,
+    position_z,
+    orientation_x,
+    orientation_y,
+    orientation_z,
+    forward_x,
+    forward_y,
+    forward_z,
+    up_x,
+    up_y,
+    up_z,
+};
+
+pub const ParamOp = enum(u8) {
+    /// The `value` setter: takes effect at the next quantum
+    set_value,
+    set_value_at_time,
+    linear_ramp,
+    exponential_ramp,
+    set_target,
+    cancel,
+};
+
+/// Node attributes that are not AudioParams.
+pub const Config = enum(u8) {
+    loop,
+    loop_start,
+    loop_end,
+    distance_model,
+    ref_distance,
+    max_distance,
+    rolloff_factor,
+    cone_inner_angle,
+    cone_outer_angle,
+    cone_outer_gain,
+};
+
+pub const DistanceModel = enum(u8) { linear, inverse, exponential };
+
+pub const OutputConfig = struct {
+    /// Open the sokol_audio device; without it the graph renders silently
+    enabled: bool = true,
+    sample_rate: u32 = 44100,
+    /// Device buffer size, which bounds the output latency
+    buffer_frames: u32 = 1024,
+};
+
+pub const OpenInfo = struct {
+    sample_rate: f32,
+    destination: NodeId,
+    listener: NodeId,
+    /// Seconds of audio the device buffers ahead of playback
+    output_latency: f64,
+    /// Bumped each time the graph opens from closed; handles from an
+    /// earlier generation may name new nodes and must not be used
+    generation: u32,
+};
+
+pub const BufferInfo = struct {
+    channels: u8,
+    frames: u32,
+    sample_rate: f32,
+};
+
+/// Immutable samples shared with the audio thread, planar like
+/// audio_decode.DecodedAudio.
+pub const BufferData = struct {
+    samples: []f32,
+    frames: u32,
+    channels: u8,
+    sample_rate: f32,
+
+    fn channel(self: *const BufferData, index: usize) []const f32 {
+        return self.samples[index * self.frames ..][0..self.frames];
+    }
+};
+
+/// The parameter slot `param` has on a node of `kind`, if it has one.
+pub fn paramSlot(kind: NodeKind, param: Param) ?u8 {
+    const p = @intFromEnum(param);
+    return switch (kind) {
+        .gain => if (param == .gain) 0 else null,
+        .buffer_source => switch (param) {
+            .playback_rate => 0,
+            .detune => 1,
+            else => null,
+        },
+        .panner => switch (param) {
+            .position_x, .position_y, .position_z => p - @intFromEnum(Param.position_x),
+            .orientation_x, .orientation_y, .orientation_z => 3 + p - @intFromEnum(Param.orientation_x),
+            else => null,
+        },
+        .listener => switch (param) {
+            .position_x, .position_y, .position_z => p - @intFromEnum(Param.position_x),
+            .forward_x, .forward_y, .forward_z => 3 + p - @intFromEnum(Param.forward_x),
+            .up_x, .up_y, .up_z => 6 + p - @intFromEnum(Param.up_x),
+            else => null,
+        },
+        .destination => null,
+    };
+}
+
+fn paramDefaults(kind: NodeKind) []const f32 {
+    return switch (kind) {
+        .gain => &.{1.0},
+        .buffer_source => &.{ 1.0, 0.0 },
+        // Position, then orientation along +x
+        .panner => &.{ 0, 0, 0, 1, 0, 0 },
+        // Position, forward along -z, up along +y
+        .listener => &.{ 0, 0, 0, 0, 0, -1, 0, 1, 0 },
+        .destination => &.{},
+    };
+}
+
+// =============================================================================
+// Parameter automation (audio thread)
+// =============================================================================
+
+const Automation = enum(u8) { none, step, linear, exponential, target };
+
+/// One AudioParam. It follows at most one automation event; scheduling
+/// another replaces it, starting from the value the param has by then.
+/// That covers how Three.js drives params (a ramp or target per frame)
+/// without the full Web Audio event timeline.
+const ParamState = struct {
+    value: f32 = 0,
+    automation: Automation = .none,
+    from: f32 = 0,
+    to: f32 = 0,
+    start: f64 = 0,
+    end: f64 = 0,
+    time_constant: f64 = 0,
+    /// set_target: `from` was captured once `start` passed
+    armed: bool = false,
+
+    fn hold(self: *ParamState, value: f32) void {
+        self.* = .{ .value = value };
+    }
+
+    fn schedule(self: *ParamState, op: ParamOp, value: f32, time: f64, time_constant: f64, now: f64) void {
+        switch (op) {
+            .set_value => self.hold(value),
+            .set_value_at_time => {
+                if (time <= now) return self.hold(value);
+                self.* = .{ .value = self.value, .automation = .step, .to = value, .start = time };
+            },
+            .linear_ramp, .exponential_ramp => {
+                if (time <= now) return self.hold(value);
+                var automation: Automation = if (op == .linear_ramp) .linear else .exponential;
+                // An exponential ramp needs both ends non-zero with one sign;
+                // otherwise the value holds and jumps at the end
+                if (automation == .exponential and !(self.value * value > 0)) automation = .step;
+                self.* = .{
+                    .value = self.value,
+                    .automation = automation,
+                    .from = self.value,
+                    .to = value,
+                    .start = now,
+                    .end = time,
+                };
+            },
+            .set_target => {
+                if (time_constant <= 0) return self.schedule(.set_value_at_time, value, time, 0, now);
+                self.* = .{
+                    .value = self.value,
+                    .automation = .target,
+                    .to = value,
+                    .start = time,
+                    .time_constant = time_constant,
+                };
+            },
+            .cancel => self.automation = .none,
+        }
+        if (self.automation == .step) self.start = @max(self.start, self.end);
+    }
+
+    /// Value at context time `t`, which never goes backwards.
+    fn advance(self: *ParamState, t: f64) f32 {
+        switch (self.automation) {
+            .none => {},
+            .step => if (t >= self.start) self.hold(self.to),
+            .linear, .exponential => {
+                if (t >= self.end) {
+                    self.hold(self.to);
+                } else {
+                    const f: f32 = @floatCast((t - self.start) / (self.end - self.start));
+                    self.value = if (self.automation == .linear)
+                        self.from + (self.to - self.from) * f
+                    else
+                        self.from * std.math.pow(f32, self.to / self.from, f);
+                }
+            },
+            .target => if (t >= self.start) {
+                if (!self.armed) {
+                    self.from = self.value;
+                    self.armed = true;
+                }
+                const decay: f32 = @floatCast(@exp(-(t - self.start) / self.time_constant));
+                const v = self.to + (self.from - self.to) * decay;
+                // Close enough to stop following the curve
+                if (@abs(v - self.to) <= 1e-5 * @max(1.0, @abs(self.to))) self.hold(self.to) else self.value = v;
+            },
+        }
+        return self.value;
+    }
+};
+
+// =============================================================================
+// Mixer (audio thread)
+// =============================================================================
+
+/// out_l = l0 * in0 + l1 * in1, out_r = r0 * in0 + r1 * in1
+const Matrix = struct {
+    l0: f32 = 0,
+    l1: f32 = 0,
+    r0: f32 = 0,
+    r1: f32 = 0,
+
+    fn scale(m: Matrix, g: f32) Matrix {
+        return .{ .l0 = m.l0 * g, .l1 = m.l1 * g, .r0 = m.r0 * g, .r1 = m.r1 * g };
+    }
+
+    /// `p` applied after `m`
+    fn then(m: Matrix, p: Matrix) Matrix {
+        return .{
+            .l0 = p.l0 * m.l0 + p.l1 * m.r0,
+            .l1 = p.l0 * m.l1 + p.l1 * m.r1,
+            .r0 = p.r0 * m.l0 + p.r1 * m.r0,
+            .r1 = p.r0 * m.l1 + p.r1 * m.r1,
+        };
+    }
+};
+
+const PannerConfig = struct {
+    distance_model: DistanceModel = .inverse,
+    ref_distance: f32 = 1,
+    max_distance: f32 = 10000,
+    rolloff_factor: f32 = 1,
+    cone_inner_angle: f32 = 360,
+    cone_outer_angle: f32 = 360,
+    cone_outer_gain: f32 = 0,
+};
+
+const VoiceState = enum(u8) {
+    idle,
+    scheduled,
+    playing,
+    /// Finished; waiting for room in the event ring
+    ending,
+    done,
+};
+
+const Voice = struct {
+    state: VoiceState = .idle,
+    buffer: ?*const BufferData = null,
+    start_frame: u64 = 0,
+    stop_frame: u64 = std.math.maxInt(u64),
+    /// Read position, in buffer frames
+    position: f64 = 0,
+    /// Buffer frames left to play for a start() duration
+    remaining: f64 = std.math.inf(f64),
+    loop: bool = false,
+    /// Seconds, as set from JS; converted to frames while playing
+    loop_start: f64 = 0,
+    loop_end: f64 = 0,
+    /// Channel matrix at the end of the last quantum it was mixed in
+    matrix: Matrix = .{},
+    ramped: bool = false,
+};
+
+const Node = struct {
+    kind: NodeKind = .gain,
+    /// Slot of the node this one feeds
+    output: u16 = NoNode,
+    params: [MaxNodeParams]ParamState = [_]ParamState{.{}} ** MaxNodeParams,
+    panner: PannerConfig = .{},
+    voice: Voice = .{},
+};
+
+const Op = enum(u8) { create, connect, disconnect, param, config, start, stop, sample_rate };
+
+const Command = struct {
+    op: Op,
+    node: u16,
+    /// create: NodeKind; connect: target slot; param: param slot; config: Config
+    arg: u16 = 0,
+    /// param: ParamOp
+    sub: u8 = 0,
+    /// param: (value, time, time constant); config: (value);
+    /// start: (when, offset, duration); stop: (when); sample_rate: (rate)
+    values: [3]f64 = .{ 0, 0, 0 },
+    buffer: ?*const BufferData = null,
+};
+
+/// A source finished; `node` is its slot.
+const Event = struct { node: u16 };
+
+const CommandRing = SpscRing(Command, CommandCapacity);
+const EventRing = SpscRing(Event, EventCapacity);
+
+pub const Mixer = struct {
+    /// Audio thread state
+    sample_rate: f32 = 44100,
+    frame: u64 = 0,
+    nodes: [MaxNodes]Node = undefined,
+    /// Slots below this have been created at least once
+    node_limit: u16 = 0,
+    mix: [2][RenderQuantum]f32 = undefined,
+    out_pos: usize = RenderQuantum,
+    // Resampling scratch for one voice
+    samples: [2][RenderQuantum]f32 = undefined,
+    index: [RenderQuantum]u32 = undefined,
+    next: [RenderQuantum]u32 = undefined,
+    frac: [RenderQuantum]f32 = undefined,
+
+    /// JS thread to audio thread
+    commands: CommandRing = .{},
+    /// Audio thread to JS thread
+    events: EventRing = .{},
+    suspended: std.atomic.Value(bool) = .init(false),
+    frames_rendered: std.atomic.Value(u64) = .init(0),
+    /// f32 bits of each node's params after the last quantum
+    published: [MaxNodes][MaxNodeParams]std.atomic.Value(u32) = undefined,
+
+    const Self = @This();
+
+    fn reset(self: *Self, sample_rate: f32) void {
+        self.sample_rate = sample_rate;
+        self.frame = 0;
+        self.node_limit = 0;
+        self.out_pos = RenderQuantum;
+        self.commands = .{};
+        self.events = .{};
+        self.suspended = .init(false);
+        self.frames_rendered = .init(0);
+    }
+
+    /// Device callback body: hand out quanta, rendering each as needed.
+    fn fill(self: *Self, out: []f32, channels: usize) void {
+        if (self.suspended.load(.acquire)) {
+            self.applyCommands();
+            @memset(out, 0);
+            return;
+        }
+        const frames = out.len / channels;
+        var done: usize = 0;
+        while (done < frames) {
+            if (self.out_pos == RenderQuantum) {
+                self.renderQuantum();
+                self.out_pos = 0;
+            }
+            const n = @min(frames - done, RenderQuantum - self.out_pos);
+            writeInterleaved(
+                out[done * channels ..][0 .. n * channels],
+                self.mix[0][self.out_pos..][0..n],
+                self.mix[1][self.out_pos..][0..n],
+                channels,
+            );
+            self.out_pos += n;
+            done += n;
+        }
+    }
+
+    fn renderQuantum(self: *Self) void {
+        self.applyCommands();
+        @memset(&self.mix[0], 0);
+        @memset(&self.mix[1], 0);
+        // Parameters first: panners read the listener's
+        const t_end = @as(f64, @floatFromInt(self.frame + RenderQuantum)) / self.sample_rate;
+        for (self.nodes[0..self.node_limit], 0..) |*node, slot| {
+            for (node.params[0..paramDefaults(node.kind).len], 0..) |*param, i| {
+                const value = param.advance(t_end);
+                self.published[slot][i].store(@bitCast(value), .monotonic);
+            }
+        }
+        for (self.nodes[0..self.node_limit], 0..) |*node, slot| {
+            if (node.kind == .buffer_source) self.renderVoice(node, @intCast(slot));
+        }
+        self.frame += RenderQuantum;
+        self.frames_rendered.store(self.frame, .release);
+    }
+
+    fn applyCommands(self: *Self) void {
+        const now = @as(f64, @floatFromInt(self.frame)) / self.sample_rate;
+        while (self.commands.pop()) |cmd| {
+            const node = &self.nodes[cmd.node];
+            switch (cmd.op) {
+                .create => {
+                    const kind: NodeKind = @enumFromInt(cmd.arg);
+                    node.* = .{ .kind = kind };
+                    for (paramDefaults(kind), 0..) |value, i| node.params[i].value = value;
+                    self.node_limit = @max(self.node_limit, cmd.node + 1);
+                },
+                .connect => node.output = cmd.arg,
+                .disconnect => node.output = NoNode,
+                .param => node.params[cmd.arg].schedule(
+                    @enumFromInt(cmd.sub),
+                    @floatCast(cmd.values[0]),
+                    cmd.values[1],
+                    cmd.values[2],
+                    now,
+                ),
+                .config => applyConfig(node, @enumFromInt(cmd.arg), cmd.values[0]),
+                .start => self.startVoice(&node.voice, cmd),
+                .stop => node.voice.stop_frame = self.timeToFrame(cmd.values[0]),
+                .sample_rate => self.sample_rate = @floatCast(cmd.values[0]),
+            }
+        }
+    }
+
+    fn timeToFrame(self: *const Self, t: f64) u64 {
+        const frame = @round(t * self.sample_rate);
+        if (!(frame > @as(f64, @floatFromInt(self.frame)))) return self.frame;
+        return @intFromFloat(@min(frame, 1e18));
+    }
+
+    fn startVoice(self: *Self, voice: *Voice, cmd: Command) void {
+        voice.state = .scheduled;
+        voice.buffer = cmd.buffer;
+        voice.start_frame = self.timeToFrame(cmd.values[0]);
+        const rate: f64 = if (cmd.buffer) |buffer| buffer.sample_rate else self.sample_rate;
+        const frames: f64 = if (cmd.buffer) |buffer| @floatFromInt(buffer.frames) else 0;
+        voice.position = std.math.clamp(cmd.values[1] * rate, 0, frames);
+        voice.remaining = if (cmd.values[2] >= 0) cmd.values[2] * rate else std.math.inf(f64);
+    }
+
+    fn renderVoice(self: *Self, node: *Node, slot: u16) void {
+        const voice = &node.voice;
+        switch (voice.state) {
+            .scheduled, .playing => {},
+            .ending => return self.reportEnded(voice, slot),
+            .idle, .done => return,
+        }
+        const q0 = self.frame;
+        const q_end = q0 + RenderQuantum;
+        if (voice.start_frame >= q_end) return;
+        voice.state = .playing;
+
+        const first: usize = if (voice.start_frame > q0) @intCast(voice.start_frame - q0) else 0;
+        var last: usize = RenderQuantum;
+        var ending = false;
+        if (voice.stop_frame < q_end) {
+            last = if (voice.stop_frame > q0) @intCast(voice.stop_frame - q0) else 0;
+            ending = true;
+        }
+        // A source without a buffer plays silence until it is stopped
+        if (first < last and voice.buffer != null) {
+            const buffer = voice.buffer.?;
+            const end = self.readVoice(node, buffer, first, last);
+            if (end < last) ending = true;
+            if (self.chainMatrix(node, buffer.channels)) |target| {
+                const from = if (voice.ramped) voice.matrix else target;
+                if (buffer.channels == 1) {
+                    accumulate(false, &self.mix, &self.samples, from, target, first, end);
+                } else {
+                    accumulate(true, &self.mix, &self.samples, from, target, first, end);
+                }
+                voice.matrix = target;
+            } else {
+                // Not connected: keeps time, and fades in if connected later
+                voice.matrix = .{};
+            }
+            voice.ramped = true;
+        }
+        if (ending) {
+            voice.state = .ending;
+            self.reportEnded(voice, slot);
+        }
+    }
+
+    fn reportEnded(self: *Self, voice: *Voice, slot: u16) void {
+        if (self.events.push(.{ .node = slot })) voice.state = .done;
+    }
+
+    /// Resample frames [first, last) of a voice into `samples`, advancing
+    /// it. Returns where the buffer ran out, or `last`.
+    fn readVoice(self: *Self, node: *Node, buffer: *const BufferData, first: usize, last: usize) usize {
+        const voice = &node.voice;
+        const frames: f64 = @floatFromInt(buffer.frames);
+        var loop_start: f64 = 0;
+        var loop_end: f64 = frames;
+        if (voice.loop and voice.loop_end > voice.loop_start and voice.loop_start >= 0) {
+            loop_start = @min(@round(voice.loop_start * buffer.sample_rate), frames);
+            loop_end = @min(@round(voice.loop_end * buffer.sample_rate), frames);
+            if (loop_end <= loop_start) {
+                loop_start = 0;
+                loop_end = frames;
+            }
+        }
+        const limit: f64 = if (voice.loop) loop_end else frames;
+        const wrap_index: u32 = @intFromFloat(loop_start);
+        const channels: usize = @min(buffer.channels, 2);
+        if (buffer.frames == 0 or (voice.loop and loop_end <= loop_start)) return first;
+
+        // k-rate, as Web Audio specifies for buffer sources
+        const rate = node.params[0].value * @exp2(node.params[1].value / 1200.0);
+        const step: f64 = @max(rate, 0) * buffer.sample_rate / self.sample_rate;
+
+        var i = first;
+        if (step == 1.0 and voice.position == @floor(voice.position)) {
+            // Unit rate: copy whole runs
+            while (i < last and voice.remaining > 0) {
+                if (voice.position >= limit) {
+                    if (!voice.loop) break;
+                    voice.position = loop_start;
+                }
+                const pos: usize = @intFromFloat(voice.position);
+                const run_limit = @min(@as(f64, @floatFromInt(last - i)), @ceil(voice.remaining));
+                const run = @min(@as(usize, @intFromFloat(run_limit)), @as(usize, @intFromFloat(limit)) - pos);
+                for (0..channels) |ch| @memcpy(self.samples[ch][i..][0..run], buffer.channel(ch)[pos..][0..run]);
+                voice.position += @floatFromInt(run);
+                voice.remaining -= @floatFromInt(run);
+                i += run;
+            }
+            return i;
+        }
+
+        // Frame positions are stepped in f64, then every channel is
+        // interpolated from them a vector at a time
+        const last_index: u32 = buffer.frames - 1;
+        while (i < last and voice.remaining > 0) : (i += 1) {
+            if (voice.position >= limit) {
+                if (!voice.loop) break;
+                voice.position = loop_start + @mod(voice.position - loop_start, loop_end - loop_start);
+            }
+            const whole = @floor(voice.position);
+            const index: u32 = @intFromFloat(whole);
+            self.index[i] = index;
+            self.next[i] = if (whole + 1 < limit) index + 1 else if (voice.loop) wrap_index else @min(index, last_index);
+            self.frac[i] = @floatCast(voice.position - whole);
+            voice.position += step;
+            voice.remaining -= step;
+        }
+        for (0..channels) |ch| {
+            interpolate(buffer.channel(ch), self.index[first..i], self.next[first..i], self.frac[first..i], self.samples[ch][first..i]);
+        }
+        return i;
+    }
+
+    /// Gains and panning between a source and the destination, or null when
+    /// its output does not reach the destination.
+    fn chainMatrix(self: *const Self, source: *const Node, channels: u8) ?Matrix {
+        // Mono signals stay mono (a single gain) until a panner spreads
+        // them, as channelCountMode "clamped-max" has it
+        var mono = channels == 1;
+        var gain: f32 = 1;
+        var m: Matrix = .{ .l0 = 1, .r1 = 1 };
+        var slot = source.output;
+        var hops: usize = 0;
+        while (slot != NoNode and hops < MaxChainLength) : (hops += 1) {
+            const node = &self.nodes[slot];
+            switch (node.kind) {
+                // Mono up-mixes to both speakers
+                .destination => return if (mono) .{ .l0 = gain, .r0 = gain } else m,
+                .gain => {
+                    const g = node.params[0].value;
+                    if (mono) gain *= g else m = m.scale(g);
+                },
+                .panner => {
+                    m = if (mono) self.pannerMatrix(node, true).scale(gain) else m.then(self.pannerMatrix(node, false));
+                    mono = false;
+                },
+                .listener, .buffer_source => return null,
+            }
+            slot = node.output;
+        }
+        return null;
+    }
+
+    /// Equal-power panning with distance and cone attenuation, as the Web
+    /// Audio PannerNode computes them. HRTF is not implemented; it pans
+    /// with equal power too.
+    fn pannerMatrix(self: *const Self, node: *const Node, mono: bool) Matrix {
+        const p = &node.params;
+        const l = &self.nodes[ListenerSlot].params;
+        const source: Vec3 = .{ p[0].value, p[1].value, p[2].value };
+        const orientation: Vec3 = .{ p[3].value, p[4].value, p[5].value };
+        const listener: Vec3 = .{ l[0].value, l[1].value, l[2].value };
+        const forward: Vec3 = .{ l[3].value, l[4].value, l[5].value };
+        const up: Vec3 = .{ l[6].value, l[7].value, l[8].value };
+
+        const cfg = &node.panner;
+        const attenuation = distanceGain(cfg, length(source - listener)) * coneGain(cfg, source, orientation, listener);
+        const azimuth = azimuthDegrees(source, listener, forward, up);
+        if (mono) {
+            const x = (azimuth + 90) / 180;
+            const pan: Matrix = .{ .l0 = @cos(x * std.math.pi / 2.0), .r0 = @sin(x * std.math.pi / 2.0) };
+            return pan.scale(attenuation);
+        }
+        // Stereo input: the far channel folds into the near one
+        const m: Matrix = if (azimuth <= 0) blk: {
+            const x = (azimuth + 90) / 90;
+            break :blk .{ .l0 = 1, .l1 = @cos(x * std.math.pi / 2.0), .r1 = @sin(x * std.math.pi / 2.0) };
+        } else blk: {
+            const x = azimuth / 90;
+            break :blk .{ .l0 = @cos(x * std.math.pi / 2.0), .r0 = @sin(x * std.math.pi / 2.0), .r1 = 1 };
+        };
+        return m.scale(attenuation);
+    }
+};
+
+fn applyConfig(node: *Node, field: Config, value: f64) void {
+    const v: f32 = @floatCast(value);
+    switch (field) {
+        .loop => node.voice.loop = value != 0,
+        .loop_start => node.voice.loop_start = value,
+        .loop_end => node.voice.loop_end = value,
+        .distance_model => node.panner.distance_model = std.meta.intToEnum(DistanceModel, @as(u8, @intFromFloat(std.math.clamp(value, 0, 2)))) catch .inverse,
+        .ref_distance => node.panner.ref_distance = @max(v, 0),
+        .max_distance => node.panner.max_distance = @max(v, 0),
+        .rolloff_factor => node.panner.rolloff_factor = @max(v, 0),
+        .cone_inner_angle => node.panner.cone_inner_angle = v,
+        .cone_outer_angle => node.panner.cone_outer_angle = v,
+        .cone_outer_gain => node.panner.cone_outer_gain = std.math.clamp(v, 0, 1),
+    }
+}
+
+/// Linear interpolation between each frame and the next, gathered a lane
+/// at a time and blended as vectors.
+fn interpolate(samples: []const f32, index: []const u32, next: []const u32, frac: []const f32, out: []f32) void {
+    var i: usize = 0;
+    while (i + Lanes <= out.len) : (i += Lanes) {
+        var a: [Lanes]f32 = undefined;
+        var b: [Lanes]f32 = undefined;
+        inline for (0..Lanes) |lane| {
+            a[lane] = samples[index[i + lane]];
+            b[lane] = samples[next[i + lane]];
+        }
+        const va: F32xN = a;
+        const vb: F32xN = b;
+        const f: F32xN = frac[i..][0..Lanes].*;
+        out[i..][0..Lanes].* = va + (vb - va) * f;
+    }
+    while (i < out.len) : (i += 1) {
+        const a = samples[index[i]];
+        out[i] = a + (samples[next[i]] - a) * frac[i];
+    }
+}
+
+const lane_offsets: F32xN = blk: {
+    var offsets: [Lanes]f32 = undefined;
+    for (&offsets, 0..) |*offset, i| offset.* = @floatFromInt(i);
+    break :blk offsets;
+};
+
+/// Add frames [first, last) of a voice into the mix, with its matrix
+/// ramped from `from` (start of the quantum) to `to` (end of it).
+fn accumulate(
+    comptime stereo: bool,
+    mix: *[2][RenderQuantum]f32,
+    samples: *const [2][RenderQuantum]f32,
+    from: Matrix,
+    to: Matrix,
+    first: usize,
+    last: usize,
+) void {
+    const inv_quantum: f32 = 1.0 / @as(f32, RenderQuantum);
+    var i = first;
+    while (i + Lanes <= last) : (i += Lanes) {
+        const t = (lane_offsets + @as(F32xN, @splat(@floatFromInt(i + 1)))) * @as(F32xN, @splat(inv_quantum));
+        const x0: F32xN = samples[0][i..][0..Lanes].*;
+        var out_l: F32xN = mix[0][i..][0..Lanes].*;
+        var out_r: F32xN = mix[1][i..][0..Lanes].*;
+        out_l += rampLane(from.l0, to.l0, t) * x0;
+        out_r += rampLane(from.r0, to.r0, t) * x0;
+        if (stereo) {
+            const x1: F32xN = samples[1][i..][0..Lanes].*;
+            out_l += rampLane(from.l1, to.l1, t) * x1;
+            out_r += rampLane(from.r1, to.r1, t) * x1;
+        }
+        mix[0][i..][0..Lanes].* = out_l;
+        mix[1][i..][0..Lanes].* = out_r;
+    }
+    while (i < last) : (i += 1) {
+        const t = @as(f32, @floatFromInt(i + 1)) * inv_quantum;
+        const x0 = samples[0][i];
+        mix[0][i] += (from.l0 + (to.l0 - from.l0) * t) * x0;
+        mix[1][i] += (from.r0 + (to.r0 - from.r0) * t) * x0;
+        if (stereo) {
+            const x1 = samples[1][i];
+            mix[0][i] += (from.l1 + (to.l1 - from.l1) * t) * x1;
+            mix[1][i] += (from.r1 + (to.r1 - from.r1) * t) * x1;
+        }
+    }
+}
+
+fn rampLane(from: f32, to: f32, t: F32xN) F32xN {
+    return @as(F32xN, @splat(from)) + @as(F32xN, @splat(to - from)) * t;
+}
+
+/// Interleave the stereo mix into the device's channel layout, clipped to
+/// [-1, 1]. Mono devices get the average; extra channels stay silent.
+fn writeInterleaved(out: []f32, left: []const f32, right: []const f32, channels: usize) void {
+    for (left, right, 0..) |l, r, frame| {
+        const base = frame * channels;
+        switch (channels) {
+            1 => out[base] = std.math.clamp((l + r) * 0.5, -1.0, 1.0),
+            else => {
+                out[base] = std.math.clamp(l, -1.0, 1.0);
+                out[base + 1] = std.math.clamp(r, -1.0, 1.0);
+                @memset(out[base + 2 .. base + channels], 0);
+            },
+        }
+    }
+}
+
+fn dot(a: Vec3, b: Vec3) f32 {
+    return @reduce(.Add, a * b);
+}
+
+fn length(v: Vec3) f32 {
+    return @sqrt(dot(v, v));
+}
+
+fn cross(a: Vec3, b: Vec3) Vec3 {
+    return .{ a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+}
+
+/// Unit vector along `v`, or null for a zero vector.
+fn normalize(v: Vec3) ?Vec3 {
+    const len = length(v);
+    if (!(len > 0)) return null;
+    return v / @as(Vec3, @splat(len));
+}
+
+fn degrees(cos_angle: f32) f32 {
+    return std.math.radiansToDegrees(std.math.acos(std.math.clamp(cos_angle, -1.0, 1.0)));
+}
+
+/// Source azimuth in the listener's frame, folded into [-90, 90] as the
+/// equal-power panner uses it (behind mirrors to in front).
+fn azimuthDegrees(source: Vec3, listener: Vec3, forward: Vec3, up: Vec3) f32 {
+    const dir = normalize(source - listener) orelse return 0;
+    const front = normalize(forward) orelse return 0;
+    const right = normalize(cross(forward, up)) orelse return 0;
+    const listener_up = cross(right, front);
+    const projected = normalize(dir - listener_up * @as(Vec3, @splat(dot(dir, listener_up)))) orelse return 0;
+
+    var azimuth = degrees(dot(projected, right));
+    if (dot(projected, front) < 0) azimuth = 360 - azimuth;
+    azimuth = if (azimuth <= 270) 90 - azimuth else 450 - azimuth;
+    if (azimuth > 90) return 180 - azimuth;
+    if (azimuth < -90) return -180 - azimuth;
+    return azimuth;
+}
+
+fn distanceGain(cfg: *const PannerConfig, distance: f32) f32 {
+    const ref = cfg.ref_distance;
+    switch (cfg.distance_model) {
+        .linear => {
+            const d_ref = @min(ref, cfg.max_distance);
+            const d_max = @max(ref, cfg.max_distance);
+            const rolloff = @min(cfg.rolloff_factor, 1);
+            if (d_max == d_ref) return 1 - rolloff;
+            const d = std.math.clamp(distance, d_ref, d_max);
+            return 1 - rolloff * (d - d_ref) / (d_max - d_ref);
+        },
+        .inverse => {
+            if (ref == 0) return 0;
+            const d = @max(distance, ref);
+            return ref / (ref + cfg.rolloff_factor * (d - ref));
+        },
+        .exponential => {
+            if (ref == 0) return 0;
+            return std.math.pow(f32, @max(distance, ref) / ref, -cfg.rolloff_factor);
+        },
+    }
+}
+
+fn coneGain(cfg: *const PannerConfig, source: Vec3, orientation: Vec3, listener: Vec3) f32 {
+    if (cfg.cone_inner_angle >= 360 and cfg.cone_outer_angle >= 360) return 1;
+    const facing = normalize(orientation) orelse return 1;
+    const to_listener = normalize(listener - source) orelse return 1;
+    const angle = degrees(dot(to_listener, facing));
+    const inner = @abs(cfg.cone_inner_angle) / 2;
+    const outer = @abs(cfg.cone_outer_angle) / 2;
+    if (angle <= inner) return 1;
+    if (angle >= outer) return cfg.cone_outer_gain;
+    const x = (angle - inner) / (outer - inner);
+    return (1 - x) + cfg.cone_outer_gain * x;
+}
+
+fn streamCallback(buffer: [*c]f32, num_frames: i32, num_channels: i32, user_data: ?*anyopaque) callconv(.c) void {
+    const mixer: *Mixer = @ptrCast(@alignCast(user_data.?));
+    const channels: usize = @intCast(num_channels);
+    const out = buffer[0 .. @as(usize, @intCast(num_frames)) * channels];
+    mixer.fill(out, channels);
+}
+
+// =============================================================================
+// Graph (JS thread)
+// =============================================================================
+
+const NodeInfo = struct {
+    kind: NodeKind,
+    /// Buffer a started source holds a use of
+    buffer: ?BufferId = null,
+    started: bool = false,
+    /// Node this one feeds, as last connected
+    output: ?NodeId = null,
+    /// Nodes feeding this one
+    inputs: u16 = 0,
+    /// JS holds no reference; freed once nothing feeds it
+    dropped: bool = false,
+};
+
+const BufferEntry = struct {
+    data: BufferData,
+    allocator: std.mem.Allocator,
+    /// Started sources that may still read the samples
+    uses: u32 = 0,
+    /// Replaced by a copy or dropped by JS; freed once the last use ends
+    orphaned: bool = false,
+};
+
+const NodeTable = handle_table.HandleTable(NodeId, NodeInfo, MaxNodes);
+const BufferTable = handle_table.HandleTable(BufferId, BufferEntry, MaxBuffers);
+
+pub const Error = error{ NotOpen, InvalidNode, InvalidBuffer, InvalidState, InvalidArgument, AtCapacity, OutOfMemory };
+
+pub const Graph = struct {
+    mixer: *Mixer,
+    allocator: std.mem.Allocator = std.heap.page_allocator,
+    /// AudioContexts sharing the graph; sokol_audio has one device
+    open_count: u32 = 0,
+    generation: u32 = 0,
+    /// The device thread renders; otherwise pump() does, silently
+    device: bool = false,
+    /// The mixer's rate, read without touching the audio thread's copy
+    sample_rate: f32 = 44100,
+    output_latency: f64 = 0,
+    nodes: NodeTable = .{},
+    buffers: BufferTable = .{},
+    /// Commands that found the ring full, in order
+    overflow: std.ArrayListUnmanaged(Command) = .empty,
+    destination: NodeId = undefined,
+    listener: NodeId = undefined,
+    last_pump_ns: i128 = 0,
+    pending_frames: f64 = 0,
+
+    const Self = @This();
+
+    /// Open the graph, or join it if another context has it open.
+    /// createBuffer() allocates from `allocator`.
+    pub fn open(self: *Self, allocator: std.mem.Allocator, output: OutputConfig) Error!OpenInfo {
+        if (self.open_count > 0) {
+            self.open_count += 1;
+            return self.openInfo();
+        }
+        self.allocator = allocator;
+        self.sample_rate = @floatFromInt(output.sample_rate);
+        self.mixer.reset(self.sample_rate);
+        self.destination = try self.addNode(.destination);
+        self.listener = try self.addNode(.listener);
+        std.debug.assert(self.destination.index == DestinationSlot and self.listener.index == ListenerSlot);
+        // Headless rendering runs the create commands too
+        self.mixer.applyCommands();
+
+        self.device = false;
+        self.output_latency = 0;
+        if (output.enabled) {
+            saudio.setup(.{
+                .sample_rate = @intCast(output.sample_rate),
+                .num_channels = 2,
+                .buffer_frames = @intCast(output.buffer_frames),
+                .stream_userdata_cb = streamCallback,
+                .user_data = self.mixer,
+                .logger = .{ .func = slog.func },
+            });
+            if (saudio.isvalid()) {
+                self.device = true;
+                // The device may not run at the rate asked for
+                const rate: f32 = @floatFromInt(saudio.sampleRate());
+                if (rate != self.sample_rate) {
+                    self.sample_rate = rate;
+                    self.send(.{ .op = .sample_rate, .node = 0, .values = .{ rate, 0, 0 } });
+                }
+                self.output_latency = @as(f64, @floatFromInt(saudio.bufferFrames())) / self.sample_rate;
+            } else {
+                saudio.shutdown();
+                log.warn("no audio output device; mixing silently", .{});
+            }
+        }
+        self.last_pump_ns = std.time.nanoTimestamp();
+        self.pending_frames = 0;
+        self.open_count = 1;
+        self.generation +%= 1;
+        return self.openInfo();
+    }
+
+    /// Leave the graph. The last close stops the device and frees every
+    /// node and buffer.
+    pub fn close(self: *Self) void {
+        if (self.open_count == 0) return;
+        self.open_count -= 1;
+        if (self.open_count > 0) return;
+        if (self.device) saudio.shutdown();
+        self.device = false;
+        var it = self.buffers.iterator();
+        while (it.next()) |entry| entry.allocator.free(entry.data.samples);
+        self.buffers.deinit();
+        self.nodes.deinit();
+        self.overflow.deinit(std.heap.page_allocator);
+        self.overflow = .empty;
+    }
+
+    /// Close for every context at once, at runtime teardown.
+    pub fn shutdown(self: *Self) void {
+        if (self.open_count == 0) return;
+        self.open_count = 1;
+        self.close();
+    }
+
+    pub fn isOpen(self: *const Self) bool {
+        return self.open_count > 0;
+    }
+
+    fn openInfo(self: *const Self) OpenInfo {
+        return .{
+            .sample_rate = self.sample_rate,
+            .destination = self.destination,
+            .listener = self.listener,
+            .output_latency = self.output_latency,
+            .generation = self.generation,
+        };
+    }
+
+    /// Context time in seconds: frames rendered so far.
+    pub fn currentTime(self: *const Self) f64 {
+        if (!self.isOpen()) return 0;
+        return @as(f64, @floatFromInt(self.mixer.frames_rendered.load(.acquire))) / self.sample_rate;
+    }
+
+    /// A suspended context renders nothing and its clock stops.
+    pub fn setSuspended(self: *Self, suspended: bool) void {
+        self.mixer.suspended.store(suspended, .release);
+        self.last_pump_ns = std.time.nanoTimestamp();
+    }
+
+    pub fn createNode(self: *Self, kind: NodeKind) Error!NodeId {
+        if (!self.isOpen()) return error.NotOpen;
+        return switch (kind) {
+            .gain, .panner, .buffer_source => self.addNode(kind),
+            .destination, .listener => error.InvalidArgument,
+        };
+    }
+
+    fn addNode(self: *Self, kind: NodeKind) Error!NodeId {
+        const id = try self.nodes.alloc();
+        self.nodes.at(id.index).* = .{ .kind = kind };
+        // Readable before the audio thread has seen the node
+        for (paramDefaults(kind), 0..) |value, i| self.mixer.published[id.index][i].store(@bitCast(value), .monotonic);
+        self.send(.{ .op = .create, .node = id.index, .arg = @intFromEnum(kind) });
+        return id;
+    }
+
+    /// Route `node`'s output to `target`. A node feeds one other node;
+    /// connecting again moves its output.
+    pub fn connect(self: *Self, node: NodeId, target: NodeId) Error!void {
+        const from = self.nodes.getConst(node) orelse return error.InvalidNode;
+        const to = self.nodes.getConst(target) orelse return error.InvalidNode;
+        switch (from.kind) {
+            .gain, .panner, .buffer_source => {},
+            .destination, .listener => return error.InvalidArgument,
+        }
+        switch (to.kind) {
+            .gain, .panner, .destination => {},
+            .listener, .buffer_source => return error.InvalidArgument,
+        }
+        self.send(.{ .op = .connect, .node = node.index, .arg = target.index });
+        self.nodes.at(target.index).inputs += 1;
+        self.setOutput(node, target);
+    }
+
+    pub fn disconnect(self: *Self, node: NodeId) Error!void {
+        if (!self.nodes.isValid(node)) return error.InvalidNode;
+        self.send(.{ .op = .disconnect, .node = node.index });
+        self.setOutput(node, null);
+    }
+
+    /// JS dropped its last reference to a node it created. The node is
+    /// freed once nothing feeds it, and a started source once it ends;
+    /// freeing it may free a dropped node it fed. Handles from an earlier
+    /// `generation` are ignored.
+    pub fn dropNode(self: *Self, generation: u32, id: NodeId) void {
+        if (!self.isOpen() or generation != self.generation) return;
+        const info = self.nodes.get(id) orelse return;
+        switch (info.kind) {
+            .gain, .panner, .buffer_source => {},
+            .destination, .listener => return,
+        }
+        info.dropped = true;
+        if (info.inputs == 0 and !info.started) self.freeNode(id);
+    }
+
+    /// Record where `node` feeds, releasing its previous target. Callers
+    /// count the new target's input first, so reconnecting to the same
+    /// node never frees it.
+    fn setOutput(self: *Self, node: NodeId, target: ?NodeId) void {
+        const info = self.nodes.get(node).?;
+        const previous = info.output;
+        info.output = target;
+        if (previous) |old| self.releaseInput(old);
+    }
+
+    fn releaseInput(self: *Self, id: NodeId) void {
+        const info = self.nodes.get(id) orelse return;
+        info.inputs -= 1;
+        if (info.inputs == 0 and info.dropped and !info.started) self.freeNode(id);
+    }
+
+    /// Release a node's buffer and its slot. The audio thread never sees a
+    /// freed node again: nothing feeds it, and a freed source has ended or
+    /// never started.
+    fn freeNode(self: *Self, id: NodeId) void {
+        const info = self.nodes.get(id) orelse return;
+        const output = info.output;
+        if (info.buffer) |buffer| self.releaseBuffer(buffer);
+        _ = self.nodes.free(id);
+        if (output) |target| self.releaseInput(target);
+    }
+
+    /// Schedule `op` on a param. `time` and `time_constant` are in context
+    /// seconds, as the AudioParam methods take them.
+    pub fn setParam(self: *Self, node: NodeId, param: Param, op: ParamOp, value: f32, time: f64, time_constant: f64) Error!void {
+        const info = self.nodes.getConst(node) orelse return error.InvalidNode;
+        const slot = paramSlot(info.kind, param) orelse return error.InvalidArgument;
+        if (op == .set_value) self.mixer.published[node.index][slot].store(@bitCast(value), .monotonic);
+        self.send(.{
+            .op = .param,
+            .node = node.index,
+            .arg = slot,
+            .sub = @intFromEnum(op),
+            .values = .{ value, time, time_constant },
+        });
+    }
+
+    /// The param's value after the last rendered quantum.
+    pub fn paramValue(self: *const Self, node: NodeId, param: Param) Error!f32 {
+        const info = self.nodes.getConst(node) orelse return error.InvalidNode;
+        const slot = paramSlot(info.kind, param) orelse return error.InvalidArgument;
+        return @bitCast(self.mixer.published[node.index][slot].load(.monotonic));
+    }
+
+    pub fn setConfig(self: *Self, node: NodeId, field: Config, value: f64) Error!void {
+        const info = self.nodes.getConst(node) orelse return error.InvalidNode;
+        const valid = switch (field) {
+            .loop, .loop_start, .loop_end => info.kind == .buffer_source,
+            else => info.kind == .panner,
+        };
+        if (!valid) return error.InvalidArgument;
+        self.send(.{ .op = .config, .node = node.index, .arg = @intFromEnum(field), .values = .{ value, 0, 0 } });
+    }
+
+    /// Start a source at context time `when`, `offset` seconds into the
+    /// buffer, for `duration` buffer seconds (negative: to the end). A
+    /// source starts once; it holds its buffer until it ends.
+    pub fn start(self: *Self, node: NodeId, buffer: ?BufferId, when: f64, offset: f64, duration: f64) Error!void {
+        const info = self.nodes.get(node) orelse return error.InvalidNode;
+        if (info.kind != .buffer_source) return error.InvalidArgument;
+        if (info.started) return error.InvalidState;
+        var data: ?*const BufferData = null;
+        if (buffer) |id| {
+            const entry = self.buffers.get(id) orelse return error.InvalidBuffer;
+            entry.uses += 1;
+            info.buffer = id;
+            data = &entry.data;
+        }
+        info.started = true;
+        self.send(.{ .op = .start, .node = node.index, .values = .{ when, @max(offset, 0), duration }, .buffer = data });
+    }
+
+    pub fn stop(self: *Self, node: NodeId, when: f64) Error!void {
+        const info = self.nodes.getConst(node) orelse return error.InvalidNode;
+        if (info.kind != .buffer_source) return error.InvalidArgument;
+        if (!info.started) return error.InvalidState;
+        self.send(.{ .op = .stop, .node = node.index, .values = .{ when, 0, 0 } });
+    }
+
+    /// Next source that finished playing. Its node is released: the id
+    /// goes stale, so later calls on it fail harmlessly.
+    pub fn pollEnded(self: *Self) ?NodeId {
+        if (!self.isOpen()) return null;
+        const event = self.mixer.events.pop() orelse return null;
+        const id: NodeId = .{ .index = event.node, .generation = self.nodes.slots[event.node].generation };
+        self.freeNode(id);
+        return id;
+    }
+
+    /// Once per frame: retry commands that found the ring full and, without
+    /// a device, render the time since the last pump.
+    pub fn pump(self: *Self) void {
+        if (!self.isOpen()) return;
+        self.flushOverflow();
+        if (self.device) return;
+        const now = std.time.nanoTimestamp();
+        const elapsed_s = @as(f64, @floatFromInt(now - self.last_pump_ns)) / std.time.ns_per_s;
+        self.last_pump_ns = now;
+        if (self.mixer.suspended.load(.acquire)) return self.mixer.applyCommands();
+        self.pending_frames += @min(elapsed_s, MaxPumpSeconds) * self.sample_rate;
+        while (self.pending_frames >= RenderQuantum) : (self.pending_frames -= RenderQuantum) {
+            self.mixer.renderQuantum();
+        }
+    }
+
+    fn send(self: *Self, cmd: Command) void {
+        if (self.overflow.items.len == 0 and self.mixer.commands.push(cmd)) return;
+        self.overflow.append(std.heap.page_allocator, cmd) catch log.warn("audio command dropped: out of memory", .{});
+    }
+
+    fn flushOverflow(self: *Self) void {
+        var sent: usize = 0;
+        while (sent < self.overflow.items.len and self.mixer.commands.push(self.overflow.items[sent])) sent += 1;
+        const left = self.overflow.items.len - sent;
+        std.mem.copyForwards(Command, self.overflow.items[0..left], self.overflow.items[sent..]);
+        self.overflow.shrinkRetainingCapacity(left);
+    }
+
+    // Buffers
+
+    /// A zeroed buffer, as `createBuffer` makes.
+    pub fn createBuffer(self: *Self, channels: u32, frames: u32, sample_rate: f32) Error!BufferId {
+        if (channels == 0 or channels > MaxChannels or frames == 0) return error.InvalidArgument;
+        if (!(sample_rate > 0) or !std.math.isFinite(sample_rate)) return error.InvalidArgument;
+        const samples = try self.allocator.alloc(f32, @as(usize, channels) * frames);
+        @memset(samples, 0);
+        return self.addBuffer(.{
+            .allocator = self.allocator,
+            .samples = samples,
+            .frames = frames,
+            .channels = @intCast(channels),
+            .sample_rate = sample_rate,
+        });
+    }
+
+    /// Take ownership of decoded samples, freeing them on failure.
+    pub fn adoptBuffer(self: *Self, decoded: audio_decode.DecodedAudio) Error!BufferId {
+        return self.addBuffer(decoded);
+    }
+
+    fn addBuffer(self: *Self, decoded: audio_decode.DecodedAudio) Error!BufferId {
+        var owned = decoded;
+        errdefer owned.deinit();
+        if (!self.isOpen()) return error.NotOpen;
+        const id = try self.buffers.alloc();
+        self.buffers.at(id.index).* = .{
+            .allocator = owned.allocator,
+            .data = .{
+                .samples = owned.samples,
+                .frames = owned.frames,
+                .channels = owned.channels,
+                .sample_rate = owned.sample_rate,
+            },
+        };
+        return id;
+    }
+
+    pub fn bufferInfo(self: *const Self, id: BufferId) ?BufferInfo {
+        const entry = self.buffers.getConst(id) orelse return null;
+        return .{ .channels = entry.data.channels, .frames = entry.data.frames, .sample_rate = entry.data.sample_rate };
+    }
+
+    /// Copy `src` into a channel from frame `offset`. Samples a started
+    /// source may be reading are never written: the buffer is copied
+    /// first and the returned id names the copy.
+    pub fn writeChannel(self: *Self, id: BufferId, channel: u32, offset: u32, src: []const f32) Error!BufferId {
+        var entry = self.buffers.get(id) orelse return error.InvalidBuffer;
+        if (channel >= entry.data.channels or offset > entry.data.frames) return error.InvalidArgument;
+        var target = id;
+        if (entry.uses > 0) {
+            const data = entry.data;
+            target = try self.createBuffer(data.channels, data.frames, data.sample_rate);
+            // alloc() may not move items, so `entry` is still valid
+            entry.orphaned = true;
+            entry = self.buffers.get(target).?;
+            @memcpy(entry.data.samples, data.samples);
+        }
+        const dst = entry.data.samples[channel * entry.data.frames ..][offset..entry.data.frames];
+        const n = @min(dst.len, src.len);
+        @memcpy(dst[0..n], src[0..n]);
+        return target;
+    }
+
+    /// Copy a channel from frame `offset` into `dst`, as far as both go.
+    pub fn readChannel(self: *const Self, id: BufferId, channel: u32, offset: u32, dst: []f32) Error!void {
+        const entry = self.buffers.getConst(id) orelse return error.InvalidBuffer;
+        if (channel >= entry.data.channels or offset > entry.data.frames) return error.InvalidArgument;
+        const src = entry.data.channel(channel)[offset..];
+        const n = @min(dst.len, src.len);
+        @memcpy(dst[0..n], src[0..n]);
+    }
+
+    /// JS dropped its last reference to a buffer. It is freed now, or once
+    /// the last source playing it ends. Handles from an earlier
+    /// `generation` are ignored.
+    pub fn dropBuffer(self: *Self, generation: u32, id: BufferId) void {
+        if (!self.isOpen() or generation != self.generation) return;
+        const entry = self.buffers.get(id) orelse return;
+        if (entry.uses > 0) {
+            entry.orphaned = true;
+            return;
+        }
+        entry.allocator.free(entry.data.samples);
+        _ = self.buffers.free(id);
+    }
+
+    fn releaseBuffer(self: *Self, id: BufferId) void {
+        const entry = self.buffers.get(id) orelse return;
+        entry.uses -= 1;
+        if (entry.uses == 0 and entry.orphaned) {
+            entry.allocator.free(entry.data.samples);
+            _ = self.buffers.free(id);
+        }
+    }
+};
+
+// =============================================================================
+// Shared graph
+// =============================================================================
+
+var g_mixer: Mixer = .{};
+var g_graph: Graph = .{ .mixer = &g_mixer };
+var g_output: OutputConfig = .{};
+
+/// Output device settings for the next open().
+pub fn configureOutput(config: OutputConfig) void {
+    g_output = config;
+}
+
+pub fn outputConfig() OutputConfig {
+    return g_output;
+}
+
+/// The graph behind every AudioContext.
+pub fn graph() *Graph {
+    return &g_graph;
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+fn testGraph() !*Graph {
+    const g = try testing.allocator.create(Graph);
+    errdefer testing.allocator.destroy(g);
+    const mixer = try testing.allocator.create(Mixer);
+    errdefer testing.allocator.destroy(mixer);
+    mixer.* = .{};
+    g.* = .{ .mixer = mixer };
+    _ = try g.open(testing.allocator, .{ .enabled = false, .sample_rate = 1000 });
+    return g;
+}
+
+fn destroyTestGraph(g: *Graph) void {
+    g.close();
+    testing.allocator.destroy(g.mixer);
+    testing.allocator.destroy(g);
+}
+
+fn fillChannel(g: *Graph, buffer: BufferId, channel: u32, values: []const f32) !void {
+    const same = try g.writeChannel(buffer, channel, 0, values);
+    try testing.expectEqual(buffer, same);
+}
+
+test "AudioParam automation steps, ramps and approaches targets" {
+    var p = ParamState{ .value = 1 };
+    p.schedule(.set_value_at_time, 3, 2.0, 0, 0);
+    try testing.expectEqual(@as(f32, 1), p.advance(1.0));
+    try testing.expectEqual(@as(f32, 3), p.advance(2.0));
+
+    p.schedule(.linear_ramp, 5, 4.0, 0, 2.0);
+    try testing.expectApproxEqAbs(@as(f32, 4), p.advance(3.0), 1e-6);
+    try testing.expectEqual(@as(f32, 5), p.advance(4.5));
+    try testing.expectEqual(Automation.none, p.automation);
+
+    p.schedule(.exponential_ramp, 20, 6.0, 0, 4.0);
+    try testing.expectApproxEqAbs(@as(f32, 10), p.advance(5.0), 1e-4);
+    // Through zero: holds, then jumps at the end
+    p.schedule(.exponential_ramp, 0, 8.0, 0, 5.0);
+    try testing.expectApproxEqAbs(@as(f32, 10), p.advance(7.0), 1e-4);
+    try testing.expectEqual(@as(f32, 0), p.advance(8.0));
+
+    p.schedule(.set_target, 1, 9.0, 0.5, 8.0);
+    try testing.expectEqual(@as(f32, 0), p.advance(8.5));
+    try testing.expectApproxEqAbs(@as(f32, 1 - @exp(@as(f32, -2))), p.advance(10.0), 1e-5);
+    try testing.expectEqual(@as(f32, 1), p.advance(30.0));
+    try testing.expectEqual(Automation.none, p.automation);
+}
+
+test "Mixer plays a buffer through a gain and reports the end" {
+    const g = try testGraph();
+    defer destroyTestGraph(g);
+    const mixer = g.mixer;
+
+    const buffer = try g.createBuffer(1, 200, 1000);
+    var ones: [200]f32 = undefined;
+    @memset(&ones, 0.5);
+    try fillChannel(g, buffer, 0, &ones);
+
+    const source = try g.createNode(.buffer_source);
+    const gain = try g.createNode(.gain);
+    try g.connect(source, gain);
+    try g.connect(gain, g.destination);
+    try g.setParam(gain, .gain, .set_value, 0.5, 0, 0);
+    try testing.expectEqual(@as(f32, 0.5), try g.paramValue(gain, .gain));
+    try g.start(source, buffer, 0.010, 0, -1);
+    try testing.expectError(error.InvalidState, g.start(source, buffer, 0, 0, -1));
+
+    // Starts 10 frames in; mono reaches both speakers
+    mixer.renderQuantum();
+    try testing.expectEqual(@as(f32, 0), mixer.mix[0][9]);
+    try testing.expectEqual(@as(f32, 0.25), mixer.mix[0][10]);
+    try testing.expectEqual(@as(f32, 0.25), mixer.mix[1][127]);
+    try testing.expect(g.pollEnded() == null);
+
+    // The buffer runs out 210 frames in; the writer now gets a copy
+    const copy = try g.writeChannel(buffer, 0, 0, &.{1.0});
+    try testing.expect(copy.index != buffer.index);
+    mixer.renderQuantum();
+    try testing.expectEqual(@as(f32, 0.25), mixer.mix[0][81]);
+    try testing.expectEqual(@as(f32, 0), mixer.mix[0][82]);
+    try testing.expectEqualDeep(@as(?NodeId, source), g.pollEnded());
+    try testing.expectError(error.InvalidNode, g.stop(source, 0));
+    // The last use of the replaced buffer ended
+    try testing.expect(g.bufferInfo(buffer) == null);
+    try testing.expect(g.bufferInfo(copy) != null);
+}
+
+test "Mixer resamples with linear interpolation and loops" {
+    const g = try testGraph();
+    defer destroyTestGraph(g);
+    const mixer = g.mixer;
+
+    const buffer = try g.createBuffer(1, 4, 1000);
+    try fillChannel(g, buffer, 0, &.{ 0, 1, 2, 3 });
+    const source = try g.createNode(.buffer_source);
+    try g.connect(source, g.destination);
+    try g.setParam(source, .playback_rate, .set_value, 0.5, 0, 0);
+    try g.setConfig(source, .loop, 1);
+    try g.start(source, buffer, 0, 0, -1);
+
+    mixer.renderQuantum();
+    // Half rate: 0, 0.5, 1, ... 3, then back through 1.5 to the loop start
+    const expected = [_]f32{ 0, 0.5, 1, 1.5, 2, 2.5, 3, 1.5, 0, 0.5 };
+    try testing.expectEqualSlices(f32, &expected, mixer.mix[0][0..expected.len]);
+    try testing.expectEqualSlices(f32, &expected, mixer.mix[1][0..expected.len]);
+    try g.stop(source, 0);
+    mixer.renderQuantum();
+    try testing.expectEqualDeep(@as(?NodeId, source), g.pollEnded());
+}
+
+test "Equal-power panning and distance attenuation follow the listener" {
+    var cfg = PannerConfig{};
+    try testing.expectEqual(@as(f32, 1), distanceGain(&cfg, 0.5));
+    try testing.expectApproxEqAbs(@as(f32, 0.5), distanceGain(&cfg, 2), 1e-6);
+    cfg.distance_model = .linear;
+    cfg.max_distance = 11;
+    try testing.expectApproxEqAbs(@as(f32, 0.5), distanceGain(&cfg, 6), 1e-6);
+    cfg.cone_inner_angle = 90;
+    cfg.cone_outer_angle = 180;
+    cfg.cone_outer_gain = 0.25;
+    // Facing +x; a listener behind the source hears the outer gain
+    try testing.expectEqual(@as(f32, 1), coneGain(&cfg, .{ 0, 0, 0 }, .{ 1, 0, 0 }, .{ 5, 0, 0 }));
+    try testing.expectEqual(@as(f32, 0.25), coneGain(&cfg, .{ 0, 0, 0 }, .{ 1, 0, 0 }, .{ -5, 0, 0 }));
+
+    const forward: Vec3 = .{ 0, 0, -1 };
+    const up: Vec3 = .{ 0, 1, 0 };
+    const origin: Vec3 = .{ 0, 0, 0 };
+    try testing.expectApproxEqAbs(@as(f32, 90), azimuthDegrees(.{ 3, 0, 0 }, origin, forward, up), 1e-4);
+    try testing.expectApproxEqAbs(@as(f32, -90), azimuthDegrees(.{ -3, 0, 0 }, origin, forward, up), 1e-4);
+    try testing.expectApproxEqAbs(@as(f32, 0), azimuthDegrees(.{ 0, 0, -3 }, origin, forward, up), 1e-4);
+    // Behind mirrors to in front
+    try testing.expectApproxEqAbs(@as(f32, 45), azimuthDegrees(.{ 1, 0, 1 }, origin, forward, up), 1e-4);
+
+    const g = try testGraph();
+    defer destroyTestGraph(g);
+    const mixer = g.mixer;
+    const buffer = try g.createBuffer(1, 256, 1000);
+    var ones: [256]f32 = undefined;
+    @memset(&ones, 1);
+    try fillChannel(g, buffer, 0, &ones);
+    const source = try g.createNode(.buffer_source);
+    const panner = try g.createNode(.panner);
+    try g.connect(source, panner);
+    try g.connect(panner, g.destination);
+    // Two units to the listener's right: all right, at half gain
+    try g.setParam(panner, .position_x, .set_value, 2, 0, 0);
+    try g.start(source, buffer, 0, 0, -1);
+    mixer.renderQuantum();
+    try testing.expectApproxEqAbs(@as(f32, 0), mixer.mix[0][64], 1e-6);
+    try testing.expectApproxEqAbs(@as(f32, 0.5), mixer.mix[1][64], 1e-6);
+}
+
+test "Dropped nodes and buffers are freed once nothing uses them" {
+    const g = try testGraph();
+    defer destroyTestGraph(g);
+    const mixer = g.mixer;
+
+    const buffer = try g.createBuffer(1, 64, 1000);
+    const source = try g.createNode(.buffer_source);
+    const gain = try g.createNode(.gain);
+    try g.connect(source, gain);
+    try g.connect(gain, g.destination);
+    try g.start(source, buffer, 0, 0, -1);
+
+    // Held by a playing source, and fed by it
+    g.dropBuffer(g.generation, buffer);
+    g.dropNode(g.generation, gain);
+    g.dropNode(g.generation, source);
+    try testing.expect(g.bufferInfo(buffer) != null);
+    try testing.expect(g.nodes.isValid(gain));
+    try testing.expect(g.nodes.isValid(source));
+
+    // The end frees the source, then the gain it fed and the buffer
+    mixer.renderQuantum();
+    try testing.expectEqualDeep(@as(?NodeId, source), g.pollEnded());
+    try testing.expect(!g.nodes.isValid(gain));
+    try testing.expect(g.bufferInfo(buffer) == null);
+    try testing.expectEqual(@as(u16, 2), g.nodes.count);
+
+    // Disconnecting the last input frees a dropped node; handles from an
+    // earlier open are ignored
+    const a = try g.createNode(.gain);
+    const b = try g.createNode(.panner);
+    try g.connect(a, b);
+    g.dropNode(g.generation, b);
+    try testing.expect(g.nodes.isValid(b));
+    try g.disconnect(a);
+    try testing.expect(!g.nodes.isValid(b));
+    g.dropNode(g.generation +% 1, a);
+    try testing.expect(g.nodes.isValid(a));
+    g.dropNode(g.generation, a);
+    try testing.expectEqual(@as(u16, 2), g.nodes.count);
+
+    const unused = try g.createBuffer(2, 16, 1000);
+    g.dropBuffer(g.generation, unused);
+    try testing.expect(g.bufferInfo(unused) == null);
+}
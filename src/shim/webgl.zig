@@ -4,6 +4,8 @@
 
 const std = @import("std");
 const testing = std.testing;
+const cpu_block_pool = @import("cpu_block_pool.zig");
+const handle_table = @import("handle_table.zig");
 
 pub const MaxContexts: usize = 4;
 
@@ -109,9 +111,10 @@ pub const ContextTable = struct {
 // WebGL buffer handles (Phase 2.2, first TDD slice)
 // =============================================================================
 
-pub const MaxBuffers: usize = 256;
+/// Default BufferTable capacity; configureBufferCapacity() changes it.
+pub const MaxBuffers: usize = 4096;
 pub const MaxBufferBytes: usize = 16 * 1024 * 1024;
-// CPU backfill pool: 4096 * 4 KiB = 16 MiB total.
+// CPU backfill pool: 4096 * 4 KiB = 16 MiB by default (configureCpuPool).
 // Napkin: enough for ~4 buffers at 4 MiB each before backend is live.
 pub const CpuBlockSizeBytes: usize = 4096;
 pub const CpuBlockCount: usize = 4096;
@@ -124,6 +127,20 @@ pub const BufferBackend = struct {
     create: *const fn (ctx: ?*anyopaque, size: usize, usage: BufferUsage) Handle,
     update: *const fn (ctx: ?*anyopaque, handle: Handle, data: []const u8) void,
     destroy: *const fn (ctx: ?*anyopaque, handle: Handle) void,
+    /// Create a buffer the app marked DYNAMIC/STREAM. Backends may mirror it
+    /// on the CPU so sub-range writes can be batched and ring-buffered.
+    create_dynamic: ?*const fn (ctx: ?*anyopaque, size: usize, usage: BufferUsage) Handle = null,
+    /// Write `data` at byte `offset`, leaving the rest of the buffer intact.
+    update_range: ?*const fn (ctx: ?*anyopaque, handle: Handle, offset: usize, data: []const u8) void = null,
+    /// Called once per frame before draws are submitted.
+    commit: ?*const fn (ctx: ?*anyopaque) void = null,
+
+    fn createFor(self: *const BufferBackend, size: usize, usage: BufferUsage, hint: BufferHint) Handle {
+        if (hint != .static) {
+            if (self.create_dynamic) |create_dynamic| return create_dynamic(self.ctx, size, usage);
+        }
+        return self.create(self.ctx, size, usage);
+    }
 };
 
 pub const BufferId = packed struct(u32) {
@@ -134,7 +151,24 @@ pub const BufferId = packed struct(u32) {
 pub const BufferUsage = enum {
     vertex,
     index,
+    /// UNIFORM_BUFFER contents; CPU pool only, copied into the frame's
+    /// uniform stream by the draws that read them
     uniform,
+    /// readPixels() destination; lives in the CPU pool only, never in a
+    /// backend buffer, so getBufferSubData() can read it back
+    pixel_pack,
+
+    /// Whether buffers of this usage never get a backend buffer
+    pub fn isCpuOnly(self: BufferUsage) bool {
+        return self == .uniform or self == .pixel_pack;
+    }
+};
+
+/// WebGL usage hint (STATIC_DRAW / DYNAMIC_DRAW / STREAM_DRAW).
+pub const BufferHint = enum {
+    static,
+    dynamic,
+    stream,
 };
 
 pub const BufferDesc = struct {
@@ -146,109 +180,59 @@ pub const Buffer = struct {
     id: BufferId,
     size: u32,
     usage: BufferUsage,
+    hint: BufferHint,
     data_len: u32,
     update_count: u32,
     backend: BufferBackend.Handle,
+    /// Bytes allocated for `backend`; larger uploads orphan and recreate it.
+    backend_capacity: u32,
     cpu_block_start: u16,
     cpu_block_count: u16,
 };
 
-const CpuSlice = struct {
-    block_start: u16,
-    block_count: u16,
-    size: u32,
-};
-
-pub const CpuBufferPool = struct {
-    data: [CpuPoolBytes]u8,
-    used: [CpuBlockCount]bool,
-
-    const Self = @This();
-
-    fn initInPlace(self: *Self) void {
-        @memset(&self.used, false);
-        // data is left uninitialized - it will be written before read
-    }
+const CpuSlice = cpu_block_pool.CpuSlice;
+pub const CpuBufferPool = cpu_block_pool.BlockPool(CpuBlockSizeBytes, CpuBlockCount);
 
-    fn reset(self: *Self) void {
-        @memset(&self.used, false);
-    }
+var g_cpu_pool: CpuBufferPool = .{};
 
-    fn alloc(self: *Self, size: usize) !CpuSlice {
-        if (size == 0) return error.InvalidSize;
-        const blocks_needed = @as(usize, (size + CpuBlockSizeBytes - 1) / CpuBlockSizeBytes);
-        if (blocks_needed > CpuBlockCount) return error.TooLarge;
-        var run_len: usize = 0;
-        var run_start: usize = 0;
-        for (0..CpuBlockCount) |idx| {
-            if (!self.used[idx]) {
-                if (run_len == 0) run_start = idx;
-                run_len += 1;
-                if (run_len >= blocks_needed) {
-                    for (run_start..run_start + blocks_needed) |block_idx| {
-                        self.used[block_idx] = true;
-                    }
-                    return .{
-                        .block_start = @intCast(run_start),
-                        .block_count = @intCast(blocks_needed),
-                        .size = @intCast(size),
-                    };
-                }
-            } else {
-                run_len = 0;
-            }
-        }
-        return error.OutOfMemory;
-    }
+fn globalCpuPool() *CpuBufferPool {
+    return &g_cpu_pool;
+}
 
-    fn free(self: *Self, cpu_slice: CpuSlice) void {
-        if (cpu_slice.block_count == 0) return;
-        const start: usize = @intCast(cpu_slice.block_start);
-        const count: usize = @intCast(cpu_slice.block_count);
-        for (start..start + count) |idx| {
-            self.used[idx] = false;
-        }
-    }
+/// Resize the CPU backfill pool. Call at startup, before any buffer data is
+/// uploaded without a backend; fails with PoolInUse otherwise.
+pub fn configureCpuPool(bytes: usize) !void {
+    try g_cpu_pool.configure(bytes);
+}
 
-    fn slice(self: *Self, cpu_slice: CpuSlice) []u8 {
-        const start = @as(usize, cpu_slice.block_start) * CpuBlockSizeBytes;
-        return self.data[start .. start + @as(usize, cpu_slice.size)];
-    }
-};
+pub fn cpuPoolStats() cpu_block_pool.PoolStats {
+    return g_cpu_pool.stats();
+}
 
-var g_cpu_pool: CpuBufferPool = undefined;
-var g_cpu_pool_init: bool = false;
+var g_buffer_capacity: usize = MaxBuffers;
 
-fn globalCpuPool() *CpuBufferPool {
-    if (!g_cpu_pool_init) {
-        g_cpu_pool.initInPlace();
-        g_cpu_pool_init = true;
-    }
-    return &g_cpu_pool;
+/// Set how many buffers each BufferTable holds. Call at startup, before the
+/// buffer tables are first used; tables initialized earlier keep their size.
+pub fn configureBufferCapacity(capacity: usize) !void {
+    if (capacity == 0 or capacity > handle_table.MaxCapacity) return error.InvalidSize;
+    g_buffer_capacity = capacity;
 }
 
 pub const BufferTable = struct {
-    entries: [MaxBuffers]Entry,
-    count: u16,
+    handles: Handles,
     cpu_pool: *CpuBufferPool,
+    /// Bumped whenever a buffer is freed or its backend handle changes, so
+    /// resolved vertex bindings know when to look handles up again.
+    backend_epoch: u32,
 
     const Self = @This();
+    const Handles = handle_table.HandleTable(BufferId, Buffer, MaxBuffers);
 
-    const Entry = struct {
-        active: bool,
-        generation: u16,
-        buffer: Buffer,
-    };
-
-    /// Initialize table in place - zeros memory at runtime, no comptime cost
+    /// Initialize table in place; slot storage is reserved on first alloc
     pub fn initInPlace(self: *Self) void {
-        @memset(std.mem.asBytes(&self.entries), 0);
-        for (&self.entries, 0..) |*entry, idx| {
-            entry.generation = 1;
-            entry.buffer.id.index = @intCast(idx);
-        }
-        self.count = 0;
+        self.handles = .{ .capacity = g_buffer_capacity };
         self.cpu_pool = globalCpuPool();
+        self.backend_epoch = 0;
     }
 
     pub fn init() Self {
@@ -262,82 +246,63 @@ pub const BufferTable = struct {
     }
 
     pub fn alloc(self: *Self, desc: BufferDesc) !BufferId {
-        if (self.count >= MaxBuffers) {
-            return error.AtCapacity;
-        }
-
-        for (&self.entries, 0..) |*entry, idx| {
-            if (!entry.active) {
-                if (entry.generation == 0) {
-                    entry.generation = 1;
-                }
-                const id = BufferId{
-                    .index = @intCast(idx),
-                    .generation = entry.generation,
-                };
-                entry.buffer = .{
-                    .id = id,
-                    .size = desc.size,
-                    .usage = desc.usage,
-                    .data_len = 0,
-                    .update_count = 0,
-                    .backend = 0,
-                    .cpu_block_start = 0,
-                    .cpu_block_count = 0,
-                };
-                entry.active = true;
-                self.count += 1;
-                return id;
-            }
-        }
-        return error.AtCapacity;
+        const id = try self.handles.alloc();
+        self.handles.at(id.index).* = .{
+            .id = id,
+            .size = desc.size,
+            .usage = desc.usage,
+            .hint = .static,
+            .data_len = 0,
+            .update_count = 0,
+            .backend = 0,
+            .backend_capacity = 0,
+            .cpu_block_start = 0,
+            .cpu_block_count = 0,
+        };
+        return id;
     }
 
     pub fn get(self: *Self, id: BufferId) ?*Buffer {
-        if (!self.isValid(id)) return null;
-        return &self.entries[id.index].buffer;
+        return self.handles.get(id);
     }
 
     pub fn free(self: *Self, id: BufferId) bool {
-        if (!self.isValid(id)) return false;
-        var entry = &self.entries[id.index];
-        if (entry.buffer.cpu_block_count != 0) {
+        const buffer = self.handles.get(id) orelse return false;
+        if (buffer.cpu_block_count != 0) {
             const slice = CpuSlice{
-                .block_start = entry.buffer.cpu_block_start,
-                .block_count = entry.buffer.cpu_block_count,
-                .size = entry.buffer.data_len,
+                .block_start = buffer.cpu_block_start,
+                .block_count = buffer.cpu_block_count,
+                .size = buffer.data_len,
             };
             self.cpu_pool.free(slice);
         }
-        entry.active = false;
-        entry.generation +%= 1;
-        entry.buffer = .{
+        self.backend_epoch +%= 1;
+        buffer.* = .{
             .id = .{
                 .index = id.index,
                 .generation = 0,
             },
             .size = 0,
             .usage = .vertex,
+            .hint = .static,
             .data_len = 0,
             .update_count = 0,
             .backend = 0,
+            .backend_capacity = 0,
             .cpu_block_start = 0,
             .cpu_block_count = 0,
         };
-        self.count -= 1;
-        return true;
+        return self.handles.free(id);
     }
 
-    pub fn isValid(self: *Self, id: BufferId) bool {
-        if (id.index >= MaxBuffers) return false;
-        const entry = &self.entries[id.index];
-        return entry.active and entry.generation == id.generation;
+    pub fn isValid(self: *const Self, id: BufferId) bool {
+        return self.handles.isValid(id);
     }
 
     pub fn updateData(self: *Self, id: BufferId, data: []const u8) !void {
         if (!self.isValid(id)) return error.InvalidHandle;
         if (data.len > MaxBufferBytes) return error.TooLarge;
-        var buffer = &self.entries[id.index].buffer;
+        const buffer = self.handles.at(id.index);
         if (buffer.cpu_block_count != 0) {
             self.cpu_pool.free(.{
                 .block_start = buffer.cpu_block_start,
@@ -363,11 +328,20 @@ pub const BufferTable = struct {
         if (!self.isValid(id)) return error.InvalidHandle;
         if (data.len > MaxBufferBytes) return error.TooLarge;
 
-        var buffer = &self.entries[id.index].buffer;
+        const buffer = self.handles.at(id.index);
+        if (buffer.backend != 0 and data.len > buffer.backend_capacity) {
+            // Orphan: draws resolve the handle at flush time, so nothing
+            // recorded still refers to the old allocation.
+            backend.destroy(backend.ctx, buffer.backend);
+            buffer.backend = 0;
+            buffer.backend_capacity = 0;
+        }
         if (buffer.backend == 0) {
-            const handle = backend.create(backend.ctx, data.len, buffer.usage);
+            const handle = backend.createFor(data.len, buffer.usage, buffer.hint);
             if (handle == 0) return error.BackendFailed;
             buffer.backend = handle;
+            buffer.backend_capacity = @intCast(data.len);
+            self.backend_epoch +%= 1;
         }
         backend.update(backend.ctx, buffer.backend, data);
         if (buffer.cpu_block_count != 0) {
@@ -385,20 +359,54 @@ pub const BufferTable = struct {
         buffer.update_count +%= 1;
     }
 
+    /// The CPU copy of a buffer's contents: always present for uniform and
+    /// pixel pack buffers, otherwise only until a backend takes the data over.
+    pub fn cpuData(self: *Self, id: BufferId) ?[]u8 {
+        if (!self.isValid(id)) return null;
+        const buffer = self.handles.at(id.index);
+        if (buffer.cpu_block_count == 0) return null;
+        return self.cpu_pool.slice(.{
+            .block_start = buffer.cpu_block_start,
+            .block_count = buffer.cpu_block_count,
+            .size = buffer.data_len,
+        });
+    }
+
+    /// bufferSubData: overwrite `data.len` bytes at `offset` of the current
+    /// contents. The range must lie within the last bufferData size.
+    pub fn subData(self: *Self, id: BufferId, offset: usize, data: []const u8, backend: ?*const BufferBackend) !void {
+        if (!self.isValid(id)) return error.InvalidHandle;
+        const buffer = self.handles.at(id.index);
+        if (offset > buffer.data_len or data.len > buffer.data_len - offset) return error.OutOfRange;
+        if (data.len == 0) return;
+
+        if (buffer.backend != 0) {
+            const b = backend orelse return error.BackendFailed;
+            const update_range = b.update_range orelse return error.Unsupported;
+            update_range(b.ctx, buffer.backend, offset, data);
+        } else if (buffer.cpu_block_count != 0) {
+            const dst = self.cpu_pool.slice(.{
+                .block_start = buffer.cpu_block_start,
+                .block_count = buffer.cpu_block_count,
+                .size = buffer.data_len,
+            });
+            @memcpy(dst[offset .. offset + data.len], data);
+        }
+        buffer.update_count +%= 1;
+    }
+
     pub fn freeWithBackend(self: *Self, id: BufferId, backend: *const BufferBackend) bool {
-        if (!self.isValid(id)) return false;
-        const entry = &self.entries[id.index];
-        if (entry.buffer.backend != 0) {
-            backend.destroy(backend.ctx, entry.buffer.backend);
+        const buffer = self.handles.get(id) orelse return false;
+        if (buffer.backend != 0) {
+            backend.destroy(backend.ctx, buffer.backend);
         }
         return self.free(id);
     }
 
     pub fn backfill(self: *Self, backend: *const BufferBackend) !void {
-        for (&self.entries) |*entry| {
-            if (!entry.active) continue;
-            var buffer = &entry.buffer;
-            if (buffer.backend != 0) continue;
+        var it = self.handles.iterator();
+        while (it.next()) |buffer| {
+            if (buffer.backend != 0 or buffer.usage.isCpuOnly()) continue;
             if (buffer.cpu_block_count != 0) {
                 const data = self.cpu_pool.slice(.{
                     .block_start = buffer.cpu_block_start,
@@ -406,9 +414,11 @@ pub const BufferTable = struct {
                     .size = buffer.data_len,
                 });
                 if (data.len == 0) continue;
-                const handle = backend.create(backend.ctx, data.len, buffer.usage);
+                const handle = backend.createFor(data.len, buffer.usage, buffer.hint);
                 if (handle == 0) return error.BackendFailed;
                 buffer.backend = handle;
+                buffer.backend_capacity = @intCast(data.len);
+                self.backend_epoch +%= 1;
                 backend.update(backend.ctx, buffer.backend, data);
                 self.cpu_pool.free(.{
                     .block_start = buffer.cpu_block_start,
@@ -422,6 +432,7 @@ pub const BufferTable = struct {
     }
 
     pub fn deinit(self: *Self) void {
+        self.handles.deinit();
         self.* = Self.init();
         self.cpu_pool.reset();
     }
@@ -481,11 +492,11 @@ test "ContextTable free rejects invalid handles" {
 test "BufferTable allocates and frees" {
     var table = BufferTable.initWithAllocator(testing.allocator);
     defer table.deinit();
-    try testing.expectEqual(@as(u16, 0), table.count);
+    try testing.expectEqual(@as(u16, 0), table.handles.count);
 
     const id = try table.alloc(.{ .size = 1024, .usage = .vertex });
     try testing.expect(table.isValid(id));
-    try testing.expectEqual(@as(u16, 1), table.count);
+    try testing.expectEqual(@as(u16, 1), table.handles.count);
 
     const buf = table.get(id) orelse return error.UnexpectedNull;
     try testing.expectEqual(@as(u32, 1024), buf.size);
@@ -494,7 +505,7 @@ test "BufferTable allocates and frees" {
     try testing.expectEqual(@as(u32, 0), buf.update_count);
 
     try testing.expect(table.free(id));
-    try testing.expectEqual(@as(u16, 0), table.count);
+    try testing.expectEqual(@as(u16, 0), table.handles.count);
     try testing.expect(!table.isValid(id));
 }
 
@@ -538,11 +549,11 @@ test "BufferTable free resets buffer state" {
     try table.updateData(id, data[0..]);
 
     try testing.expect(table.free(id));
-    const entry = table.entries[id.index];
-    try testing.expect(!entry.active);
-    try testing.expectEqual(@as(u32, 0), entry.buffer.size);
-    try testing.expectEqual(@as(u32, 0), entry.buffer.data_len);
-    try testing.expectEqual(@as(u32, 0), entry.buffer.update_count);
+    try testing.expect(!table.handles.isActive(id.index));
+    const buffer = table.handles.at(id.index);
+    try testing.expectEqual(@as(u32, 0), buffer.size);
+    try testing.expectEqual(@as(u32, 0), buffer.data_len);
+    try testing.expectEqual(@as(u32, 0), buffer.update_count);
 }
 
 test "BufferTable updateData updates size and count" {
@@ -631,7 +642,7 @@ test "BufferTable uploadData uses backend once" {
     const buf = table.get(id) orelse return error.UnexpectedNull;
     try testing.expect(buf.backend != 0);
 
-    const data_b = [_]u8{0} ** 64;
+    const data_b = [_]u8{0} ** 24;
     try table.uploadData(id, data_b[0..], &backend);
     try testing.expectEqual(@as(u32, 1), stub.create_calls);
     try testing.expectEqual(@as(u32, 2), stub.update_calls);
@@ -639,3 +650,107 @@ test "BufferTable uploadData uses backend once" {
     try testing.expect(table.freeWithBackend(id, &backend));
     try testing.expectEqual(@as(u32, 1), stub.destroy_calls);
 }
+
+const RangeBackendStub = struct {
+    create_calls: u32 = 0,
+    dynamic_calls: u32 = 0,
+    destroy_calls: u32 = 0,
+    range_calls: u32 = 0,
+    last_offset: usize = 0,
+    last_len: usize = 0,
+
+    const Self = @This();
+
+    fn backend(self: *Self) BufferBackend {
+        return .{
+            .ctx = self,
+            .create = create,
+            .update = update,
+            .destroy = destroy,
+            .create_dynamic = createDynamic,
+            .update_range = updateRange,
+        };
+    }
+
+    fn create(ctx: ?*anyopaque, _: usize, _: BufferUsage) BufferBackend.Handle {
+        const self: *Self = @ptrCast(@alignCast(ctx.?));
+        self.create_calls += 1;
+        return self.create_calls + self.dynamic_calls;
+    }
+
+    fn createDynamic(ctx: ?*anyopaque, _: usize, _: BufferUsage) BufferBackend.Handle {
+        const self: *Self = @ptrCast(@alignCast(ctx.?));
+        self.dynamic_calls += 1;
+        return self.create_calls + self.dynamic_calls;
+    }
+
+    fn update(_: ?*anyopaque, _: BufferBackend.Handle, _: []const u8) void {}
+
+    fn updateRange(ctx: ?*anyopaque, _: BufferBackend.Handle, offset: usize, data: []const u8) void {
+        const self: *Self = @ptrCast(@alignCast(ctx.?));
+        self.range_calls += 1;
+        self.last_offset = offset;
+        self.last_len = data.len;
+    }
+
+    fn destroy(ctx: ?*anyopaque, _: BufferBackend.Handle) void {
+        const self: *Self = @ptrCast(@alignCast(ctx.?));
+        self.destroy_calls += 1;
+    }
+};
+
+test "BufferTable uploadData orphans the backend buffer when data grows" {
+    var table = BufferTable.initWithAllocator(testing.allocator);
+    defer table.deinit();
+    var stub = RangeBackendStub{};
+    const backend = stub.backend();
+
+    const id = try table.alloc(.{ .usage = .vertex });
+    table.get(id).?.hint = .dynamic;
+    const small = [_]u8{0} ** 32;
+    try table.uploadData(id, small[0..], &backend);
+    const first = table.get(id).?.backend;
+    try testing.expectEqual(@as(u32, 1), stub.dynamic_calls);
+    // Rewriting in place keeps the handle, so bindings stay valid
+    const epoch = table.backend_epoch;
+    try table.uploadData(id, small[0..], &backend);
+    try testing.expectEqual(epoch, table.backend_epoch);
+
+    const large = [_]u8{0} ** 96;
+    try table.uploadData(id, large[0..], &backend);
+    const buf = table.get(id) orelse return error.UnexpectedNull;
+    try testing.expect(buf.backend != first);
+    try testing.expect(table.backend_epoch != epoch);
+    try testing.expectEqual(@as(u32, 96), buf.backend_capacity);
+    try testing.expectEqual(@as(u32, 1), stub.destroy_calls);
+    try testing.expectEqual(@as(u32, 2), stub.dynamic_calls);
+    try testing.expectEqual(@as(u32, 0), stub.create_calls);
+}
+
+test "BufferTable subData writes ranges through the backend or CPU copy" {
+    var table = BufferTable.initWithAllocator(testing.allocator);
+    defer table.deinit();
+
+    const cpu_id = try table.alloc(.{});
+    const zeros = [_]u8{0} ** 16;
+    try table.updateData(cpu_id, zeros[0..]);
+    const patch = [_]u8{ 1, 2, 3, 4 };
+    try table.subData(cpu_id, 8, patch[0..], null);
+    const cpu_buf = table.get(cpu_id).?;
+    const bytes = table.cpu_pool.slice(.{
+        .block_start = cpu_buf.cpu_block_start,
+        .block_count = cpu_buf.cpu_block_count,
+        .size = cpu_buf.data_len,
+    });
+    try testing.expectEqualSlices(u8, &[_]u8{ 0, 1, 2, 3, 4, 0 }, bytes[7..13]);
+    try testing.expectError(error.OutOfRange, table.subData(cpu_id, 14, patch[0..], null));
+
+    var stub = RangeBackendStub{};
+    const backend = stub.backend();
+    const gpu_id = try table.alloc(.{});
+    try table.uploadData(gpu_id, zeros[0..], &backend);
+    try table.subData(gpu_id, 12, patch[0..], &backend);
+    try testing.expectEqual(@as(u32, 1), stub.range_calls);
+    try testing.expectEqual(@as(usize, 12), stub.last_offset);
+    try testing.expectEqual(@as(usize, 4), stub.last_len);
+}
@@ -1,10 +1,13 @@
 //! Sokol backend adapter for WebGL buffer and texture operations.
 
 const std = @import("std");
+const testing = std.testing;
 const sokol = @import("sokol");
 const sg = sokol.gfx;
 const webgl = @import("webgl.zig");
+const webgl_program = @import("webgl_program.zig");
 const webgl_texture = @import("webgl_texture.zig");
+const gl_uniforms = @import("gl_uniforms.zig");
 
 pub fn sokolBufferBackend() webgl.BufferBackend {
     return .{
@@ -12,6 +15,9 @@ pub fn sokolBufferBackend() webgl.BufferBackend {
         .create = create,
         .update = update,
         .destroy = destroy,
+        .create_dynamic = createDynamic,
+        .update_range = updateRange,
+        .commit = commit,
     };
 }
 
@@ -22,21 +28,53 @@ pub fn getSokolBackend() *const webgl.BufferBackend {
 }
 
 fn create(_: ?*anyopaque, size: usize, usage: webgl.BufferUsage) webgl.BufferBackend.Handle {
-    const desc = sg.BufferDesc{
-        .size = size,
-        .usage = toUsage(usage),
-    };
-    const buf = sg.makeBuffer(desc);
-    return buf.id;
+    return makeTracked(size, usage, false);
+}
+
+fn createDynamic(_: ?*anyopaque, size: usize, usage: webgl.BufferUsage) webgl.BufferBackend.Handle {
+    return makeTracked(size, usage, true);
 }
 
 fn update(_: ?*anyopaque, handle: webgl.BufferBackend.Handle, data: []const u8) void {
-    if (handle == 0) return;
-    sg.updateBuffer(.{ .id = handle }, .{ .ptr = data.ptr, .size = data.len });
+    if (handle == 0 or data.len == 0) return;
+    const tracked = g_tracked.getPtr(handle) orelse {
+        sg.updateBuffer(.{ .id = handle }, .{ .ptr = data.ptr, .size = data.len });
+        g_dynamic_stats.bytes_uploaded += data.len;
+        return;
+    };
+    if (tracked.shadow) |shadow| {
+        @memcpy(shadow[0..data.len], data);
+        tracked.pending.include(0, @intCast(data.len));
+        return;
+    }
+    if (tracked.updated_frame != g_frame) {
+        sg.updateBuffer(.{ .id = handle }, .{ .ptr = data.ptr, .size = data.len });
+        tracked.updated_frame = g_frame;
+        g_dynamic_stats.bytes_uploaded += data.len;
+        return;
+    }
+    // Sokol drops a second update in the same frame; write the active slot.
+    writeActiveSlot(handle, 0, data);
+}
+
+fn updateRange(_: ?*anyopaque, handle: webgl.BufferBackend.Handle, offset: usize, data: []const u8) void {
+    if (handle == 0 or data.len == 0) return;
+    const tracked = g_tracked.getPtr(handle) orelse return;
+    if (tracked.shadow) |shadow| {
+        @memcpy(shadow[offset .. offset + data.len], data);
+        tracked.pending.include(@intCast(offset), @intCast(offset + data.len));
+        return;
+    }
+    // Static buffers are not ring-buffered: rotating would expose a slot
+    // that never saw the rest of the contents.
+    writeActiveSlot(handle, offset, data);
 }
 
 fn destroy(_: ?*anyopaque, handle: webgl.BufferBackend.Handle) void {
     if (handle == 0) return;
+    if (g_tracked.fetchRemove(handle)) |kv| {
+        if (kv.value.shadow) |shadow| allocator.free(shadow);
+    }
     sg.destroyBuffer(.{ .id = handle });
 }
 
@@ -50,17 +88,167 @@ fn toUsage(usage: webgl.BufferUsage) sg.BufferUsage {
             .index_buffer = true,
             .dynamic_update = true,
         },
-        .uniform => .{
-            .storage_buffer = true,
-            .dynamic_update = true,
-        },
+        // Uniform and pixel pack buffers stay in the CPU pool
+        .uniform, .pixel_pack => unreachable,
     };
 }
 
+// =============================================================================
+// Dynamic buffers
+// =============================================================================
+//
+// sg.updateBuffer replaces a whole buffer, may run once per buffer per frame,
+// and rotates through num_inflight_frames GL buffers so the CPU never writes
+// storage the GPU may still be reading. Dynamic buffers keep a CPU mirror:
+// sub-range writes patch the mirror and commit() turns a frame's writes into
+// one rotation plus one ranged write. Each ring slot remembers the bytes it
+// missed while it was not current, so rotating to it only re-sends those.
+
+const ByteRange = webgl_program.ByteRange;
+const allocator = std.heap.page_allocator;
+const RingSlots: usize = sg.num_inflight_frames;
+/// Dirty ranges starting this close to 0 are folded into the rotating
+/// updateBuffer call instead of a separate ranged write.
+const RotateHeadBytes: u32 = 256;
+/// Smallest prefix the rotating updateBuffer call may write.
+const MinHeadBytes: u32 = 4;
+const NeverUpdated: u64 = std.math.maxInt(u64);
+
+const TrackedBuffer = struct {
+    capacity: u32,
+    /// Frame of the last sokol update; sokol allows one per frame.
+    updated_frame: u64 = NeverUpdated,
+    /// CPU mirror for dynamic buffers, null for static ones.
+    shadow: ?[]u8 = null,
+    /// Bytes written since the last commit.
+    pending: ByteRange = .{},
+    /// Bytes each ring slot is missing.
+    stale: [RingSlots]ByteRange = [_]ByteRange{.{}} ** RingSlots,
+};
+
+pub const DynamicBufferStats = struct {
+    rotations: u64 = 0,
+    ranged_writes: u64 = 0,
+    /// Every buffer byte handed to sokol or GL, dynamic or not
+    bytes_uploaded: u64 = 0,
+};
+
+/// Bytes sent to the GPU since start, for render statistics.
+pub const UploadStats = struct {
+    buffer_bytes: u64 = 0,
+    texture_bytes: u64 = 0,
+    /// Images created with contents plus in-place region writes
+    texture_uploads: u64 = 0,
+};
+
+var g_tracked: std.AutoHashMapUnmanaged(webgl.BufferBackend.Handle, TrackedBuffer) = .empty;
+var g_frame: u64 = 0;
+var g_dynamic_stats: DynamicBufferStats = .{};
+
+pub fn dynamicBufferStats() DynamicBufferStats {
+    return g_dynamic_stats;
+}
+
+pub fn uploadStats() UploadStats {
+    return .{
+        .buffer_bytes = g_dynamic_stats.bytes_uploaded,
+        .texture_bytes = g_texture_upload_bytes,
+        .texture_uploads = g_texture_uploads,
+    };
+}
+
+fn makeTracked(size: usize, usage: webgl.BufferUsage, dynamic: bool) webgl.BufferBackend.Handle {
+    const buf = sg.makeBuffer(.{
+        .size = size,
+        .usage = toUsage(usage),
+    });
+    if (buf.id == 0) return 0;
+    var tracked = TrackedBuffer{ .capacity = @intCast(size) };
+    if (dynamic) {
+        // Without a mirror the buffer still works, just without batching
+        if (allocator.alloc(u8, size)) |shadow| {
+            @memset(shadow, 0);
+            tracked.shadow = shadow;
+        } else |_| {
+            log.warn("createDynamic: no CPU mirror for {d} bytes", .{size});
+        }
+    }
+    g_tracked.put(allocator, buf.id, tracked) catch {
+        if (tracked.shadow) |shadow| allocator.free(shadow);
+    };
+    return buf.id;
+}
+
+/// Write into the GL buffer sokol will bind this frame, bypassing the
+/// once-per-frame update rule.
+fn writeActiveSlot(handle: webgl.BufferBackend.Handle, offset: usize, data: []const u8) void {
+    const info = sg.glQueryBufferInfo(.{ .id = handle });
+    const slot: usize = @intCast(info.active_slot);
+    if (!gl_uniforms.bufferSubData(info.buf[slot], offset, data)) {
+        log.warn("writeActiveSlot: direct GL unavailable, dropped {d} bytes", .{data.len});
+        return;
+    }
+    g_dynamic_stats.ranged_writes += 1;
+    g_dynamic_stats.bytes_uploaded += data.len;
+}
+
+const UploadPlan = struct {
+    /// Prefix written by the rotating updateBuffer call.
+    head: u32,
+    /// Range written afterwards into the new active slot.
+    tail: ByteRange,
+};
+
+fn planRingUpload(range: ByteRange) UploadPlan {
+    if (range.lo <= RotateHeadBytes) return .{ .head = range.hi, .tail = .{} };
+    return .{ .head = MinHeadBytes, .tail = range };
+}
+
+fn commit(_: ?*anyopaque) void {
+    defer g_frame +%= 1;
+    var it = g_tracked.iterator();
+    while (it.next()) |kv| {
+        const tracked = kv.value_ptr;
+        const shadow = tracked.shadow orelse continue;
+        if (tracked.pending.isEmpty() or tracked.updated_frame == g_frame) continue;
+        commitDynamic(kv.key_ptr.*, tracked, shadow);
+    }
+}
+
+fn commitDynamic(handle: webgl.BufferBackend.Handle, tracked: *TrackedBuffer, shadow: []const u8) void {
+    const buf = sg.Buffer{ .id = handle };
+    const info = sg.queryBufferInfo(buf);
+    const slots: usize = @min(@as(usize, @intCast(@max(info.num_slots, 1))), RingSlots);
+    const next = (@as(usize, @intCast(info.active_slot)) + 1) % slots;
+
+    var range = tracked.pending;
+    range.include(tracked.stale[next].lo, tracked.stale[next].hi);
+    const plan = planRingUpload(range);
+    sg.updateBuffer(buf, .{ .ptr = shadow.ptr, .size = plan.head });
+    g_dynamic_stats.rotations += 1;
+    g_dynamic_stats.bytes_uploaded += plan.head;
+    if (!plan.tail.isEmpty()) {
+        writeActiveSlot(handle, plan.tail.lo, shadow[plan.tail.lo..plan.tail.hi]);
+    }
+
+    for (tracked.stale[0..slots], 0..) |*stale, slot| {
+        if (slot == next) {
+            stale.* = .{};
+        } else {
+            stale.include(tracked.pending.lo, tracked.pending.hi);
+        }
+    }
+    tracked.pending = .{};
+    tracked.updated_frame = g_frame;
+}
+
 // =============================================================================
 // Texture Backend
 // =============================================================================
 
+var g_texture_upload_bytes: u64 = 0;
+var g_texture_uploads: u64 = 0;
+
 pub const TextureBackendError = error{
     InvalidDimensions,
     CreateFailed,
@@ -75,9 +263,11 @@ pub fn createTextureImage(
     height: u32,
     format: webgl_texture.TextureFormat,
     params: webgl_texture.TextureParams,
+    mip_count: u32,
     pixels: ?[]const u8,
 ) TextureBackendError!sg.Image {
     if (width == 0 or height == 0) return TextureBackendError.InvalidDimensions;
+    if (mip_count == 0 or mip_count > sg.max_mipmaps) return TextureBackendError.InvalidDimensions;
 
     const pixel_format = mapTextureFormat(format);
     const min_filter = mapFilter(params.min_filter);
@@ -85,7 +275,7 @@ pub fn createTextureImage(
     const wrap_u = mapWrap(params.wrap_s);
     const wrap_v = mapWrap(params.wrap_t);
 
-    log.info("createTextureImage: {d}x{d} format={s} pixel_format={s} min={s} mag={s}", .{
+    log.debug("createTextureImage: {d}x{d} format={s} pixel_format={s} min={s} mag={s}", .{
         width,
         height,
         @tagName(format),
@@ -99,7 +289,7 @@ pub fn createTextureImage(
         .width = @intCast(width),
         .height = @intCast(height),
         .pixel_format = pixel_format,
-        .num_mipmaps = 1, // Explicitly set to 1 for single mip level
+        .num_mipmaps = @intCast(mip_count),
         .usage = .{ .immutable = is_immutable },
     };
 
@@ -107,26 +297,165 @@ pub fn createTextureImage(
     _ = wrap_u;
     _ = wrap_v;
 
-    // If we have initial pixel data and texture is immutable, provide it
-    if (is_immutable) {
-        if (pixels) |px| {
-            desc.data.mip_levels[0] = .{
-                .ptr = px.ptr,
-                .size = px.len,
-            };
+    // Immutable images get every level up front; `pixels` packs the chain
+    // from level 0 down (webgl_texture.levelOffset)
+    var upload_bytes: usize = 0;
+    if (pixels) |px| {
+        for (0..mip_count) |i| {
+            const level: u32 = @intCast(i);
+            const offset = webgl_texture.levelOffset(format, width, height, level);
+            const size = webgl_texture.imageSize(
+                format,
+                webgl_texture.levelExtent(width, level),
+                webgl_texture.levelExtent(height, level),
+            );
+            if (offset + size > px.len) return TextureBackendError.InvalidDimensions;
+            desc.data.mip_levels[i] = .{ .ptr = px[offset..].ptr, .size = size };
+            upload_bytes += size;
         }
     }
 
     const img = sg.makeImage(desc);
     const state = sg.queryImageState(img);
-    log.info("createTextureImage: makeImage returned id={d} state={s}", .{ img.id, @tagName(state) });
+    log.debug("createTextureImage: makeImage returned id={d} state={s}", .{ img.id, @tagName(state) });
     if (img.id == 0 or state != .VALID) {
         return TextureBackendError.CreateFailed;
     }
+    if (pixels != null) {
+        g_texture_upload_bytes += upload_bytes;
+        g_texture_uploads += 1;
+    }
 
     return img;
 }
 
+/// Create an image that passes can draw into: a color or depth-stencil
+/// attachment with one level. Its contents start undefined. Single-sampled
+/// color images can also be resolved into, and images of textures sampled.
+pub fn createRenderTargetImage(width: u32, height: u32, pixel_format: sg.PixelFormat, sample_count: u32) TextureBackendError!sg.Image {
+    if (width == 0 or height == 0) return TextureBackendError.InvalidDimensions;
+    const depth = pixel_format == .DEPTH or pixel_format == .DEPTH_STENCIL;
+    const img = sg.makeImage(.{
+        .width = @intCast(width),
+        .height = @intCast(height),
+        .pixel_format = pixel_format,
+        .sample_count = @intCast(@max(sample_count, 1)),
+        .usage = .{
+            .color_attachment = !depth,
+            .resolve_attachment = !depth and sample_count <= 1,
+            .depth_stencil_attachment = depth,
+        },
+    });
+    log.debug("createRenderTargetImage: {d}x{d} pixel_format={s} samples={d} id={d}", .{ width, height, @tagName(pixel_format), sample_count, img.id });
+    if (img.id == 0 or sg.queryImageState(img) != .VALID) {
+        return TextureBackendError.CreateFailed;
+    }
+    return img;
+}
+
+/// Backend format a texture renders into, or null when the format is not
+/// renderable (luminance/alpha and compressed formats).
+pub fn renderTargetFormat(format: webgl_texture.TextureFormat) ?sg.PixelFormat {
+    return switch (format) {
+        .rgba, .rgb, .depth_component, .depth_stencil => mapTextureFormat(format),
+        else => null,
+    };
+}
+
+/// Write `rect` of `pixels` (the full, tightly packed level-0 copy `row_texels`
+/// wide) into an existing image with glTexSubImage2D, keeping the image and its
+/// views alive. Returns false when direct GL is unavailable so callers can fall
+/// back to recreating the image.
+pub fn updateTextureRegion(
+    image: sg.Image,
+    format: webgl_texture.TextureFormat,
+    row_texels: u32,
+    rect: webgl_texture.TexRect,
+    pixels: []const u8,
+) bool {
+    if (image.id == 0 or !gl_uniforms.isAvailable()) return false;
+    if (webgl_texture.isCompressed(format)) return false;
+    if (rect.isEmpty()) return true;
+    const info = sg.glQueryImageInfo(image);
+    const gl_tex = info.tex[@intCast(info.active_slot)];
+    if (gl_tex == 0) return false;
+
+    const bpp: usize = webgl_texture.bytesPerPixel(format);
+    const offset = (@as(usize, rect.y0) * row_texels + rect.x0) * bpp;
+    const end = offset + ((@as(usize, rect.height()) - 1) * row_texels + rect.width()) * bpp;
+    if (end > pixels.len) return false;
+    if (!gl_uniforms.texSubImage2D(
+        gl_tex,
+        info.tex_target,
+        rect.x0,
+        rect.y0,
+        rect.width(),
+        rect.height(),
+        mapUploadFormat(format),
+        row_texels,
+        pixels[offset..end],
+    )) return false;
+    g_texture_upload_bytes += bpp * rect.width() * rect.height();
+    g_texture_uploads += 1;
+    return true;
+}
+
+/// Write a tightly packed `rect` of pixels into level 0 of an existing
+/// image, for textures whose CPU copy was released after upload. False
+/// when direct GL is unavailable.
+pub fn writeTextureRect(
+    image: sg.Image,
+    format: webgl_texture.TextureFormat,
+    rect: webgl_texture.TexRect,
+    pixels: []const u8,
+) bool {
+    if (image.id == 0 or !gl_uniforms.isAvailable()) return false;
+    if (webgl_texture.isCompressed(format)) return false;
+    if (rect.isEmpty()) return true;
+    const bpp: usize = webgl_texture.bytesPerPixel(format);
+    const size = bpp * rect.width() * rect.height();
+    if (size > pixels.len) return false;
+    const info = sg.glQueryImageInfo(image);
+    const gl_tex = info.tex[@intCast(info.active_slot)];
+    if (gl_tex == 0) return false;
+    if (!gl_uniforms.texSubImage2D(
+        gl_tex,
+        info.tex_target,
+        rect.x0,
+        rect.y0,
+        rect.width(),
+        rect.height(),
+        mapUploadFormat(format),
+        rect.width(),
+        pixels[0..size],
+    )) return false;
+    g_texture_upload_bytes += size;
+    g_texture_uploads += 1;
+    return true;
+}
+
+/// Rebuild an image's mip levels from its level 0 on the GPU.
+pub fn generateTextureMipmaps(image: sg.Image) bool {
+    if (image.id == 0 or !gl_uniforms.isAvailable()) return false;
+    const info = sg.glQueryImageInfo(image);
+    const gl_tex = info.tex[@intCast(info.active_slot)];
+    if (gl_tex == 0) return false;
+    return gl_uniforms.generateMipmap(gl_tex, info.tex_target);
+}
+
+/// Client pixel format matching mapTextureFormat's storage format.
+fn mapUploadFormat(format: webgl_texture.TextureFormat) c_uint {
+    const GL_RGBA: c_uint = 0x1908;
+    const GL_RG: c_uint = 0x8227;
+    const GL_RED: c_uint = 0x1903;
+    return switch (format) {
+        .rgba, .rgb => GL_RGBA,
+        .luminance_alpha => GL_RG,
+        .luminance, .alpha => GL_RED,
+        else => 0, // Compressed images are never patched in place
+    };
+}
+
 /// Create a texture view for binding
 pub fn createTextureView(image: sg.Image) TextureBackendError!sg.View {
     if (image.id == 0) return TextureBackendError.CreateFailed;
@@ -135,7 +464,7 @@ pub fn createTextureView(image: sg.Image) TextureBackendError!sg.View {
         .texture = .{ .image = image },
     });
 
-    log.info("createTextureView: for image_id={d} returned view_id={d}", .{ image.id, view.id });
+    log.debug("createTextureView: for image_id={d} returned view_id={d}", .{ image.id, view.id });
 
     if (view.id == 0) {
         return TextureBackendError.ViewCreateFailed;
@@ -144,14 +473,109 @@ pub fn createTextureView(image: sg.Image) TextureBackendError!sg.View {
     return view;
 }
 
-/// Create a sampler with the given parameters
-pub fn createTextureSampler(params: webgl_texture.TextureParams) sg.Sampler {
+/// Create a sampler for an image with `mip_count` levels
+pub fn createTextureSampler(params: webgl_texture.TextureParams, mip_count: u32) sg.Sampler {
+    const mipmapped = mip_count > 1 and isMipmapFilter(params.min_filter);
     return sg.makeSampler(.{
         .min_filter = mapFilter(params.min_filter),
         .mag_filter = mapMagFilter(params.mag_filter),
+        .mipmap_filter = mapMipmapFilter(params.min_filter),
+        // sokol samplers always pick a mip level and treat a max_lod of 0 as
+        // unlimited; clamping just above 0 keeps plain NEAREST/LINEAR on level 0
+        .max_lod = if (mipmapped) @floatFromInt(mip_count - 1) else 0.25,
         .wrap_u = mapWrap(params.wrap_s),
         .wrap_v = mapWrap(params.wrap_t),
+        // NEVER turns comparison off (TEXTURE_COMPARE_MODE NONE)
+        .compare = if (params.compare_ref) mapCompareFunc(params.compare_func) else .NEVER,
+    });
+}
+
+/// How a shader texture slot can sample a texture. sokol checks the slot's
+/// declared sample type against every bound texture; plain GL never did.
+pub const TextureSampling = enum {
+    /// Filterable format: FLOAT view with a FILTERING sampler
+    filtering,
+    /// Unfilterable format (depth) with NEAREST filtering: UNFILTERABLE_FLOAT
+    /// view with a NONFILTERING sampler
+    nonfiltering,
+    /// Depth format with TEXTURE_COMPARE_MODE: DEPTH view with a COMPARISON
+    /// sampler, for sampler2DShadow only
+    comparison,
+    /// Nothing a slot can bind: no image yet, multisampled, or linear
+    /// filtering of an unfilterable format, which WebGL2 treats as incomplete
+    incomplete,
+};
+
+pub fn textureSampling(tex: *const webgl_texture.Texture) TextureSampling {
+    if (tex.backend.id == 0 or tex.backend_view.id == 0 or tex.backend_sampler.id == 0) return .incomplete;
+    if (sg.queryImageSampleCount(tex.backend) > 1) return .incomplete;
+    const info = sg.queryPixelformat(sg.queryImagePixelformat(tex.backend));
+    if (tex.params.compare_ref) return if (info.depth) .comparison else .incomplete;
+    if (info.filter) return .filtering;
+    return if (samplesNearest(tex.params)) .nonfiltering else .incomplete;
+}
+
+/// Whether createTextureSampler gives `params` no LINEAR filter at all
+fn samplesNearest(params: webgl_texture.TextureParams) bool {
+    return mapFilter(params.min_filter) == .NEAREST and
+        mapMagFilter(params.mag_filter) == .NEAREST and
+        mapMipmapFilter(params.min_filter) == .NEAREST;
+}
+
+/// Bound in place of a texture a slot cannot sample
+pub const PlaceholderTexture = struct {
+    image: sg.Image = .{},
+    view: sg.View = .{},
+    sampler: sg.Sampler = .{},
+};
+
+/// One placeholder per kind of slot: sampler2D, samplerCube, sampler2DShadow
+pub const PlaceholderKind = enum { color_2d, color_cube, depth };
+
+/// Color placeholders are 1x1 opaque black, which is what WebGL samples from
+/// an incomplete texture; a filterable format with NEAREST filtering fits
+/// either sample type. The depth one is cleared to 1.0, so comparisons read
+/// it as unshadowed. Call outside a pass: clearing it takes a pass.
+pub fn createPlaceholderTexture(kind: PlaceholderKind) TextureBackendError!PlaceholderTexture {
+    if (kind == .depth) return createDepthPlaceholder();
+    const black = [_]u8{ 0, 0, 0, 255 } ** 6;
+    const slices: usize = if (kind == .color_cube) 6 else 1;
+    var desc = sg.ImageDesc{
+        .type = if (kind == .color_cube) .CUBE else ._2D,
+        .width = 1,
+        .height = 1,
+        .num_slices = @intCast(slices),
+        .pixel_format = .RGBA8,
+    };
+    desc.data.mip_levels[0] = .{ .ptr = &black, .size = 4 * slices };
+    const image = sg.makeImage(desc);
+    if (image.id == 0 or sg.queryImageState(image) != .VALID) {
+        return TextureBackendError.CreateFailed;
+    }
+    errdefer destroyTextureImage(image);
+    const view = try createTextureView(image);
+    return .{ .image = image, .view = view, .sampler = sg.makeSampler(.{}) };
+}
+
+fn createDepthPlaceholder() TextureBackendError!PlaceholderTexture {
+    const image = try createRenderTargetImage(1, 1, .DEPTH, 1);
+    errdefer destroyTextureImage(image);
+    const target = sg.makeView(.{ .depth_stencil_attachment = .{ .image = image } });
+    if (target.id == 0) return TextureBackendError.ViewCreateFailed;
+    defer destroyTextureView(target);
+    sg.beginPass(.{
+        .action = .{ .depth = .{ .load_action = .CLEAR, .clear_value = 1.0 } },
+        .attachments = .{ .depth_stencil = target },
     });
+    sg.endPass();
+    const view = try createTextureView(image);
+    return .{ .image = image, .view = view, .sampler = sg.makeSampler(.{ .compare = .LESS_EQUAL }) };
+}
+
+pub fn destroyPlaceholderTexture(placeholder: PlaceholderTexture) void {
+    destroyTextureSampler(placeholder.sampler);
+    destroyTextureView(placeholder.view);
+    destroyTextureImage(placeholder.image);
 }
 
 /// Destroy a texture image
@@ -182,9 +606,43 @@ fn mapTextureFormat(format: webgl_texture.TextureFormat) sg.PixelFormat {
         .luminance_alpha => .RG8,
         .luminance => .R8,
         .alpha => .R8,
+        .depth_component => .DEPTH,
+        .depth_stencil => .DEPTH_STENCIL,
+        // DXT1 without alpha decodes the same blocks; sokol has no RGB variant
+        .bc1_rgb, .bc1_rgba => .BC1_RGBA,
+        .bc2_rgba => .BC2_RGBA,
+        .bc3_rgba => .BC3_RGBA,
+        .bc4_r => .BC4_R,
+        .bc4_r_snorm => .BC4_RSN,
+        .bc5_rg => .BC5_RG,
+        .bc5_rg_snorm => .BC5_RGSN,
+        .bc6h_rgb_float => .BC6H_RGBF,
+        .bc6h_rgb_ufloat => .BC6H_RGBUF,
+        .bc7_rgba => .BC7_RGBA,
+        .bc7_srgba => .BC7_SRGBA,
+        .eac_r11 => .EAC_R11,
+        .eac_r11_snorm => .EAC_R11SN,
+        .eac_rg11 => .EAC_RG11,
+        .eac_rg11_snorm => .EAC_RG11SN,
+        .etc2_rgb8 => .ETC2_RGB8,
+        .etc2_srgb8 => .ETC2_SRGB8,
+        .etc2_rgb8a1 => .ETC2_RGB8A1,
+        .etc2_rgba8 => .ETC2_RGBA8,
+        .etc2_srgb8a8 => .ETC2_SRGB8A8,
+        .astc_4x4_rgba => .ASTC_4x4_RGBA,
+        .astc_4x4_srgba => .ASTC_4x4_SRGBA,
     };
 }
 
+/// Whether the GPU can sample `format`. Uncompressed formats always work;
+/// compressed ones depend on driver extensions and report false until the
+/// backend is up.
+pub fn supportsTextureFormat(format: webgl_texture.TextureFormat) bool {
+    if (!webgl_texture.isCompressed(format)) return true;
+    if (!sg.isvalid()) return false;
+    return sg.queryPixelformat(mapTextureFormat(format)).sample;
+}
+
 fn mapFilter(filter: webgl_texture.TextureFilter) sg.Filter {
     return switch (filter) {
         .nearest => .NEAREST,
@@ -196,6 +654,21 @@ fn mapFilter(filter: webgl_texture.TextureFilter) sg.Filter {
     };
 }
 
+fn isMipmapFilter(filter: webgl_texture.TextureFilter) bool {
+    return switch (filter) {
+        .nearest, .linear => false,
+        else => true,
+    };
+}
+
+/// How levels are blended: the second half of GL's *_MIPMAP_* names.
+fn mapMipmapFilter(filter: webgl_texture.TextureFilter) sg.Filter {
+    return switch (filter) {
+        .nearest_mipmap_linear, .linear_mipmap_linear => .LINEAR,
+        else => .NEAREST,
+    };
+}
+
 fn mapMagFilter(filter: webgl_texture.TextureFilter) sg.Filter {
     // Mag filter doesn't support mipmap modes
     return switch (filter) {
@@ -204,6 +677,21 @@ fn mapMagFilter(filter: webgl_texture.TextureFilter) sg.Filter {
     };
 }
 
+/// Depth comparison of shadow samplers; GL compare enums are 0x0200 + n.
+fn mapCompareFunc(gl_func: u32) sg.CompareFunc {
+    return switch (gl_func) {
+        0x0200 => .NEVER,
+        0x0201 => .LESS,
+        0x0202 => .EQUAL,
+        0x0203 => .LESS_EQUAL,
+        0x0204 => .GREATER,
+        0x0205 => .NOT_EQUAL,
+        0x0206 => .GREATER_EQUAL,
+        0x0207 => .ALWAYS,
+        else => .LESS_EQUAL,
+    };
+}
+
 fn mapWrap(wrap: webgl_texture.TextureWrap) sg.Wrap {
     return switch (wrap) {
         .repeat => .REPEAT,
@@ -211,3 +699,33 @@ fn mapWrap(wrap: webgl_texture.TextureWrap) sg.Wrap {
         .mirrored_repeat => .MIRRORED_REPEAT,
     };
 }
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "Ring upload folds low ranges into the rotating write" {
+    const low = planRingUpload(.{ .lo = 16, .hi = 640 });
+    try testing.expectEqual(@as(u32, 640), low.head);
+    try testing.expect(low.tail.isEmpty());
+
+    const high = planRingUpload(.{ .lo = 4096, .hi = 8192 });
+    try testing.expectEqual(MinHeadBytes, high.head);
+    try testing.expectEqual(@as(u32, 4096), high.tail.lo);
+    try testing.expectEqual(@as(u32, 8192), high.tail.hi);
+}
+
+test "Unfilterable textures sample only with nearest filters" {
+    var params = webgl_texture.TextureParams{};
+    params.min_filter = .nearest;
+    params.mag_filter = .nearest;
+    try testing.expect(samplesNearest(params));
+    params.min_filter = .nearest_mipmap_nearest;
+    try testing.expect(samplesNearest(params));
+    // The level blend is linear even though each level is sampled nearest
+    params.min_filter = .nearest_mipmap_linear;
+    try testing.expect(!samplesNearest(params));
+    params.min_filter = .nearest;
+    params.mag_filter = .linear;
+    try testing.expect(!samplesNearest(params));
+}
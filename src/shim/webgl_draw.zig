@@ -11,7 +11,13 @@ const webgl = @import("webgl.zig");
 const webgl_state = @import("webgl_state.zig");
 const webgl_program = @import("webgl_program.zig");
 const webgl_texture = @import("webgl_texture.zig");
+const webgl_framebuffer = @import("webgl_framebuffer.zig");
+const webgl_query = @import("webgl_query.zig");
+const webgl_readback = @import("webgl_readback.zig");
 const gl_uniforms = @import("gl_uniforms.zig");
+const profiler = @import("profiler.zig");
+const webgl_backend = @import("webgl_backend.zig");
+const build_options = @import("build_options");
 
 // Scoped logger for draw queue debug tracing
 const log = std.log.scoped(.webgl_draw);
@@ -54,20 +60,171 @@ const GL_ONE_MINUS_CONSTANT_COLOR: u32 = 0x8002;
 const GL_CONSTANT_ALPHA: u32 = 0x8003;
 const GL_ONE_MINUS_CONSTANT_ALPHA: u32 = 0x8004;
 const GL_FUNC_ADD: u32 = 0x8006;
+const GL_UNSIGNED_SHORT: u32 = 0x1403;
+const GL_UNSIGNED_INT: u32 = 0x1405;
 const GL_FUNC_SUBTRACT: u32 = 0x800A;
 const GL_FUNC_REVERSE_SUBTRACT: u32 = 0x800B;
 
 pub const MaxVertexAttribs: usize = 16;
-pub const MaxDrawCommands: usize = 64;
+/// Vertex array objects beyond the default one, with handles 1..MaxVertexArrays.
+pub const MaxVertexArrays: usize = 64;
+/// Upper bound on draws recorded between flushes; a guard against runaway
+/// recording rather than a working limit.
+pub const MaxDrawCommands: usize = 1 << 20;
+/// Draws one multiDraw*WEBGL call may name
+pub const MaxMultiDrawRanges: usize = 4096;
 const MaxVertexBuffers: usize = (sg.Bindings{}).vertex_buffers.len;
-const MaxPipelineCacheEntries: usize = 64;
+/// Live pipelines kept before the least recently used one is evicted.
+pub const DefaultPipelineCacheCapacity: usize = 256;
+
+const command_allocator = std.heap.page_allocator;
+
+/// Pipeline cache counters, cumulative since the last reset().
+pub const PipelineCacheStats = struct {
+    hits: u64 = 0,
+    misses: u64 = 0,
+    evictions: u64 = 0,
+    failures: u64 = 0,
+    live: u32 = 0,
+    capacity: u32 = 0,
+};
 
-const PipelineCacheEntry = struct {
+pub const PipelineCacheEntry = struct {
     key: u64 = 0,
     pipeline: sg.Pipeline = .{},
+    /// Neighbours on the recency list, as slot indices (no_slot at the ends)
+    newer: u32 = no_slot,
+    older: u32 = no_slot,
     valid: bool = false,
 };
 
+const no_slot = std.math.maxInt(u32);
+
+/// Open-addressed (linear probing) map from pipelineKey() to sokol pipeline
+/// with least-recently-used eviction once `capacity` pipelines are live.
+/// The slot table is kept at least twice the capacity so probes stay short.
+/// Live entries are also threaded on an intrusive recency list, so a hit
+/// and an eviction are both O(1).
+pub const PipelineCache = struct {
+    slots: []PipelineCacheEntry = &.{},
+    capacity: usize = DefaultPipelineCacheCapacity,
+    count: usize = 0,
+    /// Most and least recently used slots
+    newest: u32 = no_slot,
+    oldest: u32 = no_slot,
+    stats: PipelineCacheStats = .{},
+
+    const Self = @This();
+
+    pub fn find(self: *Self, key: u64) ?*PipelineCacheEntry {
+        if (self.slots.len == 0) return null;
+        const mask = self.slots.len - 1;
+        var idx = homeSlot(key, mask);
+        while (self.slots[idx].valid) : (idx = (idx + 1) & mask) {
+            if (self.slots[idx].key == key) {
+                const slot: u32 = @intCast(idx);
+                self.unlink(slot);
+                self.pushNewest(slot);
+                return &self.slots[idx];
+            }
+        }
+        return null;
+    }
+
+    /// Insert a pipeline the caller has verified is not cached. Returns the
+    /// evicted pipeline, if any, so the caller can destroy it.
+    pub fn insert(self: *Self, key: u64, pipeline: sg.Pipeline) !?sg.Pipeline {
+        try self.ensureSlots();
+        var evicted: ?sg.Pipeline = null;
+        if (self.count >= self.capacity) {
+            evicted = self.evictLru();
+        }
+        const mask = self.slots.len - 1;
+        var idx = homeSlot(key, mask);
+        while (self.slots[idx].valid) : (idx = (idx + 1) & mask) {}
+        self.slots[idx] = .{ .key = key, .pipeline = pipeline, .valid = true };
+        self.pushNewest(@intCast(idx));
+        self.count += 1;
+        return evicted;
+    }
+
+    fn ensureSlots(self: *Self) !void {
+        if (self.slots.len > 0) return;
+        const len = try std.math.ceilPowerOfTwo(usize, @max(self.capacity * 2, 4));
+        if (len >= no_slot) return error.OutOfMemory;
+        self.slots = try command_allocator.alloc(PipelineCacheEntry, len);
+        @memset(self.slots, .{});
+    }
+
+    fn evictLru(self: *Self) ?sg.Pipeline {
+        if (self.oldest == no_slot) return null;
+        const idx = self.oldest;
+        const pipeline = self.slots[idx].pipeline;
+        self.removeAt(idx);
+        self.stats.evictions += 1;
+        return pipeline;
+    }
+
+    fn pushNewest(self: *Self, slot: u32) void {
+        self.slots[slot].older = self.newest;
+        self.slots[slot].newer = no_slot;
+        if (self.newest != no_slot) self.slots[self.newest].newer = slot else self.oldest = slot;
+        self.newest = slot;
+    }
+
+    fn unlink(self: *Self, slot: u32) void {
+        const entry = self.slots[slot];
+        if (entry.newer != no_slot) self.slots[entry.newer].older = entry.older else self.newest = entry.older;
+        if (entry.older != no_slot) self.slots[entry.older].newer = entry.newer else self.oldest = entry.newer;
+    }
+
+    /// Point the neighbours of an entry that moved to `to` at its new slot.
+    fn relink(self: *Self, to: u32) void {
+        const entry = self.slots[to];
+        if (entry.newer != no_slot) self.slots[entry.newer].older = to else self.newest = to;
+        if (entry.older != no_slot) self.slots[entry.older].newer = to else self.oldest = to;
+    }
+
+    /// Backward-shift deletion: pull later probe-chain members into the hole
+    /// so lookups never need tombstones. Moved entries keep their place on
+    /// the recency list.
+    fn removeAt(self: *Self, start: usize) void {
+        self.unlink(@intCast(start));
+        const mask = self.slots.len - 1;
+        var hole = start;
+        var idx = start;
+        while (true) {
+            idx = (idx + 1) & mask;
+            if (!self.slots[idx].valid) break;
+            const home = homeSlot(self.slots[idx].key, mask);
+            const stays = if (hole <= idx) (hole < home and home <= idx) else (hole < home or home <= idx);
+            if (!stays) {
+                self.slots[hole] = self.slots[idx];
+                self.relink(@intCast(hole));
+                hole = idx;
+            }
+        }
+        self.slots[hole] = .{};
+        self.count -= 1;
+    }
+
+    fn homeSlot(key: u64, mask: usize) usize {
+        return @intCast((key ^ (key >> 32)) & mask);
+    }
+
+    /// Drop every entry (destroying backend pipelines) and free the table.
+    pub fn deinit(self: *Self) void {
+        for (self.slots) |entry| {
+            if (entry.valid) destroyPipeline(entry.pipeline);
+        }
+        if (self.slots.len > 0) command_allocator.free(self.slots);
+        self.slots = &.{};
+        self.count = 0;
+        self.newest = no_slot;
+        self.oldest = no_slot;
+    }
+};
+
 pub const VertexAttrib = struct {
     enabled: bool = false,
     size: u8 = 0,
@@ -76,6 +233,8 @@ pub const VertexAttrib = struct {
     stride: u32 = 0,
     offset: u32 = 0,
     buffer: ?webgl.BufferId = null,
+    /// Instances per element; 0 advances per vertex (vertexAttribDivisor)
+    divisor: u32 = 0,
 };
 
 const DrawKind = enum {
@@ -83,65 +242,97 @@ const DrawKind = enum {
     elements,
 };
 
+/// One draw of a multi-draw: vertices [first, first + count) for arrays,
+/// for elements `count` indices from index `first` of the bound index
+/// buffer (multiDrawElements takes byte offsets and converts them).
+pub const DrawRange = struct {
+    first: i32,
+    count: i32,
+    instance_count: i32 = 1,
+};
+
+/// One recorded draw. Bulky state lives in per-frame interned blocks and is
+/// referenced by index, keeping the command itself small.
 const DrawCommand = struct {
     kind: DrawKind,
     mode: u32,
     first: i32,
     count: i32,
+    instance_count: i32,
     index_type: u32,
     index_offset: u32,
     program: webgl_program.ProgramId,
-    attribs: [MaxVertexAttribs]VertexAttrib,
     element_buffer: ?webgl.BufferId,
     viewport: [4]i32,
     scissor: [4]i32,
     scissor_enabled: bool,
-    depth_enabled: bool,
-    depth_func: u32,
-    depth_mask: bool,
-    polygon_offset: [2]f32,
-    polygon_offset_enabled: bool,
-    cull_enabled: bool,
-    cull_face: u32,
-    front_face: u32,
-    blend_enabled: bool,
-    blend_src: u32,
-    blend_dst: u32,
-    blend_src_alpha: u32,
-    blend_dst_alpha: u32,
-    blend_eq: u32,
-    blend_eq_alpha: u32,
-    color_mask: [4]bool,
-    alpha_to_coverage_enabled: bool,
-    stencil_enabled: bool,
-    stencil_func_front: u32,
-    stencil_func_back: u32,
-    stencil_ref_front: u8,
-    stencil_ref_back: u8,
-    stencil_read_mask_front: u8,
-    stencil_read_mask_back: u8,
-    stencil_write_mask_front: u8,
-    stencil_write_mask_back: u8,
-    stencil_fail_front: u32,
-    stencil_zfail_front: u32,
-    stencil_zpass_front: u32,
-    stencil_fail_back: u32,
-    stencil_zfail_back: u32,
-    stencil_zpass_back: u32,
-    // Texture bindings (captured at draw time)
-    bound_textures_2d: [webgl_texture.MaxTextureUnits]?webgl_texture.TextureId,
+    render_state: u32,
+    vertex_state: u32,
+    texture_state: u32,
+    /// Index into DrawState.uniform_snapshots, or NoUniformSnapshot
+    uniforms: u32,
+    /// Index into DrawState.uniform_buffer_states, or NoUniformBuffers
+    uniform_buffers: u32,
+    /// Index into DrawState.passes
+    pass: u32,
+    /// A multi-draw draws DrawState.draw_ranges [range_first, range_first +
+    /// range_count) instead of first/count, with the state applied once
+    range_first: u32 = 0,
+    range_count: u32 = 0,
+    // Derived at record time by finalizeCommand()
+    state_hash: u64 = 0,
+    sort_key: u64 = 0,
+    reorderable: bool = false,
 };
 
-const DrawState = struct {
-    current_program: ?webgl_program.ProgramId = null,
-    attribs: [MaxVertexAttribs]VertexAttrib = [_]VertexAttrib{.{}} ** MaxVertexAttribs,
-    commands: [MaxDrawCommands]DrawCommand = undefined,
-    command_count: usize = 0,
-    pipeline_cache: [MaxPipelineCacheEntries]PipelineCacheEntry = [_]PipelineCacheEntry{.{}} ** MaxPipelineCacheEntries,
-    pipeline_cache_next: usize = 0,
-    viewport: [4]i32 = .{ 0, 0, 0, 0 },
-    scissor: [4]i32 = .{ 0, 0, 0, 0 },
-    scissor_enabled: bool = false,
+/// Counters from the most recent flush, used to spot redundant state churn.
+pub const FlushStats = struct {
+    commands: u32 = 0,
+    passes: u32 = 0,
+    draws: u32 = 0,
+    reordered: u32 = 0,
+    pipeline_applies: u32 = 0,
+    binding_applies: u32 = 0,
+    uniform_applies: u32 = 0,
+    uniform_snapshots: u32 = 0,
+    uniform_snapshot_bytes: u32 = 0,
+    uniform_buffer_applies: u32 = 0,
+    uniform_buffer_bytes: u32 = 0,
+    viewport_applies: u32 = 0,
+    scissor_applies: u32 = 0,
+    texture_applies: u32 = 0,
+    /// Pipelines created since the previous flush
+    pipeline_misses: u32 = 0,
+    /// Bytes sent to the GPU since the previous flush, uploads made while
+    /// JS ran included
+    buffer_upload_bytes: u64 = 0,
+    texture_upload_bytes: u64 = 0,
+    texture_uploads: u32 = 0,
+};
+
+/// State last emitted to sokol within a flush; anything equal is skipped.
+const AppliedState = struct {
+    valid: bool = false,
+    state_hash: u64 = 0,
+    program: webgl_program.ProgramId = .{ .index = 0, .generation = 0 },
+    /// Backend shader the pipeline was made for; a program switches shader
+    /// when a texture slot changes sample type
+    shader: u32 = 0,
+    pipeline: sg.Pipeline = .{},
+    bindings: sg.Bindings = .{},
+    viewport: ?[4]i32 = null,
+    scissor: ?[4]i32 = null,
+    /// Texture state block and program `textures` was resolved for
+    texture_state: u32 = NoTextureState,
+    texture_program: webgl_program.ProgramId = .{ .index = 0, .generation = 0 },
+    textures: SlotTextures = .{},
+    uniforms: u32 = NoUniformSnapshot,
+    uniform_buffers: u32 = NoUniformBuffers,
+};
+
+/// Fixed-function state that feeds the sokol pipeline. Interned per frame
+/// so consecutive draws with unchanged state share one block.
+const RenderState = struct {
     depth_enabled: bool = false,
     depth_func: u32 = GL_LESS,
     depth_mask: bool = true,
@@ -174,18 +365,239 @@ const DrawState = struct {
     stencil_fail_back: u32 = GL_KEEP,
     stencil_zfail_back: u32 = GL_KEEP,
     stencil_zpass_back: u32 = GL_KEEP,
+};
+
+/// A vertex array object: attribute state, the element buffer binding and
+/// the layout resolved from them, kept until an attribute changes. Entry 0
+/// is the default vertex array, bound whenever no VAO is.
+const VertexArray = struct {
+    live: bool = false,
+    attribs: [MaxVertexAttribs]VertexAttrib = [_]VertexAttrib{.{}} ** MaxVertexAttribs,
+    element_buffer: ?webgl.BufferId = null,
+    state: VertexState = .{},
+    state_valid: bool = false,
+    /// Index of this frame's copy of `state` in DrawState.vertex_states,
+    /// valid while `interned_frame` equals DrawState.frame
+    interned: u32 = 0,
+    interned_frame: u32 = 0,
+
+    fn invalidate(self: *VertexArray) void {
+        self.state_valid = false;
+        self.interned_frame = 0;
+    }
+};
+
+const VertexError = error{
+    MissingVertexBuffer,
+    InvalidAttribFormat,
+    TooManyVertexBuffers,
+    InvalidStride,
+    InconsistentStride,
+    InvalidBuffer,
+    BufferNotReady,
+    DivisorTooLarge,
+};
+
+/// sokol's GL backend keeps a buffer's step rate as an int8_t
+const MaxVertexDivisor = std.math.maxInt(i8);
+
+/// Vertex layout resolved from a vertex array's attributes, interned per
+/// frame and shared by every draw recorded while the array is unchanged.
+/// Copied into each draw's pipeline desc and bindings as is.
+const VertexState = struct {
+    layout: sg.VertexLayoutState = .{},
+    slot_buffers: [MaxVertexBuffers]webgl.BufferId = undefined,
+    slot_count: u8 = 0,
+    /// Hash of the attributes it was resolved from
+    hash: u64 = 0,
+    /// First problem with the attributes; draws using them are skipped
+    problem: ?VertexError = null,
+    /// Backend handles of `slot_buffers`, looked up again only when the
+    /// buffer table's backend epoch moves past `bindings_epoch`
+    vertex_buffers: [MaxVertexBuffers]sg.Buffer = [_]sg.Buffer{.{}} ** MaxVertexBuffers,
+    bindings_epoch: ?u32 = null,
+    bindings_problem: ?VertexError = null,
+};
+
+/// 2D texture unit bindings captured at draw time.
+const TextureState = [webgl_texture.MaxTextureUnits]?webgl_texture.TextureId;
+
+const NoTextureState: u32 = std.math.maxInt(u32);
+
+/// View and sampler bound for each of a program's texture slots
+/// (webgl_program.TextureSlot), filled by resolveTextures
+const SlotTextures = struct {
+    views: [webgl_program.MaxTextureSlots]sg.View = [_]sg.View{.{}} ** webgl_program.MaxTextureSlots,
+    samplers: [webgl_program.MaxTextureSlots]sg.Sampler = [_]sg.Sampler{.{}} ** webgl_program.MaxTextureSlots,
+};
+
+/// Uniform bytes of one program captured at draw time. Object- and frame-
+/// scope bytes are spans of DrawState.uniform_bytes copied independently:
+/// each is copied only when it changed since the program's previous draw,
+/// and otherwise shared with that draw's snapshot. A shadow or render-target
+/// pass that swaps the camera thus copies the camera uniforms once per pass.
+const UniformSnapshot = struct {
+    program: webgl_program.ProgramId,
+    object: [2]UniformSpan = .{ .{}, .{} },
+    frame: [2]UniformSpan = .{ .{}, .{} },
+
+    fn span(self: *UniformSnapshot, scope: webgl_program.UniformScope) *[2]UniformSpan {
+        return if (scope == .object) &self.object else &self.frame;
+    }
+};
+
+/// Bytes of one stage and scope (index 0 vertex, 1 fragment)
+const UniformSpan = struct {
+    offset: u32 = 0,
+    len: u32 = 0,
+};
+
+const NoUniformSnapshot: u32 = std.math.maxInt(u32);
+
+/// Uniform buffer ranges a program's blocks read, captured at draw time:
+/// slot i backs block i, which the program reads from GL slot i. Offsets
+/// are into DrawState.uniform_buffer_bytes, uploaded as one GL buffer at
+/// flush, so each draw only binds a range of it.
+const UniformBufferState = struct {
+    count: u8 = 0,
+    slots: [webgl_program.MaxUniformBufferBlocks]UniformBufferSlot = [_]UniformBufferSlot{.{}} ** webgl_program.MaxUniformBufferBlocks,
+};
+
+/// An empty slot (nothing usable bound) is left unbound.
+const UniformBufferSlot = struct {
+    offset: u32 = 0,
+    size: u32 = 0,
+};
+
+const NoUniformBuffers: u32 = std.math.maxInt(u32);
+
+/// Where this frame last copied the range bound at one binding point; the
+/// copy is reused until the binding or the buffer's contents change.
+const UniformBufferCopy = struct {
+    frame: u32 = 0,
+    binding: webgl_state.UniformBufferBinding = .{},
+    update_count: u32 = 0,
+    slot: UniformBufferSlot = .{},
+};
+
+/// A run of commands drawn into one target, in recording order. A pass
+/// starts when the bound draw framebuffer or its attachments change, and
+/// when a clear follows draws: a clear can only be a pass's load action.
+const PassRecord = struct {
+    target: webgl_framebuffer.DrawTarget,
+    /// Buffers cleared when the pass begins; everything else is loaded
+    clear_mask: u32 = 0,
+    clear_color: sg.Color = .{},
+    clear_depth: f32 = 1.0,
+    clear_stencil: u8 = 0,
+    /// Commands [first_command, end_command) belong to this pass
+    first_command: u32,
+    end_command: u32,
+    /// Single-sampled color the multisampled color resolves into when the
+    /// pass ends; a pass with a resolve takes no more draws
+    resolve: webgl_framebuffer.Attachment = .none,
+    /// Readbacks [readback_first, readback_end) of DrawState.readbacks run
+    /// after the pass's commands; a pass with readbacks takes no more draws
+    readback_first: u32 = 0,
+    readback_end: u32 = 0,
+
+    fn hasReadbacks(self: *const PassRecord) bool {
+        return self.readback_end > self.readback_first;
+    }
+};
+
+/// A query begin, end or timestamp recorded between draws. At flush it is
+/// emitted before the command recorded at `position`, or after the last
+/// pass when no command follows it.
+const QueryMarker = struct {
+    position: u32,
+    issue: u32,
+    action: webgl_query.Action,
+};
+
+const DrawState = struct {
+    current_program: ?webgl_program.ProgramId = null,
+    vertex_arrays: [MaxVertexArrays + 1]VertexArray = [_]VertexArray{.{}} ** (MaxVertexArrays + 1),
+    bound_vertex_array: u32 = 0,
+    /// Where createVertexArray() starts looking for a free handle
+    next_vertex_array: u32 = 1,
+    /// Flush counter; never 0, so a reset VertexArray.interned_frame is stale
+    frame: u32 = 1,
+    render: RenderState = .{},
+    // Per-frame command stream; capacity is retained across flushes
+    commands: std.ArrayList(DrawCommand) = .empty,
+    render_states: std.ArrayList(RenderState) = .empty,
+    vertex_states: std.ArrayList(VertexState) = .empty,
+    texture_states: std.ArrayList(TextureState) = .empty,
+    uniform_snapshots: std.ArrayList(UniformSnapshot) = .empty,
+    uniform_bytes: std.ArrayList(u8) = .empty,
+    uniform_buffer_states: std.ArrayList(UniformBufferState) = .empty,
+    /// The frame's uniform buffer stream: copies of every bound range a
+    /// draw read, at GL offset alignment
+    uniform_buffer_bytes: std.ArrayList(u8) = .empty,
+    uniform_buffer_copies: [webgl_state.MaxUniformBufferBindings]UniformBufferCopy = [_]UniformBufferCopy{.{}} ** webgl_state.MaxUniformBufferBindings,
+    /// GL buffer the stream is uploaded into; 0 until the first upload
+    uniform_stream: u32 = 0,
+    passes: std.ArrayList(PassRecord) = .empty,
+    draw_ranges: std.ArrayList(DrawRange) = .empty,
+    /// glMultiDraw* arguments, rebuilt per multi-draw at flush
+    multi_firsts: std.ArrayList(i32) = .empty,
+    multi_counts: std.ArrayList(i32) = .empty,
+    multi_offsets: std.ArrayList(usize) = .empty,
+    query_markers: std.ArrayList(QueryMarker) = .empty,
+    /// webgl_readback indices, grouped by pass
+    readbacks: std.ArrayList(u32) = .empty,
+    /// Set by a query marker: the next command may not be reordered, so no
+    /// draw crosses the marker
+    query_barrier: bool = false,
+    /// Latest snapshot of each program this frame, by program index; grows
+    /// to the highest program index drawn with
+    program_snapshots: std.ArrayList(u32) = .empty,
+    order: std.ArrayList(u32) = .empty,
+    pipeline_cache: PipelineCache = .{},
+    viewport: [4]i32 = .{ 0, 0, 0, 0 },
+    scissor: [4]i32 = .{ 0, 0, 0, 0 },
+    scissor_enabled: bool = false,
     clear_color: sg.Color = .{ .r = 0.0, .g = 0.0, .b = 0.0, .a = 0.0 },
     clear_depth: f32 = 1.0,
     clear_stencil: u8 = 0,
-    clear_pending: bool = false,
-    clear_mask: u32 = 0,
+    last_flush_stats: FlushStats = .{},
+    /// Swapchain and default action of the latest flush, for a stream
+    /// submitted mid-frame by readPixelsNow()
+    frame_swapchain: ?sg.Swapchain = null,
+    frame_action: sg.PassAction = .{},
+    /// A mid-frame submit began the swapchain pass, so later ones load it
+    swapchain_begun: bool = false,
+    /// Counters as of the previous flush, for the per-frame deltas
+    upload_mark: webgl_backend.UploadStats = .{},
+    pipeline_miss_mark: u64 = 0,
+    /// Bound where a slot has nothing it can sample, by PlaceholderKind
+    placeholders: [3]?webgl_backend.PlaceholderTexture = .{ null, null, null },
 };
 
 var g_state: DrawState = .{};
 
+/// Regroup opaque draws by sort key at flush. Off by default: regrouping
+/// changes which of two draws wins at equal depth, so coplanar geometry
+/// ordered with renderOrder or multi-pass LEQUAL over the same geometry
+/// can render differently than in WebGL.
+var g_reorder_draws: bool = false;
+
+/// Let draws recorded from now on be regrouped (see g_reorder_draws).
+pub fn configureDrawReordering(enabled: bool) void {
+    g_reorder_draws = enabled;
+}
+
 pub fn reset() void {
     clearPipelineCache();
-    g_state = .{};
+    if (sg.isvalid()) {
+        for (g_state.placeholders) |maybe| {
+            if (maybe) |placeholder| webgl_backend.destroyPlaceholderTexture(placeholder);
+        }
+    }
+    freeCommandStream();
+    if (g_state.uniform_stream != 0) gl_uniforms.deleteBuffer(g_state.uniform_stream);
+    g_state = .{ .upload_mark = webgl_backend.uploadStats() };
 }
 
 pub fn setViewport(x: i32, y: i32, width: i32, height: i32) void {
@@ -215,82 +627,211 @@ pub fn setClearStencil(stencil: i32) void {
     g_state.clear_stencil = @intCast(value);
 }
 
+/// Clear buffers of the bound draw framebuffer with the current clear
+/// values. Becomes the load action of the current pass, or of a new one
+/// if the current pass already has draws.
 pub fn requestClear(mask: u32) void {
-    if (mask == 0) return;
-    g_state.clear_pending = true;
-    g_state.clear_mask = mask;
+    const buffers = mask & (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    if (buffers == 0) return;
+    const pass = currentPass(true) catch {
+        log.warn("requestClear: out of memory recording a pass", .{});
+        return;
+    };
+    pass.clear_mask |= buffers;
+    if ((buffers & GL_COLOR_BUFFER_BIT) != 0) pass.clear_color = g_state.clear_color;
+    if ((buffers & GL_DEPTH_BUFFER_BIT) != 0) pass.clear_depth = g_state.clear_depth;
+    if ((buffers & GL_STENCIL_BUFFER_BIT) != 0) pass.clear_stencil = g_state.clear_stencil;
+}
+
+/// The pass new work is recorded into. A new one starts when the draw
+/// target changed, or, for a clear, when the current pass has draws.
+fn currentPass(for_clear: bool) !*PassRecord {
+    const target = webgl_framebuffer.drawTarget();
+    const end: u32 = @intCast(g_state.commands.items.len);
+    if (g_state.passes.items.len > 0) {
+        const last = &g_state.passes.items[g_state.passes.items.len - 1];
+        const same_target = last.target.framebuffer == target.framebuffer and
+            last.target.revision == target.revision;
+        const has_draws = last.end_command > last.first_command;
+        if (same_target and last.resolve == .none and !last.hasReadbacks() and !(for_clear and has_draws)) return last;
+    }
+    const pass = try g_state.passes.addOne(command_allocator);
+    pass.* = .{ .target = target, .first_command = end, .end_command = end };
+    return pass;
+}
+
+/// blitFramebuffer: resolve the read framebuffer's multisampled color
+/// into the draw framebuffer's color attachment. sokol resolves when a
+/// pass ends, so this ends the read framebuffer's current pass with the
+/// resolve, or records an empty pass that loads it. Rectangles must cover
+/// both attachments unscaled; depth and stencil bits are ignored, since
+/// Three.js only needs the resolved color.
+pub fn blitFramebuffer(src: [4]i32, dst: [4]i32, mask: u32) !void {
+    if ((mask & GL_COLOR_BUFFER_BIT) == 0) return;
+    const read = webgl_framebuffer.readTarget();
+    const draw = webgl_framebuffer.drawTarget();
+    if (read.framebuffer == 0 or draw.framebuffer == 0) return error.UnsupportedBlit;
+    const size = try webgl_framebuffer.checkResolve(read.attachments, draw.attachments);
+    const full = [4]i32{ 0, 0, @intCast(size[0]), @intCast(size[1]) };
+    if (!std.mem.eql(i32, &src, &full) or !std.mem.eql(i32, &dst, &full)) return error.UnsupportedBlit;
+
+    const end: u32 = @intCast(g_state.commands.items.len);
+    const pass = blk: {
+        if (g_state.passes.items.len > 0) {
+            const last = &g_state.passes.items[g_state.passes.items.len - 1];
+            if (last.target.framebuffer == read.framebuffer and last.target.revision == read.revision and
+                last.resolve == .none) break :blk last;
+        }
+        const fresh = try g_state.passes.addOne(command_allocator);
+        fresh.* = .{ .target = read, .first_command = end, .end_command = end };
+        break :blk fresh;
+    };
+    pass.resolve = draw.attachments.color;
+}
+
+/// readPixels() into pixel pack buffer `buffer` at `offset`; `rect` is
+/// x, y, width, height. The read runs at flush, right after the commands
+/// recorded so far for the read framebuffer: this attaches to the last pass
+/// when it draws that framebuffer, or records an empty pass that loads it.
+/// A multisampled source, the default framebuffer with MSAA included, is
+/// MultisampledReadSource (INVALID_OPERATION); framebuffers are resolved
+/// with blitFramebuffer first.
+pub fn readPixels(rect: [4]i32, format: webgl_readback.Format, buffer: webgl.BufferId, offset: u32) !void {
+    if (rect[2] < 0 or rect[3] < 0) return error.InvalidValue;
+    if (rect[2] == 0 or rect[3] == 0) return;
+    if (webgl_framebuffer.samples(.read) > 1) return error.MultisampledReadSource;
+    const mgr = webgl_state.globalBufferManager();
+    const buf = mgr.buffers.get(buffer) orelse return error.InvalidBuffer;
+    if (buf.usage != .pixel_pack) return error.InvalidBuffer;
+    const data = mgr.buffers.cpuData(buffer) orelse return error.OutOfRange;
+    const width: u64 = @intCast(rect[2]);
+    const height: u64 = @intCast(rect[3]);
+    if (offset + width * height * format.bytesPerPixel() > data.len) return error.OutOfRange;
+
+    const pass = try readbackPass();
+    addReadback(pass, try webgl_readback.record(buffer, offset, rect, format));
+}
+
+/// readPixels() into client memory `dst`. WebGL returns the pixels before
+/// the call does, so this submits every command recorded so far and reads
+/// with the GPU stalled: as slow as in browsers, and meant for tools and
+/// picking rather than every frame. Later commands start a new stream that
+/// loads what this one drew.
+pub fn readPixelsNow(rect: [4]i32, format: webgl_readback.Format, dst: []u8) !void {
+    if (rect[2] < 0 or rect[3] < 0) return error.InvalidValue;
+    if (rect[2] == 0 or rect[3] == 0) return;
+    if (webgl_framebuffer.samples(.read) > 1) return error.MultisampledReadSource;
+    const width: u64 = @intCast(rect[2]);
+    const height: u64 = @intCast(rect[3]);
+    const size = width * height * format.bytesPerPixel();
+    if (size > dst.len) return error.OutOfRange;
+    const swapchain = g_state.frame_swapchain orelse return error.NoContext;
+    if (!sg.isvalid()) return error.NoContext;
+
+    const pass = try readbackPass();
+    const index = try webgl_readback.recordClient(dst[0..@intCast(size)], rect, format);
+    addReadback(pass, index);
+    submitFrame(swapchain, g_state.frame_action, null, false);
+    // sokol updates a buffer or image once per frame; the rest of this one
+    // may write them again
+    sg.commit();
+    if (!webgl_readback.takeClient(index)) return error.ReadbackDropped;
+}
+
+/// The pass a readback of the read framebuffer runs at the end of: the
+/// last one when it draws that framebuffer, else a fresh one that loads it.
+fn readbackPass() !*PassRecord {
+    const read = webgl_framebuffer.readTarget();
+    try g_state.readbacks.ensureUnusedCapacity(command_allocator, 1);
+    if (g_state.passes.items.len > 0) {
+        const last = &g_state.passes.items[g_state.passes.items.len - 1];
+        if (last.target.framebuffer == read.framebuffer and last.target.revision == read.revision and
+            last.resolve == .none) return last;
+    }
+    const end: u32 = @intCast(g_state.commands.items.len);
+    const fresh = try g_state.passes.addOne(command_allocator);
+    fresh.* = .{ .target = read, .first_command = end, .end_command = end };
+    return fresh;
+}
+
+/// Capacity was reserved by readbackPass()
+fn addReadback(pass: *PassRecord, index: u32) void {
+    const at: u32 = @intCast(g_state.readbacks.items.len);
+    if (!pass.hasReadbacks()) pass.readback_first = at;
+    pass.readback_end = at + 1;
+    g_state.readbacks.appendAssumeCapacity(index);
 }
 
 pub fn setDepthTestEnabled(enabled: bool) void {
-    g_state.depth_enabled = enabled;
+    g_state.render.depth_enabled = enabled;
 }
 
 pub fn setDepthFunc(func: u32) void {
-    g_state.depth_func = func;
+    g_state.render.depth_func = func;
 }
 
 pub fn setDepthMask(enabled: bool) void {
-    g_state.depth_mask = enabled;
+    g_state.render.depth_mask = enabled;
 }
 
 pub fn setPolygonOffset(factor: f32, units: f32) void {
-    g_state.polygon_offset = .{ factor, units };
+    g_state.render.polygon_offset = .{ factor, units };
 }
 
 pub fn setPolygonOffsetEnabled(enabled: bool) void {
-    g_state.polygon_offset_enabled = enabled;
+    g_state.render.polygon_offset_enabled = enabled;
 }
 
 pub fn setCullEnabled(enabled: bool) void {
-    g_state.cull_enabled = enabled;
+    g_state.render.cull_enabled = enabled;
 }
 
 pub fn setCullFace(face: u32) void {
-    g_state.cull_face = face;
+    g_state.render.cull_face = face;
 }
 
 pub fn setFrontFace(face: u32) void {
-    g_state.front_face = face;
+    g_state.render.front_face = face;
 }
 
 pub fn setBlendEnabled(enabled: bool) void {
-    g_state.blend_enabled = enabled;
+    g_state.render.blend_enabled = enabled;
 }
 
 pub fn setBlendFunc(src: u32, dst: u32) void {
-    g_state.blend_src = src;
-    g_state.blend_dst = dst;
-    g_state.blend_src_alpha = src;
-    g_state.blend_dst_alpha = dst;
+    g_state.render.blend_src = src;
+    g_state.render.blend_dst = dst;
+    g_state.render.blend_src_alpha = src;
+    g_state.render.blend_dst_alpha = dst;
 }
 
 pub fn setBlendFuncSeparate(src: u32, dst: u32, src_alpha: u32, dst_alpha: u32) void {
-    g_state.blend_src = src;
-    g_state.blend_dst = dst;
-    g_state.blend_src_alpha = src_alpha;
-    g_state.blend_dst_alpha = dst_alpha;
+    g_state.render.blend_src = src;
+    g_state.render.blend_dst = dst;
+    g_state.render.blend_src_alpha = src_alpha;
+    g_state.render.blend_dst_alpha = dst_alpha;
 }
 
 pub fn setBlendEquation(eq: u32) void {
-    g_state.blend_eq = eq;
-    g_state.blend_eq_alpha = eq;
+    g_state.render.blend_eq = eq;
+    g_state.render.blend_eq_alpha = eq;
 }
 
 pub fn setBlendEquationSeparate(eq: u32, eq_alpha: u32) void {
-    g_state.blend_eq = eq;
-    g_state.blend_eq_alpha = eq_alpha;
+    g_state.render.blend_eq = eq;
+    g_state.render.blend_eq_alpha = eq_alpha;
 }
 
 pub fn setColorMask(r: bool, g: bool, b: bool, a: bool) void {
-    g_state.color_mask = .{ r, g, b, a };
+    g_state.render.color_mask = .{ r, g, b, a };
 }
 
 pub fn setAlphaToCoverageEnabled(enabled: bool) void {
-    g_state.alpha_to_coverage_enabled = enabled;
+    g_state.render.alpha_to_coverage_enabled = enabled;
 }
 
 pub fn setStencilEnabled(enabled: bool) void {
-    g_state.stencil_enabled = enabled;
+    g_state.render.stencil_enabled = enabled;
 }
 
 pub fn setStencilFunc(func: u32, ref: i32, mask: u32) void {
@@ -302,22 +843,22 @@ pub fn setStencilFuncSeparate(face: u32, func: u32, ref: i32, mask: u32) void {
     const mask_u8: u8 = if (mask > 255) 255 else @as(u8, @intCast(mask));
     switch (face) {
         GL_FRONT => {
-            g_state.stencil_func_front = func;
-            g_state.stencil_ref_front = ref_u8;
-            g_state.stencil_read_mask_front = mask_u8;
+            g_state.render.stencil_func_front = func;
+            g_state.render.stencil_ref_front = ref_u8;
+            g_state.render.stencil_read_mask_front = mask_u8;
         },
         GL_BACK => {
-            g_state.stencil_func_back = func;
-            g_state.stencil_ref_back = ref_u8;
-            g_state.stencil_read_mask_back = mask_u8;
+            g_state.render.stencil_func_back = func;
+            g_state.render.stencil_ref_back = ref_u8;
+            g_state.render.stencil_read_mask_back = mask_u8;
         },
         GL_FRONT_AND_BACK => {
-            g_state.stencil_func_front = func;
-            g_state.stencil_func_back = func;
-            g_state.stencil_ref_front = ref_u8;
-            g_state.stencil_ref_back = ref_u8;
-            g_state.stencil_read_mask_front = mask_u8;
-            g_state.stencil_read_mask_back = mask_u8;
+            g_state.render.stencil_func_front = func;
+            g_state.render.stencil_func_back = func;
+            g_state.render.stencil_ref_front = ref_u8;
+            g_state.render.stencil_ref_back = ref_u8;
+            g_state.render.stencil_read_mask_front = mask_u8;
+            g_state.render.stencil_read_mask_back = mask_u8;
         },
         else => {},
     }
@@ -330,11 +871,11 @@ pub fn setStencilMask(mask: u32) void {
 pub fn setStencilMaskSeparate(face: u32, mask: u32) void {
     const mask_u8: u8 = if (mask > 255) 255 else @as(u8, @intCast(mask));
     switch (face) {
-        GL_FRONT => g_state.stencil_write_mask_front = mask_u8,
-        GL_BACK => g_state.stencil_write_mask_back = mask_u8,
+        GL_FRONT => g_state.render.stencil_write_mask_front = mask_u8,
+        GL_BACK => g_state.render.stencil_write_mask_back = mask_u8,
         GL_FRONT_AND_BACK => {
-            g_state.stencil_write_mask_front = mask_u8;
-            g_state.stencil_write_mask_back = mask_u8;
+            g_state.render.stencil_write_mask_front = mask_u8;
+            g_state.render.stencil_write_mask_back = mask_u8;
         },
         else => {},
     }
@@ -347,51 +888,59 @@ pub fn setStencilOp(fail: u32, zfail: u32, zpass: u32) void {
 pub fn setStencilOpSeparate(face: u32, fail: u32, zfail: u32, zpass: u32) void {
     switch (face) {
         GL_FRONT => {
-            g_state.stencil_fail_front = fail;
-            g_state.stencil_zfail_front = zfail;
-            g_state.stencil_zpass_front = zpass;
+            g_state.render.stencil_fail_front = fail;
+            g_state.render.stencil_zfail_front = zfail;
+            g_state.render.stencil_zpass_front = zpass;
         },
         GL_BACK => {
-            g_state.stencil_fail_back = fail;
-            g_state.stencil_zfail_back = zfail;
-            g_state.stencil_zpass_back = zpass;
+            g_state.render.stencil_fail_back = fail;
+            g_state.render.stencil_zfail_back = zfail;
+            g_state.render.stencil_zpass_back = zpass;
         },
         GL_FRONT_AND_BACK => {
-            g_state.stencil_fail_front = fail;
-            g_state.stencil_zfail_front = zfail;
-            g_state.stencil_zpass_front = zpass;
-            g_state.stencil_fail_back = fail;
-            g_state.stencil_zfail_back = zfail;
-            g_state.stencil_zpass_back = zpass;
+            g_state.render.stencil_fail_front = fail;
+            g_state.render.stencil_zfail_front = zfail;
+            g_state.render.stencil_zpass_front = zpass;
+            g_state.render.stencil_fail_back = fail;
+            g_state.render.stencil_zfail_back = zfail;
+            g_state.render.stencil_zpass_back = zpass;
         },
         else => {},
     }
 }
 
-pub fn consumePassAction(default_action: sg.PassAction) sg.PassAction {
-    if (!g_state.clear_pending) return default_action;
-    log.debug("consumePassAction: clear_mask={x} color=[{d:.2},{d:.2},{d:.2},{d:.2}]", .{ g_state.clear_mask, g_state.clear_color.r, g_state.clear_color.g, g_state.clear_color.b, g_state.clear_color.a });
+/// Load actions of a pass: its clears, `fallback` when it has none (the
+/// window's default for the frame's first swapchain pass), otherwise the
+/// previous contents. Depth and stencil are always stored: a later pass
+/// on the same target may load them, and shadow maps are sampled.
+fn passAction(pass: *const PassRecord, fallback: ?sg.PassAction) sg.PassAction {
+    var action = if (pass.clear_mask == 0 and fallback != null) fallback.? else loadAction(pass);
+    action.depth.store_action = .STORE;
+    action.stencil.store_action = .STORE;
+    return action;
+}
+
+fn loadAction(pass: *const PassRecord) sg.PassAction {
+    log.debug("passAction: clear_mask={x} color=[{d:.2},{d:.2},{d:.2},{d:.2}]", .{ pass.clear_mask, pass.clear_color.r, pass.clear_color.g, pass.clear_color.b, pass.clear_color.a });
     var action = sg.PassAction{};
-    if ((g_state.clear_mask & GL_COLOR_BUFFER_BIT) != 0) {
+    if ((pass.clear_mask & GL_COLOR_BUFFER_BIT) != 0) {
         action.colors[0].load_action = .CLEAR;
-        action.colors[0].clear_value = g_state.clear_color;
+        action.colors[0].clear_value = pass.clear_color;
     } else {
         action.colors[0].load_action = .LOAD;
     }
-    if ((g_state.clear_mask & GL_DEPTH_BUFFER_BIT) != 0) {
+    if ((pass.clear_mask & GL_DEPTH_BUFFER_BIT) != 0) {
         action.depth.load_action = .CLEAR;
-        action.depth.clear_value = g_state.clear_depth;
+        action.depth.clear_value = pass.clear_depth;
     } else {
         action.depth.load_action = .LOAD;
     }
-    if ((g_state.clear_mask & GL_STENCIL_BUFFER_BIT) != 0) {
+    if ((pass.clear_mask & GL_STENCIL_BUFFER_BIT) != 0) {
         action.stencil.load_action = .CLEAR;
-        action.stencil.clear_value = g_state.clear_stencil;
+        action.stencil.clear_value = pass.clear_stencil;
     } else {
         action.stencil.load_action = .LOAD;
     }
-    g_state.clear_pending = false;
-    g_state.clear_mask = 0;
     return action;
 }
 
@@ -409,19 +958,129 @@ pub fn currentProgram() ?webgl_program.ProgramId {
     return g_state.current_program;
 }
 
+/// beginQuery(): take effect before the next recorded command.
+pub fn beginQuery(target: webgl_query.Target, id: u32) !void {
+    const issue = try webgl_query.begin(target, id);
+    try recordQueryMarker(issue, .begin);
+}
+
+/// endQuery(): the query covers the commands recorded since its begin.
+pub fn endQuery(target: webgl_query.Target) !void {
+    try recordQueryMarker(try webgl_query.end(target), .end);
+}
+
+/// queryCounterEXT(query, TIMESTAMP_EXT)
+pub fn queryCounter(id: u32) !void {
+    try recordQueryMarker(try webgl_query.counter(id), .counter);
+}
+
+/// deleteQuery(): an active query ends where it is deleted.
+pub fn deleteQuery(id: u32) bool {
+    if (!webgl_query.isQuery(id)) return false;
+    if (webgl_query.deleteQuery(id)) |issue| {
+        recordQueryMarker(issue, .end) catch {};
+    }
+    return true;
+}
+
+fn recordQueryMarker(issue: u32, action: webgl_query.Action) !void {
+    errdefer webgl_query.cancel(issue, action);
+    try g_state.query_markers.append(command_allocator, .{
+        .position = @intCast(g_state.commands.items.len),
+        .issue = issue,
+        .action = action,
+    });
+    g_state.query_barrier = true;
+}
+
+/// Emit the query markers positioned at or before command `position`,
+/// starting at `next.*`.
+fn emitQueryMarkers(next: *usize, position: u32) void {
+    const markers = g_state.query_markers.items;
+    while (next.* < markers.len and markers[next.*].position <= position) : (next.* += 1) {
+        webgl_query.emit(markers[next.*].issue, markers[next.*].action);
+    }
+}
+
+/// Drop the markers a flush did not get to, e.g. without a GPU.
+fn cancelQueryMarkers(next: usize) void {
+    for (g_state.query_markers.items[next..]) |marker| {
+        webgl_query.cancel(marker.issue, marker.action);
+    }
+}
+
+/// Counters recorded by the last flush() that reached sokol.
+pub fn lastFlushStats() FlushStats {
+    return g_state.last_flush_stats;
+}
+
 pub fn getAttribLocation(id: webgl_program.ProgramId, name: []const u8) !i32 {
     const programs = webgl_program.globalProgramTable();
     return programs.getAttribLocation(id, name);
 }
 
-pub fn enableVertexAttribArray(index: u32) !void {
+/// Allocate a vertex array object. Its handle is never 0.
+pub fn createVertexArray() !u32 {
+    var id = g_state.next_vertex_array;
+    for (0..MaxVertexArrays) |_| {
+        if (!g_state.vertex_arrays[id].live) {
+            g_state.vertex_arrays[id] = .{ .live = true };
+            g_state.next_vertex_array = if (id == MaxVertexArrays) 1 else id + 1;
+            return id;
+        }
+        id = if (id == MaxVertexArrays) 1 else id + 1;
+    }
+    return error.AtCapacity;
+}
+
+pub fn isVertexArray(id: u32) bool {
+    return id != 0 and id <= MaxVertexArrays and g_state.vertex_arrays[id].live;
+}
+
+/// Free a vertex array, falling back to the default one if it was bound.
+pub fn deleteVertexArray(id: u32) bool {
+    if (!isVertexArray(id)) return false;
+    if (g_state.bound_vertex_array == id) bindVertexArray(0) catch unreachable;
+    g_state.vertex_arrays[id].live = false;
+    return true;
+}
+
+/// Bind a vertex array (0 for the default). The ELEMENT_ARRAY_BUFFER
+/// binding is vertex array state, so it is swapped along with it.
+pub fn bindVertexArray(id: u32) !void {
+    if (id != 0 and !isVertexArray(id)) return error.InvalidVertexArray;
+    const mgr = webgl_state.globalBufferManager();
+    currentVertexArray().element_buffer = mgr.getBoundBuffer(.element_array);
+    g_state.bound_vertex_array = id;
+    if (currentVertexArray().element_buffer) |eid| {
+        mgr.bindBuffer(.element_array, eid) catch mgr.unbindBuffer(.element_array);
+    } else {
+        mgr.unbindBuffer(.element_array);
+    }
+}
+
+pub fn boundVertexArray() u32 {
+    return g_state.bound_vertex_array;
+}
+
+fn currentVertexArray() *VertexArray {
+    return &g_state.vertex_arrays[g_state.bound_vertex_array];
+}
+
+/// Attribute `index` of the bound vertex array, for modification.
+fn attribForWrite(index: u32) !*VertexAttrib {
     const idx = try attrIndex(index);
-    g_state.attribs[idx].enabled = true;
+    const vao = currentVertexArray();
+    vao.invalidate();
+    return &vao.attribs[idx];
+}
+
+pub fn enableVertexAttribArray(index: u32) !void {
+    (try attribForWrite(index)).enabled = true;
 }
 
 pub fn disableVertexAttribArray(index: u32) !void {
-    const idx = try attrIndex(index);
-    g_state.attribs[idx].enabled = false;
+    (try attribForWrite(index)).enabled = false;
 }
 
 pub fn vertexAttribPointer(
@@ -433,178 +1092,219 @@ pub fn vertexAttribPointer(
     offset: u32,
     buffer: webgl.BufferId,
 ) !void {
-    const idx = try attrIndex(index);
+    _ = try attrIndex(index);
     if (size == 0 or size > 4) return error.InvalidSize;
     if (typeSize(gl_type) == 0) return error.UnsupportedType;
     const mgr = webgl_state.globalBufferManager();
     if (!mgr.buffers.isValid(buffer)) return error.InvalidBuffer;
-    g_state.attribs[idx].size = size;
-    g_state.attribs[idx].gl_type = gl_type;
-    g_state.attribs[idx].normalized = normalized;
-    g_state.attribs[idx].stride = stride;
-    g_state.attribs[idx].offset = offset;
-    g_state.attribs[idx].buffer = buffer;
+    const attrib = try attribForWrite(index);
+    attrib.size = size;
+    attrib.gl_type = gl_type;
+    attrib.normalized = normalized;
+    attrib.stride = stride;
+    attrib.offset = offset;
+    attrib.buffer = buffer;
+}
+
+/// Attributes with a non-zero divisor advance once per `divisor` instances
+/// and are fed from a per-instance buffer layout slot. Draws skip them
+/// while the divisor is above MaxVertexDivisor.
+pub fn vertexAttribDivisor(index: u32, divisor: u32) !void {
+    if (divisor > MaxVertexDivisor) {
+        log.warn("vertexAttribDivisor({d}, {d}): divisors above {d} are not supported", .{ index, divisor, MaxVertexDivisor });
+    }
+    (try attribForWrite(index)).divisor = divisor;
 }
 
 pub fn drawArrays(mode: u32, first: i32, count: i32) !void {
-    if (count <= 0) return;
+    try drawArraysInstanced(mode, first, count, 1);
+}
+
+pub fn drawElements(mode: u32, count: i32, index_type: u32, offset: u32, element_buffer: webgl.BufferId) !void {
+    try drawElementsInstanced(mode, count, index_type, offset, element_buffer, 1);
+}
+
+pub fn drawArraysInstanced(mode: u32, first: i32, count: i32, instance_count: i32) !void {
+    if (count <= 0 or instance_count <= 0) return;
     const program = g_state.current_program orelse return error.NoProgram;
-    if (g_state.command_count >= MaxDrawCommands) return error.CommandQueueFull;
+    try recordCommand(.arrays, mode, first, count, instance_count, 0, 0, program, null);
+}
 
-    // Capture current texture bindings
-    const tex_mgr = webgl_texture.globalTextureManager();
+pub fn drawElementsInstanced(
+    mode: u32,
+    count: i32,
+    index_type: u32,
+    offset: u32,
+    element_buffer: webgl.BufferId,
+    instance_count: i32,
+) !void {
+    if (count <= 0 or instance_count <= 0) return;
+    const program = g_state.current_program orelse return error.NoProgram;
+    try recordCommand(.elements, mode, 0, count, instance_count, index_type, offset, program, element_buffer);
+}
 
-    g_state.commands[g_state.command_count] = .{
-        .kind = .arrays,
-        .mode = mode,
-        .first = first,
-        .count = count,
-        .index_type = 0,
-        .index_offset = 0,
-        .program = program,
-        .attribs = g_state.attribs,
-        .element_buffer = null,
-        .viewport = g_state.viewport,
-        .scissor = g_state.scissor,
-        .scissor_enabled = g_state.scissor_enabled,
-        .depth_enabled = g_state.depth_enabled,
-        .depth_func = g_state.depth_func,
-        .depth_mask = g_state.depth_mask,
-        .polygon_offset = g_state.polygon_offset,
-        .polygon_offset_enabled = g_state.polygon_offset_enabled,
-        .cull_enabled = g_state.cull_enabled,
-        .cull_face = g_state.cull_face,
-        .front_face = g_state.front_face,
-        .blend_enabled = g_state.blend_enabled,
-        .blend_src = g_state.blend_src,
-        .blend_dst = g_state.blend_dst,
-        .blend_src_alpha = g_state.blend_src_alpha,
-        .blend_dst_alpha = g_state.blend_dst_alpha,
-        .blend_eq = g_state.blend_eq,
-        .blend_eq_alpha = g_state.blend_eq_alpha,
-        .color_mask = g_state.color_mask,
-        .alpha_to_coverage_enabled = g_state.alpha_to_coverage_enabled,
-        .stencil_enabled = g_state.stencil_enabled,
-        .stencil_func_front = g_state.stencil_func_front,
-        .stencil_func_back = g_state.stencil_func_back,
-        .stencil_ref_front = g_state.stencil_ref_front,
-        .stencil_ref_back = g_state.stencil_ref_back,
-        .stencil_read_mask_front = g_state.stencil_read_mask_front,
-        .stencil_read_mask_back = g_state.stencil_read_mask_back,
-        .stencil_write_mask_front = g_state.stencil_write_mask_front,
-        .stencil_write_mask_back = g_state.stencil_write_mask_back,
-        .stencil_fail_front = g_state.stencil_fail_front,
-        .stencil_zfail_front = g_state.stencil_zfail_front,
-        .stencil_zpass_front = g_state.stencil_zpass_front,
-        .stencil_fail_back = g_state.stencil_fail_back,
-        .stencil_zfail_back = g_state.stencil_zfail_back,
-        .stencil_zpass_back = g_state.stencil_zpass_back,
-        .bound_textures_2d = tex_mgr.state.bound_2d,
+/// multiDrawArrays(Instanced)WEBGL: one command drawing every range back to
+/// back, with the pipeline and bindings applied once. Ranges stay in place
+/// even when empty, since gl_DrawID counts them.
+pub fn multiDrawArrays(mode: u32, ranges: []const DrawRange) !void {
+    for (ranges) |range| {
+        if (range.first < 0 or range.count < 0 or range.instance_count < 0) return error.InvalidValue;
+    }
+    try recordMultiDraw(.arrays, mode, 0, null, ranges, 1);
+}
+
+/// multiDrawElements(Instanced)WEBGL; each range's `first` is a byte offset
+/// into `element_buffer`, aligned to the index size.
+pub fn multiDrawElements(mode: u32, index_type: u32, element_buffer: webgl.BufferId, ranges: []const DrawRange) !void {
+    const index_size: i32 = switch (index_type) {
+        GL_UNSIGNED_SHORT => 2,
+        GL_UNSIGNED_INT => 4,
+        else => return error.InvalidIndexType,
     };
-    g_state.command_count += 1;
+    for (ranges) |range| {
+        if (range.first < 0 or range.count < 0 or range.instance_count < 0) return error.InvalidValue;
+        if (@rem(range.first, index_size) != 0) return error.InvalidOffset;
+    }
+    try recordMultiDraw(.elements, mode, index_type, element_buffer, ranges, index_size);
 }
 
-pub fn drawElements(mode: u32, count: i32, index_type: u32, offset: u32, element_buffer: webgl.BufferId) !void {
-    if (count <= 0) return;
+fn recordMultiDraw(
+    kind: DrawKind,
+    mode: u32,
+    index_type: u32,
+    element_buffer: ?webgl.BufferId,
+    ranges: []const DrawRange,
+    index_size: i32,
+) !void {
+    if (ranges.len > MaxMultiDrawRanges) return error.TooManyRanges;
+    for (ranges) |range| {
+        if (range.count > 0 and range.instance_count > 0) break;
+    } else return;
     const program = g_state.current_program orelse return error.NoProgram;
-    if (g_state.command_count >= MaxDrawCommands) return error.CommandQueueFull;
+    try g_state.draw_ranges.ensureUnusedCapacity(command_allocator, ranges.len);
+    try recordCommand(kind, mode, 0, 0, 1, index_type, 0, program, element_buffer);
+    const cmd = &g_state.commands.items[g_state.commands.items.len - 1];
+    cmd.range_first = @intCast(g_state.draw_ranges.items.len);
+    cmd.range_count = @intCast(ranges.len);
+    for (ranges) |range| {
+        g_state.draw_ranges.appendAssumeCapacity(.{
+            .first = @divExact(range.first, index_size),
+            .count = range.count,
+            .instance_count = range.instance_count,
+        });
+    }
+}
+
+/// Number of commands recorded since the last flush.
+pub fn pendingCommandCount() usize {
+    return g_state.commands.items.len;
+}
+
+fn recordCommand(
+    kind: DrawKind,
+    mode: u32,
+    first: i32,
+    count: i32,
+    instance_count: i32,
+    index_type: u32,
+    index_offset: u32,
+    program: webgl_program.ProgramId,
+    element_buffer: ?webgl.BufferId,
+) !void {
+    if (g_state.commands.items.len >= MaxDrawCommands) return error.CommandQueueFull;
 
     // Capture current texture bindings
     const tex_mgr = webgl_texture.globalTextureManager();
+    _ = try currentPass(false);
+    const pass_index: u32 = @intCast(g_state.passes.items.len - 1);
 
-    g_state.commands[g_state.command_count] = .{
-        .kind = .elements,
+    const cmd = try g_state.commands.addOne(command_allocator);
+    errdefer _ = g_state.commands.pop();
+    cmd.* = .{
+        .kind = kind,
         .mode = mode,
-        .first = 0,
+        .first = first,
         .count = count,
+        .instance_count = instance_count,
         .index_type = index_type,
-        .index_offset = offset,
+        .index_offset = index_offset,
         .program = program,
-        .attribs = g_state.attribs,
         .element_buffer = element_buffer,
         .viewport = g_state.viewport,
         .scissor = g_state.scissor,
         .scissor_enabled = g_state.scissor_enabled,
-        .depth_enabled = g_state.depth_enabled,
-        .depth_func = g_state.depth_func,
-        .depth_mask = g_state.depth_mask,
-        .polygon_offset = g_state.polygon_offset,
-        .polygon_offset_enabled = g_state.polygon_offset_enabled,
-        .cull_enabled = g_state.cull_enabled,
-        .cull_face = g_state.cull_face,
-        .front_face = g_state.front_face,
-        .blend_enabled = g_state.blend_enabled,
-        .blend_src = g_state.blend_src,
-        .blend_dst = g_state.blend_dst,
-        .blend_src_alpha = g_state.blend_src_alpha,
-        .blend_dst_alpha = g_state.blend_dst_alpha,
-        .blend_eq = g_state.blend_eq,
-        .blend_eq_alpha = g_state.blend_eq_alpha,
-        .color_mask = g_state.color_mask,
-        .alpha_to_coverage_enabled = g_state.alpha_to_coverage_enabled,
-        .stencil_enabled = g_state.stencil_enabled,
-        .stencil_func_front = g_state.stencil_func_front,
-        .stencil_func_back = g_state.stencil_func_back,
-        .stencil_ref_front = g_state.stencil_ref_front,
-        .stencil_ref_back = g_state.stencil_ref_back,
-        .stencil_read_mask_front = g_state.stencil_read_mask_front,
-        .stencil_read_mask_back = g_state.stencil_read_mask_back,
-        .stencil_write_mask_front = g_state.stencil_write_mask_front,
-        .stencil_write_mask_back = g_state.stencil_write_mask_back,
-        .stencil_fail_front = g_state.stencil_fail_front,
-        .stencil_zfail_front = g_state.stencil_zfail_front,
-        .stencil_zpass_front = g_state.stencil_zpass_front,
-        .stencil_fail_back = g_state.stencil_fail_back,
-        .stencil_zfail_back = g_state.stencil_zfail_back,
-        .stencil_zpass_back = g_state.stencil_zpass_back,
-        .bound_textures_2d = tex_mgr.state.bound_2d,
+        .render_state = try internState(RenderState, &g_state.render_states, &g_state.render),
+        .vertex_state = try internVertexArray(currentVertexArray()),
+        .texture_state = try internState(TextureState, &g_state.texture_states, &tex_mgr.state.bound_2d),
+        .uniforms = try snapshotUniforms(program),
+        .uniform_buffers = try snapshotUniformBuffers(program),
+        .pass = pass_index,
     };
-    g_state.command_count += 1;
+    finalizeCommand(cmd);
+    if (g_state.query_barrier) {
+        cmd.reorderable = false;
+        g_state.query_barrier = false;
+    }
+    g_state.passes.items[pass_index].end_command = @intCast(g_state.commands.items.len);
 }
 
-fn validateCommand(
-    cmd: *const DrawCommand,
-    mgr: *webgl_state.BufferManager,
-    programs: *webgl_program.ProgramTable,
-) !*const webgl_program.Program {
-    const prog = programs.get(cmd.program) orelse return error.InvalidProgram;
-    if (!prog.linked) return error.ProgramNotLinked;
-    if (!programs.ensureBackendShader(cmd.program)) return error.ShaderNotReady;
-    if (mapPrimitive(cmd.mode) == null) return error.InvalidPrimitive;
+/// Index of this frame's copy of the vertex array's resolved state. The
+/// layout is only resolved again after an attribute changed, and the copy
+/// is made once per frame; later draws with the same array reuse it.
+fn internVertexArray(vao: *VertexArray) !u32 {
+    if (vao.interned_frame == g_state.frame) return vao.interned;
+    if (!vao.state_valid) {
+        vao.state = resolveVertexState(&vao.attribs);
+        vao.state_valid = true;
+    }
+    // Refresh the handles here so each frame's copy starts out current;
+    // flush() only repeats the lookup if a buffer was orphaned meanwhile.
+    resolveVertexBindings(&vao.state, webgl_state.globalBufferManager()) catch {};
+    try g_state.vertex_states.append(command_allocator, vao.state);
+    vao.interned = @intCast(g_state.vertex_states.items.len - 1);
+    vao.interned_frame = g_state.frame;
+    return vao.interned;
+}
+
+fn resolveVertexState(attribs: *const [MaxVertexAttribs]VertexAttrib) VertexState {
+    var state: VertexState = .{};
+    var hash: u64 = 1469598103934665603;
+    for (attribs) |attrib| {
+        hash = hashBool(hash, attrib.enabled);
+        if (!attrib.enabled) continue;
+        hash = hashU64(hash, attrib.size);
+        hash = hashU64(hash, attrib.gl_type);
+        hash = hashBool(hash, attrib.normalized);
+        hash = hashU64(hash, attrib.stride);
+        hash = hashU64(hash, attrib.offset);
+        hash = hashU64(hash, if (attrib.buffer) |bid| @as(u32, @bitCast(bid)) else 0xFFFF_FFFF);
+        hash = hashU64(hash, attrib.divisor);
+    }
+    state.hash = hash;
+    resolveVertexLayout(attribs, &state) catch |err| {
+        state.problem = err;
+    };
+    return state;
+}
 
-    var slot_buffers: [MaxVertexBuffers]?webgl.BufferId = [_]?webgl.BufferId{null} ** MaxVertexBuffers;
+/// Assign vertex buffer slots and fill the sokol layout for `attribs`.
+fn resolveVertexLayout(attribs: *const [MaxVertexAttribs]VertexAttrib, state: *VertexState) VertexError!void {
+    const layout = &state.layout;
+    var slots: VertexSlots = .{};
     var slot_strides: [MaxVertexBuffers]u32 = [_]u32{0} ** MaxVertexBuffers;
-    var slot_count: usize = 0;
+    var max_attr_index: ?usize = null;
 
-    for (cmd.attribs, 0..) |attrib, attr_index| {
-        _ = attr_index;
+    for (attribs, 0..) |attrib, attr_index| {
         if (!attrib.enabled) continue;
         const buf_id = attrib.buffer orelse return error.MissingVertexBuffer;
-        if (mapVertexFormat(attrib.size, attrib.gl_type, attrib.normalized) == null) {
+        const format = mapVertexFormat(attrib.size, attrib.gl_type, attrib.normalized) orelse {
             return error.InvalidAttribFormat;
-        }
-
-        var slot: ?usize = null;
-        for (slot_buffers, 0..) |maybe_buf, sidx| {
-            if (maybe_buf != null and maybe_buf.? == buf_id) {
-                slot = sidx;
-                break;
-            }
-        }
-        if (slot == null) {
-            if (slot_count >= MaxVertexBuffers) return error.TooManyVertexBuffers;
-            slot = slot_count;
-            slot_buffers[slot_count] = buf_id;
-            slot_count += 1;
-        }
-        const slot_idx = slot.?;
+        };
+        if (attrib.divisor > MaxVertexDivisor) return error.DivisorTooLarge;
+        const slot_idx = slots.find(buf_id, attrib.divisor) orelse return error.TooManyVertexBuffers;
 
         var stride = attrib.stride;
-        if (stride == 0) {
-            const elem_size = typeSize(attrib.gl_type);
-            if (elem_size == 0) return error.InvalidStride;
-            stride = attrib.size * elem_size;
-        }
+        if (stride == 0) stride = attrib.size * typeSize(attrib.gl_type);
         if (stride == 0) return error.InvalidStride;
         if (slot_strides[slot_idx] == 0) {
             slot_strides[slot_idx] = stride;
@@ -612,9 +1312,266 @@ fn validateCommand(
             return error.InconsistentStride;
         }
 
-        const buf = mgr.buffers.get(buf_id) orelse return error.InvalidBuffer;
-        if (buf.backend == 0) return error.BufferNotReady;
+        layout.attrs[attr_index].buffer_index = @intCast(slot_idx);
+        layout.attrs[attr_index].offset = @intCast(attrib.offset);
+        layout.attrs[attr_index].format = format;
+        max_attr_index = attr_index;
+    }
+
+    // sokol stops at the first unset attribute, so fill gaps below the
+    // highest enabled one
+    if (max_attr_index) |max_idx| {
+        for (layout.attrs[0 .. max_idx + 1]) |*attr| {
+            if (attr.format == .INVALID) {
+                attr.* = .{ .buffer_index = 0, .offset = 0, .format = .FLOAT };
+            }
+        }
+    }
+
+    for (slots.divisors[0..slots.count], slot_strides[0..slots.count], 0..) |divisor, stride, sidx| {
+        layout.buffers[sidx].stride = @intCast(stride);
+        if (divisor > 0) {
+            layout.buffers[sidx].step_func = .PER_INSTANCE;
+            layout.buffers[sidx].step_rate = @intCast(divisor);
+        }
     }
+    state.slot_buffers = slots.buffers;
+    state.slot_count = @intCast(slots.count);
+}
+
+/// Look up the backend handles of the state's vertex buffers, unless no
+/// backend handle has changed since the previous lookup.
+fn resolveVertexBindings(state: *VertexState, mgr: *webgl_state.BufferManager) VertexError!void {
+    const epoch = mgr.buffers.backend_epoch;
+    if (state.bindings_epoch != epoch) {
+        state.bindings_epoch = epoch;
+        state.bindings_problem = null;
+        for (state.slot_buffers[0..state.slot_count], 0..) |buf_id, sidx| {
+            const buf = mgr.buffers.get(buf_id) orelse {
+                state.bindings_problem = error.InvalidBuffer;
+                break;
+            };
+            if (buf.backend == 0) {
+                state.bindings_problem = error.BufferNotReady;
+                break;
+            }
+            state.vertex_buffers[sidx] = .{ .id = buf.backend };
+        }
+    }
+    if (state.bindings_problem) |err| return err;
+}
+
+/// Return the index of a block equal to `value`, appending one if the most
+/// recently interned block differs. State tends to change in runs, so
+/// comparing against the tail catches nearly all repeats at O(1) cost.
+fn internState(comptime T: type, list: *std.ArrayList(T), value: *const T) !u32 {
+    if (list.items.len > 0 and std.meta.eql(list.items[list.items.len - 1], value.*)) {
+        return @intCast(list.items.len - 1);
+    }
+    try list.append(command_allocator, value.*);
+    return @intCast(list.items.len - 1);
+}
+
+/// Return the program's current uniform snapshot, capturing a new one if
+/// its uniforms were written since its previous draw this frame. Only the
+/// scopes that were written are copied.
+fn snapshotUniforms(program: webgl_program.ProgramId) !u32 {
+    const prog = webgl_program.globalProgramTable().get(program) orelse return NoUniformSnapshot;
+    if (program.index >= g_state.program_snapshots.items.len) {
+        try g_state.program_snapshots.appendNTimes(
+            command_allocator,
+            NoUniformSnapshot,
+            program.index + 1 - g_state.program_snapshots.items.len,
+        );
+    }
+    const slot = &g_state.program_snapshots.items[program.index];
+    const dirty = prog.takeUniformsDirty();
+    const previous: ?UniformSnapshot = if (slot.* != NoUniformSnapshot and
+        g_state.uniform_snapshots.items[slot.*].program == program)
+        g_state.uniform_snapshots.items[slot.*]
+    else
+        null;
+    if (previous != null and !dirty.object and !dirty.frame) return slot.*;
+
+    var snap: UniformSnapshot = .{ .program = program };
+    var total: usize = 0;
+    inline for ([_]webgl_program.UniformScope{ .object, .frame }) |scope| {
+        const spans = snap.span(scope);
+        const changed = if (scope == .object) dirty.object else dirty.frame;
+        if (previous != null and !changed) {
+            var prev = previous.?;
+            spans.* = prev.span(scope).*;
+        } else {
+            for (spans, [_]webgl_program.UniformStage{ .vertex, .fragment }) |*stage_span, stage| {
+                const bytes = prog.scopeUniformBytes(stage, scope);
+                stage_span.* = .{ .offset = @intCast(g_state.uniform_bytes.items.len), .len = @intCast(bytes.len) };
+                try g_state.uniform_bytes.appendSlice(command_allocator, bytes);
+            }
+        }
+        total += spans[0].len + spans[1].len;
+    }
+    if (total == 0) {
+        slot.* = NoUniformSnapshot;
+        return NoUniformSnapshot;
+    }
+    try g_state.uniform_snapshots.append(command_allocator, snap);
+    slot.* = @intCast(g_state.uniform_snapshots.items.len - 1);
+    return slot.*;
+}
+
+/// Capture the buffer ranges the program's uniform blocks read through
+/// their binding points. Ranges unchanged since their last copy this frame
+/// are shared, so a camera block written once per frame is copied once.
+fn snapshotUniformBuffers(program: webgl_program.ProgramId) !u32 {
+    const prog = webgl_program.globalProgramTable().get(program) orelse return NoUniformBuffers;
+    const blocks = prog.bufferBlocks();
+    if (blocks.len == 0) return NoUniformBuffers;
+    const mgr = webgl_state.globalBufferManager();
+    var state: UniformBufferState = .{ .count = @intCast(blocks.len) };
+    for (blocks, state.slots[0..blocks.len]) |*block, *slot| {
+        slot.* = try copyUniformBuffer(mgr, block.binding);
+    }
+    return internState(UniformBufferState, &g_state.uniform_buffer_states, &state);
+}
+
+/// The stream slot holding the range bound at `binding_index`, appending a
+/// copy of it unless the binding and the buffer's contents are what they
+/// were at the previous copy this frame. A range past the end of the
+/// buffer's data is clamped to it.
+fn copyUniformBuffer(mgr: *webgl_state.BufferManager, binding_index: u8) !UniformBufferSlot {
+    const binding = mgr.uniformBufferBinding(binding_index);
+    const buffer_id = binding.buffer orelse return .{};
+    const buf = mgr.buffers.get(buffer_id) orelse return .{};
+    const copy = &g_state.uniform_buffer_copies[binding_index];
+    if (copy.frame == g_state.frame and std.meta.eql(copy.binding, binding) and
+        copy.update_count == buf.update_count) return copy.slot;
+
+    const data = mgr.buffers.cpuData(buffer_id) orelse return .{};
+    if (binding.offset >= data.len) return .{};
+    const end = if (binding.size == 0) data.len else @min(data.len, @as(usize, binding.offset) + binding.size);
+    const bytes = data[binding.offset..end];
+    const stream = &g_state.uniform_buffer_bytes;
+    const offset = std.mem.alignForward(usize, stream.items.len, gl_uniforms.uniformBufferOffsetAlignment());
+    try stream.ensureTotalCapacity(command_allocator, offset + bytes.len);
+    stream.appendNTimesAssumeCapacity(0, offset - stream.items.len);
+    stream.appendSliceAssumeCapacity(bytes);
+
+    const slot: UniformBufferSlot = .{ .offset = @intCast(offset), .size = @intCast(bytes.len) };
+    copy.* = .{ .frame = g_state.frame, .binding = binding, .update_count = buf.update_count, .slot = slot };
+    return slot;
+}
+
+/// Bind a command's uniform buffer ranges of the uploaded stream.
+fn bindUniformBuffers(index: u32) void {
+    if (g_state.uniform_stream == 0) return;
+    const state = &g_state.uniform_buffer_states.items[index];
+    for (state.slots[0..state.count], 0..) |slot, gl_slot| {
+        // An empty slot must not keep an earlier draw's range
+        if (slot.size == 0) {
+            gl_uniforms.unbindUniformBuffer(@intCast(gl_slot));
+            continue;
+        }
+        gl_uniforms.bindUniformBufferRange(@intCast(gl_slot), g_state.uniform_stream, slot.offset, slot.size);
+    }
+}
+
+fn applyUniformSnapshot(prog: *webgl_program.Program, index: u32) void {
+    var snap = g_state.uniform_snapshots.items[index];
+    const bytes = g_state.uniform_bytes.items;
+    inline for ([_]webgl_program.UniformScope{ .object, .frame }) |scope| {
+        for (snap.span(scope), [_]webgl_program.UniformStage{ .vertex, .fragment }) |stage_span, stage| {
+            prog.overlayUniforms(stage, scope, bytes[stage_span.offset..][0..stage_span.len]);
+        }
+    }
+}
+
+fn renderStateOf(cmd: *const DrawCommand) *const RenderState {
+    return &g_state.render_states.items[cmd.render_state];
+}
+
+fn vertexStateOf(cmd: *const DrawCommand) *VertexState {
+    return &g_state.vertex_states.items[cmd.vertex_state];
+}
+
+fn textureStateOf(cmd: *const DrawCommand) *const TextureState {
+    return &g_state.texture_states.items[cmd.texture_state];
+}
+
+/// Drop recorded commands and state blocks, keeping their capacity for the
+/// next frame.
+fn clearCommandStream() void {
+    g_state.commands.clearRetainingCapacity();
+    g_state.frame = if (g_state.frame == std.math.maxInt(u32)) 1 else g_state.frame + 1;
+    g_state.render_states.clearRetainingCapacity();
+    g_state.vertex_states.clearRetainingCapacity();
+    g_state.texture_states.clearRetainingCapacity();
+    g_state.uniform_snapshots.clearRetainingCapacity();
+    g_state.uniform_bytes.clearRetainingCapacity();
+    g_state.uniform_buffer_states.clearRetainingCapacity();
+    g_state.uniform_buffer_bytes.clearRetainingCapacity();
+    g_state.passes.clearRetainingCapacity();
+    g_state.draw_ranges.clearRetainingCapacity();
+    g_state.query_markers.clearRetainingCapacity();
+    g_state.readbacks.clearRetainingCapacity();
+    g_state.query_barrier = false;
+    @memset(g_state.program_snapshots.items, NoUniformSnapshot);
+}
+
+fn freeCommandStream() void {
+    g_state.commands.deinit(command_allocator);
+    g_state.render_states.deinit(command_allocator);
+    g_state.vertex_states.deinit(command_allocator);
+    g_state.texture_states.deinit(command_allocator);
+    g_state.uniform_snapshots.deinit(command_allocator);
+    g_state.uniform_bytes.deinit(command_allocator);
+    g_state.uniform_buffer_states.deinit(command_allocator);
+    g_state.uniform_buffer_bytes.deinit(command_allocator);
+    g_state.passes.deinit(command_allocator);
+    g_state.draw_ranges.deinit(command_allocator);
+    g_state.multi_firsts.deinit(command_allocator);
+    g_state.multi_counts.deinit(command_allocator);
+    g_state.multi_offsets.deinit(command_allocator);
+    g_state.query_markers.deinit(command_allocator);
+    g_state.readbacks.deinit(command_allocator);
+    g_state.program_snapshots.deinit(command_allocator);
+    g_state.order.deinit(command_allocator);
+}
+
+/// Vertex buffer layout slots in first-use order. Attributes share a slot
+/// when they read the same buffer at the same divisor, since sokol steps
+/// per vertex or per instance for a whole slot.
+const VertexSlots = struct {
+    buffers: [MaxVertexBuffers]webgl.BufferId = undefined,
+    divisors: [MaxVertexBuffers]u32 = undefined,
+    count: usize = 0,
+
+    /// Slot for `buffer` at `divisor`, claiming a new one on first use.
+    /// Null once every slot is taken.
+    fn find(self: *VertexSlots, buffer: webgl.BufferId, divisor: u32) ?usize {
+        for (self.buffers[0..self.count], self.divisors[0..self.count], 0..) |b, d, idx| {
+            if (b == buffer and d == divisor) return idx;
+        }
+        if (self.count >= MaxVertexBuffers) return null;
+        self.buffers[self.count] = buffer;
+        self.divisors[self.count] = divisor;
+        self.count += 1;
+        return self.count - 1;
+    }
+};
+
+fn validateCommand(
+    cmd: *const DrawCommand,
+    mgr: *webgl_state.BufferManager,
+    programs: *webgl_program.ProgramTable,
+) !*webgl_program.Program {
+    const prog = programs.get(cmd.program) orelse return error.InvalidProgram;
+    if (!prog.linked) return error.ProgramNotLinked;
+    if (!programs.ensureBackendShader(cmd.program)) return error.ShaderNotReady;
+    if (mapPrimitive(cmd.mode) == null) return error.InvalidPrimitive;
+
+    const vertex_state = vertexStateOf(cmd);
+    if (vertex_state.problem) |err| return err;
+    try resolveVertexBindings(vertex_state, mgr);
 
     if (cmd.kind == .elements) {
         if (mapIndexType(cmd.index_type) == null) return error.InvalidIndexType;
@@ -626,286 +1583,727 @@ fn validateCommand(
     return prog;
 }
 
-pub fn flush() void {
-    if (g_state.command_count == 0) return;
-    log.debug("flush: processing {d} commands", .{g_state.command_count});
-    defer g_state.command_count = 0;
+/// Commands resolved against one render pass.
+const PassContext = struct {
+    mgr: *webgl_state.BufferManager,
+    programs: *webgl_program.ProgramTable,
+    tex_mgr: *webgl_texture.TextureManager,
+    format: webgl_framebuffer.PassFormat,
+    /// Viewport/scissor scale: the DPI factor on the window, 1 offscreen
+    scale: f32,
+    applied: AppliedState = .{},
+    stats: *FlushStats,
+};
+
+/// Compile and submit the recorded commands, one sokol pass per recorded
+/// pass: the window's swapchain for framebuffer 0, the framebuffer's
+/// attachments otherwise. The frame's first swapchain pass starts with
+/// `default_action` unless JS cleared it, and runs `overlay` (if any)
+/// before its draws; a frame that never drew to the window still gets an
+/// empty swapchain pass.
+///
+/// With configureDrawReordering(true), runs of opaque commands within a
+/// pass are reordered by sort key so draws sharing a program and state
+/// block end up adjacent; blended, stencilled or non-depth-tested commands
+/// act as barriers and keep submission order. Otherwise every command
+/// keeps submission order. Pipeline, bindings (textures included), uniforms,
+/// viewport and scissor are only re-emitted when they differ from what the
+/// previous draw applied.
+pub fn flush(swapchain: sg.Swapchain, default_action: sg.PassAction, overlay: ?*const fn () void) void {
+    g_state.frame_swapchain = swapchain;
+    g_state.frame_action = default_action;
+    submitFrame(swapchain, default_action, overlay, true);
+}
+
+/// Submit the command stream. Only the end of the frame draws the
+/// swapchain when nothing else did; until then a swapchain pass begun by
+/// an earlier submit is loaded rather than cleared.
+fn submitFrame(swapchain: sg.Swapchain, default_action: sg.PassAction, overlay: ?*const fn () void, frame_end: bool) void {
+    log.debug("flush: processing {d} commands in {d} passes", .{ g_state.commands.items.len, g_state.passes.items.len });
+    const zone = profiler.begin(.flush);
+    defer zone.end();
+    defer clearCommandStream();
+    var stats = FlushStats{ .commands = @intCast(g_state.commands.items.len) };
+    defer g_state.last_flush_stats = stats;
+    defer countUploads(&stats);
+    var next_marker: usize = 0;
+    defer cancelQueryMarkers(next_marker);
+    var submitted = false;
+    defer webgl_readback.endFrame(submitted);
     if (!sg.isvalid()) return;
 
+    // Results of earlier frames' queries and readbacks; never waits for
+    // the GPU
+    webgl_query.collectResults();
+    webgl_readback.collectResults();
+
     // Upload any dirty textures to GPU before drawing
+    const upload_zone = profiler.begin(.texture_upload);
     webgl_texture.uploadDirtyTextures();
+    upload_zone.end();
+    ensurePlaceholders();
 
     const mgr = webgl_state.globalBufferManager();
+    mgr.commitFrame();
     const programs = webgl_program.globalProgramTable();
+    const tex_mgr = webgl_texture.globalTextureManager();
+    const commands = g_state.commands.items;
 
-    for (g_state.commands[0..g_state.command_count], 0..) |cmd, cmd_idx| {
-        const prog = validateCommand(&cmd, mgr, programs) catch |err| {
-            log.debug("flush: command {d} validation failed: {s}", .{ cmd_idx, @errorName(err) });
-            continue;
+    g_state.order.resize(command_allocator, commands.len) catch {
+        log.err("flush: out of memory compiling {d} commands", .{commands.len});
+        return;
+    };
+    const order = g_state.order.items;
+    stats.reordered = compileCommandOrder(commands, order);
+
+    // Replaying snapshots overwrites the programs' live uniform values, so
+    // capture what JS last wrote (possibly after the final draw) and put it
+    // back once the frame is submitted.
+    for (g_state.program_snapshots.items) |*slot| {
+        if (slot.* == NoUniformSnapshot) continue;
+        const owner = g_state.uniform_snapshots.items[slot.*].program;
+        slot.* = snapshotUniforms(owner) catch slot.*;
+    }
+    defer restoreLiveUniforms(programs);
+    stats.uniform_snapshots = @intCast(g_state.uniform_snapshots.items.len);
+    stats.uniform_snapshot_bytes = @intCast(g_state.uniform_bytes.items.len);
+
+    // One upload for every uniform buffer range the frame's draws read
+    const uniform_buffer_bytes = g_state.uniform_buffer_bytes.items;
+    if (uniform_buffer_bytes.len > 0) {
+        if (!gl_uniforms.uploadUniformBuffer(&g_state.uniform_stream, uniform_buffer_bytes)) {
+            log.warn("flush: uniform buffer upload failed; uniform blocks read stale data", .{});
+        }
+        stats.uniform_buffer_bytes = @intCast(uniform_buffer_bytes.len);
+    }
+
+    var drew_swapchain = false;
+    defer {
+        g_state.swapchain_begun = if (frame_end) false else g_state.swapchain_begun or drew_swapchain;
+    }
+    for (g_state.passes.items) |*pass| {
+        // Markers before the pass cover its load action too
+        emitQueryMarkers(&next_marker, pass.first_command);
+        if (pass.end_command == pass.first_command and pass.clear_mask == 0 and pass.resolve == .none and
+            !pass.hasReadbacks()) continue;
+        var ctx = PassContext{
+            .mgr = mgr,
+            .programs = programs,
+            .tex_mgr = tex_mgr,
+            .format = .{},
+            .scale = 1.0,
+            .stats = &stats,
         };
+        if (pass.target.framebuffer == 0) {
+            const fallback: ?sg.PassAction = if (drew_swapchain or g_state.swapchain_begun) null else default_action;
+            sg.beginPass(.{ .action = passAction(pass, fallback), .swapchain = swapchain });
+            ctx.scale = sapp.dpiScale();
+            if (!drew_swapchain) {
+                if (overlay) |draw| draw();
+            }
+            drew_swapchain = true;
+        } else {
+            const resolved = webgl_framebuffer.resolvePass(pass.target.attachments, pass.resolve) orelse {
+                log.debug("flush: skipping pass for incomplete framebuffer {d}", .{pass.target.framebuffer});
+                continue;
+            };
+            sg.beginPass(.{ .action = passAction(pass, null), .attachments = resolved.attachments });
+            ctx.format = resolved.format;
+        }
+        stats.passes += 1;
+        for (order[pass.first_command..pass.end_command], pass.first_command..) |cmd_idx, position| {
+            // Markers split reorder runs, so every command before a
+            // marker's position has been submitted once the slot reaches it
+            emitQueryMarkers(&next_marker, @intCast(position));
+            submitCommand(cmd_idx, &ctx);
+        }
+        // sokol's GL backend has issued the pass's draws, and the pass's
+        // framebuffer is still bound for glReadPixels
+        for (g_state.readbacks.items[pass.readback_first..pass.readback_end]) |index| {
+            webgl_readback.emit(index);
+        }
+        sg.endPass();
+    }
+    emitQueryMarkers(&next_marker, std.math.maxInt(u32));
+    submitted = true;
+
+    if (frame_end and !drew_swapchain) {
+        const action = if (g_state.swapchain_begun) passAction(&.{ .target = .{}, .first_command = 0, .end_command = 0 }, null) else default_action;
+        sg.beginPass(.{ .action = action, .swapchain = swapchain });
+        if (overlay) |draw| draw();
+        sg.endPass();
+        stats.passes += 1;
+    }
+}
 
-        // Scale viewport and scissor by DPI factor for high-DPI displays
-        const dpi_scale = sapp.dpiScale();
-        const vp = sanitizeRect(cmd.viewport);
-        const vp_scaled = scaleRect(vp, dpi_scale);
+/// Uploads and pipeline creations since the previous flush.
+fn countUploads(stats: *FlushStats) void {
+    const uploads = webgl_backend.uploadStats();
+    const mark = g_state.upload_mark;
+    stats.buffer_upload_bytes = uploads.buffer_bytes - mark.buffer_bytes;
+    stats.texture_upload_bytes = uploads.texture_bytes - mark.texture_bytes;
+    stats.texture_uploads = @intCast(uploads.texture_uploads - mark.texture_uploads);
+    g_state.upload_mark = uploads;
+    const misses = g_state.pipeline_cache.stats.misses;
+    stats.pipeline_misses = @intCast(misses - g_state.pipeline_miss_mark);
+    g_state.pipeline_miss_mark = misses;
+}
+
+/// Apply whatever state differs from the previous draw of the pass, then
+/// draw one command.
+fn submitCommand(cmd_idx: u32, ctx: *PassContext) void {
+    const cmd = &g_state.commands.items[cmd_idx];
+    const stats = ctx.stats;
+    const applied = &ctx.applied;
+    const prog = validateCommand(cmd, ctx.mgr, ctx.programs) catch |err| {
+        log.debug("flush: command {d} validation failed: {s}", .{ cmd_idx, @errorName(err) });
+        return;
+    };
+
+    const vp = sanitizeRect(cmd.viewport);
+    const vp_scaled = scaleRect(vp, ctx.scale);
+    if (applied.viewport == null or !std.mem.eql(i32, &applied.viewport.?, &vp_scaled)) {
         sg.applyViewport(vp_scaled[0], vp_scaled[1], vp_scaled[2], vp_scaled[3], false);
-        const scissor = if (cmd.scissor_enabled) sanitizeRect(cmd.scissor) else vp;
-        const scissor_scaled = scaleRect(scissor, dpi_scale);
+        applied.viewport = vp_scaled;
+        stats.viewport_applies += 1;
+    }
+    const scissor = if (cmd.scissor_enabled) sanitizeRect(cmd.scissor) else vp;
+    const scissor_scaled = scaleRect(scissor, ctx.scale);
+    if (applied.scissor == null or !std.mem.eql(i32, &applied.scissor.?, &scissor_scaled)) {
         sg.applyScissorRect(scissor_scaled[0], scissor_scaled[1], scissor_scaled[2], scissor_scaled[3], false);
+        applied.scissor = scissor_scaled;
+        stats.scissor_applies += 1;
+    }
 
-        var pip_desc = sg.PipelineDesc{};
-        pip_desc.shader = prog.backend_shader;
-        pip_desc.primitive_type = mapPrimitive(cmd.mode) orelse continue;
-        if (cmd.kind == .elements) {
-            pip_desc.index_type = mapIndexType(cmd.index_type) orelse continue;
+    // Slot textures depend only on the program and the units' textures, so
+    // a draw repeating both reuses the previous draw's. Resolving can
+    // rebuild the program's shader, so it comes before the pipeline.
+    if (applied.texture_state != cmd.texture_state or applied.texture_program != cmd.program) {
+        if (!resolveTextures(cmd, ctx.programs, ctx.tex_mgr, &applied.textures)) {
+            applied.texture_state = NoTextureState;
+            return;
         }
-        pip_desc.cull_mode = mapCullMode(cmd.cull_enabled, cmd.cull_face);
-        pip_desc.face_winding = mapFaceWinding(cmd.front_face);
-        pip_desc.depth.compare = if (cmd.depth_enabled) mapCompare(cmd.depth_func) else .ALWAYS;
-        pip_desc.depth.write_enabled = cmd.depth_mask;
-        if (cmd.polygon_offset_enabled) {
-            pip_desc.depth.bias = cmd.polygon_offset[1];
-            pip_desc.depth.bias_slope_scale = cmd.polygon_offset[0];
+        applied.texture_state = cmd.texture_state;
+        applied.texture_program = cmd.program;
+        stats.texture_applies += 1;
+    }
+
+    // Identical state hash, program and shader means the pipeline and
+    // vertex bindings built for the previous draw are still correct; the
+    // index offset and textures are not part of the hash.
+    var pipeline_changed = false;
+    var bindings = applied.bindings;
+    const same_state = applied.valid and applied.state_hash == cmd.state_hash and
+        applied.program == cmd.program and applied.shader == prog.backend_shader.id;
+    if (!same_state) {
+        var pip_desc = sg.PipelineDesc{};
+        bindings = .{};
+        if (!buildDrawDesc(cmd, prog, ctx.mgr, ctx.format, &pip_desc, &bindings)) return;
+
+        const key = pipelineKey(prog.backend_shader.id, &pip_desc);
+        const pip = getCachedPipeline(key, pip_desc) orelse return;
+        log.debug("flush: cmd {d}: shader={d} pip.id={d} depth={any} cull={any}", .{ cmd_idx, prog.backend_shader.id, pip.id, renderStateOf(cmd).depth_enabled, renderStateOf(cmd).cull_enabled });
+        if (!applied.valid or applied.pipeline.id != pip.id) {
+            sg.applyPipeline(pip);
+            pipeline_changed = true;
+            stats.pipeline_applies += 1;
         }
-        pip_desc.stencil.enabled = cmd.stencil_enabled;
-        pip_desc.stencil.read_mask = cmd.stencil_read_mask_front;
-        pip_desc.stencil.write_mask = cmd.stencil_write_mask_front;
-        pip_desc.stencil.ref = cmd.stencil_ref_front;
-        pip_desc.stencil.front.compare = mapCompare(cmd.stencil_func_front);
-        pip_desc.stencil.front.fail_op = mapStencilOp(cmd.stencil_fail_front);
-        pip_desc.stencil.front.depth_fail_op = mapStencilOp(cmd.stencil_zfail_front);
-        pip_desc.stencil.front.pass_op = mapStencilOp(cmd.stencil_zpass_front);
-        pip_desc.stencil.back.compare = mapCompare(cmd.stencil_func_back);
-        pip_desc.stencil.back.fail_op = mapStencilOp(cmd.stencil_fail_back);
-        pip_desc.stencil.back.depth_fail_op = mapStencilOp(cmd.stencil_zfail_back);
-        pip_desc.stencil.back.pass_op = mapStencilOp(cmd.stencil_zpass_back);
-        pip_desc.color_count = 1;
-        pip_desc.colors[0].write_mask = mapColorMask(cmd.color_mask);
-        pip_desc.colors[0].blend.enabled = cmd.blend_enabled;
-        pip_desc.colors[0].blend.src_factor_rgb = mapBlendFactor(cmd.blend_src);
-        pip_desc.colors[0].blend.dst_factor_rgb = mapBlendFactor(cmd.blend_dst);
-        pip_desc.colors[0].blend.op_rgb = mapBlendOp(cmd.blend_eq);
-        pip_desc.colors[0].blend.src_factor_alpha = mapBlendFactor(cmd.blend_src_alpha);
-        pip_desc.colors[0].blend.dst_factor_alpha = mapBlendFactor(cmd.blend_dst_alpha);
-        pip_desc.colors[0].blend.op_alpha = mapBlendOp(cmd.blend_eq_alpha);
-        pip_desc.alpha_to_coverage_enabled = cmd.alpha_to_coverage_enabled;
+        applied.valid = true;
+        applied.state_hash = cmd.state_hash;
+        applied.program = cmd.program;
+        applied.shader = prog.backend_shader.id;
+        applied.pipeline = pip;
+    } else if (cmd.kind == .elements) {
+        bindings.index_buffer_offset = @intCast(cmd.index_offset);
+    }
+    @memcpy(bindings.views[0..webgl_program.MaxTextureSlots], &applied.textures.views);
+    @memcpy(bindings.samplers[0..webgl_program.MaxTextureSlots], &applied.textures.samplers);
+    // sokol requires bindings to be re-applied after a pipeline switch
+    if (pipeline_changed or !std.meta.eql(applied.bindings, bindings)) {
+        sg.applyBindings(bindings);
+        applied.bindings = bindings;
+        stats.binding_applies += 1;
+    }
 
-        var bindings = sg.Bindings{};
-        var slot_buffers: [MaxVertexBuffers]?webgl.BufferId = [_]?webgl.BufferId{null} ** MaxVertexBuffers;
-        var slot_strides: [MaxVertexBuffers]u32 = [_]u32{0} ** MaxVertexBuffers;
-        var slot_count: usize = 0;
-        var max_attr_index: ?usize = null;
-
-        for (cmd.attribs, 0..) |attrib, attr_index| {
-            if (!attrib.enabled) continue;
-            const buf_id = attrib.buffer orelse continue;
-
-            var slot: ?usize = null;
-            for (slot_buffers, 0..) |maybe_buf, sidx| {
-                if (maybe_buf != null and maybe_buf.? == buf_id) {
-                    slot = sidx;
-                    break;
-                }
-            }
-            if (slot == null) {
-                if (slot_count >= MaxVertexBuffers) continue;
-                slot = slot_count;
-                slot_buffers[slot_count] = buf_id;
-                slot_count += 1;
-            }
-            const slot_idx = slot.?;
-
-            const format = mapVertexFormat(attrib.size, attrib.gl_type, attrib.normalized) orelse continue;
-            pip_desc.layout.attrs[attr_index].buffer_index = @intCast(slot_idx);
-            pip_desc.layout.attrs[attr_index].offset = @intCast(attrib.offset);
-            pip_desc.layout.attrs[attr_index].format = format;
-            if (max_attr_index == null or attr_index > max_attr_index.?) {
-                max_attr_index = attr_index;
-            }
+    // Uniform values come from the command's snapshot. Push again after a
+    // pipeline switch (sokol requires it) or when the snapshot differs.
+    const uniforms_changed = cmd.uniforms != applied.uniforms;
+    if (uniforms_changed and cmd.uniforms != NoUniformSnapshot) {
+        applyUniformSnapshot(prog, cmd.uniforms);
+    }
+    if (pipeline_changed or uniforms_changed) {
+        applyProgramUniforms(cmd.program, prog, ctx.programs, cmd_idx);
+        stats.uniform_applies += 1;
+    }
+    applied.uniforms = cmd.uniforms;
 
-            var stride = attrib.stride;
-            if (stride == 0) {
-                stride = attrib.size * typeSize(attrib.gl_type);
-            }
-            if (slot_strides[slot_idx] == 0) {
-                slot_strides[slot_idx] = stride;
-            } else if (slot_strides[slot_idx] != stride) {
-                continue;
-            }
+    // Indexed uniform buffer bindings outlive program switches as well
+    if (cmd.uniform_buffers != NoUniformBuffers and cmd.uniform_buffers != applied.uniform_buffers) {
+        bindUniformBuffers(cmd.uniform_buffers);
+        applied.uniform_buffers = cmd.uniform_buffers;
+        stats.uniform_buffer_applies += 1;
+    }
+    // glGetError can stall the driver; only validation builds poll it
+    if (build_options.gl_validation) checkGlError(cmd_idx);
+
+    if (cmd.range_count > 0) {
+        submitRanges(cmd, prog, stats);
+        return;
+    }
+    const base = if (cmd.kind == .arrays) cmd.first else 0;
+    const base_u32: u32 = if (base < 0) 0 else @intCast(base);
+    const count_u32: u32 = if (cmd.count < 0) 0 else @intCast(cmd.count);
+    if (count_u32 == 0) return;
+    sg.draw(base_u32, count_u32, @intCast(cmd.instance_count));
+    stats.draws += 1;
+}
+
+/// Report a GL error raised by the direct uniform calls for this draw.
+fn checkGlError(cmd_idx: u32) void {
+    const gl_err = gl_uniforms.getError();
+    if (gl_err != gl_uniforms.GL_NO_ERROR) {
+        log.err("flush: cmd {d}: GL error after uniform upload: {x}", .{ cmd_idx, gl_err });
+    }
+}
+
+/// Draw a multi-draw's ranges with the state submitCommand applied: in one
+/// glMultiDraw* call when GL has it and the ranges differ only in what they
+/// draw, otherwise one sg.draw per range with gl_DrawID set before it.
+fn submitRanges(cmd: *const DrawCommand, prog: *const webgl_program.Program, stats: *FlushStats) void {
+    const ranges = g_state.draw_ranges.items[cmd.range_first..][0..cmd.range_count];
+    if (prog.draw_id_location < 0 and gl_uniforms.hasMultiDraw() and submitMultiDraw(cmd, ranges)) {
+        stats.draws += 1;
+        return;
+    }
+    for (ranges, 0..) |range, draw_id| {
+        if (range.count <= 0 or range.instance_count <= 0) continue;
+        if (prog.draw_id_location >= 0) gl_uniforms.uniform1i(prog.draw_id_location, @intCast(draw_id));
+        sg.draw(@intCast(range.first), @intCast(range.count), @intCast(range.instance_count));
+        stats.draws += 1;
+    }
+    // Single draws of the program read gl_DrawID 0
+    if (prog.draw_id_location >= 0) gl_uniforms.uniform1i(prog.draw_id_location, 0);
+}
+
+/// One glMultiDrawArrays/glMultiDrawElements for `ranges` on top of the
+/// pipeline and bindings sokol applied. False when a range is instanced
+/// (GL has no instanced multi-draw) or the arguments cannot be built.
+fn submitMultiDraw(cmd: *const DrawCommand, ranges: []const DrawRange) bool {
+    const firsts = &g_state.multi_firsts;
+    const counts = &g_state.multi_counts;
+    const offsets = &g_state.multi_offsets;
+    firsts.clearRetainingCapacity();
+    counts.clearRetainingCapacity();
+    offsets.clearRetainingCapacity();
+    firsts.ensureTotalCapacity(command_allocator, ranges.len) catch return false;
+    counts.ensureTotalCapacity(command_allocator, ranges.len) catch return false;
+    offsets.ensureTotalCapacity(command_allocator, ranges.len) catch return false;
+    const index_size: usize = if (cmd.index_type == GL_UNSIGNED_INT) 4 else 2;
+    for (ranges) |range| {
+        if (range.instance_count > 1) return false;
+        if (range.count <= 0 or range.instance_count <= 0) continue;
+        firsts.appendAssumeCapacity(range.first);
+        counts.appendAssumeCapacity(range.count);
+        offsets.appendAssumeCapacity(@as(usize, @intCast(range.first)) * index_size);
+    }
+    switch (cmd.kind) {
+        .arrays => gl_uniforms.multiDrawArrays(cmd.mode, firsts.items, counts.items),
+        .elements => gl_uniforms.multiDrawElements(cmd.mode, counts.items, cmd.index_type, offsets.items),
+    }
+    return true;
+}
+
+fn restoreLiveUniforms(programs: *webgl_program.ProgramTable) void {
+    for (g_state.program_snapshots.items) |index| {
+        if (index == NoUniformSnapshot) continue;
+        const prog = programs.get(g_state.uniform_snapshots.items[index].program) orelse continue;
+        applyUniformSnapshot(prog, index);
+    }
+}
+
+/// Fill `order` with the submission order of `commands`, sorting each run of
+/// consecutive reorderable commands of one pass by sort key (ties keep
+/// submission order). Returns how many commands ended up at a different position.
+fn compileCommandOrder(commands: []const DrawCommand, order: []u32) u32 {
+    std.debug.assert(order.len >= commands.len);
+    for (order[0..commands.len], 0..) |*slot, idx| {
+        slot.* = @intCast(idx);
+    }
+
+    var start: usize = 0;
+    while (start < commands.len) {
+        if (!commands[start].reorderable) {
+            start += 1;
+            continue;
+        }
+        var end = start + 1;
+        while (end < commands.len and commands[end].reorderable and
+            commands[end].pass == commands[start].pass) : (end += 1)
+        {}
+        if (end - start > 1) {
+            std.mem.sort(u32, order[start..end], commands, commandLessThan);
         }
+        start = end;
+    }
 
-        if (slot_count > 0) {
-            if (max_attr_index) |max_idx| {
-                for (0..max_idx + 1) |idx| {
-                    if (pip_desc.layout.attrs[idx].format == .INVALID) {
-                        pip_desc.layout.attrs[idx].buffer_index = 0;
-                        pip_desc.layout.attrs[idx].offset = 0;
-                        pip_desc.layout.attrs[idx].format = .FLOAT;
-                    }
-                }
-            }
-        }
+    var moved: u32 = 0;
+    for (order[0..commands.len], 0..) |cmd_idx, idx| {
+        if (cmd_idx != idx) moved += 1;
+    }
+    return moved;
+}
 
-        for (slot_buffers, 0..) |maybe_buf, sidx| {
-            if (maybe_buf) |buf_id| {
-                const buf = mgr.buffers.get(buf_id) orelse continue;
-                if (buf.backend == 0) continue;
-                bindings.vertex_buffers[sidx] = .{ .id = buf.backend };
-                if (slot_strides[sidx] != 0) {
-                    pip_desc.layout.buffers[sidx].stride = @intCast(slot_strides[sidx]);
-                }
-            }
-        }
+fn commandLessThan(commands: []const DrawCommand, a: u32, b: u32) bool {
+    const key_a = commands[a].sort_key;
+    const key_b = commands[b].sort_key;
+    if (key_a != key_b) return key_a < key_b;
+    return a < b;
+}
 
-        if (cmd.kind == .elements) {
-            if (cmd.element_buffer) |eid| {
-                const buf = mgr.buffers.get(eid) orelse continue;
-                if (buf.backend == 0) continue;
-                bindings.index_buffer = .{ .id = buf.backend };
-                bindings.index_buffer_offset = @intCast(cmd.index_offset);
-            } else {
-                continue;
-            }
-        }
+/// Derive the state hash, sort key and reorder eligibility for a freshly
+/// recorded command.
+fn finalizeCommand(cmd: *DrawCommand) void {
+    cmd.state_hash = commandStateHash(cmd);
+    cmd.reorderable = g_reorder_draws and isReorderable(cmd);
+    cmd.sort_key = commandSortKey(cmd);
+}
 
-        // Note: Texture binding is done via direct GL calls after applyBindings
-        // We don't use Sokol's view/sampler system since we removed sampler declarations from shader desc
-        const tex_mgr = webgl_texture.globalTextureManager();
+/// Opaque, depth-tested and depth-writing draws produce the same image in any
+/// order up to depth ties, so they may be regrouped within a run when
+/// reordering is enabled.
+fn isReorderable(cmd: *const DrawCommand) bool {
+    const rs = renderStateOf(cmd);
+    if (rs.blend_enabled or rs.stencil_enabled) return false;
+    if (!rs.depth_enabled or !rs.depth_mask) return false;
+    return rs.depth_func == GL_LESS or rs.depth_func == GL_LEQUAL;
+}
 
-        const key = pipelineKey(prog.backend_shader.id, &pip_desc);
-        const pip = getCachedPipeline(key, pip_desc) orelse continue;
-        log.debug("flush: cmd {d}: shader={d} pip.id={d} depth={any} cull={any}", .{ cmd_idx, prog.backend_shader.id, pip.id, cmd.depth_enabled, cmd.cull_enabled });
-        sg.applyPipeline(pip);
-        sg.applyBindings(bindings);
-        if (prog.vs_uniforms.size > 0) {
-            const size = @as(usize, prog.vs_uniforms.size);
-            const slice = prog.vs_uniforms.buffer[0..size];
-            sg.applyUniforms(0, .{ .ptr = slice.ptr, .size = slice.len });
-        }
-        if (prog.fs_uniforms.size > 0) {
-            const size = @as(usize, prog.fs_uniforms.size);
-            const slice = prog.fs_uniforms.buffer[0..size];
-            sg.applyUniforms(1, .{ .ptr = slice.ptr, .size = slice.len });
-
-            // Also apply FS uniforms via direct GL calls since Sokol uniform blocks
-            // don't work with Three.js's individual uniform declarations
-            if (prog.gl_program != 0 and gl_uniforms.isAvailable()) {
-                // Apply diffuse (vec3 at offset 0)
-                if (slice.len >= 12) {
-                    const diffuse_loc = gl_uniforms.getUniformLocation(prog.gl_program, "diffuse");
-                    if (diffuse_loc >= 0) {
-                        const f_data = [_]f32{
-                            @bitCast([4]u8{ slice[0], slice[1], slice[2], slice[3] }),
-                            @bitCast([4]u8{ slice[4], slice[5], slice[6], slice[7] }),
-                            @bitCast([4]u8{ slice[8], slice[9], slice[10], slice[11] }),
-                        };
-                        gl_uniforms.uniform3fv(diffuse_loc, 1, &f_data);
-                    }
-                }
-                // Apply opacity (float at offset 16)
-                if (slice.len >= 20) {
-                    const opacity_loc = gl_uniforms.getUniformLocation(prog.gl_program, "opacity");
-                    if (opacity_loc >= 0) {
-                        const opacity: f32 = @bitCast([4]u8{ slice[16], slice[17], slice[18], slice[19] });
-                        gl_uniforms.uniform1f(opacity_loc, opacity);
-                    }
-                }
-            }
-        }
-        // Apply mat2/mat3 uniforms via direct GL calls (Sokol only supports mat4)
-        if (programs.applyMatrixUniforms(cmd.program)) {
-            log.debug("flush: cmd {d}: applyMatrixUniforms done", .{cmd_idx});
-        }
+/// Sort key layout: program index (16) | state hash (32) | texture unit 0 (16).
+fn commandSortKey(cmd: *const DrawCommand) u64 {
+    const program_bits: u64 = cmd.program.index;
+    const state_bits: u64 = cmd.state_hash & 0xFFFF_FFFF;
+    const texture_bits: u64 = if (textureStateOf(cmd)[0]) |tex| tex.index else 0xFFFF;
+    return (program_bits << 48) | (state_bits << 16) | texture_bits;
+}
+
+/// Hash of everything that feeds the sokol pipeline and vertex/index bindings.
+fn commandStateHash(cmd: *const DrawCommand) u64 {
+    const rs = renderStateOf(cmd);
+    var hash: u64 = 1469598103934665603;
+    hash = hashU64(hash, @as(u32, @bitCast(cmd.program)));
+    hash = hashEnum(hash, cmd.kind);
+    hash = hashU64(hash, cmd.mode);
+    hash = hashU64(hash, cmd.index_type);
+    hash = hashU64(hash, if (cmd.element_buffer) |eid| @as(u32, @bitCast(eid)) else 0xFFFF_FFFF);
+    hash = hashU64(hash, vertexStateOf(cmd).hash);
+    hash = hashBool(hash, rs.depth_enabled);
+    hash = hashU64(hash, rs.depth_func);
+    hash = hashBool(hash, rs.depth_mask);
+    hash = hashBool(hash, rs.polygon_offset_enabled);
+    hash = hashF32(hash, rs.polygon_offset[0]);
+    hash = hashF32(hash, rs.polygon_offset[1]);
+    hash = hashBool(hash, rs.cull_enabled);
+    hash = hashU64(hash, rs.cull_face);
+    hash = hashU64(hash, rs.front_face);
+    hash = hashBool(hash, rs.blend_enabled);
+    hash = hashU64(hash, rs.blend_src);
+    hash = hashU64(hash, rs.blend_dst);
+    hash = hashU64(hash, rs.blend_src_alpha);
+    hash = hashU64(hash, rs.blend_dst_alpha);
+    hash = hashU64(hash, rs.blend_eq);
+    hash = hashU64(hash, rs.blend_eq_alpha);
+    for (rs.color_mask) |channel| {
+        hash = hashBool(hash, channel);
+    }
+    hash = hashBool(hash, rs.alpha_to_coverage_enabled);
+    hash = hashBool(hash, rs.stencil_enabled);
+    hash = hashU64(hash, rs.stencil_func_front);
+    hash = hashU64(hash, rs.stencil_func_back);
+    hash = hashU64(hash, rs.stencil_ref_front);
+    hash = hashU64(hash, rs.stencil_ref_back);
+    hash = hashU64(hash, rs.stencil_read_mask_front);
+    hash = hashU64(hash, rs.stencil_read_mask_back);
+    hash = hashU64(hash, rs.stencil_write_mask_front);
+    hash = hashU64(hash, rs.stencil_write_mask_back);
+    hash = hashU64(hash, rs.stencil_fail_front);
+    hash = hashU64(hash, rs.stencil_zfail_front);
+    hash = hashU64(hash, rs.stencil_zpass_front);
+    hash = hashU64(hash, rs.stencil_fail_back);
+    hash = hashU64(hash, rs.stencil_zfail_back);
+    hash = hashU64(hash, rs.stencil_zpass_back);
+    return hash;
+}
+
+/// Translate a recorded command into a sokol pipeline description and
+/// bindings. Returns false if the command cannot be drawn.
+fn buildDrawDesc(
+    cmd: *const DrawCommand,
+    prog: *const webgl_program.Program,
+    mgr: *webgl_state.BufferManager,
+    format: webgl_framebuffer.PassFormat,
+    pip_desc: *sg.PipelineDesc,
+    bindings: *sg.Bindings,
+) bool {
+    const rs = renderStateOf(cmd);
+    pip_desc.shader = prog.backend_shader;
+    pip_desc.primitive_type = mapPrimitive(cmd.mode) orelse return false;
+    if (cmd.kind == .elements) {
+        pip_desc.index_type = mapIndexType(cmd.index_type) orelse return false;
+    }
+    pip_desc.cull_mode = mapCullMode(rs.cull_enabled, rs.cull_face);
+    pip_desc.face_winding = mapFaceWinding(rs.front_face);
+    pip_desc.depth.compare = if (rs.depth_enabled) mapCompare(rs.depth_func) else .ALWAYS;
+    pip_desc.depth.write_enabled = rs.depth_mask;
+    if (rs.polygon_offset_enabled) {
+        pip_desc.depth.bias = rs.polygon_offset[1];
+        pip_desc.depth.bias_slope_scale = rs.polygon_offset[0];
+    }
+    pip_desc.stencil.enabled = rs.stencil_enabled;
+    pip_desc.stencil.read_mask = rs.stencil_read_mask_front;
+    pip_desc.stencil.write_mask = rs.stencil_write_mask_front;
+    pip_desc.stencil.ref = rs.stencil_ref_front;
+    pip_desc.stencil.front.compare = mapCompare(rs.stencil_func_front);
+    pip_desc.stencil.front.fail_op = mapStencilOp(rs.stencil_fail_front);
+    pip_desc.stencil.front.depth_fail_op = mapStencilOp(rs.stencil_zfail_front);
+    pip_desc.stencil.front.pass_op = mapStencilOp(rs.stencil_zpass_front);
+    pip_desc.stencil.back.compare = mapCompare(rs.stencil_func_back);
+    pip_desc.stencil.back.fail_op = mapStencilOp(rs.stencil_fail_back);
+    pip_desc.stencil.back.depth_fail_op = mapStencilOp(rs.stencil_zfail_back);
+    pip_desc.stencil.back.pass_op = mapStencilOp(rs.stencil_zpass_back);
+    pip_desc.color_count = format.colorCount();
+    pip_desc.colors[0].pixel_format = format.color;
+    pip_desc.depth.pixel_format = format.depth;
+    pip_desc.sample_count = format.sample_count;
+    pip_desc.colors[0].write_mask = mapColorMask(rs.color_mask);
+    pip_desc.colors[0].blend.enabled = rs.blend_enabled;
+    pip_desc.colors[0].blend.src_factor_rgb = mapBlendFactor(rs.blend_src);
+    pip_desc.colors[0].blend.dst_factor_rgb = mapBlendFactor(rs.blend_dst);
+    pip_desc.colors[0].blend.op_rgb = mapBlendOp(rs.blend_eq);
+    pip_desc.colors[0].blend.src_factor_alpha = mapBlendFactor(rs.blend_src_alpha);
+    pip_desc.colors[0].blend.dst_factor_alpha = mapBlendFactor(rs.blend_dst_alpha);
+    pip_desc.colors[0].blend.op_alpha = mapBlendOp(rs.blend_eq_alpha);
+    pip_desc.alpha_to_coverage_enabled = rs.alpha_to_coverage_enabled;
+
+    const vertex_state = vertexStateOf(cmd);
+    pip_desc.layout = vertex_state.layout;
+    bindings.vertex_buffers = vertex_state.vertex_buffers;
+
+    if (cmd.kind == .elements) {
+        const eid = cmd.element_buffer orelse return false;
+        const buf = mgr.buffers.get(eid) orelse return false;
+        if (buf.backend == 0) return false;
+        bindings.index_buffer = .{ .id = buf.backend };
+        bindings.index_buffer_offset = @intCast(cmd.index_offset);
+    }
+    return true;
+}
+
+/// Push the program's uniform blocks plus the direct-GL uniforms (FS fallback,
+/// mat2/mat3). Must follow sg.applyPipeline for that program.
+fn applyProgramUniforms(
+    id: webgl_program.ProgramId,
+    prog: *const webgl_program.Program,
+    programs: *webgl_program.ProgramTable,
+    cmd_idx: usize,
+) void {
+    if (prog.vs_uniforms.size > 0) {
+        const size = @as(usize, prog.vs_uniforms.size);
+        const slice = prog.vs_uniforms.buffer[0..size];
+        sg.applyUniforms(0, .{ .ptr = slice.ptr, .size = slice.len });
+    }
+    if (prog.fs_uniforms.size > 0) {
+        const size = @as(usize, prog.fs_uniforms.size);
+        const slice = prog.fs_uniforms.buffer[0..size];
+        sg.applyUniforms(1, .{ .ptr = slice.ptr, .size = slice.len });
+    }
+    // Locations were resolved at link; only uniforms written since this
+    // program's previous draw are re-sent.
+    const direct = programs.applyDirectUniforms(id);
+    if (direct > 0) {
+        log.debug("flush: cmd {d}: applied {d} direct GL uniforms", .{ cmd_idx, direct });
+    }
+}
 
-        // Apply sampler uniforms via direct GL calls (sets texture unit for each sampler)
-        _ = programs.applySamplerUniforms(cmd.program);
-
-        // Bind textures via direct GL calls (since we don't declare them in Sokol shader descriptor)
-        for (cmd.bound_textures_2d, 0..) |maybe_tex_id, unit| {
-            if (maybe_tex_id) |tex_id| {
-                if (tex_mgr.textures.get(tex_id)) |tex| {
-                    // Get GL texture ID from Sokol image (not view)
-                    if (tex.backend.id != 0) {
-                        const img_info = sg.glQueryImageInfo(tex.backend);
-                        const gl_tex = img_info.tex[0];
-                        log.debug("flush: cmd {d}: unit {d} sokol_img={d} gl_tex={d} {d}x{d}", .{
-                            cmd_idx, unit, tex.backend.id, gl_tex, tex.width, tex.height,
-                        });
-                        if (gl_tex != 0) {
-                            gl_uniforms.activeTexture(@intCast(unit));
-                            gl_uniforms.bindTexture(gl_uniforms.GL_TEXTURE_2D, gl_tex);
-                            log.debug("flush: cmd {d}: GL bind unit {d} tex={d}", .{ cmd_idx, unit, gl_tex });
-                        }
-                    }
-                    // Bind sampler if we have one
-                    if (tex.backend_sampler.id != 0) {
-                        const sampler_info = sg.glQuerySamplerInfo(tex.backend_sampler);
-                        log.debug("flush: cmd {d}: unit {d} sokol_sampler={d} gl_sampler={d}", .{
-                            cmd_idx, unit, tex.backend_sampler.id, sampler_info.smp,
-                        });
-                        if (sampler_info.smp != 0) {
-                            gl_uniforms.bindSampler(@intCast(unit), sampler_info.smp);
-                        }
-                    }
+/// Pick the view and sampler of each of the program's texture slots: the
+/// texture on the slot's unit when the slot can sample it, else a
+/// placeholder (black for color slots, as WebGL samples incomplete
+/// textures). A sampler2D texture needing the other sample type switches
+/// the program to the shader for it first. False when the draw has to be
+/// dropped.
+fn resolveTextures(
+    cmd: *const DrawCommand,
+    programs: *webgl_program.ProgramTable,
+    tex_mgr: *webgl_texture.TextureManager,
+    textures: *SlotTextures,
+) bool {
+    const prog = programs.get(cmd.program) orelse return false;
+    const units = textureStateOf(cmd);
+    textures.* = .{};
+    var unfilterable = prog.unfilterable_slots;
+    for (prog.textureSlots(), 0..) |slot, idx| {
+        const bit = @as(u16, 1) << @intCast(idx);
+        const kind = prog.slotKind(slot);
+        if (slotTexture(prog, slot, units, tex_mgr)) |tex| {
+            // Keeps it resident, or streams it back in if it was evicted
+            tex_mgr.textures.touch(tex);
+            const sampling = webgl_backend.textureSampling(tex);
+            const usable = switch (sampling) {
+                .filtering, .nonfiltering => kind == .sampler2d,
+                .comparison => kind == .sampler2dShadow,
+                .incomplete => false,
+            };
+            if (usable) {
+                if (kind == .sampler2d) {
+                    if (sampling == .nonfiltering) unfilterable |= bit else unfilterable &= ~bit;
                 }
+                textures.views[idx] = tex.backend_view;
+                textures.samplers[idx] = tex.backend_sampler;
+                continue;
             }
         }
-        // Check for GL errors after texture binding
-        const gl_err = gl_uniforms.getError();
-        if (gl_err != gl_uniforms.GL_NO_ERROR) {
-            log.err("flush: cmd {d}: GL error after texture binding: {x}", .{ cmd_idx, gl_err });
-        }
-
-        const base = if (cmd.kind == .arrays) cmd.first else 0;
-        const base_u32: u32 = if (base < 0) 0 else @intCast(base);
-        const count_u32: u32 = if (cmd.count < 0) 0 else @intCast(cmd.count);
-        if (count_u32 == 0) continue;
-        sg.draw(base_u32, count_u32, 1);
+        // Color placeholders fit either sample type, so the slot keeps its own
+        const placeholder = placeholderTexture(switch (kind) {
+            .sampler2d => .color_2d,
+            .samplerCube => .color_cube,
+            .sampler2dShadow => .depth,
+        }) orelse return false;
+        textures.views[idx] = placeholder.view;
+        textures.samplers[idx] = placeholder.sampler;
+    }
+    if (unfilterable == prog.unfilterable_slots) return true;
+    return programs.setUnfilterableSlots(cmd.program, unfilterable);
+}
+
+fn slotTexture(
+    prog: *const webgl_program.Program,
+    slot: webgl_program.TextureSlot,
+    units: *const TextureState,
+    tex_mgr: *webgl_texture.TextureManager,
+) ?*webgl_texture.Texture {
+    // Nothing creates cube map images yet
+    if (prog.slotKind(slot) == .samplerCube) return null;
+    const unit = prog.textureUnit(slot);
+    if (unit < 0 or unit >= units.len) return null;
+    const tex_id = units[@intCast(unit)] orelse return null;
+    return tex_mgr.textures.get(tex_id);
+}
+
+fn placeholderTexture(kind: webgl_backend.PlaceholderKind) ?*const webgl_backend.PlaceholderTexture {
+    if (g_state.placeholders[@intFromEnum(kind)]) |*placeholder| return placeholder;
+    return null;
+}
+
+/// Create the placeholder textures that do not exist yet. Must run outside
+/// a pass, since the depth placeholder is cleared by one of its own.
+fn ensurePlaceholders() void {
+    for (&g_state.placeholders, 0..) |*cached, index| {
+        if (cached.* != null) continue;
+        const kind: webgl_backend.PlaceholderKind = @enumFromInt(index);
+        cached.* = webgl_backend.createPlaceholderTexture(kind) catch |err| blk: {
+            log.err("flush: {s} placeholder texture failed: {s}", .{ @tagName(kind), @errorName(err) });
+            break :blk null;
+        };
     }
 }
 
 fn clearPipelineCache() void {
-    if (!sg.isvalid()) {
-        return;
-    }
-    for (&g_state.pipeline_cache) |*entry| {
-        if (entry.valid and entry.pipeline.id != 0) {
-            sg.destroyPipeline(entry.pipeline);
-        }
-        entry.* = .{};
+    g_state.pipeline_cache.deinit();
+}
+
+fn destroyPipeline(pip: sg.Pipeline) void {
+    if (pip.id != 0 and sg.isvalid()) {
+        sg.destroyPipeline(pip);
     }
 }
 
 fn getCachedPipeline(key: u64, desc: sg.PipelineDesc) ?sg.Pipeline {
-    for (g_state.pipeline_cache) |entry| {
-        if (entry.valid and entry.key == key) {
-            return entry.pipeline;
-        }
+    const cache = &g_state.pipeline_cache;
+    if (cache.find(key)) |entry| {
+        cache.stats.hits += 1;
+        return entry.pipeline;
     }
+    cache.stats.misses += 1;
 
+    const zone = profiler.begin(.pipeline_create);
+    defer zone.end();
     const pip = sg.makePipeline(desc);
     const state = sg.queryPipelineState(pip);
     if (state != .VALID) {
         log.debug("getCachedPipeline: failed to create pipeline, state={s}", .{@tagName(state)});
         sg.destroyPipeline(pip);
+        cache.stats.failures += 1;
         return null;
     }
     log.debug("getCachedPipeline: created new pipeline, depth_compare={s} cull={s}", .{ @tagName(desc.depth.compare), @tagName(desc.cull_mode) });
 
-    const slot = g_state.pipeline_cache_next % MaxPipelineCacheEntries;
-    g_state.pipeline_cache_next += 1;
-    if (g_state.pipeline_cache[slot].valid and g_state.pipeline_cache[slot].pipeline.id != 0) {
-        sg.destroyPipeline(g_state.pipeline_cache[slot].pipeline);
-    }
-    g_state.pipeline_cache[slot] = .{
-        .key = key,
-        .pipeline = pip,
-        .valid = true,
+    const evicted = cache.insert(key, pip) catch {
+        // Still usable for this frame; it just will not be cached.
+        log.warn("getCachedPipeline: out of memory growing cache", .{});
+        return pip;
     };
+    if (evicted) |old| {
+        log.debug("getCachedPipeline: evicted LRU pipeline {d}", .{old.id});
+        destroyPipeline(old);
+    }
     return pip;
 }
 
-fn pipelineKey(shader_id: u32, desc: *const sg.PipelineDesc) u64 {
+/// Set how many pipelines stay live before LRU eviction kicks in. Drops
+/// the current cache, so call it before warm-up rather than mid-frame.
+pub fn setPipelineCacheCapacity(capacity: usize) void {
+    clearPipelineCache();
+    g_state.pipeline_cache.capacity = @max(capacity, 1);
+}
+
+pub fn pipelineCacheStats() PipelineCacheStats {
+    var stats = g_state.pipeline_cache.stats;
+    stats.live = @intCast(g_state.pipeline_cache.count);
+    stats.capacity = @intCast(g_state.pipeline_cache.capacity);
+    return stats;
+}
+
+/// Build the pipelines needed by every pending command without drawing, then
+/// discard the commands. Lets a loading screen render each material/state
+/// permutation once so pipeline creation never lands in a gameplay frame.
+/// Pipelines are built for the pass each command was recorded into.
+/// Returns the number of pipelines newly created.
+pub fn warmPipelines() u32 {
+    defer clearCommandStream();
+    if (!sg.isvalid()) return 0;
+
+    // Uploaded textures settle each slot's sample type, and with it the
+    // shader the pipelines are made for
+    webgl_texture.uploadDirtyTextures();
+    ensurePlaceholders();
+    const mgr = webgl_state.globalBufferManager();
+    const programs = webgl_program.globalProgramTable();
+    const tex_mgr = webgl_texture.globalTextureManager();
+    const before = g_state.pipeline_cache.stats;
+
+    var last_hash: ?u64 = null;
+    var last_pass: u32 = 0;
+    var textures = SlotTextures{};
+    for (g_state.commands.items) |*cmd| {
+        if (last_hash != null and last_hash.? == cmd.state_hash and last_pass == cmd.pass) continue;
+        const prog = validateCommand(cmd, mgr, programs) catch continue;
+        if (!resolveTextures(cmd, programs, tex_mgr, &textures)) continue;
+        const target = g_state.passes.items[cmd.pass].target;
+        const format: webgl_framebuffer.PassFormat = if (target.framebuffer == 0)
+            .{}
+        else
+            webgl_framebuffer.passFormat(target.attachments) orelse continue;
+        var pip_desc = sg.PipelineDesc{};
+        var bindings = sg.Bindings{};
+        if (!buildDrawDesc(cmd, prog, mgr, format, &pip_desc, &bindings)) continue;
+        _ = getCachedPipeline(pipelineKey(prog.backend_shader.id, &pip_desc), pip_desc);
+        last_hash = cmd.state_hash;
+        last_pass = cmd.pass;
+    }
+    const after = g_state.pipeline_cache.stats;
+    return @intCast((after.misses - before.misses) - (after.failures - before.failures));
+}
+
+pub fn pipelineKey(shader_id: u32, desc: *const sg.PipelineDesc) u64 {
     var hash: u64 = 1469598103934665603;
     hash = hashU64(hash, shader_id);
     hash = hashEnum(hash, desc.primitive_type);
@@ -937,6 +2335,10 @@ fn pipelineKey(shader_id: u32, desc: *const sg.PipelineDesc) u64 {
     hash = hashEnum(hash, desc.colors[0].blend.dst_factor_alpha);
     hash = hashEnum(hash, desc.colors[0].blend.op_alpha);
     hash = hashBool(hash, desc.alpha_to_coverage_enabled);
+    hash = hashU64(hash, @intCast(desc.color_count));
+    hash = hashEnum(hash, desc.colors[0].pixel_format);
+    hash = hashEnum(hash, desc.depth.pixel_format);
+    hash = hashU64(hash, @intCast(desc.sample_count));
     for (desc.layout.attrs) |attr| {
         hash = hashEnum(hash, attr.format);
         hash = hashU64(hash, @intCast(attr.offset));
@@ -944,6 +2346,8 @@ fn pipelineKey(shader_id: u32, desc: *const sg.PipelineDesc) u64 {
     }
     for (desc.layout.buffers) |buf_layout| {
         hash = hashU64(hash, @intCast(buf_layout.stride));
+        hash = hashEnum(hash, buf_layout.step_func);
+        hash = hashU64(hash, @intCast(buf_layout.step_rate));
     }
     return hash;
 }
@@ -1167,7 +2571,7 @@ test "Draw state queues commands" {
     try useProgram(pid);
     try enableVertexAttribArray(0);
     try drawArrays(0x0004, 0, 3);
-    try testing.expectEqual(@as(usize, 1), g_state.command_count);
+    try testing.expectEqual(@as(usize, 1), pendingCommandCount());
 }
 
 test "Draw state captures depth cull blend" {
@@ -1194,7 +2598,7 @@ test "Draw state captures depth cull blend" {
     try useProgram(pid);
     try drawArrays(0x0004, 0, 3);
 
-    const cmd = g_state.commands[0];
+    const cmd = renderStateOf(&g_state.commands.items[0]);
     try testing.expect(cmd.depth_enabled);
     try testing.expectEqual(GL_GREATER, cmd.depth_func);
     try testing.expectEqual(false, cmd.depth_mask);
@@ -1233,7 +2637,7 @@ test "Draw state captures stencil" {
     try useProgram(pid);
     try drawArrays(0x0004, 0, 3);
 
-    const cmd = g_state.commands[0];
+    const cmd = renderStateOf(&g_state.commands.items[0]);
     try testing.expect(cmd.stencil_enabled);
     try testing.expectEqual(GL_ALWAYS, cmd.stencil_func_front);
     try testing.expectEqual(GL_NEVER, cmd.stencil_func_back);
@@ -1282,3 +2686,736 @@ test "Pipeline key includes depth cull blend state" {
     const stencil_key = pipelineKey(1, &desc);
     try testing.expect(stencil_key != base);
 }
+
+test "Command compiler groups opaque draws and keeps barriers in place" {
+    reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    configureDrawReordering(true);
+    defer configureDrawReordering(false);
+
+    setDepthTestEnabled(true);
+    const pa = try programs.alloc();
+    const pb = try programs.alloc();
+
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    setBlendEnabled(true);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    setBlendEnabled(false);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+
+    const commands = g_state.commands.items;
+    try testing.expect(commands[0].reorderable);
+    try testing.expect(!commands[3].reorderable);
+
+    var order: [5]u32 = undefined;
+    const moved = compileCommandOrder(commands, &order);
+    try testing.expectEqualSlices(u32, &[_]u32{ 0, 2, 1, 3, 4 }, &order);
+    try testing.expectEqual(@as(u32, 2), moved);
+
+    // With reordering off the same draws keep submission order
+    reset();
+    configureDrawReordering(false);
+    setDepthTestEnabled(true);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    try testing.expect(!g_state.commands.items[0].reorderable);
+
+    var kept: [3]u32 = undefined;
+    try testing.expectEqual(@as(u32, 0), compileCommandOrder(g_state.commands.items, &kept));
+    try testing.expectEqualSlices(u32, &[_]u32{ 0, 1, 2 }, &kept);
+}
+
+test "Draw commands with identical state share a state hash" {
+    reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const pid = try programs.alloc();
+    try useProgram(pid);
+    try drawArrays(0x0004, 0, 3);
+    try drawArrays(0x0004, 3, 6);
+    setBlendEnabled(true);
+    try drawArrays(0x0004, 0, 3);
+
+    try testing.expectEqual(g_state.commands.items[0].state_hash, g_state.commands.items[1].state_hash);
+    try testing.expect(g_state.commands.items[0].state_hash != g_state.commands.items[2].state_hash);
+    // Depth testing is off by default, so nothing is eligible for reordering
+    try testing.expect(!g_state.commands.items[0].reorderable);
+}
+
+test "Flush stats count pipeline misses since the previous flush" {
+    reset();
+    defer reset();
+
+    // Stand in for pipelines created while the frame was recorded
+    g_state.pipeline_cache.stats.misses += 3;
+    flush(.{}, .{}, null);
+    try testing.expectEqual(@as(u32, 3), lastFlushStats().pipeline_misses);
+    g_state.pipeline_cache.stats.misses += 1;
+    flush(.{}, .{}, null);
+    try testing.expectEqual(@as(u32, 1), lastFlushStats().pipeline_misses);
+    flush(.{}, .{}, null);
+    try testing.expectEqual(FlushStats{}, lastFlushStats());
+}
+
+test "Instanced draws step divisor attributes per instance" {
+    reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    const mgr = webgl_state.globalBufferManager();
+
+    const pid = try programs.alloc();
+    try useProgram(pid);
+    const mesh = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(mesh);
+    const instances = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(instances);
+    // Per-vertex position, then an offset and a color from the same buffer
+    // at divisor 1 and, sharing that buffer, a second offset at divisor 2
+    try vertexAttribPointer(0, 3, 5126, false, 0, 0, mesh);
+    try vertexAttribPointer(1, 3, 5126, false, 28, 0, instances);
+    try vertexAttribPointer(2, 4, 5126, false, 28, 12, instances);
+    try vertexAttribPointer(3, 3, 5126, false, 0, 0, instances);
+    for (0..4) |i| try enableVertexAttribArray(@intCast(i));
+    try vertexAttribDivisor(1, 1);
+    try vertexAttribDivisor(2, 1);
+    try vertexAttribDivisor(3, 2);
+
+    try drawArraysInstanced(0x0004, 0, 36, 100);
+    try drawArraysInstanced(0x0004, 0, 36, 0);
+    try testing.expectEqual(@as(usize, 1), pendingCommandCount());
+    const cmd = &g_state.commands.items[0];
+    try testing.expectEqual(@as(i32, 100), cmd.instance_count);
+
+    var pip_desc = sg.PipelineDesc{};
+    var bindings = sg.Bindings{};
+    _ = buildDrawDesc(cmd, programs.get(pid).?, mgr, .{}, &pip_desc, &bindings);
+    const layout = pip_desc.layout;
+    try testing.expectEqual(@as(i32, 0), layout.attrs[0].buffer_index);
+    try testing.expectEqual(@as(i32, 1), layout.attrs[1].buffer_index);
+    try testing.expectEqual(@as(i32, 1), layout.attrs[2].buffer_index);
+    try testing.expectEqual(@as(i32, 2), layout.attrs[3].buffer_index);
+    try testing.expectEqual(sg.VertexStep.DEFAULT, layout.buffers[0].step_func);
+    try testing.expectEqual(sg.VertexStep.PER_INSTANCE, layout.buffers[1].step_func);
+    try testing.expectEqual(@as(i32, 1), layout.buffers[1].step_rate);
+    try testing.expectEqual(sg.VertexStep.PER_INSTANCE, layout.buffers[2].step_func);
+    try testing.expectEqual(@as(i32, 2), layout.buffers[2].step_rate);
+
+    // A divisor change is a different pipeline, not a rebind
+    const key = pipelineKey(1, &pip_desc);
+    pip_desc.layout.buffers[2].step_rate = 3;
+    try testing.expect(pipelineKey(1, &pip_desc) != key);
+    try drawArrays(0x0004, 0, 36);
+    try vertexAttribDivisor(3, 0);
+    try drawArrays(0x0004, 0, 36);
+    try testing.expectEqual(@as(i32, 1), g_state.commands.items[1].instance_count);
+    try testing.expect(g_state.commands.items[1].state_hash != g_state.commands.items[2].state_hash);
+
+    // Past what the backend can store, the attributes are rejected rather
+    // than stepping at a truncated rate
+    try vertexAttribDivisor(3, MaxVertexDivisor + 1);
+    try drawArraysInstanced(0x0004, 0, 36, 100);
+    const last = &g_state.commands.items[g_state.commands.items.len - 1];
+    try testing.expectEqual(@as(?VertexError, error.DivisorTooLarge), vertexStateOf(last).problem);
+}
+
+test "Vertex arrays own attributes and the element binding" {
+    reset();
+    defer reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    const mgr = webgl_state.globalBufferManager();
+    const vbo = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(vbo);
+    const ibo = try mgr.createBuffer(.{ .usage = .index });
+    defer _ = mgr.deleteBuffer(ibo);
+
+    const pid = try programs.alloc();
+    try useProgram(pid);
+    const a = try createVertexArray();
+    const b = try createVertexArray();
+    try testing.expect(a != 0 and a != b);
+
+    try bindVertexArray(a);
+    try vertexAttribPointer(0, 3, 5126, false, 0, 0, vbo);
+    try enableVertexAttribArray(0);
+    try mgr.bindBuffer(.element_array, ibo);
+    try bindVertexArray(b);
+    try testing.expect(!currentVertexArray().attribs[0].enabled);
+    try testing.expect(mgr.getBoundBuffer(.element_array) == null);
+    try bindVertexArray(a);
+    try testing.expect(mgr.getBoundBuffer(.element_array).? == ibo);
+
+    // Unchanged arrays resolve once and share one block per frame
+    try drawArrays(0x0004, 0, 3);
+    try drawArrays(0x0004, 3, 3);
+    try bindVertexArray(b);
+    try drawArrays(0x0004, 0, 3);
+    try bindVertexArray(a);
+    try drawArrays(0x0004, 0, 3);
+    const cmds = g_state.commands.items;
+    try testing.expectEqual(@as(usize, 2), g_state.vertex_states.items.len);
+    try testing.expectEqual(cmds[0].vertex_state, cmds[3].vertex_state);
+    try testing.expect(cmds[0].state_hash != cmds[2].state_hash);
+    try testing.expectEqual(@as(?VertexError, null), vertexStateOf(&cmds[0]).problem);
+    try testing.expectEqual(sg.VertexFormat.FLOAT3, vertexStateOf(&cmds[0]).layout.attrs[0].format);
+    try testing.expectEqual(@as(i32, 12), vertexStateOf(&cmds[0]).layout.buffers[0].stride);
+
+    try vertexAttribPointer(0, 2, 5126, false, 0, 0, vbo);
+    try drawArrays(0x0004, 0, 3);
+    try testing.expectEqual(@as(usize, 3), g_state.vertex_states.items.len);
+
+    // Bindings are looked up again only once a backend handle changes
+    const state = vertexStateOf(&g_state.commands.items[4]);
+    try testing.expectError(error.BufferNotReady, resolveVertexBindings(state, mgr));
+    mgr.buffers.get(vbo).?.backend = 7;
+    try testing.expectError(error.BufferNotReady, resolveVertexBindings(state, mgr));
+    mgr.buffers.backend_epoch +%= 1;
+    try resolveVertexBindings(state, mgr);
+    try testing.expectEqual(@as(u32, 7), state.vertex_buffers[0].id);
+    mgr.buffers.get(vbo).?.backend = 0;
+
+    try testing.expect(deleteVertexArray(a));
+    try testing.expectEqual(@as(u32, 0), boundVertexArray());
+    try testing.expect(!isVertexArray(a));
+    try testing.expectError(error.InvalidVertexArray, bindVertexArray(a));
+}
+
+test "Command stream grows past the old fixed capacity and interns state" {
+    reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    defer reset();
+
+    const pid = try programs.alloc();
+    try useProgram(pid);
+    for (0..200) |_| {
+        try drawArrays(0x0004, 0, 3);
+    }
+    try testing.expectEqual(@as(usize, 200), pendingCommandCount());
+    try testing.expectEqual(@as(usize, 1), g_state.render_states.items.len);
+    try testing.expectEqual(@as(usize, 1), g_state.vertex_states.items.len);
+
+    setDepthTestEnabled(true);
+    try drawArrays(0x0004, 0, 3);
+    try testing.expectEqual(@as(usize, 2), g_state.render_states.items.len);
+    try testing.expectEqual(g_state.commands.items[199].vertex_state, g_state.commands.items[200].vertex_state);
+    try testing.expect(renderStateOf(&g_state.commands.items[200]).depth_enabled);
+}
+
+test "Pipeline cache evicts least recently used entry" {
+    var cache = PipelineCache{ .capacity = 2 };
+    defer cache.deinit();
+
+    try testing.expectEqual(@as(?sg.Pipeline, null), try cache.insert(1, .{ .id = 10 }));
+    try testing.expectEqual(@as(?sg.Pipeline, null), try cache.insert(2, .{ .id = 20 }));
+    // Touch key 1 so key 2 becomes the LRU entry
+    try testing.expect(cache.find(1) != null);
+
+    const evicted = try cache.insert(3, .{ .id = 30 });
+    try testing.expectEqual(@as(u32, 20), evicted.?.id);
+    try testing.expectEqual(@as(u64, 1), cache.stats.evictions);
+    try testing.expect(cache.find(1) != null);
+    try testing.expect(cache.find(2) == null);
+    try testing.expectEqual(@as(u32, 30), cache.find(3).?.pipeline.id);
+}
+
+test "Pipeline cache keeps colliding keys reachable after removal" {
+    var cache = PipelineCache{ .capacity = 4 };
+    defer cache.deinit();
+
+    // Table has 8 slots, so these keys share home slot 0 and probe 0, 1, 2
+    _ = try cache.insert(8, .{ .id = 1 });
+    _ = try cache.insert(16, .{ .id = 2 });
+    _ = try cache.insert(24, .{ .id = 3 });
+    try testing.expectEqual(@as(u64, 8), cache.slots[0].key);
+    cache.removeAt(0);
+
+    try testing.expect(cache.find(8) == null);
+    try testing.expectEqual(@as(u32, 2), cache.find(16).?.pipeline.id);
+    try testing.expectEqual(@as(u32, 3), cache.find(24).?.pipeline.id);
+    try testing.expectEqual(@as(usize, 2), cache.count);
+}
+
+test "Pipeline cache keeps recency order across backward shifts" {
+    var cache = PipelineCache{ .capacity = 3 };
+    defer cache.deinit();
+
+    // Every key shares home slot 0, so each eviction shifts the rest back
+    _ = try cache.insert(8, .{ .id = 1 });
+    _ = try cache.insert(16, .{ .id = 2 });
+    _ = try cache.insert(24, .{ .id = 3 });
+    // Recency, oldest first: 16, 8, 24
+    try testing.expect(cache.find(8) != null);
+    try testing.expect(cache.find(24) != null);
+
+    // Evicting 16 shifts 24 back a slot; 8 must be evicted next, then 24
+    try testing.expectEqual(@as(u32, 2), (try cache.insert(32, .{ .id = 4 })).?.id);
+    try testing.expectEqual(@as(u32, 1), (try cache.insert(40, .{ .id = 5 })).?.id);
+    try testing.expectEqual(@as(u32, 3), (try cache.insert(48, .{ .id = 6 })).?.id);
+    try testing.expectEqual(@as(u64, 3), cache.stats.evictions);
+    try testing.expectEqual(@as(usize, 3), cache.count);
+}
+
+const camera_test_vs =
+    \\uniform mat4 projectionMatrix;
+    \\uniform mat4 modelViewMatrix;
+    \\attribute vec3 position;
+    \\void main() {
+    \\  gl_Position = projectionMatrix * modelViewMatrix * vec4(position, 1.0);
+    \\}
+;
+
+fn linkCameraTestProgram() !webgl_program.ProgramId {
+    const webgl_shader = @import("webgl_shader.zig");
+    const shaders = webgl_shader.globalShaderTable();
+    const programs = webgl_program.globalProgramTable();
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs, camera_test_vs);
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+    try shaders.compile(fs);
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+    return pid;
+}
+
+test "Draws snapshot only changed uniform scopes" {
+    const webgl_shader = @import("webgl_shader.zig");
+    reset();
+    defer reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const pid = try linkCameraTestProgram();
+    try useProgram(pid);
+
+    const proj_loc: u32 = @intCast(try programs.getUniformLocation(pid, "projectionMatrix"));
+    const mv_loc: u32 = @intCast(try programs.getUniformLocation(pid, "modelViewMatrix"));
+    var mat = [_]f32{0} ** 16;
+
+    mat[0] = 1.0;
+    try programs.setUniformFloats(pid, mv_loc, &mat);
+    try drawArrays(0x0004, 0, 3);
+    try drawArrays(0x0004, 0, 3);
+    // Camera-only change: the object bytes are shared, not copied
+    try programs.setUniformFloats(pid, proj_loc, &mat);
+    try drawArrays(0x0004, 0, 3);
+    mat[0] = 2.0;
+    try programs.setUniformFloats(pid, mv_loc, &mat);
+    try drawArrays(0x0004, 0, 3);
+
+    const cmds = g_state.commands.items;
+    const snaps = g_state.uniform_snapshots.items;
+    try testing.expectEqual(cmds[0].uniforms, cmds[1].uniforms);
+    try testing.expect(cmds[1].uniforms != cmds[2].uniforms);
+    try testing.expect(cmds[2].uniforms != cmds[3].uniforms);
+    try testing.expectEqual(@as(usize, 3), snaps.len);
+    try testing.expectEqual(@as(u32, 64), snaps[0].object[0].len);
+    try testing.expectEqual(@as(u32, 64), snaps[0].frame[0].len);
+    try testing.expectEqual(snaps[0].object[0], snaps[1].object[0]);
+    try testing.expectEqual(snaps[1].frame[0], snaps[2].frame[0]);
+    // 128 bytes for the first draw, then one 64-byte matrix per change
+    try testing.expectEqual(@as(usize, 256), g_state.uniform_bytes.items.len);
+
+    // Replaying the first draw's snapshot puts its matrix back
+    const prog = programs.get(pid).?;
+    applyUniformSnapshot(prog, cmds[0].uniforms);
+    const bytes = prog.scopeUniformBytes(.vertex, .object);
+    try testing.expectEqual(@as(f32, 1.0), @as(f32, @bitCast(bytes[0..4].*)));
+}
+
+test "Passes with different cameras each replay their own camera" {
+    const webgl_shader = @import("webgl_shader.zig");
+    reset();
+    defer reset();
+    webgl_framebuffer.reset();
+    defer webgl_framebuffer.reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const pid = try linkCameraTestProgram();
+    try useProgram(pid);
+    const proj_loc: u32 = @intCast(try programs.getUniformLocation(pid, "projectionMatrix"));
+    const mv_loc: u32 = @intCast(try programs.getUniformLocation(pid, "modelViewMatrix"));
+    var model = [_]f32{0} ** 16;
+    model[0] = 1.0;
+    try programs.setUniformFloats(pid, mv_loc, &model);
+
+    // Shadow pass into a render target with the light's camera
+    const rb = try webgl_framebuffer.createRenderbuffer();
+    try webgl_framebuffer.bindRenderbuffer(rb);
+    try webgl_framebuffer.renderbufferStorage(0x8058, 256, 256);
+    const fbo = try webgl_framebuffer.createFramebuffer();
+    try webgl_framebuffer.bindFramebuffer(.both, fbo);
+    try webgl_framebuffer.framebufferRenderbuffer(.both, .color0, rb);
+    var light = [_]f32{0} ** 16;
+    light[0] = 3.0;
+    try programs.setUniformFloats(pid, proj_loc, &light);
+    try drawArrays(0x0004, 0, 3);
+
+    // Main pass to the window with the view camera
+    try webgl_framebuffer.bindFramebuffer(.both, 0);
+    var view = [_]f32{0} ** 16;
+    view[0] = 5.0;
+    try programs.setUniformFloats(pid, proj_loc, &view);
+    try drawArrays(0x0004, 0, 3);
+
+    const cmds = g_state.commands.items;
+    try testing.expect(cmds[0].pass != cmds[1].pass);
+    const prog = programs.get(pid).?;
+    applyUniformSnapshot(prog, cmds[0].uniforms);
+    try testing.expectEqual(@as(f32, 3.0), @as(f32, @bitCast(prog.scopeUniformBytes(.vertex, .frame)[0..4].*)));
+    applyUniformSnapshot(prog, cmds[1].uniforms);
+    try testing.expectEqual(@as(f32, 5.0), @as(f32, @bitCast(prog.scopeUniformBytes(.vertex, .frame)[0..4].*)));
+    // The model matrix was written once and is shared by both passes
+    try testing.expectEqual(g_state.uniform_snapshots.items[0].object[0], g_state.uniform_snapshots.items[1].object[0]);
+}
+
+test "Passes split on framebuffer changes and clears after draws" {
+    reset();
+    defer reset();
+    configureDrawReordering(true);
+    defer configureDrawReordering(false);
+    webgl_framebuffer.reset();
+    defer webgl_framebuffer.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const rb = try webgl_framebuffer.createRenderbuffer();
+    try webgl_framebuffer.bindRenderbuffer(rb);
+    try webgl_framebuffer.renderbufferStorage(0x8058, 256, 256);
+    const fbo = try webgl_framebuffer.createFramebuffer();
+    try webgl_framebuffer.bindFramebuffer(.both, fbo);
+    try webgl_framebuffer.framebufferRenderbuffer(.both, .color0, rb);
+
+    setDepthTestEnabled(true);
+    const pa = try programs.alloc();
+    const pb = try programs.alloc();
+
+    // Leading clears fold into the first pass's load action
+    setClearColor(1, 0, 0, 1);
+    requestClear(GL_COLOR_BUFFER_BIT);
+    requestClear(GL_DEPTH_BUFFER_BIT);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    // Back to the window: same state, different pass
+    try webgl_framebuffer.bindFramebuffer(.both, 0);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    // A clear after draws starts another pass on the same target
+    requestClear(GL_COLOR_BUFFER_BIT);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+
+    const passes = g_state.passes.items;
+    try testing.expectEqual(@as(usize, 3), passes.len);
+    try testing.expectEqual(fbo, passes[0].target.framebuffer);
+    try testing.expectEqual(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, passes[0].clear_mask);
+    try testing.expectEqual(@as(f32, 1), passes[0].clear_color.r);
+    try testing.expectEqual(@as(u32, 0), passes[0].first_command);
+    try testing.expectEqual(@as(u32, 2), passes[0].end_command);
+    try testing.expectEqual(@as(u32, 0), passes[1].target.framebuffer);
+    try testing.expectEqual(@as(u32, 0), passes[1].clear_mask);
+    try testing.expectEqual(GL_COLOR_BUFFER_BIT, passes[2].clear_mask);
+
+    const first = passAction(&passes[0], null);
+    try testing.expectEqual(sg.LoadAction.CLEAR, first.colors[0].load_action);
+    try testing.expectEqual(sg.LoadAction.CLEAR, first.depth.load_action);
+    try testing.expectEqual(sg.LoadAction.LOAD, first.stencil.load_action);
+    const second = passAction(&passes[1], null);
+    try testing.expectEqual(sg.LoadAction.LOAD, second.colors[0].load_action);
+
+    // Opaque draws only regroup inside their own pass
+    var order: [4]u32 = undefined;
+    _ = compileCommandOrder(g_state.commands.items, &order);
+    try testing.expectEqualSlices(u32, &[_]u32{ 1, 0, 2, 3 }, &order);
+
+    // Attaching something new starts a pass even without a rebind
+    try webgl_framebuffer.bindFramebuffer(.both, fbo);
+    try drawArrays(0x0004, 0, 3);
+    try webgl_framebuffer.framebufferRenderbuffer(.both, .color0, 0);
+    try drawArrays(0x0004, 0, 3);
+    try testing.expectEqual(@as(usize, 5), g_state.passes.items.len);
+}
+
+test "Pipeline key includes the pass format" {
+    var desc = sg.PipelineDesc{};
+    desc.primitive_type = .TRIANGLES;
+    const swapchain = pipelineKey(1, &desc);
+
+    desc.colors[0].pixel_format = .RGBA8;
+    desc.depth.pixel_format = .NONE;
+    desc.sample_count = 1;
+    const offscreen = pipelineKey(1, &desc);
+    try testing.expect(offscreen != swapchain);
+
+    desc.color_count = 0;
+    desc.colors[0].pixel_format = .NONE;
+    desc.depth.pixel_format = .DEPTH;
+    try testing.expect(pipelineKey(1, &desc) != offscreen);
+}
+
+test "blitFramebuffer ends the multisampled pass with a resolve" {
+    reset();
+    defer reset();
+    webgl_framebuffer.reset();
+    defer webgl_framebuffer.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const msaa_rb = try webgl_framebuffer.createRenderbuffer();
+    try webgl_framebuffer.bindRenderbuffer(msaa_rb);
+    try webgl_framebuffer.renderbufferStorageMultisample(4, 0x8058, 64, 64);
+    const resolve_rb = try webgl_framebuffer.createRenderbuffer();
+    try webgl_framebuffer.bindRenderbuffer(resolve_rb);
+    try webgl_framebuffer.renderbufferStorage(0x8058, 64, 64);
+    const msaa = try webgl_framebuffer.createFramebuffer();
+    try webgl_framebuffer.bindFramebuffer(.both, msaa);
+    try webgl_framebuffer.framebufferRenderbuffer(.both, .color0, msaa_rb);
+    const target = try webgl_framebuffer.createFramebuffer();
+    try webgl_framebuffer.bindFramebuffer(.both, target);
+    try webgl_framebuffer.framebufferRenderbuffer(.both, .color0, resolve_rb);
+
+    const pid = try programs.alloc();
+    try useProgram(pid);
+    try webgl_framebuffer.bindFramebuffer(.both, msaa);
+    try drawArrays(0x0004, 0, 3);
+    try webgl_framebuffer.bindFramebuffer(.read, msaa);
+    try webgl_framebuffer.bindFramebuffer(.draw, target);
+    try testing.expectError(error.UnsupportedBlit, blitFramebuffer(.{ 0, 0, 32, 32 }, .{ 0, 0, 32, 32 }, GL_COLOR_BUFFER_BIT));
+    try blitFramebuffer(.{ 0, 0, 64, 64 }, .{ 0, 0, 64, 64 }, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    try testing.expectEqual(@as(usize, 1), g_state.passes.items.len);
+    try testing.expect(std.meta.eql(g_state.passes.items[0].resolve, webgl_framebuffer.Attachment{ .renderbuffer = resolve_rb }));
+
+    // Drawing on after the resolve needs a pass of its own, and a second
+    // blit an empty pass that loads the multisampled contents
+    try webgl_framebuffer.bindFramebuffer(.both, msaa);
+    try drawArrays(0x0004, 0, 3);
+    try testing.expectEqual(@as(usize, 2), g_state.passes.items.len);
+    try webgl_framebuffer.bindFramebuffer(.draw, target);
+    try blitFramebuffer(.{ 0, 0, 64, 64 }, .{ 0, 0, 64, 64 }, GL_COLOR_BUFFER_BIT);
+    try blitFramebuffer(.{ 0, 0, 64, 64 }, .{ 0, 0, 64, 64 }, GL_COLOR_BUFFER_BIT);
+    const passes = g_state.passes.items;
+    try testing.expectEqual(@as(usize, 3), passes.len);
+    try testing.expectEqual(passes[2].first_command, passes[2].end_command);
+    try testing.expect(passes[2].resolve != .none);
+
+    // Depth is stored so a later pass, or a shadow lookup, can read it
+    const action = passAction(&passes[2], null);
+    try testing.expectEqual(sg.LoadAction.LOAD, action.colors[0].load_action);
+    try testing.expectEqual(sg.StoreAction.STORE, action.depth.store_action);
+}
+
+test "Query markers keep draws from crossing them" {
+    reset();
+    defer reset();
+    configureDrawReordering(true);
+    defer configureDrawReordering(false);
+    webgl_query.reset(false);
+    defer webgl_query.reset(false);
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    setDepthTestEnabled(true);
+    const pa = try programs.alloc();
+    const pb = try programs.alloc();
+    const q = try webgl_query.createQuery();
+
+    // pb, [begin] pa, pb, [end] pa: without the markers all four regroup
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    try beginQuery(.any_samples_passed, q);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+    try useProgram(pb);
+    try drawArrays(0x0004, 0, 3);
+    try endQuery(.any_samples_passed);
+    try useProgram(pa);
+    try drawArrays(0x0004, 0, 3);
+
+    const markers = g_state.query_markers.items;
+    try testing.expectEqual(@as(usize, 2), markers.len);
+    try testing.expectEqual(@as(u32, 1), markers[0].position);
+    try testing.expectEqual(@as(u32, 3), markers[1].position);
+    try testing.expect(!g_state.commands.items[1].reorderable);
+    try testing.expect(!g_state.commands.items[3].reorderable);
+
+    var order: [4]u32 = undefined;
+    _ = compileCommandOrder(g_state.commands.items, &order);
+    try testing.expectEqualSlices(u32, &[_]u32{ 0, 1, 2, 3 }, &order);
+
+    // Deleting the active query ends it in place
+    try beginQuery(.time_elapsed, try webgl_query.createQuery());
+    try testing.expect(deleteQuery(webgl_query.currentQuery(.time_elapsed)));
+    try testing.expectEqual(webgl_query.Action.end, g_state.query_markers.items[3].action);
+    try testing.expectError(error.NoActiveQuery, endQuery(.time_elapsed));
+}
+
+test "readPixels attaches to the read framebuffer's last pass" {
+    reset();
+    defer reset();
+    webgl_framebuffer.reset();
+    defer webgl_framebuffer.reset();
+    webgl_readback.reset(false);
+    defer webgl_readback.reset(false);
+    const mgr = webgl_state.globalBufferManager();
+    const buf = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(buf);
+    try mgr.bindBuffer(.pixel_pack, buf);
+    try mgr.bufferData(.pixel_pack, &([_]u8{0} ** 64));
+
+    requestClear(GL_COLOR_BUFFER_BIT);
+    try readPixels(.{ 0, 0, 2, 2 }, .rgba8, buf, 0);
+    try readPixels(.{ 2, 2, 2, 2 }, .rgba8, buf, 16);
+    try testing.expectEqual(@as(usize, 1), g_state.passes.items.len);
+    try testing.expectEqual(@as(u32, 2), g_state.passes.items[0].readback_end);
+
+    // Later work needs a pass of its own, so the reads see none of it
+    requestClear(GL_COLOR_BUFFER_BIT);
+    try testing.expectEqual(@as(usize, 2), g_state.passes.items.len);
+    try testing.expect(!g_state.passes.items[1].hasReadbacks());
+    try readPixels(.{ 0, 0, 1, 1 }, .rgba32f, buf, 48);
+    try testing.expectEqual(@as(u32, 2), g_state.passes.items[1].readback_first);
+
+    // Reading past the buffer, zero-sized reads and non-pack buffers
+    try testing.expectError(error.OutOfRange, readPixels(.{ 0, 0, 4, 4 }, .rgba8, buf, 4));
+    try readPixels(.{ 0, 0, 0, 4 }, .rgba8, buf, 0);
+    try testing.expectEqual(@as(usize, 3), g_state.readbacks.items.len);
+    const vbo = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(vbo);
+    try testing.expectError(error.InvalidBuffer, readPixels(.{ 0, 0, 1, 1 }, .rgba8, vbo, 0));
+}
+
+test "Multi-draws record one command with their ranges" {
+    reset();
+    defer reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    const mgr = webgl_state.globalBufferManager();
+
+    try testing.expectError(error.NoProgram, multiDrawArrays(0x0004, &.{.{ .first = 0, .count = 3 }}));
+    try useProgram(try programs.alloc());
+    try multiDrawArrays(0x0004, &.{
+        .{ .first = 0, .count = 3 },
+        .{ .first = 3, .count = 0 },
+        .{ .first = 6, .count = 6, .instance_count = 2 },
+    });
+    // Nothing to draw records nothing
+    try multiDrawArrays(0x0004, &.{.{ .first = 0, .count = 0 }});
+    try testing.expectError(error.InvalidValue, multiDrawArrays(0x0004, &.{.{ .first = -1, .count = 3 }}));
+    try testing.expectEqual(@as(usize, 1), pendingCommandCount());
+    const cmd = &g_state.commands.items[0];
+    try testing.expectEqual(@as(u32, 3), cmd.range_count);
+    // Empty ranges keep their slot so gl_DrawID stays the range index
+    try testing.expectEqual(@as(i32, 6), g_state.draw_ranges.items[2].first);
+
+    const ebo = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(ebo);
+    try multiDrawElements(0x0004, GL_UNSIGNED_SHORT, ebo, &.{
+        .{ .first = 0, .count = 6 },
+        .{ .first = 12, .count = 6 },
+    });
+    try testing.expectError(error.InvalidOffset, multiDrawElements(0x0004, GL_UNSIGNED_INT, ebo, &.{.{ .first = 6, .count = 3 }}));
+    try testing.expectError(error.InvalidIndexType, multiDrawElements(0x0004, 0x1401, ebo, &.{.{ .first = 0, .count = 3 }}));
+    const elements = &g_state.commands.items[1];
+    try testing.expectEqual(@as(u32, 3), elements.range_first);
+    // Byte offsets become first indices
+    try testing.expectEqual(@as(i32, 6), g_state.draw_ranges.items[4].first);
+    try testing.expectEqual(@as(u32, 0), elements.index_offset);
+}
+
+test "Draws copy bound uniform buffer ranges once per change" {
+    const webgl_shader = @import("webgl_shader.zig");
+    reset();
+    defer reset();
+    const shaders = webgl_shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = webgl_program.globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    const mgr = webgl_state.globalBufferManager();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\layout(std140) uniform Camera {
+        \\  mat4 viewProjection;
+        \\};
+        \\in vec3 position;
+        \\void main() { gl_Position = viewProjection * vec4(position, 1.0); }
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+    try shaders.compile(fs);
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+    try programs.setUniformBlockBinding(pid, 0, 3);
+    try useProgram(pid);
+
+    const ubo = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(ubo);
+    try mgr.bindBuffer(.uniform, ubo);
+    try mgr.bufferData(.uniform, &([_]u8{1} ** 128));
+    try mgr.bindBufferRange(3, ubo, 64, 64);
+
+    try drawArrays(0x0004, 0, 3);
+    try drawArrays(0x0004, 0, 3);
+    const cmds = g_state.commands.items;
+    try testing.expectEqual(cmds[0].uniform_buffers, cmds[1].uniform_buffers);
+    try testing.expectEqual(@as(usize, 64), g_state.uniform_buffer_bytes.items.len);
+    const first = g_state.uniform_buffer_states.items[cmds[0].uniform_buffers];
+    try testing.expectEqual(@as(u8, 1), first.count);
+    try testing.expectEqual(@as(u32, 64), first.slots[0].size);
+
+    // New contents are copied again, at the next aligned offset
+    try mgr.bufferSubData(.uniform, 64, &.{2});
+    try drawArrays(0x0004, 0, 3);
+    const second = g_state.uniform_buffer_states.items[g_state.commands.items[2].uniform_buffers];
+    const alignment = gl_uniforms.uniformBufferOffsetAlignment();
+    try testing.expectEqual(@as(u32, alignment), second.slots[0].offset);
+    try testing.expectEqual(@as(u8, 2), g_state.uniform_buffer_bytes.items[alignment]);
+
+    // Nothing bound at the block's binding point leaves its slot empty
+    try programs.setUniformBlockBinding(pid, 0, 4);
+    try drawArrays(0x0004, 0, 3);
+    const unbound = g_state.uniform_buffer_states.items[g_state.commands.items[3].uniform_buffers];
+    try testing.expectEqual(@as(u32, 0), unbound.slots[0].size);
+}
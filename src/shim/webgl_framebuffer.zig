@@ -0,0 +1,745 @@
+//! WebGL framebuffer and renderbuffer objects
+//!
+//! A framebuffer names what draws land in: a color attachment and a
+//! depth/stencil attachment, each a 2D texture level 0 or a renderbuffer.
+//! Framebuffer 0 is the swapchain. webgl_draw snapshots the bound draw
+//! framebuffer's attachments when a pass starts and, at flush, resolves
+//! each pass into sokol attachment views through a small cache keyed by
+//! the backing images, so a render target used every frame creates its
+//! views once.
+//!
+//! sokol has a single depth-stencil attachment, so DEPTH_ATTACHMENT,
+//! STENCIL_ATTACHMENT and DEPTH_STENCIL_ATTACHMENT share one slot; a
+//! framebuffer with different depth and stencil objects is unsupported.
+//!
+//! Multisampled renderbuffers resolve the way sokol does it: at the end of
+//! the pass that drew them, into a single-sampled color image. A
+//! blitFramebuffer() from a multisampled framebuffer becomes that resolve,
+//! so only full-size color blits between matching formats are supported.
+
+const std = @import("std");
+const testing = std.testing;
+const sokol = @import("sokol");
+const sg = sokol.gfx;
+const webgl_texture = @import("webgl_texture.zig");
+const webgl_backend = @import("webgl_backend.zig");
+
+const log = std.log.scoped(.webgl_framebuffer);
+
+pub const MaxFramebuffers: usize = 64;
+pub const MaxRenderbuffers: usize = 64;
+/// Attachment sets whose sokol views stay live between frames.
+pub const MaxCachedPasses: usize = 32;
+/// MAX_SAMPLES: every GL 3.3 and GLES 3.0 implementation supports 4
+pub const MaxSamples: u32 = 4;
+
+// checkFramebufferStatus() results
+pub const Status = enum(u32) {
+    complete = 0x8CD5,
+    incomplete_attachment = 0x8CD6,
+    incomplete_missing_attachment = 0x8CD7,
+    incomplete_dimensions = 0x8CD9,
+    unsupported = 0x8CDD,
+    incomplete_multisample = 0x8D56,
+};
+
+/// Binding points of bindFramebuffer(). FRAMEBUFFER sets both.
+pub const Binding = enum { draw, read, both };
+
+pub const AttachmentPoint = enum { color0, depth, stencil, depth_stencil };
+
+pub const Attachment = union(enum) {
+    none,
+    texture: webgl_texture.TextureId,
+    renderbuffer: u32,
+};
+
+/// What a framebuffer draws into, as sokol sees it.
+pub const AttachmentSet = struct {
+    color: Attachment = .none,
+    depth_stencil: Attachment = .none,
+};
+
+/// Attachment formats a pipeline must be built for. The default value
+/// leaves every field to sokol's swapchain defaults.
+pub const PassFormat = struct {
+    color: sg.PixelFormat = .DEFAULT,
+    depth: sg.PixelFormat = .DEFAULT,
+    sample_count: i32 = 0,
+
+    pub fn colorCount(self: PassFormat) i32 {
+        return if (self.color == .NONE) 0 else 1;
+    }
+};
+
+/// The bound draw framebuffer at some point in recording. `revision`
+/// changes whenever that framebuffer's attachments do, so two targets
+/// with the same framebuffer and revision draw into the same images.
+pub const DrawTarget = struct {
+    framebuffer: u32 = 0,
+    revision: u32 = 0,
+    attachments: AttachmentSet = .{},
+};
+
+/// An offscreen pass ready for sg.beginPass().
+pub const ResolvedPass = struct {
+    attachments: sg.Attachments,
+    format: PassFormat,
+    width: u32,
+    height: u32,
+};
+
+const Framebuffer = struct {
+    live: bool = false,
+    color: Attachment = .none,
+    depth: Attachment = .none,
+    stencil: Attachment = .none,
+    revision: u32 = 0,
+};
+
+pub const RenderbufferFormat = enum { color, depth, depth_stencil };
+
+const Renderbuffer = struct {
+    live: bool = false,
+    width: u32 = 0,
+    height: u32 = 0,
+    format: RenderbufferFormat = .color,
+    pixel_format: sg.PixelFormat = .NONE,
+    sample_count: u32 = 1,
+    /// Created on first use as an attachment, once sokol is up
+    image: sg.Image = .{},
+};
+
+const CachedPass = struct {
+    color_image: u32 = 0,
+    depth_image: u32 = 0,
+    resolve_image: u32 = 0,
+    color_view: sg.View = .{},
+    depth_view: sg.View = .{},
+    resolve_view: sg.View = .{},
+    last_used: u64 = 0,
+    valid: bool = false,
+};
+
+/// Attachment views by (color image, depth image, resolve image). Image ids are never
+/// reused by sokol, so an entry whose images were recreated simply stops
+/// matching; misses first reclaim entries whose images are gone, then the
+/// least recently used one.
+const PassCache = struct {
+    entries: [MaxCachedPasses]CachedPass = [_]CachedPass{.{}} ** MaxCachedPasses,
+    tick: u64 = 0,
+    stats: PassCacheStats = .{},
+
+    fn find(self: *PassCache, color_image: u32, depth_image: u32, resolve_image: u32) ?*CachedPass {
+        for (&self.entries) |*entry| {
+            if (entry.valid and entry.color_image == color_image and entry.depth_image == depth_image and
+                entry.resolve_image == resolve_image)
+            {
+                self.tick += 1;
+                entry.last_used = self.tick;
+                return entry;
+            }
+        }
+        return null;
+    }
+
+    /// Slot for a new entry. A displaced entry is returned still valid so
+    /// the caller can release its views.
+    fn victim(self: *PassCache, is_stale: *const fn (*const CachedPass) bool) *CachedPass {
+        var oldest: *CachedPass = &self.entries[0];
+        for (&self.entries) |*entry| {
+            if (!entry.valid or is_stale(entry)) return entry;
+            if (entry.last_used < oldest.last_used) oldest = entry;
+        }
+        return oldest;
+    }
+};
+
+pub const PassCacheStats = struct {
+    hits: u64 = 0,
+    misses: u64 = 0,
+    evictions: u64 = 0,
+};
+
+const FramebufferState = struct {
+    framebuffers: [MaxFramebuffers + 1]Framebuffer = [_]Framebuffer{.{}} ** (MaxFramebuffers + 1),
+    renderbuffers: [MaxRenderbuffers + 1]Renderbuffer = [_]Renderbuffer{.{}} ** (MaxRenderbuffers + 1),
+    next_framebuffer: u32 = 1,
+    next_renderbuffer: u32 = 1,
+    draw_binding: u32 = 0,
+    read_binding: u32 = 0,
+    renderbuffer_binding: u32 = 0,
+    /// Samples per pixel of the window's swapchain
+    swapchain_samples: u32 = 1,
+    /// Source of Framebuffer.revision; bumped on every attachment change
+    revision: u32 = 0,
+    pass_cache: PassCache = .{},
+};
+
+var g_state: FramebufferState = .{};
+
+/// Destroy every backend object and forget all framebuffers.
+pub fn reset() void {
+    if (sg.isvalid()) {
+        for (&g_state.pass_cache.entries) |*entry| releaseCached(entry);
+        for (&g_state.renderbuffers) |*rb| webgl_backend.destroyTextureImage(rb.image);
+    }
+    g_state = .{ .swapchain_samples = g_state.swapchain_samples };
+}
+
+/// Record the window's MSAA sample count (WindowConfig.sample_count).
+pub fn setSwapchainSamples(count: u32) void {
+    g_state.swapchain_samples = @max(count, 1);
+}
+
+pub fn swapchainSamples() u32 {
+    return g_state.swapchain_samples;
+}
+
+/// SAMPLES: samples per pixel of what `binding` names, 0 when incomplete.
+pub fn samples(binding: Binding) u32 {
+    const id = boundFramebuffer(binding);
+    if (id == 0) return g_state.swapchain_samples;
+    const set = attachmentSet(&g_state.framebuffers[id]);
+    const format = passFormat(set) orelse return 0;
+    return @intCast(format.sample_count);
+}
+
+// =============================================================================
+// Framebuffers
+// =============================================================================
+
+/// Allocate a framebuffer. Its handle is never 0.
+pub fn createFramebuffer() !u32 {
+    const id = allocSlot(Framebuffer, &g_state.framebuffers, &g_state.next_framebuffer) orelse return error.AtCapacity;
+    g_state.framebuffers[id] = .{ .live = true, .revision = nextRevision() };
+    return id;
+}
+
+pub fn isFramebuffer(id: u32) bool {
+    return id != 0 and id <= MaxFramebuffers and g_state.framebuffers[id].live;
+}
+
+/// Free a framebuffer; bindings to it fall back to the swapchain.
+pub fn deleteFramebuffer(id: u32) bool {
+    if (!isFramebuffer(id)) return false;
+    if (g_state.draw_binding == id) g_state.draw_binding = 0;
+    if (g_state.read_binding == id) g_state.read_binding = 0;
+    g_state.framebuffers[id].live = false;
+    return true;
+}
+
+pub fn bindFramebuffer(binding: Binding, id: u32) !void {
+    if (id != 0 and !isFramebuffer(id)) return error.InvalidFramebuffer;
+    if (binding != .read) g_state.draw_binding = id;
+    if (binding != .draw) g_state.read_binding = id;
+}
+
+pub fn boundFramebuffer(binding: Binding) u32 {
+    return if (binding == .read) g_state.read_binding else g_state.draw_binding;
+}
+
+/// Attach level 0 of a 2D texture (null detaches). The texture's GPU
+/// image is recreated as a render target on the next upload.
+pub fn framebufferTexture2D(binding: Binding, point: AttachmentPoint, texture: ?webgl_texture.TextureId) !void {
+    const fb = try boundForWrite(binding);
+    const attachment: Attachment = if (texture) |id| blk: {
+        const table = &webgl_texture.globalTextureManager().textures;
+        if (!table.isValid(id)) return error.InvalidTexture;
+        try table.markRenderTarget(id);
+        break :blk .{ .texture = id };
+    } else .none;
+    attach(fb, point, attachment);
+}
+
+/// Attach a renderbuffer (0 detaches).
+pub fn framebufferRenderbuffer(binding: Binding, point: AttachmentPoint, renderbuffer: u32) !void {
+    const fb = try boundForWrite(binding);
+    if (renderbuffer != 0 and !isRenderbuffer(renderbuffer)) return error.InvalidRenderbuffer;
+    attach(fb, point, if (renderbuffer == 0) .none else .{ .renderbuffer = renderbuffer });
+}
+
+/// The framebuffer draws currently go to, with its attachments.
+pub fn drawTarget() DrawTarget {
+    return targetOf(g_state.draw_binding);
+}
+
+/// The framebuffer blits and reads come from, with its attachments.
+pub fn readTarget() DrawTarget {
+    return targetOf(g_state.read_binding);
+}
+
+fn targetOf(id: u32) DrawTarget {
+    if (id == 0) return .{};
+    const fb = &g_state.framebuffers[id];
+    return .{ .framebuffer = id, .revision = fb.revision, .attachments = attachmentSet(fb) };
+}
+
+/// Completeness of the framebuffer bound to `binding`; the swapchain is
+/// always complete.
+pub fn checkStatus(binding: Binding) Status {
+    const id = boundFramebuffer(binding);
+    if (id == 0) return .complete;
+    const fb = &g_state.framebuffers[id];
+    if (fb.depth != .none and fb.stencil != .none and !std.meta.eql(fb.depth, fb.stencil)) return .unsupported;
+    return checkAttachments(attachmentSet(fb));
+}
+
+pub fn checkAttachments(set: AttachmentSet) Status {
+    const color = describe(set.color) catch return .incomplete_attachment;
+    const depth = describe(set.depth_stencil) catch return .incomplete_attachment;
+    if (color == null and depth == null) return .incomplete_missing_attachment;
+    if (color) |info| {
+        if (info.kind != .color) return .incomplete_attachment;
+    }
+    if (depth) |info| {
+        if (info.kind == .color) return .incomplete_attachment;
+    }
+    if (color != null and depth != null) {
+        if (color.?.width != depth.?.width or color.?.height != depth.?.height) return .incomplete_dimensions;
+        if (color.?.sample_count != depth.?.sample_count) return .incomplete_multisample;
+    }
+    return .complete;
+}
+
+/// Check that blitting `src`'s color into `dst`'s is a resolve sokol can
+/// do: a multisampled source, a single-sampled destination of the same
+/// format and size. Returns the size.
+pub fn checkResolve(src: AttachmentSet, dst: AttachmentSet) ![2]u32 {
+    if (checkAttachments(src) != .complete or checkAttachments(dst) != .complete) return error.IncompleteFramebuffer;
+    const from = (describe(src.color) catch unreachable) orelse return error.NoColorAttachment;
+    const to = (describe(dst.color) catch unreachable) orelse return error.NoColorAttachment;
+    if (from.sample_count <= 1 or to.sample_count != 1) return error.UnsupportedBlit;
+    if (from.width != to.width or from.height != to.height) return error.UnsupportedBlit;
+    if (attachmentFormat(src.color) != attachmentFormat(dst.color)) return error.FormatMismatch;
+    return .{ from.width, from.height };
+}
+
+fn boundForWrite(binding: Binding) !*Framebuffer {
+    const id = boundFramebuffer(binding);
+    if (id == 0) return error.DefaultFramebuffer;
+    return &g_state.framebuffers[id];
+}
+
+fn attach(fb: *Framebuffer, point: AttachmentPoint, attachment: Attachment) void {
+    switch (point) {
+        .color0 => fb.color = attachment,
+        .depth => fb.depth = attachment,
+        .stencil => fb.stencil = attachment,
+        .depth_stencil => {
+            fb.depth = attachment;
+            fb.stencil = attachment;
+        },
+    }
+    fb.revision = nextRevision();
+}
+
+fn attachmentSet(fb: *const Framebuffer) AttachmentSet {
+    return .{
+        .color = fb.color,
+        .depth_stencil = if (fb.depth != .none) fb.depth else fb.stencil,
+    };
+}
+
+fn nextRevision() u32 {
+    g_state.revision +%= 1;
+    return g_state.revision;
+}
+
+// =============================================================================
+// Renderbuffers
+// =============================================================================
+
+/// Allocate a renderbuffer. Its handle is never 0.
+pub fn createRenderbuffer() !u32 {
+    const id = allocSlot(Renderbuffer, &g_state.renderbuffers, &g_state.next_renderbuffer) orelse return error.AtCapacity;
+    g_state.renderbuffers[id] = .{ .live = true };
+    return id;
+}
+
+pub fn isRenderbuffer(id: u32) bool {
+    return id != 0 and id <= MaxRenderbuffers and g_state.renderbuffers[id].live;
+}
+
+/// Free a renderbuffer, detaching it from every framebuffer.
+pub fn deleteRenderbuffer(id: u32) bool {
+    if (!isRenderbuffer(id)) return false;
+    if (g_state.renderbuffer_binding == id) g_state.renderbuffer_binding = 0;
+    const rb: Attachment = .{ .renderbuffer = id };
+    for (&g_state.framebuffers) |*fb| {
+        if (!fb.live) continue;
+        if (std.meta.eql(fb.color, rb)) attach(fb, .color0, .none);
+        if (std.meta.eql(fb.depth, rb)) attach(fb, .depth, .none);
+        if (std.meta.eql(fb.stencil, rb)) attach(fb, .stencil, .none);
+    }
+    releaseRenderbufferImage(&g_state.renderbuffers[id]);
+    g_state.renderbuffers[id] = .{};
+    return true;
+}
+
+pub fn bindRenderbuffer(id: u32) !void {
+    if (id != 0 and !isRenderbuffer(id)) return error.InvalidRenderbuffer;
+    g_state.renderbuffer_binding = id;
+}
+
+pub fn boundRenderbuffer() u32 {
+    return g_state.renderbuffer_binding;
+}
+
+/// Define the bound renderbuffer's storage. The image is created when a
+/// pass first draws into it.
+pub fn renderbufferStorage(internal_format: u32, width: u32, height: u32) !void {
+    return renderbufferStorageMultisample(0, internal_format, width, height);
+}
+
+/// renderbufferStorage with `sample_count` samples per pixel; 0 and 1
+/// both mean single-sampled.
+pub fn renderbufferStorageMultisample(sample_count: u32, internal_format: u32, width: u32, height: u32) !void {
+    const id = g_state.renderbuffer_binding;
+    if (id == 0) return error.NoRenderbufferBound;
+    if (sample_count > MaxSamples) return error.InvalidValue;
+    const format, const pixel_format = mapRenderbufferFormat(internal_format) orelse return error.InvalidEnum;
+    const rb = &g_state.renderbuffers[id];
+    releaseRenderbufferImage(rb);
+    rb.width = width;
+    rb.height = height;
+    rb.format = format;
+    rb.pixel_format = pixel_format;
+    rb.sample_count = @max(sample_count, 1);
+}
+
+fn mapRenderbufferFormat(internal_format: u32) ?struct { RenderbufferFormat, sg.PixelFormat } {
+    return switch (internal_format) {
+        // RGBA4, RGB565, RGB5_A1, RGB8, RGBA8: stored as RGBA8
+        0x8056, 0x8D62, 0x8057, 0x8051, 0x8058 => .{ .color, .RGBA8 },
+        0x8C43 => .{ .color, .SRGB8A8 }, // SRGB8_ALPHA8
+        // DEPTH_COMPONENT16, DEPTH_COMPONENT24, DEPTH_COMPONENT32F
+        0x81A5, 0x81A6, 0x8CAC => .{ .depth, .DEPTH },
+        // DEPTH_STENCIL, DEPTH24_STENCIL8, DEPTH32F_STENCIL8; sokol has no
+        // stencil-only format, so STENCIL_INDEX8 gets a depth plane too
+        0x84F9, 0x88F0, 0x8CAD, 0x8D48 => .{ .depth_stencil, .DEPTH_STENCIL },
+        else => null,
+    };
+}
+
+fn releaseRenderbufferImage(rb: *Renderbuffer) void {
+    if (rb.image.id != 0 and sg.isvalid()) webgl_backend.destroyTextureImage(rb.image);
+    rb.image = .{};
+}
+
+// =============================================================================
+// Pass resolution
+// =============================================================================
+
+const AttachmentKind = enum { color, depth, depth_stencil };
+
+const AttachmentInfo = struct {
+    kind: AttachmentKind,
+    width: u32,
+    height: u32,
+    sample_count: u32 = 1,
+};
+
+/// Size and kind of an attachment; null when nothing is attached.
+fn describe(attachment: Attachment) !?AttachmentInfo {
+    switch (attachment) {
+        .none => return null,
+        .texture => |id| {
+            const tex = webgl_texture.globalTextureManager().textures.get(id) orelse return error.InvalidTexture;
+            if (tex.width == 0 or tex.height == 0) return error.NoStorage;
+            const kind: AttachmentKind = switch (tex.format) {
+                .rgba, .rgb => .color,
+                .depth_component => .depth,
+                .depth_stencil => .depth_stencil,
+                else => return error.Unrenderable,
+            };
+            return .{ .kind = kind, .width = tex.width, .height = tex.height };
+        },
+        .renderbuffer => |id| {
+            if (!isRenderbuffer(id)) return error.InvalidRenderbuffer;
+            const rb = &g_state.renderbuffers[id];
+            if (rb.width == 0 or rb.height == 0) return error.NoStorage;
+            const kind: AttachmentKind = switch (rb.format) {
+                .color => .color,
+                .depth => .depth,
+                .depth_stencil => .depth_stencil,
+            };
+            return .{ .kind = kind, .width = rb.width, .height = rb.height, .sample_count = rb.sample_count };
+        },
+    }
+}
+
+/// Backing image of an attachment, creating renderbuffer images on first
+/// use. Texture images come from webgl_texture.uploadDirtyTextures().
+fn attachmentImage(attachment: Attachment) ?sg.Image {
+    switch (attachment) {
+        .none => return null,
+        .texture => |id| {
+            const tex = webgl_texture.globalTextureManager().textures.get(id) orelse return null;
+            if (!tex.render_target or tex.backend.id == 0) return null;
+            return tex.backend;
+        },
+        .renderbuffer => |id| {
+            if (!isRenderbuffer(id)) return null;
+            const rb = &g_state.renderbuffers[id];
+            if (rb.image.id == 0) {
+                rb.image = webgl_backend.createRenderTargetImage(rb.width, rb.height, rb.pixel_format, rb.sample_count) catch |err| {
+                    log.warn("renderbuffer {d}: {s}", .{ id, @errorName(err) });
+                    return null;
+                };
+            }
+            return rb.image;
+        },
+    }
+}
+
+/// Attachment views and formats for drawing into `set`, and resolving its
+/// color into `resolve` at the end (if not .none), or null when it is
+/// incomplete or its images are not ready. Needs a live sokol context.
+pub fn resolvePass(set: AttachmentSet, resolve: Attachment) ?ResolvedPass {
+    if (checkAttachments(set) != .complete) return null;
+    const color_info = describe(set.color) catch unreachable;
+    const depth_info = describe(set.depth_stencil) catch unreachable;
+    const color_image = if (color_info != null) (attachmentImage(set.color) orelse return null) else sg.Image{};
+    const depth_image = if (depth_info != null) (attachmentImage(set.depth_stencil) orelse return null) else sg.Image{};
+    const resolve_image = if (resolve != .none) (attachmentImage(resolve) orelse return null) else sg.Image{};
+
+    const entry = cachedPass(color_image, depth_image, resolve_image) orelse return null;
+    const info = color_info orelse depth_info.?;
+    var pass = ResolvedPass{
+        .attachments = .{},
+        .format = passFormat(set).?,
+        .width = info.width,
+        .height = info.height,
+    };
+    if (color_image.id != 0) pass.attachments.colors[0] = entry.color_view;
+    if (depth_image.id != 0) pass.attachments.depth_stencil = entry.depth_view;
+    if (resolve_image.id != 0) pass.attachments.resolves[0] = entry.resolve_view;
+    return pass;
+}
+
+/// Formats pipelines drawing into a complete attachment set are built
+/// for, worked out without creating any backend objects.
+pub fn passFormat(set: AttachmentSet) ?PassFormat {
+    if (checkAttachments(set) != .complete) return null;
+    const info = (describe(set.color) catch unreachable) orelse (describe(set.depth_stencil) catch unreachable).?;
+    return .{
+        .color = attachmentFormat(set.color),
+        .depth = attachmentFormat(set.depth_stencil),
+        .sample_count = @intCast(info.sample_count),
+    };
+}
+
+fn attachmentFormat(attachment: Attachment) sg.PixelFormat {
+    return switch (attachment) {
+        .none => .NONE,
+        .texture => |id| blk: {
+            const tex = webgl_texture.globalTextureManager().textures.get(id) orelse break :blk .NONE;
+            break :blk webgl_backend.renderTargetFormat(tex.format) orelse .NONE;
+        },
+        .renderbuffer => |id| g_state.renderbuffers[id].pixel_format,
+    };
+}
+
+/// Views for drawing into `color_image` and `depth_image` and resolving
+/// into `resolve_image` (any may be the null handle), from the cache or
+/// newly made.
+fn cachedPass(color_image: sg.Image, depth_image: sg.Image, resolve_image: sg.Image) ?*CachedPass {
+    const cache = &g_state.pass_cache;
+    if (cache.find(color_image.id, depth_image.id, resolve_image.id)) |entry| {
+        cache.stats.hits += 1;
+        return entry;
+    }
+    cache.stats.misses += 1;
+    const slot = cache.victim(isStale);
+    if (slot.valid) {
+        releaseCached(slot);
+        cache.stats.evictions += 1;
+    }
+    slot.* = .{ .color_image = color_image.id, .depth_image = depth_image.id, .resolve_image = resolve_image.id };
+    if (color_image.id != 0) {
+        slot.color_view = sg.makeView(.{ .color_attachment = .{ .image = color_image } });
+    }
+    if (depth_image.id != 0) {
+        slot.depth_view = sg.makeView(.{ .depth_stencil_attachment = .{ .image = depth_image } });
+    }
+    if (resolve_image.id != 0) {
+        slot.resolve_view = sg.makeView(.{ .resolve_attachment = .{ .image = resolve_image } });
+    }
+    if ((color_image.id != 0 and sg.queryViewState(slot.color_view) != .VALID) or
+        (depth_image.id != 0 and sg.queryViewState(slot.depth_view) != .VALID) or
+        (resolve_image.id != 0 and sg.queryViewState(slot.resolve_view) != .VALID))
+    {
+        log.warn("resolvePass: failed to create attachment views", .{});
+        releaseCached(slot);
+        return null;
+    }
+    cache.tick += 1;
+    slot.last_used = cache.tick;
+    slot.valid = true;
+    return slot;
+}
+
+pub fn passCacheStats() PassCacheStats {
+    return g_state.pass_cache.stats;
+}
+
+fn isStale(entry: *const CachedPass) bool {
+    if (entry.color_image != 0 and sg.queryImageState(.{ .id = entry.color_image }) != .VALID) return true;
+    if (entry.depth_image != 0 and sg.queryImageState(.{ .id = entry.depth_image }) != .VALID) return true;
+    if (entry.resolve_image != 0 and sg.queryImageState(.{ .id = entry.resolve_image }) != .VALID) return true;
+    return false;
+}
+
+fn releaseCached(entry: *CachedPass) void {
+    webgl_backend.destroyTextureView(entry.color_view);
+    webgl_backend.destroyTextureView(entry.depth_view);
+    webgl_backend.destroyTextureView(entry.resolve_view);
+    entry.* = .{};
+}
+
+/// First free slot at or after `next.*`, wrapping; advances `next.*` past it.
+fn allocSlot(comptime T: type, slots: []T, next: *u32) ?u32 {
+    const max: u32 = @intCast(slots.len - 1);
+    var id = next.*;
+    for (0..max) |_| {
+        if (!slots[id].live) {
+            next.* = if (id == max) 1 else id + 1;
+            return id;
+        }
+        id = if (id == max) 1 else id + 1;
+    }
+    return null;
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+test "Framebuffer completeness follows its attachments" {
+    reset();
+    defer reset();
+    const tex_mgr = webgl_texture.globalTextureManager();
+    const color = try tex_mgr.createTexture();
+    defer _ = tex_mgr.deleteTexture(color);
+    try tex_mgr.bindTexture(.texture_2d, color);
+    try tex_mgr.texImage2D(.texture_2d, 64, 32, .rgba, 0x1908, 0x1401, null);
+
+    const fb = try createFramebuffer();
+    try testing.expectEqual(Status.complete, checkStatus(.draw));
+    try testing.expectError(error.InvalidFramebuffer, bindFramebuffer(.both, fb + 1));
+    try bindFramebuffer(.both, fb);
+    try testing.expectEqual(Status.incomplete_missing_attachment, checkStatus(.draw));
+
+    try framebufferTexture2D(.draw, .color0, color);
+    try testing.expect(tex_mgr.getTexture(color).?.render_target);
+    try testing.expectEqual(Status.complete, checkStatus(.draw));
+
+    // Depth renderbuffer of a different size, then a matching one
+    const depth = try createRenderbuffer();
+    try bindRenderbuffer(depth);
+    try renderbufferStorage(0x81A5, 32, 32); // DEPTH_COMPONENT16
+    try framebufferRenderbuffer(.draw, .depth, depth);
+    try testing.expectEqual(Status.incomplete_dimensions, checkStatus(.draw));
+    try renderbufferStorage(0x88F0, 64, 32); // DEPTH24_STENCIL8
+    try testing.expectEqual(Status.complete, checkStatus(.draw));
+    const format = passFormat(drawTarget().attachments).?;
+    try testing.expectEqual(sg.PixelFormat.RGBA8, format.color);
+    try testing.expectEqual(sg.PixelFormat.DEPTH_STENCIL, format.depth);
+    try testing.expectEqual(@as(i32, 1), format.colorCount());
+
+    // A separate stencil object cannot share sokol's depth-stencil slot
+    const stencil = try createRenderbuffer();
+    try framebufferRenderbuffer(.draw, .stencil, stencil);
+    try testing.expectEqual(Status.unsupported, checkStatus(.draw));
+
+    // Deleting renderbuffers detaches them and bumps the revision
+    const before = drawTarget().revision;
+    try testing.expect(deleteRenderbuffer(stencil));
+    try testing.expect(deleteRenderbuffer(depth));
+    try testing.expect(drawTarget().revision != before);
+    try testing.expectEqual(Attachment.none, drawTarget().attachments.depth_stencil);
+    try testing.expectEqual(Status.complete, checkStatus(.draw));
+
+    // A depth buffer in the color slot is not color-renderable
+    const wrong = try createRenderbuffer();
+    try bindRenderbuffer(wrong);
+    try renderbufferStorage(0x81A6, 64, 32);
+    try framebufferRenderbuffer(.draw, .color0, wrong);
+    try testing.expectEqual(Status.incomplete_attachment, checkStatus(.draw));
+    try testing.expectError(error.InvalidEnum, renderbufferStorage(0x1234, 1, 1));
+
+    try testing.expect(deleteFramebuffer(fb));
+    try testing.expectEqual(@as(u32, 0), boundFramebuffer(.draw));
+    try testing.expectEqual(@as(u32, 0), boundFramebuffer(.read));
+    try testing.expectError(error.DefaultFramebuffer, framebufferRenderbuffer(.draw, .color0, 0));
+}
+
+test "Multisampled renderbuffers resolve into matching textures" {
+    reset();
+    defer reset();
+    const tex_mgr = webgl_texture.globalTextureManager();
+    const resolved = try tex_mgr.createTexture();
+    defer _ = tex_mgr.deleteTexture(resolved);
+    try tex_mgr.bindTexture(.texture_2d, resolved);
+    try tex_mgr.texImage2D(.texture_2d, 128, 64, .rgba, 0x1908, 0x1401, null);
+
+    const color = try createRenderbuffer();
+    try bindRenderbuffer(color);
+    try testing.expectError(error.InvalidValue, renderbufferStorageMultisample(MaxSamples + 1, 0x8058, 128, 64));
+    try renderbufferStorageMultisample(4, 0x8058, 128, 64);
+    const depth = try createRenderbuffer();
+    try bindRenderbuffer(depth);
+    try renderbufferStorage(0x88F0, 128, 64);
+
+    const msaa = try createFramebuffer();
+    try bindFramebuffer(.both, msaa);
+    try framebufferRenderbuffer(.draw, .color0, color);
+    try framebufferRenderbuffer(.draw, .depth_stencil, depth);
+    try testing.expectEqual(Status.incomplete_multisample, checkStatus(.draw));
+    try renderbufferStorageMultisample(4, 0x88F0, 128, 64);
+    try testing.expectEqual(Status.complete, checkStatus(.draw));
+    try testing.expectEqual(@as(u32, 4), samples(.draw));
+    try testing.expectEqual(@as(i32, 4), passFormat(drawTarget().attachments).?.sample_count);
+
+    const target = try createFramebuffer();
+    try bindFramebuffer(.draw, target);
+    try framebufferTexture2D(.draw, .color0, resolved);
+    try testing.expectEqual(@as(u32, 1), samples(.draw));
+    try testing.expectEqual(@as(u32, msaa), boundFramebuffer(.read));
+    const size = try checkResolve(readTarget().attachments, drawTarget().attachments);
+    try testing.expectEqual([2]u32{ 128, 64 }, size);
+    // Resolves only go from multisampled to single-sampled
+    try testing.expectError(error.UnsupportedBlit, checkResolve(drawTarget().attachments, readTarget().attachments));
+    try tex_mgr.texImage2D(.texture_2d, 64, 64, .rgba, 0x1908, 0x1401, null);
+    try testing.expectError(error.UnsupportedBlit, checkResolve(readTarget().attachments, drawTarget().attachments));
+
+    setSwapchainSamples(4);
+    try bindFramebuffer(.both, 0);
+    try testing.expectEqual(@as(u32, 4), samples(.draw));
+}
+
+fn neverStale(_: *const CachedPass) bool {
+    return false;
+}
+
+fn staleDepth(entry: *const CachedPass) bool {
+    return entry.depth_image == 99;
+}
+
+test "Pass cache reuses attachment sets and reclaims stale entries first" {
+    var cache: PassCache = .{ .tick = 100 };
+    for (&cache.entries, 0..) |*entry, i| {
+        entry.* = .{ .color_image = @intCast(i + 1), .last_used = 100 - i, .valid = true };
+    }
+    try testing.expect(cache.find(3, 0, 0) != null);
+    try testing.expect(cache.find(3, 7, 0) == null);
+    try testing.expect(cache.find(3, 0, 7) == null);
+
+    // Least recently used: the last entry, which find() did not touch
+    try testing.expectEqual(&cache.entries[MaxCachedPasses - 1], cache.victim(neverStale));
+    cache.entries[5].depth_image = 99;
+    try testing.expectEqual(&cache.entries[5], cache.victim(staleDepth));
+    cache.entries[2].valid = false;
+    try testing.expectEqual(&cache.entries[2], cache.victim(neverStale));
+}
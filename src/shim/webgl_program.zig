@@ -6,6 +6,10 @@ const std = @import("std");
 const testing = std.testing;
 const shader = @import("webgl_shader.zig");
 const gl_uniforms = @import("gl_uniforms.zig");
+const webgl_state = @import("webgl_state.zig");
+const shader_cache = @import("shader_cache.zig");
+const handle_table = @import("handle_table.zig");
+const job_system = @import("job_system.zig");
 const sokol = @import("sokol");
 const sg = sokol.gfx;
 
@@ -72,22 +76,37 @@ pub const UniformType = enum(u8) {
     }
 };
 
-pub const MaxPrograms: usize = 64;
+/// Default ProgramTable capacity; configureProgramCapacity() changes it.
+pub const MaxPrograms: usize = 1024;
 pub const MaxProgramInfoLogBytes: usize = 4 * 1024;
 pub const MaxProgramAttrs: usize = 16;
 pub const MaxProgramUniforms: usize = 128;
-pub const MaxTranslatedShaderBytes: usize = shader.MaxShaderSourceBytes + 4096;
 pub const MaxAttrNameBytes: usize = 64;
 pub const MaxUniformNameBytes: usize = 64;
 pub const MaxUniformBlockBytes: usize = MaxProgramUniforms * 64;
 pub const MaxUniformArrayCount: u16 = 16;
 pub const MaxProgramSamplers: usize = 12;
+/// Sampler elements bound through sokol, one view and sampler slot each
+pub const MaxTextureSlots: usize = sg.max_sampler_bindslots;
+/// Backend shaders a program keeps for distinct unfilterable masks
+pub const MaxShaderVariants: usize = 4;
+/// Uniform blocks per program (GL 3.3's per-stage minimum)
+pub const MaxUniformBufferBlocks: usize = 12;
 
 pub const ProgramId = packed struct(u32) {
     index: u16,
     generation: u16,
 };
 
+/// Whether a uniform varies per draw or usually holds for a whole pass
+/// (camera and lights). The draw stream snapshots the two scopes separately,
+/// so a draw that changes only object uniforms shares the frame-scope copy
+/// of the draw before it.
+pub const UniformScope = enum(u8) {
+    object = 0,
+    frame = 1,
+};
+
 const UniformEntry = struct {
     name_len: u8,
     name_bytes: [MaxUniformNameBytes]u8,
@@ -96,6 +115,41 @@ const UniformEntry = struct {
     offset: u32,
     stride: u32,
     size: u32,
+    scope: UniformScope,
+
+    fn byteEnd(self: *const UniformEntry) u32 {
+        const elem_count: u32 = if (self.array_count == 0) 1 else self.array_count;
+        return self.offset + self.stride * elem_count;
+    }
+};
+
+/// Half-open byte range within a uniform block buffer; empty when lo >= hi.
+pub const ByteRange = struct {
+    lo: u32 = 0,
+    hi: u32 = 0,
+
+    pub fn isEmpty(self: ByteRange) bool {
+        return self.lo >= self.hi;
+    }
+
+    pub fn len(self: ByteRange) u32 {
+        return if (self.isEmpty()) 0 else self.hi - self.lo;
+    }
+
+    pub fn include(self: *ByteRange, lo: u32, hi: u32) void {
+        if (lo >= hi) return;
+        if (self.isEmpty()) {
+            self.* = .{ .lo = lo, .hi = hi };
+            return;
+        }
+        self.lo = @min(self.lo, lo);
+        self.hi = @max(self.hi, hi);
+    }
+
+    pub fn intersects(self: ByteRange, other: ByteRange) bool {
+        if (self.isEmpty() or other.isEmpty()) return false;
+        return self.lo < other.hi and other.lo < self.hi;
+    }
 };
 
 const UniformBlock = struct {
@@ -103,11 +157,30 @@ const UniformBlock = struct {
     count: u8,
     items: [MaxProgramUniforms]UniformEntry,
     buffer: [MaxUniformBlockBytes]u8,
+    /// Items written since their direct-GL upload (bit per item index).
+    dirty: std.StaticBitSet(MaxProgramUniforms),
+    /// Bytes written since the draw stream last snapshotted this block.
+    dirty_range: ByteRange,
+    /// Extents of the object- and frame-scope items; set by
+    /// classifyUniforms(). The two may interleave.
+    object_range: ByteRange,
+    frame_range: ByteRange,
+
+    fn scopeRange(self: *const UniformBlock, scope: UniformScope) ByteRange {
+        return if (scope == .object) self.object_range else self.frame_range;
+    }
+};
+
+/// Which uniform scopes were written since the last takeUniformsDirty().
+pub const UniformsDirty = struct {
+    object: bool = false,
+    frame: bool = false,
 };
 
-const SamplerKind = enum {
+pub const SamplerKind = enum {
     sampler2d,
     samplerCube,
+    sampler2dShadow,
 };
 
 const SamplerEntry = struct {
@@ -117,8 +190,19 @@ const SamplerEntry = struct {
     stage: UniformStage,
     array_count: u16,
     units: [MaxUniformArrayCount]i32,
-    gl_location: i32, // Cached GL uniform location (-1 if not found)
-    dirty: bool, // True if unit needs to be set via glUniform1i
+};
+
+/// A backend shader made for one set of unfilterable texture slots
+const ShaderVariant = struct {
+    unfilterable_slots: u16,
+    shader: sg.Shader,
+};
+
+/// One element of a sampler uniform. The i-th slot of a program is sokol
+/// view slot, sampler slot and texture-sampler pair i of its backend shader.
+pub const TextureSlot = struct {
+    sampler: u8,
+    element: u8,
 };
 
 /// Tracks mat2/mat3 uniforms that need direct GL calls (Sokol only supports mat4).
@@ -127,6 +211,7 @@ const MatrixUniform = struct {
     name_bytes: [MaxUniformNameBytes]u8,
     utype: UniformType, // MAT2 or MAT3
     stage: UniformStage,
+    index: u8, // Item index in the stage's uniform block
     offset: u32, // Offset in the uniform block buffer
     gl_location: i32, // GL uniform location (-1 if not found)
     array_count: u16,
@@ -134,6 +219,36 @@ const MatrixUniform = struct {
 
 pub const MaxMatrixUniforms: usize = 16;
 
+/// FS uniforms that are also set through glUniform* because Sokol uniform
+/// blocks don't reach Three.js's individual uniform declarations.
+const FallbackUniform = struct {
+    utype: UniformType,
+    index: u8, // Item index in fs_uniforms
+    offset: u32,
+    gl_location: i32,
+};
+
+const fallback_uniform_names = [_]struct { name: [:0]const u8, utype: UniformType }{
+    .{ .name = "diffuse", .utype = .FLOAT3 },
+    .{ .name = "opacity", .utype = .FLOAT },
+};
+
+pub const MaxFallbackUniforms: usize = fallback_uniform_names.len;
+
+/// A WebGL2 uniform block (`uniform Name { ... };`). Its declaration goes
+/// to GL as written; block i reads GL binding slot i, which draws fill from
+/// the buffer bound at WebGL binding point `binding`.
+pub const UniformBufferBlock = struct {
+    name_len: u8,
+    name_bytes: [MaxUniformNameBytes]u8,
+    /// uniformBlockBinding() value; 0 after link, as in GL
+    binding: u8,
+
+    pub fn name(self: *const UniformBufferBlock) []const u8 {
+        return self.name_bytes[0..@as(usize, self.name_len)];
+    }
+};
+
 pub const Program = struct {
     id: ProgramId,
     linked: bool,
@@ -142,23 +257,116 @@ pub const Program = struct {
     info_log_len: u32,
     info_log_bytes: [MaxProgramInfoLogBytes]u8,
     backend_shader: sg.Shader,
+    /// Translated GLSL 330, NUL-terminated for sokol; `*_len` excludes the
+    /// terminator. Owned, from source_allocator.
     vertex_source_len: u32,
-    vertex_source: [MaxTranslatedShaderBytes]u8,
+    vertex_source: []u8,
     fragment_source_len: u32,
-    fragment_source: [MaxTranslatedShaderBytes]u8,
+    fragment_source: []u8,
     attr_count: u8,
     attr_name_lens: [MaxProgramAttrs]u8,
     attr_names: [MaxProgramAttrs][MaxAttrNameBytes]u8,
+    /// First vertex attribute location of each input; a matrix takes one
+    /// per column. The translated source declares these explicitly, so
+    /// they are the GL locations and sokol's attribute slots as well.
+    attr_locations: [MaxProgramAttrs]u8,
+    /// INVALID for types the uniform enum lacks (uint vectors, matNxM)
+    attr_types: [MaxProgramAttrs]UniformType,
     vs_uniforms: UniformBlock,
     fs_uniforms: UniformBlock,
     sampler_count: u8,
     samplers: [MaxProgramSamplers]SamplerEntry,
+    /// Sampler elements in declaration order; link fails past
+    /// MaxTextureSlots
+    texture_slot_count: u8,
+    texture_slots: [MaxTextureSlots]TextureSlot,
+    /// sampler2D slots the backend shader declares UNFILTERABLE_FLOAT with a
+    /// NONFILTERING sampler; the rest take FLOAT with FILTERING. Shadow
+    /// slots are always DEPTH with COMPARISON.
+    unfilterable_slots: u16,
+    /// Every backend shader made since link, `backend_shader` included.
+    /// A return to an earlier mask reuses its shader, and so the pipelines
+    /// cached for that shader id; past MaxShaderVariants the oldest goes.
+    shader_variant_count: u8,
+    shader_variant_next: u8,
+    shader_variants: [MaxShaderVariants]ShaderVariant,
     link_version: u32,
     /// Mat2/mat3 uniforms that need direct GL calls (Sokol only supports mat4)
     mat_uniform_count: u8,
     mat_uniforms: [MaxMatrixUniforms]MatrixUniform,
+    /// FS fallback uniforms resolved at link (see FallbackUniform)
+    fallback_uniform_count: u8,
+    fallback_uniforms: [MaxFallbackUniforms]FallbackUniform,
     /// GL program ID for direct GL uniform calls
     gl_program: u32,
+    /// Location of DrawIdUniform, -1 when the program never reads gl_DrawID
+    draw_id_location: i32,
+    /// Uniform blocks of both stages, VS blocks first
+    buffer_block_count: u8,
+    buffer_blocks: [MaxUniformBufferBlocks]UniformBufferBlock,
+
+    pub fn bufferBlocks(self: *const Program) []const UniformBufferBlock {
+        return self.buffer_blocks[0..@as(usize, self.buffer_block_count)];
+    }
+
+    pub fn textureSlots(self: *const Program) []const TextureSlot {
+        return self.texture_slots[0..@as(usize, self.texture_slot_count)];
+    }
+
+    /// Texture unit the slot samples, as last set with uniform1i[v]
+    pub fn textureUnit(self: *const Program, slot: TextureSlot) i32 {
+        return self.samplers[slot.sampler].units[slot.element];
+    }
+
+    pub fn slotKind(self: *const Program, slot: TextureSlot) SamplerKind {
+        return self.samplers[slot.sampler].kind;
+    }
+
+    pub fn uniformBlock(self: *Program, stage: UniformStage) *UniformBlock {
+        return if (stage == .vertex) &self.vs_uniforms else &self.fs_uniforms;
+    }
+
+    /// Bytes spanning one scope's items of one stage, for snapshotting per
+    /// draw. May include items of the other scope, which
+    /// overlayUniforms() skips.
+    pub fn scopeUniformBytes(self: *const Program, stage: UniformStage, scope: UniformScope) []const u8 {
+        const block = if (stage == .vertex) &self.vs_uniforms else &self.fs_uniforms;
+        const range = block.scopeRange(scope);
+        if (range.isEmpty()) return &.{};
+        return block.buffer[@as(usize, range.lo)..@as(usize, range.hi)];
+    }
+
+    /// Which scopes had bytes written since the last call. Resets the
+    /// dirty ranges of both stages.
+    pub fn takeUniformsDirty(self: *Program) UniformsDirty {
+        const dirty: UniformsDirty = .{
+            .object = self.vs_uniforms.dirty_range.intersects(self.vs_uniforms.object_range) or
+                self.fs_uniforms.dirty_range.intersects(self.fs_uniforms.object_range),
+            .frame = self.vs_uniforms.dirty_range.intersects(self.vs_uniforms.frame_range) or
+                self.fs_uniforms.dirty_range.intersects(self.fs_uniforms.frame_range),
+        };
+        self.vs_uniforms.dirty_range = .{};
+        self.fs_uniforms.dirty_range = .{};
+        return dirty;
+    }
+
+    /// Write the `scope` items of a snapshot taken with scopeUniformBytes()
+    /// back into the block and mark them for direct-GL re-upload. Items of
+    /// the other scope inside the span are left alone. Does not touch the
+    /// snapshot dirty range.
+    pub fn overlayUniforms(self: *Program, stage: UniformStage, scope: UniformScope, bytes: []const u8) void {
+        const block = self.uniformBlock(stage);
+        const range = block.scopeRange(scope);
+        if (bytes.len != @as(usize, range.len())) return;
+        if (bytes.len == 0) return;
+        for (block.items[0..@as(usize, block.count)], 0..) |item, idx| {
+            if (item.scope != scope) continue;
+            const lo: usize = item.offset;
+            const hi: usize = item.byteEnd();
+            @memcpy(block.buffer[lo..hi], bytes[lo - range.lo .. hi - range.lo]);
+            block.dirty.set(idx);
+        }
+    }
 
     /// Count the union of VS and FS uniforms (no duplicates).
     pub fn countUniformUnion(self: *const Program) u32 {
@@ -230,7 +438,6 @@ fn zeroedSamplerEntry() SamplerEntry {
     var entry: SamplerEntry = undefined;
     @memset(std.mem.asBytes(&entry), 0);
     entry.array_count = 1;
-    entry.gl_location = -1;
     return entry;
 }
 
@@ -245,37 +452,117 @@ fn zeroedMatrixUniform() MatrixUniform {
 fn resetProgram(program: *Program, id: ProgramId) void {
     @memset(std.mem.asBytes(program), 0);
     program.id = id;
-    // Set non-zero defaults for samplers (gl_location = -1)
     for (&program.samplers) |*s| {
-        s.gl_location = -1;
         s.array_count = 1;
     }
     // Set non-zero defaults for matrix uniforms (gl_location = -1)
     for (&program.mat_uniforms) |*m| {
         m.gl_location = -1;
     }
+    program.draw_id_location = -1;
+    program.vertex_source = &.{};
+    program.fragment_source = &.{};
+}
+
+/// Translated sources are sized by the shader, so they live outside the
+/// Program; link runs on worker threads, hence the page allocator.
+const source_allocator = std.heap.page_allocator;
+
+/// Replace `dest` with a NUL-terminated copy of `text`.
+fn storeSource(dest: *[]u8, dest_len: *u32, text: []const u8) !void {
+    releaseSource(dest, dest_len);
+    const bytes = try source_allocator.alloc(u8, text.len + 1);
+    @memcpy(bytes[0..text.len], text);
+    bytes[text.len] = 0;
+    dest.* = bytes;
+    dest_len.* = @intCast(text.len);
+}
+
+fn releaseSource(dest: *[]u8, dest_len: *u32) void {
+    if (dest.len != 0) source_allocator.free(dest.*);
+    dest.* = &.{};
+    dest_len.* = 0;
 }
 
+fn releaseSources(program: *Program) void {
+    releaseSource(&program.vertex_source, &program.vertex_source_len);
+    releaseSource(&program.fragment_source, &program.fragment_source_len);
+}
+
+// =============================================================================
+// Off-thread link
+// =============================================================================
+
+/// One linkAsync() request, run as a job on the shared job system. Owns
+/// copies of both stage sources; the job writes into the table entry and
+/// `counter` reaches zero once it has.
+const LinkJob = struct {
+    job: job_system.Job,
+    table: *ProgramTable,
+    entry: *ProgramTable.Entry,
+    vs_source: []u8,
+    fs_source: []u8,
+    counter: job_system.Counter = .{},
+    result: anyerror!bool = false,
+
+    const job_allocator = std.heap.page_allocator;
+
+    fn create(table: *ProgramTable, entry: *ProgramTable.Entry, vs_source: []const u8, fs_source: []const u8) !*LinkJob {
+        const job = try job_allocator.create(LinkJob);
+        errdefer job_allocator.destroy(job);
+        const vs_copy = try job_allocator.dupe(u8, vs_source);
+        errdefer job_allocator.free(vs_copy);
+        const fs_copy = try job_allocator.dupe(u8, fs_source);
+        job.* = .{
+            .job = .{ .run = run },
+            .table = table,
+            .entry = entry,
+            .vs_source = vs_copy,
+            .fs_source = fs_copy,
+        };
+        job.job.counter = &job.counter;
+        return job;
+    }
+
+    fn destroy(job: *LinkJob) void {
+        job_allocator.free(job.vs_source);
+        job_allocator.free(job.fs_source);
+        job_allocator.destroy(job);
+    }
+
+    fn run(job_ptr: *job_system.Job) void {
+        const job: *LinkJob = @fieldParentPtr("job", job_ptr);
+        job.result = job.table.translateStages(job.entry, job.vs_source, job.fs_source);
+    }
+};
+
 pub const ProgramTable = struct {
-    entries: [MaxPrograms]Entry,
-    count: u16,
+    handles: Handles,
+    /// Runs linkAsync() translations; null links synchronously
+    jobs: ?*job_system.JobSystem,
 
     const Self = @This();
+    const Handles = handle_table.HandleTable(ProgramId, Entry, MaxPrograms);
 
     const Entry = struct {
-        active: bool,
-        generation: u16,
         program: Program,
+        /// Outstanding off-thread translation started by linkAsync().
+        link_job: ?*LinkJob,
     };
 
-    /// Initialize table - zeros memory at runtime, no comptime cost
+    /// Initialize table in place; slot storage is reserved on first alloc
     pub fn initInPlace(self: *Self) void {
-        @memset(std.mem.asBytes(self), 0);
-        // Set non-zero defaults (generation = 1)
-        for (&self.entries, 0..) |*entry, idx| {
-            entry.generation = 1;
-            entry.program.id.index = @intCast(idx);
-        }
+        self.handles = .{ .capacity = g_program_capacity };
+        self.jobs = null;
+    }
+
+    /// Translate linkAsync() programs on `jobs`, from the thread that
+    /// started it (null links synchronously). Links in flight are settled
+    /// first.
+    pub fn useJobSystem(self: *Self, jobs: ?*job_system.JobSystem) void {
+        var it = self.handles.iterator();
+        while (it.next()) |entry| self.settleLink(entry);
+        self.jobs = jobs;
     }
 
     pub fn init() Self {
@@ -289,26 +576,17 @@ pub const ProgramTable = struct {
     }
 
     pub fn alloc(self: *Self) !ProgramId {
-        if (self.count >= MaxPrograms) return error.AtCapacity;
-        for (&self.entries, 0..) |*entry, idx| {
-            if (!entry.active) {
-                if (entry.generation == 0) entry.generation = 1;
-                const id = ProgramId{
-                    .index = @intCast(idx),
-                    .generation = entry.generation,
-                };
-                resetProgram(&entry.program, id);
-                entry.active = true;
-                self.count += 1;
-                return id;
-            }
-        }
-        return error.AtCapacity;
+        const id = try self.handles.alloc();
+        const entry = self.handles.at(id.index);
+        resetProgram(&entry.program, id);
+        entry.link_job = null;
+        return id;
     }
 
     pub fn get(self: *Self, id: ProgramId) ?*Program {
-        if (!self.isValid(id)) return null;
-        return &self.entries[id.index].program;
+        const entry = self.handles.get(id) orelse return null;
+        self.settleLink(entry);
+        return &entry.program;
     }
 
     pub fn attachShader(
@@ -319,7 +597,8 @@ pub const ProgramTable = struct {
     ) !void {
         if (!self.isValid(id)) return error.InvalidHandle;
         const sh = shaders.get(shader_id) orelse return error.InvalidShader;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
+        self.settleLink(entry);
         switch (sh.kind) {
             .vertex => entry.program.vertex_shader = shader_id,
             .fragment => entry.program.fragment_shader = shader_id,
@@ -330,251 +609,304 @@ pub const ProgramTable = struct {
 
     pub fn link(self: *Self, id: ProgramId, shaders: *shader.ShaderTable) !void {
         if (!self.isValid(id)) return error.InvalidHandle;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
+        self.settleLink(entry);
+        const sources = (try self.beginLink(entry, shaders)) orelse return;
+        if (!try self.translateStages(entry, sources.vs, sources.fs)) return;
+        try self.finishLink(entry);
+    }
+
+    /// Link with the translation step running as a job (KHR_parallel_
+    /// shader_compile semantics). Any later access to the program through
+    /// this table waits for the job, running queued jobs meanwhile, and
+    /// finishes the GL half on the calling thread; isLinkComplete() polls
+    /// without blocking. Links synchronously without a job system.
+    pub fn linkAsync(self: *Self, id: ProgramId, shaders: *shader.ShaderTable) !void {
+        if (!self.isValid(id)) return error.InvalidHandle;
+        const jobs = self.jobs orelse return self.link(id, shaders);
+        const entry = self.handles.at(id.index);
+        self.settleLink(entry);
+        const sources = (try self.beginLink(entry, shaders)) orelse return;
+
+        // Sources are copied so shaderSource() on the attached shaders cannot
+        // race the worker.
+        const job = LinkJob.create(self, entry, sources.vs, sources.fs) catch {
+            if (!try self.translateStages(entry, sources.vs, sources.fs)) return;
+            return self.finishLink(entry);
+        };
+        entry.link_job = job;
+        jobs.submit(&job.job);
+    }
+
+    /// True once the program has no translation in flight. Finishes the
+    /// link (GL half) when the job has just completed.
+    pub fn isLinkComplete(self: *Self, id: ProgramId) bool {
+        if (!self.isValid(id)) return true;
+        const entry = self.handles.at(id.index);
+        const job = entry.link_job orelse return true;
+        if (!job.counter.done()) return false;
+        self.settleLink(entry);
+        return true;
+    }
+
+    /// Wait for an in-flight translation (if any) and finish the link.
+    fn settleLink(self: *Self, entry: *Entry) void {
+        const job = entry.link_job orelse return;
+        // A job is only queued with a job system, which runs it here if no
+        // worker has taken it yet
+        self.jobs.?.wait(&job.counter);
+        entry.link_job = null;
+        defer job.destroy();
+        const translated = job.result catch |err| {
+            log.warn("linkAsync: translation failed: {s}", .{@errorName(err)});
+            return;
+        };
+        if (!translated) return;
+        self.finishLink(entry) catch |err| {
+            log.warn("linkAsync: finish failed: {s}", .{@errorName(err)});
+        };
+    }
+
+    /// Settle every pending link and free the translated sources of every
+    /// live program, before the table drops them.
+    fn releaseAll(self: *Self) void {
+        var it = self.handles.iterator();
+        while (it.next()) |entry| {
+            self.settleLink(entry);
+            releaseSources(&entry.program);
+        }
+    }
+
+    const LinkSources = struct {
+        vs: []const u8,
+        fs: []const u8,
+    };
+
+    /// Validate attachments and return both stage sources, or null with the
+    /// info log set.
+    fn beginLink(self: *Self, entry: *Entry, shaders: *shader.ShaderTable) !?LinkSources {
         entry.program.linked = false;
         self.clearInfoLog(entry);
         self.clearBackend(entry);
 
         const vs_id = entry.program.vertex_shader orelse {
             try self.setInfoLog(entry, "vertex shader missing");
-            return;
+            return null;
         };
         const fs_id = entry.program.fragment_shader orelse {
             try self.setInfoLog(entry, "fragment shader missing");
-            return;
+            return null;
         };
 
         const vs = shaders.get(vs_id) orelse {
             try self.setInfoLog(entry, "vertex shader invalid");
-            return;
+            return null;
         };
         const fs = shaders.get(fs_id) orelse {
             try self.setInfoLog(entry, "fragment shader invalid");
-            return;
+            return null;
         };
         if (!vs.compiled or !fs.compiled) {
             try self.setInfoLog(entry, "shader not compiled");
-            return;
+            return null;
         }
 
         const vs_source = shaders.getSource(vs_id) orelse {
             try self.setInfoLog(entry, "vertex shader source missing");
-            return;
+            return null;
         };
         const fs_source = shaders.getSource(fs_id) orelse {
             try self.setInfoLog(entry, "fragment shader source missing");
-            return;
+            return null;
         };
 
-        var vs_uniforms_pass1: [MaxProgramUniforms]UniformDecl = undefined;
-        var vs_uniform_count_pass1: u8 = 0;
-        var vs_samplers_pass1: [MaxProgramSamplers]SamplerDecl = undefined;
-        var vs_sampler_count_pass1: u8 = 0;
-        var vs_block_size_pass1: u32 = 0;
-        var vs_len: u32 = 0;
-        translateEsToGl330(
-            vs_source,
-            .vertex,
-            &entry.program.vertex_source,
-            &vs_len,
-            &vs_uniforms_pass1,
-            &vs_uniform_count_pass1,
-            &vs_samplers_pass1,
-            &vs_sampler_count_pass1,
-            &vs_block_size_pass1,
-            null,
-            null,
-        ) catch {
-            try self.setInfoLog(entry, "vertex shader translate failed");
-            return;
+        return .{ .vs = vs_source, .fs = fs_source };
+    }
+
+    /// Translation and reflection, served from the shader cache when
+    /// possible. Touches only `entry`, so it is safe on a worker thread.
+    fn translateStages(self: *Self, entry: *Entry, vs_source: []const u8, fs_source: []const u8) !bool {
+        const cache_key = shader_cache.sourceKey(translation_cache_fingerprint, vs_source, fs_source);
+        if (!self.loadCachedTranslation(entry, cache_key)) {
+            if (!try self.translateProgram(entry, vs_source, fs_source)) return false;
+            self.storeCachedTranslation(entry, cache_key);
+        }
+        classifyUniforms(&entry.program.vs_uniforms);
+        classifyUniforms(&entry.program.fs_uniforms);
+        assignTextureSlots(&entry.program) catch {
+            try self.setInfoLog(entry, "sampler elements need more than 12 texture slots");
+            return false;
         };
+        return true;
+    }
 
-        var fs_uniforms_pass1: [MaxProgramUniforms]UniformDecl = undefined;
-        var fs_uniform_count_pass1: u8 = 0;
-        var fs_samplers_pass1: [MaxProgramSamplers]SamplerDecl = undefined;
-        var fs_sampler_count_pass1: u8 = 0;
-        var fs_block_size_pass1: u32 = 0;
-        var fs_len: u32 = 0;
-        translateEsToGl330(
-            fs_source,
-            .fragment,
-            &entry.program.fragment_source,
-            &fs_len,
-            &fs_uniforms_pass1,
-            &fs_uniform_count_pass1,
-            &fs_samplers_pass1,
-            &fs_sampler_count_pass1,
-            &fs_block_size_pass1,
-            null,
-            null,
-        ) catch {
-            try self.setInfoLog(entry, "fragment shader translate failed");
+    /// GL half of link: create the backend shader. Main thread only.
+    fn finishLink(self: *Self, entry: *Entry) !void {
+        if (!sg.isvalid()) {
+            // No graphics context available (tests or headless).
+            entry.program.linked = true;
             return;
-        };
+        }
 
-        var union_uniforms: [MaxProgramUniforms]UniformDecl = undefined;
-        var union_count: usize = 0;
-        const vs_count_pass1: usize = @intCast(vs_uniform_count_pass1);
-        for (vs_uniforms_pass1[0..vs_count_pass1]) |u| {
-            if (union_count >= MaxProgramUniforms) {
-                try self.setInfoLog(entry, "uniform union too large");
-                return;
-            }
-            union_uniforms[union_count] = u;
-            union_count += 1;
-        }
-        const fs_count_pass1: usize = @intCast(fs_uniform_count_pass1);
-        for (fs_uniforms_pass1[0..fs_count_pass1]) |u| {
-            if (hasUniformName(union_uniforms[0..union_count], u.name)) continue;
-            if (union_count >= MaxProgramUniforms) {
-                try self.setInfoLog(entry, "uniform union too large");
-                return;
-            }
-            union_uniforms[union_count] = u;
-            union_count += 1;
-        }
-        const override_uniforms: ?[]const UniformDecl = if (union_count > 0) union_uniforms[0..union_count] else null;
-
-        var vs_uniforms: [MaxProgramUniforms]UniformDecl = undefined;
-        var vs_uniform_count: u8 = 0;
-        var vs_samplers: [MaxProgramSamplers]SamplerDecl = undefined;
-        var vs_sampler_count: u8 = 0;
-        var vs_block_size: u32 = 0;
-        // Only emit uniforms that were in VS original source (pass1)
-        const vs_emit_filter: ?[]const UniformDecl = if (vs_uniform_count_pass1 > 0) vs_uniforms_pass1[0..vs_count_pass1] else null;
-        translateEsToGl330(
-            vs_source,
-            .vertex,
-            &entry.program.vertex_source,
-            &vs_len,
-            &vs_uniforms,
-            &vs_uniform_count,
-            &vs_samplers,
-            &vs_sampler_count,
-            &vs_block_size,
-            override_uniforms,
-            vs_emit_filter,
-        ) catch {
-            try self.setInfoLog(entry, "vertex shader translate failed");
+        // Collect mat2/mat3 uniforms before shader creation
+        self.collectMatrixUniforms(entry);
+
+        if (!self.makeBackendShader(entry)) {
+            try self.setInfoLog(entry, "backend shader compile failed");
+            return;
+        }
+
+        entry.program.linked = true;
+    }
+
+    /// Create the backend shader from the translated sources and resolve
+    /// its direct-GL locations. False, with no shader, if sokol rejects it.
+    fn makeBackendShader(self: *Self, entry: *Entry) bool {
+        // Reset dummy name counter before building shader descriptor
+        dummy_name_count = 0;
+        const shd = sg.makeShader(buildShaderDesc(entry));
+        if (sg.queryShaderState(shd) != .VALID) {
+            sg.destroyShader(shd);
+            entry.program.backend_shader = .{};
+            return false;
+        }
+        rememberShaderVariant(&entry.program, shd);
+        entry.program.backend_shader = shd;
+        self.resolveGlLocations(entry);
+        return true;
+    }
+
+    fn rememberShaderVariant(prog: *Program, shd: sg.Shader) void {
+        const variant = ShaderVariant{ .unfilterable_slots = prog.unfilterable_slots, .shader = shd };
+        if (prog.shader_variant_count < MaxShaderVariants) {
+            prog.shader_variants[prog.shader_variant_count] = variant;
+            prog.shader_variant_count += 1;
             return;
+        }
+        // Pipelines made for the replaced shader age out of the LRU cache
+        const slot = &prog.shader_variants[prog.shader_variant_next];
+        sg.destroyShader(slot.shader);
+        slot.* = variant;
+        prog.shader_variant_next = @intCast((@as(usize, prog.shader_variant_next) + 1) % MaxShaderVariants);
+    }
+
+    /// CPU half of link: translate both stages to GLSL 330 and reflect their
+    /// uniforms, samplers and attributes into `entry`. Returns false (with
+    /// the info log set) if the program cannot be linked.
+    fn translateProgram(self: *Self, entry: *Entry, vs_source: []const u8, fs_source: []const u8) !bool {
+        var arena_state = std.heap.ArenaAllocator.init(std.heap.page_allocator);
+        defer arena_state.deinit();
+        const arena = arena_state.allocator();
+
+        var vs: StageScan = .{};
+        scanStage(arena, vs_source, .vertex, &vs) catch {
+            try self.setInfoLog(entry, "vertex shader translate failed");
+            return false;
         };
-        entry.program.vertex_source_len = vs_len;
-
-        var fs_uniforms: [MaxProgramUniforms]UniformDecl = undefined;
-        var fs_uniform_count: u8 = 0;
-        var fs_samplers: [MaxProgramSamplers]SamplerDecl = undefined;
-        var fs_sampler_count: u8 = 0;
-        var fs_block_size: u32 = 0;
-        // Only emit uniforms that were in FS original source (pass1)
-        const fs_emit_filter: ?[]const UniformDecl = if (fs_uniform_count_pass1 > 0) fs_uniforms_pass1[0..fs_count_pass1] else null;
-        translateEsToGl330(
-            fs_source,
-            .fragment,
-            &entry.program.fragment_source,
-            &fs_len,
-            &fs_uniforms,
-            &fs_uniform_count,
-            &fs_samplers,
-            &fs_sampler_count,
-            &fs_block_size,
-            override_uniforms,
-            fs_emit_filter,
-        ) catch {
+        var fs: StageScan = .{};
+        scanStage(arena, fs_source, .fragment, &fs) catch {
             try self.setInfoLog(entry, "fragment shader translate failed");
-            return;
+            return false;
         };
-        entry.program.fragment_source_len = fs_len;
-
-        // Debug: Check if fragment shader samples from texture
-        const fs_src = entry.program.fragment_source[0..@as(usize, fs_len)];
-        const has_texture = std.mem.indexOf(u8, fs_src, "texture(") != null or
-            std.mem.indexOf(u8, fs_src, "texture2D(") != null;
-        const has_map = std.mem.indexOf(u8, fs_src, "map") != null;
-        log.info("linkProgram: FS len={d} has_texture={} has_map={}", .{ fs_len, has_texture, has_map });
-
-        // Store only the uniforms that were in each stage's original source
-        // AND are actually used in the shader body (not just declared).
-        var vs_filtered: [MaxProgramUniforms]UniformDecl = undefined;
-        var vs_filtered_count: usize = 0;
-        const vs_count: usize = @intCast(vs_uniform_count);
-        for (vs_uniforms[0..vs_count]) |u| {
-            if (hasUniformName(vs_uniforms_pass1[0..vs_count_pass1], u.name) and
-                isUniformUsedInShader(vs_source, u.name))
-            {
-                vs_filtered[vs_filtered_count] = u;
-                vs_filtered_count += 1;
+
+        // Laid out once over both stages: sets strides and sizes and rejects
+        // arrays the sokol block cannot hold
+        var union_uniforms: [MaxProgramUniforms]UniformDecl = undefined;
+        var union_count: usize = 0;
+        for ([_][]const UniformDecl{ vs.uniformDecls(), fs.uniformDecls() }) |decls| {
+            for (decls) |u| {
+                if (hasUniformName(union_uniforms[0..union_count], u.name)) continue;
+                if (union_count >= MaxProgramUniforms) {
+                    try self.setInfoLog(entry, "uniform union too large");
+                    return false;
+                }
+                union_uniforms[union_count] = u;
+                union_count += 1;
             }
         }
-        self.storeUniforms(entry, .vertex, vs_filtered[0..vs_filtered_count], vs_block_size) catch {
-            try self.setInfoLog(entry, "vertex uniforms rejected");
-            return;
+        const block_size = layoutUniforms(union_uniforms[0..union_count]) catch {
+            try self.setInfoLog(entry, "uniform layout failed");
+            return false;
         };
 
-        var fs_filtered: [MaxProgramUniforms]UniformDecl = undefined;
-        var fs_filtered_count: usize = 0;
-        const fs_count: usize = @intCast(fs_uniform_count);
-        for (fs_uniforms[0..fs_count]) |u| {
-            if (hasUniformName(fs_uniforms_pass1[0..fs_count_pass1], u.name) and
-                isUniformUsedInShader(fs_source, u.name))
-            {
-                fs_filtered[fs_filtered_count] = u;
-                fs_filtered_count += 1;
-            }
-        }
-        self.storeUniforms(entry, .fragment, fs_filtered[0..fs_filtered_count], fs_block_size) catch {
-            try self.setInfoLog(entry, "fragment uniforms rejected");
-            return;
+        // Each stage declares and stores only the uniforms it reads in live
+        // code
+        var vs_used: [MaxProgramUniforms]UniformDecl = undefined;
+        const vs_uniforms = stageUniforms(&vs, union_uniforms[0..union_count], &vs_used);
+        var fs_used: [MaxProgramUniforms]UniformDecl = undefined;
+        const fs_uniforms = stageUniforms(&fs, union_uniforms[0..union_count], &fs_used);
+
+        assignAttribLocations(vs.attrs.items) catch {
+            try self.setInfoLog(entry, "vertex attributes need more than 16 locations or overlap");
+            return false;
         };
 
-        const vs_sampler_count_usize: usize = @intCast(vs_sampler_count);
-        self.storeSamplers(entry, .vertex, vs_samplers[0..vs_sampler_count_usize]) catch {
+        var text: std.ArrayList(u8) = .empty;
+        try assembleStage(arena, &text, .vertex, &vs, vs_uniforms);
+        try storeSource(&entry.program.vertex_source, &entry.program.vertex_source_len, text.items);
+        text.clearRetainingCapacity();
+        try assembleStage(arena, &text, .fragment, &fs, fs_uniforms);
+        try storeSource(&entry.program.fragment_source, &entry.program.fragment_source_len, text.items);
+
+        self.storeUniforms(entry, .vertex, vs_uniforms, block_size) catch {
+            try self.setInfoLog(entry, "vertex uniforms rejected");
+            return false;
+        };
+        self.storeUniforms(entry, .fragment, fs_uniforms, block_size) catch {
+            try self.setInfoLog(entry, "fragment uniforms rejected");
+            return false;
+        };
+        self.storeSamplers(entry, .vertex, vs.samplerDecls()) catch {
             try self.setInfoLog(entry, "vertex samplers rejected");
-            return;
+            return false;
         };
-        const fs_sampler_count_usize: usize = @intCast(fs_sampler_count);
-        self.storeSamplers(entry, .fragment, fs_samplers[0..fs_sampler_count_usize]) catch {
+        self.storeSamplers(entry, .fragment, fs.samplerDecls()) catch {
             try self.setInfoLog(entry, "fragment samplers rejected");
-            return;
+            return false;
+        };
+        entry.program.buffer_block_count = 0;
+        collectBufferBlocks(&entry.program, vs.buffer_blocks.items) catch {
+            try self.setInfoLog(entry, "vertex uniform blocks rejected");
+            return false;
+        };
+        collectBufferBlocks(&entry.program, fs.buffer_blocks.items) catch {
+            try self.setInfoLog(entry, "fragment uniform blocks rejected");
+            return false;
         };
-        const vs_len_usize: usize = @intCast(vs_len);
-        self.collectAttrNames(entry, entry.program.vertex_source[0..vs_len_usize]) catch {
+        storeAttrs(entry, vs.attrs.items) catch {
             try self.setInfoLog(entry, "attribute parse failed");
-            return;
+            return false;
         };
+        return true;
+    }
 
-        if (!sg.isvalid()) {
-            // No graphics context available (tests or headless).
-            entry.program.linked = true;
-            return;
-        }
-
-        // Reset dummy name counter before building shader descriptor
-        dummy_name_count = 0;
-
-        // Collect mat2/mat3 uniforms before shader creation
-        self.collectMatrixUniforms(entry);
-
-        const desc = buildShaderDesc(entry);
-        const shd = sg.makeShader(desc);
-        entry.program.backend_shader = shd;
-        if (sg.queryShaderState(shd) != .VALID) {
-            sg.destroyShader(shd);
-            entry.program.backend_shader = .{};
-            try self.setInfoLog(entry, "backend shader compile failed");
-            return;
-        }
-
-        // Query GL program ID and look up mat2/mat3 uniform locations
-        const gl_info = sg.glQueryShaderInfo(shd);
-        entry.program.gl_program = gl_info.prog;
-        self.lookupMatrixUniformLocations(entry);
+    fn loadCachedTranslation(self: *Self, entry: *Entry, key: u64) bool {
+        const payload = shader_cache.load(key, translation_cache_fingerprint) orelse return false;
+        defer shader_cache.freePayload(payload);
+        decodeTranslation(&entry.program, payload) catch |err| {
+            log.warn("shader cache entry {x} rejected: {s}", .{ key, @errorName(err) });
+            self.clearBackend(entry);
+            return false;
+        };
+        log.debug("link: shader cache hit {x}", .{key});
+        return true;
+    }
 
-        entry.program.linked = true;
+    fn storeCachedTranslation(self: *Self, entry: *Entry, key: u64) void {
+        _ = self;
+        if (!shader_cache.isEnabled()) return;
+        var writer = shader_cache.Writer{};
+        defer writer.deinit();
+        encodeTranslation(&entry.program, &writer);
+        const payload = writer.finish() orelse return;
+        shader_cache.store(key, translation_cache_fingerprint, payload);
     }
 
     pub fn getInfoLog(self: *Self, id: ProgramId) ?[]const u8 {
         if (!self.isValid(id)) return null;
-        const prog = &self.entries[id.index].program;
+        const entry = self.handles.at(id.index);
+        self.settleLink(entry);
+        const prog = &entry.program;
         if (prog.info_log_len == 0) return null;
         return prog.info_log_bytes[0..@as(usize, prog.info_log_len)];
     }
@@ -586,7 +918,7 @@ pub const ProgramTable = struct {
             if (len == 0) continue;
             const slice = prog.attr_names[idx][0..@as(usize, len)];
             if (std.mem.eql(u8, slice, name)) {
-                return @intCast(idx);
+                return prog.attr_locations[idx];
             }
         }
         return -1;
@@ -607,6 +939,71 @@ pub const ProgramTable = struct {
         return -1;
     }
 
+    /// getUniformBlockIndex(): the block's index in the program, null when
+    /// neither stage declares it.
+    pub fn getUniformBlockIndex(self: *Self, id: ProgramId, name: []const u8) !?u32 {
+        const prog = self.get(id) orelse return error.InvalidHandle;
+        for (prog.bufferBlocks(), 0..) |*block, idx| {
+            if (std.mem.eql(u8, block.name(), name)) return @intCast(idx);
+        }
+        return null;
+    }
+
+    /// uniformBlockBinding(): draws recorded from now on read block `index`
+    /// from the buffer bound at `binding`.
+    pub fn setUniformBlockBinding(self: *Self, id: ProgramId, index: u32, binding: u32) !void {
+        const prog = self.get(id) orelse return error.InvalidHandle;
+        if (index >= prog.buffer_block_count) return error.InvalidIndex;
+        if (binding >= webgl_state.MaxUniformBufferBindings) return error.InvalidBinding;
+        prog.buffer_blocks[@as(usize, index)].binding = @intCast(binding);
+    }
+
+    pub fn getUniformBlockBinding(self: *Self, id: ProgramId, index: u32) !u32 {
+        const prog = self.get(id) orelse return error.InvalidHandle;
+        if (index >= prog.buffer_block_count) return error.InvalidIndex;
+        return prog.buffer_blocks[@as(usize, index)].binding;
+    }
+
+    /// True if `loc` already holds `values`, so setUniformFloats() would
+    /// write the same bytes. Mat2/mat3 (column padded) always report false.
+    pub fn uniformFloatsMatch(self: *Self, id: ProgramId, loc: u32, values: []const f32) bool {
+        const uniform, const buffer = self.blockUniform(id, loc) orelse return false;
+        switch (uniform.utype) {
+            .FLOAT, .FLOAT2, .FLOAT3, .FLOAT4, .MAT4 => {},
+            else => return false,
+        }
+        return storedValuesMatch(f32, uniform, buffer, values);
+    }
+
+    /// setUniformInts() counterpart of uniformFloatsMatch(), including
+    /// sampler units.
+    pub fn uniformIntsMatch(self: *Self, id: ProgramId, loc: u32, values: []const i32) bool {
+        const info = decodeUniformLocation(loc);
+        if (info.kind == .sampler) {
+            const prog = self.get(id) orelse return false;
+            if (info.index >= prog.sampler_count) return false;
+            const sampler = &prog.samplers[@as(usize, info.index)];
+            const count: usize = if (sampler.array_count == 0) 1 else sampler.array_count;
+            if (values.len < count) return false;
+            return std.mem.eql(i32, sampler.units[0..count], values[0..count]);
+        }
+        const uniform, const buffer = self.blockUniform(id, loc) orelse return false;
+        switch (uniform.utype) {
+            .INT, .INT2, .INT3, .INT4 => {},
+            else => return false,
+        }
+        return storedValuesMatch(i32, uniform, buffer, values);
+    }
+
+    fn blockUniform(self: *Self, id: ProgramId, loc: u32) ?struct { UniformEntry, []const u8 } {
+        const prog = self.get(id) orelse return null;
+        const info = decodeUniformLocation(loc);
+        if (info.kind != .block) return null;
+        const block = prog.uniformBlock(info.stage);
+        if (info.index >= block.count or block.size == 0) return null;
+        return .{ block.items[@as(usize, info.index)], block.buffer[0..@as(usize, block.size)] };
+    }
+
     pub fn setUniformFloats(self: *Self, id: ProgramId, loc: u32, values: []const f32) !void {
         const prog = self.get(id) orelse return error.InvalidHandle;
         const info = decodeUniformLocation(loc);
@@ -617,6 +1014,8 @@ pub const ProgramTable = struct {
         if (block.size == 0) return error.NoUniformBuffer;
         const size = @as(usize, block.size);
         try writeUniformFloats(uniform, block.buffer[0..size], values);
+        block.dirty.set(info.index);
+        block.dirty_range.include(uniform.offset, uniform.byteEnd());
         const name = uniform.name_bytes[0..@as(usize, uniform.name_len)];
         const other_block = if (info.stage == .vertex) &prog.fs_uniforms else &prog.vs_uniforms;
         if (findUniform(other_block, name)) |other_idx| {
@@ -624,6 +1023,8 @@ pub const ProgramTable = struct {
             const other_uniform = other_block.items[@as(usize, other_idx)];
             const other_size = @as(usize, other_block.size);
             try writeUniformFloats(other_uniform, other_block.buffer[0..other_size], values);
+            other_block.dirty.set(other_idx);
+            other_block.dirty_range.include(other_uniform.offset, other_uniform.byteEnd());
         }
     }
 
@@ -639,6 +1040,8 @@ pub const ProgramTable = struct {
         if (block.size == 0) return error.NoUniformBuffer;
         const size = @as(usize, block.size);
         try writeUniformInts(uniform, block.buffer[0..size], values);
+        block.dirty.set(info.index);
+        block.dirty_range.include(uniform.offset, uniform.byteEnd());
         const name = uniform.name_bytes[0..@as(usize, uniform.name_len)];
         const other_block = if (info.stage == .vertex) &entry.fs_uniforms else &entry.vs_uniforms;
         if (findUniform(other_block, name)) |other_idx| {
@@ -646,74 +1049,163 @@ pub const ProgramTable = struct {
             const other_uniform = other_block.items[@as(usize, other_idx)];
             const other_size = @as(usize, other_block.size);
             try writeUniformInts(other_uniform, other_block.buffer[0..other_size], values);
+            other_block.dirty.set(other_idx);
+            other_block.dirty_range.include(other_uniform.offset, other_uniform.byteEnd());
         }
     }
 
     pub fn ensureBackendShader(self: *Self, id: ProgramId) bool {
         if (!self.isValid(id)) return false;
         if (!sg.isvalid()) return false;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
+        self.settleLink(entry);
         if (entry.program.backend_shader.id != 0) return true;
         if (entry.program.vertex_source_len == 0 or entry.program.fragment_source_len == 0) return false;
-        const desc = buildShaderDesc(entry);
-        const shd = sg.makeShader(desc);
-        entry.program.backend_shader = shd;
-        if (sg.queryShaderState(shd) != .VALID) {
-            sg.destroyShader(shd);
-            entry.program.backend_shader = .{};
-            return false;
+        return self.makeBackendShader(entry);
+    }
+
+    /// Switch to a backend shader in which exactly the slots in `mask` take
+    /// unfilterable textures. sokol checks each slot's sample type against
+    /// the bound texture, which plain GL never did. Shaders made for earlier
+    /// masks are kept, so a program alternating between float and
+    /// unfilterable textures only rebinds GL locations after the first time.
+    pub fn setUnfilterableSlots(self: *Self, id: ProgramId, mask: u16) bool {
+        if (!self.isValid(id) or !sg.isvalid()) return false;
+        const entry = self.handles.at(id.index);
+        const prog = &entry.program;
+        if (prog.unfilterable_slots == mask and prog.backend_shader.id != 0) return true;
+        log.debug("setUnfilterableSlots: program {d} slots 0x{x} -> 0x{x}", .{ id.index, prog.unfilterable_slots, mask });
+        prog.unfilterable_slots = mask;
+        for (prog.shader_variants[0..prog.shader_variant_count]) |variant| {
+            if (variant.unfilterable_slots != mask) continue;
+            prog.backend_shader = variant.shader;
+            self.resolveGlLocations(entry);
+            return true;
         }
-        return true;
+        return self.makeBackendShader(entry);
     }
 
     pub fn free(self: *Self, id: ProgramId) bool {
-        if (!self.isValid(id)) return false;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.get(id) orelse return false;
+        self.settleLink(entry);
         self.clearInfoLog(entry);
         self.clearBackend(entry);
-        entry.active = false;
-        entry.generation +%= 1;
         const cleared_id = ProgramId{ .index = id.index, .generation = 0 };
         resetProgram(&entry.program, cleared_id);
-        self.count -= 1;
-        return true;
+        return self.handles.free(id);
     }
 
-    pub fn isValid(self: *Self, id: ProgramId) bool {
-        if (id.index >= MaxPrograms) return false;
-        const entry = &self.entries[id.index];
-        return entry.active and entry.generation == id.generation;
+    pub fn isValid(self: *const Self, id: ProgramId) bool {
+        return self.handles.isValid(id);
     }
 
     pub fn reset(self: *Self) void {
-        self.initInPlace();
+        self.releaseAll();
+        self.handles.reset();
     }
 
     pub fn deinit(self: *Self) void {
+        self.releaseAll();
+        self.handles.deinit();
         self.initInPlace();
     }
 
-    /// Apply mat2/mat3 uniforms via direct GL calls.
-    /// Call this after sg.applyUniforms to set the matrix uniforms that Sokol can't handle.
-    /// Returns true if any uniforms were applied.
-    pub fn applyMatrixUniforms(self: *Self, id: ProgramId) bool {
-        const prog = self.get(id) orelse return false;
-        if (prog.mat_uniform_count == 0) return false;
-        if (prog.gl_program == 0) return false;
-
-        if (!gl_uniforms.isAvailable()) return false;
-
+    /// Apply every direct-GL uniform (FS fallback, mat2/mat3) that
+    /// changed since the last call for this program. GL keeps uniform values
+    /// per program object, so clean uniforms need no re-upload. Call this
+    /// after sg.applyPipeline for the program. Returns the uniforms applied.
+    pub fn applyDirectUniforms(self: *Self, id: ProgramId) u32 {
+        const prog = self.get(id) orelse return 0;
         var applied: u32 = 0;
-        const mat_count: usize = @intCast(prog.mat_uniform_count);
-        for (prog.mat_uniforms[0..mat_count]) |mat| {
-            if (mat.gl_location < 0) continue;
+        if (prog.gl_program != 0 and gl_uniforms.isAvailable()) {
+            applied += applyFallbackUniforms(prog);
+            applied += applyMatrixUniforms(prog);
+        }
+        prog.vs_uniforms.dirty = .initEmpty();
+        prog.fs_uniforms.dirty = .initEmpty();
+        return applied;
+    }
 
-            // Get the data from the appropriate uniform block
-            const block = if (mat.stage == .vertex) &prog.vs_uniforms else &prog.fs_uniforms;
-            if (block.size == 0) continue;
+    /// Query the GL program behind the backend shader and resolve every
+    /// direct-GL uniform location once, so draws never look up by name.
+    /// Marks everything dirty since a new GL program holds no values yet.
+    fn resolveGlLocations(self: *Self, entry: *Entry) void {
+        const prog = &entry.program;
+        prog.gl_program = sg.glQueryShaderInfo(prog.backend_shader).prog;
+        prog.fallback_uniform_count = 0;
+        prog.draw_id_location = -1;
+        prog.vs_uniforms.dirty = .initFull();
+        prog.fs_uniforms.dirty = .initFull();
+        if (prog.gl_program == 0) return;
 
-            const offset: usize = @intCast(mat.offset);
-            const block_size: usize = @intCast(block.size);
+        gl_uniforms.init();
+        if (!gl_uniforms.isAvailable()) {
+            log.warn("resolveGlLocations: GL not available", .{});
+            return;
+        }
+        self.lookupMatrixUniformLocations(entry);
+        prog.draw_id_location = gl_uniforms.getUniformLocation(prog.gl_program, DrawIdUniform);
+        // Block i reads GL slot i for good; uniformBlockBinding() only
+        // changes which buffer range draws bind there
+        for (prog.bufferBlocks(), 0..) |*block, idx| {
+            const name_ptr: [*:0]const u8 = @ptrCast(block.name_bytes[0..].ptr);
+            const gl_index = gl_uniforms.getUniformBlockIndex(prog.gl_program, name_ptr) orelse continue;
+            gl_uniforms.uniformBlockBinding(prog.gl_program, gl_index, @intCast(idx));
+        }
+
+        for (fallback_uniform_names) |fallback| {
+            const idx = findUniform(&prog.fs_uniforms, fallback.name) orelse continue;
+            const item = prog.fs_uniforms.items[@as(usize, idx)];
+            if (item.utype != fallback.utype) continue;
+            const loc = gl_uniforms.getUniformLocation(prog.gl_program, fallback.name.ptr);
+            if (loc < 0) continue;
+            prog.fallback_uniforms[@as(usize, prog.fallback_uniform_count)] = .{
+                .utype = item.utype,
+                .index = idx,
+                .offset = item.offset,
+                .gl_location = loc,
+            };
+            prog.fallback_uniform_count += 1;
+        }
+    }
+
+    fn applyFallbackUniforms(prog: *Program) u32 {
+        var applied: u32 = 0;
+        const block = &prog.fs_uniforms;
+        for (prog.fallback_uniforms[0..@as(usize, prog.fallback_uniform_count)]) |fallback| {
+            if (!block.dirty.isSet(fallback.index)) continue;
+            const offset: usize = @intCast(fallback.offset);
+            const src = block.buffer[offset..];
+            switch (fallback.utype) {
+                .FLOAT3 => {
+                    const data = [_]f32{ @bitCast(src[0..4].*), @bitCast(src[4..8].*), @bitCast(src[8..12].*) };
+                    gl_uniforms.uniform3fv(fallback.gl_location, 1, &data);
+                },
+                .FLOAT => gl_uniforms.uniform1f(fallback.gl_location, @bitCast(src[0..4].*)),
+                else => continue,
+            }
+            applied += 1;
+        }
+        return applied;
+    }
+
+    /// Apply dirty mat2/mat3 uniforms via direct GL calls (Sokol only
+    /// supports mat4).
+    fn applyMatrixUniforms(prog: *Program) u32 {
+        if (prog.mat_uniform_count == 0) return 0;
+
+        var applied: u32 = 0;
+        const mat_count: usize = @intCast(prog.mat_uniform_count);
+        for (prog.mat_uniforms[0..mat_count]) |mat| {
+            if (mat.gl_location < 0) continue;
+
+            // Get the data from the appropriate uniform block
+            const block = if (mat.stage == .vertex) &prog.vs_uniforms else &prog.fs_uniforms;
+            if (block.size == 0) continue;
+            if (!block.dirty.isSet(mat.index)) continue;
+
+            const offset: usize = @intCast(mat.offset);
+            const block_size: usize = @intCast(block.size);
             if (offset >= block_size) continue;
 
             // Mat3 in std140 is stored as 3 vec4 columns (48 bytes), but glUniformMatrix3fv
@@ -766,50 +1258,7 @@ pub const ProgramTable = struct {
         if (applied > 0) {
             log.debug("applyMatrixUniforms: applied {d} uniforms", .{applied});
         }
-        return applied > 0;
-    }
-
-    /// Apply sampler uniforms via direct GL calls (sets texture unit for each sampler).
-    /// Call this at draw time when the program is active.
-    pub fn applySamplerUniforms(self: *Self, id: ProgramId) bool {
-        const entry = &self.entries[id.index];
-        const prog = &entry.program;
-        if (prog.sampler_count == 0) return false;
-        if (prog.gl_program == 0) return false;
-        if (!gl_uniforms.isAvailable()) return false;
-
-        // Verify the correct program is bound
-        const current_prog = gl_uniforms.getCurrentProgram();
-        if (current_prog != prog.gl_program) {
-            log.warn("applySamplerUniforms: program mismatch! current={d} expected={d}", .{ current_prog, prog.gl_program });
-        }
-
-        var applied: u32 = 0;
-        const count: usize = @intCast(prog.sampler_count);
-        for (prog.samplers[0..count]) |*sampler| {
-            if (!sampler.dirty) continue;
-            if (sampler.name_len == 0) continue;
-
-            // Look up GL location if not cached
-            if (sampler.gl_location < 0) {
-                const name_ptr: [*:0]const u8 = @ptrCast(sampler.name_bytes[0..].ptr);
-                sampler.gl_location = gl_uniforms.getUniformLocation(prog.gl_program, name_ptr);
-            }
-
-            if (sampler.gl_location >= 0) {
-                gl_uniforms.uniform1i(sampler.gl_location, sampler.units[0]);
-                log.info("applySamplerUniforms: '{s}' gl_loc={d} unit={d} (gl_program={d})", .{
-                    sampler.name_bytes[0..@as(usize, sampler.name_len)],
-                    sampler.gl_location,
-                    sampler.units[0],
-                    prog.gl_program,
-                });
-                applied += 1;
-            }
-            sampler.dirty = false;
-        }
-
-        return applied > 0;
+        return applied;
     }
 
     fn setInfoLog(self: *Self, entry: *Entry, log_msg: []const u8) !void {
@@ -836,120 +1285,48 @@ pub const ProgramTable = struct {
     }
 
     fn clearBackend(self: *Self, entry: *Entry) void {
-        if (entry.program.backend_shader.id != 0) {
-            sg.destroyShader(entry.program.backend_shader);
-            entry.program.backend_shader = .{};
+        for (entry.program.shader_variants[0..entry.program.shader_variant_count]) |variant| {
+            sg.destroyShader(variant.shader);
         }
-        entry.program.vertex_source_len = 0;
-        entry.program.fragment_source_len = 0;
+        entry.program.shader_variant_count = 0;
+        entry.program.shader_variant_next = 0;
+        entry.program.backend_shader = .{};
+        releaseSources(&entry.program);
         @memset(&entry.program.attr_name_lens, 0);
         @memset(std.mem.asBytes(&entry.program.attr_names), 0);
+        @memset(&entry.program.attr_locations, 0);
+        @memset(&entry.program.attr_types, .INVALID);
         entry.program.attr_count = 0;
         entry.program.sampler_count = 0;
+        entry.program.fallback_uniform_count = 0;
+        entry.program.buffer_block_count = 0;
         for (&entry.program.samplers) |*s| {
             @memset(std.mem.asBytes(s), 0);
             s.array_count = 1;
-            s.gl_location = -1;
         }
+        entry.program.texture_slot_count = 0;
+        entry.program.unfilterable_slots = 0;
         self.clearUniforms(entry);
     }
 
-    fn collectAttrNames(self: *Self, entry: *Entry, source: []const u8) !void {
-        _ = self;
+    fn storeAttrs(entry: *Entry, inputs: []const VertexInput) !void {
         @memset(&entry.program.attr_name_lens, 0);
         @memset(std.mem.asBytes(&entry.program.attr_names), 0);
         entry.program.attr_count = 0;
-
-        // Simple preprocessor state to handle #ifdef/#ifndef/#else/#endif
-        const MaxDefines: usize = 32;
-        const MaxIfdefDepth: usize = 16;
-        var defines: [MaxDefines][MaxAttrNameBytes]u8 = undefined;
-        var define_lens: [MaxDefines]u8 = undefined;
-        @memset(&define_lens, 0);
-        var define_count: usize = 0;
-        var ifdef_stack: [MaxIfdefDepth]bool = undefined; // true = active section
-        var ifdef_depth: usize = 0;
-
-        var it = std.mem.splitScalar(u8, source, '\n');
-        while (it.next()) |line| {
-            const trimmed = std.mem.trimLeft(u8, line, " \t\r");
-            if (std.mem.startsWith(u8, trimmed, "#version")) continue;
-
-            // Handle preprocessor directives
-            if (std.mem.startsWith(u8, trimmed, "#define ")) {
-                if (ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1]) {
-                    const rest = trimmed["#define ".len..];
-                    var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-                    if (tokens.next()) |def_name| {
-                        if (define_count < MaxDefines and def_name.len < MaxAttrNameBytes) {
-                            @memcpy(defines[define_count][0..def_name.len], def_name);
-                            define_lens[define_count] = @intCast(def_name.len);
-                            define_count += 1;
-                        }
-                    }
-                }
-                continue;
-            }
-
-            if (std.mem.startsWith(u8, trimmed, "#ifdef ")) {
-                const rest = trimmed["#ifdef ".len..];
-                var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-                const def_name = tokens.next() orelse "";
-                const defined = isDefined(defines[0..define_count], define_lens[0..define_count], def_name);
-                const parent_active = ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1];
-                if (ifdef_depth < MaxIfdefDepth) {
-                    ifdef_stack[ifdef_depth] = parent_active and defined;
-                    ifdef_depth += 1;
-                }
-                continue;
-            }
-
-            if (std.mem.startsWith(u8, trimmed, "#ifndef ")) {
-                const rest = trimmed["#ifndef ".len..];
-                var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-                const def_name = tokens.next() orelse "";
-                const defined = isDefined(defines[0..define_count], define_lens[0..define_count], def_name);
-                const parent_active = ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1];
-                if (ifdef_depth < MaxIfdefDepth) {
-                    ifdef_stack[ifdef_depth] = parent_active and !defined;
-                    ifdef_depth += 1;
-                }
-                continue;
-            }
-
-            if (std.mem.startsWith(u8, trimmed, "#else")) {
-                if (ifdef_depth > 0) {
-                    const parent_active = ifdef_depth <= 1 or ifdef_stack[ifdef_depth - 2];
-                    ifdef_stack[ifdef_depth - 1] = parent_active and !ifdef_stack[ifdef_depth - 1];
-                }
-                continue;
-            }
-
-            if (std.mem.startsWith(u8, trimmed, "#endif")) {
-                if (ifdef_depth > 0) {
-                    ifdef_depth -= 1;
-                }
-                continue;
+        outer: for (inputs) |input| {
+            const name = input.name;
+            for (0..@as(usize, entry.program.attr_count)) |idx| {
+                const len: usize = entry.program.attr_name_lens[idx];
+                if (std.mem.eql(u8, entry.program.attr_names[idx][0..len], name)) continue :outer;
             }
-
-            // Skip lines inside inactive preprocessor blocks
-            if (ifdef_depth > 0 and !ifdef_stack[ifdef_depth - 1]) continue;
-
-            const decl = extractAttrDecl(trimmed) orelse continue;
-            var tokens = std.mem.tokenizeAny(u8, decl, " \t");
-            _ = tokens.next() orelse continue; // type
-            const name_token = tokens.next() orelse continue;
-            var name = std.mem.trimRight(u8, name_token, " \t\r;");
-            if (std.mem.indexOfScalar(u8, name, '[')) |idx| {
-                name = name[0..idx];
-            }
-            if (name.len == 0) continue;
             if (@as(usize, entry.program.attr_count) >= MaxProgramAttrs) return error.TooManyAttribs;
             if (name.len >= MaxAttrNameBytes) return error.AttribNameTooLong;
             const attr_index: usize = @intCast(entry.program.attr_count);
             @memcpy(entry.program.attr_names[attr_index][0..name.len], name);
             entry.program.attr_names[attr_index][name.len] = 0;
             entry.program.attr_name_lens[attr_index] = @intCast(name.len);
+            entry.program.attr_locations[attr_index] = input.location orelse return error.AttribNotLocated;
+            entry.program.attr_types[attr_index] = input.utype;
             entry.program.attr_count += 1;
         }
     }
@@ -961,7 +1338,7 @@ pub const ProgramTable = struct {
 
         // Collect from vertex shader uniforms
         const vs_count: usize = @intCast(entry.program.vs_uniforms.count);
-        for (entry.program.vs_uniforms.items[0..vs_count]) |item| {
+        for (entry.program.vs_uniforms.items[0..vs_count], 0..) |item, item_idx| {
             if (item.name_len == 0) continue;
             if (item.utype == .MAT2 or item.utype == .MAT3) {
                 if (entry.program.mat_uniform_count >= MaxMatrixUniforms) break;
@@ -971,6 +1348,7 @@ pub const ProgramTable = struct {
                     .name_bytes = item.name_bytes,
                     .utype = item.utype,
                     .stage = .vertex,
+                    .index = @intCast(item_idx),
                     .offset = item.offset,
                     .gl_location = -1,
                     .array_count = item.array_count,
@@ -981,7 +1359,7 @@ pub const ProgramTable = struct {
 
         // Collect from fragment shader uniforms
         const fs_count: usize = @intCast(entry.program.fs_uniforms.count);
-        for (entry.program.fs_uniforms.items[0..fs_count]) |item| {
+        for (entry.program.fs_uniforms.items[0..fs_count], 0..) |item, item_idx| {
             if (item.name_len == 0) continue;
             if (item.utype == .MAT2 or item.utype == .MAT3) {
                 // Check if already collected from VS (shared uniform)
@@ -1004,6 +1382,7 @@ pub const ProgramTable = struct {
                     .name_bytes = item.name_bytes,
                     .utype = item.utype,
                     .stage = .fragment,
+                    .index = @intCast(item_idx),
                     .offset = item.offset,
                     .gl_location = -1,
                     .array_count = item.array_count,
@@ -1013,7 +1392,7 @@ pub const ProgramTable = struct {
         }
 
         if (entry.program.mat_uniform_count > 0) {
-            log.info("collectMatrixUniforms: found {d} mat2/mat3 uniforms", .{entry.program.mat_uniform_count});
+            log.debug("collectMatrixUniforms: found {d} mat2/mat3 uniforms", .{entry.program.mat_uniform_count});
         }
     }
 
@@ -1023,24 +1402,17 @@ pub const ProgramTable = struct {
         if (entry.program.gl_program == 0) return;
         if (entry.program.mat_uniform_count == 0) return;
 
-        // Initialize GL if needed
-        gl_uniforms.init();
-        if (!gl_uniforms.isAvailable()) {
-            log.warn("lookupMatrixUniformLocations: GL not available", .{});
-            return;
-        }
-
         const mat_count: usize = @intCast(entry.program.mat_uniform_count);
         for (entry.program.mat_uniforms[0..mat_count]) |*mat| {
             // The name_bytes should be null-terminated
             const name_ptr: [*:0]const u8 = @ptrCast(mat.name_bytes[0..].ptr);
             mat.gl_location = gl_uniforms.getUniformLocation(entry.program.gl_program, name_ptr);
             const name = mat.name_bytes[0..@as(usize, mat.name_len)];
-            log.info("lookupMatrixUniformLocations: '{s}' -> gl_loc={d}", .{ name, mat.gl_location });
+            log.debug("lookupMatrixUniformLocations: '{s}' -> gl_loc={d}", .{ name, mat.gl_location });
         }
     }
 
-    fn storeUniforms(self: *Self, entry: *Entry, stage: UniformStage, decls: []UniformDecl, block_size: u32) !void {
+    fn storeUniforms(self: *Self, entry: *Entry, stage: UniformStage, decls: []const UniformDecl, block_size: u32) !void {
         _ = self;
         _ = block_size; // Recompute instead of using passed-in size
         const block = if (stage == .vertex) &entry.program.vs_uniforms else &entry.program.fs_uniforms;
@@ -1079,13 +1451,13 @@ pub const ProgramTable = struct {
 
         // Debug: log stored uniforms
         const stage_name = if (stage == .vertex) "VS" else "FS";
-        log.info("storeUniforms {s}: {d} uniforms, size={d}", .{ stage_name, decls.len, computed_size });
+        log.debug("storeUniforms {s}: {d} uniforms, size={d}", .{ stage_name, decls.len, computed_size });
         for (decls, 0..) |decl, idx| {
-            log.info("  [{d}] '{s}' type={s} offset={d}", .{ idx, decl.name, @tagName(decl.utype), block.items[idx].offset });
+            log.debug("  [{d}] '{s}' type={s} offset={d}", .{ idx, decl.name, @tagName(decl.utype), block.items[idx].offset });
         }
     }
 
-    fn storeSamplers(self: *Self, entry: *Entry, stage: UniformStage, decls: []SamplerDecl) !void {
+    fn storeSamplers(self: *Self, entry: *Entry, stage: UniformStage, decls: []const SamplerDecl) !void {
         _ = self;
         if (decls.len == 0) return;
         for (decls) |decl| {
@@ -1106,28 +1478,77 @@ pub const ProgramTable = struct {
     fn buildShaderDesc(entry: *Entry) sg.ShaderDesc {
         var desc = sg.ShaderDesc{};
         if (entry.program.vertex_source_len > 0) {
-            desc.vertex_func.source = entry.program.vertex_source[0..].ptr;
+            desc.vertex_func.source = entry.program.vertex_source.ptr;
         }
         if (entry.program.fragment_source_len > 0) {
-            desc.fragment_func.source = entry.program.fragment_source[0..].ptr;
-        }
-        for (entry.program.attr_name_lens, 0..) |name_len, idx| {
-            if (idx >= @as(usize, entry.program.attr_count)) break;
-            if (name_len == 0) continue;
-            desc.attrs[idx].glsl_name = entry.program.attr_names[idx][0..].ptr;
+            desc.fragment_func.source = entry.program.fragment_source.ptr;
         }
+        // Vertex inputs carry explicit locations: with no name, sokol binds
+        // attribute slot i to location i, matrix columns included
         applyUniformBlock(&desc, 0, .VERTEX, &entry.program.vs_uniforms);
         applyUniformBlock(&desc, 1, .FRAGMENT, &entry.program.fs_uniforms);
 
-        // Note: For the GL backend, we don't declare samplers in the shader descriptor.
-        // GL handles sampler->texture unit binding natively via uniform1i calls.
-        // If we declare samplers here, Sokol validates that bindings exist for ALL declared
-        // samplers, but Three.js shaders often have unused samplers that get optimized out.
+        // One view, sampler and pair per texture slot. sokol's GL backend
+        // points each pair's sampler uniform at a texture unit when it
+        // creates the shader and skips pairs the compiler optimized out,
+        // but draws still bind every declared slot (webgl_draw binds a
+        // placeholder where the unit holds nothing).
+        for (entry.program.textureSlots(), 0..) |slot, idx| {
+            const sampler = &entry.program.samplers[slot.sampler];
+            const stage: sg.ShaderStage = if (sampler.stage == .vertex) .VERTEX else .FRAGMENT;
+            const unfilterable = (entry.program.unfilterable_slots & (@as(u16, 1) << @intCast(idx))) != 0;
+            const shadow = sampler.kind == .sampler2dShadow;
+            desc.views[idx].texture = .{
+                .stage = stage,
+                .image_type = if (sampler.kind == .samplerCube) .CUBE else ._2D,
+                .sample_type = if (shadow) .DEPTH else if (unfilterable) .UNFILTERABLE_FLOAT else .FLOAT,
+            };
+            desc.samplers[idx] = .{
+                .stage = stage,
+                .sampler_type = if (shadow) .COMPARISON else if (unfilterable) .NONFILTERING else .FILTERING,
+            };
+            desc.texture_sampler_pairs[idx] = .{
+                .stage = stage,
+                .view_slot = @intCast(idx),
+                .sampler_slot = @intCast(idx),
+                .glsl_name = slotGlslName(sampler, slot, idx),
+            };
+        }
 
         return desc;
     }
 };
 
+/// Give every sampler element a texture slot in declaration order. Each slot
+/// takes one of sokol's sampler bindings, so a program with more elements
+/// than MaxTextureSlots fails to link rather than sampling the wrong unit.
+fn assignTextureSlots(prog: *Program) error{TooManyTextureSlots}!void {
+    prog.texture_slot_count = 0;
+    prog.unfilterable_slots = 0;
+    for (prog.samplers[0..@as(usize, prog.sampler_count)], 0..) |sampler, index| {
+        const count: usize = if (sampler.array_count == 0) 1 else sampler.array_count;
+        for (0..count) |element| {
+            if (prog.texture_slot_count >= MaxTextureSlots) return error.TooManyTextureSlots;
+            prog.texture_slots[prog.texture_slot_count] = .{
+                .sampler = @intCast(index),
+                .element = @intCast(element),
+            };
+            prog.texture_slot_count += 1;
+        }
+    }
+}
+
+/// "name[i]" buffers for sampler array slots (static, like dummy_name_buffers)
+var slot_name_buffers: [MaxTextureSlots][MaxUniformNameBytes + 8]u8 = undefined;
+
+fn slotGlslName(sampler: *const SamplerEntry, slot: TextureSlot, idx: usize) [*:0]const u8 {
+    if (sampler.array_count <= 1) return @ptrCast(sampler.name_bytes[0..].ptr);
+    const name = sampler.name_bytes[0..@as(usize, sampler.name_len)];
+    const element = std.fmt.bufPrintZ(&slot_name_buffers[idx], "{s}[{d}]", .{ name, slot.element }) catch
+        return @ptrCast(sampler.name_bytes[0..].ptr);
+    return element.ptr;
+}
+
 /// Dummy name buffers for MAT2/MAT3 uniforms (static to persist past function return)
 var dummy_name_buffers: [16][MaxUniformNameBytes + 16]u8 = undefined;
 var dummy_name_count: usize = 0;
@@ -1199,6 +1620,46 @@ fn decodeUniformLocation(loc: u32) UniformLocation {
     };
 }
 
+/// Three.js uniforms set once per camera/scene rather than per object.
+/// Light arrays match by prefix ("pointLights[0].color").
+const frame_uniform_names = [_][]const u8{
+    "projectionMatrix",
+    "viewMatrix",
+    "cameraPosition",
+    "isOrthographic",
+    "logDepthBufFC",
+    "toneMappingExposure",
+    "ambientLightColor",
+    "lightProbe",
+    "directionalLights",
+    "pointLights",
+    "spotLights",
+    "rectAreaLights",
+    "hemisphereLights",
+};
+
+fn isFrameUniform(name: []const u8) bool {
+    for (frame_uniform_names) |frame_name| {
+        if (!std.mem.startsWith(u8, name, frame_name)) continue;
+        if (name.len == frame_name.len) return true;
+        const next = name[frame_name.len];
+        if (next == '[' or next == '.') return true;
+    }
+    return false;
+}
+
+/// Tag each item with its scope and compute the extent of each scope.
+fn classifyUniforms(block: *UniformBlock) void {
+    block.object_range = .{};
+    block.frame_range = .{};
+    for (block.items[0..@as(usize, block.count)]) |*item| {
+        const name = item.name_bytes[0..@as(usize, item.name_len)];
+        item.scope = if (isFrameUniform(name)) .frame else .object;
+        const range = if (item.scope == .object) &block.object_range else &block.frame_range;
+        range.include(item.offset, item.byteEnd());
+    }
+}
+
 fn findUniform(block: *const UniformBlock, name: []const u8) ?u8 {
     if (block.count == 0) return null;
     var query = name;
@@ -1327,22 +1788,39 @@ fn writeUniformInts(uniform: UniformEntry, buffer: []u8, values: []const i32) !v
     }
 }
 
+/// Compare values against what writeUniformFloats/Ints stored, element by
+/// element; padding between strided elements is not compared.
+fn storedValuesMatch(comptime T: type, uniform: UniformEntry, buffer: []const u8, values: []const T) bool {
+    const comps = uniformComponents(uniform.utype);
+    const elem_count: usize = if (uniform.array_count == 0) 1 else uniform.array_count;
+    if (values.len < elem_count * comps or uniform.size != comps * @sizeOf(T)) return false;
+    for (0..elem_count) |idx| {
+        const off = uniform.offset + uniform.stride * @as(u32, @intCast(idx));
+        if (off + uniform.size > buffer.len) return false;
+        const src = std.mem.sliceAsBytes(values[idx * comps ..][0..comps]);
+        if (!std.mem.eql(u8, buffer[off..][0..uniform.size], src)) return false;
+    }
+    return true;
+}
+
 fn setSamplerUnits(entry: *Program, index: u8, values: []const i32) !void {
     if (index >= entry.sampler_count) return error.InvalidLocation;
     const sampler = &entry.samplers[@as(usize, index)];
     const count: usize = if (sampler.array_count == 0) 1 else sampler.array_count;
     if (values.len < count) return error.NotEnoughData;
+    // Draws read the units when they pick each slot's texture
     for (0..count) |i| {
         sampler.units[i] = values[i];
     }
-    // Mark sampler as dirty - actual GL uniform1i will be called at draw time
-    // when the program is guaranteed to be active
-    sampler.dirty = true;
 }
 
-const ShaderStage = enum { vertex, fragment };
+// =============================================================================
+// GLSL ES to GLSL 330 translation
+// =============================================================================
 
-const UniformStage = enum(u8) { vertex = 0, fragment = 1 };
+pub const ShaderStage = enum { vertex, fragment };
+
+pub const UniformStage = enum(u8) { vertex = 0, fragment = 1 };
 
 const UniformDecl = struct {
     name: []const u8,
@@ -1359,374 +1837,970 @@ const SamplerDecl = struct {
     array_count: u16,
 };
 
-const UniformParse = union(enum) {
-    block: UniformDecl,
-    sampler: SamplerDecl,
+const UniformName = struct {
+    name: []const u8,
+    count: u16,
 };
 
-const MaxShaderLineBytes: usize = 1024;
+/// GLSL 330 has no gl_DrawID (WEBGL_multi_draw), so shaders read this
+/// uniform instead; webgl_draw sets it before each draw of a multi-draw.
+/// Not the `_gl_DrawID` Three.js declares when the extension is missing.
+pub const DrawIdUniform = "_tn_DrawID";
+
+/// Scan and assemble one stage on its own, the work a link does per stage
+/// before merging the stages' uniforms. For `zig build bench`.
+pub fn translateStage(allocator: std.mem.Allocator, source: []const u8, stage: ShaderStage, out: *std.ArrayList(u8)) !void {
+    var arena_state = std.heap.ArenaAllocator.init(allocator);
+    defer arena_state.deinit();
+    var scan: StageScan = .{};
+    try scanStage(arena_state.allocator(), source, stage, &scan);
+    try assignAttribLocations(scan.attrs.items);
+    var uniforms: [MaxProgramUniforms]UniformDecl = undefined;
+    const emitted = stageUniforms(&scan, scan.uniformDecls(), &uniforms);
+    _ = try layoutUniforms(emitted);
+    out.clearRetainingCapacity();
+    try assembleStage(allocator, out, stage, &scan, emitted);
+}
 
-fn translateEsToGl330(
-    source: []const u8,
+/// A vertex input in live code.
+const VertexInput = struct {
+    name: []const u8,
+    utype: UniformType,
+    /// Consecutive locations taken: a matrix has one per column
+    columns: u8,
+    /// From the source's layout qualifier, else from assignAttribLocations
+    location: ?u8 = null,
+    /// Body offset of an implicitly located declaration, where
+    /// assembleStage inserts its layout qualifier
+    insert_at: ?usize = null,
+};
+
+/// Give the inputs without a layout location the lowest free run of
+/// locations, in declaration order, around the explicitly located ones.
+fn assignAttribLocations(inputs: []VertexInput) !void {
+    const max = sg.max_vertex_attributes;
+    var taken: u32 = 0;
+    for (inputs) |input| {
+        const location = input.location orelse continue;
+        if (@as(usize, location) + input.columns > max) return error.TooManyAttribs;
+        const mask = ((@as(u32, 1) << @intCast(input.columns)) - 1) << @intCast(location);
+        if (taken & mask != 0) return error.AttribLocationOverlap;
+        taken |= mask;
+    }
+    for (inputs) |*input| {
+        if (input.location != null) continue;
+        const mask = (@as(u32, 1) << @intCast(input.columns)) - 1;
+        const location: usize = for (0..max - input.columns + 1) |loc| {
+            if (taken & (mask << @intCast(loc)) == 0) break loc;
+        } else return error.TooManyAttribs;
+        taken |= mask << @intCast(location);
+        input.location = @intCast(location);
+    }
+}
+
+/// Locations a vertex input of this type takes.
+fn attribColumns(type_name: []const u8) u8 {
+    if (type_name.len >= 4 and std.mem.startsWith(u8, type_name, "mat") and std.ascii.isDigit(type_name[3])) {
+        return type_name[3] - '0';
+    }
+    return 1;
+}
+
+/// One stage's source after a single walk: the rewritten body and all the
+/// link reflects from it. Slices point into the source.
+///
+/// Code is live unless the preprocessor state seen so far rules it out.
+/// Conditions that cannot be evaluated here leave both branches live, so
+/// a uniform is never dropped that the GL compiler would see read.
+const StageScan = struct {
+    /// The source less #version, precision statements and the loose
+    /// uniform and sampler declarations (the header redeclares those),
+    /// with ES-only words renamed
+    body: std.ArrayList(u8) = .empty,
+    uniforms: [MaxProgramUniforms]UniformDecl = undefined,
+    uniform_count: usize = 0,
+    samplers: [MaxProgramSamplers]SamplerDecl = undefined,
+    sampler_count: usize = 0,
+    /// Uniform block names; the blocks stay in the body as written
+    buffer_blocks: std.ArrayList([]const u8) = .empty,
+    /// Vertex inputs declared in live code
+    attrs: std.ArrayList(VertexInput) = .empty,
+    /// Identifiers in live code and live #define bodies, the reflected
+    /// declarations themselves aside
+    used: std.StringHashMapUnmanaged(void) = .empty,
+    uses_draw_id: bool = false,
+    uses_frag_color: bool = false,
+    /// Declares its own fragment output (pc_fragColor or a located `out`)
+    has_own_output: bool = false,
+
+    fn uniformDecls(self: *const StageScan) []const UniformDecl {
+        return self.uniforms[0..self.uniform_count];
+    }
+
+    fn samplerDecls(self: *const StageScan) []const SamplerDecl {
+        return self.samplers[0..self.sampler_count];
+    }
+};
+
+/// Walk `source` once, filling `scan`. Scratch and `scan`'s lists come
+/// from `arena`.
+fn scanStage(arena: std.mem.Allocator, source: []const u8, stage: ShaderStage, scan: *StageScan) !void {
+    try scan.body.ensureTotalCapacity(arena, source.len);
+    var scanner = Scanner{ .arena = arena, .source = source, .stage = stage, .scan = scan };
+    try scanner.run();
+}
+
+/// The uniforms of `candidates`, in that order, that `scan` declares and
+/// reads: the stage's share of the program's uniforms.
+fn stageUniforms(scan: *const StageScan, candidates: []const UniformDecl, out: *[MaxProgramUniforms]UniformDecl) []UniformDecl {
+    var count: usize = 0;
+    for (candidates) |u| {
+        if (!hasUniformName(scan.uniformDecls(), u.name)) continue;
+        if (!scan.used.contains(u.name)) continue;
+        out[count] = u;
+        count += 1;
+    }
+    return out[0..count];
+}
+
+/// GLSL 330 header for the body, then the body.
+fn assembleStage(
+    allocator: std.mem.Allocator,
+    out: *std.ArrayList(u8),
     stage: ShaderStage,
-    out: *[MaxTranslatedShaderBytes]u8,
-    out_len: *u32,
-    uniforms: *[MaxProgramUniforms]UniformDecl,
-    uniform_count: *u8,
-    samplers: *[MaxProgramSamplers]SamplerDecl,
-    sampler_count: *u8,
-    block_size: *u32,
-    override_uniforms: ?[]const UniformDecl,
-    emit_filter: ?[]const UniformDecl,
+    scan: *const StageScan,
+    uniforms: []const UniformDecl,
 ) !void {
-    if (source.len > shader.MaxShaderSourceBytes) return error.TooLarge;
-    uniform_count.* = 0;
-    sampler_count.* = 0;
-    block_size.* = 0;
-    const use_override = override_uniforms != null;
-
-    var body_buf: [MaxTranslatedShaderBytes]u8 = undefined;
-    var body_len: usize = 0;
-
-    var it = std.mem.splitScalar(u8, source, '\n');
-    while (it.next()) |line| {
-        if (line.len > MaxShaderLineBytes) return error.LineTooLong;
-        const trimmed = std.mem.trimLeft(u8, line, " \t\r");
-        if (std.mem.startsWith(u8, trimmed, "#version")) continue;
-        if (std.mem.startsWith(u8, trimmed, "precision")) continue;
-
-        if (try parseUniformDecl(trimmed)) |parsed| {
-            switch (parsed) {
-                .block => |decl| {
-                    const count: usize = @intCast(uniform_count.*);
-                    if (count >= MaxProgramUniforms) return error.TooManyUniforms;
-                    if (!use_override) {
-                        if (hasUniformName(uniforms[0..count], decl.name)) continue;
-                        uniforms[count] = decl;
-                        uniform_count.* += 1;
-                    }
-                },
-                .sampler => |decl| {
-                    const count: usize = @intCast(sampler_count.*);
-                    if (count >= MaxProgramSamplers) return error.TooManySamplers;
-                    if (hasSamplerName(samplers[0..count], decl.name)) continue;
-                    samplers[count] = decl;
-                    sampler_count.* += 1;
-                },
+    try out.ensureUnusedCapacity(allocator, scan.body.items.len + 4096);
+    try out.appendSlice(allocator, "#version 330\n");
+    // Blocks without a layout qualifier default to `shared` in GL; WebGL
+    // implementations lay them out as std140, which Three.js assumes
+    if (scan.buffer_blocks.items.len != 0) {
+        try out.appendSlice(allocator, "layout(std140) uniform;\n");
+    }
+    // Three.js shaders declare their own output (pc_fragColor)
+    if (stage == .fragment and scan.uses_frag_color and !scan.has_own_output) {
+        try out.appendSlice(allocator, "out vec4 fragColor;\n");
+    }
+    // Set with direct GL calls, outside the sokol uniform block
+    if (scan.uses_draw_id) {
+        try out.appendSlice(allocator, "uniform int " ++ DrawIdUniform ++ ";\n");
+    }
+    // Loose uniforms rather than a GLSL uniform block: sokol's GL backend
+    // looks each one up with glGetUniformLocation
+    for (uniforms) |u| {
+        try appendUniformDecl(allocator, out, glslType(u.utype), u.name, u.array_count);
+    }
+    for (scan.samplerDecls()) |s| {
+        try appendUniformDecl(allocator, out, samplerGlslType(s.kind), s.name, s.array_count);
+    }
+    var copied: usize = 0;
+    for (scan.attrs.items) |input| {
+        const at = input.insert_at orelse continue;
+        try out.appendSlice(allocator, scan.body.items[copied..at]);
+        try out.print(allocator, "layout(location = {d}) ", .{input.location.?});
+        copied = at;
+    }
+    try out.appendSlice(allocator, scan.body.items[copied..]);
+}
+
+fn appendUniformDecl(allocator: std.mem.Allocator, out: *std.ArrayList(u8), type_name: []const u8, name: []const u8, array_count: u16) !void {
+    if (array_count > 1) {
+        try out.print(allocator, "uniform {s} {s}[{d}];\n", .{ type_name, name, array_count });
+    } else {
+        try out.print(allocator, "uniform {s} {s};\n", .{ type_name, name });
+    }
+}
+
+/// Declarators in one reflected uniform statement (`uniform vec4 a, b;`)
+const MaxUniformDeclarators: usize = 16;
+/// Bound on macros expanding macros while evaluating #if
+const MaxMacroDepth: u8 = 8;
+
+/// A preprocessor macro, as far as #if evaluation needs one.
+const Macro = struct {
+    /// Replacement text, unexpanded
+    body: []const u8,
+    function_like: bool,
+    /// False when the #define (or an #undef of it) sits under a condition
+    /// that could not be evaluated, so whether it is defined is unknown
+    known: bool,
+};
+
+const Truth = enum { no, yes, unknown };
+
+/// One open #if/#ifdef/#ifndef chain.
+const Branch = struct {
+    /// The current branch may be compiled
+    live: bool,
+    /// Whether it is compiled is known
+    certain: bool,
+    /// An earlier branch of the chain was certainly taken
+    taken: bool,
+    /// An earlier branch of the chain may have been taken
+    maybe_taken: bool,
+};
+
+/// The single walk behind scanStage: tokenizes the source, tracks the
+/// preprocessor state and copies the body as it goes.
+const Scanner = struct {
+    arena: std.mem.Allocator,
+    source: []const u8,
+    stage: ShaderStage,
+    scan: *StageScan,
+    pos: usize = 0,
+    /// Only whitespace since the last newline, so `#` opens a directive
+    line_start: bool = true,
+    /// The next token begins a statement
+    statement_start: bool = true,
+    /// Open braces; vertex inputs are declared at 0
+    depth: u32 = 0,
+    /// By name as the GL compiler sees it (after renaming)
+    macros: std.StringHashMapUnmanaged(Macro) = .empty,
+    branches: std.ArrayList(Branch) = .empty,
+
+    fn run(self: *Scanner) !void {
+        const src = self.source;
+        while (self.pos < src.len) {
+            const c = src[self.pos];
+            if (c == '\n') {
+                try self.emit("\n");
+                self.pos += 1;
+                self.line_start = true;
+                continue;
+            }
+            if (c == ' ' or c == '\t' or c == '\r') {
+                const start = self.pos;
+                while (self.pos < src.len and isLineSpace(src[self.pos])) self.pos += 1;
+                try self.emit(src[start..self.pos]);
+                continue;
             }
-            continue;
-        }
-
-        var scratch_a: [MaxShaderLineBytes]u8 = undefined;
-        var scratch_b: [MaxShaderLineBytes]u8 = undefined;
-        var len_a = try replaceWord(line, "texture2D", "texture", scratch_a[0..]);
-        if (stage == .vertex) {
-            const len_b = try replaceWord(scratch_a[0..len_a], "attribute", "in", scratch_b[0..]);
-            len_a = try replaceWord(scratch_b[0..len_b], "varying", "out", scratch_a[0..]);
-        } else {
-            len_a = try replaceWord(scratch_a[0..len_a], "varying", "in", scratch_b[0..]);
-            @memcpy(scratch_a[0..len_a], scratch_b[0..len_a]);
-        }
-        const len_final = try replaceWord(scratch_a[0..len_a], "gl_FragColor", "fragColor", scratch_b[0..]);
-        try appendBytes(body_buf[0..], &body_len, scratch_b[0..len_final]);
-        try appendByte(body_buf[0..], &body_len, '\n');
-    }
-
-    if (use_override) {
-        const list = override_uniforms.?;
-        if (list.len > MaxProgramUniforms) return error.TooManyUniforms;
-        @memcpy(uniforms[0..list.len], list);
-        uniform_count.* = @intCast(list.len);
-    }
-
-    if (uniform_count.* > 0) {
-        const count: usize = @intCast(uniform_count.*);
-        block_size.* = try layoutUniforms(uniforms[0..count]);
-    }
-
-    var header_buf: [MaxTranslatedShaderBytes]u8 = undefined;
-    var header_len: usize = 0;
-    try appendBytes(header_buf[0..], &header_len, "#version 330\n");
-    // Only add fragColor output if the shader uses gl_FragColor AND doesn't already
-    // have its own output declaration (Three.js shaders declare pc_fragColor)
-    const has_gl_frag_color = std.mem.indexOf(u8, source, "gl_FragColor") != null;
-    const has_own_output = std.mem.indexOf(u8, source, "pc_fragColor") != null or
-        std.mem.indexOf(u8, source, "layout(location") != null;
-    const needs_frag_color = stage == .fragment and has_gl_frag_color and !has_own_output;
-    if (needs_frag_color) {
-        try appendBytes(header_buf[0..], &header_len, "out vec4 fragColor;\n");
-    }
-    if (uniform_count.* > 0) {
-        // Emit individual uniform declarations instead of a uniform block.
-        // Sokol's GL backend uses glGetUniformLocation for each uniform,
-        // which doesn't work with GLSL uniform blocks.
-        // Only emit uniforms that pass the filter AND are actually used.
-        const count: usize = @intCast(uniform_count.*);
-        for (uniforms[0..count]) |u| {
-            if (emit_filter) |filter| {
-                if (!hasUniformName(filter, u.name)) continue;
-                if (!isUniformUsedInShader(source, u.name)) continue;
+            if (self.line_start and c == '#') {
+                try self.directive();
+                continue;
             }
-            try appendBytes(header_buf[0..], &header_len, "uniform ");
-            try appendBytes(header_buf[0..], &header_len, glslType(u.utype));
-            try appendBytes(header_buf[0..], &header_len, " ");
-            try appendBytes(header_buf[0..], &header_len, u.name);
-            if (u.array_count > 1) {
-                var buf: [16]u8 = undefined;
-                const len = try std.fmt.bufPrint(&buf, "[{}]", .{u.array_count});
-                try appendBytes(header_buf[0..], &header_len, len);
+            self.line_start = false;
+
+            if (c == '/' and self.pos + 1 < src.len and (src[self.pos + 1] == '/' or src[self.pos + 1] == '*')) {
+                const end = commentEnd(src, self.pos);
+                try self.emit(src[self.pos..end]);
+                self.pos = end;
+            } else if (isIdentStart(c)) {
+                try self.identifier();
+            } else if (isNumberStart(src, self.pos)) {
+                const end = numberEnd(src, self.pos);
+                try self.emit(src[self.pos..end]);
+                self.pos = end;
+                self.statement_start = false;
+            } else {
+                try self.emit(src[self.pos .. self.pos + 1]);
+                self.pos += 1;
+                switch (c) {
+                    '{' => {
+                        self.depth += 1;
+                        self.statement_start = true;
+                    },
+                    '}' => {
+                        self.depth -|= 1;
+                        self.statement_start = true;
+                    },
+                    ';' => self.statement_start = true,
+                    else => self.statement_start = false,
+                }
             }
-            try appendBytes(header_buf[0..], &header_len, ";\n");
         }
     }
 
-    if (sampler_count.* > 0) {
-        const count: usize = @intCast(sampler_count.*);
-        for (samplers[0..count]) |s| {
-            try appendBytes(header_buf[0..], &header_len, "uniform ");
-            try appendBytes(header_buf[0..], &header_len, samplerGlslType(s.kind));
-            try appendBytes(header_buf[0..], &header_len, " ");
-            try appendBytes(header_buf[0..], &header_len, s.name);
-            if (s.array_count > 1) {
-                var buf: [16]u8 = undefined;
-                const len = try std.fmt.bufPrint(&buf, "[{}]", .{s.array_count});
-                try appendBytes(header_buf[0..], &header_len, len);
+    fn identifier(self: *Scanner) !void {
+        const start = self.pos;
+        self.pos = wordEnd(self.source, start);
+        const word = self.source[start..self.pos];
+        const at_statement = self.statement_start;
+        self.statement_start = false;
+
+        if (std.mem.eql(u8, word, "uniform")) {
+            if (try self.uniformDeclaration()) return;
+        } else if (at_statement and std.mem.eql(u8, word, "precision")) {
+            var tokens = Lookahead{ .source = self.source, .pos = self.pos };
+            while (tokens.next()) |tok| {
+                if (tok.is(";")) break;
             }
-            try appendBytes(header_buf[0..], &header_len, ";\n");
-        }
-    }
-
-    var total_len: usize = 0;
-    try appendBytes(out[0..], &total_len, header_buf[0..header_len]);
-    try appendBytes(out[0..], &total_len, body_buf[0..body_len]);
-    if (total_len + 1 > out.len) return error.TooLarge;
-    out[total_len] = 0;
-    out_len.* = @intCast(total_len);
-}
-
-fn parseUniformDecl(line: []const u8) !?UniformParse {
-    if (!std.mem.startsWith(u8, line, "uniform ")) return null;
-    const rest = line["uniform ".len..];
-    var tokens = std.mem.tokenizeAny(u8, rest, " \t");
-    const first = tokens.next() orelse return null;
-    const precision = if (isPrecision(first)) (tokens.next() orelse return null) else first;
-    const type_token = precision;
-    const name_token = tokens.next() orelse return null;
-    const parsed = parseUniformName(name_token) orelse return null;
-    if (parsed.count > MaxUniformArrayCount) return error.UniformArrayTooLarge;
-    if (samplerKindFromGlsl(type_token)) |kind| {
-        return .{ .sampler = .{
-            .name = parsed.name,
-            .kind = kind,
-            .array_count = parsed.count,
-        } };
-    }
-    const utype = uniformTypeFromGlsl(type_token) orelse return null;
-    return .{ .block = .{
-        .name = parsed.name,
-        .utype = utype,
-        .array_count = parsed.count,
-        .offset = 0,
-        .stride = 0,
-        .size = 0,
-    } };
-}
+            self.dropStatement(tokens.pos);
+            return;
+        } else if (at_statement and self.stage == .vertex and self.depth == 0 and self.live() and
+            (std.mem.eql(u8, word, "in") or std.mem.eql(u8, word, "attribute") or std.mem.eql(u8, word, "layout")))
+        {
+            if (try self.vertexInputs(start)) return;
+        }
+        if (self.stage == .fragment and std.mem.eql(u8, word, "layout")) {
+            var tokens = Lookahead{ .source = self.source, .pos = self.pos };
+            if (tokens.nextIs("(") and tokens.nextIs("location")) self.scan.has_own_output = true;
+        }
 
-const UniformName = struct {
-    name: []const u8,
-    count: u16,
-};
+        self.noteWord(word);
+        if (self.live()) try self.scan.used.put(self.arena, word, {});
+        try self.emit(self.rename(word));
+    }
+
+    /// At `uniform`: reflect a loose uniform or sampler declaration and
+    /// drop it from the body, or note a uniform block's name. False when
+    /// the statement stays in the body as written: blocks, struct-typed
+    /// uniforms, samplers the shim does not bind, initializers and arrays
+    /// sized by macros.
+    fn uniformDeclaration(self: *Scanner) !bool {
+        var tokens = Lookahead{ .source = self.source, .pos = self.pos };
+        var type_tok = tokens.next() orelse return false;
+        if (type_tok.kind == .identifier and isPrecision(type_tok.text)) {
+            type_tok = tokens.next() orelse return false;
+        }
+        if (type_tok.kind != .identifier) return false;
+        const sampler_kind = samplerKindFromGlsl(type_tok.text);
+        const utype = uniformTypeFromGlsl(type_tok.text);
+        if (sampler_kind == null and utype == null) {
+            if (self.live() and tokens.nextIs("{")) try self.scan.buffer_blocks.append(self.arena, type_tok.text);
+            return false;
+        }
 
-fn parseUniformName(token: []const u8) ?UniformName {
-    var name = std.mem.trimRight(u8, token, " \t\r;");
-    var count: u16 = 1;
-    if (std.mem.indexOfScalar(u8, name, '[')) |idx| {
-        const end = std.mem.indexOfScalar(u8, name, ']') orelse return null;
-        const num_slice = name[idx + 1 .. end];
-        const parsed = std.fmt.parseInt(u16, num_slice, 10) catch return null;
-        count = parsed;
-        name = name[0..idx];
-    }
-    if (name.len == 0) return null;
-    return .{ .name = name, .count = count };
-}
+        var names: [MaxUniformDeclarators]UniformName = undefined;
+        var count: usize = 0;
+        while (true) {
+            const name = tokens.next() orelse return false;
+            if (name.kind != .identifier or count == names.len) return false;
+            var array_count: u16 = 1;
+            var separator = tokens.next() orelse return false;
+            if (separator.is("[")) {
+                const size = tokens.next() orelse return false;
+                if (size.kind != .number) return false;
+                array_count = std.fmt.parseInt(u16, size.text, 0) catch return false;
+                if (!tokens.nextIs("]")) return false;
+                separator = tokens.next() orelse return false;
+            }
+            if (array_count == 0) return false;
+            if (array_count > MaxUniformArrayCount) return error.UniformArrayTooLarge;
+            names[count] = .{ .name = name.text, .count = array_count };
+            count += 1;
+            if (separator.is(";")) break;
+            if (!separator.is(",")) return false;
+        }
 
-fn hasUniformName(uniforms: []const UniformDecl, name: []const u8) bool {
-    for (uniforms) |u| {
-        if (u.name.len == 0) continue;
-        if (std.mem.eql(u8, u.name, name)) return true;
+        const scan = self.scan;
+        for (names[0..count]) |decl| {
+            if (sampler_kind) |kind| {
+                if (hasSamplerName(scan.samplerDecls(), decl.name)) continue;
+                if (scan.sampler_count >= MaxProgramSamplers) return error.TooManySamplers;
+                scan.samplers[scan.sampler_count] = .{ .name = decl.name, .kind = kind, .array_count = decl.count };
+                scan.sampler_count += 1;
+            } else {
+                if (hasUniformName(scan.uniformDecls(), decl.name)) continue;
+                if (scan.uniform_count >= MaxProgramUniforms) return error.TooManyUniforms;
+                scan.uniforms[scan.uniform_count] = .{
+                    .name = decl.name,
+                    .utype = utype.?,
+                    .array_count = decl.count,
+                    .offset = 0,
+                    .stride = 0,
+                    .size = 0,
+                };
+                scan.uniform_count += 1;
+            }
+        }
+        self.dropStatement(tokens.pos);
+        return true;
     }
-    return false;
-}
 
-/// Check if a uniform name is actually used in the shader body (not just declared).
-/// Uses preprocessor-aware scanning to skip code inside false #ifdef/#ifndef blocks.
-fn isUniformUsedInShader(source: []const u8, name: []const u8) bool {
-    if (name.len == 0) return false;
-
-    // Simple preprocessor state
-    const MaxDefines: usize = 32;
-    const MaxIfdefDepth: usize = 16;
-    var defines: [MaxDefines][MaxAttrNameBytes]u8 = undefined;
-    var define_lens: [MaxDefines]u8 = undefined;
-    @memset(&define_lens, 0);
-    var define_count: usize = 0;
-    var ifdef_stack: [MaxIfdefDepth]bool = undefined;
-    var ifdef_depth: usize = 0;
-
-    var it = std.mem.splitScalar(u8, source, '\n');
-    while (it.next()) |line| {
-        const trimmed = std.mem.trimLeft(u8, line, " \t\r");
-
-        // Handle preprocessor directives
-        if (std.mem.startsWith(u8, trimmed, "#define ")) {
-            if (ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1]) {
-                const rest = trimmed["#define ".len..];
-                var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-                if (tokens.next()) |def_name| {
-                    if (define_count < MaxDefines and def_name.len < MaxAttrNameBytes) {
-                        @memcpy(defines[define_count][0..def_name.len], def_name);
-                        define_lens[define_count] = @intCast(def_name.len);
-                        define_count += 1;
-                    }
-                }
+    /// At the first word of a file-scope statement in a vertex shader:
+    /// record the inputs it declares if it is `[layout(...)] in|attribute
+    /// [precision] type name[, name...];`. A declaration without a
+    /// location is replaced by one `in type name;` per input, which
+    /// assembleStage gives a location; true then.
+    fn vertexInputs(self: *Scanner, start: usize) !bool {
+        var tokens = Lookahead{ .source = self.source, .pos = start };
+        var tok = tokens.next() orelse return false;
+        var location: ?u8 = null;
+        if (tok.is("layout")) {
+            if (!tokens.nextIs("(")) return false;
+            while (tokens.next()) |qualifier| {
+                if (qualifier.is(")")) break;
+                if (!qualifier.is("location") or !tokens.nextIs("=")) continue;
+                const value = tokens.next() orelse return false;
+                location = std.fmt.parseInt(u8, value.text, 0) catch return false;
             }
-            continue;
-        }
-
-        if (std.mem.startsWith(u8, trimmed, "#ifdef ")) {
-            const rest = trimmed["#ifdef ".len..];
-            var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-            const def_name = tokens.next() orelse "";
-            const defined = isDefined(defines[0..define_count], define_lens[0..define_count], def_name);
-            const parent_active = ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1];
-            if (ifdef_depth < MaxIfdefDepth) {
-                ifdef_stack[ifdef_depth] = parent_active and defined;
-                ifdef_depth += 1;
+            tok = tokens.next() orelse return false;
+        }
+        if (!tok.is("in") and !tok.is("attribute")) return false;
+        tok = tokens.next() orelse return false;
+        var precision: []const u8 = "";
+        if (tok.kind == .identifier and isPrecision(tok.text)) {
+            precision = tok.text;
+            tok = tokens.next() orelse return false;
+        }
+        if (tok.kind != .identifier) return false;
+        const type_name = tok.text;
+        const columns = attribColumns(type_name);
+        const first = self.scan.attrs.items.len;
+        while (tokens.next()) |name| {
+            if (name.kind != .identifier) return false;
+            // Later declarators of a located list follow the first
+            const count = self.scan.attrs.items.len - first;
+            try self.scan.attrs.append(self.arena, .{
+                .name = name.text,
+                .utype = uniformTypeFromGlsl(type_name) orelse .INVALID,
+                .columns = columns,
+                .location = if (location) |loc| std.math.cast(u8, loc + count * columns) orelse return false else null,
+            });
+            var separator = tokens.next() orelse return false;
+            if (separator.is("[")) {
+                while (tokens.next()) |size| {
+                    if (size.is("]")) break;
+                }
+                separator = tokens.next() orelse return false;
             }
-            continue;
-        }
-
-        if (std.mem.startsWith(u8, trimmed, "#ifndef ")) {
-            const rest = trimmed["#ifndef ".len..];
-            var tokens = std.mem.tokenizeAny(u8, rest, " \t\r\n");
-            const def_name = tokens.next() orelse "";
-            const defined = isDefined(defines[0..define_count], define_lens[0..define_count], def_name);
-            const parent_active = ifdef_depth == 0 or ifdef_stack[ifdef_depth - 1];
-            if (ifdef_depth < MaxIfdefDepth) {
-                ifdef_stack[ifdef_depth] = parent_active and !defined;
-                ifdef_depth += 1;
+            if (separator.is(";")) break;
+            if (!separator.is(",")) return false;
+        } else return false;
+        if (location != null) return false;
+
+        self.dropStatement(tokens.pos);
+        for (self.scan.attrs.items[first..]) |*input| {
+            input.insert_at = self.scan.body.items.len;
+            try self.emit("in ");
+            if (precision.len > 0) {
+                try self.emit(precision);
+                try self.emit(" ");
             }
-            continue;
+            try self.emit(type_name);
+            try self.emit(" ");
+            try self.emit(self.rename(input.name));
+            try self.emit(";\n");
         }
+        return true;
+    }
 
-        if (std.mem.startsWith(u8, trimmed, "#else")) {
-            if (ifdef_depth > 0) {
-                const parent_active = ifdef_depth <= 1 or ifdef_stack[ifdef_depth - 2];
-                ifdef_stack[ifdef_depth - 1] = parent_active and !ifdef_stack[ifdef_depth - 1];
+    /// Remove a statement ending at `end` from the body. One alone on its
+    /// line takes the line with it.
+    fn dropStatement(self: *Scanner, end: usize) void {
+        self.pos = end;
+        self.statement_start = true;
+        const body = &self.scan.body;
+        const line_begin = if (std.mem.lastIndexOfScalar(u8, body.items, '\n')) |idx| idx + 1 else 0;
+        for (body.items[line_begin..]) |c| {
+            if (!isLineSpace(c)) return;
+        }
+        var rest = end;
+        while (rest < self.source.len and isLineSpace(self.source[rest])) rest += 1;
+        if (rest < self.source.len and self.source[rest] != '\n') return;
+        body.shrinkRetainingCapacity(line_begin);
+        self.pos = @min(rest + 1, self.source.len);
+        self.line_start = true;
+    }
+
+    /// A preprocessor line at `pos`. Conditionals and macros update the
+    /// state; every directive but #version is copied to the body.
+    fn directive(self: *Scanner) !void {
+        const src = self.source;
+        const start = self.pos;
+        var end = start;
+        while (end < src.len and src[end] != '\n') : (end += 1) {
+            // A backslash continues the directive on the next line
+            if (src[end] == '\\' and end + 1 < src.len and src[end + 1] == '\n') end += 1;
+        }
+        const next_line = if (end < src.len) end + 1 else end;
+        self.pos = next_line;
+        self.line_start = true;
+
+        var tokens = Lookahead{ .source = src[0..end], .pos = start + 1 };
+        const name = tokens.next() orelse return self.emitDirective(start, next_line);
+        if (name.is("version")) return;
+        if (name.is("extension")) {
+            if (tokens.nextIs("GL_ANGLE_multi_draw")) {
+                // The extension is built in; keep its macro so #ifdef
+                // branches choose as they would in WebGL
+                try self.emit("#define GL_ANGLE_multi_draw 1\n");
+                try self.define("GL_ANGLE_multi_draw", "1", false);
+                return;
             }
-            continue;
+        } else if (name.is("define")) {
+            try self.defineDirective(&tokens);
+        } else if (name.is("undef")) {
+            if (tokens.next()) |macro| self.undefine(macro.text);
+        } else if (name.is("ifdef") or name.is("ifndef")) {
+            var truth: Truth = if (tokens.next()) |macro| self.definedState(macro.text) else .unknown;
+            if (name.is("ifndef")) truth = switch (truth) {
+                .no => .yes,
+                .yes => .no,
+                .unknown => .unknown,
+            };
+            try self.pushBranch(truth);
+        } else if (name.is("if")) {
+            try self.pushBranch(self.evaluate(tokens));
+        } else if (name.is("elif")) {
+            self.nextBranch(self.evaluate(tokens));
+        } else if (name.is("else")) {
+            self.nextBranch(.yes);
+        } else if (name.is("endif")) {
+            _ = self.branches.pop();
         }
+        try self.emitDirective(start, next_line);
+    }
 
-        if (std.mem.startsWith(u8, trimmed, "#endif")) {
-            if (ifdef_depth > 0) {
-                ifdef_depth -= 1;
+    /// Copy `source[start..end]` with identifiers renamed.
+    fn emitDirective(self: *Scanner, start: usize, end: usize) !void {
+        const src = self.source;
+        var copied = start;
+        var pos = start;
+        while (pos < end) {
+            if (!isIdentStart(src[pos]) or (pos > start and isWordChar(src[pos - 1]))) {
+                pos += 1;
+                continue;
             }
-            continue;
-        }
-
-        // Skip if inside an inactive preprocessor block
-        if (ifdef_depth > 0 and !ifdef_stack[ifdef_depth - 1]) continue;
-
-        // Skip uniform declarations and other preprocessor directives
-        if (std.mem.startsWith(u8, trimmed, "uniform ")) continue;
-        if (std.mem.startsWith(u8, trimmed, "#")) continue;
-        if (std.mem.startsWith(u8, trimmed, "precision ")) continue;
-
-        // Search for the name as a word in this line
-        var pos: usize = 0;
-        while (pos < line.len) {
-            if (std.mem.indexOfPos(u8, line, pos, name)) |idx| {
-                const start_ok = idx == 0 or !isWordChar(line[idx - 1]);
-                const end_idx = idx + name.len;
-                const end_ok = end_idx >= line.len or !isWordChar(line[end_idx]);
-                if (start_ok and end_ok) return true;
-                pos = idx + 1;
-            } else {
-                break;
+            const word_end = wordEnd(src, pos);
+            const word = src[pos..word_end];
+            self.noteWord(word);
+            const renamed = self.rename(word);
+            if (renamed.ptr != word.ptr) {
+                try self.emit(src[copied..pos]);
+                try self.emit(renamed);
+                copied = word_end;
             }
+            pos = word_end;
+        }
+        try self.emit(src[copied..end]);
+    }
+
+    fn defineDirective(self: *Scanner, tokens: *Lookahead) !void {
+        if (!self.live()) return;
+        const name = tokens.next() orelse return;
+        if (name.kind != .identifier) return;
+        const src = tokens.source;
+        // `NAME(` with no space is a function-like macro
+        const function_like = tokens.pos < src.len and src[tokens.pos] == '(';
+        try self.define(self.rename(name.text), std.mem.trim(u8, src[tokens.pos..], " \t\r"), function_like);
+        // A uniform named in a macro is read wherever the macro expands
+        var words = tokens.*;
+        while (words.next()) |tok| {
+            if (tok.kind == .identifier) try self.scan.used.put(self.arena, tok.text, {});
         }
     }
-    return false;
-}
 
-fn hasSamplerName(samplers: []const SamplerDecl, name: []const u8) bool {
-    for (samplers) |s| {
-        if (s.name.len == 0) continue;
-        if (std.mem.eql(u8, s.name, name)) return true;
+    fn define(self: *Scanner, name: []const u8, body: []const u8, function_like: bool) !void {
+        if (!self.live()) return;
+        try self.macros.put(self.arena, name, .{ .body = body, .function_like = function_like, .known = self.certain() });
     }
-    return false;
-}
 
-fn isPrecision(token: []const u8) bool {
-    return std.mem.eql(u8, token, "lowp") or std.mem.eql(u8, token, "mediump") or std.mem.eql(u8, token, "highp");
-}
+    fn undefine(self: *Scanner, name: []const u8) void {
+        if (!self.live()) return;
+        const renamed = self.rename(name);
+        if (self.certain()) {
+            _ = self.macros.remove(renamed);
+        } else if (self.macros.getPtr(renamed)) |macro| {
+            macro.known = false;
+        }
+    }
 
-fn uniformTypeFromGlsl(token: []const u8) ?UniformType {
-    if (std.mem.eql(u8, token, "float")) return .FLOAT;
-    if (std.mem.eql(u8, token, "vec2")) return .FLOAT2;
-    if (std.mem.eql(u8, token, "vec3")) return .FLOAT3;
-    if (std.mem.eql(u8, token, "vec4")) return .FLOAT4;
-    if (std.mem.eql(u8, token, "int")) return .INT;
-    if (std.mem.eql(u8, token, "ivec2")) return .INT2;
-    if (std.mem.eql(u8, token, "ivec3")) return .INT3;
-    if (std.mem.eql(u8, token, "ivec4")) return .INT4;
-    if (std.mem.eql(u8, token, "mat2")) return .MAT2;
-    if (std.mem.eql(u8, token, "mat3")) return .MAT3;
-    if (std.mem.eql(u8, token, "mat4")) return .MAT4;
-    return null;
-}
+    fn definedState(self: *const Scanner, name: []const u8) Truth {
+        const macro = self.macros.get(self.rename(name)) orelse
+            return if (isPredefinedName(name)) .unknown else .no;
+        return if (macro.known) .yes else .unknown;
+    }
 
-fn samplerKindFromGlsl(token: []const u8) ?SamplerKind {
-    if (std.mem.eql(u8, token, "sampler2D")) return .sampler2d;
-    if (std.mem.eql(u8, token, "samplerCube")) return .samplerCube;
-    return null;
-}
+    /// Value of a #if/#elif condition
+    fn evaluate(self: *Scanner, tokens: Lookahead) Truth {
+        var condition = Condition{ .scanner = self, .tokens = tokens };
+        const value = condition.value() orelse return .unknown;
+        return if (value != 0) .yes else .no;
+    }
 
-fn glslType(utype: UniformType) []const u8 {
-    return switch (utype) {
-        .FLOAT => "float",
-        .FLOAT2 => "vec2",
-        .FLOAT3 => "vec3",
-        .FLOAT4 => "vec4",
-        .INT => "int",
-        .INT2 => "ivec2",
-        .INT3 => "ivec3",
-        .INT4 => "ivec4",
-        .MAT2 => "mat2",
-        .MAT3 => "mat3",
-        .MAT4 => "mat4",
-        .INVALID => "float",
-    };
-}
+    /// Integer value of a macro in a #if; null when unknown.
+    fn macroValue(self: *Scanner, name: []const u8, depth: u8) ?i64 {
+        // Identifiers that name no macro are 0, as in C
+        const macro = self.macros.get(self.rename(name)) orelse
+            return if (isPredefinedName(name)) null else 0;
+        if (!macro.known or macro.function_like or depth >= MaxMacroDepth) return null;
+        var condition = Condition{
+            .scanner = self,
+            .tokens = .{ .source = macro.body, .pos = 0 },
+            .depth = depth + 1,
+        };
+        return condition.value();
+    }
 
-fn samplerGlslType(kind: SamplerKind) []const u8 {
-    return switch (kind) {
-        .sampler2d => "sampler2D",
-        .samplerCube => "samplerCube",
-    };
-}
+    fn live(self: *const Scanner) bool {
+        const items = self.branches.items;
+        return items.len == 0 or items[items.len - 1].live;
+    }
 
-fn layoutUniforms(uniforms: []UniformDecl) !u32 {
-    var offset: u32 = 0;
-    for (uniforms) |*u| {
-        const elem_count: u32 = if (u.array_count == 0) 1 else u.array_count;
-        if (elem_count > MaxUniformArrayCount) return error.UniformArrayTooLarge;
-        if (u.array_count > 1) {
-            // In std140, arrays of smaller types are padded to vec4 alignment
-            // Only allow types that are vec4-sized or matrix types for arrays
-            if (u.utype != .FLOAT4 and u.utype != .INT4 and
-                u.utype != .MAT2 and u.utype != .MAT3 and u.utype != .MAT4)
+    fn certain(self: *const Scanner) bool {
+        const items = self.branches.items;
+        return items.len == 0 or items[items.len - 1].certain;
+    }
+
+    fn pushBranch(self: *Scanner, truth: Truth) !void {
+        try self.branches.append(self.arena, .{ .live = false, .certain = true, .taken = false, .maybe_taken = false });
+        self.enterBranch(truth);
+    }
+
+    /// #elif and #else: the next branch of the innermost chain.
+    fn nextBranch(self: *Scanner, truth: Truth) void {
+        const items = self.branches.items;
+        if (items.len == 0) return;
+        const top = items[items.len - 1];
+        const effective: Truth = if (top.taken)
+            .no
+        else if (top.maybe_taken and truth != .no)
+            .unknown
+        else
+            truth;
+        self.enterBranch(effective);
+    }
+
+    fn enterBranch(self: *Scanner, truth: Truth) void {
+        const items = self.branches.items;
+        const parent_live = items.len < 2 or items[items.len - 2].live;
+        const parent_certain = items.len < 2 or items[items.len - 2].certain;
+        const top = &items[items.len - 1];
+        top.live = parent_live and truth != .no;
+        top.certain = !top.live or (parent_certain and truth != .unknown);
+        top.taken = top.taken or truth == .yes;
+        top.maybe_taken = top.maybe_taken or truth != .no;
+    }
+
+    fn noteWord(self: *Scanner, word: []const u8) void {
+        if (std.mem.eql(u8, word, "gl_DrawID")) {
+            self.scan.uses_draw_id = true;
+        } else if (std.mem.eql(u8, word, "gl_FragColor")) {
+            self.scan.uses_frag_color = true;
+        } else if (std.mem.eql(u8, word, "pc_fragColor")) {
+            self.scan.has_own_output = true;
+        }
+    }
+
+    /// GLSL ES words with a different GLSL 330 spelling
+    fn rename(self: *const Scanner, word: []const u8) []const u8 {
+        if (std.mem.eql(u8, word, "texture2D")) return "texture";
+        if (std.mem.eql(u8, word, "gl_FragColor")) return "fragColor";
+        if (std.mem.eql(u8, word, "gl_DrawID")) return DrawIdUniform;
+        if (std.mem.eql(u8, word, "varying")) return if (self.stage == .vertex) "out" else "in";
+        if (self.stage == .vertex and std.mem.eql(u8, word, "attribute")) return "in";
+        return word;
+    }
+
+    fn emit(self: *Scanner, bytes: []const u8) !void {
+        try self.scan.body.appendSlice(self.arena, bytes);
+    }
+};
+
+const Token = struct {
+    kind: Kind,
+    text: []const u8,
+
+    const Kind = enum { identifier, number, punct };
+
+    fn is(self: Token, text: []const u8) bool {
+        return std.mem.eql(u8, self.text, text);
+    }
+};
+
+/// Tokens from `pos`, skipping whitespace, comments and line
+/// continuations. A copy looks ahead without moving the original.
+const Lookahead = struct {
+    source: []const u8,
+    pos: usize,
+
+    const two_byte_operators = [_][]const u8{ "||", "&&", "==", "!=", "<=", ">=", "<<", ">>" };
+
+    fn next(self: *Lookahead) ?Token {
+        self.skipSpace();
+        const src = self.source;
+        if (self.pos >= src.len) return null;
+        const start = self.pos;
+        if (isIdentStart(src[start])) {
+            self.pos = wordEnd(src, start);
+            return .{ .kind = .identifier, .text = src[start..self.pos] };
+        }
+        if (isNumberStart(src, start)) {
+            self.pos = numberEnd(src, start);
+            return .{ .kind = .number, .text = src[start..self.pos] };
+        }
+        if (start + 2 <= src.len) {
+            for (two_byte_operators) |op| {
+                if (std.mem.eql(u8, src[start .. start + 2], op)) {
+                    self.pos = start + 2;
+                    return .{ .kind = .punct, .text = src[start..self.pos] };
+                }
+            }
+        }
+        self.pos = start + 1;
+        return .{ .kind = .punct, .text = src[start..self.pos] };
+    }
+
+    fn peek(self: *const Lookahead) ?Token {
+        var copy = self.*;
+        return copy.next();
+    }
+
+    /// Consume the next token if it is `text`.
+    fn nextIs(self: *Lookahead, text: []const u8) bool {
+        var copy = self.*;
+        const tok = copy.next() orelse return false;
+        if (!tok.is(text)) return false;
+        self.* = copy;
+        return true;
+    }
+
+    /// Consume a parenthesized group.
+    fn skipGroup(self: *Lookahead) bool {
+        if (!self.nextIs("(")) return false;
+        var depth: usize = 1;
+        while (self.next()) |tok| {
+            if (tok.is("(")) depth += 1;
+            if (tok.is(")")) {
+                depth -= 1;
+                if (depth == 0) return true;
+            }
+        }
+        return false;
+    }
+
+    fn skipSpace(self: *Lookahead) void {
+        const src = self.source;
+        while (self.pos < src.len) {
+            const c = src[self.pos];
+            if (isLineSpace(c) or c == '\n' or c == '\\') {
+                self.pos += 1;
+            } else if (c == '/' and self.pos + 1 < src.len and (src[self.pos + 1] == '/' or src[self.pos + 1] == '*')) {
+                self.pos = commentEnd(src, self.pos);
+            } else {
+                return;
+            }
+        }
+    }
+};
+
+/// #if expression: C preprocessor integer arithmetic and `defined`. A
+/// null value is unknown.
+const Condition = struct {
+    scanner: *Scanner,
+    tokens: Lookahead,
+    /// Macro expansion depth
+    depth: u8 = 0,
+    failed: bool = false,
+
+    /// The whole expression, null if it is unknown or malformed.
+    fn value(self: *Condition) ?i64 {
+        const result = self.expression(0);
+        if (self.failed or self.tokens.next() != null) return null;
+        return result;
+    }
+
+    fn expression(self: *Condition, min_precedence: u8) ?i64 {
+        var lhs = self.unary();
+        while (self.tokens.peek()) |op| {
+            const precedence = binaryPrecedence(op) orelse break;
+            if (precedence < min_precedence) break;
+            _ = self.tokens.next();
+            const rhs = self.expression(precedence + 1);
+            lhs = applyBinary(op.text, lhs, rhs);
+        }
+        return lhs;
+    }
+
+    fn unary(self: *Condition) ?i64 {
+        const tok = self.tokens.next() orelse return self.fail();
+        switch (tok.kind) {
+            .number => return parseIntLiteral(tok.text),
+            .identifier => {
+                if (tok.is("defined")) return self.definedOperand();
+                return self.scanner.macroValue(tok.text, self.depth);
+            },
+            .punct => {
+                if (tok.is("(")) {
+                    const inner = self.expression(0);
+                    if (!self.tokens.nextIs(")")) return self.fail();
+                    return inner;
+                }
+                if (!tok.is("!") and !tok.is("-") and !tok.is("+") and !tok.is("~")) return self.fail();
+                const operand = self.unary() orelse return null;
+                if (tok.is("!")) return @intFromBool(operand == 0);
+                if (tok.is("-")) return -%operand;
+                if (tok.is("~")) return ~operand;
+                return operand;
+            },
+        }
+    }
+
+    fn definedOperand(self: *Condition) ?i64 {
+        const paren = self.tokens.nextIs("(");
+        const name = self.tokens.next() orelse return self.fail();
+        if (name.kind != .identifier) return self.fail();
+        if (paren and !self.tokens.nextIs(")")) return self.fail();
+        return switch (self.scanner.definedState(name.text)) {
+            .no => 0,
+            .yes => 1,
+            .unknown => null,
+        };
+    }
+
+    fn fail(self: *Condition) ?i64 {
+        self.failed = true;
+        return null;
+    }
+};
+
+fn binaryPrecedence(tok: Token) ?u8 {
+    if (tok.kind != .punct) return null;
+    const operators = [_]struct { []const u8, u8 }{
+        .{ "||", 1 }, .{ "&&", 2 }, .{ "|", 3 },  .{ "^", 4 },  .{ "&", 5 },  .{ "==", 6 },
+        .{ "!=", 6 }, .{ "<", 7 },  .{ ">", 7 },  .{ "<=", 7 }, .{ ">=", 7 }, .{ "<<", 8 },
+        .{ ">>", 8 }, .{ "+", 9 },  .{ "-", 9 },  .{ "*", 10 }, .{ "/", 10 }, .{ "%", 10 },
+    };
+    for (operators) |entry| {
+        if (tok.is(entry[0])) return entry[1];
+    }
+    return null;
+}
+
+fn applyBinary(op: []const u8, lhs: ?i64, rhs: ?i64) ?i64 {
+    const eql = std.mem.eql;
+    // One known side can settle a logical operator
+    if (eql(u8, op, "||")) {
+        if ((lhs orelse 0) != 0 or (rhs orelse 0) != 0) return 1;
+        if (lhs == null or rhs == null) return null;
+        return 0;
+    }
+    if (eql(u8, op, "&&")) {
+        if ((lhs orelse 1) == 0 or (rhs orelse 1) == 0) return 0;
+        if (lhs == null or rhs == null) return null;
+        return 1;
+    }
+    const a = lhs orelse return null;
+    const b = rhs orelse return null;
+    if (eql(u8, op, "|")) return a | b;
+    if (eql(u8, op, "^")) return a ^ b;
+    if (eql(u8, op, "&")) return a & b;
+    if (eql(u8, op, "==")) return @intFromBool(a == b);
+    if (eql(u8, op, "!=")) return @intFromBool(a != b);
+    if (eql(u8, op, "<")) return @intFromBool(a < b);
+    if (eql(u8, op, ">")) return @intFromBool(a > b);
+    if (eql(u8, op, "<=")) return @intFromBool(a <= b);
+    if (eql(u8, op, ">=")) return @intFromBool(a >= b);
+    if (eql(u8, op, "+")) return a +% b;
+    if (eql(u8, op, "-")) return a -% b;
+    if (eql(u8, op, "*")) return a *% b;
+    if (eql(u8, op, "<<") or eql(u8, op, ">>")) {
+        if (b < 0 or b > 63) return null;
+        const shift: u6 = @intCast(b);
+        return if (op[0] == '<') std.math.shl(i64, a, shift) else std.math.shr(i64, a, shift);
+    }
+    // Division by zero is an error in GLSL; leave it to the compiler
+    if (b == 0 or (a == std.math.minInt(i64) and b == -1)) return null;
+    if (eql(u8, op, "/")) return @divTrunc(a, b);
+    return @rem(a, b);
+}
+
+/// Decimal, hex or octal integer with an optional `u` suffix; null for
+/// anything else (float literals are errors in #if).
+fn parseIntLiteral(text: []const u8) ?i64 {
+    const digits = std.mem.trimRight(u8, text, "uU");
+    if (digits.len > 1 and digits[0] == '0' and std.ascii.isDigit(digits[1])) {
+        return std.fmt.parseInt(i64, digits[1..], 8) catch null;
+    }
+    return std.fmt.parseInt(i64, digits, 0) catch null;
+}
+
+fn hasUniformName(uniforms: []const UniformDecl, name: []const u8) bool {
+    for (uniforms) |u| {
+        if (u.name.len == 0) continue;
+        if (std.mem.eql(u8, u.name, name)) return true;
+    }
+    return false;
+}
+
+/// Append the stage's uniform blocks to `prog`, skipping blocks another
+/// stage already declared.
+fn collectBufferBlocks(prog: *Program, names: []const []const u8) !void {
+    outer: for (names) |name| {
+        for (prog.bufferBlocks()) |*block| {
+            if (std.mem.eql(u8, block.name(), name)) continue :outer;
+        }
+        if (prog.buffer_block_count >= MaxUniformBufferBlocks) return error.TooManyUniformBlocks;
+        if (name.len >= MaxUniformNameBytes) return error.UniformNameTooLong;
+        const block = &prog.buffer_blocks[@as(usize, prog.buffer_block_count)];
+        block.* = .{ .name_len = @intCast(name.len), .name_bytes = undefined, .binding = 0 };
+        @memset(&block.name_bytes, 0);
+        @memcpy(block.name_bytes[0..name.len], name);
+        prog.buffer_block_count += 1;
+    }
+}
+
+fn hasSamplerName(samplers: []const SamplerDecl, name: []const u8) bool {
+    for (samplers) |s| {
+        if (s.name.len == 0) continue;
+        if (std.mem.eql(u8, s.name, name)) return true;
+    }
+    return false;
+}
+
+fn isPrecision(token: []const u8) bool {
+    return std.mem.eql(u8, token, "lowp") or std.mem.eql(u8, token, "mediump") or std.mem.eql(u8, token, "highp");
+}
+
+fn uniformTypeFromGlsl(token: []const u8) ?UniformType {
+    if (std.mem.eql(u8, token, "float")) return .FLOAT;
+    if (std.mem.eql(u8, token, "vec2")) return .FLOAT2;
+    if (std.mem.eql(u8, token, "vec3")) return .FLOAT3;
+    if (std.mem.eql(u8, token, "vec4")) return .FLOAT4;
+    if (std.mem.eql(u8, token, "int")) return .INT;
+    if (std.mem.eql(u8, token, "ivec2")) return .INT2;
+    if (std.mem.eql(u8, token, "ivec3")) return .INT3;
+    if (std.mem.eql(u8, token, "ivec4")) return .INT4;
+    if (std.mem.eql(u8, token, "mat2")) return .MAT2;
+    if (std.mem.eql(u8, token, "mat3")) return .MAT3;
+    if (std.mem.eql(u8, token, "mat4")) return .MAT4;
+    return null;
+}
+
+fn samplerKindFromGlsl(token: []const u8) ?SamplerKind {
+    if (std.mem.eql(u8, token, "sampler2D")) return .sampler2d;
+    if (std.mem.eql(u8, token, "samplerCube")) return .samplerCube;
+    if (std.mem.eql(u8, token, "sampler2DShadow")) return .sampler2dShadow;
+    return null;
+}
+
+fn glslType(utype: UniformType) []const u8 {
+    return switch (utype) {
+        .FLOAT => "float",
+        .FLOAT2 => "vec2",
+        .FLOAT3 => "vec3",
+        .FLOAT4 => "vec4",
+        .INT => "int",
+        .INT2 => "ivec2",
+        .INT3 => "ivec3",
+        .INT4 => "ivec4",
+        .MAT2 => "mat2",
+        .MAT3 => "mat3",
+        .MAT4 => "mat4",
+        .INVALID => "float",
+    };
+}
+
+fn samplerGlslType(kind: SamplerKind) []const u8 {
+    return switch (kind) {
+        .sampler2d => "sampler2D",
+        .samplerCube => "samplerCube",
+        .sampler2dShadow => "sampler2DShadow",
+    };
+}
+
+fn layoutUniforms(uniforms: []UniformDecl) !u32 {
+    var offset: u32 = 0;
+    for (uniforms) |*u| {
+        const elem_count: u32 = if (u.array_count == 0) 1 else u.array_count;
+        if (elem_count > MaxUniformArrayCount) return error.UniformArrayTooLarge;
+        if (u.array_count > 1) {
+            // In std140, arrays of smaller types are padded to vec4 alignment
+            // Only allow types that are vec4-sized or matrix types for arrays
+            if (u.utype != .FLOAT4 and u.utype != .INT4 and
+                u.utype != .MAT2 and u.utype != .MAT3 and u.utype != .MAT4)
             {
                 return error.UnsupportedArrayType;
             }
@@ -1803,73 +2877,209 @@ fn alignUp(value: u32, alignment: u32) u32 {
     return (value + alignment - 1) & ~(alignment - 1);
 }
 
-fn isDefined(defines: [][MaxAttrNameBytes]u8, define_lens: []u8, name: []const u8) bool {
-    for (defines, 0..) |def, idx| {
-        const len = define_lens[idx];
-        if (len == 0) continue;
-        if (std.mem.eql(u8, def[0..len], name)) return true;
-    }
-    return false;
+fn isWordChar(ch: u8) bool {
+    return (ch >= 'a' and ch <= 'z') or
+        (ch >= 'A' and ch <= 'Z') or
+        (ch >= '0' and ch <= '9') or
+        ch == '_';
 }
 
-fn extractAttrDecl(line: []const u8) ?[]const u8 {
-    if (std.mem.startsWith(u8, line, "attribute ")) {
-        return line["attribute ".len..];
-    }
-    if (std.mem.startsWith(u8, line, "in ")) {
-        return line["in ".len..];
+/// Names the GL compiler may define itself (__VERSION__, extension macros)
+fn isPredefinedName(name: []const u8) bool {
+    return std.mem.startsWith(u8, name, "__") or std.mem.startsWith(u8, name, "GL_");
+}
+
+fn isLineSpace(ch: u8) bool {
+    return ch == ' ' or ch == '\t' or ch == '\r';
+}
+
+fn isIdentStart(ch: u8) bool {
+    return (ch >= 'a' and ch <= 'z') or (ch >= 'A' and ch <= 'Z') or ch == '_';
+}
+
+fn wordEnd(src: []const u8, start: usize) usize {
+    var end = start;
+    while (end < src.len and isWordChar(src[end])) end += 1;
+    return end;
+}
+
+/// A digit, or a `.` before one (`.5`)
+fn isNumberStart(src: []const u8, pos: usize) bool {
+    if (std.ascii.isDigit(src[pos])) return true;
+    return src[pos] == '.' and pos + 1 < src.len and std.ascii.isDigit(src[pos + 1]);
+}
+
+/// End of the numeric literal at `start`, suffixes and exponent included.
+fn numberEnd(src: []const u8, start: usize) usize {
+    var end = start;
+    while (end < src.len) : (end += 1) {
+        const ch = src[end];
+        if (isWordChar(ch) or ch == '.') continue;
+        // Exponent sign: `1e-5`, but not the `e` of a hex literal
+        const is_hex = end > start + 1 and src[start] == '0' and (src[start + 1] == 'x' or src[start + 1] == 'X');
+        if ((ch == '+' or ch == '-') and !is_hex and (src[end - 1] == 'e' or src[end - 1] == 'E')) continue;
+        break;
+    }
+    return end;
+}
+
+/// End of the `//` or `/*` comment at `start`; an unterminated block
+/// comment runs to the end of the source.
+fn commentEnd(src: []const u8, start: usize) usize {
+    if (src[start + 1] == '/') {
+        return std.mem.indexOfScalarPos(u8, src, start, '\n') orelse src.len;
     }
-    if (std.mem.startsWith(u8, line, "layout")) {
-        if (std.mem.indexOf(u8, line, " in ")) |idx| {
-            return line[idx + " in ".len ..];
-        }
+    const close = std.mem.indexOfPos(u8, src, start + 2, "*/") orelse return src.len;
+    return close + 2;
+}
+
+// =============================================================================
+// Shader cache payload
+// =============================================================================
+
+/// Identifies the translator build: a hash of this file, which holds the
+/// translator and the payload encoding, and of the limits that size the
+/// payload. Any change to either yields new keys, so entries written by
+/// other builds are never read back.
+const translation_cache_fingerprint: u64 = blk: {
+    const translator_source = @embedFile("webgl_program.zig");
+    @setEvalBranchQuota(4 * translator_source.len + 1000);
+    var hash: u64 = 1469598103934665603;
+    for (translator_source) |byte| {
+        hash = (hash ^ byte) *% 1099511628211;
+    }
+    for ([_]u64{ MaxProgramAttrs, MaxAttrNameBytes, MaxProgramUniforms, MaxUniformNameBytes, MaxProgramSamplers, MaxUniformArrayCount, MaxUniformBufferBlocks }) |value| {
+        hash = (hash ^ value) *% 1099511628211;
+    }
+    break :blk hash;
+};
+
+fn encodeTranslation(prog: *const Program, w: *shader_cache.Writer) void {
+    w.blob(prog.vertex_source[0..@as(usize, prog.vertex_source_len)]);
+    w.blob(prog.fragment_source[0..@as(usize, prog.fragment_source_len)]);
+    w.int(u8, prog.attr_count);
+    for (0..@as(usize, prog.attr_count)) |idx| {
+        w.blob(prog.attr_names[idx][0..@as(usize, prog.attr_name_lens[idx])]);
+        w.int(u8, prog.attr_locations[idx]);
+        w.int(u8, @intFromEnum(prog.attr_types[idx]));
+    }
+    encodeUniformBlock(&prog.vs_uniforms, w);
+    encodeUniformBlock(&prog.fs_uniforms, w);
+    w.int(u8, prog.sampler_count);
+    for (prog.samplers[0..@as(usize, prog.sampler_count)]) |sampler| {
+        w.blob(sampler.name_bytes[0..@as(usize, sampler.name_len)]);
+        w.int(u8, @intFromEnum(sampler.kind));
+        w.int(u8, @intFromEnum(sampler.stage));
+        w.int(u16, sampler.array_count);
+    }
+    w.int(u8, prog.buffer_block_count);
+    for (prog.bufferBlocks()) |*block| {
+        w.blob(block.name());
     }
-    return null;
 }
 
-fn appendBytes(dest: []u8, dest_len: *usize, bytes: []const u8) !void {
-    if (dest_len.* + bytes.len > dest.len) return error.TooLarge;
-    @memcpy(dest[dest_len.* .. dest_len.* + bytes.len], bytes);
-    dest_len.* += bytes.len;
+fn encodeUniformBlock(block: *const UniformBlock, w: *shader_cache.Writer) void {
+    w.int(u32, block.size);
+    w.int(u8, block.count);
+    for (block.items[0..@as(usize, block.count)]) |item| {
+        w.blob(item.name_bytes[0..@as(usize, item.name_len)]);
+        w.int(u8, @intFromEnum(item.utype));
+        w.int(u16, item.array_count);
+        w.int(u32, item.offset);
+        w.int(u32, item.stride);
+        w.int(u32, item.size);
+    }
 }
 
-fn appendByte(dest: []u8, dest_len: *usize, value: u8) !void {
-    if (dest_len.* + 1 > dest.len) return error.TooLarge;
-    dest[dest_len.*] = value;
-    dest_len.* += 1;
+/// Inverse of encodeTranslation. Validates every count and enum so a
+/// corrupt entry is rejected instead of producing an inconsistent program.
+fn decodeTranslation(prog: *Program, payload: []const u8) !void {
+    var r = shader_cache.Reader{ .bytes = payload };
+    try storeSource(&prog.vertex_source, &prog.vertex_source_len, try r.blob());
+    try storeSource(&prog.fragment_source, &prog.fragment_source_len, try r.blob());
+
+    const attr_count = try r.int(u8);
+    if (attr_count > MaxProgramAttrs) return error.TooManyAttribs;
+    for (0..@as(usize, attr_count)) |idx| {
+        const name = try r.blob();
+        if (name.len >= MaxAttrNameBytes) return error.AttribNameTooLong;
+        @memcpy(prog.attr_names[idx][0..name.len], name);
+        prog.attr_names[idx][name.len] = 0;
+        prog.attr_name_lens[idx] = @intCast(name.len);
+        const location = try r.int(u8);
+        if (location >= sg.max_vertex_attributes) return error.TooManyAttribs;
+        prog.attr_locations[idx] = location;
+        prog.attr_types[idx] = try std.meta.intToEnum(UniformType, try r.int(u8));
+    }
+    prog.attr_count = attr_count;
+
+    try decodeUniformBlock(&r, &prog.vs_uniforms);
+    try decodeUniformBlock(&r, &prog.fs_uniforms);
+
+    const sampler_count = try r.int(u8);
+    if (sampler_count > MaxProgramSamplers) return error.TooManySamplers;
+    for (prog.samplers[0..@as(usize, sampler_count)]) |*sampler| {
+        sampler.* = zeroedSamplerEntry();
+        const name = try r.blob();
+        if (name.len >= MaxUniformNameBytes) return error.UniformNameTooLong;
+        @memcpy(sampler.name_bytes[0..name.len], name);
+        sampler.name_bytes[name.len] = 0;
+        sampler.name_len = @intCast(name.len);
+        sampler.kind = try std.meta.intToEnum(SamplerKind, try r.int(u8));
+        sampler.stage = try std.meta.intToEnum(UniformStage, try r.int(u8));
+        sampler.array_count = try r.int(u16);
+        if (sampler.array_count > MaxUniformArrayCount) return error.InvalidArrayCount;
+    }
+    prog.sampler_count = sampler_count;
+
+    const block_count = try r.int(u8);
+    if (block_count > MaxUniformBufferBlocks) return error.TooManyUniformBlocks;
+    for (prog.buffer_blocks[0..@as(usize, block_count)]) |*block| {
+        const name = try r.blob();
+        if (name.len >= MaxUniformNameBytes) return error.UniformNameTooLong;
+        block.* = .{ .name_len = @intCast(name.len), .name_bytes = undefined, .binding = 0 };
+        @memset(&block.name_bytes, 0);
+        @memcpy(block.name_bytes[0..name.len], name);
+    }
+    prog.buffer_block_count = block_count;
+
+    if (!r.done()) return error.TrailingBytes;
 }
 
-fn replaceWord(src: []const u8, needle: []const u8, replacement: []const u8, dest: []u8) !usize {
-    if (needle.len == 0) return error.InvalidNeedle;
-    var out_len: usize = 0;
-    var i: usize = 0;
-    while (i < src.len) : (i += 1) {
-        if (std.mem.startsWith(u8, src[i..], needle) and isWordBoundary(src, i, needle.len)) {
-            if (out_len + replacement.len > dest.len) return error.LineTooLong;
-            @memcpy(dest[out_len .. out_len + replacement.len], replacement);
-            out_len += replacement.len;
-            i += needle.len - 1;
-            continue;
+fn decodeUniformBlock(r: *shader_cache.Reader, block: *UniformBlock) !void {
+    block.* = zeroedUniformBlock();
+    const size = try r.int(u32);
+    const count = try r.int(u8);
+    if (size > MaxUniformBlockBytes) return error.UniformBlockTooLarge;
+    if (count > MaxProgramUniforms) return error.TooManyUniforms;
+    for (block.items[0..@as(usize, count)]) |*item| {
+        const name = try r.blob();
+        if (name.len >= MaxUniformNameBytes) return error.UniformNameTooLong;
+        @memcpy(item.name_bytes[0..name.len], name);
+        item.name_bytes[name.len] = 0;
+        item.name_len = @intCast(name.len);
+        item.utype = try std.meta.intToEnum(UniformType, try r.int(u8));
+        item.array_count = try r.int(u16);
+        item.offset = try r.int(u32);
+        item.stride = try r.int(u32);
+        item.size = try r.int(u32);
+        const elem_count: u64 = @max(item.array_count, 1);
+        if (@as(u64, item.offset) + @as(u64, item.stride) * elem_count > MaxUniformBlockBytes) {
+            return error.UniformOutOfRange;
         }
-        if (out_len + 1 > dest.len) return error.LineTooLong;
-        dest[out_len] = src[i];
-        out_len += 1;
     }
-    return out_len;
+    block.count = count;
+    block.size = size;
 }
 
-fn isWordBoundary(src: []const u8, index: usize, len: usize) bool {
-    const start_ok = index == 0 or !isWordChar(src[index - 1]);
-    const end_index = index + len;
-    const end_ok = end_index >= src.len or !isWordChar(src[end_index]);
-    return start_ok and end_ok;
-}
+var g_program_capacity: usize = MaxPrograms;
 
-fn isWordChar(ch: u8) bool {
-    return (ch >= 'a' and ch <= 'z') or
-        (ch >= 'A' and ch <= 'Z') or
-        (ch >= '0' and ch <= '9') or
-        ch == '_';
+/// Set how many programs each ProgramTable holds. Call at startup, before
+/// the program tables are first used; tables initialized earlier keep their
+/// size.
+pub fn configureProgramCapacity(capacity: usize) !void {
+    if (capacity == 0 or capacity > handle_table.MaxCapacity) return error.InvalidSize;
+    g_program_capacity = capacity;
 }
 
 var g_program_table: ProgramTable = undefined;
@@ -2052,6 +3262,73 @@ test "ProgramTable tracks sampler uniforms" {
     try testing.expect(std.mem.indexOf(u8, fs_src, "uniform sampler2D u_tex") != null);
 }
 
+test "Link gives every sampler element a texture slot" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\attribute vec3 position;
+        \\uniform sampler2D u_height;
+        \\void main() {
+        \\  gl_Position = vec4(position, texture2D(u_height, position.xy).r);
+        \\}
+    );
+    try shaders.compile(vs);
+
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs,
+        \\#version 300 es
+        \\precision mediump float;
+        \\uniform sampler2D u_layers[3];
+        \\uniform samplerCube u_env;
+        \\uniform mediump sampler2DShadow u_shadow;
+        \\out vec4 color;
+        \\void main() {
+        \\  color = texture(u_layers[2], vec2(0.5)) * texture(u_shadow, vec3(0.5)) + texture(u_env, vec3(1.0));
+        \\}
+    );
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    const slots = prog.textureSlots();
+    try testing.expectEqual(@as(usize, 6), slots.len);
+    try testing.expectEqual(@as(u16, 0), prog.unfilterable_slots);
+    // VS samplers come first, then each array element in turn
+    try testing.expectEqualStrings("u_height", prog.samplers[slots[0].sampler].name_bytes[0..8]);
+    try testing.expectEqual(@as(u8, 2), slots[3].element);
+    try testing.expectEqual(SamplerKind.sampler2d, prog.slotKind(slots[3]));
+    try testing.expectEqual(SamplerKind.samplerCube, prog.slotKind(slots[4]));
+    try testing.expectEqual(SamplerKind.sampler2dShadow, prog.slotKind(slots[5]));
+
+    const loc = try programs.getUniformLocation(pid, "u_layers");
+    try programs.setUniformInts(pid, @intCast(loc), &[_]i32{ 4, 5, 6 });
+    try testing.expectEqual(@as(i32, 5), prog.textureUnit(slots[2]));
+
+    // Thirteen elements do not fit the sampler bindings
+    const wide = try shaders.alloc(.fragment);
+    try shaders.setSource(wide,
+        \\precision mediump float;
+        \\uniform sampler2D u_many[13];
+        \\void main() { gl_FragColor = texture2D(u_many[12], vec2(0.5)); }
+    );
+    try shaders.compile(wide);
+    const too_many = try programs.alloc();
+    try programs.attachShader(too_many, vs, shaders);
+    try programs.attachShader(too_many, wide, shaders);
+    try programs.link(too_many, shaders);
+    try testing.expect(!(programs.get(too_many) orelse return error.UnexpectedNull).linked);
+}
+
 test "ProgramTable mat2 and mat3 uniforms" {
     const shaders = shader.globalShaderTable();
     shaders.reset();
@@ -2144,3 +3421,486 @@ test "ProgramTable mat2 and mat3 uniforms" {
     try testing.expectEqual(@as(f32, 9.0), readF32(mat3_buf, 40)); // m22
     try testing.expectEqual(@as(f32, 0.0), readF32(mat3_buf, 44)); // padding
 }
+
+test "ProgramTable reuses cached translation for identical sources" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    var tmp = testing.tmpDir(.{});
+    defer tmp.cleanup();
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    shader_cache.setDirectory(try tmp.dir.realpath(".", &path_buf));
+    defer shader_cache.setDirectory(null);
+    shader_cache.resetStats();
+    defer shader_cache.resetStats();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\attribute vec3 position;
+        \\uniform mat4 u_mvp;
+        \\void main() {
+        \\  gl_Position = u_mvp * vec4(position, 1.0);
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs,
+        \\precision mediump float;
+        \\uniform sampler2D u_tex;
+        \\uniform vec4 u_color;
+        \\void main() {
+        \\  gl_FragColor = u_color * texture2D(u_tex, vec2(0.5));
+        \\}
+    );
+    try shaders.compile(fs);
+
+    const first = try programs.alloc();
+    try programs.attachShader(first, vs, shaders);
+    try programs.attachShader(first, fs, shaders);
+    try programs.link(first, shaders);
+    const a = programs.get(first) orelse return error.UnexpectedNull;
+    try testing.expect(a.linked);
+    try testing.expectEqual(shader_cache.Stats{ .hits = 0, .misses = 1, .stores = 1 }, shader_cache.stats());
+
+    const second = try programs.alloc();
+    try programs.attachShader(second, vs, shaders);
+    try programs.attachShader(second, fs, shaders);
+    try programs.link(second, shaders);
+    const b = programs.get(second) orelse return error.UnexpectedNull;
+    try testing.expect(b.linked);
+    // The second link is served from disk rather than translated again
+    try testing.expectEqual(shader_cache.Stats{ .hits = 1, .misses = 1, .stores = 1 }, shader_cache.stats());
+
+    try testing.expectEqualStrings(a.vertex_source[0..a.vertex_source_len], b.vertex_source[0..b.vertex_source_len]);
+    try testing.expectEqualStrings(a.fragment_source[0..a.fragment_source_len], b.fragment_source[0..b.fragment_source_len]);
+    try testing.expectEqual(a.attr_count, b.attr_count);
+    try testing.expectEqualSlices(u8, a.attr_locations[0..a.attr_count], b.attr_locations[0..b.attr_count]);
+    try testing.expectEqual(a.vs_uniforms.count, b.vs_uniforms.count);
+    try testing.expectEqual(a.fs_uniforms.size, b.fs_uniforms.size);
+    try testing.expectEqual(a.sampler_count, b.sampler_count);
+    try testing.expectEqual(try programs.getUniformLocation(first, "u_color"), try programs.getUniformLocation(second, "u_color"));
+
+    // A truncated payload must be rejected rather than half-applied
+    var writer = shader_cache.Writer{};
+    defer writer.deinit();
+    encodeTranslation(a, &writer);
+    const encoded = writer.finish().?;
+    try testing.expectError(error.Truncated, decodeTranslation(b, encoded[0 .. encoded.len - 1]));
+}
+
+test "ProgramTable linkAsync completes on first access" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+    var jobs = job_system.JobSystem{};
+    jobs.start(2);
+    defer jobs.stop();
+    programs.useJobSystem(&jobs);
+    defer programs.useJobSystem(null);
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs, "void main() {}");
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() {}");
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.linkAsync(pid, shaders);
+    // Relinking while a job is in flight settles the first one
+    try programs.linkAsync(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expect(prog.linked);
+    try testing.expect(programs.isLinkComplete(pid));
+
+    const bad = try programs.alloc();
+    try programs.attachShader(bad, vs, shaders);
+    try programs.linkAsync(bad, shaders);
+    try testing.expect(programs.isLinkComplete(bad));
+    try testing.expect(programs.getInfoLog(bad) != null);
+    try testing.expect(programs.free(bad));
+
+    // In flight when the job system goes away: settled, then synchronous
+    try programs.linkAsync(pid, shaders);
+    programs.useJobSystem(null);
+    try testing.expect(programs.isLinkComplete(pid));
+    try programs.linkAsync(pid, shaders);
+    try testing.expect(programs.isLinkComplete(pid));
+    try testing.expect(programs.get(pid).?.linked);
+}
+
+test "ProgramTable tracks dirty uniforms until they are applied" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\uniform vec4 u_tint;
+        \\uniform mat4 u_mvp;
+        \\attribute vec3 position;
+        \\void main() {
+        \\  gl_Position = u_mvp * vec4(position, 1.0) + u_tint;
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs,
+        \\precision mediump float;
+        \\uniform vec4 u_tint;
+        \\void main() {
+        \\  gl_FragColor = u_tint;
+        \\}
+    );
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expectEqual(@as(usize, 0), prog.vs_uniforms.dirty.count());
+
+    const loc = try programs.getUniformLocation(pid, "u_tint");
+    try programs.setUniformFloats(pid, @intCast(loc), &[_]f32{ 1.0, 0.5, 0.25, 1.0 });
+    // Shared uniforms are dirty in both stages, untouched ones stay clean
+    const vs_idx = findUniform(&prog.vs_uniforms, "u_tint").?;
+    const fs_idx = findUniform(&prog.fs_uniforms, "u_tint").?;
+    try testing.expect(prog.vs_uniforms.dirty.isSet(vs_idx));
+    try testing.expect(prog.fs_uniforms.dirty.isSet(fs_idx));
+    try testing.expect(!prog.vs_uniforms.dirty.isSet(findUniform(&prog.vs_uniforms, "u_mvp").?));
+
+    // No GL context here, so nothing is sent, but the bits are consumed
+    try testing.expectEqual(@as(u32, 0), programs.applyDirectUniforms(pid));
+    try testing.expectEqual(@as(usize, 0), prog.vs_uniforms.dirty.count());
+    try testing.expectEqual(@as(usize, 0), prog.fs_uniforms.dirty.count());
+}
+
+test "Stored uniform values are compared before rewriting" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\uniform vec3 u_points[2];
+        \\uniform int u_mode;
+        \\attribute vec3 position;
+        \\void main() {
+        \\  gl_Position = vec4(position + u_points[0] + u_points[1], float(u_mode));
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs,
+        \\precision mediump float;
+        \\void main() {
+        \\  gl_FragColor = vec4(1.0);
+        \\}
+    );
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    // Strided vec3 array: padding is skipped, every element compared
+    const points: i32 = try programs.getUniformLocation(pid, "u_points");
+    const values = [_]f32{ 1, 2, 3, 4, 5, 6 };
+    try testing.expect(!programs.uniformFloatsMatch(pid, @intCast(points), &values));
+    try programs.setUniformFloats(pid, @intCast(points), &values);
+    try testing.expect(programs.uniformFloatsMatch(pid, @intCast(points), &values));
+    try testing.expect(!programs.uniformFloatsMatch(pid, @intCast(points), &[_]f32{ 1, 2, 3, 4, 5, 7 }));
+    try testing.expect(!programs.uniformFloatsMatch(pid, @intCast(points), values[0..3]));
+
+    const mode: i32 = try programs.getUniformLocation(pid, "u_mode");
+    try testing.expect(programs.uniformIntsMatch(pid, @intCast(mode), &[_]i32{0}));
+    try testing.expect(!programs.uniformFloatsMatch(pid, @intCast(mode), &[_]f32{0}));
+    try programs.setUniformInts(pid, @intCast(mode), &[_]i32{2});
+    try testing.expect(programs.uniformIntsMatch(pid, @intCast(mode), &[_]i32{2}));
+}
+
+test "Uniform classification separates frame and object scope" {
+    try testing.expect(isFrameUniform("projectionMatrix"));
+    try testing.expect(isFrameUniform("pointLights[0].color"));
+    try testing.expect(!isFrameUniform("projectionMatrixInverse"));
+    try testing.expect(!isFrameUniform("modelViewMatrix"));
+
+    var range = ByteRange{};
+    try testing.expect(range.isEmpty());
+    range.include(64, 128);
+    range.include(16, 32);
+    try testing.expectEqual(@as(u32, 16), range.lo);
+    try testing.expectEqual(@as(u32, 128), range.hi);
+    try testing.expect(range.intersects(.{ .lo = 100, .hi = 200 }));
+    try testing.expect(!range.intersects(.{ .lo = 128, .hi = 200 }));
+}
+
+test "ProgramTable translates gl_DrawID to a direct-GL uniform" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\#extension GL_ANGLE_multi_draw : require
+        \\attribute vec3 position;
+        \\uniform mat4 u_mvp;
+        \\#ifndef GL_ANGLE_multi_draw
+        \\#define gl_DrawID _gl_DrawID
+        \\#endif
+        \\void main() {
+        \\  gl_Position = u_mvp * vec4(position + float(gl_DrawID), 1.0);
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    const source = prog.vertex_source[0..prog.vertex_source_len];
+    try testing.expect(std.mem.indexOf(u8, source, "#extension") == null);
+    try testing.expect(std.mem.indexOf(u8, source, "#define GL_ANGLE_multi_draw 1") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "uniform int " ++ DrawIdUniform ++ ";") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "float(" ++ DrawIdUniform ++ ")") != null);
+    // Not part of the sokol uniform block
+    try testing.expectEqual(@as(u8, 1), prog.vs_uniforms.count);
+    try testing.expectEqual(@as(i32, -1), prog.draw_id_location);
+}
+
+test "ProgramTable reflects uniform blocks of both stages" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\layout(std140) uniform ViewData {
+        \\  mat4 viewProjection;
+        \\};
+        \\uniform Bones
+        \\{
+        \\  mat4 boneMatrices[256];
+        \\};
+        \\uniform mat4 modelMatrix;
+        \\in vec3 position;
+        \\void main() {
+        \\  gl_Position = viewProjection * boneMatrices[0] * modelMatrix * vec4(position, 1.0);
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs,
+        \\layout(std140) uniform ViewData {
+        \\  mat4 viewProjection;
+        \\};
+        \\layout(std140) uniform Lights { vec4 color; };
+        \\void main() { gl_FragColor = color; }
+    );
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expectEqual(@as(u8, 3), prog.buffer_block_count);
+    try testing.expectEqual(@as(?u32, 0), try programs.getUniformBlockIndex(pid, "ViewData"));
+    try testing.expectEqual(@as(?u32, 1), try programs.getUniformBlockIndex(pid, "Bones"));
+    try testing.expectEqual(@as(?u32, 2), try programs.getUniformBlockIndex(pid, "Lights"));
+    try testing.expectEqual(@as(?u32, null), try programs.getUniformBlockIndex(pid, "modelMatrix"));
+    // Block members stay out of the sokol uniform block
+    try testing.expectEqual(@as(u8, 1), prog.vs_uniforms.count);
+    const source = prog.vertex_source[0..prog.vertex_source_len];
+    try testing.expect(std.mem.indexOf(u8, source, "layout(std140) uniform;") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "mat4 boneMatrices[256];") != null);
+
+    try programs.setUniformBlockBinding(pid, 1, 5);
+    try testing.expectEqual(@as(u32, 5), try programs.getUniformBlockBinding(pid, 1));
+    try testing.expectError(error.InvalidIndex, programs.setUniformBlockBinding(pid, 3, 0));
+    try testing.expectError(error.InvalidBinding, programs.setUniformBlockBinding(pid, 0, webgl_state.MaxUniformBufferBindings));
+}
+
+test "ProgramTable resolves preprocessor branches when reflecting uniforms" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\#version 300 es
+        \\#define USE_FOG
+        \\#define NUM_LIGHTS 2
+        \\#define TINT u_tint
+        \\uniform mat4 u_mvp; uniform vec4 u_tint;
+        \\uniform vec4 u_fog;
+        \\uniform vec4 u_lights;
+        \\uniform vec4 u_unused;
+        \\in vec3 position;
+        \\#ifdef USE_SKINNING
+        \\in vec4 skinWeight;
+        \\#endif
+        \\void main() {
+        \\  vec4 p = u_mvp * vec4(position, 1.0) * TINT;
+        \\#if defined(USE_FOG) && NUM_LIGHTS > 1
+        \\  p += u_fog + u_lights;
+        \\#elif defined( USE_FOG )
+        \\  p += u_unused;
+        \\#endif
+        \\  gl_Position = p;
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "uniform vec4 u_color; void main() { gl_FragColor = u_color; }");
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expect(prog.linked);
+    try testing.expectEqual(@as(u8, 4), prog.vs_uniforms.count);
+    try testing.expect(findUniform(&prog.vs_uniforms, "u_tint") != null);
+    try testing.expect(findUniform(&prog.vs_uniforms, "u_lights") != null);
+    try testing.expect(findUniform(&prog.vs_uniforms, "u_unused") == null);
+    try testing.expect(findUniform(&prog.fs_uniforms, "u_color") != null);
+    try testing.expectEqual(@as(i32, 0), try programs.getAttribLocation(pid, "position"));
+    try testing.expectEqual(@as(i32, -1), try programs.getAttribLocation(pid, "skinWeight"));
+
+    const source = prog.vertex_source[0..prog.vertex_source_len];
+    try testing.expect(std.mem.indexOf(u8, source, "#version 300") == null);
+    try testing.expect(std.mem.indexOf(u8, source, "uniform vec4 u_unused") == null);
+    try testing.expectEqual(@as(u8, 0), prog.vertex_source[prog.vertex_source_len]);
+}
+
+test "Matrix attributes take one location per column" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs,
+        \\uniform mat4 u_mvp;
+        \\layout(location = 1) in vec2 uv;
+        \\attribute vec3 position;
+        \\attribute mat4 instanceMatrix;
+        \\attribute highp vec3 normal, tangent;
+        \\void main() {
+        \\  gl_Position = u_mvp * instanceMatrix * vec4(position + normal + tangent, uv.x);
+        \\}
+    );
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expect(prog.linked);
+
+    // The explicit location stays; the rest fill the gaps around it, and
+    // the matrix needs a free run of four
+    try testing.expectEqual(@as(i32, 1), try programs.getAttribLocation(pid, "uv"));
+    try testing.expectEqual(@as(i32, 0), try programs.getAttribLocation(pid, "position"));
+    try testing.expectEqual(@as(i32, 2), try programs.getAttribLocation(pid, "instanceMatrix"));
+    try testing.expectEqual(@as(i32, 6), try programs.getAttribLocation(pid, "normal"));
+    try testing.expectEqual(@as(i32, 7), try programs.getAttribLocation(pid, "tangent"));
+    try testing.expectEqual(UniformType.MAT4, prog.attr_types[2]);
+
+    const source = prog.vertex_source[0..prog.vertex_source_len];
+    try testing.expect(std.mem.indexOf(u8, source, "layout(location = 1) in vec2 uv;") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "layout(location = 0) in vec3 position;") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "layout(location = 2) in mat4 instanceMatrix;") != null);
+    try testing.expect(std.mem.indexOf(u8, source, "layout(location = 7) in highp vec3 tangent;") != null);
+
+    // Seventeen locations do not fit
+    const wide = try shaders.alloc(.vertex);
+    try shaders.setSource(wide,
+        \\attribute mat4 a, b, c, d;
+        \\attribute float e;
+        \\void main() { gl_Position = a * b * c * d * vec4(e); }
+    );
+    try shaders.compile(wide);
+    const too_many = try programs.alloc();
+    try programs.attachShader(too_many, wide, shaders);
+    try programs.attachShader(too_many, fs, shaders);
+    try programs.link(too_many, shaders);
+    try testing.expect(!(programs.get(too_many) orelse return error.UnexpectedNull).linked);
+}
+
+test "ProgramTable links sources past 64 KiB with long lines" {
+    const shaders = shader.globalShaderTable();
+    shaders.reset();
+    defer shaders.reset();
+    const programs = globalProgramTable();
+    programs.reset();
+    defer programs.reset();
+
+    var text: std.ArrayList(u8) = .empty;
+    defer text.deinit(testing.allocator);
+    try text.appendSlice(testing.allocator, "uniform vec4 u_offset;\nin vec3 position;\nvoid main() {\n  vec4 p = vec4(position, 1.0);\n  p.x = p.x");
+    // One 80 KiB line, far past any single-line limit
+    for (0..8 * 1024) |_| try text.appendSlice(testing.allocator, " + 0.000001");
+    try text.appendSlice(testing.allocator, ";\n  gl_Position = p + u_offset;\n}\n");
+    try testing.expect(text.items.len > 64 * 1024);
+
+    const vs = try shaders.alloc(.vertex);
+    try shaders.setSource(vs, text.items);
+    try shaders.compile(vs);
+    const fs = try shaders.alloc(.fragment);
+    try shaders.setSource(fs, "void main() { gl_FragColor = vec4(1.0); }");
+    try shaders.compile(fs);
+
+    const pid = try programs.alloc();
+    try programs.attachShader(pid, vs, shaders);
+    try programs.attachShader(pid, fs, shaders);
+    try programs.link(pid, shaders);
+
+    const prog = programs.get(pid) orelse return error.UnexpectedNull;
+    try testing.expect(prog.linked);
+    try testing.expectEqual(@as(u8, 1), prog.vs_uniforms.count);
+    try testing.expect(prog.vertex_source_len > text.items.len);
+}
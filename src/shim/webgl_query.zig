@@ -0,0 +1,455 @@
+//! WebGL query objects: GPU timer and occlusion queries
+//!
+//! beginQuery()/endQuery() and queryCounterEXT() go into webgl_draw's
+//! command stream as markers between draws, so at flush they wrap exactly
+//! the commands recorded between them. Each issue of a query takes a GL
+//! query object from a small pool, preferring one already made for its GL
+//! target: GL fixes a query object's target at its first use. Results are polled without blocking at
+//! the start of later flushes and cached on the WebGL query, which is all
+//! getQueryParameter() reads; nothing ever waits on the GPU.
+//!
+//! Issuing a query again before its previous result arrived drops that
+//! result, as WebGL requires. ANY_SAMPLES_PASSED_CONSERVATIVE runs as
+//! ANY_SAMPLES_PASSED, which GL 3.3 has and which is a valid (exact)
+//! answer to the conservative question.
+
+const std = @import("std");
+const testing = std.testing;
+const gl_uniforms = @import("gl_uniforms.zig");
+
+const log = std.log.scoped(.webgl_query);
+
+pub const MaxQueries: usize = 256;
+/// GL query objects issued and not yet read back, across all queries
+pub const MaxIssues: usize = 128;
+
+// GL targets the queries run on
+const GL_TIME_ELAPSED: u32 = 0x88BF;
+const GL_ANY_SAMPLES_PASSED: u32 = 0x8C2F;
+const GL_TIMESTAMP: u32 = 0x8E28;
+
+/// Query targets by their WebGL enum value.
+pub const Target = enum(u32) {
+    time_elapsed = 0x88BF,
+    timestamp = 0x8E28,
+    any_samples_passed = 0x8C2F,
+    any_samples_passed_conservative = 0x8D6A,
+
+    /// Active-query slot; both occlusion targets share one, as in GLES 3.0.
+    /// Timestamps are instantaneous and never active.
+    fn slot(self: Target) ?usize {
+        return switch (self) {
+            .time_elapsed => 0,
+            .any_samples_passed, .any_samples_passed_conservative => 1,
+            .timestamp => null,
+        };
+    }
+
+    fn glTarget(self: Target) u32 {
+        return switch (self) {
+            .time_elapsed => GL_TIME_ELAPSED,
+            .timestamp => GL_TIMESTAMP,
+            .any_samples_passed, .any_samples_passed_conservative => GL_ANY_SAMPLES_PASSED,
+        };
+    }
+};
+
+pub fn targetFromGl(raw: u32) ?Target {
+    return std.meta.intToEnum(Target, raw) catch null;
+}
+
+/// What a recorded marker does to its issue at flush.
+pub const Action = enum { begin, end, counter };
+
+pub const QueryError = error{
+    InvalidQuery,
+    /// Another query is active on the target, or this one is active elsewhere
+    QueryActive,
+    /// The query was first used on a different target
+    TargetMismatch,
+    NoActiveQuery,
+    TooManyIssues,
+};
+
+const Query = struct {
+    live: bool = false,
+    /// Fixed by the first beginQuery()/queryCounterEXT()
+    target: ?Target = null,
+    /// Serial of the latest issue; results of older issues are dropped
+    serial: u32 = 0,
+    available: bool = false,
+    result: u64 = 0,
+};
+
+const IssueState = enum {
+    free,
+    /// Begun (or counted) in JS; the end has not been emitted to GL yet
+    recorded,
+    /// Ended in GL; the result is polled at each flush
+    in_flight,
+};
+
+const Issue = struct {
+    state: IssueState = .free,
+    query: u32 = 0,
+    serial: u32 = 0,
+    target: Target = .time_elapsed,
+    /// The begin marker reached GL; an end without it is not emitted
+    begun: bool = false,
+    /// GL query object, created on first emit and kept for later issues
+    /// on the same GL target
+    gl_name: u32 = 0,
+    gl_target: u32 = 0,
+};
+
+/// Where collectResults() reads a finished GL query object; null until the
+/// GPU has produced it. Replaced in tests.
+pub const ResultSource = *const fn (gl_name: u32) ?u64;
+
+pub const QueryStats = struct {
+    issued: u64 = 0,
+    completed: u64 = 0,
+    /// Results that arrived after their query was issued again or deleted
+    dropped: u64 = 0,
+};
+
+const QueryState = struct {
+    queries: [MaxQueries + 1]Query = [_]Query{.{}} ** (MaxQueries + 1),
+    issues: [MaxIssues]Issue = [_]Issue{.{}} ** MaxIssues,
+    next_query: u32 = 1,
+    /// Query active per Target.slot(), 0 for none
+    active: [2]u32 = .{ 0, 0 },
+    /// Issue each active query's end marker will close
+    active_issue: [2]u32 = .{ 0, 0 },
+    /// Source of Query.serial, never 0
+    serial: u32 = 0,
+    stats: QueryStats = .{},
+};
+
+var g_state: QueryState = .{};
+
+/// Forget every query, deleting the GL query objects when `delete_gl`
+/// (the GL context must be current).
+pub fn reset(delete_gl: bool) void {
+    if (delete_gl and gl_uniforms.isAvailable()) {
+        for (&g_state.issues) |*issue| {
+            if (issue.gl_name != 0) gl_uniforms.deleteQuery(issue.gl_name);
+        }
+    }
+    g_state = .{};
+}
+
+pub fn stats() QueryStats {
+    return g_state.stats;
+}
+
+// =============================================================================
+// Query objects
+// =============================================================================
+
+/// Allocate a query. Its handle is never 0.
+pub fn createQuery() !u32 {
+    const max: u32 = MaxQueries;
+    var id = g_state.next_query;
+    for (0..max) |_| {
+        if (!g_state.queries[id].live) {
+            g_state.next_query = if (id == max) 1 else id + 1;
+            g_state.queries[id] = .{ .live = true };
+            return id;
+        }
+        id = if (id == max) 1 else id + 1;
+    }
+    return error.AtCapacity;
+}
+
+pub fn isQuery(id: u32) bool {
+    return id != 0 and id <= MaxQueries and g_state.queries[id].live;
+}
+
+/// Free a query. Returns the issue its end marker must close when it was
+/// still active, which deleting ends implicitly.
+pub fn deleteQuery(id: u32) ?u32 {
+    if (!isQuery(id)) return null;
+    g_state.queries[id].live = false;
+    for (&g_state.active, &g_state.active_issue) |*active, issue| {
+        if (active.* != id) continue;
+        active.* = 0;
+        return issue;
+    }
+    return null;
+}
+
+/// getQuery(target, CURRENT_QUERY): the query active on `target`, 0 for none.
+pub fn currentQuery(target: Target) u32 {
+    const slot = target.slot() orelse return 0;
+    const id = g_state.active[slot];
+    // The slot is shared, but only names the query of the asked target
+    if (id != 0 and g_state.queries[id].target != target) return 0;
+    return id;
+}
+
+/// getQueryParameter(query, QUERY_RESULT_AVAILABLE / QUERY_RESULT).
+pub fn result(id: u32) ?u64 {
+    if (!isQuery(id)) return null;
+    const query = &g_state.queries[id];
+    return if (query.available) query.result else null;
+}
+
+// =============================================================================
+// Issues
+// =============================================================================
+
+/// beginQuery(): start a new issue of `id` on `target`. Returns the issue
+/// for the begin marker.
+pub fn begin(target: Target, id: u32) QueryError!u32 {
+    if (!isQuery(id)) return error.InvalidQuery;
+    const slot = target.slot() orelse return error.TargetMismatch;
+    if (g_state.active[slot] != 0) return error.QueryActive;
+    for (g_state.active) |active| {
+        if (active == id) return error.QueryActive;
+    }
+    const issue = try startIssue(target, id);
+    g_state.active[slot] = id;
+    g_state.active_issue[slot] = issue;
+    return issue;
+}
+
+/// endQuery(): the issue the end marker closes.
+pub fn end(target: Target) QueryError!u32 {
+    const slot = target.slot() orelse return error.NoActiveQuery;
+    const id = g_state.active[slot];
+    if (id == 0 or g_state.queries[id].target != target) return error.NoActiveQuery;
+    g_state.active[slot] = 0;
+    return g_state.active_issue[slot];
+}
+
+/// queryCounterEXT(query, TIMESTAMP_EXT): a one-marker issue.
+pub fn counter(id: u32) QueryError!u32 {
+    if (!isQuery(id)) return error.InvalidQuery;
+    for (g_state.active) |active| {
+        if (active == id) return error.QueryActive;
+    }
+    return startIssue(.timestamp, id);
+}
+
+fn startIssue(target: Target, id: u32) QueryError!u32 {
+    const query = &g_state.queries[id];
+    if (query.target) |t| {
+        if (t != target) return error.TargetMismatch;
+    }
+    const index = freeIssue(target.glTarget()) orelse return error.TooManyIssues;
+    g_state.serial = if (g_state.serial == std.math.maxInt(u32)) 1 else g_state.serial + 1;
+    query.target = target;
+    query.serial = g_state.serial;
+    query.available = false;
+    g_state.issues[index] = .{
+        .state = .recorded,
+        .query = id,
+        .serial = g_state.serial,
+        .target = target,
+        .gl_name = g_state.issues[index].gl_name,
+        .gl_target = g_state.issues[index].gl_target,
+    };
+    g_state.stats.issued += 1;
+    return index;
+}
+
+/// A free issue, by preference one whose GL query object was made for
+/// `gl_target`, then one without an object; the object of any other is
+/// replaced when it is emitted.
+fn freeIssue(gl_target: u32) ?u32 {
+    var unnamed: ?u32 = null;
+    var other: ?u32 = null;
+    for (&g_state.issues, 0..) |*issue, index| {
+        if (issue.state != .free) continue;
+        if (issue.gl_name == 0) {
+            if (unnamed == null) unnamed = @intCast(index);
+        } else if (issue.gl_target == gl_target) {
+            return @intCast(index);
+        } else if (other == null) {
+            other = @intCast(index);
+        }
+    }
+    return unnamed orelse other;
+}
+
+/// Run a recorded marker in GL, in command order at flush. The end (or
+/// counter) puts the issue in flight.
+pub fn emit(index: u32, action: Action) void {
+    const issue = &g_state.issues[index];
+    if (issue.state != .recorded) return;
+    if (action == .end and !issue.begun) {
+        // The begin was cancelled: GL has no query to end or to read
+        issue.state = .free;
+        return;
+    }
+    if (action == .begin) issue.begun = true;
+    if (gl_uniforms.isAvailable()) {
+        const gl_target = issue.target.glTarget();
+        if (issue.gl_name != 0 and issue.gl_target != gl_target) {
+            gl_uniforms.deleteQuery(issue.gl_name);
+            issue.gl_name = 0;
+        }
+        if (issue.gl_name == 0) {
+            issue.gl_name = gl_uniforms.createQuery();
+            issue.gl_target = gl_target;
+        }
+        switch (action) {
+            .begin => gl_uniforms.beginQuery(issue.target.glTarget(), issue.gl_name),
+            .end => gl_uniforms.endQuery(issue.target.glTarget()),
+            .counter => gl_uniforms.queryCounter(issue.gl_name),
+        }
+    }
+    if (action != .begin) issue.state = .in_flight;
+}
+
+/// Forget a marker that never reached GL (the frame was not submitted).
+/// Its query stays unavailable until issued again.
+pub fn cancel(index: u32, action: Action) void {
+    const issue = &g_state.issues[index];
+    if (issue.state != .recorded) return;
+    // A begin dropped on its own leaves the end to free the issue
+    if (action == .begin) return;
+    // An end after an emitted begin still closes the GL query, or the
+    // target would stay active
+    if (action == .end and issue.begun and gl_uniforms.isAvailable()) {
+        gl_uniforms.endQuery(issue.target.glTarget());
+    }
+    issue.state = .free;
+}
+
+/// Poll every issue in flight once, caching finished results on their
+/// queries. Call with the GL context current, before recording new work.
+pub fn collectResults() void {
+    if (!gl_uniforms.isAvailable()) return;
+    collect(gl_uniforms.queryResult);
+}
+
+fn collect(source: ResultSource) void {
+    for (&g_state.issues) |*issue| {
+        if (issue.state != .in_flight) continue;
+        const value = source(issue.gl_name) orelse continue;
+        issue.state = .free;
+        const query = &g_state.queries[issue.query];
+        if (!query.live or query.serial != issue.serial) {
+            g_state.stats.dropped += 1;
+            continue;
+        }
+        query.result = value;
+        query.available = true;
+        g_state.stats.completed += 1;
+        log.debug("query {d}: result {d}", .{ issue.query, value });
+    }
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+var test_value: ?u64 = null;
+
+fn testSource(_: u32) ?u64 {
+    return test_value;
+}
+
+test "Queries follow WebGL begin and end rules" {
+    reset(false);
+    defer reset(false);
+
+    const timer = try createQuery();
+    const occlusion = try createQuery();
+    try testing.expect(isQuery(timer));
+    try testing.expectError(error.InvalidQuery, begin(.time_elapsed, occlusion + 1));
+
+    _ = try begin(.time_elapsed, timer);
+    try testing.expectEqual(timer, currentQuery(.time_elapsed));
+    try testing.expectError(error.QueryActive, begin(.time_elapsed, occlusion));
+    // Active on one target means it cannot start on another
+    try testing.expectError(error.QueryActive, begin(.any_samples_passed, timer));
+
+    // Both occlusion targets share the active slot
+    _ = try begin(.any_samples_passed_conservative, occlusion);
+    try testing.expectEqual(@as(u32, 0), currentQuery(.any_samples_passed));
+    try testing.expectError(error.NoActiveQuery, end(.any_samples_passed));
+    _ = try end(.any_samples_passed_conservative);
+    _ = try end(.time_elapsed);
+    try testing.expectError(error.NoActiveQuery, end(.time_elapsed));
+
+    // A query keeps the target it was first used with
+    try testing.expectError(error.TargetMismatch, begin(.any_samples_passed, timer));
+    try testing.expectError(error.TargetMismatch, counter(timer));
+
+    // Deleting an active query hands back the issue to end
+    const issue = try begin(.time_elapsed, timer);
+    try testing.expectEqual(@as(?u32, issue), deleteQuery(timer));
+    try testing.expect(!isQuery(timer));
+    try testing.expectEqual(@as(u32, 0), currentQuery(.time_elapsed));
+}
+
+test "Query results land on the latest issue only" {
+    reset(false);
+    defer reset(false);
+
+    const q = try createQuery();
+    const first = try begin(.time_elapsed, q);
+    emit(first, .begin);
+    emit(try end(.time_elapsed), .end);
+
+    // Not finished on the GPU yet
+    test_value = null;
+    collect(testSource);
+    try testing.expectEqual(@as(?u64, null), result(q));
+
+    test_value = 1500;
+    collect(testSource);
+    try testing.expectEqual(@as(?u64, 1500), result(q));
+    try testing.expectEqual(@as(u64, 1), stats().completed);
+
+    // Issued again: the old result is gone, and a late one for an older
+    // issue is dropped
+    const second = try begin(.time_elapsed, q);
+    emit(second, .begin);
+    emit(try end(.time_elapsed), .end);
+    const third = try begin(.time_elapsed, q);
+    try testing.expectEqual(@as(?u64, null), result(q));
+    test_value = 900;
+    collect(testSource);
+    try testing.expectEqual(@as(?u64, null), result(q));
+    try testing.expectEqual(@as(u64, 1), stats().dropped);
+
+    emit(third, .begin);
+    emit(try end(.time_elapsed), .end);
+    collect(testSource);
+    try testing.expectEqual(@as(?u64, 900), result(q));
+
+    // Cancelled markers free their issue without a result
+    const ts = try counter(try createQuery());
+    cancel(ts, .counter);
+    try testing.expectEqual(IssueState.free, g_state.issues[ts].state);
+
+    // An end whose begin was cancelled frees the issue instead of going
+    // in flight
+    const dropped = try begin(.time_elapsed, q);
+    cancel(dropped, .begin);
+    emit(try end(.time_elapsed), .end);
+    try testing.expectEqual(IssueState.free, g_state.issues[dropped].state);
+    test_value = 700;
+    collect(testSource);
+    try testing.expectEqual(@as(?u64, null), result(q));
+}
+
+test "Issues keep GL query objects on their own target" {
+    reset(false);
+    defer reset(false);
+
+    // Stand in for objects made by earlier emits
+    g_state.issues[0] = .{ .gl_name = 11, .gl_target = GL_TIME_ELAPSED };
+    g_state.issues[1] = .{ .gl_name = 12, .gl_target = GL_ANY_SAMPLES_PASSED };
+    g_state.issues[2] = .{ .gl_name = 13, .gl_target = GL_TIMESTAMP };
+
+    try testing.expectEqual(@as(u32, 2), try counter(try createQuery()));
+    try testing.expectEqual(@as(u32, 1), try begin(.any_samples_passed_conservative, try createQuery()));
+    try testing.expectEqual(@as(u32, 0), try begin(.time_elapsed, try createQuery()));
+    // With every object of the target taken, one without an object is next
+    try testing.expectEqual(@as(u32, 3), try counter(try createQuery()));
+}
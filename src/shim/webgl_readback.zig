@@ -0,0 +1,478 @@
+//! Asynchronous readPixels into pixel pack buffers, and WebGL sync objects
+//!
+//! With a PIXEL_PACK_BUFFER bound, readPixels() records a readback on the
+//! pass of webgl_draw's command stream that draws the read framebuffer.
+//! At flush, once that pass's commands were submitted, glReadPixels copies
+//! the rectangle into a GL buffer from a small pool and returns at once.
+//! Every submitted frame that has readbacks or fenceSync() calls ends with
+//! a GL fence. Later flushes poll the fences without blocking; once one has
+//! signalled, its readbacks are mapped and copied into the WebGL buffer's
+//! CPU data, where getBufferSubData() reads them, and its syncs report
+//! SIGNALED. Nothing ever waits on the GPU.
+//!
+//! readPixels() into client memory records a client readback instead,
+//! which glReadPixels fills when webgl_draw submits the stream for it.
+//!
+//! WebGL syncs only tell JS when a readback is safe to read, so they are
+//! frame-grained: one GL fence covers every sync created while its frame
+//! was recorded.
+
+const std = @import("std");
+const testing = std.testing;
+const gl_uniforms = @import("gl_uniforms.zig");
+const webgl = @import("webgl.zig");
+const webgl_state = @import("webgl_state.zig");
+
+const log = std.log.scoped(.webgl_readback);
+
+/// Readbacks recorded or waiting for their fence, across all buffers
+pub const MaxReadbacks: usize = 16;
+/// Frames whose fence has not signalled yet; more merge into the newest
+pub const MaxFences: usize = 4;
+pub const MaxSyncs: usize = 256;
+
+// GL formats readPixels accepts into a pack buffer
+const GL_RGBA: u32 = 0x1908;
+const GL_UNSIGNED_BYTE: u32 = 0x1401;
+const GL_FLOAT: u32 = 0x1406;
+
+/// Pixel formats a readback can produce. RGBA/UNSIGNED_BYTE is the one
+/// combination WebGL always allows; RGBA/FLOAT is what Three.js reads
+/// float render targets with.
+pub const Format = enum {
+    rgba8,
+    rgba32f,
+
+    pub fn bytesPerPixel(self: Format) u32 {
+        return switch (self) {
+            .rgba8 => 4,
+            .rgba32f => 16,
+        };
+    }
+
+    fn glType(self: Format) u32 {
+        return switch (self) {
+            .rgba8 => GL_UNSIGNED_BYTE,
+            .rgba32f => GL_FLOAT,
+        };
+    }
+};
+
+pub fn formatFromGl(format: u32, pixel_type: u32) ?Format {
+    if (format != GL_RGBA) return null;
+    return switch (pixel_type) {
+        GL_UNSIGNED_BYTE => .rgba8,
+        GL_FLOAT => .rgba32f,
+        else => null,
+    };
+}
+
+pub const ReadbackError = error{
+    TooManyReadbacks,
+};
+
+const ReadbackState = enum {
+    free,
+    /// Recorded in JS; glReadPixels has not run yet
+    recorded,
+    /// Read into the GL buffer; copied out once the frame's fence signals
+    pending,
+    /// A client readback that glReadPixels filled; freed by takeClient()
+    delivered,
+};
+
+const Readback = struct {
+    state: ReadbackState = .free,
+    buffer: webgl.BufferId = undefined,
+    offset: u32 = 0,
+    rect: [4]i32 = .{ 0, 0, 0, 0 },
+    format: Format = .rgba8,
+    /// Frame it was recorded in
+    frame: u32 = 0,
+    /// Client memory read into directly, instead of a WebGL buffer
+    client: ?[]u8 = null,
+    /// GL pack buffer, created on first emit and kept for later readbacks
+    pbo: u32 = 0,
+    pbo_capacity: u32 = 0,
+
+    fn size(self: *const Readback) u32 {
+        const width: u32 = @intCast(self.rect[2]);
+        const height: u32 = @intCast(self.rect[3]);
+        return width * height * self.format.bytesPerPixel();
+    }
+};
+
+const Fence = struct {
+    /// Latest frame the fence covers
+    frame: u32,
+    /// GL sync object; null without GL
+    handle: ?*anyopaque,
+};
+
+const Sync = struct {
+    live: bool = false,
+    frame: u32 = 0,
+};
+
+/// How collect() reaches the GPU. Replaced in tests.
+pub const Gpu = struct {
+    /// Whether a fence has signalled; never blocks
+    signaled: *const fn (handle: ?*anyopaque) bool,
+    /// Copy the start of a GL pack buffer into `dst`
+    read: *const fn (pbo: u32, dst: []u8) bool,
+};
+
+pub const ReadbackStats = struct {
+    issued: u64 = 0,
+    completed: u64 = 0,
+    /// Readbacks never read (frame not submitted, pass skipped) or whose
+    /// buffer was deleted or shrunk before the data arrived
+    dropped: u64 = 0,
+};
+
+const State = struct {
+    readbacks: [MaxReadbacks]Readback = [_]Readback{.{}} ** MaxReadbacks,
+    fences: [MaxFences]Fence = undefined,
+    fence_count: usize = 0,
+    syncs: [MaxSyncs + 1]Sync = [_]Sync{.{}} ** (MaxSyncs + 1),
+    next_sync: u32 = 1,
+    /// Frame being recorded; frames before it have been flushed
+    frame: u32 = 1,
+    /// The frame being recorded ends with a fence
+    needs_fence: bool = false,
+    stats: ReadbackStats = .{},
+};
+
+var g_state: State = .{};
+
+/// Forget every readback and sync, deleting GL buffers and fences when
+/// `delete_gl` (the GL context must be current).
+pub fn reset(delete_gl: bool) void {
+    if (delete_gl and gl_uniforms.isAvailable()) {
+        for (&g_state.readbacks) |*readback| {
+            if (readback.pbo != 0) gl_uniforms.deleteBuffer(readback.pbo);
+        }
+        for (g_state.fences[0..g_state.fence_count]) |fence| {
+            if (fence.handle) |handle| gl_uniforms.deleteSync(handle);
+        }
+    }
+    g_state = .{};
+}
+
+pub fn stats() ReadbackStats {
+    return g_state.stats;
+}
+
+// =============================================================================
+// Readbacks
+// =============================================================================
+
+/// readPixels() into `buffer` at `offset`; `rect` is x, y, width, height
+/// with a positive size. Range checks against the buffer are the caller's.
+/// Returns the readback to emit after the read framebuffer's commands.
+pub fn record(buffer: webgl.BufferId, offset: u32, rect: [4]i32, format: Format) ReadbackError!u32 {
+    const index = try recordInto(.{ .buffer = buffer, .offset = offset, .rect = rect, .format = format });
+    g_state.needs_fence = true;
+    return index;
+}
+
+/// readPixels() into client memory `dst`, at least the rectangle's size.
+/// The caller submits the stream it is emitted from and then takes the
+/// result with takeClient().
+pub fn recordClient(dst: []u8, rect: [4]i32, format: Format) ReadbackError!u32 {
+    return recordInto(.{ .client = dst, .rect = rect, .format = format });
+}
+
+fn recordInto(fields: Readback) ReadbackError!u32 {
+    std.debug.assert(fields.rect[2] > 0 and fields.rect[3] > 0);
+    for (&g_state.readbacks, 0..) |*readback, index| {
+        if (readback.state != .free) continue;
+        var fresh = fields;
+        fresh.state = .recorded;
+        fresh.frame = g_state.frame;
+        fresh.pbo = readback.pbo;
+        fresh.pbo_capacity = readback.pbo_capacity;
+        readback.* = fresh;
+        g_state.stats.issued += 1;
+        return @intCast(index);
+    }
+    return error.TooManyReadbacks;
+}
+
+/// Whether client readback `index` was read, freeing it.
+pub fn takeClient(index: u32) bool {
+    const readback = &g_state.readbacks[index];
+    if (readback.state != .delivered) return false;
+    readback.state = .free;
+    readback.client = null;
+    return true;
+}
+
+/// Run a recorded readback in GL, inside the pass that drew its source
+/// and after the pass's commands.
+pub fn emit(index: u32) void {
+    const readback = &g_state.readbacks[index];
+    if (readback.state != .recorded) return;
+    if (readback.client) |dst| {
+        if (gl_uniforms.isAvailable()) {
+            const ok = gl_uniforms.readPixelsToMemory(
+                readback.rect[0],
+                readback.rect[1],
+                @intCast(readback.rect[2]),
+                @intCast(readback.rect[3]),
+                GL_RGBA,
+                readback.format.glType(),
+                dst[0..readback.size()],
+            );
+            if (!ok) {
+                readback.state = .free;
+                g_state.stats.dropped += 1;
+                return;
+            }
+        }
+        readback.state = .delivered;
+        g_state.stats.completed += 1;
+        return;
+    }
+    if (gl_uniforms.isAvailable()) {
+        if (readback.pbo == 0) readback.pbo = gl_uniforms.createPackBuffer();
+        const ok = gl_uniforms.readPixelsToBuffer(
+            readback.pbo,
+            &readback.pbo_capacity,
+            readback.rect[0],
+            readback.rect[1],
+            @intCast(readback.rect[2]),
+            @intCast(readback.rect[3]),
+            GL_RGBA,
+            readback.format.glType(),
+            readback.size(),
+        );
+        if (!ok) {
+            readback.state = .free;
+            g_state.stats.dropped += 1;
+            return;
+        }
+    }
+    readback.state = .pending;
+}
+
+/// End the frame being recorded: fence it when it read pixels or created
+/// syncs, and drop readbacks that never reached GL. Call once per flush,
+/// after its last pass.
+pub fn endFrame(submitted: bool) void {
+    for (&g_state.readbacks) |*readback| {
+        if (readback.state != .recorded) continue;
+        readback.state = .free;
+        g_state.stats.dropped += 1;
+    }
+    // Without a submitted frame there is no GPU work left to wait for
+    if (submitted and g_state.needs_fence) {
+        const handle = if (gl_uniforms.isAvailable()) gl_uniforms.fenceSync() else null;
+        if (g_state.fence_count == MaxFences) {
+            // The newer fence signals later and covers every command the
+            // last one did
+            const last = &g_state.fences[MaxFences - 1];
+            if (last.handle) |old| gl_uniforms.deleteSync(old);
+            last.* = .{ .frame = g_state.frame, .handle = handle };
+        } else {
+            g_state.fences[g_state.fence_count] = .{ .frame = g_state.frame, .handle = handle };
+            g_state.fence_count += 1;
+        }
+    }
+    g_state.needs_fence = false;
+    g_state.frame = if (g_state.frame == std.math.maxInt(u32)) 1 else g_state.frame + 1;
+}
+
+/// Poll the fences in order, delivering the readbacks of every frame that
+/// finished. Call with the GL context current, before recording new work.
+pub fn collectResults() void {
+    if (!gl_uniforms.isAvailable()) return;
+    collect(.{ .signaled = fenceSignaled, .read = gl_uniforms.readPackBuffer });
+}
+
+fn fenceSignaled(handle: ?*anyopaque) bool {
+    const sync = handle orelse return true;
+    return gl_uniforms.syncSignaled(sync);
+}
+
+fn collect(gpu: Gpu) void {
+    var done: usize = 0;
+    while (done < g_state.fence_count) : (done += 1) {
+        const fence = g_state.fences[done];
+        // Fences signal in submission order
+        if (!gpu.signaled(fence.handle)) break;
+        if (fence.handle) |handle| gl_uniforms.deleteSync(handle);
+        for (&g_state.readbacks) |*readback| {
+            if (readback.state != .pending or !frameAtOrBefore(readback.frame, fence.frame)) continue;
+            deliver(readback, gpu);
+        }
+    }
+    const left = g_state.fence_count - done;
+    std.mem.copyForwards(Fence, g_state.fences[0..left], g_state.fences[done..g_state.fence_count]);
+    g_state.fence_count = left;
+}
+
+fn deliver(readback: *Readback, gpu: Gpu) void {
+    readback.state = .free;
+    const size = readback.size();
+    const data = webgl_state.globalBufferManager().buffers.cpuData(readback.buffer) orelse {
+        g_state.stats.dropped += 1;
+        return;
+    };
+    if (@as(u64, readback.offset) + size > data.len or !gpu.read(readback.pbo, data[readback.offset..][0..size])) {
+        g_state.stats.dropped += 1;
+        return;
+    }
+    g_state.stats.completed += 1;
+    log.debug("readback of {d} bytes delivered", .{size});
+}
+
+/// Frame serials wrap; nothing stays in flight for 2^31 frames
+fn frameAtOrBefore(a: u32, b: u32) bool {
+    return b -% a < 1 << 31;
+}
+
+// =============================================================================
+// Sync objects
+// =============================================================================
+
+/// fenceSync(): a sync covering everything recorded so far. Its handle is
+/// never 0.
+pub fn createSync() !u32 {
+    const max: u32 = MaxSyncs;
+    var id = g_state.next_sync;
+    for (0..max) |_| {
+        if (!g_state.syncs[id].live) {
+            g_state.next_sync = if (id == max) 1 else id + 1;
+            g_state.syncs[id] = .{ .live = true, .frame = g_state.frame };
+            g_state.needs_fence = true;
+            return id;
+        }
+        id = if (id == max) 1 else id + 1;
+    }
+    return error.AtCapacity;
+}
+
+pub fn isSync(id: u32) bool {
+    return id != 0 and id <= MaxSyncs and g_state.syncs[id].live;
+}
+
+pub fn deleteSync(id: u32) bool {
+    if (!isSync(id)) return false;
+    g_state.syncs[id].live = false;
+    return true;
+}
+
+/// Whether the GPU finished the sync's frame, and with it every readback
+/// recorded before the sync; null for an invalid sync.
+pub fn syncSignaled(id: u32) ?bool {
+    if (!isSync(id)) return null;
+    const frame = g_state.syncs[id].frame;
+    // Still being recorded
+    if (frame == g_state.frame) return false;
+    for (g_state.fences[0..g_state.fence_count]) |fence| {
+        if (frameAtOrBefore(frame, fence.frame)) return false;
+    }
+    return true;
+}
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+var test_signaled = false;
+
+fn testSignaled(_: ?*anyopaque) bool {
+    return test_signaled;
+}
+
+fn testRead(_: u32, dst: []u8) bool {
+    @memset(dst, 0xAB);
+    return true;
+}
+
+const test_gpu = Gpu{ .signaled = testSignaled, .read = testRead };
+
+test "Readbacks land in the pack buffer once their fence signals" {
+    reset(false);
+    defer reset(false);
+    const mgr = webgl_state.globalBufferManager();
+    const buf = try mgr.createBuffer(.{});
+    defer _ = mgr.deleteBuffer(buf);
+    try mgr.bindBuffer(.pixel_pack, buf);
+    try mgr.bufferData(.pixel_pack, &([_]u8{0} ** 32));
+
+    // 2x2 RGBA8 at offset 8
+    const index = try record(buf, 8, .{ 0, 0, 2, 2 }, .rgba8);
+    const sync = try createSync();
+    try testing.expectEqual(@as(?bool, false), syncSignaled(sync));
+    emit(index);
+    endFrame(true);
+
+    test_signaled = false;
+    collect(test_gpu);
+    try testing.expectEqual(@as(?bool, false), syncSignaled(sync));
+    try testing.expectEqual(@as(u8, 0), mgr.buffers.cpuData(buf).?[8]);
+
+    test_signaled = true;
+    collect(test_gpu);
+    try testing.expectEqual(@as(?bool, true), syncSignaled(sync));
+    const data = mgr.buffers.cpuData(buf).?;
+    try testing.expectEqual(@as(u8, 0), data[7]);
+    try testing.expectEqual(@as(u8, 0xAB), data[8]);
+    try testing.expectEqual(@as(u8, 0xAB), data[23]);
+    try testing.expectEqual(@as(u8, 0), data[24]);
+    try testing.expectEqual(@as(u64, 1), stats().completed);
+
+    try testing.expect(deleteSync(sync));
+    try testing.expectEqual(@as(?bool, null), syncSignaled(sync));
+}
+
+test "Client readbacks are taken once emitted" {
+    reset(false);
+    defer reset(false);
+
+    var pixels: [16]u8 = undefined;
+    const read = try recordClient(&pixels, .{ 0, 0, 2, 2 }, .rgba8);
+    try testing.expect(!takeClient(read));
+    emit(read);
+    // No fence: the pixels are in client memory once emitted
+    endFrame(true);
+    try testing.expectEqual(@as(usize, 0), g_state.fence_count);
+    try testing.expect(takeClient(read));
+    try testing.expect(!takeClient(read));
+    try testing.expectEqual(ReadbackStats{ .issued = 1, .completed = 1, .dropped = 0 }, stats());
+
+    // One the stream never reached is dropped with the frame
+    const skipped = try recordClient(&pixels, .{ 0, 0, 2, 2 }, .rgba8);
+    endFrame(true);
+    try testing.expect(!takeClient(skipped));
+    try testing.expectEqual(@as(u64, 1), stats().dropped);
+}
+
+test "Readbacks that never reached GL are dropped" {
+    reset(false);
+    defer reset(false);
+    const buf: webgl.BufferId = .{ .index = 0, .generation = 1 };
+
+    // Recorded, but its pass never ran
+    _ = try record(buf, 0, .{ 0, 0, 1, 1 }, .rgba32f);
+    endFrame(true);
+    try testing.expectEqual(@as(u64, 1), stats().dropped);
+
+    // An unsubmitted frame has no fence, so its syncs count as done
+    _ = try record(buf, 0, .{ 0, 0, 1, 1 }, .rgba8);
+    const sync = try createSync();
+    endFrame(false);
+    try testing.expectEqual(@as(u64, 2), stats().dropped);
+    try testing.expectEqual(@as(usize, 0), g_state.fence_count);
+    try testing.expectEqual(@as(?bool, true), syncSignaled(sync));
+
+    // Frames past the fence limit merge into the newest fence
+    for (0..MaxFences + 2) |_| {
+        _ = try createSync();
+        endFrame(true);
+    }
+    try testing.expectEqual(MaxFences, g_state.fence_count);
+    try testing.expectEqual(g_state.frame - 1, g_state.fences[MaxFences - 1].frame);
+}
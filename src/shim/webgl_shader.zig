@@ -4,9 +4,14 @@
 
 const std = @import("std");
 const testing = std.testing;
+const handle_table = @import("handle_table.zig");
 
-pub const MaxShaders: usize = 128;
-pub const MaxShaderSourceBytes: usize = 64 * 1024;
+/// Shader sources are as long as the application makes them, so they are
+/// allocated per shader rather than held in the table's slots.
+const source_allocator = std.heap.page_allocator;
+
+/// Default ShaderTable capacity; configureShaderCapacity() changes it.
+pub const MaxShaders: usize = 1024;
 pub const MaxShaderInfoLogBytes: usize = 4 * 1024;
 
 pub const ShaderId = packed struct(u32) {
@@ -28,27 +33,21 @@ pub const Shader = struct {
 };
 
 pub const ShaderTable = struct {
-    entries: [MaxShaders]Entry,
-    count: u16,
+    handles: Handles,
 
     const Self = @This();
+    const Handles = handle_table.HandleTable(ShaderId, Entry, MaxShaders);
 
     const Entry = struct {
-        active: bool,
-        generation: u16,
         shader: Shader,
-        source_bytes: [MaxShaderSourceBytes]u8,
+        /// Owned, from source_allocator; `shader.source_len` bytes are used
+        source: []u8,
         info_bytes: [MaxShaderInfoLogBytes]u8,
     };
 
-    /// Initialize table - zeros memory at runtime, no comptime cost
+    /// Initialize table in place; slot storage is reserved on first alloc
     pub fn initInPlace(self: *Self) void {
-        @memset(std.mem.asBytes(self), 0);
-        // Set non-zero defaults (generation = 1)
-        for (&self.entries, 0..) |*entry, idx| {
-            entry.generation = 1;
-            entry.shader.id.index = @intCast(idx);
-        }
+        self.handles = .{ .capacity = g_shader_capacity };
     }
 
     pub fn init() Self {
@@ -62,45 +61,40 @@ pub const ShaderTable = struct {
     }
 
     pub fn alloc(self: *Self, kind: ShaderKind) !ShaderId {
-        if (self.count >= MaxShaders) return error.AtCapacity;
-        for (&self.entries, 0..) |*entry, idx| {
-            if (!entry.active) {
-                if (entry.generation == 0) entry.generation = 1;
-                const id = ShaderId{
-                    .index = @intCast(idx),
-                    .generation = entry.generation,
-                };
-                entry.shader = .{
-                    .id = id,
-                    .kind = kind,
-                    .source_len = 0,
-                    .compiled = false,
-                    .info_len = 0,
-                };
-                entry.active = true;
-                self.count += 1;
-                return id;
-            }
-        }
-        return error.AtCapacity;
+        const id = try self.handles.alloc();
+        self.handles.at(id.index).shader = .{
+            .id = id,
+            .kind = kind,
+            .source_len = 0,
+            .compiled = false,
+            .info_len = 0,
+        };
+        self.handles.at(id.index).source = &.{};
+        return id;
     }
 
     pub fn get(self: *Self, id: ShaderId) ?*Shader {
-        if (!self.isValid(id)) return null;
-        return &self.entries[id.index].shader;
+        const entry = self.handles.get(id) orelse return null;
+        return &entry.shader;
     }
 
     pub fn setSource(self: *Self, id: ShaderId, source: []const u8) !void {
         if (!self.isValid(id)) return error.InvalidHandle;
-        if (source.len > MaxShaderSourceBytes) return error.TooLarge;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
         if (source.len == 0) {
             entry.shader.source_len = 0;
             entry.shader.compiled = false;
             entry.shader.info_len = 0;
             return;
         }
-        @memcpy(entry.source_bytes[0..source.len], source);
+        // Three.js recompiles the same shader with new defines, so keep the
+        // buffer when the new source fits
+        if (source.len > entry.source.len) {
+            const bytes = try source_allocator.alloc(u8, source.len);
+            releaseSource(entry);
+            entry.source = bytes;
+        }
+        @memcpy(entry.source[0..source.len], source);
         entry.shader.source_len = @intCast(source.len);
         entry.shader.compiled = false;
         entry.shader.info_len = 0;
@@ -108,14 +102,14 @@ pub const ShaderTable = struct {
 
     pub fn getSource(self: *Self, id: ShaderId) ?[]const u8 {
         if (!self.isValid(id)) return null;
-        const entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
         if (entry.shader.source_len == 0) return null;
-        return entry.source_bytes[0..@as(usize, entry.shader.source_len)];
+        return entry.source[0..@as(usize, entry.shader.source_len)];
     }
 
     pub fn compile(self: *Self, id: ShaderId) !void {
         if (!self.isValid(id)) return error.InvalidHandle;
-        var entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
         entry.shader.info_len = 0;
         if (entry.shader.source_len == 0) {
             entry.shader.compiled = false;
@@ -127,16 +121,14 @@ pub const ShaderTable = struct {
 
     pub fn getInfoLog(self: *Self, id: ShaderId) ?[]const u8 {
         if (!self.isValid(id)) return null;
-        const entry = &self.entries[id.index];
+        const entry = self.handles.at(id.index);
         if (entry.shader.info_len == 0) return null;
         return entry.info_bytes[0..@as(usize, entry.shader.info_len)];
     }
 
     pub fn free(self: *Self, id: ShaderId) bool {
-        if (!self.isValid(id)) return false;
-        var entry = &self.entries[id.index];
-        entry.active = false;
-        entry.generation +%= 1;
+        const entry = self.handles.get(id) orelse return false;
+        releaseSource(entry);
         entry.shader = .{
             .id = .{
                 .index = id.index,
@@ -147,24 +139,34 @@ pub const ShaderTable = struct {
             .compiled = false,
             .info_len = 0,
         };
-        self.count -= 1;
-        return true;
+        return self.handles.free(id);
     }
 
-    pub fn isValid(self: *Self, id: ShaderId) bool {
-        if (id.index >= MaxShaders) return false;
-        const entry = &self.entries[id.index];
-        return entry.active and entry.generation == id.generation;
+    pub fn isValid(self: *const Self, id: ShaderId) bool {
+        return self.handles.isValid(id);
     }
 
     pub fn reset(self: *Self) void {
-        self.initInPlace();
+        self.releaseAllSources();
+        self.handles.reset();
     }
 
     pub fn deinit(self: *Self) void {
+        self.releaseAllSources();
+        self.handles.deinit();
         self.initInPlace();
     }
 
+    fn releaseAllSources(self: *Self) void {
+        var it = self.handles.iterator();
+        while (it.next()) |entry| releaseSource(entry);
+    }
+
+    fn releaseSource(entry: *Entry) void {
+        if (entry.source.len != 0) source_allocator.free(entry.source);
+        entry.source = &.{};
+    }
+
     fn setInfoLog(self: *Self, entry: *Entry, log: []const u8) !void {
         if (log.len > MaxShaderInfoLogBytes) return error.TooLarge;
         _ = self;
@@ -177,6 +179,15 @@ pub const ShaderTable = struct {
     }
 };
 
+var g_shader_capacity: usize = MaxShaders;
+
+/// Set how many shaders each ShaderTable holds. Call at startup, before the
+/// shader tables are first used; tables initialized earlier keep their size.
+pub fn configureShaderCapacity(capacity: usize) !void {
+    if (capacity == 0 or capacity > handle_table.MaxCapacity) return error.InvalidSize;
+    g_shader_capacity = capacity;
+}
+
 var g_shader_table: ShaderTable = undefined;
 var g_shader_table_init: bool = false;
 
@@ -259,14 +270,19 @@ test "ShaderTable setSource stores a copy" {
     try testing.expect(table.free(id));
 }
 
-test "ShaderTable setSource rejects oversize" {
+test "ShaderTable setSource stores sources of any size" {
     const table = globalShaderTable();
     table.reset();
     defer table.reset();
     const id = try table.alloc(.vertex);
-    const data = try testing.allocator.alloc(u8, MaxShaderSourceBytes + 1);
+    const data = try testing.allocator.alloc(u8, 256 * 1024);
     defer testing.allocator.free(data);
-    try testing.expectError(error.TooLarge, table.setSource(id, data));
+    @memset(data, ' ');
+    try table.setSource(id, data);
+    try testing.expectEqual(data.len, (table.getSource(id) orelse return error.UnexpectedNull).len);
+
+    try table.setSource(id, "void main() {}");
+    try testing.expectEqualStrings("void main() {}", table.getSource(id) orelse return error.UnexpectedNull);
 }
 
 test "ShaderTable compile fails without source" {
@@ -9,11 +9,27 @@ const webgl = @import("webgl.zig");
 pub const BufferTarget = enum {
     array,
     element_array,
+    pixel_pack,
+    uniform,
+};
+
+/// Indexed UNIFORM_BUFFER binding points (WebGL2's minimum).
+pub const MaxUniformBufferBindings: usize = 24;
+
+/// What bindBufferBase/bindBufferRange put at one binding point. `size` 0
+/// covers the buffer from `offset` to its end, whatever its size then.
+pub const UniformBufferBinding = struct {
+    buffer: ?webgl.BufferId = null,
+    offset: u32 = 0,
+    size: u32 = 0,
 };
 
 pub const BindState = struct {
     array_buffer: ?webgl.BufferId = null,
     element_array_buffer: ?webgl.BufferId = null,
+    pixel_pack_buffer: ?webgl.BufferId = null,
+    uniform_buffer: ?webgl.BufferId = null,
+    uniform_buffers: [MaxUniformBufferBindings]UniformBufferBinding = [_]UniformBufferBinding{.{}} ** MaxUniformBufferBindings,
 
     const Self = @This();
 
@@ -24,6 +40,8 @@ pub const BindState = struct {
         switch (target) {
             .array => self.array_buffer = id,
             .element_array => self.element_array_buffer = id,
+            .pixel_pack => self.pixel_pack_buffer = id,
+            .uniform => self.uniform_buffer = id,
         }
     }
 
@@ -31,20 +49,39 @@ pub const BindState = struct {
         switch (target) {
             .array => self.array_buffer = null,
             .element_array => self.element_array_buffer = null,
+            .pixel_pack => self.pixel_pack_buffer = null,
+            .uniform => self.uniform_buffer = null,
         }
     }
 
+    /// bindBufferRange(UNIFORM_BUFFER, index, id, offset, size); also the
+    /// generic UNIFORM_BUFFER binding, as in GL. A null `id` clears the
+    /// binding point.
+    pub fn bindBufferRange(self: *Self, table: *webgl.BufferTable, index: u32, id: ?webgl.BufferId, offset: u32, size: u32) !void {
+        if (index >= MaxUniformBufferBindings) return error.InvalidIndex;
+        if (id) |bid| {
+            if (!table.isValid(bid)) return error.InvalidHandle;
+        }
+        self.uniform_buffers[index] = .{ .buffer = id, .offset = offset, .size = size };
+        self.uniform_buffer = id;
+    }
+
+    pub fn uniformBufferBinding(self: *const Self, index: u32) UniformBufferBinding {
+        if (index >= MaxUniformBufferBindings) return .{};
+        return self.uniform_buffers[index];
+    }
+
     pub fn isBound(self: *const Self, target: BufferTarget, id: webgl.BufferId) bool {
-        return switch (target) {
-            .array => self.array_buffer != null and self.array_buffer.? == id,
-            .element_array => self.element_array_buffer != null and self.element_array_buffer.? == id,
-        };
+        const bound = self.getBoundBuffer(target) orelse return false;
+        return bound == id;
     }
 
     pub fn getBoundBuffer(self: *const Self, target: BufferTarget) ?webgl.BufferId {
         return switch (target) {
             .array => self.array_buffer,
             .element_array => self.element_array_buffer,
+            .pixel_pack => self.pixel_pack_buffer,
+            .uniform => self.uniform_buffer,
         };
     }
 
@@ -55,19 +92,18 @@ pub const BindState = struct {
         data: []const u8,
         backend: ?*const webgl.BufferBackend,
     ) !void {
-        const id = switch (target) {
-            .array => self.array_buffer orelse return error.NoBufferBound,
-            .element_array => self.element_array_buffer orelse return error.NoBufferBound,
-        };
+        const id = self.getBoundBuffer(target) orelse return error.NoBufferBound;
 
         const buf = table.get(id) orelse return error.InvalidHandle;
         const desired_usage: webgl.BufferUsage = switch (target) {
             .array => .vertex,
             .element_array => .index,
+            .pixel_pack => .pixel_pack,
+            .uniform => .uniform,
         };
         if (buf.update_count == 0 and buf.data_len == 0 and buf.backend == 0) {
-            if (buf.usage == .vertex and desired_usage == .index) {
-                buf.usage = .index;
+            if (buf.usage == .vertex and desired_usage != .vertex) {
+                buf.usage = desired_usage;
             } else if (buf.usage != desired_usage) {
                 return error.WrongTarget;
             }
@@ -75,13 +111,25 @@ pub const BindState = struct {
             return error.WrongTarget;
         }
 
-        if (backend) |b| {
-            try table.uploadData(id, data, b);
+        if (backend != null and !desired_usage.isCpuOnly()) {
+            try table.uploadData(id, data, backend.?);
         } else {
             try table.updateData(id, data);
         }
     }
 
+    pub fn bufferSubData(
+        self: *Self,
+        table: *webgl.BufferTable,
+        target: BufferTarget,
+        offset: usize,
+        data: []const u8,
+        backend: ?*const webgl.BufferBackend,
+    ) !void {
+        const id = self.getBoundBuffer(target) orelse return error.NoBufferBound;
+        try table.subData(id, offset, data, backend);
+    }
+
     pub fn onBufferDeleted(self: *Self, id: webgl.BufferId) void {
         if (self.array_buffer != null and self.array_buffer.? == id) {
             self.array_buffer = null;
@@ -89,6 +137,15 @@ pub const BindState = struct {
         if (self.element_array_buffer != null and self.element_array_buffer.? == id) {
             self.element_array_buffer = null;
         }
+        if (self.pixel_pack_buffer != null and self.pixel_pack_buffer.? == id) {
+            self.pixel_pack_buffer = null;
+        }
+        if (self.uniform_buffer != null and self.uniform_buffer.? == id) {
+            self.uniform_buffer = null;
+        }
+        for (&self.uniform_buffers) |*binding| {
+            if (binding.buffer != null and binding.buffer.? == id) binding.* = .{};
+        }
     }
 };
 
@@ -161,9 +218,37 @@ pub const BufferManager = struct {
         self.binds.unbindBuffer(target);
     }
 
+    pub fn bindBufferRange(self: *Self, index: u32, id: ?webgl.BufferId, offset: u32, size: u32) !void {
+        try self.binds.bindBufferRange(&self.buffers, index, id, offset, size);
+    }
+
+    pub fn uniformBufferBinding(self: *const Self, index: u32) UniformBufferBinding {
+        return self.binds.uniformBufferBinding(index);
+    }
+
     pub fn bufferData(self: *Self, target: BufferTarget, data: []const u8) !void {
         try self.binds.bufferData(&self.buffers, target, data, self.backend);
     }
+
+    /// bufferData with a WebGL usage hint. The hint only takes effect when the
+    /// backend buffer is (re)created, matching how drivers treat it.
+    pub fn bufferDataWithHint(self: *Self, target: BufferTarget, data: []const u8, hint: webgl.BufferHint) !void {
+        const id = self.binds.getBoundBuffer(target) orelse return error.NoBufferBound;
+        const buf = self.buffers.get(id) orelse return error.InvalidHandle;
+        buf.hint = hint;
+        try self.bufferData(target, data);
+    }
+
+    pub fn bufferSubData(self: *Self, target: BufferTarget, offset: usize, data: []const u8) !void {
+        try self.binds.bufferSubData(&self.buffers, target, offset, data, self.backend);
+    }
+
+    /// Push this frame's batched buffer writes to the GPU. Called once per
+    /// frame before any draw is submitted.
+    pub fn commitFrame(self: *Self) void {
+        const b = self.backend orelse return;
+        if (b.commit) |commit| commit(b.ctx);
+    }
 };
 
 var g_buffer_manager: BufferManager = undefined;
@@ -450,6 +535,146 @@ test "BufferManager backfills uploads when backend set" {
     try testing.expectEqual(@as(u32, 1), stub.update_calls);
 }
 
+test "BufferManager bufferSubData updates the bound buffer range" {
+    const BackendStub = struct {
+        dynamic_calls: u32 = 0,
+        range_calls: u32 = 0,
+        commit_calls: u32 = 0,
+        last_offset: usize = 0,
+
+        const Self = @This();
+
+        fn create(_: ?*anyopaque, _: usize, _: webgl.BufferUsage) webgl.BufferBackend.Handle {
+            return 1;
+        }
+
+        fn createDynamic(ctx: ?*anyopaque, _: usize, _: webgl.BufferUsage) webgl.BufferBackend.Handle {
+            const self: *Self = @ptrCast(@alignCast(ctx.?));
+            self.dynamic_calls += 1;
+            return 2;
+        }
+
+        fn update(_: ?*anyopaque, _: webgl.BufferBackend.Handle, _: []const u8) void {}
+
+        fn updateRange(ctx: ?*anyopaque, _: webgl.BufferBackend.Handle, offset: usize, _: []const u8) void {
+            const self: *Self = @ptrCast(@alignCast(ctx.?));
+            self.range_calls += 1;
+            self.last_offset = offset;
+        }
+
+        fn destroy(_: ?*anyopaque, _: webgl.BufferBackend.Handle) void {}
+
+        fn commit(ctx: ?*anyopaque) void {
+            const self: *Self = @ptrCast(@alignCast(ctx.?));
+            self.commit_calls += 1;
+        }
+    };
+
+    var stub = BackendStub{};
+    const backend = webgl.BufferBackend{
+        .ctx = &stub,
+        .create = BackendStub.create,
+        .update = BackendStub.update,
+        .destroy = BackendStub.destroy,
+        .create_dynamic = BackendStub.createDynamic,
+        .update_range = BackendStub.updateRange,
+        .commit = BackendStub.commit,
+    };
+
+    var mgr = BufferManager.initWithBackend(&backend);
+    defer mgr.deinit();
+    const id = try mgr.createBuffer(.{ .usage = .vertex });
+    try testing.expectError(error.NoBufferBound, mgr.bufferSubData(.array, 0, &.{1}));
+    try mgr.bindBuffer(.array, id);
+
+    const data = [_]u8{0} ** 64;
+    try mgr.bufferDataWithHint(.array, data[0..], .dynamic);
+    try testing.expectEqual(@as(u32, 1), stub.dynamic_calls);
+
+    const patch = [_]u8{7} ** 8;
+    try mgr.bufferSubData(.array, 16, patch[0..]);
+    try mgr.bufferSubData(.array, 40, patch[0..]);
+    try testing.expectEqual(@as(u32, 2), stub.range_calls);
+    try testing.expectEqual(@as(usize, 40), stub.last_offset);
+    try testing.expectError(error.OutOfRange, mgr.bufferSubData(.array, 60, patch[0..]));
+
+    mgr.commitFrame();
+    try testing.expectEqual(@as(u32, 1), stub.commit_calls);
+}
+
+test "BufferManager keeps pixel pack buffers on the CPU" {
+    const BackendStub = struct {
+        create_calls: u32 = 0,
+
+        const Self = @This();
+
+        fn create(ctx: ?*anyopaque, _: usize, _: webgl.BufferUsage) webgl.BufferBackend.Handle {
+            const self: *Self = @ptrCast(@alignCast(ctx.?));
+            self.create_calls += 1;
+            return self.create_calls;
+        }
+
+        fn update(_: ?*anyopaque, _: webgl.BufferBackend.Handle, _: []const u8) void {}
+        fn destroy(_: ?*anyopaque, _: webgl.BufferBackend.Handle) void {}
+    };
+
+    var stub = BackendStub{};
+    const backend = webgl.BufferBackend{
+        .ctx = &stub,
+        .create = BackendStub.create,
+        .update = BackendStub.update,
+        .destroy = BackendStub.destroy,
+    };
+
+    var mgr = BufferManager.initWithAllocator(testing.allocator);
+    defer mgr.deinit();
+    const id = try mgr.createBuffer(.{});
+    try mgr.bindBuffer(.pixel_pack, id);
+    const data = [_]u8{0} ** 32;
+    try mgr.bufferData(.pixel_pack, data[0..]);
+    // A backend arriving later leaves it alone too
+    try mgr.setBackend(&backend);
+    try mgr.bufferData(.pixel_pack, data[0..]);
+    try testing.expectEqual(@as(u32, 0), stub.create_calls);
+    try testing.expectEqual(webgl.BufferUsage.pixel_pack, mgr.buffers.get(id).?.usage);
+
+    const cpu = mgr.buffers.cpuData(id) orelse return error.UnexpectedNull;
+    try testing.expectEqual(@as(usize, 32), cpu.len);
+    cpu[3] = 9;
+    try mgr.bufferSubData(.pixel_pack, 0, &.{ 1, 2 });
+    try testing.expectEqualSlices(u8, &.{ 1, 2, 0, 9 }, mgr.buffers.cpuData(id).?[0..4]);
+
+    // Once a vertex buffer, never a pack buffer
+    const vbo = try mgr.createBuffer(.{});
+    try mgr.bindBuffer(.array, vbo);
+    try mgr.bufferData(.array, data[0..]);
+    try mgr.bindBuffer(.pixel_pack, vbo);
+    try testing.expectError(error.WrongTarget, mgr.bufferData(.pixel_pack, data[0..]));
+}
+
+test "BufferManager keeps indexed uniform buffer bindings" {
+    var mgr = BufferManager.initWithAllocator(testing.allocator);
+    defer mgr.deinit();
+    const ubo = try mgr.createBuffer(.{});
+    try mgr.bindBuffer(.uniform, ubo);
+    try mgr.bufferData(.uniform, &([_]u8{0} ** 64));
+    try testing.expectEqual(webgl.BufferUsage.uniform, mgr.buffers.get(ubo).?.usage);
+    try mgr.bufferSubData(.uniform, 16, &.{ 7, 8 });
+    try testing.expectEqualSlices(u8, &.{ 7, 8 }, mgr.buffers.cpuData(ubo).?[16..18]);
+
+    try mgr.bindBufferRange(2, ubo, 32, 16);
+    try mgr.bindBufferRange(0, ubo, 0, 0);
+    try testing.expectEqual(@as(u32, 32), mgr.uniformBufferBinding(2).offset);
+    try testing.expect(mgr.getBoundBuffer(.uniform).? == ubo);
+    try testing.expectError(error.InvalidIndex, mgr.bindBufferRange(MaxUniformBufferBindings, ubo, 0, 0));
+    try mgr.bindBufferRange(0, null, 0, 0);
+    try testing.expect(mgr.uniformBufferBinding(0).buffer == null);
+
+    try testing.expect(mgr.deleteBuffer(ubo));
+    try testing.expect(mgr.uniformBufferBinding(2).buffer == null);
+    try testing.expect(mgr.getBoundBuffer(.uniform) == null);
+}
+
 test "globalBufferManager wires backend" {
     const BackendStub = struct {
         create_calls: u32 = 0,
@@ -1,27 +1,45 @@
 //! WebGL texture management (M3)
 //!
 //! Handle table with generation checks for texture lifecycle management,
-//! CPU-side pixel data pool, and texture binding state tracking.
+//! CPU-side pixel data pool, texture binding state tracking, and GPU
+//! residency under a VRAM budget.
 
 const std = @import("std");
 const testing = std.testing;
 const sokol = @import("sokol");
 const sg = sokol.gfx;
+const cpu_block_pool = @import("cpu_block_pool.zig");
+const pixel_kernels = @import("pixel_kernels.zig");
+const handle_table = @import("handle_table.zig");
 const log = std.log.scoped(.webgl_texture);
 
 // =============================================================================
 // Constants
 // =============================================================================
 
-pub const MaxTextures: usize = 256;
+/// Default TextureTable capacity; configureTextureCapacity() changes it.
+pub const MaxTextures: usize = 2048;
 pub const MaxTextureUnits: usize = 8;
 
-// CPU texture data pool: 64 MB total
+// CPU texture data pool: 64 MB by default (configureCpuPool)
 // Block size of 16 KiB is reasonable for texture data (4K x 1 row of RGBA)
 pub const CpuBlockSizeBytes: usize = 16 * 1024;
 pub const CpuBlockCount: usize = 4096; // 4096 * 16 KiB = 64 MiB
 pub const CpuPoolBytes: usize = CpuBlockSizeBytes * CpuBlockCount;
 
+// Bytes of pixel data pushed to the GPU per flush before the rest of the
+// dirty queue waits for the next frame. One 2048x2048 RGBA texture.
+pub const DefaultUploadBudgetBytes: usize = 16 * 1024 * 1024;
+
+// Evicted textures keep a tail of at most this many texels a side on the
+// GPU, so draws sample a blurred image while the full one streams back.
+pub const EvictedExtent: u32 = 64;
+// Upload passes (about frames) a texture must go undrawn before it can be
+// evicted, so the working set of a scene does not thrash.
+pub const EvictIdlePasses: u32 = 30;
+// Evictions per upload pass; bounds the work after a budget drop.
+pub const MaxEvictionsPerPass: u32 = 16;
+
 // =============================================================================
 // Types
 // =============================================================================
@@ -50,8 +68,64 @@ pub const TextureFormat = enum(u32) {
     luminance_alpha = 0x190A,
     luminance = 0x1909,
     alpha = 0x1906,
+    // Depth formats have no CPU copy; their images are only ever drawn
+    // into (see Texture.render_target)
+    depth_component = 0x1902,
+    depth_stencil = 0x84F9,
+
+    // Block-compressed formats, named by their GL internal format enums.
+    // Stored and uploaded as-is; see isCompressed().
+    bc1_rgb = 0x83F0,
+    bc1_rgba = 0x83F1,
+    bc2_rgba = 0x83F2,
+    bc3_rgba = 0x83F3,
+    bc4_r = 0x8DBB,
+    bc4_r_snorm = 0x8DBC,
+    bc5_rg = 0x8DBD,
+    bc5_rg_snorm = 0x8DBE,
+    bc6h_rgb_float = 0x8E8E,
+    bc6h_rgb_ufloat = 0x8E8F,
+    bc7_rgba = 0x8E8C,
+    bc7_srgba = 0x8E8D,
+    eac_r11 = 0x9270,
+    eac_r11_snorm = 0x9271,
+    eac_rg11 = 0x9272,
+    eac_rg11_snorm = 0x9273,
+    etc2_rgb8 = 0x9274,
+    etc2_srgb8 = 0x9275,
+    etc2_rgb8a1 = 0x9276,
+    etc2_rgba8 = 0x9278,
+    etc2_srgb8a8 = 0x9279,
+    astc_4x4_rgba = 0x93B0,
+    astc_4x4_srgba = 0x93D0,
 };
 
+/// True for formats stored as 4x4 texel blocks.
+pub fn isCompressed(format: TextureFormat) bool {
+    return switch (format) {
+        .rgba, .rgb, .luminance_alpha, .luminance, .alpha, .depth_component, .depth_stencil => false,
+        else => true,
+    };
+}
+
+pub fn isDepth(format: TextureFormat) bool {
+    return format == .depth_component or format == .depth_stencil;
+}
+
+/// Bytes per 4x4 block of a compressed format.
+pub fn compressedBlockBytes(format: TextureFormat) u32 {
+    return switch (format) {
+        .bc1_rgb, .bc1_rgba, .bc4_r, .bc4_r_snorm => 8,
+        .eac_r11, .eac_r11_snorm, .etc2_rgb8, .etc2_srgb8, .etc2_rgb8a1 => 8,
+        else => 16,
+    };
+}
+
+/// Size of one compressed image; partial blocks at the edges count whole.
+pub fn compressedImageSize(format: TextureFormat, width: u32, height: u32) u32 {
+    return ((width + 3) / 4) * ((height + 3) / 4) * compressedBlockBytes(format);
+}
+
 pub const TextureFilter = enum(u32) {
     nearest = 0x2600,
     linear = 0x2601,
@@ -72,6 +146,45 @@ pub const TextureParams = struct {
     mag_filter: TextureFilter = .linear,
     wrap_s: TextureWrap = .repeat,
     wrap_t: TextureWrap = .repeat,
+    /// TEXTURE_COMPARE_MODE is COMPARE_REF_TO_TEXTURE (shadow samplers)
+    compare_ref: bool = false,
+    compare_func: u32 = 0x0203, // GL_LEQUAL
+};
+
+/// Texel rectangle [x0, x1) x [y0, y1).
+pub const TexRect = struct {
+    x0: u32 = 0,
+    y0: u32 = 0,
+    x1: u32 = 0,
+    y1: u32 = 0,
+
+    pub fn full(width: u32, height: u32) TexRect {
+        return .{ .x1 = width, .y1 = height };
+    }
+
+    pub fn isEmpty(self: TexRect) bool {
+        return self.x0 >= self.x1 or self.y0 >= self.y1;
+    }
+
+    pub fn width(self: TexRect) u32 {
+        return if (self.isEmpty()) 0 else self.x1 - self.x0;
+    }
+
+    pub fn height(self: TexRect) u32 {
+        return if (self.isEmpty()) 0 else self.y1 - self.y0;
+    }
+
+    pub fn include(self: *TexRect, other: TexRect) void {
+        if (other.isEmpty()) return;
+        if (self.isEmpty()) {
+            self.* = other;
+            return;
+        }
+        self.x0 = @min(self.x0, other.x0);
+        self.y0 = @min(self.y0, other.y0);
+        self.x1 = @max(self.x1, other.x1);
+        self.y1 = @max(self.y1, other.y1);
+    }
 };
 
 pub const Texture = struct {
@@ -90,122 +203,276 @@ pub const Texture = struct {
     cpu_block_start: u16,
     cpu_block_count: u16,
     dirty: bool, // True if CPU data needs upload to GPU
+    dirty_rect: TexRect, // Part of level 0 changed since the last upload
+    realloc: bool, // True if the GPU image must be recreated (size/format change)
     params_dirty: bool, // True if sampler params need refresh
+    render_target: bool, // Attached to a framebuffer: the GPU image is drawn into
+    mip_count: u8, // Mip levels held in CPU storage, level 0 first
+    level_mask: u16, // Bit per mip level that has been defined
+    backend_levels: u8, // Mip levels in the GPU image
+    gpu_bytes: u32, // Size of the GPU image, counted against the VRAM budget
+    last_used: u32, // Upload pass in which a draw last sampled it
+    evicted: bool, // GPU image holds only a low-resolution tail (see evict)
+    cpu_released: bool, // CPU copy dropped after upload; the GPU has the only one
+
+    /// Levels handed to the GPU: the defined run starting at level 0.
+    pub fn uploadLevels(self: *const Texture) u32 {
+        const defined: u32 = @ctz(~self.level_mask);
+        return @max(@min(defined, self.mip_count), 1);
+    }
 };
 
 // =============================================================================
-// CPU Data Pool
+// Mip chains
 // =============================================================================
 
-const CpuSlice = struct {
-    block_start: u16,
-    block_count: u16,
-    size: u32,
-};
+/// Enough for 32768x32768; level_mask has a bit per level.
+pub const MaxMipLevels: u32 = 16;
 
-const CpuTexturePool = struct {
-    data: [CpuPoolBytes]u8,
-    used: [CpuBlockCount]bool,
+/// Levels in a complete chain down to 1x1.
+pub fn fullMipCount(width: u32, height: u32) u32 {
+    var count: u32 = 1;
+    var size = @max(width, height);
+    while (size > 1 and count < MaxMipLevels) : (size >>= 1) count += 1;
+    return count;
+}
 
-    const Self = @This();
+pub fn levelExtent(size: u32, level: u32) u32 {
+    return @max(size >> @intCast(level), 1);
+}
 
-    fn initInPlace(self: *Self) void {
-        @memset(&self.used, false);
-        // data is left uninitialized - it will be written before read
-    }
-
-    fn reset(self: *Self) void {
-        @memset(&self.used, false);
-    }
-
-    fn alloc(self: *Self, size: usize) !CpuSlice {
-        if (size == 0) return error.InvalidSize;
-        const blocks_needed = (size + CpuBlockSizeBytes - 1) / CpuBlockSizeBytes;
-        if (blocks_needed > CpuBlockCount) return error.TooLarge;
-
-        // Find contiguous free blocks
-        var run_len: usize = 0;
-        var run_start: usize = 0;
-        for (0..CpuBlockCount) |idx| {
-            if (!self.used[idx]) {
-                if (run_len == 0) run_start = idx;
-                run_len += 1;
-                if (run_len >= blocks_needed) {
-                    for (run_start..run_start + blocks_needed) |block_idx| {
-                        self.used[block_idx] = true;
-                    }
-                    return .{
-                        .block_start = @intCast(run_start),
-                        .block_count = @intCast(blocks_needed),
-                        .size = @intCast(size),
-                    };
-                }
-            } else {
-                run_len = 0;
-            }
-        }
-        return error.OutOfMemory;
+fn levelMask(count: u32) u16 {
+    return @intCast((@as(u32, 1) << @intCast(count)) - 1);
+}
+
+/// Bytes of one image in storage layout.
+pub fn imageSize(format: TextureFormat, width: u32, height: u32) u32 {
+    if (isCompressed(format)) return compressedImageSize(format, width, height);
+    return width * height * bytesPerPixel(format);
+}
+
+/// Byte offset of `level` in storage, with levels packed from level 0.
+pub fn levelOffset(format: TextureFormat, width: u32, height: u32, level: u32) u32 {
+    var offset: u32 = 0;
+    for (0..level) |i| {
+        const l: u32 = @intCast(i);
+        offset += imageSize(format, levelExtent(width, l), levelExtent(height, l));
     }
+    return offset;
+}
 
-    fn free(self: *Self, cpu_slice: CpuSlice) void {
-        if (cpu_slice.block_count == 0) return;
-        const start: usize = @intCast(cpu_slice.block_start);
-        const count: usize = @intCast(cpu_slice.block_count);
-        for (start..start + count) |idx| {
-            self.used[idx] = false;
-        }
+pub fn chainSize(format: TextureFormat, width: u32, height: u32, count: u32) u32 {
+    return levelOffset(format, width, height, count);
+}
+
+/// 2x2 box filter from one level into the next. On odd sizes the last row
+/// or column is reused, matching the usual GL downsample.
+fn downsample(dst: []u8, src: []const u8, src_width: u32, src_height: u32, bpp: u32) void {
+    switch (bpp) {
+        1 => downsampleRows(1, dst, src, src_width, src_height),
+        2 => downsampleRows(2, dst, src, src_width, src_height),
+        4 => downsampleRows(4, dst, src, src_width, src_height),
+        else => unreachable, // Storage formats are 1, 2 or 4 bytes per texel
     }
+}
 
-    fn slice(self: *Self, cpu_slice: CpuSlice) []u8 {
-        const start = @as(usize, cpu_slice.block_start) * CpuBlockSizeBytes;
-        return self.data[start .. start + @as(usize, cpu_slice.size)];
+fn downsampleRows(comptime bpp: usize, dst: []u8, src: []const u8, src_width: u32, src_height: u32) void {
+    const src_w: usize = src_width;
+    const dst_w: usize = levelExtent(src_width, 1);
+    const dst_h: usize = levelExtent(src_height, 1);
+    const src_stride = src_w * bpp;
+    for (0..dst_h) |y| {
+        const y0 = @min(2 * y, src_height - 1);
+        const y1 = @min(2 * y + 1, src_height - 1);
+        downsampleRow(
+            bpp,
+            dst[y * dst_w * bpp ..][0 .. dst_w * bpp],
+            src[y0 * src_stride ..][0..src_stride],
+            src[y1 * src_stride ..][0..src_stride],
+            src_w,
+        );
     }
+}
 
-    fn constSlice(self: *const Self, cpu_slice: CpuSlice) []const u8 {
-        const start = @as(usize, cpu_slice.block_start) * CpuBlockSizeBytes;
-        return self.data[start .. start + @as(usize, cpu_slice.size)];
+/// One output row from two source rows. Whole 16-byte output chunks are
+/// averaged as vectors; the tail and odd last column fall back to scalar.
+fn downsampleRow(comptime bpp: usize, dst: []u8, row0: []const u8, row1: []const u8, src_w: usize) void {
+    const lanes = 16;
+    const chunk_texels = lanes / bpp;
+    const Wide = @Vector(2 * lanes, u16);
+    const Out = @Vector(lanes, u16);
+    // Output lane j takes channel j % bpp of source texels 2t and 2t + 1
+    const even: @Vector(lanes, i32) = comptime blk: {
+        var mask: [lanes]i32 = undefined;
+        for (0..lanes) |j| mask[j] = @intCast((j / bpp) * 2 * bpp + j % bpp);
+        break :blk mask;
+    };
+    const odd = even + @as(@Vector(lanes, i32), @splat(bpp));
+
+    const dst_w = dst.len / bpp;
+    var x: usize = 0;
+    while (x + chunk_texels <= src_w / 2) : (x += chunk_texels) {
+        const offset = x * 2 * bpp;
+        const top: @Vector(2 * lanes, u8) = row0[offset..][0 .. 2 * lanes].*;
+        const bottom: @Vector(2 * lanes, u8) = row1[offset..][0 .. 2 * lanes].*;
+        const sum = @as(Wide, @intCast(top)) + @as(Wide, @intCast(bottom));
+        const pairs = @shuffle(u16, sum, undefined, even) + @shuffle(u16, sum, undefined, odd);
+        const avg = (pairs + @as(Out, @splat(2))) / @as(Out, @splat(4));
+        const out: @Vector(lanes, u8) = @intCast(avg);
+        dst[x * bpp ..][0..lanes].* = out;
     }
-};
+    while (x < dst_w) : (x += 1) {
+        const x0 = @min(2 * x, src_w - 1) * bpp;
+        const x1 = @min(2 * x + 1, src_w - 1) * bpp;
+        for (0..bpp) |ch| {
+            const sum = @as(u32, row0[x0 + ch]) + row0[x1 + ch] + row1[x0 + ch] + row1[x1 + ch];
+            dst[x * bpp + ch] = @intCast((sum + 2) / 4);
+        }
+    }
+}
+
+/// Backend storage format: RGB is widened to RGBA.
+fn storageFormat(format: TextureFormat) TextureFormat {
+    return if (format == .rgb) .rgba else format;
+}
 
-var g_cpu_pool: CpuTexturePool = undefined;
-var g_cpu_pool_init: bool = false;
+/// Bytes per texel of an uncompressed format; 0 for compressed formats,
+/// which are sized with compressedImageSize().
+pub fn bytesPerPixel(format: TextureFormat) u32 {
+    return switch (format) {
+        .rgba, .depth_component, .depth_stencil => 4,
+        .rgb => 3,
+        .luminance_alpha => 2,
+        .luminance, .alpha => 1,
+        else => 0,
+    };
+}
 
-fn globalCpuPool() *CpuTexturePool {
-    if (!g_cpu_pool_init) {
-        g_cpu_pool.initInPlace();
-        g_cpu_pool_init = true;
+/// Copy `pixel_count` pixels of `src_format` into storage layout, padding
+/// RGB with opaque alpha.
+fn copyPixels(dst: []u8, src: []const u8, src_format: TextureFormat, pixel_count: usize) void {
+    if (src_format != .rgb) {
+        const len = pixel_count * bytesPerPixel(src_format);
+        @memcpy(dst[0..len], src[0..len]);
+        return;
     }
+    pixel_kernels.expandRgbToRgba(dst, src, pixel_count);
+}
+
+// =============================================================================
+// CPU Data Pool
+// =============================================================================
+
+const CpuSlice = cpu_block_pool.CpuSlice;
+const CpuTexturePool = cpu_block_pool.BlockPool(CpuBlockSizeBytes, CpuBlockCount);
+
+var g_cpu_pool: CpuTexturePool = .{};
+
+fn globalCpuPool() *CpuTexturePool {
     return &g_cpu_pool;
 }
 
+/// Resize the CPU pixel pool. Call at startup, before any texture data is
+/// stored; fails with PoolInUse otherwise.
+pub fn configureCpuPool(bytes: usize) !void {
+    try g_cpu_pool.configure(bytes);
+}
+
+pub fn cpuPoolStats() cpu_block_pool.PoolStats {
+    return g_cpu_pool.stats();
+}
+
+const queue_allocator = std.heap.page_allocator;
+
+var g_texture_capacity: usize = MaxTextures;
+
+pub const ResidencyConfig = struct {
+    /// GPU bytes of textures to stay under by evicting the least recently
+    /// drawn ones; 0 is unlimited.
+    vram_budget: usize = 0,
+    /// Keep each texture's CPU copy after upload. Copies are always kept
+    /// under a VRAM budget, since evicted textures stream back from them.
+    keep_cpu_copies: bool = true,
+};
+
+var g_residency: ResidencyConfig = .{};
+
+/// Set the residency policy of texture tables initialized from now on.
+pub fn configureResidency(config: ResidencyConfig) void {
+    g_residency = config;
+}
+
+/// Set how many textures each TextureTable holds. Call at startup, before
+/// the texture tables are first used; tables initialized earlier keep their
+/// size.
+pub fn configureTextureCapacity(capacity: usize) !void {
+    if (capacity == 0 or capacity > handle_table.MaxCapacity) return error.InvalidSize;
+    g_texture_capacity = capacity;
+}
+
 // =============================================================================
 // Texture Table
 // =============================================================================
 
 pub const TextureTable = struct {
-    entries: [MaxTextures]Entry,
-    count: u16,
+    handles: Handles,
     cpu_pool: *CpuTexturePool,
+    /// Slots with pending pixel or sampler work, in the order they were
+    /// first touched. A slot appears at most once (queued[slot]), which is
+    /// tied to the slot, not the generation, so a freed and reallocated
+    /// texture is never queued twice. Both are sized to the table's
+    /// capacity with its first alloc.
+    dirty_queue: []u16,
+    queued: []bool,
+    dirty_count: u16,
+    upload_budget: usize,
+    residency: ResidencyConfig,
+    /// Sum of gpu_bytes over live textures
+    gpu_bytes: usize,
+    /// Upload passes so far; stamps Texture.last_used
+    frame: u32,
 
     const Self = @This();
+    const Handles = handle_table.HandleTable(TextureId, Texture, MaxTextures);
 
-    const Entry = struct {
-        active: bool,
-        generation: u16,
-        texture: Texture,
-    };
-
-    /// Initialize table in place - zeros memory at runtime, no comptime cost
+    /// Initialize table in place; slot storage is reserved on first alloc
     pub fn initInPlace(self: *Self) void {
-        @memset(std.mem.asBytes(&self.entries), 0);
-        for (&self.entries, 0..) |*entry, idx| {
-            entry.generation = 1;
-            entry.texture.id.index = @intCast(idx);
-            entry.texture.internal_format = 0x1908; // GL_RGBA
-            entry.texture.pixel_type = 0x1401; // GL_UNSIGNED_BYTE
-        }
-        self.count = 0;
+        self.handles = .{ .capacity = g_texture_capacity };
         self.cpu_pool = globalCpuPool();
+        self.dirty_queue = &.{};
+        self.queued = &.{};
+        self.dirty_count = 0;
+        self.upload_budget = DefaultUploadBudgetBytes;
+        self.residency = g_residency;
+        self.gpu_bytes = 0;
+        self.frame = 0;
+    }
+
+    fn enqueue(self: *Self, id: TextureId) void {
+        if (self.queued[id.index]) return;
+        self.queued[id.index] = true;
+        self.dirty_queue[self.dirty_count] = id.index;
+        self.dirty_count += 1;
+    }
+
+    fn ensureQueue(self: *Self) !void {
+        if (self.queued.len != 0) return;
+        const queued = try queue_allocator.alloc(bool, self.handles.capacity);
+        errdefer queue_allocator.free(queued);
+        self.dirty_queue = try queue_allocator.alloc(u16, self.handles.capacity);
+        @memset(queued, false);
+        self.queued = queued;
+        self.dirty_count = 0;
+    }
+
+    /// Cap the bytes uploaded per flush (0 = unlimited). The first queued
+    /// upload always proceeds so oversized textures still make progress.
+    pub fn setUploadBudget(self: *Self, bytes: usize) void {
+        self.upload_budget = bytes;
+    }
+
+    pub fn setResidency(self: *Self, config: ResidencyConfig) void {
+        self.residency = config;
     }
 
     pub fn init() Self {
@@ -215,138 +482,134 @@ pub const TextureTable = struct {
     }
 
     pub fn reset(self: *Self) void {
-        for (&self.entries) |*entry| {
-            if (entry.active) {
-                // Free CPU pool blocks
-                if (entry.texture.cpu_block_count > 0) {
-                    self.cpu_pool.free(.{
-                        .block_start = entry.texture.cpu_block_start,
-                        .block_count = entry.texture.cpu_block_count,
-                        .size = entry.texture.data_len,
-                    });
-                }
-                // Destroy backend resources if valid
-                if (entry.texture.backend_view.id != 0) {
-                    sg.destroyView(entry.texture.backend_view);
-                }
-                if (entry.texture.backend.id != 0) {
-                    sg.destroyImage(entry.texture.backend);
-                }
+        var it = self.handles.iterator();
+        while (it.next()) |tex| {
+            // Free CPU pool blocks
+            if (tex.cpu_block_count > 0) {
+                self.cpu_pool.free(.{
+                    .block_start = tex.cpu_block_start,
+                    .block_count = tex.cpu_block_count,
+                    .size = tex.data_len,
+                });
+            }
+            // Destroy backend resources if valid
+            if (tex.backend_view.id != 0) {
+                sg.destroyView(tex.backend_view);
+            }
+            if (tex.backend.id != 0) {
+                sg.destroyImage(tex.backend);
             }
-            entry.active = false;
-            entry.generation = 1;
-            entry.texture.cpu_block_start = 0;
-            entry.texture.cpu_block_count = 0;
-            entry.texture.data_len = 0;
-            entry.texture.backend = .{};
-            entry.texture.backend_view = .{};
-            entry.texture.dirty = false;
-        }
-        self.count = 0;
+        }
+        self.handles.reset();
+        @memset(self.queued, false);
+        self.dirty_count = 0;
+        self.gpu_bytes = 0;
         self.cpu_pool.reset();
     }
 
-    pub fn alloc(self: *Self) !TextureId {
-        if (self.count >= MaxTextures) {
-            return error.AtCapacity;
-        }
-
-        for (&self.entries, 0..) |*entry, idx| {
-            if (!entry.active) {
-                if (entry.generation == 0) {
-                    entry.generation = 1;
-                }
-                const id = TextureId{
-                    .index = @intCast(idx),
-                    .generation = entry.generation,
-                };
-                entry.texture = .{
-                    .id = id,
-                    .target = .texture_2d,
-                    .width = 0,
-                    .height = 0,
-                    .format = .rgba,
-                    .internal_format = 0x1908,
-                    .pixel_type = 0x1401,
-                    .data_len = 0,
-                    .params = .{},
-                    .backend = .{},
-                    .backend_view = .{},
-                    .backend_sampler = .{},
-                    .cpu_block_start = 0,
-                    .cpu_block_count = 0,
-                    .dirty = false,
-                    .params_dirty = true, // Start dirty to ensure initial sampler creation
-                };
-                entry.active = true;
-                self.count += 1;
-                return id;
-            }
+    /// reset() and release the slot storage.
+    pub fn deinit(self: *Self) void {
+        self.reset();
+        self.handles.deinit();
+        if (self.queued.len != 0) {
+            queue_allocator.free(self.queued);
+            queue_allocator.free(self.dirty_queue);
         }
-        return error.AtCapacity;
+        self.initInPlace();
+    }
+
+    pub fn alloc(self: *Self) !TextureId {
+        try self.ensureQueue();
+        const id = try self.handles.alloc();
+        self.handles.at(id.index).* = .{
+            .id = id,
+            .target = .texture_2d,
+            .width = 0,
+            .height = 0,
+            .format = .rgba,
+            .internal_format = 0x1908,
+            .pixel_type = 0x1401,
+            .data_len = 0,
+            .params = .{},
+            .backend = .{},
+            .backend_view = .{},
+            .backend_sampler = .{},
+            .cpu_block_start = 0,
+            .cpu_block_count = 0,
+            .dirty = false,
+            .dirty_rect = .{},
+            .realloc = true,
+            .params_dirty = true, // Start dirty to ensure initial sampler creation
+            .render_target = false,
+            .mip_count = 1,
+            .level_mask = 0,
+            .backend_levels = 0,
+            .gpu_bytes = 0,
+            // Idle time counts from creation, not from the first draw
+            .last_used = self.frame,
+            .evicted = false,
+            .cpu_released = false,
+        };
+        return id;
     }
 
     pub fn get(self: *Self, id: TextureId) ?*Texture {
-        if (!self.isValid(id)) return null;
-        return &self.entries[id.index].texture;
+        return self.handles.get(id);
     }
 
     pub fn getConst(self: *const Self, id: TextureId) ?*const Texture {
-        if (!self.isValidConst(id)) return null;
-        return &self.entries[id.index].texture;
+        return self.handles.getConst(id);
     }
 
     pub fn free(self: *Self, id: TextureId) bool {
-        if (!self.isValid(id)) return false;
-        var entry = &self.entries[id.index];
+        const tex = self.handles.get(id) orelse return false;
 
         // Free CPU pool blocks
-        if (entry.texture.cpu_block_count > 0) {
+        if (tex.cpu_block_count > 0) {
             self.cpu_pool.free(.{
-                .block_start = entry.texture.cpu_block_start,
-                .block_count = entry.texture.cpu_block_count,
-                .size = entry.texture.data_len,
+                .block_start = tex.cpu_block_start,
+                .block_count = tex.cpu_block_count,
+                .size = tex.data_len,
             });
         }
 
         // Destroy backend resources if valid
-        if (entry.texture.backend_sampler.id != 0) {
-            sg.destroySampler(entry.texture.backend_sampler);
-        }
-        if (entry.texture.backend_view.id != 0) {
-            sg.destroyView(entry.texture.backend_view);
-        }
-        if (entry.texture.backend.id != 0) {
-            sg.destroyImage(entry.texture.backend);
-        }
-
-        entry.active = false;
-        entry.generation +%= 1;
-        entry.texture.cpu_block_start = 0;
-        entry.texture.cpu_block_count = 0;
-        entry.texture.data_len = 0;
-        entry.texture.backend = .{};
-        entry.texture.backend_view = .{};
-        entry.texture.backend_sampler = .{};
-        entry.texture.dirty = false;
-        entry.texture.params_dirty = false;
-        self.count -= 1;
-        return true;
+        if (tex.backend_sampler.id != 0) {
+            sg.destroySampler(tex.backend_sampler);
+        }
+        if (tex.backend_view.id != 0) {
+            sg.destroyView(tex.backend_view);
+        }
+        if (tex.backend.id != 0) {
+            sg.destroyImage(tex.backend);
+        }
+
+        tex.cpu_block_start = 0;
+        tex.cpu_block_count = 0;
+        tex.data_len = 0;
+        tex.backend = .{};
+        tex.backend_view = .{};
+        tex.backend_sampler = .{};
+        self.setGpuBytes(tex, 0);
+        tex.dirty = false;
+        tex.dirty_rect = .{};
+        tex.params_dirty = false;
+        tex.render_target = false;
+        tex.evicted = false;
+        tex.cpu_released = false;
+        return self.handles.free(id);
     }
 
-    pub fn isValid(self: *Self, id: TextureId) bool {
-        if (id.index >= MaxTextures) return false;
-        const entry = &self.entries[id.index];
-        return entry.active and entry.generation == id.generation;
+    pub fn isValid(self: *const Self, id: TextureId) bool {
+        return self.handles.isValid(id);
     }
 
     pub fn isValidConst(self: *const Self, id: TextureId) bool {
-        if (id.index >= MaxTextures) return false;
-        const entry = &self.entries[id.index];
-        return entry.active and entry.generation == id.generation;
+        return self.handles.isValid(id);
     }
 
-    /// Upload pixel data to CPU pool for later GPU upload
+    /// Define level 0 and store its pixels in the CPU pool for a later
+    /// GPU upload. A new size or format drops any smaller mip levels.
     pub fn texImage2D(
         self: *Self,
         id: TextureId,
@@ -359,109 +622,550 @@ pub const TextureTable = struct {
         data: ?[]const u8,
     ) !void {
         const tex = self.get(id) orelse return error.InvalidHandle;
+        if (isCompressed(format)) return error.InvalidEnum;
+        if (isDepth(format)) return self.defineDepthImage(tex, target, width, height, format, internal_format, pixel_type);
+        if (data) |pixels| {
+            if (pixels.len < width * height * bytesPerPixel(format)) return error.InsufficientData;
+        }
 
-        // Calculate source data size based on input format
-        const src_bytes_per_pixel: u32 = switch (format) {
-            .rgba => 4,
-            .rgb => 3,
-            .luminance_alpha => 2,
-            .luminance, .alpha => 1,
-        };
-        const src_data_size = width * height * src_bytes_per_pixel;
-
-        // Backend always uses RGBA8 (4 bytes per pixel) for RGB/RGBA
-        // So we need to convert RGB to RGBA
-        const storage_format: TextureFormat = if (format == .rgb) .rgba else format;
-        const storage_bytes_per_pixel: u32 = switch (storage_format) {
-            .rgba => 4,
-            .rgb => 4, // Stored as RGBA
-            .luminance_alpha => 2,
-            .luminance, .alpha => 1,
-        };
-        const storage_size = width * height * storage_bytes_per_pixel;
+        // RGB is widened to RGBA for the backend
+        const storage_format = storageFormat(format);
+        const storage_size = imageSize(storage_format, width, height);
 
-        // Free existing CPU data if dimensions/format changed
-        if (tex.cpu_block_count > 0 and
-            (tex.width != width or tex.height != height or tex.format != storage_format))
-        {
-            self.cpu_pool.free(.{
-                .block_start = tex.cpu_block_start,
-                .block_count = tex.cpu_block_count,
-                .size = tex.data_len,
-            });
-            tex.cpu_block_start = 0;
-            tex.cpu_block_count = 0;
-            tex.data_len = 0;
+        // Same-shaped re-uploads update the existing GPU image in place
+        if (tex.width != width or tex.height != height or tex.format != storage_format) {
+            self.releaseStorage(tex);
         }
-
-        // Update texture metadata (store as RGBA for RGB input)
         tex.target = target;
         tex.width = width;
         tex.height = height;
         tex.format = storage_format;
         tex.internal_format = internal_format;
         tex.pixel_type = pixel_type;
+        if (storage_size == 0) return;
+        // Without data, existing contents are kept; fresh storage is zeroed
+        if (data == null and tex.cpu_block_count > 0) return;
 
-        // Allocate CPU storage and copy data if provided
+        const fresh = tex.cpu_block_count == 0;
+        const dst = try self.ensureStorage(tex, @max(storage_size, tex.data_len));
         if (data) |pixels| {
-            if (pixels.len < src_data_size) return error.InsufficientData;
-
-            // Allocate new CPU block if needed
-            if (tex.cpu_block_count == 0 or tex.data_len < storage_size) {
-                if (tex.cpu_block_count > 0) {
-                    self.cpu_pool.free(.{
-                        .block_start = tex.cpu_block_start,
-                        .block_count = tex.cpu_block_count,
-                        .size = tex.data_len,
-                    });
-                }
-                const cpu_slice = try self.cpu_pool.alloc(storage_size);
-                tex.cpu_block_start = cpu_slice.block_start;
-                tex.cpu_block_count = cpu_slice.block_count;
-            }
+            copyPixels(dst, pixels, format, @as(usize, width) * height);
+        } else {
+            @memset(dst[0..storage_size], 0);
+        }
+        if (fresh) tex.level_mask = 1;
+        tex.dirty = true;
+        tex.dirty_rect = TexRect.full(width, height);
+        self.enqueue(id);
+    }
 
-            tex.data_len = storage_size;
+    /// Depth textures exist only on the GPU: any CPU copy is dropped and
+    /// the image is (re)created as a render target on the next upload.
+    fn defineDepthImage(
+        self: *Self,
+        tex: *Texture,
+        target: TextureTarget,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        internal_format: u32,
+        pixel_type: u32,
+    ) void {
+        if (tex.width != width or tex.height != height or tex.format != format or tex.cpu_block_count > 0) {
+            self.releaseStorage(tex);
+        }
+        tex.target = target;
+        tex.width = width;
+        tex.height = height;
+        tex.format = format;
+        tex.internal_format = internal_format;
+        tex.pixel_type = pixel_type;
+        tex.level_mask = 1;
+        tex.render_target = true;
+        tex.dirty = false;
+        tex.dirty_rect = .{};
+        if (tex.realloc) self.enqueue(tex.id);
+    }
 
-            // Copy pixel data to CPU pool
-            const dst = self.cpu_pool.slice(.{
-                .block_start = tex.cpu_block_start,
-                .block_count = tex.cpu_block_count,
-                .size = storage_size,
-            });
+    /// Mark a texture as drawn into by a framebuffer. Its GPU image is
+    /// recreated with attachment usage on the next upload; CPU contents
+    /// still reach it through in-place sub-image writes.
+    pub fn markRenderTarget(self: *Self, id: TextureId) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        if (tex.render_target) return;
+        tex.render_target = true;
+        tex.realloc = true;
+        self.enqueue(id);
+    }
+
+    /// Define mip level `level` (>= 1) of a texture whose level 0 exists.
+    /// The size must match the level's place in the chain and the format
+    /// must match level 0; CPU storage grows to hold the chain.
+    pub fn texImageLevel(
+        self: *Self,
+        id: TextureId,
+        level: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: ?[]const u8,
+    ) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        if (level == 0 or level >= MaxMipLevels) return error.InvalidLevel;
+        if (tex.cpu_block_count == 0) return error.NoStorage;
+        if (storageFormat(format) != tex.format) return error.FormatMismatch;
+        if (width != levelExtent(tex.width, level) or height != levelExtent(tex.height, level)) {
+            return error.InvalidLevel;
+        }
+        const src_size = if (isCompressed(format))
+            compressedImageSize(format, width, height)
+        else
+            width * height * bytesPerPixel(format);
+        if (data) |bytes| {
+            if (bytes.len < src_size) return error.InsufficientData;
+        }
 
-            // Convert RGB to RGBA by padding alpha if needed
-            if (format == .rgb) {
-                const pixel_count = width * height;
-                var i: usize = 0;
-                while (i < pixel_count) : (i += 1) {
-                    const src_offset = i * 3;
-                    const dst_offset = i * 4;
-                    dst[dst_offset + 0] = pixels[src_offset + 0];
-                    dst[dst_offset + 1] = pixels[src_offset + 1];
-                    dst[dst_offset + 2] = pixels[src_offset + 2];
-                    dst[dst_offset + 3] = 255; // Full alpha
-                }
+        try self.growChain(tex, level + 1);
+        const dst = self.levelSlice(tex, level);
+        if (data) |bytes| {
+            if (isCompressed(format)) {
+                @memcpy(dst, bytes[0..dst.len]);
             } else {
-                @memcpy(dst[0..storage_size], pixels[0..storage_size]);
+                copyPixels(dst, bytes, format, @as(usize, width) * height);
             }
-            tex.dirty = true;
         } else {
-            // No data provided - just update dimensions (reserve space)
-            if (storage_size > 0 and tex.cpu_block_count == 0) {
-                const cpu_slice = try self.cpu_pool.alloc(storage_size);
-                tex.cpu_block_start = cpu_slice.block_start;
-                tex.cpu_block_count = cpu_slice.block_count;
-                tex.data_len = storage_size;
-                // Zero-fill the allocated space
-                const dst = self.cpu_pool.slice(.{
+            @memset(dst, 0);
+        }
+        tex.level_mask |= @as(u16, 1) << @intCast(level);
+        self.markRealloc(tex);
+    }
+
+    /// Reserve `levels` mip levels at once (texStorage2D). Every level is
+    /// defined and zeroed; contents arrive via sub-image uploads.
+    pub fn allocateLevels(self: *Self, id: TextureId, levels: u32) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        if (tex.cpu_block_count == 0) return error.NoStorage;
+        const count = @min(levels, fullMipCount(tex.width, tex.height));
+        if (count <= tex.mip_count) return;
+        try self.growChain(tex, count);
+        tex.level_mask = levelMask(count);
+        self.markRealloc(tex);
+    }
+
+    /// Fill levels 1.. from level 0 with a 2x2 box filter, replacing any
+    /// explicitly uploaded levels. Only uncompressed formats can be filtered.
+    pub fn generateMipmap(self: *Self, id: TextureId) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        // Rendered contents exist only on the GPU; filtering the CPU copy
+        // would overwrite them, so render targets keep a single level
+        if (tex.render_target) return;
+        if (tex.cpu_released) {
+            // The GPU image is the only copy; filter it in place
+            if (tex.backend_levels <= 1 or !webgl_backend.generateTextureMipmaps(tex.backend)) return error.NoStorage;
+            return;
+        }
+        if (tex.cpu_block_count == 0 or tex.level_mask & 1 == 0) return error.NoStorage;
+        if (isCompressed(tex.format)) return error.FormatMismatch;
+        const count = fullMipCount(tex.width, tex.height);
+        if (count == 1) return;
+
+        try self.growChain(tex, count);
+        const bpp = bytesPerPixel(tex.format);
+        for (1..count) |level| {
+            const src_level: u32 = @intCast(level - 1);
+            downsample(
+                self.levelSlice(tex, @intCast(level)),
+                self.levelSlice(tex, src_level),
+                levelExtent(tex.width, src_level),
+                levelExtent(tex.height, src_level),
+                bpp,
+            );
+        }
+        tex.level_mask = levelMask(count);
+        self.markRealloc(tex);
+    }
+
+    /// Overwrite a rectangle of mip level `level`. The CPU copy is patched;
+    /// for level 0 only the touched region is re-sent on the next upload.
+    pub fn texSubImage2D(
+        self: *Self,
+        id: TextureId,
+        level: u32,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        pixels: []const u8,
+    ) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        if (tex.cpu_released) return self.writeReleased(tex, level, x, y, width, height, format, pixels);
+        if (tex.cpu_block_count == 0 or tex.data_len == 0 or level >= tex.mip_count) return error.NoStorage;
+        if (storageFormat(format) != tex.format) return error.FormatMismatch;
+        const level_width = levelExtent(tex.width, level);
+        const level_height = levelExtent(tex.height, level);
+        if (x > level_width or width > level_width - x) return error.OutOfRange;
+        if (y > level_height or height > level_height - y) return error.OutOfRange;
+        if (width == 0 or height == 0) return;
+
+        const src_stride = @as(usize, width) * bytesPerPixel(format);
+        if (pixels.len < src_stride * height) return error.InsufficientData;
+        const dst_bpp: usize = bytesPerPixel(tex.format);
+        const dst = self.levelSlice(tex, level);
+        for (0..height) |row| {
+            const dst_offset = ((y + row) * @as(usize, level_width) + x) * dst_bpp;
+            copyPixels(dst[dst_offset..], pixels[row * src_stride ..], format, width);
+        }
+
+        if (level != 0) {
+            // In-place region updates cover level 0 only
+            self.markRealloc(tex);
+            return;
+        }
+        tex.dirty_rect.include(.{ .x0 = x, .y0 = y, .x1 = x + width, .y1 = y + height });
+        tex.dirty = true;
+        self.enqueue(id);
+    }
+
+    /// texSubImage2D on a texture whose CPU copy was released: level 0 is
+    /// written straight into the GPU image. Other levels have no copy to
+    /// patch and fail like a texture without storage.
+    fn writeReleased(
+        self: *Self,
+        tex: *Texture,
+        level: u32,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        pixels: []const u8,
+    ) !void {
+        if (level != 0 or tex.backend.id == 0) return error.NoStorage;
+        if (storageFormat(format) != tex.format) return error.FormatMismatch;
+        if (x > tex.width or width > tex.width - x) return error.OutOfRange;
+        if (y > tex.height or height > tex.height - y) return error.OutOfRange;
+        if (width == 0 or height == 0) return;
+
+        const pixel_count = @as(usize, width) * height;
+        if (pixels.len < pixel_count * bytesPerPixel(format)) return error.InsufficientData;
+        const rect: TexRect = .{ .x0 = x, .y0 = y, .x1 = x + width, .y1 = y + height };
+        if (format == tex.format) {
+            if (!webgl_backend.writeTextureRect(tex.backend, tex.format, rect, pixels)) return error.NoStorage;
+            return;
+        }
+        // RGB is widened through a scratch slice of the pool
+        const scratch = try self.cpu_pool.alloc(pixel_count * bytesPerPixel(tex.format));
+        defer self.cpu_pool.free(scratch);
+        const widened = self.cpu_pool.slice(scratch);
+        copyPixels(widened, pixels, format, pixel_count);
+        if (!webgl_backend.writeTextureRect(tex.backend, tex.format, rect, widened)) return error.NoStorage;
+    }
+
+    /// Define level 0 from already-compressed blocks (or zeroed blocks when
+    /// `data` is null). The bytes are kept as-is and handed to the GPU
+    /// without conversion.
+    pub fn compressedTexImage2D(
+        self: *Self,
+        id: TextureId,
+        target: TextureTarget,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: ?[]const u8,
+    ) !void {
+        if (!isCompressed(format)) return error.InvalidEnum;
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        const size = compressedImageSize(format, width, height);
+        if (data) |bytes| {
+            if (bytes.len < size) return error.InsufficientData;
+        }
+
+        if (tex.width != width or tex.height != height or tex.format != format) {
+            self.releaseStorage(tex);
+        }
+        tex.target = target;
+        tex.width = width;
+        tex.height = height;
+        tex.format = format;
+        tex.internal_format = @intFromEnum(format);
+        tex.pixel_type = 0;
+        if (size == 0) return;
+
+        const dst = try self.ensureStorage(tex, @max(size, tex.data_len));
+        if (data) |bytes| @memcpy(dst[0..size], bytes[0..size]) else @memset(dst[0..size], 0);
+        tex.level_mask |= 1;
+        self.markRealloc(tex);
+    }
+
+    /// Overwrite whole blocks of a compressed mip level. Offsets must be
+    /// block-aligned and sizes too, except where the region meets the edge.
+    pub fn compressedTexSubImage2D(
+        self: *Self,
+        id: TextureId,
+        level: u32,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: []const u8,
+    ) !void {
+        const tex = self.get(id) orelse return error.InvalidHandle;
+        if (tex.cpu_block_count == 0 or tex.data_len == 0 or level >= tex.mip_count) return error.NoStorage;
+        if (format != tex.format) return error.FormatMismatch;
+        const level_width = levelExtent(tex.width, level);
+        const level_height = levelExtent(tex.height, level);
+        if (x > level_width or width > level_width - x) return error.OutOfRange;
+        if (y > level_height or height > level_height - y) return error.OutOfRange;
+        if (x % 4 != 0 or y % 4 != 0) return error.Unaligned;
+        if ((width % 4 != 0 and x + width != level_width) or (height % 4 != 0 and y + height != level_height)) {
+            return error.Unaligned;
+        }
+        if (width == 0 or height == 0) return;
+
+        const block_bytes: usize = compressedBlockBytes(format);
+        const src_stride = ((width + 3) / 4) * block_bytes;
+        const block_rows: usize = (height + 3) / 4;
+        if (data.len < src_stride * block_rows) return error.InsufficientData;
+        const dst_stride = ((level_width + 3) / 4) * block_bytes;
+        const dst = self.levelSlice(tex, level);
+        for (0..block_rows) |row| {
+            const dst_offset = (y / 4 + row) * dst_stride + (x / 4) * block_bytes;
+            @memcpy(dst[dst_offset .. dst_offset + src_stride], data[row * src_stride ..][0..src_stride]);
+        }
+        self.markRealloc(tex);
+    }
+
+    /// Queue a texture whose GPU image must be rebuilt from the CPU copy:
+    /// mip chain changes and compressed data, which have no in-place path.
+    fn markRealloc(self: *Self, tex: *Texture) void {
+        tex.realloc = true;
+        tex.dirty = true;
+        tex.dirty_rect = TexRect.full(tex.width, tex.height);
+        self.enqueue(tex.id);
+    }
+
+    /// Grow CPU storage to hold the first `count` mip levels, keeping the
+    /// levels already stored and zeroing the new ones.
+    fn growChain(self: *Self, tex: *Texture, count: u32) !void {
+        if (count <= tex.mip_count) return;
+        const old_len = tex.data_len;
+        const dst = try self.ensureStorage(tex, chainSize(tex.format, tex.width, tex.height, count));
+        @memset(dst[old_len..], 0);
+        tex.mip_count = @intCast(count);
+    }
+
+    fn levelSlice(self: *Self, tex: *const Texture, level: u32) []u8 {
+        const offset = levelOffset(tex.format, tex.width, tex.height, level);
+        const size = imageSize(tex.format, levelExtent(tex.width, level), levelExtent(tex.height, level));
+        return self.storageSlice(tex)[offset .. offset + size];
+    }
+
+    fn storageSlice(self: *Self, tex: *const Texture) []u8 {
+        return self.cpu_pool.slice(.{
+            .block_start = tex.cpu_block_start,
+            .block_count = tex.cpu_block_count,
+            .size = tex.data_len,
+        });
+    }
+
+    /// CPU storage for `size` bytes. The current bytes are kept (up to
+    /// `size`) and the blocks are reused when they are already large enough;
+    /// anything past the old length is left undefined.
+    fn ensureStorage(self: *Self, tex: *Texture, size: u32) ![]u8 {
+        if (@as(usize, tex.cpu_block_count) * CpuBlockSizeBytes < size) {
+            const cpu_slice = try self.cpu_pool.alloc(size);
+            if (tex.cpu_block_count > 0) {
+                const keep = @min(tex.data_len, size);
+                const old = self.storageSlice(tex);
+                @memcpy(self.cpu_pool.slice(cpu_slice)[0..keep], old[0..keep]);
+                self.cpu_pool.free(.{
                     .block_start = tex.cpu_block_start,
                     .block_count = tex.cpu_block_count,
-                    .size = storage_size,
+                    .size = tex.data_len,
                 });
-                @memset(dst, 0);
-                tex.dirty = true;
             }
+            tex.cpu_block_start = cpu_slice.block_start;
+            tex.cpu_block_count = cpu_slice.block_count;
         }
+        tex.data_len = size;
+        tex.cpu_released = false;
+        return self.storageSlice(tex);
+    }
+
+    fn releaseStorage(self: *Self, tex: *Texture) void {
+        if (tex.cpu_block_count > 0) {
+            self.cpu_pool.free(.{
+                .block_start = tex.cpu_block_start,
+                .block_count = tex.cpu_block_count,
+                .size = tex.data_len,
+            });
+        }
+        tex.cpu_block_start = 0;
+        tex.cpu_block_count = 0;
+        tex.data_len = 0;
+        tex.mip_count = 1;
+        tex.level_mask = 0;
+        tex.realloc = true;
+        tex.cpu_released = false;
+    }
+
+    /// Drop the CPU copy of an uploaded texture, leaving the GPU image as
+    /// the only one. The defined levels stay as they are on the GPU.
+    fn releaseCpuCopy(self: *Self, tex: *Texture) void {
+        if (tex.cpu_block_count == 0) return;
+        self.cpu_pool.free(.{
+            .block_start = tex.cpu_block_start,
+            .block_count = tex.cpu_block_count,
+            .size = tex.data_len,
+        });
+        tex.cpu_block_start = 0;
+        tex.cpu_block_count = 0;
+        tex.data_len = 0;
+        tex.mip_count = 1;
+        tex.cpu_released = true;
+    }
+
+    fn setGpuBytes(self: *Self, tex: *Texture, bytes: u32) void {
+        self.gpu_bytes = self.gpu_bytes - tex.gpu_bytes + bytes;
+        tex.gpu_bytes = bytes;
+    }
+
+    /// Note that a draw samples `tex`. An evicted texture is queued to
+    /// stream its full image back in, within the upload budget.
+    pub fn touch(self: *Self, tex: *Texture) void {
+        tex.last_used = self.frame;
+        if (tex.evicted and !tex.dirty) self.markRealloc(tex);
+    }
+
+    /// Evict the least recently drawn textures until GPU memory is back
+    /// under the VRAM budget, nothing idle is left, or a tail cannot be
+    /// built (the next pass tries again). Returns how many were evicted.
+    fn enforceBudget(self: *Self) u32 {
+        const budget = self.residency.vram_budget;
+        if (budget == 0) return 0;
+        var evictions: u32 = 0;
+        while (self.gpu_bytes > budget and evictions < MaxEvictionsPerPass) : (evictions += 1) {
+            const victim = self.leastRecentlyUsed() orelse break;
+            if (!self.evict(victim)) break;
+        }
+        return evictions;
+    }
+
+    fn leastRecentlyUsed(self: *Self) ?*Texture {
+        var oldest: ?*Texture = null;
+        var it = self.handles.iterator();
+        while (it.next()) |tex| {
+            if (!self.evictable(tex)) continue;
+            if (oldest == null or self.frame -% tex.last_used > self.frame -% oldest.?.last_used) oldest = tex;
+        }
+        return oldest;
+    }
+
+    fn evictable(self: *const Self, tex: *const Texture) bool {
+        // Render targets hold what was drawn into them, nowhere else
+        if (tex.evicted or tex.render_target or tex.backend.id == 0) return false;
+        // The full image streams back in from the CPU copy
+        if (tex.cpu_block_count == 0 or tex.dirty or self.queued[tex.id.index]) return false;
+        // Nothing to gain from a tail as large as the image
+        if (@max(tex.width, tex.height) <= EvictedExtent) return false;
+        return self.frame -% tex.last_used >= EvictIdlePasses;
+    }
+
+    /// Replace a texture's GPU image with a low-resolution tail: its
+    /// stored levels from the first at most EvictedExtent a side, or its
+    /// smallest level box-filtered down to that size. Compressed textures
+    /// without such levels leave the GPU entirely and sample as
+    /// incomplete until touch() brings them back. The tail is built
+    /// before the full image is dropped; if that fails the texture stays
+    /// resident and false is returned.
+    fn evict(self: *Self, tex: *Texture) bool {
+        var tail: u32 = 0;
+        while (@max(levelExtent(tex.width, tail), levelExtent(tex.height, tail)) > EvictedExtent) tail += 1;
+        const levels = tex.uploadLevels();
+        var replacement: TailImage = .{};
+        if (tail < levels) {
+            // Stored levels already reach down to the tail
+            const offset = levelOffset(tex.format, tex.width, tex.height, tail);
+            replacement = createTail(tex, tail, levels - tail, self.storageSlice(tex)[offset..]) orelse return false;
+        } else if (!isCompressed(tex.format)) {
+            const filtered = self.filterTail(tex, levels - 1, tail) catch |err| {
+                log.warn("evict: no CPU pool space to filter a {d}x{d} texture: {s}", .{ tex.width, tex.height, @errorName(err) });
+                return false;
+            };
+            defer self.cpu_pool.free(filtered.scratch);
+            replacement = createTail(tex, tail, 1, filtered.pixels) orelse return false;
+        }
+
+        // The old image was made with a context; without one it is a stand-in
+        if (sg.isvalid()) {
+            webgl_backend.destroyTextureView(tex.backend_view);
+            webgl_backend.destroyTextureImage(tex.backend);
+        }
+        tex.backend = replacement.image;
+        tex.backend_view = replacement.view;
+        tex.backend_levels = replacement.levels;
+        self.setGpuBytes(tex, replacement.bytes);
+        tex.evicted = true;
+        // Whatever uploads next rebuilds the full image
+        tex.realloc = true;
+        if (tex.backend.id != 0) refreshSampler(tex);
+        log.debug("evicted {d}x{d} texture, {d} bytes resident", .{ tex.width, tex.height, tex.gpu_bytes });
+        return true;
+    }
+
+    const TailImage = struct {
+        image: sg.Image = .{},
+        view: sg.View = .{},
+        levels: u8 = 0,
+        bytes: u32 = 0,
+    };
+
+    const FilteredTail = struct {
+        scratch: CpuSlice,
+        pixels: []const u8,
+    };
+
+    /// Box-filter level `base` down to level `tail` (below it) through
+    /// two scratch halves of the pool. The caller frees `scratch`.
+    fn filterTail(self: *Self, tex: *const Texture, base: u32, tail: u32) !FilteredTail {
+        const bpp = bytesPerPixel(tex.format);
+        const half = imageSize(tex.format, levelExtent(tex.width, base + 1), levelExtent(tex.height, base + 1));
+        const scratch = try self.cpu_pool.alloc(2 * @as(usize, half));
+        const buf = self.cpu_pool.slice(scratch);
+
+        var src: []const u8 = self.levelSlice(tex, base);
+        var side: usize = 0;
+        var level = base;
+        while (level < tail) : (level += 1) {
+            const size = imageSize(tex.format, levelExtent(tex.width, level + 1), levelExtent(tex.height, level + 1));
+            const dst = buf[side * half ..][0..size];
+            downsample(dst, src, levelExtent(tex.width, level), levelExtent(tex.height, level), bpp);
+            src = dst;
+            side ^= 1;
+        }
+        return .{ .scratch = scratch, .pixels = src };
+    }
+
+    /// A GPU image of `count` levels from `level`, or null if the backend
+    /// rejects it. Without a graphics context (tests or headless) only its
+    /// size is filled in.
+    fn createTail(tex: *const Texture, level: u32, count: u32, pixels: []const u8) ?TailImage {
+        const width = levelExtent(tex.width, level);
+        const height = levelExtent(tex.height, level);
+        var result: TailImage = .{ .levels = @intCast(count), .bytes = chainSize(tex.format, width, height, count) };
+        if (!sg.isvalid()) return result;
+        result.image = webgl_backend.createTextureImage(width, height, tex.format, tex.params, count, pixels) catch |err| {
+            log.warn("evict: failed to create {d}x{d} tail: {s}", .{ width, height, @errorName(err) });
+            return null;
+        };
+        result.view = webgl_backend.createTextureView(result.image) catch |err| {
+            log.warn("evict: failed to create tail view: {s}", .{@errorName(err)});
+            webgl_backend.destroyTextureImage(result.image);
+            return null;
+        };
+        return result;
     }
 
     /// Get CPU pixel data for a texture
@@ -605,6 +1309,71 @@ pub const TextureManager = struct {
         try self.textures.texImage2D(id, target, width, height, format, internal_format, pixel_type, data);
     }
 
+    pub fn texImageLevel(
+        self: *Self,
+        target: TextureTarget,
+        level: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: ?[]const u8,
+    ) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.texImageLevel(id, level, width, height, format, data);
+    }
+
+    pub fn allocateLevels(self: *Self, target: TextureTarget, levels: u32) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.allocateLevels(id, levels);
+    }
+
+    pub fn generateMipmap(self: *Self, target: TextureTarget) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.generateMipmap(id);
+    }
+
+    pub fn texSubImage2D(
+        self: *Self,
+        target: TextureTarget,
+        level: u32,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        pixels: []const u8,
+    ) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.texSubImage2D(id, level, x, y, width, height, format, pixels);
+    }
+
+    pub fn compressedTexImage2D(
+        self: *Self,
+        target: TextureTarget,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: ?[]const u8,
+    ) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.compressedTexImage2D(id, target, width, height, format, data);
+    }
+
+    pub fn compressedTexSubImage2D(
+        self: *Self,
+        target: TextureTarget,
+        level: u32,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        format: TextureFormat,
+        data: []const u8,
+    ) !void {
+        const id = self.state.getBound(target) orelse return error.NoTextureBound;
+        try self.textures.compressedTexSubImage2D(id, level, x, y, width, height, format, data);
+    }
+
     pub fn texParameteri(self: *Self, target: TextureTarget, pname: u32, param: u32) !void {
         const id = self.state.getBound(target) orelse return error.NoTextureBound;
         const tex = self.textures.get(id) orelse return error.InvalidHandle;
@@ -613,6 +1382,9 @@ pub const TextureManager = struct {
         const GL_TEXTURE_MAG_FILTER: u32 = 0x2800;
         const GL_TEXTURE_WRAP_S: u32 = 0x2802;
         const GL_TEXTURE_WRAP_T: u32 = 0x2803;
+        const GL_TEXTURE_COMPARE_MODE: u32 = 0x884C;
+        const GL_TEXTURE_COMPARE_FUNC: u32 = 0x884D;
+        const GL_COMPARE_REF_TO_TEXTURE: u32 = 0x884E;
 
         switch (pname) {
             GL_TEXTURE_MIN_FILTER => {
@@ -631,8 +1403,19 @@ pub const TextureManager = struct {
                 tex.params.wrap_t = std.meta.intToEnum(TextureWrap, param) catch return error.InvalidEnum;
                 tex.params_dirty = true;
             },
-            else => {}, // Ignore unknown parameters
+            GL_TEXTURE_COMPARE_MODE => {
+                if (param != 0 and param != GL_COMPARE_REF_TO_TEXTURE) return error.InvalidEnum;
+                tex.params.compare_ref = param == GL_COMPARE_REF_TO_TEXTURE;
+                tex.params_dirty = true;
+            },
+            GL_TEXTURE_COMPARE_FUNC => {
+                if (param < 0x0200 or param > 0x0207) return error.InvalidEnum;
+                tex.params.compare_func = param;
+                tex.params_dirty = true;
+            },
+            else => return, // Ignore unknown parameters
         }
+        self.textures.enqueue(id);
     }
 
     pub fn getTexture(self: *Self, id: TextureId) ?*Texture {
@@ -665,118 +1448,250 @@ pub fn globalTextureManager() *TextureManager {
 
 const webgl_backend = @import("webgl_backend.zig");
 
-/// Upload all dirty textures to the GPU
-/// Call this before rendering to ensure textures are available
-pub fn uploadDirtyTextures() void {
-    const mgr = globalTextureManager();
+pub const UploadStats = struct {
+    uploads: u32 = 0,
+    bytes: usize = 0,
+    /// Textures left queued for a later frame by the byte budget.
+    deferred: u32 = 0,
+    /// Evicted textures whose full image was uploaded again.
+    restores: u32 = 0,
+    /// Textures cut down to their tail to meet the VRAM budget.
+    evictions: u32 = 0,
+};
 
-    for (&mgr.textures.entries) |*entry| {
-        if (!entry.active) continue;
+var g_upload_stats: UploadStats = .{};
 
-        var tex = &entry.texture;
+/// Counters from the most recent uploadDirtyTextures() call.
+pub fn lastUploadStats() UploadStats {
+    return g_upload_stats;
+}
 
-        // Handle image data upload if dirty
-        if (tex.dirty) {
-            log.info("uploadDirtyTextures: found dirty texture {d}x{d}, cpu_blocks={d}", .{ tex.width, tex.height, tex.cpu_block_count });
-            if (tex.width == 0 or tex.height == 0) continue;
-            if (tex.cpu_block_count == 0 or tex.data_len == 0) continue;
+pub const ResidencyStats = struct {
+    gpu_bytes: usize = 0,
+    /// 0 when unlimited
+    budget_bytes: usize = 0,
+    resident: u32 = 0,
+    evicted: u32 = 0,
+    /// Textures whose only copy is on the GPU
+    cpu_released: u32 = 0,
+};
 
-            // Get pixel data from CPU pool
-            const pixels = mgr.textures.cpu_pool.constSlice(.{
-                .block_start = tex.cpu_block_start,
-                .block_count = tex.cpu_block_count,
-                .size = tex.data_len,
-            });
+pub fn residencyStats() ResidencyStats {
+    const table = &globalTextureManager().textures;
+    var stats = ResidencyStats{ .gpu_bytes = table.gpu_bytes, .budget_bytes = table.residency.vram_budget };
+    var it = table.handles.iterator();
+    while (it.next()) |tex| {
+        if (tex.evicted) {
+            stats.evicted += 1;
+        } else if (tex.backend.id != 0) {
+            stats.resident += 1;
+        }
+        if (tex.cpu_released) stats.cpu_released += 1;
+    }
+    return stats;
+}
 
-            // Destroy old backend resources if they exist
-            if (tex.backend_view.id != 0) {
-                webgl_backend.destroyTextureView(tex.backend_view);
-                tex.backend_view = .{};
-            }
-            if (tex.backend.id != 0) {
-                webgl_backend.destroyTextureImage(tex.backend);
-                tex.backend = .{};
-            }
+const UploadResult = enum { done, retry, deferred };
 
-            // Log pixel data info before creating image
-            if (pixels.len >= 16) {
-                log.info("uploadDirtyTextures: pixel data len={d}, all 16 bytes: [{x},{x},{x},{x}] [{x},{x},{x},{x}] [{x},{x},{x},{x}] [{x},{x},{x},{x}]", .{
-                    pixels.len,
-                    pixels[0], pixels[1], pixels[2], pixels[3],
-                    pixels[4], pixels[5], pixels[6], pixels[7],
-                    pixels[8], pixels[9], pixels[10], pixels[11],
-                    pixels[12], pixels[13], pixels[14], pixels[15],
-                });
-            } else if (pixels.len >= 4) {
-                log.info("uploadDirtyTextures: pixel data len={d}, first 4 bytes: {x} {x} {x} {x}", .{
-                    pixels.len,
-                    pixels[0],
-                    pixels[1],
-                    pixels[2],
-                    pixels[3],
-                });
-            }
+/// Upload queued textures to the GPU, oldest first, within the per-frame
+/// byte budget, then evict idle ones over the VRAM budget. Call this before
+/// rendering to ensure textures are available.
+pub fn uploadDirtyTextures() void {
+    const table = &globalTextureManager().textures;
+    var stats = UploadStats{};
+    var keep: u16 = 0;
+    table.frame +%= 1;
+
+    for (table.dirty_queue[0..table.dirty_count]) |index| {
+        const result: UploadResult = if (table.handles.isActive(index))
+            uploadTexture(table, table.handles.at(index), &stats)
+        else
+            .done;
+        if (result == .done) {
+            table.queued[index] = false;
+            continue;
+        }
+        if (result == .deferred) stats.deferred += 1;
+        table.dirty_queue[keep] = index;
+        keep += 1;
+    }
+    table.dirty_count = keep;
+    stats.evictions = table.enforceBudget();
+    g_upload_stats = stats;
+}
 
-            // Use the actual pixel data from CPU pool
-            const img = webgl_backend.createTextureImage(
-                tex.width,
-                tex.height,
-                tex.format,
-                tex.params,
-                pixels,
-            ) catch |err| {
-                log.info("uploadDirtyTextures: FAILED to create image: {s}", .{@errorName(err)});
-                // Failed to create image, leave dirty for retry
-                continue;
-            };
-            tex.backend = img;
-
-            // Create view for binding
-            const view = webgl_backend.createTextureView(img) catch |err| {
-                log.info("uploadDirtyTextures: FAILED to create view: {s}", .{@errorName(err)});
-                // Failed to create view, destroy image and retry later
-                webgl_backend.destroyTextureImage(img);
-                tex.backend = .{};
-                continue;
-            };
-            tex.backend_view = view;
-            log.info("uploadDirtyTextures: successfully uploaded {d}x{d} image_id={d} view_id={d} internal_format={x}", .{ tex.width, tex.height, img.id, view.id, tex.internal_format });
+fn uploadCost(tex: *const Texture) usize {
+    if (!tex.dirty) return 0;
+    if (tex.backend.id != 0 and !tex.realloc) {
+        return @as(usize, tex.dirty_rect.width()) * tex.dirty_rect.height() * bytesPerPixel(tex.format);
+    }
+    return tex.data_len;
+}
+
+fn uploadTexture(table: *TextureTable, tex: *Texture, stats: *UploadStats) UploadResult {
+    // Render targets get an attachment-capable image first; pending CPU
+    // pixels then go into it in place below
+    if (tex.render_target and (tex.backend.id == 0 or tex.realloc)) {
+        if (tex.width == 0 or tex.height == 0) return .done;
+        if (!recreateRenderTarget(table, tex)) return .retry;
+        tex.params_dirty = true;
+        stats.uploads += 1;
+    }
 
-            // Mark as clean
+    if (tex.dirty) {
+        const cost = uploadCost(tex);
+        if (table.upload_budget != 0 and stats.uploads > 0 and stats.bytes + cost > table.upload_budget) {
+            return .deferred;
+        }
+        if (tex.width == 0 or tex.height == 0) return .done;
+        // Nothing to upload until texImage2D supplies storage (and re-queues)
+        const pixels = table.getPixelData(tex.id) orelse return .done;
+
+        // Same size and format: push just the changed rectangle into the
+        // live image instead of recreating it
+        if (tex.backend.id != 0 and !tex.realloc and
+            webgl_backend.updateTextureRegion(tex.backend, tex.format, tex.width, tex.dirty_rect, pixels))
+        {
+            tex.dirty = false;
+            tex.dirty_rect = .{};
+        } else if (tex.render_target) {
+            // Recreating would drop the attachment usage (and what was
+            // drawn); without the in-place path the CPU pixels are lost
+            log.warn("uploadDirtyTextures: cannot patch render target {d}x{d}", .{ tex.width, tex.height });
             tex.dirty = false;
+            tex.dirty_rect = .{};
+        } else {
+            if (tex.evicted) stats.restores += 1;
+            if (!recreateTextureImage(table, tex, pixels)) return .retry;
             // Force sampler refresh when image changes
             tex.params_dirty = true;
+            const residency = table.residency;
+            if (!residency.keep_cpu_copies and residency.vram_budget == 0 and !tex.render_target) {
+                table.releaseCpuCopy(tex);
+            }
         }
+        stats.uploads += 1;
+        stats.bytes += cost;
+    }
 
-        // Handle sampler creation/refresh if params changed
-        if (tex.params_dirty and tex.backend.id != 0) {
-            // Destroy old sampler if it exists
-            if (tex.backend_sampler.id != 0) {
-                webgl_backend.destroyTextureSampler(tex.backend_sampler);
-                tex.backend_sampler = .{};
-            }
+    // Handle sampler creation/refresh if params changed
+    if (tex.params_dirty and tex.backend.id != 0) refreshSampler(tex);
+    return .done;
+}
 
-            // For textures without mipmaps, convert mipmap filters to non-mipmap equivalents
-            // Otherwise GL will error when sampling with mipmap filter on non-mipmapped texture
-            var params = tex.params;
-            params.min_filter = switch (params.min_filter) {
-                .nearest_mipmap_nearest, .nearest_mipmap_linear => .nearest,
-                .linear_mipmap_nearest, .linear_mipmap_linear => .linear,
-                else => params.min_filter,
-            };
+/// Replace the texture's sampler with one for its params and the levels
+/// its GPU image has.
+fn refreshSampler(tex: *Texture) void {
+    // Destroy old sampler if it exists
+    if (tex.backend_sampler.id != 0) {
+        webgl_backend.destroyTextureSampler(tex.backend_sampler);
+        tex.backend_sampler = .{};
+    }
 
-            // Create new sampler with adjusted params
-            tex.backend_sampler = webgl_backend.createTextureSampler(params);
-            log.info("uploadDirtyTextures: created sampler id={d} for texture {d}x{d}, min_filter={d} mag_filter={d}", .{
-                tex.backend_sampler.id,
-                tex.width,
-                tex.height,
-                @intFromEnum(params.min_filter),
-                @intFromEnum(params.mag_filter),
-            });
-            tex.params_dirty = false;
-        }
+    // Mipmap filters only reach the GPU when the image has the levels
+    const levels: u32 = @max(tex.backend_levels, 1);
+    tex.backend_sampler = webgl_backend.createTextureSampler(tex.params, levels);
+    log.debug("uploadDirtyTextures: created sampler id={d} for texture {d}x{d}, levels={d} min_filter={d} mag_filter={d}", .{
+        tex.backend_sampler.id,
+        tex.width,
+        tex.height,
+        levels,
+        @intFromEnum(tex.params.min_filter),
+        @intFromEnum(tex.params.mag_filter),
+    });
+    tex.params_dirty = false;
+}
+
+/// Replace the texture's image and view with new ones holding `pixels`.
+/// Returns false (leaving the texture dirty) if creation fails.
+fn recreateTextureImage(table: *TextureTable, tex: *Texture, pixels: []const u8) bool {
+    // Destroy old backend resources if they exist
+    if (tex.backend_view.id != 0) {
+        webgl_backend.destroyTextureView(tex.backend_view);
+        tex.backend_view = .{};
+    }
+    if (tex.backend.id != 0) {
+        webgl_backend.destroyTextureImage(tex.backend);
+        tex.backend = .{};
+    }
+    table.setGpuBytes(tex, 0);
+
+    // Use the actual pixel data from CPU pool
+    const img = webgl_backend.createTextureImage(
+        tex.width,
+        tex.height,
+        tex.format,
+        tex.params,
+        tex.uploadLevels(),
+        pixels,
+    ) catch |err| {
+        log.warn("uploadDirtyTextures: failed to create image: {s}", .{@errorName(err)});
+        return false;
+    };
+    tex.backend = img;
+
+    // Create view for binding
+    const view = webgl_backend.createTextureView(img) catch |err| {
+        log.warn("uploadDirtyTextures: failed to create view: {s}", .{@errorName(err)});
+        // Destroy image and retry later
+        webgl_backend.destroyTextureImage(img);
+        tex.backend = .{};
+        return false;
+    };
+    tex.backend_view = view;
+    tex.backend_levels = @intCast(tex.uploadLevels());
+    table.setGpuBytes(tex, chainSize(tex.format, tex.width, tex.height, tex.backend_levels));
+    log.debug("uploadDirtyTextures: uploaded {d}x{d} image_id={d} view_id={d} internal_format={x}", .{ tex.width, tex.height, img.id, view.id, tex.internal_format });
+
+    // Mark as clean
+    tex.dirty = false;
+    tex.dirty_rect = .{};
+    tex.realloc = false;
+    tex.evicted = false;
+    return true;
+}
+
+/// Replace the texture's image and view with an empty render target of
+/// its size and format. Returns false (leaving it queued) on failure.
+fn recreateRenderTarget(table: *TextureTable, tex: *Texture) bool {
+    const pixel_format = webgl_backend.renderTargetFormat(tex.format) orelse {
+        // Not renderable; framebuffer completeness rejects it, so keep
+        // the existing image for sampling
+        tex.render_target = false;
+        return true;
+    };
+    if (tex.backend_view.id != 0) {
+        webgl_backend.destroyTextureView(tex.backend_view);
+        tex.backend_view = .{};
+    }
+    if (tex.backend.id != 0) {
+        webgl_backend.destroyTextureImage(tex.backend);
+        tex.backend = .{};
+    }
+    table.setGpuBytes(tex, 0);
+
+    const img = webgl_backend.createRenderTargetImage(tex.width, tex.height, pixel_format, 1) catch |err| {
+        log.warn("uploadDirtyTextures: failed to create render target: {s}", .{@errorName(err)});
+        return false;
+    };
+    const view = webgl_backend.createTextureView(img) catch |err| {
+        log.warn("uploadDirtyTextures: failed to create render target view: {s}", .{@errorName(err)});
+        webgl_backend.destroyTextureImage(img);
+        return false;
+    };
+    tex.backend = img;
+    tex.backend_view = view;
+    tex.backend_levels = 1;
+    table.setGpuBytes(tex, imageSize(tex.format, tex.width, tex.height));
+    tex.realloc = false;
+    tex.evicted = false;
+    // Level 0 of the CPU copy (zeros after texImage2D(null)) is written
+    // into the new image by the in-place path
+    if (tex.cpu_block_count > 0) {
+        tex.dirty = true;
+        tex.dirty_rect = TexRect.full(tex.width, tex.height);
     }
+    return true;
 }
 
 // =============================================================================
@@ -789,15 +1704,15 @@ test "TextureTable alloc and free" {
 
     const id1 = try table.alloc();
     try testing.expect(table.isValid(id1));
-    try testing.expectEqual(@as(u16, 1), table.count);
+    try testing.expectEqual(@as(u16, 1), table.handles.count);
 
     const id2 = try table.alloc();
     try testing.expect(table.isValid(id2));
-    try testing.expectEqual(@as(u16, 2), table.count);
+    try testing.expectEqual(@as(u16, 2), table.handles.count);
 
     try testing.expect(table.free(id1));
     try testing.expect(!table.isValid(id1));
-    try testing.expectEqual(@as(u16, 1), table.count);
+    try testing.expectEqual(@as(u16, 1), table.handles.count);
 
     // id1's slot should be reused with new generation
     const id3 = try table.alloc();
@@ -844,8 +1759,361 @@ test "TextureTable texImage2D stores pixel data" {
     try testing.expectEqualSlices(u8, pixels[0..], data);
 }
 
+test "TextureTable texSubImage2D patches storage and tracks the dirty rect" {
+    var table = TextureTable.init();
+    defer table.reset();
+
+    const id = try table.alloc();
+    try table.texImage2D(id, .texture_2d, 4, 4, .rgba, 0x1908, 0x1401, null);
+    const tex = table.get(id).?;
+    try testing.expect(tex.realloc);
+    tex.dirty = false;
+    tex.dirty_rect = .{};
+    tex.realloc = false;
+
+    const rgb = [_]u8{ 1, 2, 3, 4, 5, 6 }; // 2x1 RGB
+    try table.texSubImage2D(id, 0, 1, 2, 2, 1, .rgb, rgb[0..]);
+    const one = [_]u8{ 9, 9, 9, 9 };
+    try table.texSubImage2D(id, 0, 3, 0, 1, 1, .rgba, one[0..]);
+
+    try testing.expect(tex.dirty);
+    try testing.expect(!tex.realloc);
+    try testing.expectEqual(TexRect{ .x0 = 1, .y0 = 0, .x1 = 4, .y1 = 3 }, tex.dirty_rect);
+
+    const data = table.getPixelData(id).?;
+    const row2 = data[2 * 16 ..][0..16];
+    try testing.expectEqualSlices(u8, &[_]u8{ 0, 0, 0, 0, 1, 2, 3, 255, 4, 5, 6, 255, 0, 0, 0, 0 }, row2);
+    try testing.expectEqualSlices(u8, one[0..], data[12..16]);
+
+    try testing.expectError(error.OutOfRange, table.texSubImage2D(id, 0, 3, 3, 2, 1, .rgba, one[0..]));
+    try testing.expectError(error.FormatMismatch, table.texSubImage2D(id, 0, 0, 0, 1, 1, .alpha, one[0..]));
+
+    // A same-shaped full re-upload reuses the GPU image
+    const full = [_]u8{7} ** 64;
+    try table.texImage2D(id, .texture_2d, 4, 4, .rgba, 0x1908, 0x1401, full[0..]);
+    try testing.expect(!tex.realloc);
+    try testing.expectEqual(TexRect.full(4, 4), tex.dirty_rect);
+}
+
+test "TextureTable stores compressed blocks and patches whole block rows" {
+    var table = TextureTable.init();
+    defer table.reset();
+
+    // 8x6 BC1: 2x2 blocks of 8 bytes, the bottom row partly outside
+    const id = try table.alloc();
+    try table.compressedTexImage2D(id, .texture_2d, 8, 6, .bc1_rgba, null);
+    const tex = table.get(id).?;
+    try testing.expectEqual(@as(u32, 32), tex.data_len);
+    try testing.expectEqual(@as(u32, 0x83F1), tex.internal_format);
+    try testing.expect(tex.realloc);
+    try testing.expectEqual(@as(usize, 32), uploadCost(tex));
+
+    const block = [_]u8{5} ** 8;
+    try table.compressedTexSubImage2D(id, 0, 4, 4, 4, 2, .bc1_rgba, block[0..]);
+    const data = table.getPixelData(id).?;
+    try testing.expectEqualSlices(u8, block[0..], data[24..32]);
+    try testing.expectEqualSlices(u8, &([_]u8{0} ** 24), data[0..24]);
+
+    try testing.expectError(error.Unaligned, table.compressedTexSubImage2D(id, 0, 2, 0, 4, 4, .bc1_rgba, block[0..]));
+    try testing.expectError(error.Unaligned, table.compressedTexSubImage2D(id, 0, 0, 0, 2, 4, .bc1_rgba, block[0..]));
+    try testing.expectError(error.FormatMismatch, table.compressedTexSubImage2D(id, 0, 0, 0, 4, 4, .bc3_rgba, block[0..]));
+    try testing.expectError(error.InvalidEnum, table.compressedTexImage2D(id, .texture_2d, 4, 4, .rgba, null));
+    try testing.expectError(error.InsufficientData, table.compressedTexImage2D(id, .texture_2d, 8, 8, .bc7_rgba, block[0..]));
+}
+
+test "TextureTable generateMipmap packs the chain after level 0" {
+    var table = TextureTable.init();
+    defer table.reset();
+
+    // 4x2 RGBA: levels 4x2, 2x1, 1x1
+    const id = try table.alloc();
+    var pixels: [32]u8 = undefined;
+    for (&pixels, 0..) |*p, i| p.* = @intCast(i * 4);
+    try table.texImage2D(id, .texture_2d, 4, 2, .rgba, 0x1908, 0x1401, pixels[0..]);
+    try table.generateMipmap(id);
+
+    const tex = table.get(id).?;
+    try testing.expectEqual(@as(u8, 3), tex.mip_count);
+    try testing.expectEqual(@as(u32, 3), tex.uploadLevels());
+    try testing.expectEqual(@as(u32, 32 + 8 + 4), tex.data_len);
+    try testing.expect(tex.realloc);
+
+    const data = table.getPixelData(id).?;
+    try testing.expectEqualSlices(u8, pixels[0..], data[0..32]);
+    // Level 1 texel 0 averages texels 0, 1, 4 and 5 of level 0
+    const expected: u8 = @intCast((0 + 16 + 64 + 80 + 2) / 4);
+    try testing.expectEqual(expected, data[32]);
+    try testing.expectEqual(@as(u32, 40), levelOffset(.rgba, 4, 2, 2));
+
+    // Explicit levels must sit where the chain expects them
+    const level1 = [_]u8{9} ** 8;
+    try testing.expectError(error.InvalidLevel, table.texImageLevel(id, 1, 2, 2, .rgba, level1[0..]));
+    try table.texImageLevel(id, 1, 2, 1, .rgba, level1[0..]);
+    try testing.expectEqualSlices(u8, level1[0..], table.getPixelData(id).?[32..40]);
+
+    // Redefining level 0 at a new size drops the chain
+    try table.texImage2D(id, .texture_2d, 8, 8, .rgba, 0x1908, 0x1401, null);
+    try testing.expectEqual(@as(u8, 1), tex.mip_count);
+    try testing.expectEqual(@as(u32, 1), tex.uploadLevels());
+}
+
+test "Mip downsample vector path matches the scalar box filter" {
+    // 34x3 single-channel: one 16-texel vector chunk plus a scalar tail;
+    // the odd third row falls outside the 17x1 result
+    const w = 34;
+    const h = 3;
+    var src: [w * h]u8 = undefined;
+    for (&src, 0..) |*p, i| p.* = @truncate(i * 37 + 11);
+    var dst: [17 * 1]u8 = undefined;
+    downsample(dst[0..], src[0..], w, h, 1);
+    for (0..17) |x| {
+        const sum = @as(u32, src[2 * x]) + src[2 * x + 1] + src[w + 2 * x] + src[w + 2 * x + 1];
+        try testing.expectEqual(@as(u8, @intCast((sum + 2) / 4)), dst[x]);
+    }
+}
+
+test "Texture dirty queue holds each slot once and drops freed textures" {
+    const mgr = globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    const a = try mgr.createTexture();
+    const b = try mgr.createTexture();
+    try mgr.bindTexture(.texture_2d, a);
+    try mgr.texImage2D(.texture_2d, 2, 2, .rgba, 0x1908, 0x1401, null);
+    const px = [_]u8{1} ** 4;
+    try mgr.texSubImage2D(.texture_2d, 0, 1, 1, 1, 1, .rgba, px[0..]);
+    try mgr.texParameteri(.texture_2d, 0x2801, 0x2600);
+    try testing.expectEqual(@as(u16, 1), mgr.textures.dirty_count);
+
+    try mgr.bindTexture(.texture_2d, b);
+    try mgr.texParameteri(.texture_2d, 0x2800, 0x2600);
+    try testing.expectEqual(@as(u16, 2), mgr.textures.dirty_count);
+    try testing.expectEqual(a.index, mgr.textures.dirty_queue[0]);
+
+    // Freed and reallocated before the flush: still one queue slot
+    try testing.expect(mgr.deleteTexture(a));
+    const c = try mgr.createTexture();
+    try testing.expectEqual(a.index, c.index);
+    try mgr.bindTexture(.texture_2d, c);
+    try mgr.texParameteri(.texture_2d, 0x2801, 0x2600);
+    try testing.expectEqual(@as(u16, 2), mgr.textures.dirty_count);
+
+    // Without an image nothing needs the GPU, so the queue drains
+    try testing.expect(mgr.deleteTexture(b));
+    try testing.expect(mgr.deleteTexture(c));
+    uploadDirtyTextures();
+    try testing.expectEqual(@as(u16, 0), mgr.textures.dirty_count);
+    try testing.expectEqual(@as(u32, 0), lastUploadStats().uploads);
+}
+
+test "Render target textures keep one level and queue a recreate" {
+    const mgr = globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+
+    const id = try mgr.createTexture();
+    try mgr.bindTexture(.texture_2d, id);
+    try mgr.texImage2D(.texture_2d, 4, 4, .rgba, 0x1908, 0x1401, null);
+    try mgr.textures.markRenderTarget(id);
+    try mgr.textures.markRenderTarget(id);
+    try testing.expectEqual(@as(u16, 1), mgr.textures.dirty_count);
+    const tex = mgr.getTexture(id).?;
+    try testing.expect(tex.render_target and tex.realloc);
+
+    try mgr.generateMipmap(.texture_2d);
+    try testing.expectEqual(@as(u16, 1), tex.level_mask);
+    try mgr.texParameteri(.texture_2d, 0x884C, 0x884E);
+    try mgr.texParameteri(.texture_2d, 0x884D, 0x0201);
+    try testing.expect(tex.params.compare_ref);
+    try testing.expectEqual(@as(u32, 0x0201), tex.params.compare_func);
+}
+
+test "Residency picks the least recently drawn idle texture and touch streams it back" {
+    const mgr = globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+    const table = &mgr.textures;
+
+    var ids: [3]TextureId = undefined;
+    for (&ids) |*id| {
+        id.* = try mgr.createTexture();
+        try mgr.bindTexture(.texture_2d, id.*);
+        try mgr.texImage2D(.texture_2d, 128, 128, .rgba, 0x1908, 0x1401, null);
+    }
+    const small = try mgr.createTexture();
+    try mgr.bindTexture(.texture_2d, small);
+    try mgr.texImage2D(.texture_2d, EvictedExtent, EvictedExtent, .rgba, 0x1908, 0x1401, null);
+
+    // Stand in for the uploads, which need a GPU
+    for (ids ++ [_]TextureId{small}) |id| {
+        const tex = table.get(id).?;
+        tex.dirty = false;
+        tex.backend.id = 1;
+    }
+    @memset(table.queued, false);
+    table.dirty_count = 0;
+    defer for (ids ++ [_]TextureId{small}) |id| {
+        table.get(id).?.backend.id = 0;
+    };
+
+    table.frame = 10;
+    table.touch(table.get(ids[0]).?);
+    try testing.expect(table.leastRecentlyUsed() == null);
+    table.frame = 10 + EvictIdlePasses;
+    table.touch(table.get(ids[1]).?);
+    // ids[0] has been idle just long enough, ids[2] longer; the small
+    // texture has no tail to shrink to
+    try testing.expectEqual(ids[2], table.leastRecentlyUsed().?.id);
+
+    const tex = table.get(ids[2]).?;
+    tex.evicted = true;
+    try testing.expectEqual(ids[0], table.leastRecentlyUsed().?.id);
+    table.touch(tex);
+    try testing.expect(tex.dirty and tex.realloc);
+    try testing.expect(table.queued[ids[2].index]);
+    try testing.expectEqual(@as(u16, 1), table.dirty_count);
+}
+
+test "Eviction filters the smallest level down to a 64-texel tail" {
+    var table = TextureTable.init();
+    defer table.reset();
+
+    // 256x128 single-channel: two halvings reach 64x32
+    const id = try table.alloc();
+    const pixels = try testing.allocator.alloc(u8, 256 * 128);
+    defer testing.allocator.free(pixels);
+    for (pixels, 0..) |*p, i| p.* = @truncate(i * 7 + i / 256);
+    try table.texImage2D(id, .texture_2d, 256, 128, .luminance, 0x1909, 0x1401, pixels);
+    const used = table.cpu_pool.stats().used_blocks;
+
+    const filtered = try table.filterTail(table.get(id).?, 0, 2);
+    var half: [128 * 64]u8 = undefined;
+    var quarter: [64 * 32]u8 = undefined;
+    downsample(&half, pixels, 256, 128, 1);
+    downsample(&quarter, &half, 128, 64, 1);
+    try testing.expectEqualSlices(u8, &quarter, filtered.pixels);
+    try testing.expectEqualSlices(u8, pixels, table.getPixelData(id).?);
+    table.cpu_pool.free(filtered.scratch);
+    try testing.expectEqual(used, table.cpu_pool.stats().used_blocks);
+}
+
+test "Budget enforcement evicts idle textures to their tails and tracks GPU bytes" {
+    const mgr = globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+    const table = &mgr.textures;
+    const saved = table.residency;
+    defer table.setResidency(saved);
+    // Idle time counts from creation
+    table.frame = 0;
+
+    var ids: [3]TextureId = undefined;
+    for (&ids) |*id| {
+        id.* = try mgr.createTexture();
+        try mgr.bindTexture(.texture_2d, id.*);
+        try mgr.texImage2D(.texture_2d, 128, 128, .rgba, 0x1908, 0x1401, null);
+    }
+    // ids[2] stores its whole chain, so its tail is levels 1.. as stored
+    try mgr.generateMipmap(.texture_2d);
+
+    // Stand in for the uploads, which need a GPU
+    for (ids) |id| {
+        const tex = table.get(id).?;
+        tex.dirty = false;
+        tex.realloc = false;
+        tex.backend.id = 1;
+        tex.backend_levels = @intCast(tex.uploadLevels());
+        table.setGpuBytes(tex, chainSize(tex.format, tex.width, tex.height, tex.backend_levels));
+    }
+    @memset(table.queued, false);
+    table.dirty_count = 0;
+    defer for (ids) |id| {
+        if (table.get(id)) |tex| tex.backend.id = 0;
+    };
+    const full = imageSize(.rgba, 128, 128);
+    try testing.expectEqual(@as(usize, 2 * full + chainSize(.rgba, 128, 128, 8)), table.gpu_bytes);
+
+    table.frame = EvictIdlePasses;
+    table.touch(table.get(ids[0]).?);
+    table.setResidency(.{});
+    try testing.expectEqual(@as(u32, 0), table.enforceBudget());
+
+    // ids[0] was just drawn; the other two go
+    table.setResidency(.{ .vram_budget = 1 });
+    try testing.expectEqual(@as(u32, 2), table.enforceBudget());
+    const filtered = table.get(ids[1]).?;
+    try testing.expect(filtered.evicted and filtered.realloc);
+    try testing.expectEqual(@as(u8, 1), filtered.backend_levels);
+    try testing.expectEqual(imageSize(.rgba, 64, 64), filtered.gpu_bytes);
+    const stored = table.get(ids[2]).?;
+    try testing.expect(stored.evicted);
+    try testing.expectEqual(@as(u8, 7), stored.backend_levels);
+    try testing.expectEqual(chainSize(.rgba, 64, 64, 7), stored.gpu_bytes);
+    try testing.expectEqual(@as(usize, full + filtered.gpu_bytes + stored.gpu_bytes), table.gpu_bytes);
+    try testing.expect(!table.get(ids[0]).?.evicted);
+    // Still over budget, but nothing idle is left
+    try testing.expectEqual(@as(u32, 0), table.enforceBudget());
+
+    try testing.expect(mgr.deleteTexture(ids[1]));
+    try testing.expectEqual(@as(usize, full + stored.gpu_bytes), table.gpu_bytes);
+}
+
+test "Released textures take level 0 writes on the GPU only" {
+    const mgr = globalTextureManager();
+    mgr.reset();
+    defer mgr.reset();
+    const table = &mgr.textures;
+    const saved = table.residency;
+    defer table.setResidency(saved);
+    table.setResidency(.{ .keep_cpu_copies = false });
+
+    const id = try mgr.createTexture();
+    try mgr.bindTexture(.texture_2d, id);
+    try mgr.texImage2D(.texture_2d, 4, 4, .rgba, 0x1908, 0x1401, null);
+    const tex = table.get(id).?;
+    const used = table.cpu_pool.stats().used_blocks;
+
+    // What uploadTexture does after an upload under this policy
+    tex.dirty = false;
+    tex.realloc = false;
+    tex.backend.id = 1;
+    tex.backend_levels = 1;
+    defer tex.backend.id = 0;
+    table.releaseCpuCopy(tex);
+    try testing.expect(tex.cpu_released);
+    try testing.expect(table.getPixelData(id) == null);
+    try testing.expect(table.cpu_pool.stats().used_blocks < used);
+
+    const rgba = [_]u8{7} ** (2 * 2 * 4);
+    const rgb = [_]u8{7} ** (2 * 2 * 3);
+    try testing.expectError(error.NoStorage, table.texSubImage2D(id, 1, 0, 0, 1, 1, .rgba, &rgba));
+    try testing.expectError(error.FormatMismatch, table.texSubImage2D(id, 0, 0, 0, 2, 2, .luminance, &rgba));
+    try testing.expectError(error.OutOfRange, table.texSubImage2D(id, 0, 3, 0, 2, 2, .rgba, &rgba));
+    try testing.expectError(error.InsufficientData, table.texSubImage2D(id, 0, 0, 0, 2, 2, .rgba, rgba[0..8]));
+    try table.texSubImage2D(id, 0, 0, 0, 0, 0, .rgba, &rgba);
+    // Without direct GL the writes fail, and the RGB scratch goes back
+    const released_used = table.cpu_pool.stats().used_blocks;
+    try testing.expectError(error.NoStorage, table.texSubImage2D(id, 0, 1, 1, 2, 2, .rgba, &rgba));
+    try testing.expectError(error.NoStorage, table.texSubImage2D(id, 0, 1, 1, 2, 2, .rgb, &rgb));
+    try testing.expectEqual(released_used, table.cpu_pool.stats().used_blocks);
+    try testing.expect(tex.cpu_released and !tex.dirty);
+
+    // Mipmaps are filtered on the GPU, which needs the levels there
+    try testing.expectError(error.NoStorage, mgr.generateMipmap(.texture_2d));
+    tex.backend_levels = 3;
+    try testing.expectError(error.NoStorage, mgr.generateMipmap(.texture_2d));
+    try testing.expect(tex.cpu_released);
+    try testing.expectEqual(@as(u16, 1), tex.level_mask);
+
+    // Redefining level 0 brings a CPU copy back
+    try mgr.texImage2D(.texture_2d, 4, 4, .rgba, 0x1908, 0x1401, null);
+    try testing.expect(!tex.cpu_released);
+    try testing.expect(table.getPixelData(id) != null);
+}
+
 test "CpuTexturePool alloc and free" {
-    // Use global pool to avoid 64 MB stack allocation
+    // Use global pool to avoid reserving a second 64 MB pool
     var pool = &g_cpu_pool;
     pool.reset();
 